@@ -42,7 +42,7 @@ UPDATE_METHOD = afs
 # A list of the test programs you want compiled in from the user/progs
 # directory.
 #
-STUDENTTESTS = 
+STUDENTTESTS = prof schedtrace bench bench_nop
 
 ###########################################################################
 # Data files provided by course staff to build into the RAM disk
@@ -63,7 +63,7 @@ STUDENTFILES =
 ###########################################################################
 # Object files for your thread library
 ###########################################################################
-THREAD_OBJS = malloc.o panic.o condvar.o mutex.o p2thread.o p2thrlist.o spawn_thread.o mutex_asm.o list.o semaphore.o rwlock.o exception.o
+THREAD_OBJS = malloc.o panic.o condvar.o mutex.o p2thread.o p2thrhash.o p2thrlist.o spawn_thread.o mutex_asm.o list.o semaphore.o rwlock.o exception.o seqlock.o
 
 # Thread Group Library Support.
 #
@@ -76,7 +76,7 @@ THREAD_OBJS = malloc.o panic.o condvar.o mutex.o p2thread.o p2thrlist.o spawn_th
 ###########################################################################
 # Object files for your syscall wrappers
 ###########################################################################
-SYSCALL_OBJS = syscall.o gettid.o exec.o fork.o yield.o sleep.o make_runnable.o deschedule.o get_ticks.o vanish.o wait.o set_status.o new_pages.o remove_pages.o getchar.o readline.o print.o set_term_color.o get_cursor_pos.o set_cursor_pos.o halt.o swexn.o thread_fork.o readfile.o
+SYSCALL_OBJS = syscall.o sysenter.o gettid.o exec.o fork.o spawn.o yield.o sleep.o usleep.o get_time_ns.o set_nice.o make_runnable.o make_runnable_many.o deschedule.o get_ticks.o vanish.o wait.o set_status.o new_pages.o remove_pages.o shm_create.o shm_attach.o shm_detach.o map_file.o memstat.o set_frame_limit.o getchar.o readline.o print.o set_term_color.o get_cursor_pos.o set_cursor_pos.o halt.o swexn.o thread_fork.o readfile.o kstat.o futex_wait.o futex_wake.o sysring_enter.o profile.o sched_trace.o pipe_create.o pipe_write.o pipe_read.o pipe_close.o ipc_call.o ipc_receive.o ipc_reply.o ipc_reply_wait.o set_deadline.o getrusage.o
 
 ###########################################################################
 # Object files for your automatic stack handling
@@ -93,14 +93,14 @@ AUTOSTACK_OBJS = autostack.o
 #
 # Kernel object files you provide in from kern/
 #
-KERNEL_OBJS = kernel.o malloc_wrappers.o
-KERNEL_OBJS += context/child_stack.o context/context.o context/launch.o context/stack.o
-KERNEL_OBJS += drivers/console.o drivers/drivers.o drivers/int_wrappers.o drivers/keyboard.o drivers/timer.o
+KERNEL_OBJS = kernel.o malloc_wrappers.o smp_glue.o
+KERNEL_OBJS += context/child_stack.o context/context.o context/fpu.o context/launch.o context/stack.o
+KERNEL_OBJS += drivers/boottime.o drivers/clock.o drivers/conring.o drivers/console.o drivers/drivers.o drivers/int_wrappers.o drivers/keyboard.o drivers/lapic.o drivers/prof.o drivers/serial.o drivers/timeout.o drivers/timer.o
 KERNEL_OBJS += handlers/exception.o handlers/handlers.o handlers/interrupts.o handlers/panic.o
-KERNEL_OBJS += lock/condvar.o lock/mutex.o lock/mutex_asm.o lock/rwlock.o
-KERNEL_OBJS += prog/process.o prog/thread.o prog/thrhash.o prog/thrlist.o
-KERNEL_OBJS += syscall/syscall.o syscall/syshelper.o syscall/drivers.o syscall/drivers_wrappers.o syscall/lifecycle.o syscall/lifecycle_wrappers.o syscall/management.o syscall/management_wrappers.o syscall/misc.o syscall/misc_wrappers.o syscall/paging.o syscall/paging_wrappers.o
-KERNEL_OBJS += vm/frame.o vm/page.o
+KERNEL_OBJS += lock/condvar.o lock/futex.o lock/lockstat.o lock/mutex.o lock/mutex_asm.o lock/pcrwlock.o lock/rwlock.o lock/seqlock.o lock/spinlock.o
+KERNEL_OBJS += prog/cpu.o prog/edf.o prog/cputime.o prog/kthread.o prog/message.o prog/process.o prog/reaper.o prog/recring.o prog/sched.o prog/thread.o prog/thrhash.o prog/thrlist.o prog/trace.o
+KERNEL_OBJS += syscall/syscall.o syscall/syshelper.o syscall/drivers.o syscall/drivers_wrappers.o syscall/lifecycle.o syscall/lifecycle_wrappers.o syscall/management.o syscall/management_wrappers.o syscall/misc.o syscall/misc_wrappers.o syscall/paging.o syscall/paging_wrappers.o syscall/sysenter_wrappers.o syscall/sysstat.o syscall/usercopy.o syscall/usercopy_asm.o
+KERNEL_OBJS += vm/filemap.o vm/frame.o vm/growstack.o vm/image.o vm/ksm.o vm/lazy.o vm/objcache.o vm/page.o vm/pageops.o vm/pipe.o vm/ptpool.o vm/scanset.o vm/quota.o vm/reclaim.o vm/region.o vm/shm.o vm/slab.o vm/tlb.o vm/vdso.o vm/wss.o
 
 ###########################################################################
 # WARNING: Do not put **test** programs into the REQPROGS variables.  Your
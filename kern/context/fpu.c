@@ -0,0 +1,241 @@
+/**
+ * @file fpu.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Lazy switching of the FPU and SSE state
+ *
+ * context_switch only saves the general purpose registers. The FPU, MMX and
+ * SSE registers of a thread are kept in a state area of its own, saved with
+ * fxsave and restored with fxrstor, which it only gets the first time it
+ * uses the FPU. The threads which never touch it pay nothing.
+ *
+ * Each CPU knows the thread whose state is in its registers, its owner. A
+ * switch sets CR0.TS unless the thread switched to is the owner, so that its
+ * first FPU instruction raises a #NM fault (@see _nofpu_handler). The
+ * handler saves the registers of the previous owner, loads those of the
+ * thread and makes it the owner.
+ *
+ * With a single CPU the registers of the owner stay there while other
+ * threads run, and are only saved when another thread uses the FPU. With
+ * several CPUs a thread can run next on another CPU, so the owner saves its
+ * registers when it is switched out. The restore stays lazy.
+ *
+ * The kernel itself never uses the FPU.
+ *
+ * @bugs No known bugs
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/cr.h>
+#include <errors.h>
+#include <ureg.h>
+#include <spinlock.h>
+#include <objcache.h>
+#include <interrupts.h>
+#include <cpu.h>
+#include <fpu.h>
+
+#ifndef CR0_MP
+#define CR0_MP 0x00000002
+#endif
+#ifndef CR0_EM
+#define CR0_EM 0x00000004
+#endif
+#ifndef CR0_TS
+#define CR0_TS 0x00000008
+#endif
+#ifndef CR0_NE
+#define CR0_NE 0x00000020
+#endif
+#ifndef CR4_OSFXSR
+#define CR4_OSFXSR 0x00000200
+#endif
+#ifndef CR4_OSXMMEXCPT
+#define CR4_OSXMMEXCPT 0x00000400
+#endif
+
+/* The feature bits of cpuid we need, in edx */
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+/* Offsets of the control words in the area, @see fxsave */
+#define FXSAVE_FCW 0
+#define FXSAVE_MXCSR 24
+
+/* The free state areas */
+static objcache_t fpu_cache;
+
+/* Whether the FPU can be handed out, checked by the bootstrap processor */
+static boolean_t fpu_usable = FALSE;
+
+static inline void clts(void) {
+	asm volatile ("clts");
+}
+
+static inline void stts(void) {
+	set_cr0(get_cr0() | CR0_TS);
+}
+
+static inline void fxsave(void *area) {
+	asm volatile ("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static inline void fxrstor(void *area) {
+	asm volatile ("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
+/**
+ * @brief Initializes the cache of state areas
+ */
+void fpu_init(void) {
+	objcache_init(&fpu_cache, "fpu", FPU_STATE_SIZE, FPU_STATE_ALIGN,
+			FPU_CACHE_SIZE, NULL);
+}
+
+/**
+ * @brief Enables the FPU and SSE on the calling CPU, with CR0.TS set
+ *
+ * Called once on each CPU by cpu_init. Without fxsave the FPU stays
+ * emulated, so that using it faults as it always did.
+ */
+void fpu_cpu_init(void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+	this_cpu()->fpu_owner = NULL;
+
+	if (!(edx & CPUID_FXSR)) {
+		set_cr0(get_cr0() | CR0_EM);
+		return;
+	}
+
+	set_cr0((get_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+	uint32_t cr4 = get_cr4() | CR4_OSFXSR;
+	if (edx & CPUID_SSE) cr4 |= CR4_OSXMMEXCPT;
+	set_cr4(cr4);
+
+	if (this_cpu()->id == 0) fpu_usable = TRUE;
+}
+
+/**
+ * @brief Hands the FPU over on a context switch, called by stack_switch
+ * with interrupts off
+ *
+ * @param self the thread being switched out
+ * @param other the thread to be executed shortly
+ */
+void fpu_switch(thread_t *self, thread_t *other) {
+	cpu_t *cpu = this_cpu();
+
+	// The registers can't stay behind if the thread moves to another CPU
+	if (num_cpus() > 1 && cpu->fpu_owner == self) {
+		fxsave(self->fpu_state);
+		cpu->fpu_owner = NULL;
+	}
+
+	if (cpu->fpu_owner != NULL && cpu->fpu_owner == other) clts();
+	else if (!(get_cr0() & CR0_TS)) stts();
+}
+
+/**
+ * @brief Returns a state area as after fninit
+ */
+static void *fpu_alloc(void) {
+	uint8_t *area = objcache_alloc(&fpu_cache);
+	if (area == NULL) return NULL;
+
+	memset(area, 0, FPU_STATE_SIZE);
+	*(uint16_t *) (area + FXSAVE_FCW) = FPU_INIT_FCW;
+	*(uint32_t *) (area + FXSAVE_MXCSR) = FPU_INIT_MXCSR;
+	return area;
+}
+
+/**
+ * @brief Gives the FPU to the calling thread on its first use since it was
+ * switched in
+ *
+ * The state area is allocated before interrupts are disabled, since the
+ * cache may block. The thread can be switched out meanwhile, it faults again
+ * on its return if so.
+ *
+ * @param frame the eip, cs and eflags pushed by the fault
+ */
+void _nofpu_handler(uint32_t *frame) {
+	uint32_t cs = frame[1];
+	thread_t *self = get_self();
+
+	if ((cs & 0x3) == 0)
+		kernel_panic("Exception in thread %d: FPU used by the kernel",
+				self->tid);
+
+	if (!fpu_usable) {
+		_exception_handler(SWEXN_CAUSE_NOFPU, cs);
+		return;
+	}
+
+	if (self->fpu_state == NULL) {
+		self->fpu_state = fpu_alloc();
+		if (self->fpu_state == NULL) {
+			_exception_handler(SWEXN_CAUSE_NOFPU, cs);
+			return;
+		}
+	}
+
+	uint32_t eflags = save_disable_interrupts();
+	cpu_t *cpu = this_cpu();
+	clts();
+	if (cpu->fpu_owner != self) {
+		if (cpu->fpu_owner != NULL) fxsave(cpu->fpu_owner->fpu_state);
+		fxrstor(self->fpu_state);
+		cpu->fpu_owner = self;
+	}
+	restore_interrupts(eflags);
+}
+
+/**
+ * @brief Gives a new thread a copy of the FPU state of another, on fork and
+ * thread_fork
+ *
+ * @param thread the new thread, which has no state yet
+ * @param target the calling thread, which it is copied from
+ * @return 0 on success, a negative error code otherwise
+ */
+int fpu_copy(thread_t *thread, thread_t *target) {
+	if (target->fpu_state == NULL) return 0;
+
+	void *area = objcache_alloc(&fpu_cache);
+	if (area == NULL) return ERR_MALLOC_FAIL;
+
+	// Its registers may be newer than its area
+	uint32_t eflags = save_disable_interrupts();
+	if (this_cpu()->fpu_owner == target) fxsave(target->fpu_state);
+	memcpy(area, target->fpu_state, FPU_STATE_SIZE);
+	restore_interrupts(eflags);
+
+	thread->fpu_state = area;
+	return 0;
+}
+
+/**
+ * @brief Forgets the FPU state of a thread, on exec or once it is dead
+ *
+ * @param thread the thread, either the caller or a thread which won't run
+ * anymore
+ */
+void fpu_drop(thread_t *thread) {
+	if (thread->fpu_state == NULL) return;
+
+	uint32_t eflags = save_disable_interrupts();
+	int i;
+	for (i = 0; i < num_cpus(); ++i) {
+		cpu_t *cpu = get_cpu(i);
+		if (cpu->fpu_owner == thread) cpu->fpu_owner = NULL;
+	}
+	if (thread == get_self()) stts();
+	restore_interrupts(eflags);
+
+	objcache_free(&fpu_cache, thread->fpu_state);
+	thread->fpu_state = NULL;
+}
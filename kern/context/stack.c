@@ -9,7 +9,9 @@
 #include <types.h>
 #include <thread.h>
 #include <context.h>
+#include <fpu.h>
 #include <simics.h>
+#include <trace.h>
 
 /**
  * @brief Switches the stack pointer to a new thread
@@ -36,6 +38,52 @@ unsigned int stack_switch(thread_t *self, thread_t *other,
 		unsigned int esp) {
 
 	self->esp = esp;
+	fpu_switch(self, other);
+	trace_switch(self, other);
 	return other->esp;
 }
 
+
+/**
+ * @brief Constructs the kernel stack of a thread starting in the kernel
+ *
+ * Unlike child_stack, the new thread does not leave the kernel as if
+ * returning from a system call. The first context_switch to it returns to
+ * entry, called with arg, which must never return. entry is typically in
+ * charge of building the user context and calling launch.
+ *
+ * This is the stack we build, right below esp0 :
+ *
+ * 	+ ------------- +
+ * 	|      arg		| <-- esp0, the argument of entry
+ * 	+ ------------- +
+ * 	|     self		| <-- for set_running, then the return address of entry
+ * 	+ ------------- +
+ * 	|     entry		|
+ * 	+ ------------- +
+ * 	|       0		| <-- the old ebp
+ * 	+ ------------- +
+ * 	|				|
+ * 	|     PUSHA		|
+ * 	|				|
+ * 	+ ------------- + <-- esp
+ *
+ * @param thread the thread whose stack we build
+ * @param entry the kernel function the thread starts in
+ * @param arg the argument given to entry
+ */
+void entry_stack(thread_t *thread, void (*entry)(void *), void *arg) {
+	uint32_t *top = (uint32_t *) thread->esp0;
+
+	top[0] = (uint32_t) arg;
+	top[-1] = (uint32_t) thread;
+	top[-2] = (uint32_t) entry;
+	top[-3] = 0;
+
+	// The order is eax, ecx, edx, ebx, esp, ebp, esi, edi
+	int i;
+	for (i = 4; i <= 11; ++i) top[-i] = 0;
+	top[-9] = (uint32_t) &top[-3];	// ebp points to the old ebp
+
+	thread->esp = (uint32_t) &top[-11];
+}
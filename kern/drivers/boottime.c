@@ -0,0 +1,104 @@
+/**
+ * @file boottime.c
+ * @brief The timeline of the boot, kept by the time stamp counter
+ *
+ * kernel_main reads the TSC on entry, then at the end of each phase of the
+ * boot, up to the first user instruction of god, idle and init (@see
+ * _exec). Each phase is marked once, by the first CPU to reach its end.
+ * Once init runs the timeline is complete, and goes to the log on the
+ * serial port in a single line, in microseconds; kstat(KSTAT_BOOT) copies it
+ * out in cycles.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <clock.h>
+#include <serial.h>
+#include <spinlock.h>
+#include <boottime.h>
+
+/* The TSC on entry of the kernel */
+static uint64_t boot_origin = 0;
+/* The cycles from boot_origin to the end of each phase, 0 until it ends */
+static uint64_t boot_end[KSTAT_BOOT_PHASES];
+/* Protects boot_end, the user programs may start on several CPUs */
+static spinlock_t boot_lock;
+
+/**
+ * @brief Returns the microseconds in a number of cycles of the TSC
+ */
+static unsigned int boot_usecs(uint64_t cycles) {
+	uint32_t khz = clock_tsc_khz();
+	if (khz == 0) return 0;
+	return div64_32(cycles * 1000, khz, NULL);
+}
+
+/**
+ * @brief Logs the timeline, once every phase ended
+ */
+static void boot_log(void) {
+	klog("boot: map %uus frames %uus paging %uus threads %uus "
+		"syscalls %uus handlers %uus god %uus | user god %uus "
+		"idle %uus init %uus",
+		boot_usecs(boot_end[KSTAT_BOOT_KERNEL_MAP]),
+		boot_usecs(boot_end[KSTAT_BOOT_FRAMES]),
+		boot_usecs(boot_end[KSTAT_BOOT_PAGING]),
+		boot_usecs(boot_end[KSTAT_BOOT_THREADS]),
+		boot_usecs(boot_end[KSTAT_BOOT_SYSCALLS]),
+		boot_usecs(boot_end[KSTAT_BOOT_HANDLERS]),
+		boot_usecs(boot_end[KSTAT_BOOT_GOD]),
+		boot_usecs(boot_end[KSTAT_BOOT_USER_GOD]),
+		boot_usecs(boot_end[KSTAT_BOOT_USER_IDLE]),
+		boot_usecs(boot_end[KSTAT_BOOT_USER_INIT]));
+}
+
+/**
+ * @brief Starts the timeline, first thing on entry of the kernel
+ */
+void boot_start(void) {
+	spin_init(&boot_lock);
+	boot_origin = rdtsc();
+}
+
+/**
+ * @brief Marks the end of a phase of the boot, if it is the first time
+ *
+ * @param phase one of the KSTAT_BOOT_* phases
+ */
+void boot_mark(int phase) {
+	if (phase < 0 || phase >= KSTAT_BOOT_PHASES) return;
+
+	uint64_t now = rdtsc() - boot_origin;
+	if (now == 0) now = 1;
+
+	spin_lock_irqsave(&boot_lock);
+	if (boot_end[phase] != 0) {
+		spin_unlock_irqrestore(&boot_lock);
+		return;
+	}
+	boot_end[phase] = now;
+
+	int i;
+	for (i = 0; i < KSTAT_BOOT_PHASES && boot_end[i] != 0; i++) continue;
+	spin_unlock_irqrestore(&boot_lock);
+
+	// We completed it
+	if (i == KSTAT_BOOT_PHASES) boot_log();
+}
+
+/**
+ * @brief Copies the timeline
+ *
+ * @param stats where to copy it
+ */
+void boot_stats(kstat_boot_t *stats) {
+	stats->tsc_khz = clock_tsc_khz();
+	stats->unused = 0;
+
+	spin_lock_irqsave(&boot_lock);
+	int i;
+	for (i = 0; i < KSTAT_BOOT_PHASES; i++) stats->end[i] = boot_end[i];
+	spin_unlock_irqrestore(&boot_lock);
+}
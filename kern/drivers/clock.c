@@ -0,0 +1,135 @@
+/**
+ * @file clock.c
+ * @brief The high resolution clock, kept by the time stamp counter
+ *
+ * The ticks of the PIT (@see timer.c) only tell the time to the tick. The
+ * TSC of the processor counts its cycles: once we know how many it counts
+ * in a millisecond, it tells the time to the nanosecond. At boot, before the
+ * ticks start, we count the cycles during CLOCK_CALIBRATE_MS milliseconds
+ * measured by the channel 2 of the PIT, the one of the speaker, whose output
+ * we can poll.
+ *
+ * The TSCs of the CPUs are assumed to run at the same rate and to have been
+ * started together. Without a TSC, the clock falls back to the ticks.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <x86/asm.h>
+#include <x86/timer_defines.h>
+#include <drivers.h>
+#include <clock.h>
+
+/* The cpuid feature bit of the TSC, in edx */
+#define CPUID_TSC (1 << 4)
+
+/* The counter of channel 2 of the PIT */
+#define PIT_CH2_PORT 0x42
+/* Channel 2, low then high byte of the count, interrupt on terminal count */
+#define PIT_CH2_ONE_SHOT 0xB0
+/* The port gating channel 2, and feeding back its output */
+#define PIT_GATE_PORT 0x61
+#define PIT_GATE_CH2 0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_CH2_OUT 0x20
+
+/* Cycles of the TSC in a millisecond, 0 if there is no TSC */
+static uint32_t tsc_khz = 0;
+/* The TSC at the end of the calibration, the origin of the clock */
+static uint64_t tsc_origin = 0;
+
+/**
+ * @brief Divides a 64 bits number by a 32 bits one
+ *
+ * The kernel isn't linked with the helpers gcc calls for 64 bits divisions,
+ * this does it with two divl.
+ *
+ * @param n the dividend
+ * @param d the divisor, not 0
+ * @param rem where to put the remainder, may be NULL
+ * @return the quotient
+ */
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t *rem) {
+	uint32_t high = n >> 32;
+	uint32_t low = n;
+	uint32_t qhigh = high / d;
+	high %= d;
+
+	uint32_t qlow, r;
+	asm ("divl %4" : "=a" (qlow), "=d" (r) : "a" (low), "d" (high), "rm" (d));
+
+	if (rem != NULL) *rem = r;
+	return ((uint64_t) qhigh << 32) | qlow;
+}
+
+/* The gate of channel 2 before clock_pit_start */
+static uint8_t saved_gate;
+
+/**
+ * @brief Starts the channel 2 of the PIT on a count of ms milliseconds, at
+ * most 54, for clock_pit_wait to wait for
+ *
+ * This is how the clock and the local APIC timer are calibrated. Interrupts
+ * must be off.
+ */
+void clock_pit_start(unsigned int ms) {
+	uint16_t count = (TIMER_RATE / 1000) * ms;
+
+	// Gate channel 2 on, with the speaker off
+	saved_gate = inb(PIT_GATE_PORT);
+	outb(PIT_GATE_PORT, (saved_gate & ~PIT_GATE_SPEAKER) | PIT_GATE_CH2);
+
+	outb(TIMER_MODE_IO_PORT, PIT_CH2_ONE_SHOT);
+	outb(PIT_CH2_PORT, count & 0xFF);
+	outb(PIT_CH2_PORT, count >> 8);
+}
+
+/**
+ * @brief Waits for the end of the count of clock_pit_start
+ */
+void clock_pit_wait(void) {
+	// The count starts once it is written, its output rises at the end
+	while (!(inb(PIT_GATE_PORT) & PIT_GATE_CH2_OUT)) continue;
+	outb(PIT_GATE_PORT, saved_gate);
+}
+
+/**
+ * @brief Measures the rate of the TSC against the PIT
+ *
+ * Called once, by init_timer, with interrupts off.
+ */
+void clock_init(void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	if (!(edx & CPUID_TSC)) return;
+
+	clock_pit_start(CLOCK_CALIBRATE_MS);
+	uint64_t start = rdtsc();
+	clock_pit_wait();
+	uint64_t end = rdtsc();
+
+	tsc_khz = div64_32(end - start, CLOCK_CALIBRATE_MS, NULL);
+	tsc_origin = end;
+}
+
+/**
+ * @brief Returns the cycles the TSC counts in a millisecond, 0 if there is
+ * no TSC
+ */
+uint32_t clock_tsc_khz(void) {
+	return tsc_khz;
+}
+
+/**
+ * @brief Returns the nanoseconds elapsed since the calibration
+ */
+uint64_t clock_ns(void) {
+	if (tsc_khz == 0)
+		return (uint64_t) get_time() * TIMER_NS_PER_TICK;
+
+	uint32_t rem;
+	uint64_t ms = div64_32(rdtsc() - tsc_origin, tsc_khz, &rem);
+	return ms * 1000000 + div64_32((uint64_t) rem * 1000000, tsc_khz, NULL);
+}
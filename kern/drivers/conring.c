@@ -0,0 +1,302 @@
+/**
+ * @file conring.c
+ * @brief The rings print writes into, and the thread rendering them
+ *
+ * Each terminal has its rings and its locks (@see console.c), so that the
+ * processes writing to different terminals don't contend.
+ *
+ * print copies the string into a large ring and returns, instead of
+ * rendering it to the console itself. The console drain, a kernel thread,
+ * renders what the ring holds in batches: everything queued since its last
+ * batch, up to the end of the ring, goes through a single putbytes, which
+ * the console turns into a single copy to video memory (@see console.c).
+ *
+ * A print only blocks when the ring is full, until the drain made room for
+ * the rest of its string. The strings of two prints are never interleaved:
+ * a print holds the writer mutex until all of its string is in the ring.
+ *
+ * The echo of the keyboard comes from the line discipline, which runs in a
+ * dont_switch_me_out area and can't lock anything (@see keyboard.c). It
+ * goes in a ring of its own, of which the discipline is the only writer and
+ * the drain the only reader, and the drain renders it first. For the
+ * discipline to wake it, the drain blocks itself in the same area in which
+ * it finds all the rings empty, like the reaper (@see reaper.c).
+ *
+ * Everything else that touches the console, the cursor and the color,
+ * first waits for the ring to be drained (conring_flush) and holds the
+ * console mutex, which the drain holds while rendering.
+ *
+ * Until the drain runs, print renders the string itself.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <console.h>
+#include <thread.h>
+#include <process.h>
+#include <context.h>
+#include <lock.h>
+#include <usercopy.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <kthread.h>
+
+/* The rings of a terminal */
+typedef struct {
+	/* The queued bytes, from tail to head. Both only grow, and wrap around */
+	char ring[CONRING_SIZE];
+	volatile unsigned int head;
+	volatile unsigned int tail;
+
+	/* The echo, from echo_tail to echo_head, which only grow too */
+	char echo[CONRING_ECHO_SIZE];
+	volatile unsigned int echo_head;
+	volatile unsigned int echo_tail;
+
+	/* Protects head and tail */
+	mutex_t ring_mutex;
+	cond_t not_full;		// Printers wait for room
+	cond_t drained;			// Flushes wait for the ring to be empty
+
+	/* Keeps the string of a print in one piece */
+	mutex_t writer_mutex;
+	/* Ensures that the terminal is drawn by one thread at a time */
+	mutex_t console_mutex;
+} conring_t;
+
+static conring_t conrings[NUM_TERMINALS];
+
+/* The drain, NULL until it runs */
+static thread_t *drain = NULL;
+static boolean_t drain_asleep = FALSE;
+
+/**
+ * @brief Initializes the rings and their locks
+ */
+void conring_init(void) {
+	int i;
+	for (i = 0; i < NUM_TERMINALS; i++) {
+		conring_t *c = &conrings[i];
+		c->head = c->tail = 0;
+		c->echo_head = c->echo_tail = 0;
+		mutex_init(&c->ring_mutex);
+		mutex_init(&c->writer_mutex);
+		mutex_init(&c->console_mutex);
+		cond_init(&c->not_full);
+		cond_init(&c->drained);
+	}
+}
+
+/**
+ * @brief Makes the drain runnable if it sleeps
+ */
+static void wake_drain(void) {
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
+
+	if (drain_asleep) {
+		drain_asleep = FALSE;
+		set_runnable(drain);
+	}
+
+	if (!in_area) you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Tells whether all the rings are empty
+ */
+static boolean_t conrings_empty(void) {
+	int i;
+	for (i = 0; i < NUM_TERMINALS; i++) {
+		conring_t *c = &conrings[i];
+		if (c->head != c->tail || c->echo_head != c->echo_tail)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * @brief Renders the echo, then a batch of what is queued, of a terminal
+ *
+ * The batches are rendered from the rings themselves, without the ring
+ * mutex: nobody writes over them as long as the tails are not moved past.
+ */
+static void drain_terminal(int term) {
+	conring_t *c = &conrings[term];
+
+	if (c->echo_tail != c->echo_head) {
+		mutex_lock(&c->console_mutex);
+		while (c->echo_tail != c->echo_head) {
+			unsigned int start = c->echo_tail % CONRING_ECHO_SIZE;
+			unsigned int len = c->echo_head - c->echo_tail;
+			if (start + len > CONRING_ECHO_SIZE)
+				len = CONRING_ECHO_SIZE - start;
+			term_putbytes(term, c->echo + start, len);
+			c->echo_tail += len;
+		}
+		mutex_unlock(&c->console_mutex);
+	}
+
+	mutex_lock(&c->ring_mutex);
+	unsigned int start = c->tail % CONRING_SIZE;
+	unsigned int len = c->head - c->tail;
+	if (start + len > CONRING_SIZE) len = CONRING_SIZE - start;
+	mutex_unlock(&c->ring_mutex);
+	if (len == 0) return;
+
+	mutex_lock(&c->console_mutex);
+	term_putbytes(term, c->ring + start, len);
+	mutex_unlock(&c->console_mutex);
+
+	mutex_lock(&c->ring_mutex);
+	c->tail += len;
+	cond_broadcast(&c->not_full);
+	if (c->tail == c->head) cond_broadcast(&c->drained);
+	mutex_unlock(&c->ring_mutex);
+}
+
+/**
+ * @brief The console drain thread
+ *
+ * It takes a batch of each terminal in turn, so that a chatty terminal
+ * doesn't hold the others back.
+ */
+static void drain_main(void *arg) {
+	thread_t *self = get_self();
+
+	for (;;) {
+		dont_switch_me_out();
+		while (conrings_empty()) {
+			drain_asleep = TRUE;
+			set_blocked(self);
+
+			thread_t *other = get_running();
+			if (other == NULL) other = idle();
+			context_switch(self, other);
+			dont_switch_me_out();
+		}
+		you_can_switch_me_out_now();
+
+		int term;
+		for (term = 0; term < NUM_TERMINALS; term++) drain_terminal(term);
+	}
+}
+
+/**
+ * @brief Creates the console drain and makes it runnable
+ *
+ * If the drain can't be created, print keeps rendering the strings itself.
+ */
+void conring_start(void) {
+	thread_t *thread = kthread_create(drain_main, NULL, -1);
+	if (thread == NULL) return;
+
+	dont_switch_me_out();
+	drain = thread;
+	you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Queues a string of user space for a terminal
+ *
+ * The string is copied in a chunk at a time, outside of the ring mutex since
+ * copying it may fault.
+ *
+ * @param buf the string, in user space and checked by the caller
+ * @param size its length
+ * @return 0 on success, a negative error code if the string faulted
+ */
+int conring_write(int term, const char *buf, int size) {
+	conring_t *c = &conrings[term];
+	char chunk[CONRING_CHUNK];
+	int done, err = 0;
+
+	if (drain == NULL) {
+		mutex_lock(&c->console_mutex);
+		for (done = 0; done < size && !err; done += CONRING_CHUNK) {
+			int len = size - done;
+			if (len > CONRING_CHUNK) len = CONRING_CHUNK;
+			err = copy_from_user(chunk, buf + done, len);
+			if (!err) term_putbytes(term, chunk, len);
+		}
+		mutex_unlock(&c->console_mutex);
+		return err;
+	}
+
+	mutex_lock(&c->writer_mutex);
+	for (done = 0; done < size && !err; done += CONRING_CHUNK) {
+		int len = size - done;
+		if (len > CONRING_CHUNK) len = CONRING_CHUNK;
+		err = copy_from_user(chunk, buf + done, len);
+		if (err) break;
+
+		mutex_lock(&c->ring_mutex);
+		int copied = 0;
+		while (copied < len) {
+			while (c->head - c->tail == CONRING_SIZE)
+				cond_wait(&c->not_full, &c->ring_mutex);
+
+			// As much as fits, up to the end of the ring
+			unsigned int start = c->head % CONRING_SIZE;
+			int n = CONRING_SIZE - (c->head - c->tail);
+			if (n > len - copied) n = len - copied;
+			if (start + n > CONRING_SIZE) n = CONRING_SIZE - start;
+
+			memcpy(c->ring + start, chunk + copied, n);
+			c->head += n;
+			copied += n;
+			wake_drain();
+		}
+		mutex_unlock(&c->ring_mutex);
+	}
+	mutex_unlock(&c->writer_mutex);
+
+	return err;
+}
+
+/**
+ * @brief Queues the echo of characters typed on the keyboard
+ *
+ * It never blocks, what doesn't fit is not echoed. Its callers are in a
+ * dont_switch_me_out area, which also makes them the only writer.
+ */
+void conring_echo(int term, const char *buf, int size) {
+	conring_t *c = &conrings[term];
+	int i;
+	for (i = 0; i < size; i++) {
+		if (c->echo_head - c->echo_tail == CONRING_ECHO_SIZE) break;
+		c->echo[c->echo_head % CONRING_ECHO_SIZE] = buf[i];
+		c->echo_head++;
+	}
+	if (i > 0 && drain != NULL) wake_drain();
+}
+
+/**
+ * @brief Waits until everything queued so far for a terminal is on it
+ */
+void conring_flush(int term) {
+	if (drain == NULL) return;
+
+	conring_t *c = &conrings[term];
+	mutex_lock(&c->ring_mutex);
+	while (c->head != c->tail) cond_wait(&c->drained, &c->ring_mutex);
+	mutex_unlock(&c->ring_mutex);
+}
+
+/**
+ * @brief Drains the ring of a terminal and takes it for the caller
+ */
+void console_lock(int term) {
+	conring_flush(term);
+	mutex_lock(&conrings[term].console_mutex);
+}
+
+/**
+ * @brief Gives a terminal back
+ */
+void console_unlock(int term) {
+	mutex_unlock(&conrings[term].console_mutex);
+}
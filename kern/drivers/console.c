@@ -18,6 +18,23 @@
  * pointers) passed to its functions. It is the responsibility of the system
  * calls to check those values before passing them down to the console.
  * 
+ * The screen is drawn in a shadow buffer in memory rather than in video
+ * memory, which is slow to access. The rows changed since the last flush
+ * are then copied to video memory at once, and the hardware cursor, which
+ * takes four port writes, is programmed only if it moved. Every function of
+ * the driver flushes before returning, except while putbytes renders a
+ * string: it flushes once at the end, so that a print costs a copy of the
+ * rows it touched and one cursor update, however many lines it scrolls.
+ *
+ * There are NUM_TERMINALS virtual terminals, each with its own shadow
+ * buffer, cursor and color. Only the focused one is flushed to video
+ * memory; the others keep track of their changed rows, and are copied whole
+ * when they get the focus (@see term_focus). The terminals are drawn by
+ * different threads at once, each under the mutex of its terminal (@see
+ * conring.c), and only the copies to video memory are serialized, by the
+ * video lock. The functions of the p1 interface draw on the focused
+ * terminal, so that what the kernel prints is seen.
+ * 
  * @author Loic Ottet (lottet)
  * @author Daniel Balle (dballe)
  * @bugs No known bugs
@@ -25,6 +42,7 @@
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <asm.h>
 #include <types.h>
@@ -33,48 +51,161 @@
 #include <drivers.h>
 #include <console.h>
 #include <errors.h>
+#include <spinlock.h>
+
+/* The state of a terminal */
+typedef struct {
+	int cursor_row;			// Current row of the cursor (even hidden)
+	int cursor_col;			// Current column of the cursor (even hidden)
+	boolean_t cursor_hidden;	// Is the cursor hidden or not?
+	int term_color;			// Current output colors
+
+	/* The screen as drawn, a character and its color per cell like video
+	 * memory */
+	uint16_t shadow[CONSOLE_HEIGHT * CONSOLE_WIDTH];
+	/* Rows of the shadow buffer changed since the last flush, first to last */
+	int dirty_first;
+	int dirty_last;
+	/* Whether the hardware cursor must be programmed at the next flush */
+	boolean_t cursor_moved;
+	/* Non zero while putbytes renders, the flush then waits until it is done */
+	int batching;
+} terminal_t;
+
+static terminal_t terminals[NUM_TERMINALS];
+
+/* The terminal on screen, changed under the video lock */
+static volatile int focus = 0;
+static spinlock_t video_lock;
+
+static void clear_terminal(terminal_t *t);
+static int set_terminal_cursor(terminal_t *t, int row, int col);
+static void next_terminal_cursor(terminal_t *t);
+static void scroll_terminal(terminal_t *t);
+static void clear_terminal_row(terminal_t *t, int row);
 
-/* State variables */
-static int cursor_row = 0; // Current row of the cursor (even hidden)
-static int cursor_col = 0; // Current column of the cursor (even hidden)
-static boolean_t cursor_hidden = FALSE; // Is the cursor hidden or not?
-static int term_color = FGND_WHITE | BGND_RED; // Current output colors
+/**
+ * @brief Returns the cell of the shadow buffer at a position on screen
+ */
+static uint16_t *shadow_cell(terminal_t *t, int row, int col) {
+	return &t->shadow[row * CONSOLE_WIDTH + col];
+}
 
 /**
- * @brief Initializes the console state and resets the display
+ * @brief Notes that rows first to last of the shadow buffer changed
+ */
+static void mark_dirty(terminal_t *t, int first, int last) {
+	if (first < t->dirty_first) t->dirty_first = first;
+	if (last > t->dirty_last) t->dirty_last = last;
+}
+
+/**
+ * @brief Copies the changed rows of the shadow buffer to video memory and
+ * programs the cursor if it moved, unless putbytes is rendering or the
+ * terminal is not on screen
+ */
+static void flush_terminal(terminal_t *t) {
+	if (t->batching) return;
+
+	spin_lock_irqsave(&video_lock);
+	if (t != &terminals[focus]) {
+		spin_unlock_irqrestore(&video_lock);
+		return;
+	}
+
+	if (t->dirty_first <= t->dirty_last) {
+		// The rows are contiguous in both buffers
+		memcpy(get_mem_pos(t->dirty_first, 0),
+			shadow_cell(t, t->dirty_first, 0),
+			(t->dirty_last - t->dirty_first + 1) * CONSOLE_WIDTH
+			* sizeof(uint16_t));
+		t->dirty_first = CONSOLE_HEIGHT;
+		t->dirty_last = -1;
+	}
+
+	if (t->cursor_moved && !t->cursor_hidden)
+		send_curpos(t->cursor_row, t->cursor_col);
+	t->cursor_moved = FALSE;
+	spin_unlock_irqrestore(&video_lock);
+}
+
+/**
+ * @brief Initializes the terminals and resets the display
  * 
  * @return Void.
  */
 void init_console() {
-	clear_console();
-	set_cursor(0,0);
-	set_term_color(FGND_WHITE | BGND_RED);
+	spin_init(&video_lock);
+
+	int i;
+	for (i = 0; i < NUM_TERMINALS; i++) {
+		terminal_t *t = &terminals[i];
+		t->cursor_hidden = FALSE;
+		t->dirty_first = CONSOLE_HEIGHT;
+		t->dirty_last = -1;
+		t->cursor_moved = FALSE;
+		t->batching = 0;
+		t->term_color = FGND_WHITE | BGND_RED;
+		clear_terminal(t);
+	}
+}
+
+/**
+ * @brief Puts a terminal on screen
+ *
+ * Its whole shadow buffer is copied to video memory. It may be called in a
+ * dont_switch_me_out area, from the keyboard.
+ */
+void term_focus(int term) {
+	if (term < 0 || term >= NUM_TERMINALS) return;
+
+	spin_lock_irqsave(&video_lock);
+	if (term != focus) {
+		terminal_t *t = &terminals[term];
+		focus = term;
+		memcpy(get_mem_pos(0, 0), shadow_cell(t, 0, 0),
+			sizeof(t->shadow));
+		t->dirty_first = CONSOLE_HEIGHT;
+		t->dirty_last = -1;
+		t->cursor_moved = FALSE;
+		if (t->cursor_hidden) send_curpos(CONSOLE_HEIGHT, CONSOLE_WIDTH);
+		else send_curpos(t->cursor_row, t->cursor_col);
+	}
+	spin_unlock_irqrestore(&video_lock);
+}
+
+/**
+ * @brief Returns the terminal on screen
+ */
+int term_focused(void) {
+	return focus;
 }
 
 /* Character display */
 
-/* See p1kern.h for documentation */
-int putbyte(char ch) {
-	if (!check_cursor_position(cursor_row, cursor_col)) {
+/**
+ * @brief Draws a character at the cursor of a terminal and moves it
+ */
+static int terminal_putbyte(terminal_t *t, char ch) {
+	if (!check_cursor_position(t->cursor_row, t->cursor_col)) {
 		kernel_panic("Invalid cursor position");
 	}
+	t->batching++;
 
-	// Get global values
-	int row = cursor_row;
-	int col = cursor_col;
-	int color;
-	get_term_color(&color);
+	int row = t->cursor_row;
+	int col = t->cursor_col;
+	int color = t->term_color;
 
 	switch(ch) {
 		case '\n': // Line return, we get to the next line
 			if (row < CONSOLE_HEIGHT - 1) {
 				++row;
 			} else { // Last line on screen, we've got to make some room
-				scroll();
+				scroll_terminal(t);
 			}
 			// No break, that's normal (\n is just an enhanced \r)
 		case '\r': // Carriage return, we just come back to the line start
-			set_cursor(row, 0);
+			set_terminal_cursor(t, row, 0);
 			break;
 		case '\b': // Delete (row and col will be the char to delete)
 			if (col == 0) { // We are trying to delete a line break
@@ -87,23 +218,35 @@ int putbyte(char ch) {
 				--col;
 			}
 
-			// Character deletion
-			draw_char(row, col, ' ', -1); // -1 means "keep color"
-			set_cursor(row, col);
+			// Character deletion, keeping the color
+			*shadow_cell(t, row, col) =
+				(*shadow_cell(t, row, col) & 0xFF00) | ' ';
+			mark_dirty(t, row, row);
+			set_terminal_cursor(t, row, col);
 			break;
 		default: // For any "regular" character
 			if (isprint(ch)) {
 				// We avoid unprintable chars to be consistent to the user
-				draw_char(row, col, ch, color);
-				next_cursor();
+				*shadow_cell(t, row, col) = (color << 8) | (uint8_t) ch;
+				mark_dirty(t, row, row);
+				next_terminal_cursor(t);
 			}
 	}
 
+	t->batching--;
+	flush_terminal(t);
 	return (int) ch;
 }
 
-/* see p1kern.h for documentation */
-void putbytes(const char *s, int len) {
+/**
+ * @brief Renders a string on a terminal, flushing once at the end
+ *
+ * The caller holds the console of the terminal (@see console_lock).
+ */
+void term_putbytes(int term, const char *s, int len) {
+	terminal_t *t = &terminals[term];
+
+	t->batching++;
 	int i;
 	for (i = 0; i < len; ++i) {
 		char c = s[i];
@@ -112,8 +255,20 @@ void putbytes(const char *s, int len) {
 		}
 
 		// We write the string until it ends or we printed enough
-		putbyte(c);
+		terminal_putbyte(t, c);
 	}
+	t->batching--;
+	flush_terminal(t);
+}
+
+/* See p1kern.h for documentation */
+int putbyte(char ch) {
+	return terminal_putbyte(&terminals[focus], ch);
+}
+
+/* see p1kern.h for documentation */
+void putbytes(const char *s, int len) {
+	term_putbytes(focus, s, len);
 }
 
 /* see p1kern.h for documentation */
@@ -121,13 +276,16 @@ void draw_char(int row, int col, int ch, int color) {
 	// We draw only if we're on the screen
 	if (!check_cursor_position(row, col)) return;
 	
-	char* mem_pos = get_mem_pos(row, col);
+	terminal_t *t = &terminals[focus];
+	uint16_t *cell = shadow_cell(t, row, col);
 
-	*mem_pos = ch;
 	// A color of -1 means we want to keep the same color
-	if (color != -1 && check_term_color(color)) {
-		*(mem_pos + 1) = color;
-	}
+	uint16_t attr = *cell & 0xFF00;
+	if (color != -1 && check_term_color(color)) attr = color << 8;
+	*cell = attr | (uint8_t) ch;
+
+	mark_dirty(t, row, row);
+	flush_terminal(t);
 }
 
 /* see p1kern.h for documentation */
@@ -135,25 +293,7 @@ char get_char(int row, int col) {
 	// We can get information only about the screen
 	if (!check_cursor_position(row, col)) return '\0'; // Default value
 
-	char* mem_pos = get_mem_pos(row, col);
-	return *mem_pos;
-}
-
-/**
- * @brief Copies one character from one location to another
- * 
- * @return 1 if the copy was succesful, 0 otherwise
- */
-void copy_char(int from_row, int from_col, int to_row, int to_col) {
-	if (!check_cursor_position(from_row, from_col)
-		|| !check_cursor_position(to_row, to_col)) return;
-	
-	char* mem_pos_from = get_mem_pos(from_row, from_col);
-	char* mem_pos_to = get_mem_pos(to_row, to_col);
-	
-	// We want to keep char and color together
-	*mem_pos_to = *mem_pos_from;
-	*(mem_pos_to + 1) = *(mem_pos_from + 1);
+	return (char) *shadow_cell(&terminals[focus], row, col);
 }
 
 /**
@@ -177,21 +317,24 @@ boolean_t check_cursor_position(int row, int col) {
 
 /* Color management */
 
-/* see p1kern.h for documentation */
-int set_term_color(int color) {
+/**
+ * @brief Sets the color of what is drawn next on a terminal
+ */
+int term_set_color(int term, int color) {
 	if (!check_term_color(color)) return -1;
 
-	term_color = color;
+	terminals[term].term_color = color;
 	return 0;
 }
 
 /* see p1kern.h for documentation */
-void get_term_color(int *color) {
-	if (!check_term_color(term_color)) {
-		kernel_panic("Invalid terminal color scheme");
-	}
+int set_term_color(int color) {
+	return term_set_color(focus, color);
+}
 
-	*color = term_color;
+/* see p1kern.h for documentation */
+void get_term_color(int *color) {
+	*color = terminals[focus].term_color;
 }
 
 /**
@@ -200,50 +343,74 @@ void get_term_color(int *color) {
  * @return 1 if the color code is valid, 0 otherwise
  */
 boolean_t check_term_color(int color) {
-	return term_color <= 0xFF && term_color >= 0x00;
+	return color <= 0xFF && color >= 0x00;
 }
 
 /* Cursor management */
 
-/* see p1kern.h for documentation */
-int set_cursor(int row, int col) {
+/**
+ * @brief Moves the cursor of a terminal
+ */
+static int set_terminal_cursor(terminal_t *t, int row, int col) {
 	if (!check_cursor_position(row, col)) return -1;
 	
-	cursor_row = row;
-	cursor_col = col;
+	t->cursor_row = row;
+	t->cursor_col = col;
 
-	if (!cursor_hidden) { // We update the display if needed
-		send_curpos(cursor_row, cursor_col);
-	}
+	// The display is updated by the flush, if needed
+	t->cursor_moved = TRUE;
+	flush_terminal(t);
 
 	return 0;
 }
 
-/* see p1kern.h for documentation */
-void get_cursor(int *row, int *col) {
-	if (!check_cursor_position(cursor_col, cursor_row)) {
+/**
+ * @brief Moves the cursor of a terminal, whose console the caller holds
+ */
+int term_set_cursor(int term, int row, int col) {
+	return set_terminal_cursor(&terminals[term], row, col);
+}
+
+/**
+ * @brief Gets the cursor of a terminal, whose console the caller holds
+ */
+void term_get_cursor(int term, int *row, int *col) {
+	terminal_t *t = &terminals[term];
+	if (!check_cursor_position(t->cursor_row, t->cursor_col)) {
 		kernel_panic("Invalid cursor position");
 	}
 
-	*row = cursor_row;
-	*col = cursor_col;
+	*row = t->cursor_row;
+	*col = t->cursor_col;
+}
+
+/* see p1kern.h for documentation */
+int set_cursor(int row, int col) {
+	return term_set_cursor(focus, row, col);
+}
+
+/* see p1kern.h for documentation */
+void get_cursor(int *row, int *col) {
+	term_get_cursor(focus, row, col);
 }
 
 /* see p1kern.h for documentation */
 void hide_cursor() {
 	// Update the state and the display
-	cursor_hidden = TRUE;
+	terminal_t *t = &terminals[focus];
+	t->cursor_hidden = TRUE;
 	send_curpos(CONSOLE_HEIGHT, CONSOLE_WIDTH);
 }
 
 /* see p1kern.h for documentation */
 void show_cursor() {
 	// Update the status and the display if possible
-	cursor_hidden = FALSE;
-	if (!check_cursor_position(cursor_row, cursor_col)) { // Should not happen
-		kernel_panic("Invalid cursor position");
+	terminal_t *t = &terminals[focus];
+	t->cursor_hidden = FALSE;
+	if (!check_cursor_position(t->cursor_row, t->cursor_col)) {
+		kernel_panic("Invalid cursor position"); // Should not happen
 	}
-	send_curpos(cursor_row, cursor_col);
+	send_curpos(t->cursor_row, t->cursor_col);
 }
 
 /**
@@ -263,25 +430,25 @@ void send_curpos(int row, int col) {
 }
 
 /**
- * @brief Moves the cursor to its next legal position
+ * @brief Moves the cursor of a terminal to its next legal position
  */
-void next_cursor() {
+static void next_terminal_cursor(terminal_t *t) {
 	// We can do this only if we're inside the screen
-	if (!check_cursor_position(cursor_row, cursor_col)) {
+	if (!check_cursor_position(t->cursor_row, t->cursor_col)) {
 		panic("Invalid cursor position");
 	}
 
-	int row = cursor_row;
-	int col = cursor_col;
+	int row = t->cursor_row;
+	int col = t->cursor_col;
 
 	if (col < CONSOLE_WIDTH - 1) { // Just the next spot
-		set_cursor(row, ++col);
+		set_terminal_cursor(t, row, ++col);
 	} else { // We have a line break to operate
 		if (row < CONSOLE_HEIGHT - 1) { // Nothing's wrong
-			set_cursor(++row, 0);
+			set_terminal_cursor(t, ++row, 0);
 		} else { // We're at the last line, we must make some room
-			scroll();
-			set_cursor(row, 0);
+			scroll_terminal(t);
+			set_terminal_cursor(t, row, 0);
 		}
 	}
 }
@@ -289,34 +456,50 @@ void next_cursor() {
 /* General purpose utility functions (no argument check) */
 
 /**
- * @brief Shifts the display up by one line
+ * @brief Shifts the display of a terminal up by one line
  */
-void scroll() {
-	int i,j;
-	for (i = 0; i < CONSOLE_HEIGHT - 1; ++i) {
-		for (j = 0; j < CONSOLE_WIDTH; ++j) {
-			copy_char(i+1, j, i, j); // We copy each char one line above
-		}
+static void scroll_terminal(terminal_t *t) {
+	// Move the shadow buffer a line up at once, everything changed
+	t->batching++;
+	memmove(shadow_cell(t, 0, 0), shadow_cell(t, 1, 0),
+		(CONSOLE_HEIGHT - 1) * CONSOLE_WIDTH * sizeof(uint16_t));
+	mark_dirty(t, 0, CONSOLE_HEIGHT - 1);
+	clear_terminal_row(t, CONSOLE_HEIGHT - 1); // We clear the last row
+	t->batching--;
+	flush_terminal(t);
+}
+
+/**
+ * @brief Blanks a terminal and puts its cursor at the top
+ */
+static void clear_terminal(terminal_t *t) {
+	t->batching++;
+	int i;
+	for (i = 0; i < CONSOLE_HEIGHT; ++i) {
+		clear_terminal_row(t, i);
 	}
-	clear_row(CONSOLE_HEIGHT - 1); // We clear the last row
+	set_terminal_cursor(t, 0, 0); // Reset the cursor
+	t->batching--;
+	flush_terminal(t);
 }
 
 /* see p1kern.h for documentation */
 void clear_console()
 {
-	int i;
-	for (i = 0; i < CONSOLE_HEIGHT; ++i) {
-		clear_row(i);
-	}
-	set_cursor(0,0); // Reset the cursor
+	clear_terminal(&terminals[focus]);
 }
 
 /**
- * @brief Sets the given row to a blank state
+ * @brief Sets the given row of a terminal to a blank state
  */
-void clear_row(int row) {
+static void clear_terminal_row(terminal_t *t, int row) {
+	if (!check_cursor_position(row, 0)) return;
+
+	uint16_t blank = ((FGND_WHITE | BGND_RED) << 8) | ' ';
 	int j;
 	for (j = 0; j < CONSOLE_WIDTH; ++j) {
-			draw_char(row, j, ' ', FGND_WHITE | BGND_RED);
+		*shadow_cell(t, row, j) = blank;
 	}
+	mark_dirty(t, row, row);
+	flush_terminal(t);
 }
@@ -11,6 +11,7 @@
 #include <interrupt_defines.h>
 
 #include <drivers.h>
+#include <serial.h>
 
 /**
  * @brief Sets up the drivers for a smoothly working user interface
@@ -19,6 +20,7 @@ void install_handlers() {
 	init_console();
 	init_keyboard();
 	init_timer();
+	init_serial();
 }
 
 /**
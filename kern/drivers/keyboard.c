@@ -1,28 +1,31 @@
 /**
  * @file keyboard.c
- * @brief The keyboard handler
- * 
- * The keyboard handler receives interrupts from the hardware keyboard, stores
- * them in a buffer so they can be read afterwards by the readchar() function.
- * 
- * A note about the buffer. It has two index variables pointing to the last 
- * entered (by the handler) and last processed (by readchar()) indexes in the
- * array. When those numbers are different, everything is fine. But when both
- * are equal, we can be in two very different situations. The first (and
- * simple) case is when the buffer is empty. In this case we just have to
- * prevent readchar from processing the next character, as it is currently
- * junk. The second case is a bit trickier. It occurs when the buffer is full,
- * and cannot hold the additional char we try to fit in. In that case, the
- * design decision is to drop the incoming character without ever processing
- * it, giving priority to the previously entered values. The rationale behind
- * this is that the "user" wants to see what he entered first occur first in
- * any case. Printing the last half of a phrase or playing the end of a
- * sequence of actions in a game, for example, are not an expected behavior
- * for the program.
- * 
- * We chose the approach to disable interrupts for keyboard-related operations
- * instead of a locking solution to keep the interrupts as short as possible.
- * 
+ * @brief The keyboard handler and the line discipline
+ *
+ * The keyboard handler receives interrupts from the hardware keyboard and
+ * stores the scancodes in a ring, of which it is the only writer. It takes
+ * no lock: the line discipline, the only reader, finds a scancode once the
+ * head moved past it. When the ring is full, the incoming scancode is
+ * dropped, giving priority to the previously entered values; the "user"
+ * wants to see what he entered first occur first in any case.
+ *
+ * The line discipline turns the scancodes into characters and assembles
+ * the lines: a backspace erases the last character of the line being
+ * edited, a newline ends it. Each character is echoed through the console
+ * ring (@see conring_echo), which doesn't block. The discipline runs in a
+ * dont_switch_me_out area, right after the interrupt if this CPU isn't in
+ * such an area already. Otherwise the scancodes wait for the next timer
+ * tick (@see keyboard_poll), or for a reader, who catches up first.
+ *
+ * The characters typed go to the terminal on screen, the one echoing them,
+ * and Alt with a digit puts another terminal on screen (@see term_focus).
+ * Each terminal has its input: a second ring, of the lines completed, then
+ * the line being edited, and its reader. readline blocks until a line is
+ * completed, or enough characters are typed to fill its buffer, and the
+ * discipline wakes it once then, rather than once per character. getchar
+ * doesn't block, it only takes a character of a completed line if there is
+ * one.
+ *
  * @author Loic Ottet (lottet)
  * @author Daniel Balle (dballe)
  * @bugs No known bugs
@@ -37,24 +40,40 @@
 
 #include <drivers.h>
 #include <interrupts.h>
-#include <lock.h>
-
-/* Global buffer variables */
-static uint8_t keyboard_buffer[KEY_BUFFER_SIZE];
-// Index of the last key sent by the keyboard
-static unsigned int last_entered = KEY_BUFFER_SIZE;
-// Index of the last key sent to the user
-static unsigned int last_processed = KEY_BUFFER_SIZE;
-// Is the buffer full? (In the case where last_entered = last_processed)
-static boolean_t is_buffer_full = FALSE;
-// Mutex protecting the buffer
-static mutex_t keyboard_mutex;
-// Condition variable on new input to the buffer
-static cond_t new_key;
+#include <thread.h>
+#include <context.h>
+#include <cpu.h>
+
+/**
+ * The scancodes, from scan_tail to scan_head. Both only grow, and wrap
+ * around; the handler writes the head and the discipline the tail.
+ */
+static volatile uint8_t scancodes[KEY_BUFFER_SIZE];
+static volatile unsigned int scan_head = 0;
+static volatile unsigned int scan_tail = 0;
+
+/**
+ * The characters typed on a terminal. The completed lines go from in_tail to
+ * in_line, the line being edited from in_line to in_head. They are only
+ * touched in a dont_switch_me_out area.
+ */
+typedef struct {
+	char input[INPUT_BUFFER_SIZE];
+	unsigned int in_tail;
+	unsigned int in_line;
+	unsigned int in_head;
+	unsigned int lines;			// Newlines between in_tail and in_line
+
+	/* The thread blocked in readline, and how many characters it wants */
+	thread_t *reader;
+	unsigned int wanted;
+} input_t;
+
+static input_t inputs[NUM_TERMINALS];
 
 /**
  * @brief initializes the keyboard handler
- * 
+ *
  * init_handlers() ensures that no interruption is called during the setup of
  * the drivers.
  */
@@ -67,63 +86,172 @@ void init_keyboard() {
 
 	// Store it in the IDT
 	insert_to_idt(create_trap_idt_entry(&keyboard_gate), KEY_IDT_ENTRY);
-	
-	mutex_init(&keyboard_mutex);
-	cond_init(&new_key);
+}
+
+/**
+ * @brief Wakes the reader of an input if it can go on
+ */
+static void wake_reader(input_t *in) {
+	if (in->reader == NULL) return;
+	if (in->lines == 0 && in->in_head - in->in_tail < in->wanted) return;
+
+	thread_t *thread = in->reader;
+	in->reader = NULL;
+	set_runnable(thread);
+}
+
+/**
+ * @brief Turns the pending scancodes into characters for the terminal on
+ * screen, and wakes its reader if it can go on. We must be in a
+ * dont_switch_me_out area.
+ */
+static void line_discipline(void) {
+	int term = term_focused();
+	input_t *in = &inputs[term];
+	char echo[KEY_ECHO_CHUNK];
+	int echoed = 0;
+
+	while (scan_tail != scan_head) {
+		kh_type k = process_scancode(scancodes[scan_tail % KEY_BUFFER_SIZE]);
+		scan_tail++;
+		if (!KH_ISMAKE(k) || !KH_HASDATA(k)) continue;
+
+		char c = KH_GETCHAR(k);
+		if (KH_ALT(k) && c >= '1' && c < '1' + NUM_TERMINALS) {
+			// What is typed from now on goes to the other terminal
+			if (echoed > 0) conring_echo(term, echo, echoed);
+			echoed = 0;
+			wake_reader(in);
+
+			term = c - '1';
+			in = &inputs[term];
+			term_focus(term);
+			continue;
+		}
+
+		if (c == '\b') {
+			// Only the line being edited can be erased
+			if (in->in_head == in->in_line) continue;
+			in->in_head--;
+		} else {
+			if (in->in_head - in->in_tail == INPUT_BUFFER_SIZE) continue;
+			in->input[in->in_head++ % INPUT_BUFFER_SIZE] = c;
+			if (c == '\n') {
+				in->in_line = in->in_head;
+				in->lines++;
+			}
+		}
+		echo[echoed++] = c;
+		if (echoed == KEY_ECHO_CHUNK) {
+			conring_echo(term, echo, echoed);
+			echoed = 0;
+		}
+	}
+
+	if (echoed > 0) conring_echo(term, echo, echoed);
+	wake_reader(in);
 }
 
 /**
  * @brief Called when an interrupt is sent by the keyboard
- * 
- * We signal the condition variable only after acknowledging the interrupt 
- * to ensure that the interrupts keep flowing even if the thread somehow 
- * gets stuck in the cond_signal call.
+ *
+ * The scancode is stored before acknowledging the interrupt, and the
+ * discipline only runs after, to keep the interrupts flowing.
  */
 void keyboard_handler() {
+	uint8_t scancode = inb(KEYBOARD_PORT);
+	if (scan_head - scan_tail < KEY_BUFFER_SIZE) {
+		scancodes[scan_head % KEY_BUFFER_SIZE] = scancode;
+		scan_head++;
+	}
+	ack_interrupt();
+
+	// Like the timeouts, the scancodes wait if this CPU is in the area
+	if (this_cpu()->no_switch) return;
+
+	dont_switch_me_out();
+	line_discipline();
+	you_can_switch_me_out_now();
+}
 
-	mutex_lock(&keyboard_mutex);
-
-	// We store the character in the next available buffer spot
-	unsigned int next_char_idx = (last_entered + 1) % KEY_BUFFER_SIZE;
-	if (!is_buffer_full) {
-		keyboard_buffer[next_char_idx] = inb(KEYBOARD_PORT);
-		last_entered = next_char_idx;
-		
-		if (last_entered == last_processed) {
-			is_buffer_full = TRUE;
-		}	
+/**
+ * @brief Runs the discipline for the scancodes left by the handler, from
+ * the timer. We must be in a dont_switch_me_out area.
+ */
+void keyboard_poll(void) {
+	if (scan_tail != scan_head) line_discipline();
+}
+
+/**
+ * @brief Reads a line of at most size characters typed on a terminal into a
+ * kernel buffer
+ *
+ * The thread blocks until a line is completed or size characters are typed.
+ * Only one thread may call it at a time for a terminal.
+ *
+ * @return the number of characters read, the last one a newline if the line
+ * was completed
+ */
+int keyboard_readline(int term, char *buf, int size) {
+	if (size <= 0) return 0;
+	thread_t *self = get_self();
+	input_t *in = &inputs[term];
+
+	dont_switch_me_out();
+	line_discipline();
+	while (in->lines == 0 && in->in_head - in->in_tail < (unsigned int) size) {
+		in->reader = self;
+		in->wanted = size;
+		set_blocked(self);
+
+		thread_t *other = get_running();
+		if (other == NULL) other = idle();
+		context_switch(self, other);
+		dont_switch_me_out();
 	}
 
-	mutex_unlock(&keyboard_mutex);
-	ack_interrupt();
+	int read = 0;
+	while (read < size) {
+		char c = in->input[in->in_tail++ % INPUT_BUFFER_SIZE];
+		buf[read++] = c;
+		if (c == '\n') {
+			in->lines--;
+			break;
+		}
+	}
+
+	// What was read of the line being edited can't be erased anymore
+	if ((int) (in->in_tail - in->in_line) > 0) in->in_line = in->in_tail;
+	you_can_switch_me_out_now();
 
-	cond_signal(&new_key);
+	return read;
 }
 
-/* see p1kern.h for documentation */
-/* Accessing the buffer and updating the last_processed variable is an
- * operation that has to be made atomical to avoid that a timer-driven
- * interrupt begins a new readchar while we are doing this one.
+/**
+ * @brief Takes the next character of a completed line of a terminal,
+ * without blocking
+ *
+ * @return the character, -1 if there is none, or none while a thread waits
+ * in readline, whose turn it is
  */
-int readchar() {
-	kh_type k = 0;
-
-	mutex_lock(&keyboard_mutex);
-	do {
-		if ((last_processed != last_entered) || is_buffer_full) {
-			// We have characters to process
-			unsigned int next_char_idx = (last_processed + 1) %
-				KEY_BUFFER_SIZE;
-			k = process_scancode(keyboard_buffer[next_char_idx]);
-			last_processed = next_char_idx;
-
-			if (is_buffer_full) {
-				is_buffer_full = FALSE;
-			}
-		} else cond_wait(&new_key, &keyboard_mutex);
+int keyboard_getchar(int term) {
+	input_t *in = &inputs[term];
+	int c = -1;
 
-	} while (!KH_ISMAKE(k) || !KH_HASDATA(k));
-	mutex_unlock(&keyboard_mutex);
+	dont_switch_me_out();
+	line_discipline();
+	if (in->reader == NULL && in->in_tail != in->in_line) {
+		c = in->input[in->in_tail++ % INPUT_BUFFER_SIZE];
+		if (c == '\n') in->lines--;
+	}
+	you_can_switch_me_out_now();
+
+	return c;
+}
 
-	return KH_GETCHAR(k);
+/* see p1kern.h for documentation */
+/* The characters are those of the terminal on screen.
+ */
+int readchar() {
+	return keyboard_getchar(term_focused());
 }
@@ -0,0 +1,157 @@
+/**
+ * @file lapic.c
+ * @brief The local APIC of each CPU, and its timer
+ *
+ * Every CPU has a local APIC, whose registers are at the same physical
+ * address on all of them, each seeing its own. They are mapped, uncached,
+ * over a page of the kernel image in the first 4MB (@see map_device_page),
+ * whose page table every page directory shares.
+ *
+ * The timer of a local APIC counts down at the rate of the bus, divided by
+ * LAPIC_TIMER_DIVIDE, and interrupts its own CPU only, periodically or once.
+ * Its rate is unknown until measured against the PIT, once at boot (@see
+ * lapic_calibrate): the CPUs are assumed to share the bus, hence the rate.
+ * Programming it is a write to a register of the CPU, instead of the port
+ * I/O to the PIT, which only interrupts the bootstrap processor.
+ *
+ * Without a local APIC, as the cpuid feature bit says, the PIT keeps the
+ * ticks (@see timer.c).
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <x86/page.h>
+#include <page.h>
+#include <clock.h>
+#include <lapic.h>
+
+/* The cpuid feature bit of the local APIC, in edx */
+#define CPUID_APIC (1 << 9)
+
+/* The MSR of the physical address of the local APIC, and its enable bit */
+#define MSR_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+
+/* The registers, by their offset in bytes */
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+/* The bit of the spurious vector register enabling the local APIC */
+#define SVR_ENABLE (1 << 8)
+/* The bits of the timer entry */
+#define LVT_MASKED (1 << 16)
+#define LVT_PERIODIC (1 << 17)
+/* The bus rate is divided by 16, the value of the divide register */
+#define LAPIC_TIMER_DIVIDE 0x3
+
+/* The page the registers are mapped over */
+static uint32_t lapic_window[PAGE_SIZE / sizeof(uint32_t)]
+	__attribute__((aligned(PAGE_SIZE)));
+/* NULL until the registers are mapped */
+static volatile uint32_t *lapic = NULL;
+
+static inline uint32_t lapic_read(int reg) {
+	return lapic[reg / sizeof(uint32_t)];
+}
+
+static inline void lapic_write(int reg, uint32_t value) {
+	lapic[reg / sizeof(uint32_t)] = value;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+	uint64_t value;
+	asm volatile ("rdmsr" : "=A" (value) : "c" (msr));
+	return value;
+}
+
+/**
+ * @brief Maps the local APIC, if the CPU has one, and enables the one of
+ * the bootstrap processor
+ *
+ * Called once, with paging on and before the APs start.
+ *
+ * @return TRUE if there is a local APIC to use
+ */
+boolean_t lapic_init(void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	if (!(edx & CPUID_APIC)) return FALSE;
+
+	uint64_t base = rdmsr(MSR_APIC_BASE);
+	if (!(base & APIC_BASE_ENABLE)) return FALSE;
+
+	paddr_t regs = (paddr_t) (uint32_t) (base & ADDR_MASK);
+	if (map_device_page((vaddr_t) lapic_window, regs)) return FALSE;
+	lapic = lapic_window;
+
+	lapic_enable();
+	return TRUE;
+}
+
+/**
+ * @brief Enables the local APIC of the calling CPU, with its timer stopped
+ */
+void lapic_enable(void) {
+	lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_IDT_ENTRY);
+	lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIVIDE);
+	lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_IDT_ENTRY);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/**
+ * @brief Measures the rate of the timer against the PIT
+ *
+ * The timer counts down, masked, from its largest count, for ms
+ * milliseconds measured by the channel 2 of the PIT (@see clock_pit_start).
+ * Interrupts must be off.
+ *
+ * @return the cycles the timer counts in ms milliseconds
+ */
+uint32_t lapic_calibrate(unsigned int ms) {
+	lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_IDT_ENTRY);
+
+	clock_pit_start(ms);
+	lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+	clock_pit_wait();
+	uint32_t left = lapic_read(LAPIC_TIMER_CURRENT);
+
+	lapic_write(LAPIC_TIMER_INIT, 0);
+	return 0xFFFFFFFF - left;
+}
+
+/**
+ * @brief Makes the timer of the calling CPU interrupt it every cycles
+ */
+void lapic_timer_periodic(uint32_t cycles) {
+	lapic_write(LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_IDT_ENTRY);
+	lapic_write(LAPIC_TIMER_INIT, cycles);
+}
+
+/**
+ * @brief Makes the timer of the calling CPU interrupt it once, in cycles
+ */
+void lapic_timer_oneshot(uint32_t cycles) {
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_IDT_ENTRY);
+	lapic_write(LAPIC_TIMER_INIT, cycles);
+}
+
+/**
+ * @brief Returns the cycles left to the count of the timer, 0 once it is
+ * over
+ */
+uint32_t lapic_timer_count(void) {
+	return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+/**
+ * @brief Acknowledges the interrupt of the local APIC being handled
+ */
+void lapic_eoi(void) {
+	lapic_write(LAPIC_EOI, 0);
+}
@@ -0,0 +1,81 @@
+/**
+ * @file prof.c
+ * @brief The sampling profiler
+ *
+ * The timer handler of each CPU records the instruction it interrupted,
+ * with its privilege level and the thread running, while the profiler is on
+ * (@see prof_sample). The samples go in a ring of the CPU, which the timer
+ * handler fills and the profile system call drains (@see recring.c).
+ *
+ * Every CPU with ticks takes samples (@see tick and ap_tick): all of them
+ * with local APIC timers, only the bootstrap processor with the PIT alone.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <types.h>
+#include <cpu.h>
+#include <process.h>
+#include <recring.h>
+#include <profiler.h>
+
+static prof_sample_t samples[CPU_MAX * PROF_RING_SIZE];
+static recring_t rings;
+
+/**
+ * @brief Initializes the profiler, off
+ */
+void prof_init(void) {
+	recring_init(&rings, samples, sizeof(prof_sample_t), PROF_RING_SIZE);
+}
+
+/**
+ * @brief Records where the CPU was interrupted, if the profiler is on
+ *
+ * Called by the timer handler with interrupts off.
+ *
+ * @param frame the eip and cs pushed by the interrupt
+ */
+void prof_sample(uint32_t *frame) {
+	cpu_t *cpu = this_cpu();
+	prof_sample_t *sample = recring_reserve(&rings, cpu->id);
+	if (sample == NULL) return;
+
+	thread_t *self = cpu->current;
+	sample->eip = frame[0];
+	sample->user = (frame[1] & 0x3) != 0;
+	sample->cpu = cpu->id;
+	sample->tid = (self != NULL) ? self->tid : -1;
+	sample->pid = (self != NULL && self->process != NULL) ?
+			self->process->pid : -1;
+
+	recring_commit(&rings, cpu->id);
+}
+
+/**
+ * @brief Forgets the samples taken so far and turns the profiler on
+ */
+void prof_start(void) {
+	recring_start(&rings);
+}
+
+/**
+ * @brief Turns the profiler off, the samples stay until drained
+ * @return the number of samples dropped since it started
+ */
+int prof_stop(void) {
+	return recring_stop(&rings);
+}
+
+/**
+ * @brief Copies samples out to user memory, the oldest of each CPU first
+ *
+ * @param buf the user buffer
+ * @param max the number of samples it can hold
+ * @return the number of samples copied, a negative error code if buf is
+ * invalid
+ */
+int prof_drain(prof_sample_t *buf, int max) {
+	return recring_drain(&rings, buf, max);
+}
@@ -0,0 +1,187 @@
+/**
+ * @file serial.c
+ * @brief The log on the first serial port
+ *
+ * The kernel, and user programs through kstat (@see kstat.h), write log
+ * records to a ring, which the serial port sends out behind their back: a
+ * record is only copied in, and the transmitter is fed from its interrupt,
+ * a FIFO of 16 bytes at a time. Nobody ever waits for the port. A record
+ * which doesn't fit in the ring is dropped whole, and counted.
+ *
+ * The ring is protected by a spinlock taken with the interrupts disabled,
+ * so that a record can be logged from anywhere, a handler included.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <asm.h>
+#include <seg.h>
+
+#include <drivers.h>
+#include <interrupts.h>
+#include <spinlock.h>
+#include <serial.h>
+
+/* The registers of the UART, from its base port */
+#define COM1_PORT		0x3F8
+#define UART_DATA		0	// Transmit holding register
+#define UART_IER		1	// Interrupt enable register
+#define UART_FCR		2	// FIFO control register, on writes
+#define UART_IIR		2	// Interrupt identification, on reads
+#define UART_LCR		3	// Line control register
+#define UART_MCR		4	// Modem control register
+#define UART_LSR		5	// Line status register
+#define UART_DLL		0	// Divisor latch, while LCR_DLAB is set
+#define UART_DLM		1
+
+#define UART_IER_THRE	0x02	// Interrupt when the FIFO is empty
+#define UART_FCR_SETUP	0xC7	// Enabled and cleared, 14 bytes trigger
+#define UART_LCR_8N1	0x03
+#define UART_LCR_DLAB	0x80
+#define UART_MCR_SETUP	0x0B	// DTR, RTS and OUT2, which gates the IRQ
+#define UART_LSR_THRE	0x20	// The FIFO is empty
+#define UART_FIFO_SIZE	16
+#define UART_DIVISOR	1		// 115200 bauds
+
+/* The mask register of the master PIC */
+#define PIC_MASTER_MASK	0x21
+
+/* The records, from tail to head. Both only grow, and wrap around */
+static char ring[SERIAL_RING_SIZE];
+static unsigned int head = 0;
+static unsigned int tail = 0;
+
+/* Protects all of the above and below */
+static spinlock_t serial_lock;
+static boolean_t ready = FALSE;		// The port is set up
+static boolean_t sending = FALSE;	// The port interrupts when it is done
+
+/* Counters, since the last reset */
+static unsigned int records = 0;
+static unsigned int dropped = 0;
+static unsigned int bytes = 0;
+
+/**
+ * @brief Feeds the transmitter from the ring, with the lock held
+ *
+ * The port interrupts when it sent what it was given, and the next bytes
+ * go out then. When the ring is empty, the interrupt is turned off.
+ */
+static void feed_port(void) {
+	if (!(inb(COM1_PORT + UART_LSR) & UART_LSR_THRE)) return;
+
+	int n = 0;
+	while (n < UART_FIFO_SIZE && tail != head) {
+		outb(COM1_PORT + UART_DATA, ring[tail % SERIAL_RING_SIZE]);
+		tail++;
+		n++;
+	}
+
+	sending = n > 0;
+	outb(COM1_PORT + UART_IER, sending ? UART_IER_THRE : 0);
+}
+
+/**
+ * @brief Sets the port up and installs its interrupt handler
+ */
+void init_serial(void) {
+	spin_init(&serial_lock);
+
+	trap_gate_t serial_gate;
+	serial_gate.segment = SEGSEL_KERNEL_CS;
+	serial_gate.offset = (uint32_t) serial_interrupt_handler;
+	serial_gate.privilege_level = 0x0;
+	insert_to_idt(create_trap_idt_entry(&serial_gate), SERIAL_IDT_ENTRY);
+
+	outb(COM1_PORT + UART_IER, 0);
+	outb(COM1_PORT + UART_LCR, UART_LCR_DLAB);
+	outb(COM1_PORT + UART_DLL, UART_DIVISOR & 0xFF);
+	outb(COM1_PORT + UART_DLM, UART_DIVISOR >> 8);
+	outb(COM1_PORT + UART_LCR, UART_LCR_8N1);
+	outb(COM1_PORT + UART_FCR, UART_FCR_SETUP);
+	outb(COM1_PORT + UART_MCR, UART_MCR_SETUP);
+
+	outb(PIC_MASTER_MASK, inb(PIC_MASTER_MASK) & ~(1 << SERIAL_IRQ));
+
+	spin_lock_irqsave(&serial_lock);
+	ready = TRUE;
+	if (tail != head) feed_port();
+	spin_unlock_irqrestore(&serial_lock);
+}
+
+/**
+ * @brief Called when the port interrupts, its FIFO empty
+ */
+void serial_handler(void) {
+	// Reading the identification clears the interrupt of the port
+	inb(COM1_PORT + UART_IIR);
+
+	spin_lock_irqsave(&serial_lock);
+	feed_port();
+	spin_unlock_irqrestore(&serial_lock);
+
+	ack_interrupt();
+}
+
+/**
+ * @brief Queues a log record, ended by a newline if it isn't already
+ *
+ * @return TRUE if it was queued, FALSE if it was dropped for lack of room
+ */
+boolean_t serial_log(const char *record, int len) {
+	if (len <= 0) return TRUE;
+	int newline = record[len - 1] != '\n';
+
+	spin_lock_irqsave(&serial_lock);
+	if (len + newline > SERIAL_RING_SIZE - (head - tail)) {
+		dropped++;
+		spin_unlock_irqrestore(&serial_lock);
+		return FALSE;
+	}
+
+	int i;
+	for (i = 0; i < len; i++) ring[(head + i) % SERIAL_RING_SIZE] = record[i];
+	if (newline) ring[(head + len) % SERIAL_RING_SIZE] = '\n';
+	head += len + newline;
+	records++;
+	bytes += len + newline;
+
+	if (ready && !sending) feed_port();
+	spin_unlock_irqrestore(&serial_lock);
+	return TRUE;
+}
+
+/**
+ * @brief Formats a log record of the kernel, cut at SERIAL_RECORD_MAX bytes
+ */
+void klog(const char *fmt, ...) {
+	char record[SERIAL_RECORD_MAX];
+	va_list vl;
+
+	va_start(vl, fmt);
+	int len = vsnprintf(record, sizeof(record), fmt, vl);
+	va_end(vl);
+
+	if (len >= (int) sizeof(record)) len = sizeof(record) - 1;
+	if (len > 0) serial_log(record, len);
+}
+
+/**
+ * @brief Copies the counters of the log
+ *
+ * @param stats where to copy them
+ * @param reset whether to clear the records, dropped and bytes counts
+ */
+void serial_stats(kstat_serial_t *stats, boolean_t reset) {
+	spin_lock_irqsave(&serial_lock);
+	stats->records = records;
+	stats->dropped = dropped;
+	stats->bytes = bytes;
+	stats->pending = head - tail;
+	if (reset) records = dropped = bytes = 0;
+	spin_unlock_irqrestore(&serial_lock);
+}
@@ -0,0 +1,296 @@
+/**
+ * @file timeout.c
+ * @brief Kernel timeouts, kept in a hierarchical timer wheel
+ *
+ * The first level of the wheel has a slot for each of the next
+ * WHEEL_ROOT_SLOTS ticks. Each of the levels above covers WHEEL_LEVEL_SLOTS
+ * times more ticks per slot than the one below. A timeout goes in the slot
+ * of the lowest level its delay fits in, so that adding or cancelling one is
+ * O(1). Whenever the first level wraps around, the next slot of the level
+ * above is emptied into the levels below, and so on upwards: each timeout
+ * moves down at most WHEEL_LEVELS times before firing.
+ *
+ * The wheel is used from the timer interrupt. Anyone else touching it must
+ * have called dont_switch_me_out(), during which the timer handler leaves
+ * the wheel alone. The interrupts missed meanwhile are caught up on the next
+ * run, since the wheel keeps its own clock.
+ *
+ * A timeout may also have a deadline finer than the tick, in nanoseconds of
+ * the clock (@see clock.c). Once its tick comes, it waits in a pairing heap
+ * ordered by deadline until the deadline passes, and the timer splits the
+ * tick to fire it on time (@see split_tick). Placing it there or cancelling
+ * it is O(log n) amortized, however many timeouts wait.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <timeout.h>
+#include <clock.h>
+
+/* The slots of the first level */
+static timeout_t *root[WHEEL_ROOT_SLOTS];
+/* The slots of the levels above */
+static timeout_t *levels[WHEEL_LEVELS][WHEEL_LEVEL_SLOTS];
+/* The next tick the wheel has to process */
+static unsigned int wheel_time = 0;
+/* The timeouts past their tick but not their deadline, the earliest first */
+PH_NEW_HEAD(fine_heap_t, timeout_t);
+static fine_heap_t fine;
+/* The slot of the timeouts in the heap, which only marks them armed */
+#define FINE_SLOT ((timeout_t **) &fine)
+#define FINE_BEFORE(a, b) ((a)->deadline < (b)->deadline)
+
+/**
+ * @brief Returns the index in levels[level] of the slot of a tick
+ */
+static int level_index(unsigned int tick, int level) {
+	int shift = WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS;
+	return (tick >> shift) & (WHEEL_LEVEL_SLOTS - 1);
+}
+
+/**
+ * @brief Puts a timeout in the slot matching its expiry
+ */
+static void place_timeout(timeout_t *timeout) {
+	unsigned int delta = timeout->expires - wheel_time;
+	timeout_t **slot;
+
+	if ((int) delta < 0) {
+		// Late already, fire on the next tick processed
+		slot = &root[wheel_time & (WHEEL_ROOT_SLOTS - 1)];
+	} else if (delta < WHEEL_ROOT_SLOTS) {
+		slot = &root[timeout->expires & (WHEEL_ROOT_SLOTS - 1)];
+	} else {
+		int level = 0;
+		unsigned int span = WHEEL_ROOT_SLOTS * WHEEL_LEVEL_SLOTS;
+		while (level < WHEEL_LEVELS - 1 && delta >= span) {
+			span *= WHEEL_LEVEL_SLOTS;
+			level++;
+		}
+		slot = &levels[level][level_index(timeout->expires, level)];
+	}
+
+	timeout->prev = NULL;
+	timeout->next = *slot;
+	if (*slot != NULL) (*slot)->prev = timeout;
+	*slot = timeout;
+	timeout->slot = slot;
+}
+
+/**
+ * @brief Puts a timeout whose tick came in the heap of fine timeouts
+ */
+static void place_fine(timeout_t *timeout) {
+	PH_INSERT(&fine, timeout, fine_link, FINE_BEFORE);
+	timeout->slot = FINE_SLOT;
+}
+
+/**
+ * @brief Takes a timeout out of its slot
+ */
+static void unlink_timeout(timeout_t *timeout) {
+	if (timeout->slot == FINE_SLOT) {
+		PH_REMOVE(&fine, timeout, fine_link, FINE_BEFORE);
+		timeout->slot = NULL;
+		return;
+	}
+
+	if (timeout->prev != NULL) timeout->prev->next = timeout->next;
+	else *timeout->slot = timeout->next;
+	if (timeout->next != NULL) timeout->next->prev = timeout->prev;
+
+	timeout->next = NULL;
+	timeout->prev = NULL;
+	timeout->slot = NULL;
+}
+
+/**
+ * @brief Moves the timeouts of a slot of an upper level down the wheel
+ * @return the index of the slot
+ */
+static int cascade(int level) {
+	int index = level_index(wheel_time, level);
+	timeout_t *timeout = levels[level][index];
+	levels[level][index] = NULL;
+
+	while (timeout != NULL) {
+		timeout_t *next = timeout->next;
+		place_timeout(timeout);
+		timeout = next;
+	}
+
+	return index;
+}
+
+/**
+ * @brief Initializes the wheel
+ */
+void init_timeouts(void) {
+	int i, j;
+	for (i = 0; i < WHEEL_ROOT_SLOTS; ++i) root[i] = NULL;
+	for (i = 0; i < WHEEL_LEVELS; ++i)
+		for (j = 0; j < WHEEL_LEVEL_SLOTS; ++j) levels[i][j] = NULL;
+	wheel_time = 0;
+	PH_INIT_HEAD(&fine);
+}
+
+/**
+ * @brief Initializes a timeout, which is not armed
+ *
+ * @param timeout the timeout
+ * @param fn the function called when it fires
+ * @param arg the argument of fn
+ */
+void init_timeout(timeout_t *timeout, timeout_fn_t fn, void *arg) {
+	timeout->fn = fn;
+	timeout->arg = arg;
+	timeout->deadline = 0;
+	timeout->next = NULL;
+	timeout->prev = NULL;
+	timeout->slot = NULL;
+	PH_INIT_ELEM(timeout, fine_link);
+}
+
+/**
+ * @brief Arms a timeout to fire at the given tick (@see get_time)
+ *
+ * A timeout already armed is moved to the new tick.
+ */
+void add_timeout(timeout_t *timeout, unsigned int expires) {
+	add_timeout_ns(timeout, expires, 0);
+}
+
+/**
+ * @brief Arms a timeout to fire at the given nanosecond (@see clock_ns)
+ *
+ * @param timeout the timeout, moved if it is armed already
+ * @param expires a tick, at most the one in which the deadline falls
+ * @param deadline the nanosecond at which it fires, 0 to fire at the tick
+ */
+void add_timeout_ns(timeout_t *timeout, unsigned int expires,
+		uint64_t deadline) {
+	if (timeout->slot != NULL) unlink_timeout(timeout);
+	timeout->expires = expires;
+	timeout->deadline = deadline;
+	place_timeout(timeout);
+}
+
+/**
+ * @brief Disarms a timeout, nothing happens if it isn't armed
+ */
+void cancel_timeout(timeout_t *timeout) {
+	if (timeout->slot != NULL) unlink_timeout(timeout);
+}
+
+/**
+ * @brief Tells whether a timeout is armed
+ */
+boolean_t timeout_pending(timeout_t *timeout) {
+	return timeout->slot != NULL;
+}
+
+/**
+ * @brief Gives a tick before which no timeout fires
+ *
+ * The tick is exact if the earliest timeout is in the first level of the
+ * wheel. Otherwise it is the tick at which the slot holding the earliest
+ * timeouts moves down, which is early enough.
+ *
+ * @param tick placeholder for the tick
+ * @return FALSE if no timeout is armed, TRUE otherwise
+ */
+boolean_t next_timeout(unsigned int *tick) {
+	int i;
+	for (i = 0; i < WHEEL_ROOT_SLOTS; ++i) {
+		if (root[(wheel_time + i) & (WHEEL_ROOT_SLOTS - 1)] != NULL) {
+			*tick = wheel_time + i;
+			return TRUE;
+		}
+	}
+
+	// The first level is empty, up to the next time it wraps
+	unsigned int wrap = (wheel_time | (WHEEL_ROOT_SLOTS - 1)) + 1;
+	int level;
+	for (level = 0; level < WHEEL_LEVELS; ++level) {
+		for (i = 0; i < WHEEL_LEVEL_SLOTS; ++i) {
+			if (levels[level][i] != NULL) {
+				*tick = wrap;
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * @brief Fires every timeout expiring up to the tick now
+ *
+ * This is called by the timer handler.
+ *
+ * @return the number of timeouts which fired
+ */
+int run_timeouts(unsigned int now) {
+	int fired = 0;
+
+	while ((int) (now - wheel_time) >= 0) {
+		int index = wheel_time & (WHEEL_ROOT_SLOTS - 1);
+
+		// Refill the first level from the ones above when it wraps
+		int level;
+		for (level = 0; index == 0 && level < WHEEL_LEVELS; ++level) {
+			if (cascade(level) != 0) break;
+		}
+
+		timeout_t *timeout;
+		while ((timeout = root[index]) != NULL) {
+			unlink_timeout(timeout);
+			if (timeout->deadline != 0) {
+				place_fine(timeout);
+				continue;
+			}
+			fired++;
+			timeout->fn(timeout->arg);
+		}
+
+		wheel_time++;
+	}
+
+	return fired;
+}
+
+/**
+ * @brief Fires every timeout past its tick whose deadline passed
+ *
+ * This is called by the timer handler, on each tick and when a tick is
+ * split.
+ *
+ * @return the number of timeouts which fired
+ */
+int run_fine_timeouts(void) {
+	int fired = 0;
+	uint64_t now = clock_ns();
+
+	timeout_t *timeout;
+	while ((timeout = PH_GET_MIN(&fine)) != NULL && timeout->deadline <= now) {
+		unlink_timeout(timeout);
+		fired++;
+		timeout->fn(timeout->arg);
+	}
+
+	return fired;
+}
+
+/**
+ * @brief Gives the earliest deadline of the timeouts past their tick
+ *
+ * @param deadline placeholder for the deadline
+ * @return FALSE if there is no such timeout, TRUE otherwise
+ */
+boolean_t next_fine_timeout(uint64_t *deadline) {
+	if (PH_EMPTY(&fine)) return FALSE;
+	*deadline = PH_GET_MIN(&fine)->deadline;
+	return TRUE;
+}
@@ -5,6 +5,29 @@
  * The timer interrupt handler receives interrupts from the clock at set
  * intervals and handled them by incrementing an internal counter and calling
  * a "user"-defined callback function.
+ *
+ * When only the idle thread can run, the timer goes tickless: it is
+ * programmed for a single interrupt at the next timeout, or as far as the
+ * PIT can count, and the CPU halts until then (@see idle_sleep). The ticks
+ * skipped are added to the counter when the CPU wakes up.
+ *
+ * A timeout with a deadline within the coming tick splits it: the PIT is
+ * programmed for a single interrupt at the deadline, then for another at the
+ * end of the tick (@see split_tick). The interrupt at the deadline isn't a
+ * tick, it only fires the timeouts which are due.
+ *
+ * The ticks come from the PIT, unless the CPU has a local APIC (@see
+ * lapic.c): its timer is then calibrated against the PIT at boot and takes
+ * over, in both its periodic and one-shot modes, and the PIT is masked.
+ * The counts are in cycles of whichever timer keeps the ticks.
+ *
+ * The timer of the local APIC of every application processor ticks at the
+ * same rate, periodically. Its ticks only serve the scheduler and the profiler
+ * of that CPU (@see ap_tick); the tick counter and the timeouts stay with the
+ * bootstrap processor. Without a local APIC, the APs have no ticks.
+ *
+ * This file also holds the scheduler lock, a spinlock which serializes the
+ * scheduling decisions of all the CPUs (@see dont_switch_me_out).
  * 
  * @author Daniel Balle (dballe)
  * @author Loic Ottet (lottet)
@@ -18,17 +41,47 @@
 #include <x86/seg.h>
 #include <x86/timer_defines.h>
 #include <thread.h>
+#include <page.h>
 #include <context.h>
 #include <simics.h>
 #include <assert.h>
 
 #include <drivers.h>
 #include <interrupts.h>
+#include <timeout.h>
+#include <sched.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <vdso.h>
+#include <clock.h>
+#include <profiler.h>
+#include <trace.h>
+#include <lapic.h>
+#include <cputime.h>
+
+/* The mask register of the master PIC, and the line of the PIT */
+#define PIC_MASTER_MASK 0x21
+#define TIMER_IRQ 0
 
 
 // Global variables
 static unsigned int num_ticks = 0; // Clock counter (somewhat)
-static boolean_t no_switch = FALSE; // Can we initiate context switch ?
+static spinlock_t sched_lock; // Held by the CPU choosing whom to run
+static unsigned int oneshot_ticks = 0; // Ticks of the pending one-shot count
+static uint32_t oneshot_cycles = 0; // Its length in cycles
+static uint32_t split_end = 0; // Cycles of the tick at the split, 0 if none
+
+/* The timer keeping the ticks, the PIT until timer_use_lapic */
+static boolean_t use_lapic = FALSE;
+static uint32_t tick_cycles = TIMER_CYCLES_PER_INTERRUPT; // Cycles of a tick
+static unsigned int oneshot_max = TIMER_ONESHOT_MAX_TICKS; // In ticks
+static uint32_t split_min = TIMER_SPLIT_MIN_CYCLES; // Shortest split part
+
+/* Ticks of each application processor, @see ap_tick */
+static unsigned int ap_ticks[CPU_MAX];
+
+static void set_periodic(void);
+static void ap_tick(uint32_t *frame);
 
 /**
  * @brief Initializes the timer handler so it does its job
@@ -49,6 +102,35 @@ void init_timer() {
 	// Insertion
 	insert_to_idt(create_trap_idt_entry(&timer_gate), TIMER_IDT_ENTRY);
 
+	// The local APIC timers share the handler, in case they take over
+	timer_gate.offset = (uint32_t) lapic_timer_interrupt_handler;
+	insert_to_idt(create_trap_idt_entry(&timer_gate), LAPIC_TIMER_IDT_ENTRY);
+	timer_gate.offset = (uint32_t) lapic_spurious_handler;
+	insert_to_idt(create_trap_idt_entry(&timer_gate),
+		LAPIC_SPURIOUS_IDT_ENTRY);
+
+	spin_init(&sched_lock);
+	clock_init();
+	set_periodic();
+}
+
+/**
+ * @brief Acknowledges the interrupt of the timer keeping the ticks
+ */
+static void timer_ack(void) {
+	if (use_lapic) lapic_eoi();
+	else ack_interrupt();
+}
+
+/**
+ * @brief Programs the timer to interrupt every tick
+ */
+static void set_periodic(void) {
+	if (use_lapic) {
+		lapic_timer_periodic(tick_cycles);
+		return;
+	}
+
 	// Period computation
 	uint16_t period = TIMER_CYCLES_PER_INTERRUPT;
 	uint8_t period_lsb = period & 0xFF;
@@ -60,6 +142,224 @@ void init_timer() {
 	outb(TIMER_PERIOD_IO_PORT, period_msb);
 }
 
+/**
+ * @brief Programs the timer for a single interrupt in the given number of
+ * cycles, which end the given number of ticks. Interrupts must be disabled.
+ */
+static void program_oneshot(unsigned int ticks, uint32_t cycles) {
+	oneshot_ticks = ticks;
+	oneshot_cycles = cycles;
+
+	if (use_lapic) {
+		lapic_timer_oneshot(cycles);
+		return;
+	}
+
+	outb(TIMER_MODE_IO_PORT, TIMER_ONE_SHOT);
+	outb(TIMER_PERIOD_IO_PORT, cycles & 0xFF);
+	outb(TIMER_PERIOD_IO_PORT, cycles >> 8);
+}
+
+/**
+ * @brief Programs the timer for a single interrupt in the given number of
+ * ticks, at most oneshot_max. Interrupts must be disabled.
+ */
+static void set_oneshot(unsigned int ticks) {
+	program_oneshot(ticks, ticks * tick_cycles);
+}
+
+/**
+ * @brief Splits the current tick at the earliest fine timeout, if it falls
+ * within the tick. Interrupts must be disabled.
+ *
+ * @param elapsed the cycles of the tick elapsed already
+ * @return TRUE if the tick was split
+ */
+static boolean_t split_tick(uint32_t elapsed) {
+	uint64_t deadline;
+	if (!next_fine_timeout(&deadline)) return FALSE;
+
+	uint64_t now = clock_ns();
+	uint64_t delay = (deadline > now) ? deadline - now : 0;
+	if (delay >= TIMER_NS_PER_TICK) return FALSE;
+
+	uint32_t cycles = div64_32(delay * tick_cycles, TIMER_NS_PER_TICK, NULL);
+	if (cycles == 0) cycles = 1;
+	if (elapsed + cycles + split_min >= tick_cycles) return FALSE;
+
+	split_end = elapsed + cycles;
+	program_oneshot(0, cycles);
+	return TRUE;
+}
+
+/**
+ * @brief Handles the interrupt splitting a tick, with nothing to account
+ *
+ * The timeouts due fire, and the timer is programmed for the rest of the
+ * tick, split again if another timeout falls in it. The thread interrupted
+ * goes on, unless it is idle and someone woke up.
+ */
+static void split_handler(void) {
+	uint32_t elapsed = split_end;
+	split_end = 0;
+
+	if (this_cpu()->no_switch) {
+		// The timeouts fire on the next tick
+		program_oneshot(1, tick_cycles - elapsed);
+		timer_ack();
+		return;
+	}
+
+	dont_switch_me_out();
+	run_fine_timeouts();
+	if (!split_tick(elapsed)) program_oneshot(1, tick_cycles - elapsed);
+
+	thread_t *self = get_self();
+	thread_t *other = NULL;
+	if (is_idle(self) && num_runnable() > 0) {
+		unset_state(self);
+		other = get_running();
+	}
+
+	timer_ack();
+	if (other != NULL) context_switch(self, other);
+	else you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Ends the pending one-shot count early, accounting the ticks which
+ * elapsed, and gets back to periodic interrupts. Interrupts must be disabled.
+ */
+static void stop_oneshot(void) {
+	uint32_t count;
+	if (use_lapic) count = lapic_timer_count();
+	else {
+		outb(TIMER_MODE_IO_PORT, TIMER_LATCH);
+		count = inb(TIMER_PERIOD_IO_PORT);
+		count |= inb(TIMER_PERIOD_IO_PORT) << 8;
+	}
+
+	if (count == 0 || count > oneshot_cycles) {
+		// It fired already, the pending interrupt accounts one tick
+		num_ticks += oneshot_ticks - 1;
+	} else {
+		num_ticks += (oneshot_cycles - count) / tick_cycles;
+	}
+
+	oneshot_ticks = 0;
+	set_periodic();
+	vdso_set_ticks(num_ticks);
+}
+
+/**
+ * @brief Halts the CPU until a thread other than idle can run
+ *
+ * Called by the idle thread of the bootstrap processor, with nothing else
+ * runnable. Each round programs a single interrupt for the next timeout and
+ * halts. The interrupts waking the CPU up run on top of us, and the timer
+ * ones may switch idle out: we only get back here once idle runs again.
+ */
+static void idle_sleep(void) {
+	for (;;) {
+		disable_interrupts();
+		if (num_runnable() > 0) break;
+
+		// A split tick has to run to its end
+		uint64_t deadline;
+		if (split_end > 0 || next_fine_timeout(&deadline)) break;
+
+		unsigned int ticks = oneshot_max;
+		unsigned int next;
+		if (next_timeout(&next) && next - num_ticks < ticks)
+			ticks = ((int) (next - num_ticks) > 0) ? next - num_ticks : 0;
+		if (ticks <= 1) break;
+
+		set_oneshot(ticks);
+		asm volatile ("sti; hlt");
+
+		// Another device woke us up, the ticks go on
+		disable_interrupts();
+		if (oneshot_ticks > 0) stop_oneshot();
+		enable_interrupts();
+	}
+
+	enable_interrupts();
+}
+
+/**
+ * @brief The idle thread of the bootstrap processor, once it exec'd idle
+ *
+ * Like the idle threads of the other CPUs (@see ap_idle), it stays in the
+ * kernel: with nothing to do, it has frames zeroed in advance by the worker
+ * of the CPU and then stops the ticks until a thread has something to do,
+ * outside of any interrupt handler. Further interrupts can still switch it
+ * out meanwhile.
+ */
+void bsp_idle(void) {
+	thread_t *self = get_self();
+
+	for (;;) {
+		queue_refill();
+		idle_sleep();
+
+		// Someone is runnable, don't wait for the next tick
+		dont_switch_me_out();
+		thread_t *other = NULL;
+		if (num_runnable() > 0 || sched_steal()) {
+			unset_state(self);
+			other = get_running();
+		}
+		if (other != NULL) {
+			context_switch(self, other);
+			continue;
+		}
+		you_can_switch_me_out_now();
+
+		// The next timeout is too close to stop the ticks for
+		disable_interrupts();
+		if (num_runnable() == 0) asm volatile ("sti; hlt");
+		else enable_interrupts();
+	}
+}
+
+/**
+ * @brief Handles a tick of the local APIC timer of an application processor
+ *
+ * Only the scheduler of the CPU runs: the thread which used its quantum, or
+ * sees a more urgent thread queued, gives the CPU to the next in line. Its
+ * idle thread polls the run queue (@see ap_idle) and is left alone. The
+ * profiler samples the CPU like on the bootstrap processor.
+ *
+ * @param frame the eip, cs and eflags pushed by the interrupt
+ */
+static void ap_tick(uint32_t *frame) {
+	prof_sample(frame);
+
+	if (this_cpu()->no_switch) {
+		lapic_eoi();
+		return;
+	}
+
+	dont_switch_me_out();
+	thread_t *self = get_self();
+	thread_t *other = NULL;
+
+	if (!is_idle(self)) {
+		if (++ap_ticks[cpu_id()] % SCHED_AGING_PERIOD == 0) sched_age(self);
+		if (sched_tick(self)) {
+			trace_hint_switch(SCHED_SWITCH_TICK);
+			set_runnable(self);
+			other = get_running();
+			// A throttled thread may leave nobody to run
+			if (other == NULL) other = idle();
+		}
+	}
+
+	lapic_eoi();
+	if (other != NULL) context_switch(self, other);
+	else you_can_switch_me_out_now();
+}
+
 /**
  * @brief Calls the tickback function and increments the counter
  * 
@@ -67,78 +367,133 @@ void init_timer() {
  * function to disable interrupts if its actions need to access shared data
  * structures in an atomical way. The rationale is that there is no sense in
  * disabling and then enabling the interrupts over an empty tickback function.
+ *
+ * @param frame the eip, cs and eflags pushed by the interrupt
  */
-void timer_handler() {
-	++num_ticks;
+static void tick(uint32_t *frame) {
+	if (cpu_id() != 0) {
+		ap_tick(frame);
+		return;
+	}
 
-	if (no_switch) {
-		ack_interrupt();	
+	if (split_end > 0) {
+		split_handler();
 		return;
 	}
 
-	// Awake sleeping threads
-	thread_t *head;
-	boolean_t awoken = FALSE;
-	while ((head = get_sleeping()) != NULL
-		&& head->wake <= num_ticks) {
-	
-		// Make the thread runnable again but don't transfer
-		set_runnable(head);
-		awoken = TRUE;
+	++num_ticks;
+	prof_sample(frame);
+
+	if (oneshot_ticks > 0) {
+		// The one-shot count is over, account for the ticks it lasted
+		num_ticks += oneshot_ticks - 1;
+		oneshot_ticks = 0;
+		set_periodic();
 	}
+	vdso_set_ticks(num_ticks);
 
-	// If we are the idle thread and woke someone up
-	if (awoken && is_idle(get_running())) {
-		thread_t *self = get_self();
-		unset_state(self);
-		thread_t *other = get_running();
-		dont_switch_me_out();
-		ack_interrupt();
-		context_switch(self, other);
+	if (this_cpu()->no_switch) {
+		timer_ack();
 		return;
 	}
 
-	// Time slicing
-	/**
-	 * Since we context_switch to idle, idle will be on the 
-	 * "running" list. Thus we actually never have an empty 
-	 * list. So to see if we have another thread other than 
-	 * idle to run the size of "running" must be greater than 
-	 * 1.
-	 */
+	// Fire the timeouts, which most notably awake sleeping threads
+	dont_switch_me_out();
+	run_timeouts(num_ticks);
+	keyboard_poll();
+	run_fine_timeouts();
+	split_tick(0);
+
 	thread_t *other = NULL;
 	thread_t *self = get_self();
 
-	/**
-	 * If we aren't the idle thread we just transfer to the 
-	 * next thread in line.
-	 */
-	if (!is_idle(self)) {
-
-		// Add ourselves to the end of the list
-		set_runnable(self);
-		other = get_running(); // Never NULL, but check
+	// Even out the loads of the CPUs once in a while
+	if (num_cpus() > 1 && num_ticks % SCHED_BALANCE_PERIOD == 0)
+		sched_balance();
 
-	} else {
+	if (!is_idle(self)) {
+		// Every runnable thread gets back to its base level once in a while
+		if (num_ticks % SCHED_AGING_PERIOD == 0) sched_age(self);
 
-		// We need to check if we have other threads ready
-		unsigned int ready = num_runnable();
-		if (ready > 1) {
-			// Remove idle from the list
-			unset_state(self);
+		/**
+		 * The scheduler tells us if we used our quantum or if a more
+		 * urgent thread is runnable, in which case we go back to our run
+		 * queue and transfer to the next thread in line.
+		 */
+		if (sched_tick(self)) {
+			trace_hint_switch(SCHED_SWITCH_TICK);
+			set_runnable(self);
 			other = get_running();
+			// A throttled thread may leave nobody to run
+			if (other == NULL) other = idle();
 		}
+
+	} else if (num_runnable() > 0 || sched_steal()) {
+		// Idle runs only as long as nobody else can, even on other CPUs
+		unset_state(self);
+		other = get_running();
 	}
 
-	dont_switch_me_out();
-	ack_interrupt();
+	timer_ack();
 	if (other != NULL) context_switch(self, other);
 	else you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Handles a tick, counting the time it takes in kernel mode when it
+ * interrupted user mode (@see cputime.c)
+ *
+ * @param frame the eip, cs and eflags pushed by the interrupt
+ */
+void timer_handler(uint32_t *frame) {
+	if ((frame[1] & 0x3) == 0) {
+		tick(frame);
+		return;
+	}
+
+	cputime_enter();
+	tick(frame);
+	cputime_leave(0);
+}
 
-	return;	
 
+/**
+ * @brief Hands the ticks over to the local APIC timer, if there is one
+ *
+ * The timer is calibrated against the PIT, then ticks periodically at the
+ * same rate, and the PIT is masked. Called once by the bootstrap processor,
+ * with paging on and interrupts off, before the APs start.
+ *
+ * @return TRUE if the local APIC timer keeps the ticks
+ */
+boolean_t timer_use_lapic(void) {
+	if (!lapic_init()) return FALSE;
+
+	uint32_t cycles = lapic_calibrate(LAPIC_CALIBRATE_MS);
+	cycles = cycles / LAPIC_CALIBRATE_MS * TIMER_USECS_PER_TICK / 1000;
+	if (cycles == 0) return FALSE;
+
+	tick_cycles = cycles;
+	oneshot_max = 0xFFFFFFFF / cycles;
+	split_min = TIMER_SPLIT_MIN_CYCLES * (uint64_t) cycles
+		/ (TIMER_CYCLES_PER_INTERRUPT);
+	use_lapic = TRUE;
+
+	outb(PIC_MASTER_MASK, inb(PIC_MASTER_MASK) | (1 << TIMER_IRQ));
+	set_periodic();
+	return TRUE;
 }
 
+/**
+ * @brief Starts the ticks of an application processor, on the timer of its
+ * local APIC, if the bootstrap processor uses its own
+ */
+void timer_start_ap(void) {
+	if (!use_lapic) return;
+
+	lapic_enable();
+	lapic_timer_periodic(tick_cycles);
+}
 
 /**
  * @brief Retrieve the number of timer ticks since system boot
@@ -152,16 +507,41 @@ unsigned int get_time(void) {
  * @brief Asks not to be switched out by a clock interrupt
  * 
  * A thread will call this function when it is acting on critical data
- * structures (most notably the running list) and a context switch at that
+ * structures (most notably the run queues) and a context switch at that
  * moment would most certainly result in inconsistencies within the kernel.
+ *
+ * This also keeps the other CPUs out of these structures: the CPU takes the
+ * scheduler lock, and keeps it until you_can_switch_me_out_now(). The lock
+ * belongs to the CPU rather than to the thread, it stays held across the
+ * context_switch and the thread switched to releases it. A CPU holding it
+ * already, such as when a mutex yields within the area, goes on.
+ *
+ * Interrupts are off until the lock is ours, so that no handler on our CPU
+ * can see the area entered before it is.
  */
 void dont_switch_me_out() {
-	no_switch = TRUE;
+	uint32_t eflags = save_disable_interrupts();
+
+	cpu_t *cpu = this_cpu();
+	if (!cpu->no_switch) {
+		spin_lock(&sched_lock);
+		cpu->no_switch = TRUE;
+	}
+
+	restore_interrupts(eflags);
 }
 
 /**
  * @brief Exits the dont_switch_me_out area.
  */
 void you_can_switch_me_out_now() {
-	no_switch = FALSE;
+	uint32_t eflags = save_disable_interrupts();
+
+	cpu_t *cpu = this_cpu();
+	if (cpu->no_switch) {
+		cpu->no_switch = FALSE;
+		spin_unlock(&sched_lock);
+	}
+
+	restore_interrupts(eflags);
 }
@@ -95,10 +95,12 @@ void _exception_handler(uint32_t cause, uint32_t error_code) {
 			vaddr_t esp3 = thread->swexn_esp;
 			void *arg = thread->swexn_arg;
 
-			// Unregister the exception handler
-			thread->swexn_eip = 0x0;
-			thread->swexn_esp = 0x0;
-			thread->swexn_arg = NULL;
+			// Unregister the exception handler, unless it is persistent
+			if (!thread->swexn_persistent) {
+				thread->swexn_eip = 0x0;
+				thread->swexn_esp = 0x0;
+				thread->swexn_arg = NULL;
+			}
 
 			// Setup the stack for the handler
 			//if (!check_region(esp3, sizeof(ureg_t + 3 * sizeof(uint32_t)))) break;
@@ -13,11 +13,13 @@
 #include <context.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 #include <simics.h>
 #include <asm.h>
 
 #include <inc/syscall.h>
+#include <serial.h>
 
 /**
  * @brief Panic function
@@ -34,6 +36,7 @@ void panic(const char *fmt, ...) {
 	vsnprintf(buf, sizeof (buf), fmt, vl);
 	va_end(vl);
 	lprintf(buf);
+	serial_log(buf, strlen(buf));
 
 	va_start(vl, fmt);
 	vprintf(fmt, vl);
@@ -62,6 +65,7 @@ void kernel_panic(const char *fmt, ...) {
 	vsnprintf(buf, sizeof (buf), fmt, vl);
 	va_end(vl);
 	lprintf(buf);
+	serial_log(buf, strlen(buf));
 
 	va_start(vl, fmt);
 	vprintf(fmt, vl);
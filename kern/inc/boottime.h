@@ -0,0 +1,18 @@
+/**
+ * @file boottime.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the timeline of the boot
+ */
+
+#ifndef __KERN_BOOTTIME_H_
+#define __KERN_BOOTTIME_H_
+
+#include <kstat.h>
+
+void boot_start(void);
+void boot_mark(int phase);
+void boot_stats(kstat_boot_t *stats);
+
+#endif /* __KERN_BOOTTIME_H_ */
@@ -0,0 +1,37 @@
+/**
+ * @file clock.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the high resolution clock
+ */
+
+#ifndef __KERN_CLOCK_H_
+#define __KERN_CLOCK_H_
+
+#include <types.h>
+#include <inc/stdint.h>
+
+#define NS_PER_SEC 1000000000
+#define NS_PER_USEC 1000
+
+/* Length of the calibration of the TSC against the PIT, in milliseconds */
+#define CLOCK_CALIBRATE_MS 10
+
+/**
+ * @brief Reads the time stamp counter of the calling CPU
+ */
+static inline uint64_t rdtsc(void) {
+	uint64_t tsc;
+	asm volatile ("rdtsc" : "=A" (tsc));
+	return tsc;
+}
+
+void clock_init(void);
+void clock_pit_start(unsigned int ms);
+void clock_pit_wait(void);
+uint64_t clock_ns(void);
+uint32_t clock_tsc_khz(void);
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t *rem);
+
+#endif /* __KERN_CLOCK_H_ */
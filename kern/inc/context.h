@@ -195,5 +195,10 @@ unsigned int stack_switch(thread_t *self, thread_t *other, unsigned int);
  */
 void child_stack(uint32_t, thread_t *, unsigned int *, unsigned int);
 
+/**
+ * @see stack.c
+ */
+void entry_stack(thread_t *thread, void (*entry)(void *), void *arg);
+
 #endif /* !__P2_CONTEXT_H_ */
 
@@ -0,0 +1,119 @@
+/**
+ * @file cpu.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Structures and prototypes for the per-CPU state
+ */
+
+#ifndef __KERN_CPU_H_
+#define __KERN_CPU_H_
+
+/* Largest number of CPUs we drive */
+#define CPU_MAX 16
+/* Number of descriptors in the private GDT of each CPU */
+#define CPU_GDT_ENTRIES 8
+/* Index of the segment of the per-CPU block in each GDT, after the boot ones */
+#define SEGSEL_CPU_IDX 6
+/* Its selector, which the kernel keeps in %gs */
+#define SEGSEL_CPU (SEGSEL_CPU_IDX << 3)
+
+#ifndef ASSEMBLER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <types.h>
+#include <thread.h>
+
+/**
+ * The 32-bit task state segment. We only use it to find the kernel stack
+ * on a switch from user mode, the hardware task switching fields are left
+ * alone.
+ */
+typedef struct tss {
+	uint32_t	link;
+	uint32_t	esp0;
+	uint32_t	ss0;
+	uint32_t	unused[22];	// Inner stacks, registers and LDT
+	uint16_t	trap;
+	uint16_t	iomap;		// No I/O permission bitmap
+} tss_t;
+
+/**
+ * The state of a CPU, only ever touched by the CPU itself, except by the
+ * scheduler under its lock.
+ *
+ * Each CPU reaches its own block through %gs, whose segment starts at the
+ * block (@see cpu.c), so that the fields below are a single load away.
+ */
+typedef struct cpu {
+	struct cpu	*self;		// The address of the block
+	int			id;
+	thread_t	*current;	// The thread running on this CPU
+	boolean_t	no_switch;	// @see dont_switch_me_out
+
+	boolean_t	online;		// Did the CPU reach its idle thread ?
+	thread_t	*idle;		// Runs when nobody else can
+	thread_t	*fpu_owner;	// Whose FPU state is in the registers
+
+	/* Switches which reloaded cr3, and those which kept it, under the
+	 * scheduler lock */
+	unsigned int	cr3_loads;
+	unsigned int	cr3_skips;
+
+	thread_t	boot;		// Keeps the boot context of the CPU
+
+	tss_t		tss;
+	uint64_t	gdt[CPU_GDT_ENTRIES];	// Its TSS descriptor points to tss
+} cpu_t;
+
+/* Reads a 32-bit field of the block of the calling CPU */
+#define CPU_READ(type, field) ({ \
+	type __value; \
+	asm volatile ("movl %%gs:%c1, %0" : "=r" (__value) \
+			: "i" (offsetof(cpu_t, field))); \
+	__value; \
+})
+
+/**
+ * @return the block of the calling CPU
+ */
+static inline cpu_t *this_cpu(void) {
+	return CPU_READ(cpu_t *, self);
+}
+
+/**
+ * @brief Returns the id of the calling CPU
+ *
+ * The caller must not be switched out, or the answer may be stale once it
+ * gets it.
+ */
+static inline int cpu_id(void) {
+	return CPU_READ(int, id);
+}
+
+/**
+ * @brief Returns the thread running on the calling CPU
+ *
+ * This is right even if we move to another CPU right after the load: the
+ * thread is ourselves wherever we run.
+ */
+static inline thread_t *cpu_current(void) {
+	return CPU_READ(thread_t *, current);
+}
+
+/* Per-CPU state */
+void cpu_init(int id);
+void cpu_enable_smp(int count);
+void cpu_set_online(void);
+void cpu_set_esp0(uint32_t esp0);
+int num_cpus(void);
+cpu_t *get_cpu(int id);
+
+/* Bring-up of the application processors, @see smp_glue.c */
+void smp_start(void);
+void ap_main(int id);
+
+#endif /* ASSEMBLER */
+
+#endif /* __KERN_CPU_H_ */
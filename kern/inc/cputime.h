@@ -0,0 +1,24 @@
+/**
+ * @file cputime.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the accounting of the CPU time
+ */
+
+#ifndef __KERN_CPUTIME_H_
+#define __KERN_CPUTIME_H_
+
+#include <types.h>
+#include <thread.h>
+#include <process.h>
+#include <rusage.h>
+
+void cputime_enter(void);
+int cputime_leave(int ret);
+void cputime_switch(thread_t *prev, thread_t *next);
+void cputime_vanish(thread_t *thread);
+void cputime_bury(process_t *process);
+int cputime_usage(int who, rusage_t *usage);
+
+#endif /* __KERN_CPUTIME_H_ */
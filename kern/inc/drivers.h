@@ -16,12 +16,25 @@
 
 #define TIMER_INTERRUPT_RATE 100 // Number of interrupts per second
 #define TIMER_CYCLES_PER_INTERRUPT TIMER_RATE / TIMER_INTERRUPT_RATE
+// Command latching the counter of channel 0, to read it
+#define TIMER_LATCH 0x00
+// Largest number of ticks a one-shot count of the PIT can last, the local
+// APIC timer can last longer
+#define TIMER_ONESHOT_MAX_TICKS (0xFFFF / (TIMER_CYCLES_PER_INTERRUPT))
+// Length of a tick
+#define TIMER_USECS_PER_TICK (1000000 / TIMER_INTERRUPT_RATE)
+#define TIMER_NS_PER_TICK (1000000000 / TIMER_INTERRUPT_RATE)
+// Shortest part of a tick split at a sub-tick timeout, in PIT cycles
+#define TIMER_SPLIT_MIN_CYCLES 64
 
 void install_handlers(void);
 void ack_interrupt(void);
 
 void init_timer(void);
 void timer_interrupt_handler(void);
+boolean_t timer_use_lapic(void);
+void timer_start_ap(void);
+void bsp_idle(void);
 unsigned int get_time(void);
 
 void dont_switch_me_out(void);
@@ -29,12 +42,17 @@ void you_can_switch_me_out_now(void);
 
 /* Keyboard */
 
-// Buffer constant
-#define KEY_BUFFER_SIZE 256
+// Buffer constants, the sizes of the rings powers of two
+#define KEY_BUFFER_SIZE 1024	// Scancodes not processed yet
+#define INPUT_BUFFER_SIZE 8192	// Characters typed and not read yet
+#define KEY_ECHO_CHUNK 64		// Characters echoed at a time
 #define MAX_LINE_LENGTH 4096
 
 void init_keyboard(void);
 void keyboard_handler(void);
+void keyboard_poll(void);
+int keyboard_readline(int term, char *buf, int size);
+int keyboard_getchar(int term);
 int readchar(void);
 void keyboard_interrupt_handler(void);
 
@@ -42,15 +60,39 @@ void keyboard_interrupt_handler(void);
 void init_console(void);
 
 char* get_mem_pos(int row, int col);
-void copy_char(int from_row, int from_col, int to_row, int to_col);
 
 boolean_t check_term_color(int color);
 
 boolean_t check_cursor_position(int row, int col);
 void send_curpos(int row, int col);
-void next_cursor(void);
 
-void scroll(void);
-void clear_row(int row);
+/* Virtual terminals, @see console.c */
+
+// Terminals, switched with Alt and the digit of the terminal, from 1
+#define NUM_TERMINALS 4
+
+void term_focus(int term);
+int term_focused(void);
+void term_putbytes(int term, const char *s, int len);
+int term_set_color(int term, int color);
+int term_set_cursor(int term, int row, int col);
+void term_get_cursor(int term, int *row, int *col);
+
+/* Console rings, one per terminal, @see conring.c */
+
+// Bytes queued for a terminal at most, a power of two
+#define CONRING_SIZE (32 * 1024)
+// Bytes print copies in from user space at a time
+#define CONRING_CHUNK 256
+// Bytes of echo of the keyboard waiting for the console at most
+#define CONRING_ECHO_SIZE 1024
+
+void conring_init(void);
+void conring_start(void);
+int conring_write(int term, const char *buf, int size);
+void conring_echo(int term, const char *buf, int size);
+void conring_flush(int term);
+void console_lock(int term);
+void console_unlock(int term);
 
 #endif /* _KERN_TIMER_H_ */
@@ -0,0 +1,43 @@
+/**
+ * @file edf.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Constants and prototypes for the earliest-deadline-first class
+ */
+
+#ifndef __KERN_EDF_H_
+#define __KERN_EDF_H_
+
+#include <types.h>
+#include <thread.h>
+#include <kstat.h>
+
+/* Thousandths of a CPU the class may be given, the rest is left to the
+ * other threads */
+#define EDF_MAX_BANDWIDTH 900
+/* Longest period, in ticks */
+#define EDF_MAX_PERIOD 100000
+
+/**
+ * @brief Tells whether a thread belongs to the earliest-deadline-first
+ * class
+ */
+static inline boolean_t edf_member(thread_t *thread) {
+	return thread->edf_budget != 0;
+}
+
+void edf_init(void);
+void edf_init_thread(thread_t *thread);
+int edf_set(thread_t *thread, unsigned int budget, unsigned int deadline,
+		unsigned int period);
+int edf_enqueue(thread_t *thread);
+void edf_dequeue(thread_t *thread);
+thread_t *edf_pick(void);
+unsigned int edf_count(int cpu);
+void edf_wakeup(thread_t *thread);
+boolean_t edf_preempts(thread_t *self, thread_t *woken);
+boolean_t edf_tick(thread_t *self);
+int edf_stats(kstat_edf_t *stats, int n, boolean_t reset);
+
+#endif /* __KERN_EDF_H_ */
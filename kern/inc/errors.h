@@ -67,11 +67,34 @@
 #define ERR_KERNEL_PAGE -39
 #define ERR_PAGE_NOT_PRESENT -40
 #define ERR_WORN_OUT_NEW_PAGES -41
+#define ERR_REGION_OVERLAP -42
+#define ERR_NO_REGION -43
+#define ERR_NO_SEGMENT -44
+#define ERR_TOO_MANY_SEGMENTS -45
+#define ERR_FRAME_LIMIT -47
+
+/* WORK QUEUES */
+#define ERR_WORK_QUEUE_FULL -48
+
+/* PIPES */
+#define ERR_NO_PIPE -49
+#define ERR_TOO_MANY_PIPES -50
+#define ERR_PIPE_CLOSED -51
+
+/* MESSAGES */
+#define ERR_IPC_GONE -52
+#define ERR_IPC_NO_CALLER -53
+
+/* SCHEDULING */
+#define ERR_NO_BANDWIDTH -54
 
 /* VANISH */
 #define ERR_ACTIVE_THREADS -31
 #define ERR_PROCESS_NOT_EXITED -32
 
+/* FUTEX */
+#define ERR_FUTEX_CHANGED -46
+
 /* PANIC */
 void panic(const char *, ...);
 void kernel_panic(const char *, ...);
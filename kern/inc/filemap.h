@@ -0,0 +1,33 @@
+/**
+ * @file filemap.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the mapping of RAM disk files in user space
+ */
+
+#ifndef __KERN_FILEMAP_H_
+#define __KERN_FILEMAP_H_
+
+#include <exec2obj.h>
+#include <page_types.h>
+#include <lock.h>
+
+/**
+ * The pages of a file of the RAM disk, loaded in frames the first time any
+ * process maps them. Every mapping holds its frames once more.
+ */
+typedef struct {
+	int			num_pages;	// Length of the file, in pages
+	paddr_t		*frames;	// Loaded frames, NULL where not loaded yet
+	mutex_t		lock;		// Protects the frames
+} file_cache_t;
+
+int init_filemap(void);
+int filemap_map(int file, vaddr_t base);
+paddr_t filemap_frame(int file, int idx);
+int file_index(const exec2obj_userapp_TOC_entry *entry);
+int file_pages(int file);
+int filemap_reclaim(void);
+
+#endif /* __KERN_FILEMAP_H_ */
@@ -0,0 +1,32 @@
+/**
+ * @file fpu.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the lazy switching of the FPU and SSE state
+ */
+
+#ifndef __KERN_FPU_H_
+#define __KERN_FPU_H_
+
+#include <types.h>
+#include <thread.h>
+
+/* Size and alignment of the area saved by fxsave */
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGN 16
+/* Free state areas kept for reuse */
+#define FPU_CACHE_SIZE 16
+
+/* The state of a thread which never used the FPU, as after fninit */
+#define FPU_INIT_FCW 0x037F
+#define FPU_INIT_MXCSR 0x1F80
+
+void fpu_init(void);
+void fpu_cpu_init(void);
+void fpu_switch(thread_t *self, thread_t *other);
+int fpu_copy(thread_t *thread, thread_t *target);
+void fpu_drop(thread_t *thread);
+void _nofpu_handler(uint32_t *frame);
+
+#endif /* __KERN_FPU_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file futex.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the waits on user memory words
+ */
+
+#ifndef __KERN_FUTEX_H_
+#define __KERN_FUTEX_H_
+
+/* Queues of waiters, the words hash to them by physical address */
+#define FUTEX_BUCKETS 64
+
+void futex_init(void);
+int futex_wait(int *addr, int expected);
+int futex_wake(int *addr, int n);
+
+#endif /* __KERN_FUTEX_H_ */
@@ -0,0 +1,25 @@
+/**
+ * @file growstack.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the grow-down stack regions
+ */
+
+#ifndef __KERN_GROWSTACK_H_
+#define __KERN_GROWSTACK_H_
+
+#include <page_types.h>
+#include <process.h>
+#include <region.h>
+
+/* Pages the main stack of a program may grow to, 8MB */
+#define STACK_MAIN_PAGES 2048
+/* Pages a stack is extended by on a fault, at least */
+#define STACK_GROW_PAGES 8
+
+vaddr_t stack_mapped(region_t *region);
+int stack_create(process_t *process, vaddr_t base, int num_pages);
+int stack_grow(region_t *region, vaddr_t va);
+
+#endif /* __KERN_GROWSTACK_H_ */
@@ -0,0 +1,57 @@
+/**
+ * @file image.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the shared executable images
+ */
+
+#ifndef __KERN_IMAGE_H_
+#define __KERN_IMAGE_H_
+
+typedef struct image_t image_t;
+
+#include <exec2obj.h>
+#include <elf_410.h>
+#include <page_types.h>
+#include <lock.h>
+
+/* Loads of a program after which its image gets a template */
+#define IMAGE_TEMPLATE_LOADS 2
+/* Largest data and bss a template is made of, in pages */
+#define IMAGE_TEMPLATE_MAX_PAGES 256
+
+struct process_t;
+
+/**
+ * The read-only part of a program, shared by every process running it.
+ *
+ * The text and rodata pages of a program are loaded in frames once, the
+ * first time any process touches them, and stay in the cache afterwards,
+ * unless memory runs low while no process maps them (@see reclaim.c).
+ * Every process mapping one of these frames holds it once more, read-only.
+ *
+ * A program loaded often gets a template as well: an address space, which
+ * never runs, holding its data and bss as they are right after a load. The
+ * next loads share its page tables copy on write, as a fork would, instead
+ * of building the data and bss again.
+ */
+struct image_t {
+	const exec2obj_userapp_TOC_entry *entry;	// The program file
+	simple_elf_t	hdr;		// Its simple ELF header
+	vaddr_t			start;		// First page of the text and rodata
+	int				num_pages;	// Pages from start to the end of both
+	paddr_t			*frames;	// Loaded frames, NULL if not loaded yet
+	mutex_t			lock;		// Protects the frames and the template
+	int				loads;		// Times the program was loaded
+	struct process_t *template;	// The template, NULL if none
+};
+
+int init_images(void);
+int find_image(const char *execname, image_t **out);
+int image_fault(vaddr_t va);
+int image_clone(image_t *image);
+void image_snapshot(image_t *image);
+int image_reclaim(void);
+
+#endif /* __KERN_IMAGE_H_ */
@@ -0,0 +1,35 @@
+/**
+ * @file ksm.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and constants for the same-page merging scanner
+ */
+
+#ifndef __KERN_KSM_H_
+#define __KERN_KSM_H_
+
+#include <process.h>
+#include <kstat.h>
+
+/**
+ * Set to 1 to run the same-page merging scanner, @see ksm.c
+ */
+#ifndef KSM_SCAN
+#define KSM_SCAN 0
+#endif
+
+/* Pages the scanner looks at before it sleeps */
+#define KSM_PAGES_PER_PASS 64
+/* Ticks it sleeps between two passes */
+#define KSM_SLEEP_TICKS 10
+/* Slots of the tables of the frames seen, a power of two */
+#define KSM_SLOTS 1024
+
+void ksm_start(void);
+void ksm_track(process_t *process);
+void ksm_untrack(process_t *process);
+int ksm_reclaim(void);
+void ksm_stats(kstat_ksm_t *stats, boolean_t reset);
+
+#endif /* __KERN_KSM_H_ */
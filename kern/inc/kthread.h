@@ -0,0 +1,22 @@
+/**
+ * @file kthread.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the kernel threads and the work queues
+ */
+
+#ifndef __KERN_KTHREAD_H_
+#define __KERN_KTHREAD_H_
+
+#include <thread.h>
+
+/* Works each CPU can have queued */
+#define WORK_QUEUE_SIZE 64
+
+thread_t *kthread_create(void (*entry)(void *), void *arg, int cpu);
+
+void workqueue_start(void);
+int queue_work(void (*fn)(void *), void *arg);
+
+#endif /* __KERN_KTHREAD_H_ */
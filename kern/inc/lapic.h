@@ -0,0 +1,33 @@
+/**
+ * @file lapic.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Constants and prototypes for the local APIC and its timer
+ */
+
+#ifndef __KERN_LAPIC_H_
+#define __KERN_LAPIC_H_
+
+#include <types.h>
+#include <inc/stdint.h>
+
+/* The gates of the timer and of the spurious interrupts of the local APIC */
+#define LAPIC_TIMER_IDT_ENTRY 0xF0
+#define LAPIC_SPURIOUS_IDT_ENTRY 0xFF
+
+/* Length of the calibration of the timer against the PIT, in milliseconds */
+#define LAPIC_CALIBRATE_MS 10
+
+boolean_t lapic_init(void);
+void lapic_enable(void);
+uint32_t lapic_calibrate(unsigned int ms);
+void lapic_timer_periodic(uint32_t cycles);
+void lapic_timer_oneshot(uint32_t cycles);
+uint32_t lapic_timer_count(void);
+void lapic_eoi(void);
+
+void lapic_timer_interrupt_handler(void);
+void lapic_spurious_handler(void);
+
+#endif /* __KERN_LAPIC_H_ */
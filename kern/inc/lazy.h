@@ -0,0 +1,22 @@
+/**
+ * @file lazy.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the regions filled on demand
+ */
+
+#ifndef __KERN_LAZY_H_
+#define __KERN_LAZY_H_
+
+#include <page_types.h>
+#include <process.h>
+#include <region.h>
+
+boolean_t region_is_lazy(region_t *region);
+int lazy_create(process_t *process, vaddr_t base, int num_pages,
+	region_kind_t kind, int file);
+void lazy_unmap(region_t *region);
+int region_fault(vaddr_t va);
+
+#endif /* __KERN_LAZY_H_ */
@@ -10,23 +10,54 @@ typedef struct cond cond_t;
 typedef struct rwlock rwlock_t;
 
 #include <types.h>
-#include <thread.h>
+#include <spinlock.h>
+#include <kstat.h>
+
+/**
+ * Set to 0 to compile the lock statistics out, @see lockstat.c. The names
+ * given at initialization are then dropped.
+ */
+#ifndef LOCK_PROFILE
+#define LOCK_PROFILE 1
+#endif
 
+/* Number of lock names the statistics can tell apart */
+#define LOCKSTAT_CLASSES 48
+
+/**
+ * The statistics of all the mutexes initialized under the same name. The
+ * ticks are timer ticks.
+ */
+typedef struct lockstat {
+	const char		*name;
+	unsigned int	acquisitions;	// Times one of the mutexes was locked
+	unsigned int	contended;		// Times it was held by somebody else
+	unsigned int	wait_ticks;		// Ticks spent waiting, in all
+	unsigned int	wait_max;		// Longest wait
+	unsigned int	hold_ticks;		// Ticks the mutexes were held, in all
+	unsigned int	hold_max;		// Longest hold
+} lockstat_t;
+
+/* The thread_t typedef comes with thread.h, which embeds a mutex_t */
 struct mutex {
-	boolean_t mutex_lock;		// Is someone performing changes on the waiting list
-	thread_t *owner;			// Who is in the mutex (=locked). NULL if nobody's in
-	thread_t *list_owner;		// Who is performing changes on the waiting list
-	thread_t *first_waiting;	// First thread in the waiting list
-	thread_t *last_waiting;		// Last thread in the waiting list
+	spinlock_t guard;			// Held while changing the waiting list
+	struct thread_t *owner;		// Who is in the mutex (=locked). NULL if nobody's in
+	struct thread_t *list_owner;	// Who is performing changes on the waiting list
+	struct thread_t *first_waiting;	// First thread in the waiting list
+	struct thread_t *last_waiting;	// Last thread in the waiting list
 
 	mutex_t	 *previous_lock;	// Most recent mutex hold when this one
 								// was aquired
+#if LOCK_PROFILE
+	lockstat_t *stat;			// The statistics of its name
+	unsigned int locked_at;		// Tick the owner got it at
+#endif
 };
 
 struct cond {
-	mutex_t mutex;			// Mutex protecting the data structure
-	thread_t *first_waiting;	// List of threads waiting to be signaled
-	thread_t *last_waiting;
+	spinlock_t guard;		// Held while changing the waiting list
+	struct thread_t *first_waiting;	// List of threads waiting to be signaled
+	struct thread_t *last_waiting;
 };
 
 struct rwlock {
@@ -41,18 +72,31 @@ struct rwlock {
 	cond_t no_writers_in;	// Condition for readers when all writers are out
 };
 
+#include <thread.h>
+
 /* Mutexes */
 void install_mutex(void);
-void mutex_init(mutex_t *mp);
+void mutex_init_named(mutex_t *mp, const char *name);
 void mutex_destroy(mutex_t *mp);
 void mutex_lock(mutex_t *mp);
 void mutex_unlock(mutex_t *mp);
 
 void waitlist_addLast(mutex_t *mp, thread_t *thr);
 thread_t *waitlist_removeHead(mutex_t *mp);
+boolean_t mutex_requeue(mutex_t *mp, thread_t *thr);
 
 unsigned int testandset(void *var);
 
+/* Mutexes initialized without a name are named after their expression */
+#define mutex_init(mp) mutex_init_named((mp), #mp)
+
+/* Lock statistics */
+lockstat_t *lockstat_class(const char *name);
+void lockstat_acquired(lockstat_t *stat, boolean_t contended,
+		unsigned int wait);
+void lockstat_released(lockstat_t *stat, unsigned int hold);
+int lockstat_report(kstat_lock_t *stats, int n, boolean_t reset);
+
 /* Condition variables */
 void cond_init(cond_t *cv);
 void cond_destroy(cond_t *cv);
@@ -60,7 +104,6 @@ void cond_wait(cond_t *cv, mutex_t *mp);
 void cond_signal(cond_t *cv);
 void cond_broadcast(cond_t *cv);
 
-int awaken_first_thread(cond_t *cv);
 void cond_waitlist_addLast(cond_t *cv, thread_t *thr);
 thread_t *cond_waitlist_removeHead(cond_t *cv);
 
@@ -68,7 +111,8 @@ thread_t *cond_waitlist_removeHead(cond_t *cv);
 #define RWLOCK_READ  0
 #define RWLOCK_WRITE 1
 
-void rwlock_init(rwlock_t *rwlock);
+void rwlock_init_named(rwlock_t *rwlock, const char *name);
+#define rwlock_init(rw) rwlock_init_named((rw), #rw)
 void rwlock_lock(rwlock_t *rwlock, int type);
 void rwlock_unlock(rwlock_t *rwlock);
 void rwlock_destroy(rwlock_t *rwlock);
@@ -0,0 +1,20 @@
+/**
+ * @file message.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Constants and prototypes for the synchronous messages
+ */
+
+#ifndef __KERN_MESSAGE_H_
+#define __KERN_MESSAGE_H_
+
+#include <ipc.h>
+#include <thread.h>
+
+int ipc_call(int tid, ipc_msg_t *msg);
+int ipc_receive(ipc_msg_t *msg);
+int ipc_reply(int tid, const ipc_msg_t *reply, ipc_msg_t *next);
+void ipc_vanish(thread_t *self);
+
+#endif /* __KERN_MESSAGE_H_ */
@@ -0,0 +1,39 @@
+/**
+ * @file objcache.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and types for the object caches
+ */
+
+#ifndef __KERN_OBJCACHE_H_
+#define __KERN_OBJCACHE_H_
+
+#include <stddef.h>
+#include <lock.h>
+
+/* Largest number of free objects a cache can keep */
+#define OBJCACHE_MAX_FREE 32
+
+/**
+ * A cache of objects of a single type. The free objects are kept in their
+ * constructed state, the constructor only runs on objects fresh from the
+ * heap.
+ */
+typedef struct objcache {
+	const char	*name;				// For the debugging output
+	size_t		size;				// Size of an object
+	size_t		align;				// Alignment of the objects, 0 for none
+	void		(*ctor)(void *);	// Constructor, NULL for none
+	int			limit;				// Free objects kept at most
+	int			count;				// Free objects kept now
+	void		*free[OBJCACHE_MAX_FREE];
+	mutex_t		lock;
+} objcache_t;
+
+void objcache_init(objcache_t *cache, const char *name, size_t size,
+		size_t align, int limit, void (*ctor)(void *));
+void *objcache_alloc(objcache_t *cache);
+void objcache_free(objcache_t *cache, void *obj);
+
+#endif /* __KERN_OBJCACHE_H_ */
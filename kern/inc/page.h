@@ -13,6 +13,7 @@
 #include <inc/process.h>		/* process_t */
 #include <types.h>
 #include <common_kern.h>
+#include <memstat.h>
 
 #define ADDR_MASK 0xFFFFF000
 #define FLAGS_MASK 0xFFF
@@ -33,6 +34,29 @@
 
 #define FRAME_ID(pa) ((uint32_t)(pa) < USER_MEM_START ? -1 : ((uint32_t)(pa) - USER_MEM_START) >> 12)
 #define FRAME_ADDR(id) (((id) << 12) + USER_MEM_START)
+/* Largest block handed out by allocate_frames, 2^10 frames (4MB) */
+#define FRAME_MAX_ORDER 10
+/* User pages mapped by a single directory entry, on a block of frames */
+#define LARGE_PAGE_ORDER FRAME_MAX_ORDER
+#define LARGE_PAGE_SIZE (PAGE_SIZE << LARGE_PAGE_ORDER)
+/* Kernel memory below this is mapped with 4KB pages, the rest with 4MB */
+#define KERNEL_SMALL_PAGES_END (PAGE_SIZE * PAGE_TABLE_ENTRIES)
+/* Number of page directory entries covering the kernel direct map */
+#define KERNEL_PDES (USER_MEM_START / KERNEL_SMALL_PAGES_END)
+/* Page fault error code bit set when the fault is a write */
+#define PF_ERR_WRITE (1 << 1)
+/* Page fault error code bit set when the fault comes from user mode */
+#define PF_ERR_USER (1 << 2)
+/* Number of frames map_range and unmap_range handle under one frame lock */
+#define MAP_BATCH 64
+/* Number of frames the idle CPUs keep zeroed in advance */
+#define ZERO_POOL_SIZE 64
+
+/* What sample_region tells of each page of a region */
+#define SAMPLE_PRESENT	(1 << 0)	// Mapped to a frame
+#define SAMPLE_ACCESSED	(1 << 1)	// Touched since the last sample
+#define SAMPLE_DIRTY	(1 << 2)	// Written to, @see clean_page
+#define SAMPLE_COW		(1 << 3)	// Still copy on write, not written to
 
 /* Kernel paging */
 int install_paging(vm_size_t upper_mem);
@@ -40,25 +64,65 @@ int activate_paging(pde_t *cr3);
 pde_t *init_paging(void);
 void reset_paging(void);
 int create_page(vaddr_t va, mem_type_t type, paddr_t ref_frame);
+int map_frame(vaddr_t va, mem_type_t type, paddr_t frame);
 int destroy_page(vaddr_t va);
+boolean_t valid_range(vaddr_t va, int num_pages);
+int map_range(vaddr_t va, int num_pages, mem_type_t type);
+int map_shared(vaddr_t va, paddr_t *frames, int num_pages);
+int unmap_range(vaddr_t va, int num_pages);
 int destroy_paging(process_t *process);
 
 /* Page faults */
 void page_fault_handler(void);
-void _page_fault_handler(void);
+void _page_fault_handler(uint32_t *trap);
 
 /* Frame management */
 int init_frame_allocator(vm_size_t upper_mem);
 paddr_t allocate_frame(void);
 paddr_t _allocate_frame(void);
+paddr_t allocate_frames(int order);
+paddr_t _allocate_frames(int order);
 int get_frame(paddr_t frame);
 int _get_frame(paddr_t frame);
 int free_frame(paddr_t frame);
+int _free_frame(paddr_t frame);
+int free_frames(paddr_t base, int order);
+int allocate_frame_batch(paddr_t *out, int n, vaddr_t va, int *zeroed);
+int free_frame_batch(paddr_t *batch, int n);
+size_t num_free_frames(void);
+size_t num_available_frames(void);
+int frame_flags(paddr_t frame);
+int frame_update_flags(paddr_t frame, uint16_t set, uint16_t unset);
+void frame_set_rmap(paddr_t frame, vaddr_t va);
+vaddr_t frame_rmap(paddr_t frame);
+int frame_refs(paddr_t frame);
 int copy_on_write(vaddr_t page);
+paddr_t allocate_zeroed_frame(void);
+paddr_t take_zeroed_frame(void);
+void refill_zeroed_frames(void);
+void queue_refill(void);
+int drain_zeroed_frames(void);
+int reserve_frames(process_t *process, int n);
+void unreserve_frames(process_t *process, int n);
+paddr_t allocate_reserved_frame(process_t *process, boolean_t *reserved);
+paddr_t allocate_reserved_block(process_t *process, int order);
+void write_frame(paddr_t frame, size_t offset, const void *buf, size_t len);
+void read_frame(paddr_t frame, void *buf);
 
 /* Utils */
 pte_t *get_pte(vaddr_t va, pde_t *cr3);
 pde_t *get_pde(vaddr_t va, pde_t *cr3);
 int copy_paging(process_t *parent, process_t *child);
+int own_page_table(vaddr_t va);
+int prepare_write(vaddr_t va);
+void paging_stats(memstat_t *stat);
+int clean_page(process_t *process, vaddr_t va, paddr_t frame);
+int protect_page(process_t *process, vaddr_t va, paddr_t frame);
+int remap_page(process_t *process, vaddr_t va, paddr_t frame,
+	paddr_t new_frame);
+int sample_region(process_t *process, vaddr_t base, uint8_t *pages);
+int lend_page(vaddr_t va, paddr_t *frame);
+int adopt_page(vaddr_t va, paddr_t frame);
+int map_device_page(vaddr_t va, paddr_t pa);
 
 #endif /* __KERN_PAGE_H_ */
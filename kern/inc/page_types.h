@@ -34,7 +34,9 @@ typedef enum {
 	PDE_NOCACHE			= (1 << 4),
 	PDE_ACCESSED		= (1 << 5),
 	PDE_PAGESIZE		= (1 << 7),
-	PDE_KERNEL			= (1 << 9) 		// The page table contains kernel space
+	PDE_GLOBAL			= (1 << 8),		// Only for 4MB pages
+	PDE_KERNEL			= (1 << 9), 	// The page table contains kernel space
+	PDE_COPYONWRITE		= (1 << 10)		// The page table is shared since a fork
 } pde_flag_t;
 
 typedef enum {
@@ -49,6 +51,13 @@ typedef enum {
 	PTE_GLOBAL			= (1 << 8),
 	PTE_ZEROPAGE		= (1 << 9), 	// The page is only zeros
 	PTE_COPYONWRITE		= (1 << 10),	// The page is the child of a copy on write
+	PTE_SHARED			= (1 << 11),	// The page is in a shared memory segment
 } pte_flag_t;
 
+typedef enum {
+	FRAME_ZEROED		= (1 << 0),		// The frame is known to hold only zeros
+	FRAME_PINNED		= (1 << 1),		// The frame must stay where it is
+	FRAME_SHARED		= (1 << 2),		// More than one entry points to the frame
+} frame_flag_t;
+
 #endif /* !__KERN_PAGE_TYPES_H_ */
@@ -0,0 +1,22 @@
+/**
+ * @file pageops.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the page copy and zero primitives
+ */
+
+#ifndef __KERN_PAGEOPS_H_
+#define __KERN_PAGEOPS_H_
+
+#include <types.h>
+
+/* The feature bit of cpuid for movnti, in edx */
+#define CPUID_SSE2 (1 << 26)
+
+void pageops_init(void);
+void zero_page(void *page);
+void copy_page(void *dst, const void *src);
+void zero_page_nt(void *page);
+
+#endif /* __KERN_PAGEOPS_H_ */
@@ -0,0 +1,42 @@
+/**
+ * @file pcrwlock.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Reader/writer locks whose readers are counted per CPU
+ */
+
+#ifndef __KERN_PCRWLOCK_H_
+#define __KERN_PCRWLOCK_H_
+
+#include <types.h>
+#include <lock.h>
+#include <cpu.h>
+
+/* Size of a cache line, each CPU counts its readers on its own */
+#define PCRW_LINE_SIZE 64
+
+/**
+ * The readers counted on a CPU, alone on its cache line. Threads can move
+ * to another CPU while they read, so a count may go below 0; only the sum
+ * of the counts makes sense.
+ */
+typedef struct pcrw_count {
+	volatile int	readers;
+	char			pad[PCRW_LINE_SIZE - sizeof(int)];
+} pcrw_count_t;
+
+typedef struct pcrwlock {
+	pcrw_count_t		counts[CPU_MAX];
+	volatile boolean_t	writer;		// A writer is in, or about to be
+	mutex_t				mutex;		// Held by the writer
+} __attribute__((aligned(PCRW_LINE_SIZE))) pcrwlock_t;
+
+void pcrwlock_init_named(pcrwlock_t *lock, const char *name);
+#define pcrwlock_init(lock) pcrwlock_init_named((lock), #lock)
+void pcrw_read_lock(pcrwlock_t *lock);
+void pcrw_read_unlock(pcrwlock_t *lock);
+void pcrw_write_lock(pcrwlock_t *lock);
+void pcrw_write_unlock(pcrwlock_t *lock);
+
+#endif /* __KERN_PCRWLOCK_H_ */
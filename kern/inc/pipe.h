@@ -0,0 +1,29 @@
+/**
+ * @file pipe.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Constants and prototypes for the pipes
+ */
+
+#ifndef __KERN_PIPE_H_
+#define __KERN_PIPE_H_
+
+struct process_t;
+
+/* Number of pipes that can exist at once */
+#define PIPE_MAX 32
+/* Bytes of the ring of a pipe, of the writes smaller than a page */
+#define PIPE_RING_SIZE PAGE_SIZE
+/* Whole pages a pipe holds at most, on top of its ring */
+#define PIPE_MAX_PAGES 16
+
+void init_pipes(void);
+int pipe_create(void);
+int pipe_write(int id, const char *buf, int len);
+int pipe_read(int id, char *buf, int len);
+int pipe_close(int id);
+void pipe_fork(struct process_t *parent, struct process_t *child);
+void pipe_exit(struct process_t *process);
+
+#endif /* __KERN_PIPE_H_ */
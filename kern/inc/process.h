@@ -14,6 +14,12 @@ typedef struct process_t process_t;
 #include <page_types.h>
 #include <thread.h>
 #include <thrlist.h>
+#include <lock.h>
+#include <region.h>
+#include <kdata.h>
+#include <quota.h>
+#include <pipe.h>
+#include <scanset.h>
 
 #define PROCESS_INITIAL_PID 1
 
@@ -30,10 +36,47 @@ struct process_t {
 
 	/* The page directory base pointer cr3 */
 	pde_t			*cr3;
+
+	/* Its kernel data page, mapped read-only @see vm/vdso.c */
+	kdata_task_t	*kdata;
+
+	/* The virtual terminal it prints to and reads from @see console.c */
+	int				terminal;
+
+	/* The CPU running the threads of the process, @see sched.c */
+	int				cpu;
+	unsigned int	migrated_at;	// Tick of its last move to another CPU
+	int				pinned;			// Kept from moving while not 0
 	
-	/* New pages chunks @see syscall/paging.c */
-	uint32_t		*memregions;
-	unsigned int	next_memregion_idx;
+	/* Serializes copy on write faults @see vm/frame.c */
+	mutex_t			*cow_lock;
+
+	/* The shared image of the running program @see vm/image.c */
+	struct image_t	*image;
+
+	/* New pages regions and their lock @see vm/region.c */
+	region_set_t	regions;
+	mutex_t			*region_lock;
+
+	/* Frames reserved for untouched zero pages @see vm/frame.c */
+	int				reserved_frames;
+
+	/* Memory accounting, updated atomically @see vm/page.c */
+	volatile int	rss_frames;		// User pages mapped to a frame
+	volatile int	peak_frames;	// The most rss_frames ever was
+	volatile int	page_tables;	// Page tables in the directory
+
+	/* The group limiting its frames, NULL if none @see vm/quota.c */
+	quota_t			*quota;
+
+	/* Its links in the sets of the scanners @see vm/scanset.c */
+	scan_link_t		scan[SCAN_SETS];
+
+	/* The same-page merging scanner @see vm/ksm.c */
+	vaddr_t			ksm_cursor;		// Next page to scan
+
+	/* The working-set scanner @see vm/wss.c */
+	struct wss		*wss;			// Its samples, NULL until scanned
 
 	/**
 	 * The following are used to provide a family hierachy between 
@@ -41,10 +84,20 @@ struct process_t {
 	 */
 	process_t		*parent;
 	process_t		*youngest_child;
+	process_t		*oldest_child;
 	process_t		*older_sibling;
 	process_t		*younger_sibling;
 	unsigned int	children;
 
+	/**
+	 * The children which exited and wait to be collected by wait, in
+	 * the order they exited. They sit in the children list as well.
+	 */
+	process_t		*first_exited;
+	process_t		*last_exited;
+	process_t		*next_exited;
+	unsigned int	exited;
+
 	/**
 	 * The following is to provide access to all threads of a given 
 	 * process. The thread ID of the original thread of this task is 
@@ -62,14 +115,27 @@ struct process_t {
 	/* List of waiting threads */
 	thrlist_t	*waiting;
 
+	/* The ends of each pipe it holds, by slot, @see pipe.c */
+	uint8_t		pipe_ends[PIPE_MAX];
+
+	/* The cycles its vanished threads ran in each mode, and those of its
+	 * children collected by wait, @see cputime.c */
+	uint64_t	user_cycles;
+	uint64_t	kernel_cycles;
+	uint64_t	child_user_cycles;
+	uint64_t	child_kernel_cycles;
+
 };
 
 process_t *create_process(void);
 int destroy_process(process_t *process);
 process_t *create_god_process(void);
 process_t *copy_process(process_t *parent);
+process_t *create_child_process(process_t *parent);
 process_t *exited_child(process_t *parent);
+void unwait_child(process_t *parent, process_t *child);
 unsigned int next_pid(void);
 int vanish_process(process_t *process);
+int bury_process(process_t *process);
 
 #endif /* ! __P2_PROCESS_H_ */
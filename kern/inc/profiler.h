@@ -0,0 +1,21 @@
+/**
+ * @file profiler.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the sampling profiler
+ */
+
+#ifndef __KERN_PROFILER_H_
+#define __KERN_PROFILER_H_
+
+#include <inc/stdint.h>
+#include <prof.h>
+
+void prof_init(void);
+void prof_sample(uint32_t *frame);
+void prof_start(void);
+int prof_stop(void);
+int prof_drain(prof_sample_t *buf, int max);
+
+#endif /* __KERN_PROFILER_H_ */
@@ -0,0 +1,25 @@
+/**
+ * @file ptpool.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and types for the page table pool
+ */
+
+#ifndef __KERN_PTPOOL_H_
+#define __KERN_PTPOOL_H_
+
+#include <types.h>
+#include <kstat.h>
+
+/* Number of zeroed page tables kept for reuse */
+#define PT_POOL_SIZE 64
+
+void init_pt_pool(void);
+void *alloc_page_table(void);
+void free_page_table(void *table);
+void free_page_table_batch(void **tables, int n);
+int pt_pool_drain(void);
+void pt_pool_stats(kstat_ptpool_t *stats, boolean_t reset);
+
+#endif /* __KERN_PTPOOL_H_ */
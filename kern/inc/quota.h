@@ -0,0 +1,31 @@
+/**
+ * @file quota.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the frame quotas of process groups
+ */
+
+#ifndef __KERN_QUOTA_H_
+#define __KERN_QUOTA_H_
+
+/**
+ * A group of processes sharing a limit on the frames they hold. A group
+ * may sit in a larger one, whose limit it is held to as well.
+ */
+typedef struct quota {
+	volatile int	charged;	// Frames held by the group, nested ones too
+	int				limit;		// Frames it may hold
+	volatile int	refs;		// Processes and nested groups in it
+	struct quota	*parent;	// The group it sits in, NULL if none
+} quota_t;
+
+struct process_t;
+
+void quota_join(struct process_t *process, quota_t *quota);
+void quota_leave(struct process_t *process);
+int quota_set(struct process_t *process, int limit);
+void quota_charge(struct process_t *process, int n);
+int quota_check(struct process_t *process, int n);
+
+#endif /* __KERN_QUOTA_H_ */
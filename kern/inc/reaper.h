@@ -0,0 +1,20 @@
+/**
+ * @file reaper.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the reaper
+ */
+
+#ifndef __KERN_REAPER_H_
+#define __KERN_REAPER_H_
+
+#include <process.h>
+#include <kstat.h>
+
+void reaper_start(void);
+void reap_process(process_t *process);
+boolean_t reap_thread(thread_t *thread);
+void reaper_stats(kstat_reaper_t *stats, boolean_t reset);
+
+#endif /* __KERN_REAPER_H_ */
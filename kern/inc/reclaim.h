@@ -0,0 +1,31 @@
+/**
+ * @file reclaim.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and constants for the reclaim under memory pressure
+ */
+
+#ifndef __KERN_RECLAIM_H_
+#define __KERN_RECLAIM_H_
+
+#include <types.h>
+#include <kstat.h>
+
+/* Available frames under which the reclaimer is woken */
+#define RECLAIM_LOW 32
+/* Available frames at which it stops */
+#define RECLAIM_HIGH 128
+/* Ticks a fault waits for memory at most, each time */
+#define RECLAIM_STALL_TICKS 5
+/* Times a fault waits before it fails */
+#define RECLAIM_STALL_TRIES 8
+
+void init_reclaim(void);
+void reclaim_start(void);
+void reclaim_kick(void);
+void reclaim_notify(void);
+boolean_t reclaim_stall(int err, int tries);
+void reclaim_stats(kstat_reclaim_t *stats, boolean_t reset);
+
+#endif /* __KERN_RECLAIM_H_ */
@@ -0,0 +1,50 @@
+/**
+ * @file recring.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Per-CPU rings of fixed size records, drained to user memory
+ *
+ * Each CPU has a ring of the same number of records, a power of two, which
+ * only it adds to, with interrupts off: it gets a free slot, writes the
+ * record in it and commits it (@see recring_reserve). The drains copy the
+ * records of every CPU out to user memory (@see recring_drain).
+ */
+
+#ifndef __KERN_RECRING_H_
+#define __KERN_RECRING_H_
+
+#include <types.h>
+#include <lock.h>
+#include <cpu.h>
+
+/**
+ * The records of a CPU
+ */
+typedef struct recring_cpu {
+	volatile unsigned int	head;		// Next record added
+	volatile unsigned int	tail;		// Next record drained
+	unsigned int			dropped;	// Since the ring started
+} recring_cpu_t;
+
+/**
+ * A ring of records for each CPU
+ */
+typedef struct recring {
+	volatile boolean_t	on;				// Are records added?
+	size_t				record_size;
+	unsigned int		size;			// Records per CPU, a power of two
+	char				*records;		// Of each CPU, one after the other
+	mutex_t				drain_lock;		// Serializes the drains
+	recring_cpu_t		cpus[CPU_MAX];
+} recring_t;
+
+void recring_init(recring_t *ring, void *records, size_t record_size,
+		unsigned int size);
+void *recring_reserve(recring_t *ring, int cpu);
+void recring_commit(recring_t *ring, int cpu);
+void recring_start(recring_t *ring);
+int recring_stop(recring_t *ring);
+int recring_drain(recring_t *ring, void *buf, int max);
+
+#endif /* __KERN_RECRING_H_ */
@@ -0,0 +1,64 @@
+/**
+ * @file region.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the memory regions of a process
+ */
+
+#ifndef __KERN_REGION_H_
+#define __KERN_REGION_H_
+
+#include <page_types.h>
+
+/* Number of regions the table of a process starts with */
+#define REGIONS_INITIAL_CAPACITY 8
+
+/**
+ * What a region maps
+ */
+typedef enum {
+	REGION_ANON,			// Pages allocated by new_pages
+	REGION_SHM,				// A shared memory segment, @see shm.c
+	REGION_FILE,			// A file of the RAM disk, @see filemap.c
+	REGION_STACK,			// A grow-down stack, @see growstack.c
+	REGION_LAZY_ZERO,		// Pages filled on demand, @see lazy.c
+	REGION_LAZY_TEMPLATE,	// Copies of its first page, on demand
+	REGION_LAZY_FILE,		// A file of the RAM disk, on demand
+} region_kind_t;
+
+/**
+ * A range of pages allocated in one go by new_pages, a shared memory
+ * segment attached by shm_create or shm_attach, or a file mapped by
+ * map_file. A stack region is the most its stack may grow to, of which
+ * only the top pages are mapped, and the pages of a lazy region are only
+ * mapped once touched.
+ */
+typedef struct {
+	vaddr_t			start;		// First page of the region
+	int				num_pages;	// Length of the region, in pages
+	region_kind_t	kind;		// What the region maps
+	int				object;		// Segment id, file index, or mapped pages of
+								// a stack, unused otherwise
+} region_t;
+
+/**
+ * The regions of a process, sorted by start address and never overlapping,
+ * so that lookups are binary searches. The table grows as needed.
+ */
+typedef struct {
+	region_t	*regions;	// The regions, NULL until the first insertion
+	int			count;		// Number of regions in the table
+	int			capacity;	// Number of regions the table can hold
+} region_set_t;
+
+void init_regions(region_set_t *set);
+void destroy_regions(region_set_t *set);
+void clear_regions(region_set_t *set);
+int copy_regions(region_set_t *dst, region_set_t *src);
+boolean_t region_overlaps(region_set_t *set, vaddr_t start, int num_pages);
+int insert_region(region_set_t *set, vaddr_t start, int num_pages);
+int remove_region(region_set_t *set, vaddr_t start);
+region_t *find_region(region_set_t *set, vaddr_t va);
+
+#endif /* __KERN_REGION_H_ */
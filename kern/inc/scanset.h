@@ -0,0 +1,45 @@
+/**
+ * @file scanset.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the sets of processes a scanner walks
+ */
+
+#ifndef __KERN_SCANSET_H_
+#define __KERN_SCANSET_H_
+
+#include <types.h>
+#include <lock.h>
+
+/* The sets, each process has a link for each of them */
+#define SCAN_KSM 0		// Same-page merging, @see ksm.c
+#define SCAN_WSS 1		// Working-set estimation, @see wss.c
+#define SCAN_SETS 2
+
+struct process_t;
+
+/* The link of a process in a set */
+typedef struct {
+	struct process_t	*next;
+	struct process_t	*prev;
+	boolean_t			busy;	// Being scanned
+} scan_link_t;
+
+/* The processes a scanner walks, and the next one it scans */
+typedef struct {
+	int					id;		// The link of the processes it uses
+	struct process_t	*tracked;
+	struct process_t	*cursor;
+	mutex_t				lock;	// Protects the set and the links
+	cond_t				not_busy;
+} scanset_t;
+
+void scanset_init(scanset_t *set, int id);
+struct process_t *scanset_next(scanset_t *set, boolean_t *round_over);
+void scanset_join(struct process_t *process);
+void scanset_leave(scanset_t *set, struct process_t *process, boolean_t done);
+void scanset_track(scanset_t *set, struct process_t *process);
+boolean_t scanset_untrack(scanset_t *set, struct process_t *process);
+
+#endif /* __KERN_SCANSET_H_ */
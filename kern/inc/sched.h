@@ -0,0 +1,65 @@
+/**
+ * @file sched.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Constants and prototypes for the multi-level feedback scheduler
+ */
+
+#ifndef __KERN_SCHED_H_
+#define __KERN_SCHED_H_
+
+#include <types.h>
+#include <thread.h>
+#include <kstat.h>
+
+/* Number of priority levels, 0 being the highest */
+#define SCHED_LEVELS 8
+/* Number of ticks a thread of the given level runs before being demoted */
+#define SCHED_QUANTUM(level) ((level) + 1)
+/* Ticks between two returns of every runnable thread to its base level */
+#define SCHED_AGING_PERIOD 100
+/* Ticks between two rebalances of the CPU loads */
+#define SCHED_BALANCE_PERIOD 20
+/* A process moving again within this many ticks is bouncing between CPUs */
+#define SCHED_BOUNCE_WINDOW 100
+/* Times in a row a thread of the running process may go ahead of the head
+ * of its queue */
+#define SCHED_AFFINITY_WINDOW 4
+/* Threads of a queue looked at for one of the running process */
+#define SCHED_AFFINITY_SCAN 8
+
+/**
+ * @brief Returns the level a thread is queued and scheduled at, the most
+ * urgent of its own and of the one it inherited
+ */
+static inline int sched_level(thread_t *thread) {
+	return thread->level < thread->boost ? thread->level : thread->boost;
+}
+
+/**
+ * @brief Returns the level a thread is scheduled at once it wakes up
+ */
+static inline int sched_base(thread_t *thread) {
+	return thread->nice < thread->boost ? thread->nice : thread->boost;
+}
+
+void sched_init(void);
+boolean_t sched_queued(thread_t *thread);
+int sched_enqueue(thread_t *thread);
+int sched_dequeue(thread_t *thread);
+thread_t *sched_pick(void);
+unsigned int sched_count(void);
+int sched_place(void);
+boolean_t sched_can_steal(void);
+boolean_t sched_steal(void);
+void sched_balance(void);
+int sched_stats(kstat_sched_t *stats, int n, boolean_t reset);
+void sched_wakeup(thread_t *thread);
+boolean_t sched_preempts(thread_t *self, thread_t *woken);
+boolean_t sched_tick(thread_t *self);
+void sched_age(thread_t *self);
+int sched_set_nice(thread_t *thread, int nice);
+void sched_boost(thread_t *thread, int boost);
+
+#endif /* __KERN_SCHED_H_ */
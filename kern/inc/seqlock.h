@@ -0,0 +1,71 @@
+/**
+ * @file seqlock.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Sequence locks, for small data read often and rarely written
+ *
+ * A writer bumps the sequence number of the lock before and after it
+ * writes, so the number is odd while the data changes. A reader notes the
+ * number, even, before it reads and checks it is unchanged afterwards;
+ * otherwise it reads again. Readers never write to the lock, so they never
+ * steal its cache line from one another, and never wait for each other.
+ *
+ * The data must be safe to read while it changes, since a reader may see
+ * it half written before it retries: no pointer a reader follows may be
+ * freed under it. The writers serialize on a spinlock which keeps
+ * interrupts off, so that a reader in an interrupt handler never spins on a
+ * writer it interrupted.
+ *
+ * The loads of x86 are not reordered with other loads, nor the stores
+ * with other stores, so keeping the compiler from reordering them is enough.
+ *
+ *     unsigned int seq;
+ *     do {
+ *         seq = seq_read_begin(&lock);
+ *         ... copy the data ...
+ *     } while (seq_read_retry(&lock, seq));
+ */
+
+#ifndef __KERN_SEQLOCK_H_
+#define __KERN_SEQLOCK_H_
+
+#include <types.h>
+#include <spinlock.h>
+
+typedef struct seqlock {
+	volatile unsigned int seq;	// Odd while a writer is in
+	spinlock_t lock;			// Serializes the writers
+} seqlock_t;
+
+/* Keeps the compiler from moving memory accesses across it */
+#define SEQ_BARRIER() asm volatile ("" : : : "memory")
+
+void seqlock_init(seqlock_t *sl);
+void seq_write_lock(seqlock_t *sl);
+void seq_write_unlock(seqlock_t *sl);
+
+/**
+ * @brief Starts a read, waiting for the writer in to leave
+ *
+ * @return the sequence number to give to seq_read_retry
+ */
+static inline unsigned int seq_read_begin(seqlock_t *sl) {
+	unsigned int seq;
+	while ((seq = sl->seq) & 1) asm volatile ("pause");
+	SEQ_BARRIER();
+	return seq;
+}
+
+/**
+ * @brief Ends a read
+ *
+ * @param seq the number seq_read_begin returned
+ * @return TRUE if a writer came in meanwhile and the read has to be redone
+ */
+static inline boolean_t seq_read_retry(seqlock_t *sl, unsigned int seq) {
+	SEQ_BARRIER();
+	return sl->seq != seq;
+}
+
+#endif /* __KERN_SEQLOCK_H_ */
@@ -0,0 +1,31 @@
+/**
+ * @file serial.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the log on the serial port
+ */
+
+#ifndef __KERN_SERIAL_H_
+#define __KERN_SERIAL_H_
+
+#include <types.h>
+#include <kstat.h>
+
+// The first serial port, on the fourth line of the master PIC
+#define SERIAL_IDT_ENTRY 0x24
+#define SERIAL_IRQ 4
+
+// Bytes of log records waiting for the port at most, a power of two
+#define SERIAL_RING_SIZE (64 * 1024)
+// Longest record, newline included
+#define SERIAL_RECORD_MAX 256
+
+void init_serial(void);
+void serial_handler(void);
+void serial_interrupt_handler(void);
+boolean_t serial_log(const char *record, int len);
+void klog(const char *fmt, ...);
+void serial_stats(kstat_serial_t *stats, boolean_t reset);
+
+#endif /* __KERN_SERIAL_H_ */
@@ -0,0 +1,38 @@
+/**
+ * @file shm.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the shared memory segments
+ */
+
+#ifndef __KERN_SHM_H_
+#define __KERN_SHM_H_
+
+#include <page_types.h>
+#include <region.h>
+
+/* Number of shared memory segments that can exist at once */
+#define SHM_MAX_SEGMENTS 64
+
+/**
+ * A set of frames mapped read-write, at the same offsets, in every address
+ * space the segment is attached to. The segment holds every frame once, and
+ * each mapping holds it once more, so that the frames outlive any single
+ * mapping and are freed with the last attachment.
+ */
+typedef struct {
+	int			id;			// Identifier given to user space, 0 if unused
+	int			num_pages;	// Length of the segment, in pages
+	int			attached;	// Number of regions mapping the segment
+	paddr_t		*frames;	// The frames, in order
+} shm_segment_t;
+
+void init_shm(void);
+int shm_create_segment(int num_pages, paddr_t **frames);
+paddr_t *shm_get(int id, int *num_pages);
+void shm_put(int id);
+void shm_hold_regions(region_set_t *set);
+void shm_drop_regions(region_set_t *set);
+
+#endif /* __KERN_SHM_H_ */
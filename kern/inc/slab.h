@@ -0,0 +1,65 @@
+/**
+ * @file slab.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and types for the slab allocator
+ */
+
+#ifndef __KERN_SLAB_H_
+#define __KERN_SLAB_H_
+
+#include <stddef.h>
+#include <lock.h>
+#include <kstat.h>
+
+/* Largest object a slab holds, larger allocations go to the heap */
+#define SLAB_MAX_SIZE 1024
+/* Smallest size class, the others double up to SLAB_MAX_SIZE */
+#define SLAB_MIN_SIZE 16
+/* Objects are aligned on this many bytes */
+#define SLAB_ALIGN 8
+/* Empty slabs a cache keeps rather than giving them back to the heap */
+#define SLAB_MAX_EMPTY 1
+/* Caches, size classes included, the kernel can register */
+#define SLAB_MAX_CACHES 24
+
+typedef struct slab slab_t;
+
+/**
+ * A cache of objects of one size, carved out of page-sized slabs. Each slab
+ * is in one of the three lists of its cache, depending on how many of its
+ * objects are allocated.
+ */
+typedef struct slab_cache {
+	const char	*name;			// Shown in the statistics
+	size_t		size;			// Size asked for at creation
+	size_t		stride;			// Size of an object in the slab
+	int			per_slab;		// Objects in each slab
+
+	slab_t		*partial;		// Slabs with free and allocated objects
+	slab_t		*full;			// Slabs without free objects
+	slab_t		*empty;			// Slabs without allocated objects
+	int			num_empty;
+
+	unsigned int	slabs;		// Slabs the cache holds
+	unsigned int	in_use;		// Objects allocated now
+	unsigned int	allocs;		// Allocations since the last reset
+	unsigned int	frees;		// Frees since the last reset
+
+	mutex_t		lock;
+} slab_cache_t;
+
+void slab_init(void);
+void slab_cache_init(slab_cache_t *cache, const char *name, size_t size);
+void *slab_alloc(slab_cache_t *cache);
+void *slab_zalloc(slab_cache_t *cache);
+void slab_free(slab_cache_t *cache, void *obj);
+int slab_stats(kstat_slab_t *stats, int n, boolean_t reset);
+
+/* Size classes */
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *buf, size_t size);
+
+#endif /* __KERN_SLAB_H_ */
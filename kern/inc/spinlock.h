@@ -0,0 +1,28 @@
+/**
+ * @file spinlock.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Spinlocks, for the data shared with interrupt handlers and with
+ * the other CPUs
+ */
+
+#ifndef __KERN_SPINLOCK_H_
+#define __KERN_SPINLOCK_H_
+
+#include <stdint.h>
+
+typedef struct spinlock {
+	volatile uint32_t locked;	// Taken with an atomic exchange
+	uint32_t eflags;			// Saved by spin_lock_irqsave
+} spinlock_t;
+
+void spin_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+void spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock);
+uint32_t save_disable_interrupts(void);
+void restore_interrupts(uint32_t eflags);
+
+#endif /* __KERN_SPINLOCK_H_ */
@@ -9,7 +9,17 @@
 #ifndef __KERN_SYSCALL_H_
 #define __KERN_SYSCALL_H_
 
+#include <inc/stdint.h>
+#include <sysring.h>
+#include <memstat.h>
+#include <ipc.h>
+
 int install_syscalls();
+void install_sysenter(void);
+
+void sysenter_int(void);
+void syscall_int(void);
+int _sysenter(unsigned int num, void *arg);
 
 int gettid_int(void);
 int _gettid(void);
@@ -20,6 +30,9 @@ int _exec(void **args);
 int fork_int(void);
 int _fork(void);
 
+int spawn_int(void);
+int _spawn(void **args);
+
 int yield_int(void);
 int _yield(int tid);
 
@@ -28,6 +41,9 @@ int _deschedule(int *flag);
 
 int make_runnable_int(void);
 int _make_runnable(int tid);
+/* Threads woken together, @see make_runnable_batch */
+#define MAKE_RUNNABLE_BATCH 32
+void make_runnable_batch(const int *tids, int n, int *results);
 
 unsigned int get_ticks_int(void);
 unsigned int _get_ticks(void);
@@ -35,6 +51,15 @@ unsigned int _get_ticks(void);
 int sleep_int(void);
 int _sleep(int ticks);
 
+int usleep_int(void);
+int _usleep(unsigned int usecs);
+
+int get_time_ns_int(void);
+int _get_time_ns(uint64_t *ns);
+
+int set_nice_int(void);
+int _set_nice(int nice);
+
 void set_status_int(void);
 void _set_status(int status);
 
@@ -50,6 +75,24 @@ int _new_pages(int *args);
 int remove_pages_int(void);
 int _remove_pages(void *base);
 
+int shm_create_int(void);
+int _shm_create(int *args);
+
+int shm_attach_int(void);
+int _shm_attach(int *args);
+
+int shm_detach_int(void);
+int _shm_detach(void *base);
+
+int map_file_int(void);
+int _map_file(void **args);
+
+int memstat_int(void);
+int _memstat(memstat_t *stat);
+
+int set_frame_limit_int(void);
+int _set_frame_limit(int frames);
+
 int getchar_int(void);
 int _getchar(void);
 
@@ -80,4 +123,34 @@ int _thread_fork(void);
 int _readfile(void **args);
 int readfile_int(void **args);
 
+int kstat_int(void);
+int _kstat(void **args);
+
+int futex_wait_int(void);
+int _futex_wait(void **args);
+
+int futex_wake_int(void);
+int _futex_wake(void **args);
+
+int sysring_int(void);
+int _sysring_enter(sysring_t *ring);
+
+int profile_int(void);
+int _profile(void **args);
+
+int sched_trace_int(void);
+int _sched_trace(void **args);
+
+/* Reachable through sysenter only */
+int _pipe_create(void);
+int _pipe_write(void **args);
+int _pipe_read(void **args);
+int _pipe_close(int id);
+int _ipc_call(void **args);
+int _ipc_receive(ipc_msg_t *msg);
+int _ipc_reply(void **args);
+int _ipc_reply_wait(void **args);
+int _set_deadline(void **args);
+int _getrusage(void **args);
+
 #endif /* __KERN_SYSCALL_H_ */
@@ -23,17 +23,10 @@ typedef struct {
 	unsigned long start;
 } simple_elf_seg_t;
 
+int init_exec2obj_index(void);
 const exec2obj_userapp_TOC_entry *exec2obj_entry(const char *filename);
 int getbytes(const char *filename, int offset, int size, char *buf);
-int string_array_length(char **array);
 
 void init_syscall_mutexes(void);
 
-// Check functions
-boolean_t check_page(vaddr_t addr, boolean_t write);
-boolean_t check_buffer(char* buf, size_t len, boolean_t write);
-boolean_t check_string(char* str);
-boolean_t check_string_array(char **arr);
-boolean_t check_array(void* array, size_t len);
-
 #endif /* !__P2_SYSHELPER_H_ */
@@ -0,0 +1,63 @@
+/**
+ * @file sysstat.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief The statistics of the system calls, kept around their handlers
+ */
+
+#ifndef __KERN_SYSSTAT_H_
+#define __KERN_SYSSTAT_H_
+
+#include <syscall_int.h>
+
+/**
+ * Set to 0 to compile the statistics of the system calls out, @see
+ * sysstat.c
+ */
+#ifndef SYSCALL_PROFILE
+#define SYSCALL_PROFILE 1
+#endif
+
+/* Number of gates the statistics are kept for */
+#define SYSSTAT_GATES (SYSCALL_RESERVED_END - SYSCALL_INT + 1)
+
+#ifdef ASSEMBLER
+
+/**
+ * Calls the handler of a system call from its wrapper, with the arguments
+ * pushed already, and accounts the call, along with the CPU time of the
+ * caller (@see cputime.c). A handler without a return value is given by
+ * SYSCALL_CALL_VOID.
+ */
+#if SYSCALL_PROFILE
+#define SYSCALL_CALL(fn, num) \
+	call cputime_enter; call sysstat_enter; call fn; \
+	pushl %eax; pushl $(num); call sysstat_exit; addl $8, %esp; \
+	pushl %eax; call cputime_leave; addl $4, %esp
+#define SYSCALL_CALL_VOID(fn, num) \
+	call cputime_enter; call sysstat_enter; call fn; \
+	pushl $0; pushl $(num); call sysstat_exit; addl $8, %esp; \
+	pushl $0; call cputime_leave; addl $4, %esp
+#else
+#define SYSCALL_CALL(fn, num) \
+	call cputime_enter; call fn; \
+	pushl %eax; call cputime_leave; addl $4, %esp
+#define SYSCALL_CALL_VOID(fn, num) \
+	call cputime_enter; call fn; \
+	pushl $0; call cputime_leave; addl $4, %esp
+#endif
+
+#else
+
+#include <types.h>
+#include <kstat.h>
+
+void sysstat_enter(void);
+int sysstat_exit(unsigned int num, int ret);
+boolean_t sysstat_get(int cpu, unsigned int num, kstat_syscall_t *stats,
+		boolean_t reset);
+
+#endif /* ASSEMBLER */
+
+#endif /* __KERN_SYSSTAT_H_ */
@@ -16,9 +16,16 @@ typedef struct thread_t thread_t;
 #include <thrlist.h>
 #include <process.h>
 #include <lock.h>
+#include <timeout.h>
+#include <ipc.h>
 
 #define THREAD_INITIAL_TID 32
 #define THREAD_KERNEL_SIZE 2
+/* Free control blocks and kernel stacks kept for reuse */
+#define THREAD_CACHE_SIZE 32
+#define KSTACK_CACHE_SIZE 16
+/* Bytes of a cache line, which the control blocks are aligned on */
+#define THREAD_CACHE_LINE 64
 
 /**
  * Lock used to make the malloc functions thread safe.
@@ -33,33 +40,35 @@ extern mutex_t mem_lock;
 typedef enum {THR_RUNNING, THR_BLOCKED, THR_SLEEPING,
 	THR_WAITING, THR_ZOMBIE} thrstate_t;
 
+/**
+ * What a thread waits for in the synchronous messages: a call, to be
+ * received, or the reply to its call (@see message.c)
+ */
+typedef enum {IPC_IDLE, IPC_RECEIVING, IPC_SENDING, IPC_AWAITING} ipcstate_t;
+
 /**
  * The thread control block
+ *
+ * The fields which context_switch, the scheduler, the timer and the mutexes
+ * touch on every pass come first, down to the level inherited through the
+ * mutexes, and fit the first cache line of the block, which is aligned on
+ * one. The rest is only read on the slow paths, the wake tick of a sleep
+ * among them, which is read along with the sleep timeout.
  */
 struct thread_t {
 
-	// the thread ID and state of the thread
-	unsigned int 	tid;
-	thrstate_t	state;
-
 	/* The esp where the thread's context was saved during a 
-	 * context_switch */
+	 * context_switch, and the top of its kernel stack */
 	unsigned int	esp;
-
-	/* The stack pointer of the kernel and user stacks */
 	uint32_t	esp0;
-	uint32_t	esp3;
+
+	// the thread ID and state of the thread
+	thrstate_t	state;
+	unsigned int 	tid;
 
 	/* The process/task the thread belongs to */
 	process_t	*process;
 
-   	/* A lock used to assure atomicity during a deschedule/make_runnable 
-	 * sequence */
-	mutex_t		*thread_lock;
-
-	/* List of acquired locks we should release when being vanished */
-	mutex_t		*acquired_lock;
-
 	/**
 	 * The following are used to provide an embeded traversal method.
 	 * This restricts each thread to be part of at most one list, which
@@ -67,19 +76,24 @@ struct thread_t {
 	 * sleeping or waiting at the same time.
 	 */
 	thrlist_t	*list;
-	thread_t	*next;
-	thread_t	*prev;
+	Q_NEW_LINK(thread_t) link;
 
-	/* Embeded traversal for the hash table of all threads in existence */
-	thread_t	*hash_next;
-	thread_t	*hash_prev;
+	/* The next thread on the waiting list of a mutex or a condition,
+	 * a thread waits for one of them at most */
+	thread_t	*wait_next;
+	mutex_t		*cond_mutex;	// The mutex given to cond_wait
 
-	/**
-	 * The following are used to identify threads belonging to the 
-	 * same process.
-	 */
-	thread_t	*older_sibling;
-	thread_t	*younger_sibling;	
+	/* Scheduling state, @see sched.c */
+	int		cpu;		// CPU whose run queue holds or runs the thread
+	int		level;		// Current level, between nice and the lowest
+	int		slice;		// Ticks run in the current quantum
+	int		nice;		// Base level, set by the set_nice system call
+	int		boost;		// Level inherited through mutexes, @see mutex.c
+
+	/* The rest is cold */
+
+	/* The mutex it waits for, NULL if none, @see mutex.c */
+	mutex_t	*blocked_on;
 
 	/**
 	 * The following field is used for the sleep() system call and 
@@ -89,17 +103,69 @@ struct thread_t {
 	 */
 	unsigned int	wake;
 
+	/* The stack pointer of the user stack */
+	uint32_t	esp3;
+
+   	/* A lock used to assure atomicity during a deschedule/make_runnable 
+	 * sequence, set up once by the constructor of the cache */
+	mutex_t		thread_lock;
+
+	/* List of acquired locks we should release when being vanished */
+	mutex_t		*acquired_lock;
+
+	/* Lookups using the control block past their dont_switch_me_out area,
+	 * which keep it from being freed, @see hold_thread */
+	unsigned int	holds;
+
+	/**
+	 * The following are used to identify threads belonging to the 
+	 * same process.
+	 */
+	thread_t	*older_sibling;
+	thread_t	*younger_sibling;	
+
+	timeout_t		sleep_timeout;	// Fires at wake, armed while sleeping
+
+	/* Earliest-deadline-first class, @see edf.c, budget 0 if not in it */
+	unsigned int	edf_budget;		// Ticks it runs per period
+	unsigned int	edf_relative;	// Ticks after the start of a period
+	unsigned int	edf_period;		// Ticks between two periods
+	unsigned int	edf_left;		// Ticks left of the budget
+	unsigned int	edf_release;	// Tick the current period started at
+	unsigned int	edf_deadline;	// Tick the budget is due by
+	boolean_t		edf_missed;		// It ran past the deadline
+	boolean_t		edf_queued;		// In the ready heap of its CPU
+	timeout_t		edf_timer;		// Armed while it is throttled
+	PH_NEW_LINK(thread_t) edf_link;
+
 	/* The thread's registered exception handler, as per the swexn system
 	 * call */
 	vaddr_t swexn_eip;
 	vaddr_t swexn_esp;
 	void *swexn_arg;
+	boolean_t swexn_persistent;	// Stays registered when it is called
+
+	/* The area the FPU and SSE registers are saved in, allocated on the
+	 * first use of the FPU, @see fpu.c */
+	void		*fpu_state;
+
+	/* The TSC when the system call in progress started, @see sysstat.c */
+	uint64_t	sys_start;
+
+	/* The cycles the thread ran in each mode, and the TSC when it entered
+	 * the one it is in, @see cputime.c */
+	uint64_t	user_cycles;
+	uint64_t	kernel_cycles;
+	uint64_t	cycles_since;
 
-	/* The following is used for the kernel locking system to provide
-	 * embeded traversal for waiting lists. */
-	thread_t 	*mutex_nextwait;
-	thread_t	*cond_nextwait;
-};
+	/* Synchronous messages, protected by the scheduler lock, @see
+	 * message.c */
+	ipcstate_t	ipc_state;		// What the thread waits for, if anything
+	thread_t	*ipc_callers;	// Threads calling it, in order
+	thread_t	*ipc_next;		// Next caller of the same thread
+	ipc_msg_t	ipc_msg;		// The call, then the reply
+	int		ipc_result;		// 0, or why the call failed
+} __attribute__((aligned(THREAD_CACHE_LINE)));
 
 
 /* Initialisation */
@@ -111,13 +177,15 @@ int set_running(thread_t *thread);
 int set_runnable(thread_t *thread);
 int set_blocked(thread_t *thread);
 int set_sleeping(thread_t *thread, unsigned int sleep);
+int set_sleeping_ns(thread_t *thread, unsigned int sleep, uint64_t deadline);
 int set_waiting(thread_t *thread);
 
 /* Getting */
 thread_t *get_thread(unsigned int tid);
+thread_t *hold_thread(unsigned int tid);
+void release_thread(thread_t *thread);
 thread_t *get_self(void);
 thread_t *get_running(void);
-thread_t *get_sleeping(void);
 thread_t *get_waiting(process_t *parent);
 thread_t *idle(void);
 thread_t *init(void);
@@ -125,15 +193,17 @@ thread_t *init(void);
 /* Misc */
 unsigned int num_runnable(void);
 int is_idle(thread_t *thread);
+boolean_t is_local(thread_t *thread);
 int set_idle(thread_t *idle);
 int set_init(thread_t *init);
 
 /* Management */
-unsigned int next_tid(void);
 thread_t *create_thread(process_t *parent);
 thread_t *copy_thread(process_t *, thread_t *, boolean_t handler);
 int vanish_thread(void);
 int destroy_thread(thread_t *thread);
+void leave_family(thread_t *thread);
+void free_thread(thread_t *thread);
 
 #endif /* ! __P2_THREAD_H_ */
 
@@ -3,7 +3,7 @@
  * @author Daniel Balle (dballe)
  * @author Loic Ottet (lottet)
  *
- * @brieif Header definitions for thrhash.c
+ * @brief Header definitions for thrhash.c
  */
 
 #ifndef _P3_THRHASH_H
@@ -12,11 +12,18 @@
 #include <thread.h>
 #include <x86/page.h>
 
-#define HASH_ENTRIES (PAGE_SIZE / sizeof(thread_t*))
+/* Thread slots in a leaf of the table, a leaf fills a page */
+#define TIDTAB_LEAF_ENTRIES (PAGE_SIZE / sizeof(thread_t*))
+/* Leaves the table can have, the root fills a page too */
+#define TIDTAB_LEAVES (PAGE_SIZE / sizeof(thread_t**))
+/* The thread ids are below this */
+#define TIDTAB_MAX_TID (TIDTAB_LEAVES * TIDTAB_LEAF_ENTRIES)
 
+void thrhash_init(void);
+int thrhash_reserve(void);
 void thrhash_add(thread_t *thr);
 void thrhash_remove(thread_t *thr);
+void thrhash_unlink(thread_t *thr);
 thread_t *thrhash_find(unsigned int tid);
-unsigned int thrhash_entry(unsigned int tid);
 
 #endif /* _P3_THRHASH_H */
@@ -13,11 +13,14 @@
 typedef struct thrlist_t thrlist_t;
 
 #include <thread.h>
+#include <variable_queue.h>
+
+/* The threads of a list, linked through their link field */
+Q_NEW_HEAD(thrqueue_t, thread_t);
 
 /* The structure of our double linked list */
 struct thrlist_t {
-	thread_t *head;
-	thread_t *tail;
+	thrqueue_t q;
 	unsigned int size;
 };
 
@@ -31,9 +34,11 @@ int thrlist_remove(thread_t *thread);
 /* Adding nodes */
 int thrlist_add_tail(thread_t *thread, thrlist_t *list);
 int thrlist_add_head(thread_t *thread, thrlist_t *list);
-int thrlist_add_sorted(thread_t *thread, thrlist_t *list);
 
 /* Accessing nodes */
-thread_t *thrlist_find(unsigned int, thrlist_t *);
+#define thrlist_head(list) Q_GET_FRONT(&(list)->q)
+#define thrlist_tail(list) Q_GET_TAIL(&(list)->q)
+#define thrlist_next(thread) Q_GET_NEXT(thread, link)
+#define thrlist_prev(thread) Q_GET_PREV(thread, link)
 
 #endif /* !__P3_THRLIST_H_ */
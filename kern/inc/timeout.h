@@ -0,0 +1,60 @@
+/**
+ * @file timeout.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Types and prototypes for the kernel timeouts
+ */
+
+#ifndef __KERN_TIMEOUT_H_
+#define __KERN_TIMEOUT_H_
+
+#include <types.h>
+#include <inc/stdint.h>
+#include <variable_queue.h>
+
+/* Bits of the expiry tick indexing the first level of the wheel */
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_ROOT_SLOTS (1 << WHEEL_ROOT_BITS)
+/* Bits of the expiry tick indexing each of the other levels */
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVEL_SLOTS (1 << WHEEL_LEVEL_BITS)
+/* Levels above the first one, enough to cover every 32 bits delay */
+#define WHEEL_LEVELS 4
+
+typedef struct timeout_t timeout_t;
+
+/**
+ * A function called from the timer interrupt when a timeout expires. It must
+ * not block, and may add the timeout again for a later tick.
+ */
+typedef void (*timeout_fn_t)(void *arg);
+
+/**
+ * A timeout, embedded in whatever structure needs one, so that arming it
+ * never allocates anything
+ */
+struct timeout_t {
+	unsigned int	expires;	// Tick at which the timeout fires
+	uint64_t		deadline;	// Its nanosecond within the tick, 0 if none
+	timeout_fn_t	fn;			// Called with arg when it does
+	void			*arg;
+	timeout_t		*next;		// Embeded traversal for the wheel slots
+	timeout_t		*prev;
+	timeout_t		**slot;		// The slot holding us, NULL if not armed
+	PH_NEW_LINK(timeout_t) fine_link;	// In the heap of fine timeouts
+};
+
+void init_timeouts(void);
+void init_timeout(timeout_t *timeout, timeout_fn_t fn, void *arg);
+void add_timeout(timeout_t *timeout, unsigned int expires);
+void add_timeout_ns(timeout_t *timeout, unsigned int expires,
+		uint64_t deadline);
+void cancel_timeout(timeout_t *timeout);
+boolean_t timeout_pending(timeout_t *timeout);
+int run_timeouts(unsigned int now);
+boolean_t next_timeout(unsigned int *tick);
+int run_fine_timeouts(void);
+boolean_t next_fine_timeout(uint64_t *deadline);
+
+#endif /* __KERN_TIMEOUT_H_ */
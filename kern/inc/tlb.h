@@ -0,0 +1,38 @@
+/**
+ * @file tlb.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and types for the TLB invalidation functions
+ */
+
+#ifndef __KERN_TLB_H_
+#define __KERN_TLB_H_
+
+#include <page_types.h>
+
+/*
+ * Above this many pages, flushing the whole TLB is cheaper than invalidating
+ * the pages one by one
+ */
+#define TLB_FLUSH_THRESHOLD 32
+
+/**
+ * A set of pages whose TLB entries have to be invalidated together, once a
+ * multi-page operation is done with the page tables.
+ */
+typedef struct {
+	vaddr_t		pages[TLB_FLUSH_THRESHOLD];	// Pages to invalidate
+	int			count;		// Number of pages recorded
+	boolean_t	full;		// Too many pages, flush everything
+} tlb_batch_t;
+
+void tlb_flush_page(vaddr_t va);
+void tlb_flush_range(vaddr_t base, int num_pages);
+void tlb_flush_all(void);
+
+void tlb_batch_init(tlb_batch_t *batch);
+void tlb_batch_add(tlb_batch_t *batch, vaddr_t va);
+void tlb_batch_flush(tlb_batch_t *batch);
+
+#endif /* __KERN_TLB_H_ */
@@ -0,0 +1,25 @@
+/**
+ * @file trace.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the trace of the scheduler
+ */
+
+#ifndef __KERN_TRACE_H_
+#define __KERN_TRACE_H_
+
+#include <thread.h>
+#include <schedtrace.h>
+
+void trace_init(void);
+void trace_start(void);
+int trace_stop(void);
+int trace_drain(sched_event_t *buf, int max);
+
+void trace_hint_switch(int reason);
+void trace_hint_wake(int source);
+void trace_switch(thread_t *self, thread_t *other);
+void trace_wakeup(thread_t *thread, thrstate_t previous);
+
+#endif /* __KERN_TRACE_H_ */
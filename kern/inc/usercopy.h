@@ -0,0 +1,25 @@
+/**
+ * @file usercopy.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the copies between kernel and user memory
+ */
+
+#ifndef __KERN_USERCOPY_H_
+#define __KERN_USERCOPY_H_
+
+#include <types.h>
+#include <stdint.h>
+
+boolean_t user_range(const void *addr, size_t len);
+int copy_from_user(void *dst, const void *src, size_t len);
+int copy_to_user(void *dst, const void *src, size_t len);
+int strncpy_from_user(char *dst, const char *src, size_t len);
+uint32_t usercopy_fixup(uint32_t eip);
+
+/* Raw copies @see usercopy_asm.S */
+int _copy_user(void *dst, const void *src, size_t len);
+int _strncpy_user(char *dst, const char *src, size_t len);
+
+#endif /* __KERN_USERCOPY_H_ */
@@ -0,0 +1,588 @@
+/** @file variable_queue.h
+ *
+ *  @brief Generalized queue module for data collection
+ *
+ *  Three families of intrusive structures, whose links are embedded in the
+ *  elements so that organizing them never allocates anything:
+ *  - Q_*, doubly linked queues.
+ *  - PH_*, pairing heaps, for timer and priority queues: insertion is O(1),
+ *    and taking the least element or removing any element is O(log n)
+ *    amortized. The order is given by a LESS(a, b) macro or function,
+ *    nonzero if element a goes before element b.
+ *  - MPSC_*, lock-free queues of any number of producers and a single
+ *    consumer, for handing elements from interrupt handlers or other CPUs
+ *    to a thread. The producers push onto a stack with a compare-and-swap;
+ *    the consumer takes the whole stack at once and reverses it, so that the
+ *    elements come out in the order they were pushed.
+ *
+ *  @author Daniel Balle (dballe)
+ *  @author Loic Ottet (lottet)
+ **/
+
+#ifndef _VARIABLE_QUEUE_H
+#define _VARIABLE_QUEUE_H
+
+#include <stddef.h>
+
+
+
+/** @def Q_NEW_HEAD(Q_HEAD_TYPE, Q_ELEM_TYPE) 
+ *
+ *  @brief Generates a new structure of type Q_HEAD_TYPE representing the head 
+ *  of a queue of elements of type Q_ELEM_TYPE. 
+ *  
+ *  Usage: Q_NEW_HEAD(Q_HEAD_TYPE, Q_ELEM_TYPE); //create the type <br>
+           Q_HEAD_TYPE headName; //instantiate a head of the given type
+ *
+ *  @param Q_HEAD_TYPE the type you wish the newly-generated structure to have.
+ *         
+ *  @param Q_ELEM_TYPE the type of elements stored in the queue.
+ *         Q_ELEM_TYPE must be a structure.
+ *  
+ **/
+ 
+#define Q_NEW_HEAD(Q_HEAD_TYPE, Q_ELEM_TYPE) \
+	typedef struct { \
+		struct Q_ELEM_TYPE *front; \
+		struct Q_ELEM_TYPE *tail; \
+	} Q_HEAD_TYPE
+
+/** @def Q_NEW_LINK(Q_ELEM_TYPE)
+ *
+ *  @brief Instantiates a link within a structure, allowing that structure to be 
+ *         collected into a queue created with Q_NEW_HEAD. 
+ *
+ *  Usage: <br>
+ *  typedef struct Q_ELEM_TYPE {<br>
+ *  Q_NEW_LINK(Q_ELEM_TYPE) LINK_NAME; //instantiate the link <br>
+ *  } Q_ELEM_TYPE; <br>
+ *
+ *  A structure can have more than one link defined within it, as long as they
+ *  have different names. This allows the structure to be placed in more than
+ *  one queue simultanteously.
+ *
+ *  @param Q_ELEM_TYPE the type of the structure containing the link
+ **/
+#define Q_NEW_LINK(Q_ELEM_TYPE) \
+	struct { \
+		struct Q_ELEM_TYPE *next; \
+		struct Q_ELEM_TYPE *prev; \
+	}
+ 
+ 
+/** @def Q_INIT_HEAD(Q_HEAD)
+ *
+ *  @brief Initializes the head of a queue so that the queue head can be used
+ *         properly.
+ *  @param Q_HEAD Pointer to queue head to initialize
+ **/
+#define Q_INIT_HEAD(Q_HEAD) do { \
+	(Q_HEAD)->front = NULL; \
+	(Q_HEAD)->tail = NULL; \
+} while (0)
+
+/** @def Q_INIT_ELEM(Q_ELEM, LINK_NAME)
+ *
+ *  @brief Initializes the link named LINK_NAME in an instance of the structure  
+ *         Q_ELEM. 
+ *  
+ *  Once initialized, the link can be used to organized elements in a queue.
+ *  
+ *  @param Q_ELEM Pointer to the structure instance containing the link
+ *  @param LINK_NAME The name of the link to initialize
+ **/
+#define Q_INIT_ELEM(Q_ELEM, LINK_NAME) do { \
+	(Q_ELEM)->LINK_NAME.next = NULL; \
+	(Q_ELEM)->LINK_NAME.prev = NULL; \
+} while (0)
+ 
+/** @def Q_INSERT_FRONT(Q_HEAD, Q_ELEM, LINK_NAME)
+ *
+ *  @brief Inserts the queue element pointed to by Q_ELEM at the front of the 
+ *         queue headed by the structure Q_HEAD. 
+ *  
+ *  The link identified by LINK_NAME will be used to organize the element and
+ *  record its location in the queue.
+ *
+ *  @param Q_HEAD Pointer to the head of the queue into which Q_ELEM will be 
+ *         inserted
+ *  @param Q_ELEM Pointer to the element to insert into the queue
+ *  @param LINK_NAME Name of the link used to organize the queue
+ *
+ *  @return Void (you may change this if your implementation calls for a 
+ *                return value)
+ **/
+#define Q_INSERT_FRONT(Q_HEAD, Q_ELEM, LINK_NAME) do { \
+	(Q_ELEM)->LINK_NAME.prev = NULL; \
+	(Q_ELEM)->LINK_NAME.next = (Q_HEAD)->front; \
+	if ((Q_HEAD)->front != NULL) (Q_HEAD)->front->LINK_NAME.prev = (Q_ELEM); \
+	else (Q_HEAD)->tail = (Q_ELEM); \
+	(Q_HEAD)->front = (Q_ELEM); \
+} while (0)
+ 
+/** @def Q_INSERT_TAIL(Q_HEAD, Q_ELEM, LINK_NAME) 
+ *  @brief Inserts the queue element pointed to by Q_ELEM at the end of the 
+ *         queue headed by the structure pointed to by Q_HEAD. 
+ *  
+ *  The link identified by LINK_NAME will be used to organize the element and
+ *  record its location in the queue.
+ *
+ *  @param Q_HEAD Pointer to the head of the queue into which Q_ELEM will be 
+ *         inserted
+ *  @param Q_ELEM Pointer to the element to insert into the queue
+ *  @param LINK_NAME Name of the link used to organize the queue
+ *
+ *  @return Void (you may change this if your implementation calls for a 
+ *                return value)
+ **/
+#define Q_INSERT_TAIL(Q_HEAD, Q_ELEM, LINK_NAME) do { \
+	(Q_ELEM)->LINK_NAME.next = NULL; \
+	(Q_ELEM)->LINK_NAME.prev = (Q_HEAD)->tail; \
+	if ((Q_HEAD)->tail != NULL) (Q_HEAD)->tail->LINK_NAME.next = (Q_ELEM); \
+	else (Q_HEAD)->front = (Q_ELEM); \
+	(Q_HEAD)->tail = (Q_ELEM); \
+} while (0)
+
+
+/** @def Q_GET_FRONT(Q_HEAD)
+ *  
+ *  @brief Returns a pointer to the first element in the queue, or NULL 
+ *  (memory address 0) if the queue is empty.
+ *
+ *  @param Q_HEAD Pointer to the head of the queue
+ *  @return Pointer to the first element in the queue, or NULL if the queue
+ *          is empty
+ **/
+#define Q_GET_FRONT(Q_HEAD) ((Q_HEAD)->front)
+ 
+/** @def Q_GET_TAIL(Q_HEAD)
+ *
+ *  @brief Returns a pointer to the last element in the queue, or NULL 
+ *  (memory address 0) if the queue is empty.
+ *
+ *  @param Q_HEAD Pointer to the head of the queue
+ *  @return Pointer to the last element in the queue, or NULL if the queue
+ *          is empty
+ **/
+#define Q_GET_TAIL(Q_HEAD) ((Q_HEAD)->tail)
+
+
+/** @def Q_GET_NEXT(Q_ELEM, LINK_NAME)
+ * 
+ *  @brief Returns a pointer to the next element in the queue, as linked to by 
+ *         the link specified with LINK_NAME. 
+ *
+ *  If Q_ELEM is not in a queue or is the last element in the queue, 
+ *  Q_GET_NEXT should return NULL.
+ *
+ *  @param Q_ELEM Pointer to the queue element before the desired element
+ *  @param LINK_NAME Name of the link organizing the queue
+ *
+ *  @return The element after Q_ELEM, or NULL if there is no next element
+ **/
+#define Q_GET_NEXT(Q_ELEM, LINK_NAME) ((Q_ELEM)->LINK_NAME.next)
+ 
+/** @def Q_GET_PREV(Q_ELEM, LINK_NAME)
+ * 
+ *  @brief Returns a pointer to the previous element in the queue, as linked to 
+ *         by the link specified with LINK_NAME. 
+ *
+ *  If Q_ELEM is not in a queue or is the first element in the queue, 
+ *  Q_GET_NEXT should return NULL.
+ *
+ *  @param Q_ELEM Pointer to the queue element after the desired element
+ *  @param LINK_NAME Name of the link organizing the queue
+ *
+ *  @return The element before Q_ELEM, or NULL if there is no next element
+ **/
+#define Q_GET_PREV(Q_ELEM, LINK_NAME) ((Q_ELEM)->LINK_NAME.prev)
+
+/** @def Q_INSERT_AFTER(Q_HEAD, Q_INQ, Q_TOINSERT, LINK_NAME)
+ *
+ *  @brief Inserts the queue element Q_TOINSERT after the element Q_INQ
+ *         in the queue.
+ *
+ *  Inserts an element into a queue after a given element. If the given
+ *  element is the last element, Q_HEAD should be updated appropriately
+ *  (so that Q_TOINSERT becomes the tail element)
+ *
+ *  @param Q_HEAD head of the queue into which Q_TOINSERT will be inserted
+ *  @param Q_INQ  Element already in the queue
+ *  @param Q_TOINSERT Element to insert into queue
+ *  @param LINK_NAME  Name of link field used to organize the queue
+ **/
+
+#define Q_INSERT_AFTER(Q_HEAD,Q_INQ,Q_TOINSERT,LINK_NAME) do { \
+	(Q_TOINSERT)->LINK_NAME.prev = (Q_INQ); \
+	(Q_TOINSERT)->LINK_NAME.next = (Q_INQ)->LINK_NAME.next; \
+	if ((Q_INQ)->LINK_NAME.next != NULL) \
+		(Q_INQ)->LINK_NAME.next->LINK_NAME.prev = (Q_TOINSERT); \
+	else (Q_HEAD)->tail = (Q_TOINSERT); \
+	(Q_INQ)->LINK_NAME.next = (Q_TOINSERT); \
+} while (0)
+
+/** @def Q_INSERT_BEFORE(Q_HEAD, Q_INQ, Q_TOINSERT, LINK_NAME)
+ *
+ *  @brief Inserts the queue element Q_TOINSERT before the element Q_INQ
+ *         in the queue.
+ *
+ *  Inserts an element into a queue before a given element. If the given
+ *  element is the first element, Q_HEAD should be updated appropriately
+ *  (so that Q_TOINSERT becomes the front element)
+ *
+ *  @param Q_HEAD head of the queue into which Q_TOINSERT will be inserted
+ *  @param Q_INQ  Element already in the queue
+ *  @param Q_TOINSERT Element to insert into queue
+ *  @param LINK_NAME  Name of link field used to organize the queue
+ **/
+
+#define Q_INSERT_BEFORE(Q_HEAD,Q_INQ,Q_TOINSERT,LINK_NAME) do { \
+	(Q_TOINSERT)->LINK_NAME.next = (Q_INQ); \
+	(Q_TOINSERT)->LINK_NAME.prev = (Q_INQ)->LINK_NAME.prev; \
+	if ((Q_INQ)->LINK_NAME.prev != NULL) \
+		(Q_INQ)->LINK_NAME.prev->LINK_NAME.next = (Q_TOINSERT); \
+	else (Q_HEAD)->front = (Q_TOINSERT); \
+	(Q_INQ)->LINK_NAME.prev = (Q_TOINSERT); \
+} while (0)
+
+/** @def Q_REMOVE(Q_HEAD,Q_ELEM,LINK_NAME)
+ * 
+ *  @brief Detaches the element Q_ELEM from the queue organized by LINK_NAME, 
+ *         and returns a pointer to the element. 
+ *
+ *  If Q_HEAD does not use the link named LINK_NAME to organize its elements or 
+ *  if Q_ELEM is not a member of Q_HEAD's queue, the behavior of this macro
+ *  is undefined.
+ *
+ *  @param Q_HEAD Pointer to the head of the queue containing Q_ELEM. If 
+ *         Q_REMOVE removes the first, last, or only element in the queue, 
+ *         Q_HEAD should be updated appropriately.
+ *  @param Q_ELEM Pointer to the element to remove from the queue headed by 
+ *         Q_HEAD.
+ *  @param LINK_NAME The name of the link used to organize Q_HEAD's queue
+ *
+ *  Q_ELEM is evaluated once, so that Q_REMOVE(q, Q_GET_FRONT(q), link)
+ *  works.
+ * 
+ *  @return Void (if you would like to return a value, you may change this
+ *                specification)
+ **/
+#define Q_REMOVE(Q_HEAD,Q_ELEM,LINK_NAME) do { \
+	__typeof__(Q_ELEM) q_elem_ = (Q_ELEM); \
+	if (q_elem_->LINK_NAME.prev != NULL) \
+		q_elem_->LINK_NAME.prev->LINK_NAME.next = q_elem_->LINK_NAME.next; \
+	else (Q_HEAD)->front = q_elem_->LINK_NAME.next; \
+	if (q_elem_->LINK_NAME.next != NULL) \
+		q_elem_->LINK_NAME.next->LINK_NAME.prev = q_elem_->LINK_NAME.prev; \
+	else (Q_HEAD)->tail = q_elem_->LINK_NAME.prev; \
+	q_elem_->LINK_NAME.next = NULL; \
+	q_elem_->LINK_NAME.prev = NULL; \
+} while (0)
+
+/** @def Q_FOREACH(CURRENT_ELEM,Q_HEAD,LINK_NAME) 
+ *
+ *  @brief Constructs an iterator block (like a for block) that operates
+ *         on each element in Q_HEAD, in order.
+ *
+ *  Q_FOREACH constructs the head of a block of code that will iterate through
+ *  each element in the queue headed by Q_HEAD. Each time through the loop, 
+ *  the variable named by CURRENT_ELEM will be set to point to a subsequent
+ *  element in the queue.
+ *
+ *  Usage:<br>
+ *  Q_FOREACH(CURRENT_ELEM,Q_HEAD,LINK_NAME)<br>
+ *  {<br>
+ *  ... operate on the variable CURRENT_ELEM ... <br>
+ *  }
+ *
+ *  If LINK_NAME is not used to organize the queue headed by Q_HEAD, then
+ *  the behavior of this macro is undefined.
+ *
+ *  @param CURRENT_ELEM name of the variable to use for iteration. On each
+ *         loop through the Q_FOREACH block, CURRENT_ELEM will point to the
+ *         current element in the queue. CURRENT_ELEM should be an already-
+ *         defined variable name, and its type should be a pointer to 
+ *         the type of data organized by Q_HEAD
+ *  @param Q_HEAD Pointer to the head of the queue to iterate through
+ *  @param LINK_NAME The name of the link used to organize the queue headed
+ *         by Q_HEAD.
+ **/
+
+#define Q_FOREACH(CURRENT_ELEM,Q_HEAD,LINK_NAME) \
+	for ((CURRENT_ELEM) = (Q_HEAD)->front; (CURRENT_ELEM) != NULL; \
+		(CURRENT_ELEM) = (CURRENT_ELEM)->LINK_NAME.next)
+
+
+/** @def PH_NEW_HEAD(PH_HEAD_TYPE, PH_ELEM_TYPE)
+ *
+ *  @brief Generates a new structure of type PH_HEAD_TYPE representing the
+ *  head of a pairing heap of elements of type PH_ELEM_TYPE.
+ *
+ *  @param PH_HEAD_TYPE the type you wish the newly-generated structure to have
+ *  @param PH_ELEM_TYPE the type of elements stored in the heap, a structure
+ **/
+#define PH_NEW_HEAD(PH_HEAD_TYPE, PH_ELEM_TYPE) \
+	typedef struct { \
+		struct PH_ELEM_TYPE *root; \
+	} PH_HEAD_TYPE
+
+/** @def PH_NEW_LINK(PH_ELEM_TYPE)
+ *
+ *  @brief Instantiates a link within a structure, allowing that structure to
+ *  be collected into a heap created with PH_NEW_HEAD.
+ *
+ *  An element links to its first child and to its next sibling. Its prev
+ *  link is its previous sibling, or its parent if it is the first child,
+ *  and NULL for the root.
+ *
+ *  @param PH_ELEM_TYPE the type of the structure containing the link
+ **/
+#define PH_NEW_LINK(PH_ELEM_TYPE) \
+	struct { \
+		struct PH_ELEM_TYPE *child; \
+		struct PH_ELEM_TYPE *next; \
+		struct PH_ELEM_TYPE *prev; \
+	}
+
+/** @def PH_INIT_HEAD(PH_HEAD)
+ *  @brief Initializes the head of a heap, which is empty
+ **/
+#define PH_INIT_HEAD(PH_HEAD) do { \
+	(PH_HEAD)->root = NULL; \
+} while (0)
+
+/** @def PH_INIT_ELEM(PH_ELEM, LINK_NAME)
+ *  @brief Initializes the link named LINK_NAME in an element
+ **/
+#define PH_INIT_ELEM(PH_ELEM, LINK_NAME) do { \
+	(PH_ELEM)->LINK_NAME.child = NULL; \
+	(PH_ELEM)->LINK_NAME.next = NULL; \
+	(PH_ELEM)->LINK_NAME.prev = NULL; \
+} while (0)
+
+/** @def PH_GET_MIN(PH_HEAD)
+ *  @return the least element of the heap, NULL if it is empty
+ **/
+#define PH_GET_MIN(PH_HEAD) ((PH_HEAD)->root)
+
+/** @def PH_EMPTY(PH_HEAD)
+ *  @return nonzero if the heap is empty
+ **/
+#define PH_EMPTY(PH_HEAD) ((PH_HEAD)->root == NULL)
+
+/** @def PH_MELD_(A, B, LINK_NAME, LESS, OUT)
+ *
+ *  @brief Melds the trees rooted at A and B, neither NULL nor with siblings,
+ *  and sets OUT to the root of the result. For the other PH_ macros.
+ **/
+#define PH_MELD_(A, B, LINK_NAME, LESS, OUT) do { \
+	__typeof__(A) ph_win_ = (A), ph_lose_ = (B); \
+	if (LESS(ph_lose_, ph_win_)) { \
+		ph_win_ = ph_lose_; \
+		ph_lose_ = (A); \
+	} \
+	ph_lose_->LINK_NAME.next = ph_win_->LINK_NAME.child; \
+	if (ph_win_->LINK_NAME.child != NULL) \
+		ph_win_->LINK_NAME.child->LINK_NAME.prev = ph_lose_; \
+	ph_lose_->LINK_NAME.prev = ph_win_; \
+	ph_win_->LINK_NAME.child = ph_lose_; \
+	(OUT) = ph_win_; \
+} while (0)
+
+/** @def PH_MERGE_CHILDREN_(PH_ELEM, LINK_NAME, LESS, OUT)
+ *
+ *  @brief Merges the children of PH_ELEM into a single tree, in two passes,
+ *  and sets OUT to its root, NULL if there are none. For the other PH_
+ *  macros.
+ *
+ *  The first pass melds the children in pairs from the first one, and
+ *  stacks the pairs up; the second melds the stack into a single tree.
+ **/
+#define PH_MERGE_CHILDREN_(PH_ELEM, LINK_NAME, LESS, OUT) do { \
+	__typeof__(PH_ELEM) ph_cur_ = (PH_ELEM)->LINK_NAME.child; \
+	__typeof__(PH_ELEM) ph_stack_ = NULL; \
+	(PH_ELEM)->LINK_NAME.child = NULL; \
+	while (ph_cur_ != NULL) { \
+		__typeof__(PH_ELEM) ph_a_ = ph_cur_, ph_b_ = ph_cur_->LINK_NAME.next; \
+		__typeof__(PH_ELEM) ph_pair_ = ph_a_; \
+		ph_cur_ = ph_b_ != NULL ? ph_b_->LINK_NAME.next : NULL; \
+		ph_a_->LINK_NAME.next = ph_a_->LINK_NAME.prev = NULL; \
+		if (ph_b_ != NULL) { \
+			ph_b_->LINK_NAME.next = ph_b_->LINK_NAME.prev = NULL; \
+			PH_MELD_(ph_a_, ph_b_, LINK_NAME, LESS, ph_pair_); \
+		} \
+		ph_pair_->LINK_NAME.next = ph_stack_; \
+		ph_stack_ = ph_pair_; \
+	} \
+	__typeof__(PH_ELEM) ph_tree_ = ph_stack_; \
+	if (ph_stack_ != NULL) { \
+		ph_stack_ = ph_stack_->LINK_NAME.next; \
+		ph_tree_->LINK_NAME.next = NULL; \
+	} \
+	while (ph_stack_ != NULL) { \
+		__typeof__(PH_ELEM) ph_top_ = ph_stack_; \
+		ph_stack_ = ph_stack_->LINK_NAME.next; \
+		ph_top_->LINK_NAME.next = NULL; \
+		PH_MELD_(ph_tree_, ph_top_, LINK_NAME, LESS, ph_tree_); \
+	} \
+	(OUT) = ph_tree_; \
+} while (0)
+
+/** @def PH_INSERT(PH_HEAD, PH_ELEM, LINK_NAME, LESS)
+ *
+ *  @brief Inserts the element PH_ELEM in the heap, in O(1)
+ *
+ *  @param PH_HEAD Pointer to the head of the heap
+ *  @param PH_ELEM Pointer to the element to insert, in no heap
+ *  @param LINK_NAME Name of the link used to organize the heap
+ *  @param LESS the order of the heap, LESS(a, b) nonzero if a goes before b
+ **/
+#define PH_INSERT(PH_HEAD, PH_ELEM, LINK_NAME, LESS) do { \
+	PH_INIT_ELEM(PH_ELEM, LINK_NAME); \
+	if ((PH_HEAD)->root == NULL) (PH_HEAD)->root = (PH_ELEM); \
+	else PH_MELD_((PH_HEAD)->root, PH_ELEM, LINK_NAME, LESS, \
+		(PH_HEAD)->root); \
+} while (0)
+
+/** @def PH_REMOVE(PH_HEAD, PH_ELEM, LINK_NAME, LESS)
+ *
+ *  @brief Detaches the element PH_ELEM, anywhere in the heap, in O(log n)
+ *  amortized
+ *
+ *  Its children are merged into a single tree, which takes its place. If
+ *  PH_ELEM is not in the heap, the behavior of this macro is undefined.
+ *
+ *  @param PH_HEAD Pointer to the head of the heap containing PH_ELEM
+ *  @param PH_ELEM Pointer to the element to remove
+ *  @param LINK_NAME Name of the link used to organize the heap
+ *  @param LESS the order of the heap
+ **/
+#define PH_REMOVE(PH_HEAD, PH_ELEM, LINK_NAME, LESS) do { \
+	__typeof__(PH_ELEM) ph_elem_ = (PH_ELEM), ph_sub_; \
+	PH_MERGE_CHILDREN_(ph_elem_, LINK_NAME, LESS, ph_sub_); \
+	if (ph_elem_ == (PH_HEAD)->root) { \
+		(PH_HEAD)->root = ph_sub_; \
+	} else { \
+		__typeof__(PH_ELEM) ph_prev_ = ph_elem_->LINK_NAME.prev; \
+		if (ph_prev_->LINK_NAME.child == ph_elem_) \
+			ph_prev_->LINK_NAME.child = ph_elem_->LINK_NAME.next; \
+		else ph_prev_->LINK_NAME.next = ph_elem_->LINK_NAME.next; \
+		if (ph_elem_->LINK_NAME.next != NULL) \
+			ph_elem_->LINK_NAME.next->LINK_NAME.prev = ph_prev_; \
+		if (ph_sub_ != NULL) PH_MELD_((PH_HEAD)->root, ph_sub_, LINK_NAME, \
+			LESS, (PH_HEAD)->root); \
+	} \
+	PH_INIT_ELEM(ph_elem_, LINK_NAME); \
+} while (0)
+
+/** @def PH_POP(PH_HEAD, PH_ELEM, LINK_NAME, LESS)
+ *
+ *  @brief Takes the least element out of the heap, in O(log n) amortized
+ *
+ *  @param PH_HEAD Pointer to the head of the heap
+ *  @param PH_ELEM Variable set to the element taken, NULL if the heap is empty
+ *  @param LINK_NAME Name of the link used to organize the heap
+ *  @param LESS the order of the heap
+ **/
+#define PH_POP(PH_HEAD, PH_ELEM, LINK_NAME, LESS) do { \
+	(PH_ELEM) = (PH_HEAD)->root; \
+	if ((PH_ELEM) != NULL) PH_REMOVE(PH_HEAD, PH_ELEM, LINK_NAME, LESS); \
+} while (0)
+
+
+/** @def MPSC_NEW_HEAD(MPSC_HEAD_TYPE, MPSC_ELEM_TYPE)
+ *
+ *  @brief Generates a new structure of type MPSC_HEAD_TYPE representing the
+ *  head of a multi-producer single-consumer queue of elements of type
+ *  MPSC_ELEM_TYPE.
+ *
+ *  The producers push onto in, the newest first. Only the consumer touches
+ *  out, the elements it took from in, the oldest first.
+ *
+ *  @param MPSC_HEAD_TYPE the type you wish the newly-generated structure to
+ *         have
+ *  @param MPSC_ELEM_TYPE the type of elements stored in the queue, a
+ *         structure
+ **/
+#define MPSC_NEW_HEAD(MPSC_HEAD_TYPE, MPSC_ELEM_TYPE) \
+	typedef struct { \
+		struct MPSC_ELEM_TYPE * volatile in; \
+		struct MPSC_ELEM_TYPE *out; \
+	} MPSC_HEAD_TYPE
+
+/** @def MPSC_NEW_LINK(MPSC_ELEM_TYPE)
+ *  @brief Instantiates a link within a structure, allowing that structure to
+ *  be collected into a queue created with MPSC_NEW_HEAD
+ **/
+#define MPSC_NEW_LINK(MPSC_ELEM_TYPE) \
+	struct { \
+		struct MPSC_ELEM_TYPE *next; \
+	}
+
+/** @def MPSC_INIT_HEAD(MPSC_HEAD)
+ *  @brief Initializes the head of a queue, which is empty
+ **/
+#define MPSC_INIT_HEAD(MPSC_HEAD) do { \
+	(MPSC_HEAD)->in = NULL; \
+	(MPSC_HEAD)->out = NULL; \
+} while (0)
+
+/** @def MPSC_PUSH(MPSC_HEAD, MPSC_ELEM, LINK_NAME)
+ *
+ *  @brief Appends an element to the queue, from any producer, without a lock
+ *
+ *  The element is pushed onto in with a compare-and-swap. Since the
+ *  consumer only ever takes in as a whole, an element can't be taken from
+ *  under the producer and the compare-and-swap can't be fooled by an
+ *  element coming back.
+ *
+ *  @param MPSC_HEAD Pointer to the head of the queue
+ *  @param MPSC_ELEM Pointer to the element, in no queue
+ *  @param LINK_NAME Name of the link used to organize the queue
+ **/
+#define MPSC_PUSH(MPSC_HEAD, MPSC_ELEM, LINK_NAME) do { \
+	__typeof__(MPSC_ELEM) mpsc_old_; \
+	do { \
+		mpsc_old_ = (MPSC_HEAD)->in; \
+		(MPSC_ELEM)->LINK_NAME.next = mpsc_old_; \
+	} while (!__sync_bool_compare_and_swap(&(MPSC_HEAD)->in, mpsc_old_, \
+		(MPSC_ELEM))); \
+} while (0)
+
+/** @def MPSC_POP(MPSC_HEAD, MPSC_ELEM, LINK_NAME)
+ *
+ *  @brief Takes the oldest element out of the queue, from the consumer
+ *
+ *  Once out is empty, the consumer exchanges in for NULL, and reverses the
+ *  stack it got into out.
+ *
+ *  @param MPSC_HEAD Pointer to the head of the queue
+ *  @param MPSC_ELEM Variable set to the element taken, NULL if the queue is
+ *         empty
+ *  @param LINK_NAME Name of the link used to organize the queue
+ **/
+#define MPSC_POP(MPSC_HEAD, MPSC_ELEM, LINK_NAME) do { \
+	if ((MPSC_HEAD)->out == NULL && (MPSC_HEAD)->in != NULL) { \
+		__typeof__(MPSC_ELEM) mpsc_in_ = \
+			__sync_lock_test_and_set(&(MPSC_HEAD)->in, NULL); \
+		while (mpsc_in_ != NULL) { \
+			__typeof__(MPSC_ELEM) mpsc_next_ = mpsc_in_->LINK_NAME.next; \
+			mpsc_in_->LINK_NAME.next = (MPSC_HEAD)->out; \
+			(MPSC_HEAD)->out = mpsc_in_; \
+			mpsc_in_ = mpsc_next_; \
+		} \
+	} \
+	(MPSC_ELEM) = (MPSC_HEAD)->out; \
+	if ((MPSC_ELEM) != NULL) { \
+		(MPSC_HEAD)->out = (MPSC_ELEM)->LINK_NAME.next; \
+		(MPSC_ELEM)->LINK_NAME.next = NULL; \
+	} \
+} while (0)
+
+/** @def MPSC_EMPTY(MPSC_HEAD)
+ *  @return nonzero if the queue is empty, as seen by the consumer
+ **/
+#define MPSC_EMPTY(MPSC_HEAD) \
+	((MPSC_HEAD)->out == NULL && (MPSC_HEAD)->in == NULL)
+
+#endif /* _VARIABLE_QUEUE_H */
@@ -0,0 +1,26 @@
+/**
+ * @file vdso.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes for the kernel data pages mapped in user space
+ */
+
+#ifndef __KERN_VDSO_H_
+#define __KERN_VDSO_H_
+
+#include <types.h>
+#include <page_types.h>
+#include <kdata.h>
+#include <process.h>
+#include <thread.h>
+
+void vdso_init(void);
+int vdso_create(process_t *process);
+void vdso_destroy(process_t *process);
+boolean_t vdso_overlaps(vaddr_t va, int num_pages);
+void vdso_set_ticks(unsigned int ticks);
+void vdso_set_sysenter(boolean_t usable);
+void vdso_set_running(thread_t *thread);
+
+#endif /* __KERN_VDSO_H_ */
@@ -0,0 +1,32 @@
+/**
+ * @file wss.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Prototypes and constants for the working-set scanner
+ */
+
+#ifndef __KERN_WSS_H_
+#define __KERN_WSS_H_
+
+#include <process.h>
+#include <memstat.h>
+
+/**
+ * Set to 0 not to run the working-set scanner, @see wss.c
+ */
+#ifndef WSS_SCAN
+#define WSS_SCAN 1
+#endif
+
+/* Ticks the scanner sleeps between two regions */
+#define WSS_SLEEP_TICKS 10
+/* Rounds a page is counted idle for at most */
+#define WSS_MAX_AGE 255
+
+void wss_start(void);
+void wss_track(process_t *process);
+void wss_untrack(process_t *process);
+void wss_stats(process_t *process, memstat_t *stat);
+
+#endif /* __KERN_WSS_H_ */
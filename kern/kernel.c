@@ -31,6 +31,14 @@
 #include <drivers.h>
 #include <errors.h>
 #include <interrupts.h>
+#include <cpu.h>
+#include <slab.h>
+#include <futex.h>
+#include <fpu.h>
+#include <pageops.h>
+#include <profiler.h>
+#include <trace.h>
+#include <boottime.h>
 
 /** @brief Kernel entrypoint.
  *  
@@ -42,19 +50,46 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp) {
 
 	int err;
 
+	// Where the boot time goes, @see boottime.c
+	boot_start();
+
+	// The bootstrap processor gets its own GDT and TSS, like the others
+	cpu_init(0);
+	cpu_set_online();
+
 	// Initialize paging
 	err = install_paging(mbinfo->mem_upper);
 	if (err) kernel_panic("Unable to setup paging. Error %d", err);
+	boot_mark(KSTAT_BOOT_PAGING);
+
+	// The slab caches, the size classes first
+	slab_init();
 
 	// Init threads
 	thread_init();
 
+	// The queues of the threads waiting on user memory
+	futex_init();
+
+	// The FPU state areas, handed out on the first use of the FPU
+	fpu_init();
+
+	// The page copy and zero primitives, which default to rep strings
+	pageops_init();
+
+	// The sampling profiler and the trace of the scheduler, off until asked
+	prof_init();
+	trace_init();
+	boot_mark(KSTAT_BOOT_THREADS);
+
 	// Install syscalls
 	err = install_syscalls();
 	if (err) kernel_panic("Unable to setup syscalls. Error %d", err);
+	boot_mark(KSTAT_BOOT_SYSCALLS);
 
 	// Install drivers
 	install_handlers();
+	boot_mark(KSTAT_BOOT_HANDLERS);
 
 	/**
 	 * Create the "god" process, which will then use the system calls 
@@ -73,6 +108,9 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp) {
 	// Activate paging with the page directory of the god process
 	set_running(thread);
 
+	// The local APIC timer, if any, is mapped now that paging is on
+	timer_use_lapic();
+
 	// Now that we have a thread we can start using mutexes
 	install_mutex();
 	enable_interrupts();
@@ -81,6 +119,7 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp) {
 	args[0] = (void*) "god";
 	args[1] = NULL;
 
+	boot_mark(KSTAT_BOOT_GOD);
 	err = _exec(args);
 	kernel_panic("THERE IS NO GOD ! (error %d)", err);	
 
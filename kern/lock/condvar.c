@@ -9,16 +9,30 @@
  * thread at a time can act on the condvar's data structures. Threads register
  * themselves in a waiting list and are awaken when signals are emitted,
  * either one at a time or via a broadcast call.
+ *
+ * A waiter joins the list and blocks in the same dont_switch_me_out area, and
+ * the signals are sent in such an area too, so a waiter is always blocked by
+ * the time it is signaled. The list itself is protected by a spinlock, taken
+ * after the scheduler lock.
+ *
+ * A signaled thread would only wake up to lock the mutex it waits with
+ * again. If that mutex is held, typically by the signaler, the thread is
+ * moved to the waiting list of the mutex instead (@see mutex_requeue): it
+ * stays blocked until the owner hands it the mutex, and wakes up once, when
+ * it can go on. A broadcast thus wakes the waiters one after the other
+ * rather than all at once.
  * 
  * @bugs No bugs known
  */
 
 #include <stdlib.h>
-#include <syscall.h>
 #include <assert.h>
 #include <simics.h>
-#include <inc/syscall.h>
 #include <lock.h>
+#include <spinlock.h>
+#include <drivers.h>
+#include <context.h>
+#include <cpu.h>
 
 /**
  * @brief Initializes the given condition
@@ -26,12 +40,9 @@
  * The behavior when initializing an already initialized condvar or when
  * acting on a condvar while it is initializing is undefined. The init
  * function doesn't protect against interleaving.
- * 
- * @return 0 if success, negative number if error
  */
 void cond_init(cond_t *cv) {
-	// Condition mutex creation
-	mutex_init(&cv->mutex);
+	spin_init(&cv->guard);
 
 	// Data structure initialization
 	cv->first_waiting = NULL;
@@ -45,93 +56,122 @@ void cond_init(cond_t *cv) {
  * destroy function doesn't protect against interleaving.
  */
 void cond_destroy(cond_t *cv) {
+	// Nobody may be waiting
+	assert(cv->first_waiting == NULL);
+
 	// Destroy the list
 	cv->first_waiting = NULL;
 	cv->last_waiting = NULL;
-
-	// Destroy the mutex
-	mutex_destroy(&cv->mutex);
 }
 
 /**
  * @brief Waits for the given condition to be signaled
  * 
- * The thread adds itself to the waiting list, and deschedules itself until it
- * is awaken by a signal or broadcast call. Ensuring that the unlocking of the
- * mutex and the descheduling are "atomical" is taken care of in
- * awaken_first_thread.
+ * The thread adds itself to the waiting list, releases the mutex and blocks
+ * until it is signaled, all in one dont_switch_me_out area: a signal can
+ * only find it once it is blocked.
+ *
+ * When it runs again, the thread either holds the mutex already, handed
+ * over by its owner, or has to lock it. mutex_lock takes care of both.
  * 
  * @param mp the mutex to release while we are waiting for the signal, and to
  * reacquire afterwards
  */
 void cond_wait(cond_t *cv, mutex_t *mp) {
-	mutex_lock(&cv->mutex);
+	thread_t *me = get_self();
+
+	// The area we might be in already ends with our sleep
+	boolean_t in_area = this_cpu()->no_switch;
+	dont_switch_me_out();
 
 	// We register ourselves on the list
-	cond_waitlist_addLast(cv, get_running());
+	spin_lock_irqsave(&cv->guard);
+	me->cond_mutex = mp;
+	cond_waitlist_addLast(cv, me);
+	spin_unlock_irqrestore(&cv->guard);
 
-	mutex_unlock(&cv->mutex);
 	mutex_unlock(mp);
 
-	// We deschedule ourselves
-	int reject = 0;
-	_deschedule(&reject);
+	// Sleep until signaled
+	set_blocked(me);
+	thread_t *other = get_running();
+	if (other == NULL) other = idle();
+	context_switch(me, other);
 
+	if (in_area) dont_switch_me_out();
 	mutex_lock(mp);
 }
 
+/**
+ * @brief Hands a signaled thread its mutex, or wakes it up if the mutex is
+ * free. We must be in a dont_switch_me_out area.
+ */
+static void awaken(thread_t *thr) {
+	mutex_t *mp = thr->cond_mutex;
+	thr->cond_mutex = NULL;
+
+	if (!mutex_requeue(mp, thr)) set_runnable(thr);
+}
+
 /**
  * @brief Wakes the first thread in the waiting list
  * 
  * If no threads wait on the condition (at the moment we call it, or more
- * exactly when we acquire the mutex), this function has no effect (the signal
- * is lost).
+ * exactly when we acquire the spinlock), this function has no effect (the
+ * signal is lost).
  */
 void cond_signal(cond_t *cv) {
-	mutex_lock(&cv->mutex);
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
+
+	spin_lock_irqsave(&cv->guard);
+	thread_t *awaken_thr = cond_waitlist_removeHead(cv);
+	spin_unlock_irqrestore(&cv->guard);
 
 	// This does nothing if there is no thread to wake
-	awaken_first_thread(cv);
-	
-	mutex_unlock(&cv->mutex);
+	if (awaken_thr != NULL) awaken(awaken_thr);
+
+	if (!in_area) you_can_switch_me_out_now();
 }
 
 /**
  * @brief Wakes all the threads in the waiting list
  * 
  * If no threads wait on the condition (at the moment we call it, or more
- * exactly when we acquire the mutex), this function has no effect (the signal
- * is lost).
+ * exactly when we acquire the spinlock), this function has no effect (the
+ * signal is lost).
  */
 void cond_broadcast(cond_t *cv) {
-	mutex_lock(&cv->mutex);
-
-	// Remove all threads in the list
-	while(awaken_first_thread(cv) == 0) continue;
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
 
-	mutex_unlock(&cv->mutex);
-}
-
-/**
- * @brief Actually wakes the first thread in the list
- */
-int awaken_first_thread(cond_t *cv) {
-	thread_t *awaken = cond_waitlist_removeHead(cv);
-	if (awaken == NULL) return -1; // Signal we're at the end of the list
+	// Take the whole list at once
+	spin_lock_irqsave(&cv->guard);
+	thread_t *thr = cv->first_waiting;
+	cv->first_waiting = NULL;
+	cv->last_waiting = NULL;
+	spin_unlock_irqrestore(&cv->guard);
 
-	while(_make_runnable(awaken->tid) != 0) _yield(awaken->tid);
+	while (thr != NULL) {
+		thread_t *next = thr->wait_next;
+		awaken(thr);
+		thr = next;
+	}
 
-	return 0;
+	if (!in_area) you_can_switch_me_out_now();
 }
 
 void cond_waitlist_addLast(cond_t *cv, thread_t *thr) {
+	// It may still point to whoever followed it in an earlier list
+	thr->wait_next = NULL;
+
 	if (cv->last_waiting == NULL) {
 		// The list is empty
 		cv->first_waiting = thr;
 		cv->last_waiting = thr;
 	} else {
 		// Someone is waiting
-		cv->last_waiting->cond_nextwait = thr;
+		cv->last_waiting->wait_next = thr;
 		cv->last_waiting = thr;
 	}
 }
@@ -139,7 +179,7 @@ void cond_waitlist_addLast(cond_t *cv, thread_t *thr) {
 thread_t *cond_waitlist_removeHead(cond_t *cv) {
 	thread_t *next = cv->first_waiting;
 	if (next != NULL) {
-		cv->first_waiting = next->cond_nextwait;
+		cv->first_waiting = next->wait_next;
 		if (cv->last_waiting == next) {
 			// There was only one thread in the list
 			cv->last_waiting = NULL;
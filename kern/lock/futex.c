@@ -0,0 +1,246 @@
+/**
+ * @file futex.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Waiting on a word of user memory
+ *
+ * The user thread library keeps its locks in user memory and only enters
+ * the kernel when it has to wait (@see futex_wait) or to wake waiters up
+ * (@see futex_wake). The kernel doesn't know what the words mean, it only
+ * compares a word with the value the waiter expects before blocking it.
+ *
+ * A word is known by its physical address, so that the threads of the
+ * processes sharing its page, through shared memory or a file mapping, wait
+ * on the same word. Before its key is taken, the page is made private to the
+ * process if it is on the zero frame or copy-on-write (@see prepare_write),
+ * so that the first write to it doesn't move it to another frame.
+ *
+ * The waiters are kept in a hash of FUTEX_BUCKETS queues, each protected by
+ * a spinlock. A waiter checks the word under the lock of its queue and joins
+ * it in the same dont_switch_me_out area in which it blocks, so a waker,
+ * which changes the word before it takes the lock of the queue, either
+ * makes the waiter see the new value or finds it in the queue. It can only
+ * make it runnable, which takes the scheduler lock too, once it is blocked.
+ *
+ * @bugs A page which is copied on write after a fork moves to another frame,
+ * the threads waiting on it before the fork are only woken up on its old
+ * frame.
+ */
+
+#include <stdlib.h>
+#include <errors.h>
+#include <x86/page.h>
+#include <x86/cr.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <page.h>
+#include <usercopy.h>
+#include <futex.h>
+
+/**
+ * A thread waiting on a word, on the kernel stack of the thread
+ */
+typedef struct futex_waiter {
+	uint32_t			key;		// Physical address of the word
+	thread_t			*thread;
+	struct futex_waiter	*next;		// In the queue of its bucket
+} futex_waiter_t;
+
+/**
+ * A queue of waiters, on the words whose keys hash to it
+ */
+typedef struct futex_bucket {
+	spinlock_t		lock;
+	futex_waiter_t	*first;
+	futex_waiter_t	*last;
+} futex_bucket_t;
+
+static futex_bucket_t buckets[FUTEX_BUCKETS];
+
+/**
+ * @brief Returns the bucket of a key
+ *
+ * The words are aligned, and the words of a lock often sit next to each
+ * other, so the low bits are dropped and the page number mixed in.
+ */
+static futex_bucket_t *bucket_of(uint32_t key) {
+	uint32_t hash = (key >> 2) ^ (key >> 12);
+	return &buckets[hash % FUTEX_BUCKETS];
+}
+
+/**
+ * @brief Initializes the queues, empty
+ */
+void futex_init(void) {
+	int i;
+	for (i = 0; i < FUTEX_BUCKETS; ++i) {
+		spin_init(&buckets[i].lock);
+		buckets[i].first = NULL;
+		buckets[i].last = NULL;
+	}
+}
+
+/**
+ * @brief Returns the physical address of the word at va, mapped in the
+ * current directory, or 0 if it is not present
+ */
+static uint32_t physical_address(vaddr_t va) {
+	pde_t pde = *get_pde(va, (pde_t *) get_cr3());
+	if (PE_GETFLAG(pde, PDE_PRESENT) && PE_GETFLAG(pde, PDE_PAGESIZE))
+		return PE_GETADDR(pde) | (va & (LARGE_PAGE_SIZE - 1));
+
+	pte_t *pte = get_pte(va, (pde_t *) get_cr3());
+	if (pte == NULL || !PE_GETFLAG(*pte, PTE_PRESENT)) return 0;
+	return PE_GETADDR(*pte) | (va & (PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Returns the key the word at addr is known by, on a frame of its
+ * own
+ *
+ * @param addr the user address of an aligned word
+ * @param key where to put the physical address of the word
+ * @return 0 on success, a negative error code otherwise
+ */
+static int futex_key(int *addr, uint32_t *key) {
+	vaddr_t va = (vaddr_t) addr;
+	if ((va & (sizeof(int) - 1)) != 0) return ERR_INVALID_ARG;
+	if (!user_range(addr, sizeof(int))) return ERR_INVALID_ARG;
+
+	// The program image is paged in on its first touch
+	int value;
+	if (copy_from_user(&value, addr, sizeof(int))) return ERR_INVALID_ARG;
+
+	int err = own_page_table(va);
+	if (err) return err;
+	err = prepare_write(va);
+	if (err) return err;
+
+	*key = physical_address(va);
+	if (*key == 0) return ERR_PAGE_NOT_PRESENT;
+	return 0;
+}
+
+/**
+ * @brief Whether the word at addr is still the one known by key. The lock
+ * of its bucket must be held, so interrupts are off.
+ *
+ * The page could have been removed since its key was taken; the word can
+ * only be read if it is still there, a page fault would be handled with the
+ * lock held.
+ */
+static boolean_t key_holds(int *addr, uint32_t key) {
+	uint32_t address = physical_address((vaddr_t) addr);
+	return address != 0 && address == key;
+}
+
+/**
+ * @brief Blocks the calling thread as long as the word at addr holds the
+ * expected value
+ *
+ * The thread returns once a futex_wake on the word picks it. The caller has
+ * to check the word again: another thread may have changed it back since.
+ *
+ * @param addr the user address of an aligned word
+ * @param expected the value the word has to hold for the thread to block
+ * @return 0 once woken up, ERR_FUTEX_CHANGED if the word didn't hold the
+ * value, another negative error code if the word can't be waited on
+ */
+int futex_wait(int *addr, int expected) {
+	uint32_t key;
+	int err = futex_key(addr, &key);
+	if (err) return err;
+
+	thread_t *self = get_self();
+	futex_bucket_t *bucket = bucket_of(key);
+	futex_waiter_t waiter;
+	waiter.key = key;
+	waiter.thread = self;
+	waiter.next = NULL;
+
+	dont_switch_me_out();
+	spin_lock_irqsave(&bucket->lock);
+
+	if (!key_holds(addr, key)) {
+		spin_unlock_irqrestore(&bucket->lock);
+		you_can_switch_me_out_now();
+		return ERR_INVALID_ARG;
+	}
+	if (*(volatile int *) addr != expected) {
+		spin_unlock_irqrestore(&bucket->lock);
+		you_can_switch_me_out_now();
+		return ERR_FUTEX_CHANGED;
+	}
+
+	if (bucket->last != NULL) bucket->last->next = &waiter;
+	else bucket->first = &waiter;
+	bucket->last = &waiter;
+	spin_unlock_irqrestore(&bucket->lock);
+
+	// Sleep until a waker takes us out of the queue
+	set_blocked(self);
+	thread_t *other = get_running();
+	if (other == NULL) other = idle();
+	context_switch(self, other);
+
+	return 0;
+}
+
+/**
+ * @brief Wakes up the threads waiting on the word at addr, the oldest
+ * first
+ *
+ * @param addr the user address of an aligned word
+ * @param n the number of threads to wake up at most
+ * @return the number of threads woken up, a negative error code if the word
+ * can't be waited on
+ */
+int futex_wake(int *addr, int n) {
+	if (n < 0) return ERR_NEGATIVE_ARG;
+
+	uint32_t key;
+	int err = futex_key(addr, &key);
+	if (err) return err;
+
+	futex_bucket_t *bucket = bucket_of(key);
+	futex_waiter_t *woken = NULL;
+	int count = 0;
+
+	// Take the waiters out of the queue, keeping their order
+	spin_lock_irqsave(&bucket->lock);
+	futex_waiter_t **link = &bucket->first;
+	futex_waiter_t *prev = NULL;
+	futex_waiter_t **tail = &woken;
+	while (*link != NULL && count < n) {
+		futex_waiter_t *waiter = *link;
+		if (waiter->key != key) {
+			prev = waiter;
+			link = &waiter->next;
+			continue;
+		}
+
+		*link = waiter->next;
+		if (bucket->last == waiter) bucket->last = prev;
+		waiter->next = NULL;
+		*tail = waiter;
+		tail = &waiter->next;
+		count++;
+	}
+	spin_unlock_irqrestore(&bucket->lock);
+
+	if (woken == NULL) return 0;
+
+	// The waiters are blocked by now, their frames live until they run
+	dont_switch_me_out();
+	while (woken != NULL) {
+		futex_waiter_t *waiter = woken;
+		woken = waiter->next;
+		set_runnable(waiter->thread);
+	}
+	you_can_switch_me_out_now();
+
+	return count;
+}
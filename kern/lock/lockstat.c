@@ -0,0 +1,164 @@
+/**
+ * @file lockstat.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Statistics on the contention of the kernel mutexes
+ *
+ * A mutex belongs to the class of the name it was initialized under
+ * (@see mutex_init_named); mutex_init names it after the expression it was
+ * given, so that all the mutexes embedded in the same field of an object
+ * share a class. Most mutexes live in objects which come and go, so we keep
+ * statistics per class rather than per mutex, in a static table.
+ *
+ * A class counts the acquisitions of its mutexes, those which found the
+ * mutex held, and how long, in timer ticks, the mutexes were waited for and
+ * held. The mutexes of a class have different spinlocks, so the counters
+ * are updated with atomic additions. The maxima are updated without a lock
+ * and can miss a concurrent larger value.
+ *
+ * Setting LOCK_PROFILE to 0 (@see lock.h) compiles the statistics out of
+ * the mutexes.
+ *
+ * @bugs No known bugs
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <lock.h>
+#include <spinlock.h>
+
+/* The classes, in the order they were created */
+static lockstat_t classes[LOCKSTAT_CLASSES];
+static int num_classes = 0;
+static spinlock_t classes_lock = { 0, 0 };
+
+/**
+ * @brief Atomically adds to a counter
+ */
+static void atomic_add(unsigned int *counter, unsigned int value) {
+	asm volatile ("lock; addl %1, %0"
+		: "+m" (*counter) : "r" (value) : "memory");
+}
+
+/**
+ * @brief Raises a maximum to the given value
+ */
+static void raise_max(unsigned int *max, unsigned int value) {
+	if (value > *(volatile unsigned int *) max) *max = value;
+}
+
+/**
+ * @brief Finds the class of a name, creates it if there is none
+ *
+ * The names are compared as strings, the same literal is found first.
+ *
+ * @param name the name, which must live as long as the kernel
+ * @return the class, NULL if there is no room left for a new one
+ */
+lockstat_t *lockstat_class(const char *name) {
+	if (name == NULL) return NULL;
+
+	spin_lock_irqsave(&classes_lock);
+
+	int i;
+	lockstat_t *stat = NULL;
+	for (i = 0; i < num_classes && stat == NULL; ++i)
+		if (classes[i].name == name) stat = &classes[i];
+	for (i = 0; i < num_classes && stat == NULL; ++i)
+		if (strcmp(classes[i].name, name) == 0) stat = &classes[i];
+
+	if (stat == NULL && num_classes < LOCKSTAT_CLASSES) {
+		stat = &classes[num_classes++];
+		memset(stat, 0, sizeof(lockstat_t));
+		stat->name = name;
+	}
+
+	spin_unlock_irqrestore(&classes_lock);
+	return stat;
+}
+
+/**
+ * @brief Records that a mutex of the class was acquired
+ *
+ * @param stat the class, NULL does nothing
+ * @param contended whether the mutex was held when we asked for it
+ * @param wait the ticks spent waiting for it
+ */
+void lockstat_acquired(lockstat_t *stat, boolean_t contended,
+		unsigned int wait) {
+	if (stat == NULL) return;
+
+	atomic_add(&stat->acquisitions, 1);
+	if (!contended) return;
+
+	atomic_add(&stat->contended, 1);
+	atomic_add(&stat->wait_ticks, wait);
+	raise_max(&stat->wait_max, wait);
+}
+
+/**
+ * @brief Records that a mutex of the class was released
+ *
+ * @param stat the class, NULL does nothing
+ * @param hold the ticks the mutex was held for
+ */
+void lockstat_released(lockstat_t *stat, unsigned int hold) {
+	if (stat == NULL) return;
+
+	atomic_add(&stat->hold_ticks, hold);
+	raise_max(&stat->hold_max, hold);
+}
+
+/**
+ * @brief Copies the statistics of the most contended classes
+ *
+ * The names are copied without the leading '&' mutex_init puts in most of
+ * them.
+ *
+ * @param stats where to copy them, most contended first
+ * @param n the number of entries stats has room for
+ * @param reset whether to clear the statistics of every class
+ * @return the number of entries copied
+ */
+int lockstat_report(kstat_lock_t *stats, int n, boolean_t reset) {
+	spin_lock_irqsave(&classes_lock);
+
+	// Pick the most contended class left, n times
+	boolean_t picked[LOCKSTAT_CLASSES] = { FALSE };
+	if (n > num_classes) n = num_classes;
+
+	int i, j;
+	for (i = 0; i < n; ++i) {
+		lockstat_t *best = NULL;
+		for (j = 0; j < num_classes; ++j) {
+			if (picked[j]) continue;
+			if (best == NULL || classes[j].contended > best->contended)
+				best = &classes[j];
+		}
+		picked[best - classes] = TRUE;
+
+		kstat_lock_t *out = &stats[i];
+		const char *name = best->name;
+		if (name[0] == '&') name++;
+		strncpy(out->name, name, KSTAT_NAME_LEN - 1);
+		out->name[KSTAT_NAME_LEN - 1] = '\0';
+		out->acquisitions = best->acquisitions;
+		out->contended = best->contended;
+		out->wait_ticks = best->wait_ticks;
+		out->wait_max = best->wait_max;
+		out->hold_ticks = best->hold_ticks;
+		out->hold_max = best->hold_max;
+	}
+
+	if (reset) {
+		for (j = 0; j < num_classes; ++j) {
+			const char *name = classes[j].name;
+			memset(&classes[j], 0, sizeof(lockstat_t));
+			classes[j].name = name;
+		}
+	}
+
+	spin_unlock_irqrestore(&classes_lock);
+	return n;
+}
@@ -11,13 +11,29 @@
  *
  * @section Architecture
  * Each mutex can be accessed (read or written) by only one thread at the time. 
- * To ensure that property we use a boolean lock on which we perform the 
- * testandset operation.
+ * To ensure that property we use a spinlock, which keeps interrupts off
+ * while held.
  *
  * To indicate whether a thread currently holds the mutex protecting a specific 
  * critial section we use the "owner" field. That field is also used to 
  * guarantee fair bounded waiting. See the mutex_lock and mutex_unlock function 
  * for further details.
+ *
+ * The threads waiting for a mutex are blocked, the owner hands the mutex
+ * to the first of them when it releases it.
+ *
+ * @section Priority inheritance
+ * A thread about to wait for a mutex passes the level it wakes up at to the
+ * owner (@see sched_boost), and along the chain of mutexes the owner waits
+ * for itself, each thread recording the one it waits for in its blocked_on.
+ * A thread releasing a mutex keeps the most urgent level of the threads
+ * still waiting for the mutexes it holds, or none, and the new owner
+ * inherits from those waiting behind it. The boosts are only changed in a
+ * dont_switch_me_out area, and the spinlocks of the mutexes are taken one
+ * at a time meanwhile.
+ *
+ * Unless LOCK_PROFILE is 0, each mutex also feeds the contention statistics
+ * of its name (@see lockstat.c).
  * 
  * @bugs No bugs known
  */
@@ -27,9 +43,19 @@
 #include <inc/syscall.h>
 #include <assert.h>
 #include <lock.h>
+#include <spinlock.h>
 #include <types.h>
 #include <errors.h>
 #include <simics.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <context.h>
+#include <sched.h>
+
+/* Rounds a thread spins on a mutex whose owner runs on another CPU */
+#define MUTEX_SPIN_ROUNDS 100
+/* Mutexes a boost goes through at most, in case of a deadlock cycle */
+#define MUTEX_BOOST_DEPTH 8
 
 static boolean_t operational = FALSE;
 
@@ -40,19 +66,47 @@ void install_mutex(void) {
 	operational = TRUE;
 }
 
+/**
+ * @brief Gets the lock to interact with a mutex
+ *
+ * This is a spinlock which also keeps interrupts off: its holder only keeps
+ * it for a few instructions and can never be switched out meanwhile, so
+ * that the threads spinning on other CPUs are never kept waiting for long.
+ *
+ * @param mp the mutex
+ * @param me the calling thread
+ */
+static void mutex_enter(mutex_t *mp, thread_t *me) {
+	spin_lock_irqsave(&mp->guard);
+	mp->list_owner = me;
+}
+
+/**
+ * @brief Gives back the lock to interact with a mutex
+ */
+static void mutex_leave(mutex_t *mp) {
+	mp->list_owner = NULL;
+	spin_unlock_irqrestore(&mp->guard);
+}
+
 /**
  * @brief Initializes a mutex
  *
  * @param mp a pointer to a mutex
- * @return 0 on success, negative error code otherwise
+ * @param name the name of its statistics, which must live as long as the
+ * kernel (mutex_init gives the expression of the mutex)
  */
-void mutex_init(mutex_t *mp) {
+void mutex_init_named(mutex_t *mp, const char *name) {
 	mp->first_waiting = NULL;
 	mp->last_waiting = NULL;
 	mp->owner = NULL;
 	mp->list_owner = NULL;
-	mp->mutex_lock = FALSE;
+	spin_init(&mp->guard);
 	mp->previous_lock = NULL;
+#if LOCK_PROFILE
+	mp->stat = lockstat_class(name);
+	mp->locked_at = 0;
+#endif
 }
 
 /**
@@ -63,94 +117,203 @@ void mutex_init(mutex_t *mp) {
 void mutex_destroy(mutex_t *mp) {
 
 	// First get the lock to interact with the mutex
-	boolean_t *mlock = &(mp->mutex_lock);
-	thread_t *me = get_running();
+	thread_t *me = get_self();
 
-	while (testandset(mlock)) _yield(mp->list_owner->tid);
-	mp->list_owner = me;
+	mutex_enter(mp, me);
 	mp->previous_lock = NULL;
 
 	// make sure nobody owns the lock
 	assert(mp->owner == NULL);
+	mutex_leave(mp);
+}
+
+/**
+ * @brief Spins a little while the owner of the mutex runs on another CPU
+ *
+ * The owner is likely to release the mutex soon, sooner than it takes to
+ * block and be woken up. We watch the mutex without its spinlock, and give
+ * up as soon as the owner stops running or after MUTEX_SPIN_ROUNDS.
+ *
+ * @param mp the mutex
+ * @return TRUE if the mutex was free when we last looked
+ */
+static boolean_t mutex_spin(mutex_t *mp) {
+	if (num_cpus() <= 1) return FALSE;
+
+	int i;
+	for (i = 0; i < MUTEX_SPIN_ROUNDS; ++i) {
+		thread_t *owner = *(thread_t * volatile *) &mp->owner;
+		if (owner == NULL) return TRUE;
+
+		// An owner which doesn't run won't release the mutex soon
+		if (owner->cpu == cpu_id()) return FALSE;
+		cpu_t *cpu = get_cpu(owner->cpu);
+		if (cpu == NULL || cpu->current != owner) return FALSE;
+
+		asm volatile ("pause");
+	}
+	return FALSE;
+}
+
+/**
+ * @brief Passes the level of a thread now waiting for a mutex to its owner,
+ * and on to the owners of the mutexes it waits for
+ *
+ * We must be in a dont_switch_me_out area, and hold no mutex spinlock.
+ *
+ * @param mp the mutex
+ * @param waiter the thread waiting for it
+ * @param level the level the waiter wakes up at
+ */
+static void boost_owners(mutex_t *mp, thread_t *waiter, int level) {
+	thread_t *me = get_self();
+
+	int depth;
+	for (depth = 0; mp != NULL && depth < MUTEX_BOOST_DEPTH; ++depth) {
+		mutex_enter(mp, me);
+		thread_t *owner = mp->owner;
+		mutex_t *next = NULL;
+
+		// It may have been handed the mutex already
+		if (owner != NULL && owner != waiter && level < owner->boost) {
+			sched_boost(owner, level);
+			next = owner->blocked_on;
+		}
+		mutex_leave(mp);
+
+		mp = next;
+	}
+}
+
+/**
+ * @brief Returns the most urgent level of the threads waiting for a mutex,
+ * SCHED_LEVELS if none does. Its spinlock must be held.
+ */
+static int waiters_level(mutex_t *mp) {
+	int level = SCHED_LEVELS;
+	thread_t *thr;
+	for (thr = mp->first_waiting; thr != NULL; thr = thr->wait_next) {
+		int base = sched_base(thr);
+		if (base < level) level = base;
+	}
+	return level;
+}
+
+/**
+ * @brief Returns the level a thread inherits from the mutexes it holds
+ *
+ * We must be in a dont_switch_me_out area, and hold no mutex spinlock.
+ *
+ * @param thr the thread, which doesn't lock or unlock meanwhile
+ * @return the level, SCHED_LEVELS if nobody waits for them
+ */
+static int held_level(thread_t *thr) {
+	thread_t *me = get_self();
+	int level = SCHED_LEVELS;
+
+	mutex_t *mp;
+	for (mp = thr->acquired_lock; mp != NULL; mp = mp->previous_lock) {
+		mutex_enter(mp, me);
+		int waiting = waiters_level(mp);
+		mutex_leave(mp);
+		if (waiting < level) level = waiting;
+	}
+	return level;
 }
 
 /**
  * @brief Aquire the mutex
  *
  * Only one thread is allowed to interact (that is read or alter) any mutex 
- * at a given time. To make sure that property holds we use a lock which is just 
- * a boolean value and use the "testandset" operation to aquire it.
+ * at a given time. To make sure that property holds we use a spinlock 
+ * (@see mutex_enter).
  *
  * To check whether a thread is inside the critical section protected by that 
- * mutex we use the "owner" field. If it is set to anything other than -1, a 
- * thread has acquired the mutex.
+ * mutex we use the "owner" field. If it is set to anything but NULL, a thread
+ * has acquired the mutex.
  *
  * To ensure bounded waiting in a fair manner each mutex has a waiting list of 
- * kernel ID's. When the thread which currently holds the mutex releases it, it 
+ * threads. When the thread which currently holds the mutex releases it, it 
  * removes the head of the waiting list and sets the owner field of the mutex to 
- * that kernel ID. This ensures that the next thread which will enter the 
+ * that thread. This ensures that the next thread which will enter the 
  * critical section is the next on the waiting list.
  *
+ * A thread which finds the mutex taken spins a little if the owner runs on
+ * another CPU (@see mutex_spin), and then blocks until the owner hands the
+ * mutex over. It gets in the waiting list and blocks in a dont_switch_me_out
+ * area, taken before the spinlock of the mutex: the owner can only wake it
+ * up, which takes the scheduler lock too, once it is blocked. The idle
+ * threads, which lock mutexes in interrupt handlers, never block. The owner
+ * runs at our level at least while we wait (@see boost_owners).
+ *
  * @param mp the mutex to aquire
  */
 void mutex_lock(mutex_t *mp) {
 
 	if (!operational) return;
-	// Get the lock
-	boolean_t *mlock = &(mp->mutex_lock);
 
 	thread_t *me = get_self();
 
-	/**
-	 * We get the lock to interact with the mutex. As explained before, we 
-	 * cannot yield to the thread currently interacting with the mutex as 
-	 * this requires a read which we are not allowed.
-	 */
-	while (testandset(mlock)) _yield(mp->list_owner->tid);
-	mp->list_owner = me;
-
-	// At this point we can interact with the mutex 
-	if (mp->owner == NULL) {
-
-		// If no one owns the mutex now go right in
-		mp->owner = me;
-
-	} else {
-
-		boolean_t waiting = FALSE;
-
-		// Wait until someone makes us the owner
-		while (mp->owner != me) {
-
-			// Add ourselves to the waitingList
-			// unless we already did that
-			if (!waiting) {
-				waitlist_addLast(mp, me);
-				waiting = TRUE;
-			}
-
-			// Then release the "mlock"
-			*mlock = FALSE;
-			mp->list_owner = NULL;
-
-			// Yield to the owner
-			_yield(mp->owner->tid);
-
-			// When we run again make sure we can still interact
-			while (testandset(mlock)) _yield(mp->list_owner->tid);
-			mp->list_owner = me;
+	// We get the lock to interact with the mutex
+	mutex_enter(mp, me);
+
+#if LOCK_PROFILE
+	boolean_t contended = (mp->owner != NULL && mp->owner != me);
+	unsigned int asked_at = contended ? get_time() : 0;
+#endif
+
+	// If no one owns the mutex now go right in
+	while (mp->owner != NULL && mp->owner != me) {
+		mutex_leave(mp);
+		// Idle must never block, it waits for the owner to run instead
+		if (mutex_spin(mp) || is_idle(me)) {
+			asm volatile ("pause");
+			mutex_enter(mp, me);
+			continue;
 		}
 
+		// The area we might be in already ends with our sleep
+		boolean_t in_area = this_cpu()->no_switch;
+		dont_switch_me_out();
+		mutex_enter(mp, me);
+
+		if (mp->owner != NULL) {
+			waitlist_addLast(mp, me);
+			me->blocked_on = mp;
+			mutex_leave(mp);
+			boost_owners(mp, me, sched_base(me));
+
+			// Sleep until the owner makes us the new owner
+			set_blocked(me);
+			thread_t *other = get_running();
+			if (other == NULL) other = idle();
+			context_switch(me, other);
+
+			if (in_area) dont_switch_me_out();
+			mutex_enter(mp, me);
+		} else if (!in_area) {
+			mutex_leave(mp);
+			you_can_switch_me_out_now();
+			mutex_enter(mp, me);
+		}
 	}
 
+	// Whoever released the mutex may have made us the owner already
+	if (mp->owner == NULL) mp->owner = me;
+
 	// Add this to our list of mutexes we hold
 	if (mp == me->acquired_lock) panic("Relock!");
 	mp->previous_lock = me->acquired_lock;
 	me->acquired_lock = mp;
 
+#if LOCK_PROFILE
+	mp->locked_at = get_time();
+	lockstat_acquired(mp->stat, contended,
+		contended ? mp->locked_at - asked_at : 0);
+#endif
+
 	// release the mutex interaction lock but keep the actual mutex
-	*mlock = FALSE;
-	mp->list_owner = NULL;
+	mutex_leave(mp);
 }
 
 
@@ -162,20 +325,20 @@ void mutex_lock(mutex_t *mp) {
  * not and in the ladder case make the head of the list the new owner of the 
  * mutex. If the list is empty we simply release the mutex.
  *
+ * The new owner is made runnable, but we keep the CPU. It inherits from
+ * the threads still waiting, and we lose what we inherited from those, as
+ * the mutexes we still hold allow.
+ *
  * @param mp the mutex to release
  */
 void mutex_unlock(mutex_t *mp) {
 
 	if (!operational) return;
 
-	// Get the locks
-	boolean_t *mlock = &(mp->mutex_lock);
-
 	thread_t *me = get_self();
 
 	// First we get the lock to interact with the mutex
-	while (testandset(mlock)) _yield(mp->list_owner->tid);
-	mp->list_owner = me;
+	mutex_enter(mp, me);
 
 	// Now we can interact with the mutex
 
@@ -187,23 +350,68 @@ void mutex_unlock(mutex_t *mp) {
 	// It is illegal for an application to unlock a mutex that is not 
 	// locked.
 	if (mp->owner == NULL) {
-		*mlock = FALSE;
-		mp->list_owner = FALSE;
+		mutex_leave(mp);
 		return;
 	}
 
-	// Now check if there are threads in the waiting list
-	do {
-		mp->owner = waitlist_removeHead(mp);
-	} while (mp->owner != NULL && mp->owner->state != THR_RUNNING);
+#if LOCK_PROFILE
+	lockstat_released(mp->stat, get_time() - mp->locked_at);
+#endif
+
+	// Hand the mutex over to the head of the waiting list, if any
+	thread_t *owner = waitlist_removeHead(mp);
+	mp->owner = owner;
+	if (owner != NULL) owner->blocked_on = NULL;
+	mutex_leave(mp);
+
+	if (owner == NULL && me->boost == SCHED_LEVELS) return;
 
-	// release the mutex and transfer 
-	*mlock = FALSE;
-	mp->list_owner = FALSE;
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
 
-	if (mp->owner != NULL) {
-		_yield(mp->owner->tid);
+	// It blocked before we could take the scheduler lock
+	if (owner != NULL) {
+		mutex_enter(mp, me);
+		int level = (mp->owner == owner) ? waiters_level(mp) : SCHED_LEVELS;
+		mutex_leave(mp);
+
+		int held = held_level(owner);
+		sched_boost(owner, held < level ? held : level);
+		set_runnable(owner);
 	}
+
+	if (me->boost != SCHED_LEVELS) sched_boost(me, held_level(me));
+	if (!in_area) you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Makes a blocked thread wait for a mutex, if it is held
+ *
+ * A thread signaled on a condition variable would only wake up to wait for
+ * the mutex it gave to cond_wait (@see condvar.c). If somebody holds the
+ * mutex, the thread is moved to its waiting list instead, still blocked, and
+ * its owner hands it the mutex.
+ *
+ * We must be in a dont_switch_me_out area.
+ *
+ * @param mp the mutex
+ * @param thr the thread, blocked
+ * @return TRUE if the thread now waits for the mutex, FALSE if the mutex is
+ * free and the thread has to be made runnable
+ */
+boolean_t mutex_requeue(mutex_t *mp, thread_t *thr) {
+	if (!operational) return FALSE;
+
+	mutex_enter(mp, get_self());
+	boolean_t held = (mp->owner != NULL);
+	if (held) {
+		waitlist_addLast(mp, thr);
+		thr->blocked_on = mp;
+	}
+	mutex_leave(mp);
+
+	if (held) boost_owners(mp, thr, sched_base(thr));
+	return held;
 }
 
 /**
@@ -212,13 +420,16 @@ void mutex_unlock(mutex_t *mp) {
 void waitlist_addLast(mutex_t *mp, thread_t *thr) {
 	if (!operational) return;
 
+	// It may still point to whoever followed it in an earlier list
+	thr->wait_next = NULL;
+
 	if (mp->last_waiting == NULL) {
 		// The list is empty
 		mp->first_waiting = thr;
 		mp->last_waiting = thr;
 	} else {
 		// Someone is waiting
-		mp->last_waiting->mutex_nextwait = thr;
+		mp->last_waiting->wait_next = thr;
 		mp->last_waiting = thr;
 	}
 }
@@ -231,7 +442,7 @@ thread_t *waitlist_removeHead(mutex_t *mp) {
 
 	thread_t *next = mp->first_waiting;
 	if (next != NULL) {
-		mp->first_waiting = next->mutex_nextwait;
+		mp->first_waiting = next->wait_next;
 		if (mp->last_waiting == next) {
 			// There was only one thread in the list
 			mp->last_waiting = NULL;
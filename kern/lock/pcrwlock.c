@@ -0,0 +1,113 @@
+/**
+ * @file pcrwlock.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Implements reader/writer locks whose readers are counted per CPU
+ *
+ * Every read of a rwlock_t takes and releases its mutex, whose cache line
+ * then goes back and forth between the CPUs of the readers. For data read
+ * far more often than it is written, a pcrwlock_t counts its readers on as
+ * many cache lines as there are CPUs: a reader only writes to the line of
+ * its own CPU, and reads the writer flag, which stays in every cache until
+ * a writer comes.
+ *
+ * A reader counts itself in, then checks that no writer is in. The writer
+ * raises its flag, then waits for the counts to sum up to 0. Both steps are
+ * locked instructions, which are full barriers, so either the reader sees
+ * the flag and counts itself out, or the writer sees the reader and waits
+ * for it. The readers who saw the flag wait for the writer on its mutex.
+ *
+ * The writers are expected to be rare: they yield until the readers leave.
+ * A reader must not take the lock a second time, a writer may come in
+ * between. Neither side may be an interrupt handler.
+ *
+ * @bugs Writers waiting on the mutex keep the readers out, but the readers
+ * may still starve a writer which waits for them to leave.
+ */
+
+#include <stdlib.h>
+#include <inc/syscall.h>
+#include <lock.h>
+#include <cpu.h>
+#include <pcrwlock.h>
+
+/**
+ * @brief Atomically adds to a counter, a full barrier too
+ */
+static void atomic_add(volatile int *counter, int value) {
+	asm volatile ("lock; addl %1, %0"
+		: "+m" (*counter) : "r" (value) : "memory");
+}
+
+/**
+ * @brief Initializes a lock, nobody in
+ *
+ * @param name the name of the mutex of the writers, for its statistics
+ */
+void pcrwlock_init_named(pcrwlock_t *lock, const char *name) {
+	int i;
+	for (i = 0; i < CPU_MAX; ++i) lock->counts[i].readers = 0;
+	lock->writer = FALSE;
+	mutex_init_named(&lock->mutex, name);
+}
+
+/**
+ * @brief Enters the lock as a reader
+ */
+void pcrw_read_lock(pcrwlock_t *lock) {
+	for (;;) {
+		volatile int *count = &lock->counts[cpu_id()].readers;
+		atomic_add(count, 1);
+		if (!lock->writer) return;
+
+		/**
+		 * Get out of the way and wait for the writer to leave. We take back
+		 * the count we added, the writer could otherwise miss it but see
+		 * it taken back, and miss a reader in.
+		 */
+		atomic_add(count, -1);
+		mutex_lock(&lock->mutex);
+		mutex_unlock(&lock->mutex);
+	}
+}
+
+/**
+ * @brief Leaves the lock as a reader, from whichever CPU we are on now
+ *
+ * The writers only come in once we counted ourselves in, so they see our
+ * count by the time they sum them up, wherever we take it back.
+ */
+void pcrw_read_unlock(pcrwlock_t *lock) {
+	atomic_add(&lock->counts[cpu_id()].readers, -1);
+}
+
+/**
+ * @return the number of readers in the lock
+ */
+static int count_readers(pcrwlock_t *lock) {
+	int i, sum = 0;
+	for (i = 0; i < CPU_MAX; ++i) sum += lock->counts[i].readers;
+	return sum;
+}
+
+/**
+ * @brief Enters the lock as a writer, once the readers left
+ */
+void pcrw_write_lock(pcrwlock_t *lock) {
+	mutex_lock(&lock->mutex);
+
+	lock->writer = TRUE;
+	asm volatile ("lock; orl $0, (%%esp)" : : : "memory");
+
+	// The readers in may run on this CPU, let them leave
+	while (count_readers(lock) != 0) _yield(-1);
+}
+
+/**
+ * @brief Leaves the lock as a writer
+ */
+void pcrw_write_unlock(pcrwlock_t *lock) {
+	lock->writer = FALSE;
+	mutex_unlock(&lock->mutex);
+}
@@ -31,8 +31,8 @@
  * behavior is undefined if any operation is performed on the lock while it is
  * initializing (it doesn't protect against interleaving)
  */
-void rwlock_init(rwlock_t *rwlock) {
-	mutex_init(&rwlock->mutex);
+void rwlock_init_named(rwlock_t *rwlock, const char *name) {
+	mutex_init_named(&rwlock->mutex, name);
 	cond_init(&rwlock->no_threads_in);
 	cond_init(&rwlock->no_writers_in);
 
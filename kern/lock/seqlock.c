@@ -0,0 +1,42 @@
+/**
+ * @file seqlock.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Implements the writer side of the sequence locks
+ *
+ * The readers are inlined, @see seqlock.h.
+ *
+ * @bugs No known bugs
+ */
+
+#include <spinlock.h>
+#include <seqlock.h>
+
+/**
+ * @brief Initializes a sequence lock, no writer in
+ */
+void seqlock_init(seqlock_t *sl) {
+	sl->seq = 0;
+	spin_init(&sl->lock);
+}
+
+/**
+ * @brief Enters as a writer, the readers retry until we leave
+ *
+ * Interrupts are off until seq_write_unlock, the writer must not block.
+ */
+void seq_write_lock(seqlock_t *sl) {
+	spin_lock_irqsave(&sl->lock);
+	sl->seq++;
+	SEQ_BARRIER();
+}
+
+/**
+ * @brief Leaves as a writer
+ */
+void seq_write_unlock(seqlock_t *sl) {
+	SEQ_BARRIER();
+	sl->seq++;
+	spin_unlock_irqrestore(&sl->lock);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file spinlock.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Implements spinlocks
+ *
+ * Unlike mutexes, a spinlock never gives up the CPU: a thread failing to
+ * get it busy-waits until the holder, which runs on another CPU, releases
+ * it. This is what we need for data touched by interrupt handlers, which
+ * cannot block, and for the scheduler itself.
+ *
+ * The irqsave variants also disable interrupts on the calling CPU for as
+ * long as the lock is held, so that a handler taking the same lock can
+ * never interrupt the holder and spin forever. The interrupt flag to
+ * restore is kept in the lock, which only its holder touches.
+ *
+ * @bugs No known bugs
+ */
+
+#include <x86/eflags.h>
+#include <lock.h>
+#include <spinlock.h>
+
+/**
+ * @brief Initializes a spinlock, unlocked
+ */
+void spin_init(spinlock_t *lock) {
+	lock->locked = 0;
+	lock->eflags = 0;
+}
+
+/**
+ * @brief Busy-waits until the lock is ours
+ *
+ * We only retry the atomic exchange once the lock looks free, so that the
+ * waiters spin on their cache line instead of stealing it from the holder.
+ */
+void spin_lock(spinlock_t *lock) {
+	while (testandset((void *) &lock->locked)) {
+		while (lock->locked) asm volatile ("pause");
+	}
+}
+
+/**
+ * @brief Releases a spinlock
+ */
+void spin_unlock(spinlock_t *lock) {
+	asm volatile ("" : : : "memory");
+	lock->locked = 0;
+}
+
+/**
+ * @brief Disables interrupts on the calling CPU
+ * @return the eflags to give back to restore_interrupts
+ */
+uint32_t save_disable_interrupts(void) {
+	uint32_t eflags;
+	asm volatile ("pushfl; popl %0; cli" : "=r" (eflags) : : "memory");
+	return eflags;
+}
+
+/**
+ * @brief Enables interrupts again if they were before save_disable_interrupts
+ */
+void restore_interrupts(uint32_t eflags) {
+	if (eflags & EFL_IF) asm volatile ("sti" : : : "memory");
+}
+
+/**
+ * @brief Disables interrupts, then takes the lock
+ */
+void spin_lock_irqsave(spinlock_t *lock) {
+	uint32_t eflags = save_disable_interrupts();
+	spin_lock(lock);
+	lock->eflags = eflags;
+}
+
+/**
+ * @brief Releases the lock, then restores interrupts
+ */
+void spin_unlock_irqrestore(spinlock_t *lock) {
+	uint32_t eflags = lock->eflags;
+	spin_unlock(lock);
+	restore_interrupts(eflags);
+}
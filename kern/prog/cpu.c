@@ -0,0 +1,140 @@
+/**
+ * @file cpu.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief The per-CPU state
+ *
+ * Each CPU has its own block, holding the thread it runs, its idle thread
+ * and its task state segment.
+ *
+ * Each CPU also loads a private copy of the boot GDT, with two changes:
+ * - The TSS descriptor points to the TSS of the CPU. The hardware marks a
+ *   TSS busy when loading it, so that two CPUs can never share one.
+ * - A data segment at SEGSEL_CPU_IDX starts at the block of the CPU. The
+ *   kernel entry points load it in %gs, so that the same instruction, such
+ *   as the load in cpu_current(), reads the block of whichever CPU runs it.
+ *
+ * @bugs No known bugs
+ */
+
+#include <string.h>
+#include <smp.h>
+#include <x86/seg.h>
+
+#include <cpu.h>
+#include <fpu.h>
+
+/* The per-CPU blocks, indexed by CPU id */
+static cpu_t cpus[CPU_MAX];
+/* Number of CPUs we drive, 1 until the application processors boot */
+static int count = 1;
+
+/* Access byte of a present, writable data segment of privilege level 0 */
+#define SEG_KERNEL_DATA 0x92
+/* Flags of a segment with 32-bit operands and byte granularity */
+#define SEG_FLAGS_32 0x4
+
+/* The operand of sgdt and lgdt */
+typedef struct {
+	uint16_t	limit;
+	uint32_t	base;
+} __attribute__((packed)) gdtr_t;
+
+/**
+ * @brief Creates the descriptor of a segment of at most 1MB
+ */
+static uint64_t seg_desc_create(void *start, size_t size, uint8_t access) {
+	uint64_t base = (uint32_t) start;
+	uint64_t limit = size - 1;
+	uint64_t seg = 0LL;
+
+	seg |= limit & 0xFFFF;
+	seg |= (base & 0xFFFFFF) << 16;
+	seg |= (uint64_t) access << 40;
+	seg |= ((limit >> 16) & 0xF) << 48;
+	seg |= (uint64_t) SEG_FLAGS_32 << 52;
+	seg |= ((base >> 24) & 0xFF) << 56;
+
+	return seg;
+}
+
+/**
+ * @brief Sets up the block of the calling CPU and loads its GDT, its TSS
+ * and its %gs
+ *
+ * Called once on each CPU, before anything on it looks at its block.
+ *
+ * @param id the id of the calling CPU
+ */
+void cpu_init(int id) {
+	cpu_t *cpu = &cpus[id];
+	cpu->self = cpu;
+	cpu->id = id;
+
+	// The kernel stack is the only thing the hardware reads in the TSS
+	memset(&cpu->tss, 0, sizeof(tss_t));
+	cpu->tss.ss0 = SEGSEL_KERNEL_DS;
+	cpu->tss.iomap = sizeof(tss_t);
+
+	// Copy the segments we booted with, they are the same for everybody
+	gdtr_t gdtr;
+	asm volatile ("sgdt %0" : "=m" (gdtr));
+
+	size_t size = gdtr.limit + 1;
+	if (size > sizeof(cpu->gdt)) size = sizeof(cpu->gdt);
+	memset(cpu->gdt, 0, sizeof(cpu->gdt));
+	memcpy(cpu->gdt, (void *) gdtr.base, size);
+	cpu->gdt[SEGSEL_TSS >> 3] = tss_desc_create(&cpu->tss, sizeof(tss_t));
+	cpu->gdt[SEGSEL_CPU_IDX] = seg_desc_create(cpu, sizeof(cpu_t),
+			SEG_KERNEL_DATA);
+
+	gdtr.limit = sizeof(cpu->gdt) - 1;
+	gdtr.base = (uint32_t) cpu->gdt;
+	asm volatile ("lgdt %0" : : "m" (gdtr));
+	asm volatile ("ltr %w0" : : "r" (SEGSEL_TSS));
+	asm volatile ("movw %w0, %%gs" : : "r" (SEGSEL_CPU));
+
+	fpu_cpu_init();
+}
+
+/**
+ * @brief Records that the application processors are booting
+ *
+ * @param n the number of CPUs, the bootstrap processor included
+ */
+void cpu_enable_smp(int n) {
+	count = (n > CPU_MAX) ? CPU_MAX : n;
+}
+
+/**
+ * @brief Marks the calling CPU as ready to run threads
+ */
+void cpu_set_online(void) {
+	this_cpu()->online = TRUE;
+}
+
+/**
+ * @brief Sets the kernel stack used on a switch from user mode
+ *
+ * This is the per-CPU version of set_esp0, the caller must not be switched
+ * out.
+ */
+void cpu_set_esp0(uint32_t esp0) {
+	this_cpu()->tss.esp0 = esp0;
+}
+
+/**
+ * @return the number of CPUs we drive
+ */
+int num_cpus(void) {
+	return count;
+}
+
+/**
+ * @return the block of the given CPU, NULL if there is no such CPU
+ */
+cpu_t *get_cpu(int id) {
+	if (id < 0 || id >= count) return NULL;
+	return &cpus[id];
+}
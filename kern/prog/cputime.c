@@ -0,0 +1,163 @@
+/**
+ * @file cputime.c
+ * @brief Accounting of the CPU time of the threads and processes
+ *
+ * Each thread counts the cycles of the time stamp counter it runs in user
+ * mode and in kernel mode, along with the counter at which its current
+ * stretch in the mode it is in started. The system calls, the timer
+ * interrupts and the page faults taken from user mode close the stretch in
+ * user mode on the way in and the one in kernel mode on the way out (@see
+ * sysstat.h, syscall.c, timer.c and page.c), and a thread giving up its CPU
+ * closes its stretch in kernel mode, the next one starting its own. The
+ * other interrupts and exceptions are counted in the mode they interrupted.
+ *
+ * A vanishing thread leaves its counts to its process, which sums those of
+ * its live threads with its own. A process collected by wait() leaves its
+ * counts, along with those of the children it collected, to its parent.
+ *
+ * Only a thread changes its own counts, with interrupts disabled so that a
+ * switch from the timer doesn't close the same stretch meanwhile. The
+ * threads of a process share its CPU, the counts of all of them are
+ * consistent in a dont_switch_me_out area.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <string.h>
+
+#include <errors.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <cputime.h>
+
+/**
+ * @brief Closes the stretch of the calling thread in user mode, on the way
+ * into the kernel
+ */
+void cputime_enter(void) {
+	uint32_t eflags = save_disable_interrupts();
+	thread_t *self = get_self();
+	uint64_t now = rdtsc();
+	self->user_cycles += now - self->cycles_since;
+	self->cycles_since = now;
+	restore_interrupts(eflags);
+}
+
+/**
+ * @brief Closes the stretch of the calling thread in kernel mode, on the way
+ * back to user mode
+ *
+ * @param ret the return value of the system call, if any
+ * @return ret, so that it can wrap the call
+ */
+int cputime_leave(int ret) {
+	uint32_t eflags = save_disable_interrupts();
+	thread_t *self = get_self();
+	uint64_t now = rdtsc();
+	self->kernel_cycles += now - self->cycles_since;
+	self->cycles_since = now;
+	restore_interrupts(eflags);
+	return ret;
+}
+
+/**
+ * @brief Closes the stretch of a thread giving up its CPU, always in kernel
+ * mode, and starts that of the next
+ *
+ * @param prev the thread which ran, NULL if none did
+ * @param next the thread about to run
+ */
+void cputime_switch(thread_t *prev, thread_t *next) {
+	uint64_t now = rdtsc();
+	if (prev != NULL) prev->kernel_cycles += now - prev->cycles_since;
+	next->cycles_since = now;
+}
+
+/**
+ * @brief Leaves the counts of the calling thread, which is vanishing, to its
+ * process. We must be in a dont_switch_me_out area.
+ */
+void cputime_vanish(thread_t *thread) {
+	process_t *process = thread->process;
+	cputime_leave(0);
+
+	process->user_cycles += thread->user_cycles;
+	process->kernel_cycles += thread->kernel_cycles;
+	thread->user_cycles = 0;
+	thread->kernel_cycles = 0;
+}
+
+/**
+ * @brief Leaves the counts of a process being buried to its parent, if it
+ * still has one. We must be in a dont_switch_me_out area.
+ */
+void cputime_bury(process_t *process) {
+	process_t *parent = process->parent;
+	if (parent == NULL) return;
+
+	parent->child_user_cycles += process->user_cycles
+		+ process->child_user_cycles;
+	parent->child_kernel_cycles += process->kernel_cycles
+		+ process->child_kernel_cycles;
+}
+
+/**
+ * @brief Converts cycles of the time stamp counter to nanoseconds, 0 if its
+ * frequency is unknown
+ */
+static uint64_t cycles_to_ns(uint64_t cycles) {
+	uint32_t khz = clock_tsc_khz();
+	if (khz == 0) return 0;
+
+	uint32_t rem;
+	uint64_t ms = div64_32(cycles, khz, &rem);
+	return ms * 1000000 + div64_32((uint64_t) rem * 1000000, khz, &rem);
+}
+
+/**
+ * @brief Gets the CPU time of the calling thread, its process or the
+ * children its process collected. We must be in a dont_switch_me_out area.
+ *
+ * @param who RUSAGE_THREAD, RUSAGE_SELF or RUSAGE_CHILDREN
+ * @param usage where to copy the times
+ * @return 0 on success, ERR_INVALID_ARG if who is none of them
+ */
+int cputime_usage(int who, rusage_t *usage) {
+	thread_t *self = get_self();
+	process_t *process = self->process;
+	thread_t *thread;
+	memset(usage, 0, sizeof(rusage_t));
+
+	switch (who) {
+	case RUSAGE_SELF:
+		usage->user_cycles = process->user_cycles;
+		usage->kernel_cycles = process->kernel_cycles;
+
+		for (thread = process->youngest_thread; thread != NULL;
+				thread = thread->older_sibling) {
+			if (thread == self) continue;
+			usage->user_cycles += thread->user_cycles;
+			usage->kernel_cycles += thread->kernel_cycles;
+		}
+		// Fall through to our own counts
+
+	case RUSAGE_THREAD:
+		cputime_leave(0);
+		usage->user_cycles += self->user_cycles;
+		usage->kernel_cycles += self->kernel_cycles;
+		break;
+
+	case RUSAGE_CHILDREN:
+		usage->user_cycles = process->child_user_cycles;
+		usage->kernel_cycles = process->child_kernel_cycles;
+		break;
+
+	default:
+		return ERR_INVALID_ARG;
+	}
+
+	usage->user_ns = cycles_to_ns(usage->user_cycles);
+	usage->kernel_ns = cycles_to_ns(usage->kernel_cycles);
+	return 0;
+}
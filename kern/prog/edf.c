@@ -0,0 +1,326 @@
+/**
+ * @file edf.c
+ * @brief Earliest-deadline-first scheduling class, with constant bandwidth
+ * servers
+ *
+ * A thread joins the class with the set_deadline system call, declaring the
+ * budget of ticks it needs every period, within deadline ticks of the start
+ * of the period. The runnable threads of the class go ahead of all the
+ * others of their CPU (@see sched.c), the one with the earliest deadline
+ * first, and run until they block, their budget runs out or a thread with an
+ * earlier deadline is runnable.
+ *
+ * Each thread is its own constant bandwidth server. The ticks it runs come
+ * out of its budget, and a thread out of budget is throttled: it is left
+ * out of the run queues until its next period, when a timeout gives it its
+ * budget back along with a new deadline. A thread waking up keeps its
+ * deadline only if what is left of its budget fits before it at the rate it
+ * was admitted at, otherwise it starts a new period right away: a thread
+ * which slept through part of its period can't claim the time it left
+ * unused at the expense of the others.
+ *
+ * Admission control keeps the densities, budget over deadline, of the
+ * threads of a CPU under EDF_MAX_BANDWIDTH thousandths in all. Below that,
+ * their deadlines are all met and the other threads still get the rest of
+ * the CPU. The bandwidth being reserved on a CPU, the process of a thread
+ * in the class is pinned there, its other threads with it.
+ *
+ * Everything here is protected by the scheduler lock, the callers must be
+ * in a dont_switch_me_out area. The times are in timer ticks. A thread of
+ * another CPU which gets its budget back, from the timer of the bootstrap
+ * processor, takes its CPU on the next tick there.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <string.h>
+
+#include <errors.h>
+#include <thrlist.h>
+#include <cpu.h>
+#include <drivers.h>
+#include <timeout.h>
+#include <edf.h>
+
+PH_NEW_HEAD(edf_heap_t, thread_t);
+
+/* Deadlines are ticks, which wrap around */
+#define EDF_BEFORE(a, b) ((int) ((a)->edf_deadline - (b)->edf_deadline) < 0)
+
+/* The class on a CPU */
+typedef struct {
+	edf_heap_t		ready;		// Runnable, the earliest deadline first
+	unsigned int	queued;		// Threads in ready
+	thrlist_t		throttled;	// Runnable, waiting for their next period
+	unsigned int	bandwidth;	// Admitted, in thousandths of the CPU
+	unsigned int	members;	// Threads admitted
+
+	/* Counters, @see kstat.h */
+	unsigned int	admitted;
+	unsigned int	rejected;
+	unsigned int	throttles;
+	unsigned int	misses;
+} edf_queue_t;
+
+/* The queues, indexed by CPU */
+static edf_queue_t queues[CPU_MAX];
+
+/**
+ * @brief Initializes the queues
+ */
+void edf_init(void) {
+	memset(queues, 0, sizeof(queues));
+
+	int cpu;
+	for (cpu = 0; cpu < CPU_MAX; ++cpu) {
+		PH_INIT_HEAD(&queues[cpu].ready);
+		thrlist_init(&queues[cpu].throttled);
+	}
+}
+
+/**
+ * @brief Returns the thousandths of a CPU a budget and deadline take,
+ * rounded up
+ */
+static unsigned int density(unsigned int budget, unsigned int deadline) {
+	return (budget * 1000 + deadline - 1) / deadline;
+}
+
+/**
+ * @brief Starts a period of a thread, with a full budget
+ */
+static void start_period(thread_t *thread, unsigned int now) {
+	thread->edf_release = now;
+	thread->edf_left = thread->edf_budget;
+	thread->edf_deadline = now + thread->edf_relative;
+	thread->edf_missed = FALSE;
+}
+
+/**
+ * @brief Puts a thread in the ready heap of its CPU
+ */
+static void make_ready(thread_t *thread) {
+	edf_queue_t *q = &queues[thread->cpu];
+	PH_INSERT(&q->ready, thread, edf_link, EDF_BEFORE);
+	thread->edf_queued = TRUE;
+	q->queued++;
+}
+
+/**
+ * @brief Gives a throttled thread its budget back, at its next period
+ *
+ * Called by the timer, the thread being runnable or not.
+ */
+static void replenish(void *arg) {
+	thread_t *thread = arg;
+	unsigned int now = get_time();
+	unsigned int next = thread->edf_release + thread->edf_period;
+	start_period(thread, (int) (now - next) < 0 ? next : now);
+
+	edf_queue_t *q = &queues[thread->cpu];
+	if (thread->list == &q->throttled) {
+		thrlist_remove(thread);
+		make_ready(thread);
+	}
+}
+
+/**
+ * @brief Sets up the class of a new thread, which is not in it
+ */
+void edf_init_thread(thread_t *thread) {
+	thread->edf_budget = 0;
+	thread->edf_relative = 0;
+	thread->edf_period = 0;
+	thread->edf_left = 0;
+	thread->edf_queued = FALSE;
+	init_timeout(&thread->edf_timer, replenish, thread);
+	PH_INIT_ELEM(thread, edf_link);
+}
+
+/**
+ * @brief Makes a thread join the class, change its parameters or leave it
+ *
+ * The thread must not be queued. Joining pins its process on its CPU, and
+ * leaving unpins it.
+ *
+ * @param budget the ticks it runs per period, 0 to leave the class
+ * @param deadline the ticks after the start of a period its budget is due
+ * by, from budget up to period
+ * @param period the ticks between the starts of two periods, at most
+ * EDF_MAX_PERIOD
+ * @return 0 on success, ERR_INVALID_ARG if the parameters are inconsistent,
+ * ERR_NO_BANDWIDTH if its CPU can't take them
+ */
+int edf_set(thread_t *thread, unsigned int budget, unsigned int deadline,
+		unsigned int period) {
+	if (budget != 0 && (budget > deadline || deadline > period
+			|| period > EDF_MAX_PERIOD))
+		return ERR_INVALID_ARG;
+
+	process_t *process = thread->process;
+	edf_queue_t *q = &queues[process->cpu];
+
+	unsigned int old = edf_member(thread)
+		? density(thread->edf_budget, thread->edf_relative) : 0;
+	unsigned int new = (budget != 0) ? density(budget, deadline) : 0;
+	if (q->bandwidth - old + new > EDF_MAX_BANDWIDTH) {
+		q->rejected++;
+		return ERR_NO_BANDWIDTH;
+	}
+
+	cancel_timeout(&thread->edf_timer);
+	q->bandwidth = q->bandwidth - old + new;
+
+	if (old == 0 && new != 0) {
+		process->pinned++;
+		q->members++;
+		q->admitted++;
+	} else if (old != 0 && new == 0) {
+		process->pinned--;
+		q->members--;
+	}
+
+	thread->edf_budget = budget;
+	thread->edf_relative = deadline;
+	thread->edf_period = period;
+	if (budget != 0) start_period(thread, get_time());
+	return 0;
+}
+
+/**
+ * @brief Adds a runnable thread of the class to the queues of its CPU
+ *
+ * A throttled thread waits for its next period.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int edf_enqueue(thread_t *thread) {
+	if (timeout_pending(&thread->edf_timer))
+		return thrlist_add_tail(thread, &queues[thread->cpu].throttled);
+
+	make_ready(thread);
+	return 0;
+}
+
+/**
+ * @brief Takes a thread out of the ready heap of its CPU, if it is there
+ */
+void edf_dequeue(thread_t *thread) {
+	if (!thread->edf_queued) return;
+
+	edf_queue_t *q = &queues[thread->cpu];
+	PH_REMOVE(&q->ready, thread, edf_link, EDF_BEFORE);
+	thread->edf_queued = FALSE;
+	q->queued--;
+}
+
+/**
+ * @brief Returns the ready thread of the calling CPU with the earliest
+ * deadline, NULL if there is none
+ */
+thread_t *edf_pick(void) {
+	return PH_GET_MIN(&queues[cpu_id()].ready);
+}
+
+/**
+ * @brief Returns the number of ready threads of the class on a CPU
+ */
+unsigned int edf_count(int cpu) {
+	return queues[cpu].queued;
+}
+
+/**
+ * @brief Checks the deadline of a thread of the class which gave up the CPU
+ * and is runnable again
+ *
+ * The thread must not be queued yet.
+ */
+void edf_wakeup(thread_t *thread) {
+	if (timeout_pending(&thread->edf_timer)) return;
+
+	unsigned int now = get_time();
+	int before = (int) (thread->edf_deadline - now);
+
+	// left / before must not exceed budget / deadline
+	if (before <= 0 || (uint64_t) thread->edf_left * thread->edf_relative
+			> (uint64_t) before * thread->edf_budget)
+		start_period(thread, now);
+}
+
+/**
+ * @brief Tells whether a thread just made runnable takes the CPU from the
+ * one which woke it up, one of them at least being in the class
+ *
+ * It does if it is ready and either the other isn't in the class or its
+ * deadline is later.
+ */
+boolean_t edf_preempts(thread_t *self, thread_t *woken) {
+	if (!woken->edf_queued) return FALSE;
+	return !edf_member(self) || EDF_BEFORE(woken, self);
+}
+
+/**
+ * @brief Accounts a timer tick to the running thread, which is in the class
+ *
+ * A thread running out of budget is throttled until its next period, unless
+ * that period started already.
+ *
+ * @return TRUE if the thread must give up the CPU, either since it is out
+ * of budget or since a thread with an earlier deadline is ready
+ */
+boolean_t edf_tick(thread_t *self) {
+	edf_queue_t *q = &queues[self->cpu];
+	unsigned int now = get_time();
+
+	if (!self->edf_missed && (int) (now - self->edf_deadline) > 0) {
+		self->edf_missed = TRUE;
+		q->misses++;
+	}
+
+	if (self->edf_left > 0) self->edf_left--;
+	if (self->edf_left == 0) {
+		unsigned int next = self->edf_release + self->edf_period;
+		if ((int) (next - now) > 0) {
+			add_timeout(&self->edf_timer, next);
+			q->throttles++;
+		} else start_period(self, now);
+		return TRUE;
+	}
+
+	thread_t *first = PH_GET_MIN(&q->ready);
+	return first != NULL && EDF_BEFORE(first, self);
+}
+
+/**
+ * @brief Copies the state and counters of the class on each CPU
+ *
+ * @param stats where to copy them, one entry per CPU
+ * @param n the number of entries available
+ * @param reset whether to clear the counters afterwards
+ * @return the number of entries copied
+ */
+int edf_stats(kstat_edf_t *stats, int n, boolean_t reset) {
+	int id;
+	for (id = 0; id < num_cpus() && id < n; ++id) {
+		edf_queue_t *q = &queues[id];
+		stats[id].cpu = id;
+		stats[id].bandwidth = q->bandwidth;
+		stats[id].members = q->members;
+		stats[id].queued = q->queued;
+		stats[id].throttled = q->throttled.size;
+		stats[id].admitted = q->admitted;
+		stats[id].rejected = q->rejected;
+		stats[id].throttles = q->throttles;
+		stats[id].misses = q->misses;
+
+		if (reset) {
+			q->admitted = 0;
+			q->rejected = 0;
+			q->throttles = 0;
+			q->misses = 0;
+		}
+	}
+
+	return id;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file kthread.c
+ * @brief Kernel threads, and the per-CPU work queues run by some of them
+ *
+ * A kernel thread has a process of its own, whose address space is the
+ * kernel's and never gets a user page, and runs a function of the kernel
+ * until it is done. The reaper, the console drain and the same-page
+ * scanner are such threads.
+ *
+ * Each CPU also has a worker, a kernel thread pinned to it, and a queue of
+ * works for it: queue_work(fn, arg) hands fn(arg) to the worker of the
+ * calling CPU rather than running it in the caller. The idle threads hand
+ * the zeroing of frames in advance to it (@see queue_refill), so that they
+ * stay free to halt or to switch to whoever becomes runnable. The queue is
+ * protected by the scheduler lock, and the worker blocks itself in the area
+ * in which it finds its queue empty, like the reaper (@see reaper.c). The
+ * works of a CPU run in the order they were queued, one after the other.
+ *
+ * queue_work never blocks. It fails when the queue is full, or the CPU has
+ * no worker yet, and the caller then runs the work itself. It must not be
+ * called from an interrupt handler which interrupted a dont_switch_me_out
+ * area, since it takes the scheduler lock.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <thread.h>
+#include <process.h>
+#include <context.h>
+#include <drivers.h>
+#include <errors.h>
+#include <cpu.h>
+#include <kthread.h>
+
+/* A function to call, and its argument */
+typedef struct {
+	void (*fn)(void *);
+	void *arg;
+} work_t;
+
+/* The works of a CPU, from tail to head. Both only grow, and wrap around */
+typedef struct {
+	work_t works[WORK_QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+
+	thread_t *worker;			// NULL until it runs
+	boolean_t asleep;
+	boolean_t claimed;			// Is the worker being created ?
+} workqueue_t;
+
+static workqueue_t queues[CPU_MAX];
+
+/**
+ * @brief Creates a kernel thread and makes it runnable
+ *
+ * @param entry the function it runs, which must never return
+ * @param arg its argument
+ * @param cpu the CPU to pin the thread to, or -1 to let the scheduler
+ * place and move it
+ * @return the thread, NULL if it couldn't be created
+ */
+thread_t *kthread_create(void (*entry)(void *), void *arg, int cpu) {
+	process_t *process = create_process();
+	if (process == NULL) return NULL;
+
+	thread_t *thread = create_thread(process);
+	if (thread == NULL) {
+		process->state = EXITED;
+		destroy_process(process);
+		return NULL;
+	}
+
+	entry_stack(thread, entry, arg);
+	if (cpu >= 0) {
+		process->cpu = cpu;
+		process->pinned = 1;
+	}
+
+	dont_switch_me_out();
+	set_runnable(thread);
+	you_can_switch_me_out_now();
+
+	return thread;
+}
+
+/**
+ * @brief The worker of a CPU
+ *
+ * @param arg the queue of the CPU
+ */
+static void worker_main(void *arg) {
+	workqueue_t *q = arg;
+	thread_t *self = get_self();
+
+	for (;;) {
+		dont_switch_me_out();
+		while (q->tail == q->head) {
+			q->asleep = TRUE;
+			set_blocked(self);
+
+			thread_t *other = get_running();
+			if (other == NULL) other = idle();
+			context_switch(self, other);
+			dont_switch_me_out();
+		}
+
+		work_t work = q->works[q->tail % WORK_QUEUE_SIZE];
+		q->tail++;
+		you_can_switch_me_out_now();
+
+		work.fn(work.arg);
+	}
+}
+
+/**
+ * @brief Creates the workers of the CPUs which have none
+ *
+ * It is called once the bootstrap processor runs init, and again once the
+ * other CPUs are known. The works queued before a CPU has its worker are
+ * run by their callers.
+ */
+void workqueue_start(void) {
+	int id;
+	for (id = 0; id < num_cpus() && id < CPU_MAX; id++) {
+		workqueue_t *q = &queues[id];
+
+		// Both callers may get here at once
+		dont_switch_me_out();
+		boolean_t mine = !q->claimed;
+		q->claimed = TRUE;
+		you_can_switch_me_out_now();
+		if (!mine) continue;
+
+		thread_t *worker = kthread_create(worker_main, q, id);
+
+		dont_switch_me_out();
+		q->worker = worker;
+		if (worker == NULL) q->claimed = FALSE;
+		you_can_switch_me_out_now();
+	}
+}
+
+/**
+ * @brief Hands a work to the worker of the calling CPU
+ *
+ * @param fn the function to call
+ * @param arg its argument
+ * @return 0 if it is queued, ERR_WORK_QUEUE_FULL if the caller must run it
+ * itself
+ */
+int queue_work(void (*fn)(void *), void *arg) {
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
+
+	int err = 0;
+	workqueue_t *q = &queues[cpu_id()];
+	if (q->worker == NULL || q->head - q->tail == WORK_QUEUE_SIZE) {
+		err = ERR_WORK_QUEUE_FULL;
+	} else {
+		work_t *work = &q->works[q->head % WORK_QUEUE_SIZE];
+		work->fn = fn;
+		work->arg = arg;
+		q->head++;
+
+		if (q->asleep) {
+			q->asleep = FALSE;
+			set_runnable(q->worker);
+		}
+	}
+
+	if (!in_area) you_can_switch_me_out_now();
+	return err;
+}
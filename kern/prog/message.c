@@ -0,0 +1,213 @@
+/**
+ * @file message.c
+ * @brief Synchronous messages, handing the CPU from thread to thread
+ *
+ * A thread calls another one with a message, and blocks until it replies
+ * (@see ipc.h). The callers of a thread are in its list of callers, from
+ * their call until the reply: first sending, then awaiting the reply once
+ * the thread received their call. The message travels in the control block
+ * of the caller, where the receiver reads the call and writes the reply.
+ *
+ * Like the reaper (@see reaper.c), everything happens in dont_switch_me_out
+ * areas, under the scheduler lock, so a thread blocks in the same area in
+ * which it finds nothing to receive, and a caller finds it blocked there.
+ * The caller then makes it runnable and switches to it directly, instead of
+ * running the next in line, as yield to a thread does (@see _yield). So
+ * does the thread replying with ipc_reply_wait, to the caller, when no
+ * other call waits. A thread of a process running on another CPU is only
+ * made runnable, and runs there.
+ *
+ * The messages are copied from and to user space outside of the areas,
+ * since copying may fault. A waiting thread checks its state again when it
+ * is woken up, since make_runnable may wake it up too.
+ *
+ * A thread vanishing fails the calls made to it which it didn't reply to.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <sched.h>
+#include <errors.h>
+#include <message.h>
+
+/**
+ * @brief Returns the first caller of a thread whose call wasn't received
+ */
+static thread_t *first_sending(thread_t *self) {
+	thread_t *caller;
+	for (caller = self->ipc_callers; caller != NULL; caller = caller->ipc_next)
+		if (caller->ipc_state == IPC_SENDING) return caller;
+	return NULL;
+}
+
+/**
+ * @brief Takes a caller out of the callers of a thread and makes it
+ * runnable with the result of its call
+ */
+static void end_call(thread_t *self, thread_t *caller, int result) {
+	thread_t **link = &self->ipc_callers;
+	while (*link != caller) link = &(*link)->ipc_next;
+	*link = caller->ipc_next;
+
+	caller->ipc_next = NULL;
+	caller->ipc_state = IPC_IDLE;
+	caller->ipc_result = result;
+	if (caller->state == THR_BLOCKED) set_runnable(caller);
+}
+
+/**
+ * @brief Blocks the calling thread, giving the CPU to a thread if it can
+ *
+ * We must be in a dont_switch_me_out area, in which we are again when
+ * woken up.
+ *
+ * @param to the thread to switch to, or NULL for the next in line
+ */
+static void block_to(thread_t *self, thread_t *to) {
+	set_blocked(self);
+
+	thread_t *other = to;
+	if (other == NULL || !is_local(other) || !sched_queued(other))
+		other = get_running();
+	if (other == NULL) other = idle();
+	context_switch(self, other);
+	dont_switch_me_out();
+}
+
+/**
+ * @brief Receives the next call, blocking until there is one
+ *
+ * We must be in a dont_switch_me_out area, which is over on return.
+ *
+ * @param msg where to store the call, in the kernel
+ * @param to the thread to switch to if we block, or NULL
+ * @return the id of the caller
+ */
+static int receive(thread_t *self, ipc_msg_t *msg, thread_t *to) {
+	thread_t *caller;
+	while ((caller = first_sending(self)) == NULL) {
+		self->ipc_state = IPC_RECEIVING;
+		block_to(self, to);
+		to = NULL;
+	}
+	self->ipc_state = IPC_IDLE;
+
+	caller->ipc_state = IPC_AWAITING;
+	*msg = caller->ipc_msg;
+	int tid = caller->tid;
+	you_can_switch_me_out_now();
+	return tid;
+}
+
+/**
+ * @brief Calls a thread and waits for its reply
+ *
+ * @param tid the thread called
+ * @param msg the call, in the kernel, which the reply replaces
+ * @return 0 on success, ERR_INVALID_TID if there is no such thread,
+ * ERR_IPC_GONE if it vanished before replying
+ */
+int ipc_call(int tid, ipc_msg_t *msg) {
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	thread_t *server = (tid < 0) ? NULL : get_thread(tid);
+	if (server == NULL || server == self || server->state == THR_ZOMBIE) {
+		you_can_switch_me_out_now();
+		return ERR_INVALID_TID;
+	}
+
+	// Queue our call last
+	thread_t **link = &server->ipc_callers;
+	while (*link != NULL) link = &(*link)->ipc_next;
+	*link = self;
+	self->ipc_next = NULL;
+	self->ipc_state = IPC_SENDING;
+	self->ipc_msg = *msg;
+
+	// A server waiting for a call gets our CPU
+	thread_t *to = NULL;
+	if (server->ipc_state == IPC_RECEIVING) {
+		server->ipc_state = IPC_IDLE;
+		if (server->state == THR_BLOCKED) set_runnable(server);
+		to = server;
+	}
+
+	// A make_runnable may wake us up before the reply
+	while (self->ipc_state != IPC_IDLE) {
+		block_to(self, to);
+		to = NULL;
+	}
+	*msg = self->ipc_msg;
+	int result = self->ipc_result;
+	you_can_switch_me_out_now();
+
+	return result;
+}
+
+/**
+ * @brief Receives the next call made to the calling thread
+ *
+ * @param msg where to store the call, in the kernel
+ * @return the id of the caller
+ */
+int ipc_receive(ipc_msg_t *msg) {
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	return receive(self, msg, NULL);
+}
+
+/**
+ * @brief Replies to a call received, and receives the next one if asked to
+ *
+ * Without a next call to receive, the caller only gets the CPU if the
+ * scheduler lets it preempt us (@see sched_preempts). Otherwise we block
+ * for the next call, and give our CPU to the caller unless a call already
+ * waits.
+ *
+ * @param tid the caller
+ * @param reply the reply, in the kernel
+ * @param next where to store the next call, NULL to return right away
+ * @return 0, or the id of the next caller, on success, ERR_IPC_NO_CALLER if
+ * tid isn't waiting for a reply from us
+ */
+int ipc_reply(int tid, const ipc_msg_t *reply, ipc_msg_t *next) {
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	thread_t *caller;
+	for (caller = self->ipc_callers; caller != NULL; caller = caller->ipc_next)
+		if (caller->tid == (unsigned int) tid) break;
+	if (caller == NULL || caller->ipc_state != IPC_AWAITING) {
+		you_can_switch_me_out_now();
+		return ERR_IPC_NO_CALLER;
+	}
+
+	caller->ipc_msg = *reply;
+	end_call(self, caller, 0);
+
+	if (next != NULL) return receive(self, next, caller);
+
+	if (sched_preempts(self, caller) && is_local(caller)
+			&& sched_queued(caller)) {
+		set_runnable(self);
+		context_switch(self, caller);
+	} else you_can_switch_me_out_now();
+	return 0;
+}
+
+/**
+ * @brief Fails the calls made to a vanishing thread
+ *
+ * We must be in a dont_switch_me_out area.
+ */
+void ipc_vanish(thread_t *self) {
+	while (self->ipc_callers != NULL)
+		end_call(self, self->ipc_callers, ERR_IPC_GONE);
+}
@@ -17,11 +17,23 @@
 #include <thrlist.h>
 #include <errors.h>
 #include <lock.h>
+#include <shm.h>
+#include <sched.h>
+#include <slab.h>
+#include <vdso.h>
+#include <ksm.h>
+#include <wss.h>
+#include <cputime.h>
 
 /** A mutex to make the next_pid() function atomic */
 static mutex_t pid_lock;
 static unsigned int pid = PROCESS_INITIAL_PID;
 
+/* The slab caches of the control blocks and of their parts */
+static slab_cache_t process_cache;
+static slab_cache_t thrlist_cache;
+static slab_cache_t mutex_cache;
+
 
 /**
  * @brief Create a new process
@@ -35,13 +47,20 @@ static unsigned int pid = PROCESS_INITIAL_PID;
 process_t *create_process(void) {
 
 	// Allocate the process control block
-	process_t *process = calloc(1, sizeof(process_t));
+	process_t *process = slab_zalloc(&process_cache);
 	if (process == NULL) return NULL;	
 
 	// Create the page directory and page tables for the kernel
 	process->cr3 = init_paging();
 	if (process->cr3 == NULL) {
-		free(process);	
+		slab_free(&process_cache, process);
+		return NULL;
+	}
+
+	// Map the kernel data pages
+	if (vdso_create(process)) {
+		destroy_paging(process);
+		slab_free(&process_cache, process);
 		return NULL;
 	}
 
@@ -49,36 +68,76 @@ process_t *create_process(void) {
 	process->pid = next_pid();
 	process->exit_status = -1;
 	process->state = RUNNING;
+
+	// The CPU its threads run on, and the first terminal
+	process->cpu = sched_place();
+	process->terminal = 0;
 	
 	// Memory region tracking
-	process->memregions = smemalign(PAGE_SIZE, PAGE_SIZE);
-	if (process->memregions == NULL) {
-		destroy_paging(process);
-		free(process);
-		return NULL;
-	}
-	memset(process->memregions, 0, PAGE_SIZE);
-	process->next_memregion_idx = 0;
+	init_regions(&process->regions);
+	process->reserved_frames = 0;
+	process->rss_frames = 0;
+	process->peak_frames = 0;
+	process->page_tables = 0;
+	process->quota = NULL;
 
 	// Leave family NULL
 	process->parent = NULL;
 	process->youngest_child = NULL;
+	process->oldest_child = NULL;
 	process->older_sibling = NULL;
 	process->younger_sibling = NULL;
 	process->original_tid = -1;
 	process->youngest_thread = NULL;
 	process->children = 0;
 	process->threads = 0;
+	process->first_exited = NULL;
+	process->last_exited = NULL;
+	process->next_exited = NULL;
+	process->exited = 0;
+	process->user_cycles = 0;
+	process->kernel_cycles = 0;
+	process->child_user_cycles = 0;
+	process->child_kernel_cycles = 0;
+	memset(process->pipe_ends, 0, sizeof(process->pipe_ends));
 
 	// Create the waiting list
-	process->waiting = calloc(1, sizeof(thrlist_t));
+	process->waiting = slab_zalloc(&thrlist_cache);
 	if (process->waiting == NULL) {
-		sfree(process->memregions, PAGE_SIZE);	
+		destroy_regions(&process->regions);
 		destroy_paging(process);
-		free(process);
+		slab_free(&process_cache, process);
 		return NULL;
 	}
 
+	// Create the copy on write lock
+	process->cow_lock = slab_alloc(&mutex_cache);
+	if (process->cow_lock == NULL) {
+		thrlist_destroy(process->waiting);
+		slab_free(&thrlist_cache, process->waiting);
+		destroy_regions(&process->regions);
+		destroy_paging(process);
+		slab_free(&process_cache, process);
+		return NULL;
+	}
+	mutex_init(process->cow_lock);
+
+	// Create the regions lock
+	process->region_lock = slab_alloc(&mutex_cache);
+	if (process->region_lock == NULL) {
+		mutex_destroy(process->cow_lock);
+		slab_free(&mutex_cache, process->cow_lock);
+		thrlist_destroy(process->waiting);
+		slab_free(&thrlist_cache, process->waiting);
+		destroy_regions(&process->regions);
+		destroy_paging(process);
+		slab_free(&process_cache, process);
+		return NULL;
+	}
+	mutex_init(process->region_lock);
+
+	ksm_track(process);
+	wss_track(process);
 	return process;
 
 }
@@ -94,8 +153,11 @@ process_t *create_process(void) {
  */
 process_t *create_god_process() {
 
-	// Initialize the pid_mutex
+	// Initialize the pid_mutex and the caches
 	mutex_init(&pid_lock);
+	slab_cache_init(&process_cache, "process", sizeof(process_t));
+	slab_cache_init(&thrlist_cache, "thrlist", sizeof(thrlist_t));
+	slab_cache_init(&mutex_cache, "mutex", sizeof(mutex_t));
 
 	// Create a normal process (without user stack)
 	process_t *god = create_process();
@@ -103,12 +165,15 @@ process_t *create_god_process() {
 
 	// Setup the page directory so that we can create the user stack
 	set_cr3((uint32_t) god->cr3);
-	set_cr0(get_cr0() | CR0_PG);
+	// The kernel is mapped with global 4MB pages
+	set_cr4(get_cr4() | CR4_PSE | CR4_PGE);
+	// The kernel faults on read-only user pages too @see usercopy.c
+	set_cr0(get_cr0() | CR0_PG | CR0_WP);
 
 	// Create new user stack
 	int err = create_page(PAGE_ADDR(0xfffffffc), MEM_TYPE_STACK, NULL);
 	if (err < 0) {
-		free(god);
+		slab_free(&process_cache, god);
 		return NULL;
 	}
 
@@ -116,6 +181,20 @@ process_t *create_god_process() {
 }
 
 
+/**
+ * @brief Makes process the youngest child of parent
+ */
+static void adopt_process(process_t *parent, process_t *process) {
+	process->parent = parent;
+
+	if (parent->youngest_child != NULL) {
+		parent->youngest_child->younger_sibling = process;
+		process->older_sibling = parent->youngest_child;
+	} else parent->oldest_child = process;
+	parent->youngest_child = process;
+	parent->children += 1;
+}
+
 /**
  * @brief Creates a copy of the given process
  *
@@ -132,6 +211,11 @@ process_t *copy_process(process_t *parent) {
 	// Create a new process
 	process_t *process = create_process();
 	if (process == NULL) return NULL;
+
+	// The child is held to the frame limit of its parent, and uses its
+	// terminal
+	quota_join(process, parent->quota);
+	process->terminal = parent->terminal;
 	
 	// Copy the memory region
 	int err = copy_paging(parent, process);		
@@ -140,39 +224,87 @@ process_t *copy_process(process_t *parent) {
 		return NULL;
 	}
 
-	// Update Family relations
-	process->parent = parent;
-
-	if (parent->youngest_child != NULL) {
-		parent->youngest_child->younger_sibling = process;
-		process->older_sibling = parent->youngest_child;
+	// The child has the same regions, at the same addresses
+	mutex_lock(parent->region_lock);
+	err = copy_regions(&process->regions, &parent->regions);
+	// The child maps the shared memory segments of the parent too
+	if (err == 0) shm_hold_regions(&process->regions);
+	mutex_unlock(parent->region_lock);
+	if (err < 0) {
+		destroy_process(process);
+		return NULL;
 	}
-	parent->youngest_child = process;
-	parent->children += 1;
+
+	// The child runs the same program, and holds the same pipes
+	process->image = parent->image;
+	pipe_fork(parent, process);
+
+	// Update Family relations
+	adopt_process(parent, process);
 
 	// Now we should be ready
 	return process;
 }
 
 /**
- * @brief Returns an exited child
+ * @brief Creates a child of the given process with an empty user space
+ *
+ * This is used by spawn, where the child's image is loaded directly and
+ * there is nothing to copy from the parent.
+ *
+ * @param parent the invoking process
+ * @return the new process, NULL on error
+ */
+process_t *create_child_process(process_t *parent) {
+
+	if (parent == NULL) return NULL;
+
+	process_t *process = create_process();
+	if (process == NULL) return NULL;
+
+	quota_join(process, parent->quota);
+	process->terminal = parent->terminal;
+	adopt_process(parent, process);
+	return process;
+}
+
+/**
+ * @brief Takes the child which exited first out of the exited children
+ *
+ * The caller must be in a dont_switch_me_out area, like the exiting
+ * children which add themselves to the queue (@see vanish_process).
  *
  * @param parent the parent process looking for an exited child
  * @return an exited child or NULL if none exist
  */
 process_t *exited_child(process_t *parent) {
 
-	if (parent == NULL || parent->children == 0) return NULL;
-	
-	// Find a child which EXITED already
-	process_t *child = parent->youngest_child;
-	while (child != NULL && child->state != EXITED) {
-		child = child->older_sibling;
+	if (parent == NULL) return NULL;
+
+	process_t *child = parent->first_exited;
+	if (child != NULL) {
+		parent->first_exited = child->next_exited;
+		if (parent->first_exited == NULL) parent->last_exited = NULL;
+		child->next_exited = NULL;
+		parent->exited--;
 	}
 
 	return child;
 }
 
+/**
+ * @brief Gives back an exited child which could not be collected, it
+ * comes out next.
+ *
+ * The caller must be in a dont_switch_me_out area.
+ */
+void unwait_child(process_t *parent, process_t *child) {
+	child->next_exited = parent->first_exited;
+	parent->first_exited = child;
+	if (parent->last_exited == NULL) parent->last_exited = child;
+	parent->exited++;
+}
+
 /**
  * @brief Returns the next available process id
  * @return a process id
@@ -194,10 +326,16 @@ unsigned int next_pid(void) {
  *
  * If we still have process children, we update their family relations 
  * such that init becomes their parent and can collect their exit status 
- * via wait().
+ * via wait(). Our children list and our queue of exited children are
+ * spliced at the ends of those of init, only the parent links have to be
+ * rewritten one by one.
+ *
+ * The process then joins the exited children of its parent. The caller
+ * must be in a dont_switch_me_out area.
  *
  * @param process the process to vanish
- * @return 0 on sucess, a negative error code otherwise.
+ * @return the number of exited children handed to init, a negative error
+ * 		code otherwise.
  */
 int vanish_process(process_t *process) {
 
@@ -207,6 +345,7 @@ int vanish_process(process_t *process) {
 	if (process->threads > 0) return ERR_ACTIVE_THREADS; 	
 
 	// Make children not destroyed yet available to "init"
+	int orphans = 0;
 	if (process->children > 0) {
 
 		process_t *init_task = init()->process;
@@ -217,41 +356,66 @@ int vanish_process(process_t *process) {
 		init_task->children += process->children;
 
 		// Update the "parent" link of all processes
-		process_t *last = NULL;
 		process_t *current = process->youngest_child;
 		while (current != NULL) {
 			current->parent = init_task;
-			last = current;
 			current = current->older_sibling;
 		}
 
-		// Now update so that the last is the younger sibling of the
+		// Now update so that our oldest is the younger sibling of the
 		// youngest from init
+		process_t *last = process->oldest_child;
 		last->older_sibling = init_task->youngest_child;
 		if (init_task->youngest_child)
 			init_task->youngest_child->younger_sibling = last;
+		else init_task->oldest_child = last;
 
 		init_task->youngest_child = process->youngest_child;
 
+		// Our exited children wait for init after its own
+		orphans = process->exited;
+		if (process->first_exited != NULL) {
+			if (init_task->last_exited != NULL)
+				init_task->last_exited->next_exited = process->first_exited;
+			else init_task->first_exited = process->first_exited;
+			init_task->last_exited = process->last_exited;
+			init_task->exited += process->exited;
+		}
+
+		process->youngest_child = NULL;
+		process->oldest_child = NULL;
+		process->first_exited = NULL;
+		process->last_exited = NULL;
+		process->exited = 0;
 	}
 
 	// Mark this process as having exited, for waiting threads to 
 	// collect.
 	process->state = EXITED;
-	return 0;
+
+	process_t *parent = process->parent;
+	if (parent != NULL) {
+		if (parent->last_exited != NULL)
+			parent->last_exited->next_exited = process;
+		else parent->first_exited = process;
+		parent->last_exited = process;
+		parent->exited++;
+	}
+
+	return orphans;
 }
 
 
 /**
- * @brief Destroys a process and all resources for it
+ * @brief Takes an exited process out of the family of its parent
  *
- * This function is called by anoher process which called wait and is now 
- * cleaning up the remains (like the kernel stacks and control blocks).
+ * This is the part of destroy_process() which wait needs done before it
+ * returns. The rest can be left to the reaper (@see reaper.c).
  *
- * @param process the process to destroy
+ * @param process the process to bury
  * @return 0 on sucess, a negative error code otherwise
  */
-int destroy_process(process_t *process) {
+int bury_process(process_t *process) {
 
 	if (process == NULL) return ERR_ARG_NULL;
 
@@ -259,28 +423,67 @@ int destroy_process(process_t *process) {
 	if (process->state != EXITED) return ERR_PROCESS_NOT_EXITED;
 	process->state = BURIED;
 
-	// Destroy all the threads
-	while (process->youngest_thread != NULL) {
-		destroy_thread(process->youngest_thread);
-	}
-
 	// Update family of parent process
 	process_t *older = process->older_sibling;
 	process_t *younger = process->younger_sibling;
 	if (older) older->younger_sibling = younger;
+	else if (process->parent)
+		process->parent->oldest_child = younger;
 	if (younger) younger->older_sibling = older;
 	else if (process->parent)
 		process->parent->youngest_child = older;
 
 	if (process->parent) process->parent->children -= 1;
+
+	// Our parent inherits our CPU time, @see cputime.c
+	cputime_bury(process);
+	process->parent = NULL;
+	process->older_sibling = NULL;
+	process->younger_sibling = NULL;
+	return 0;
+}
+
+/**
+ * @brief Destroys a process and all resources for it
+ *
+ * This function is called by anoher process which called wait and is now 
+ * cleaning up the remains (like the kernel stacks and control blocks), or
+ * by the reaper on its behalf. The process is buried first if it wasn't.
+ *
+ * @param process the process to destroy
+ * @return 0 on sucess, a negative error code otherwise
+ */
+int destroy_process(process_t *process) {
+
+	if (process == NULL) return ERR_ARG_NULL;
+
+	if (process->state == EXITED) bury_process(process);
+	if (process->state != BURIED) return ERR_PROCESS_NOT_EXITED;
+
+	// Destroy all the threads
+	while (process->youngest_thread != NULL) {
+		destroy_thread(process->youngest_thread);
+	}
 	
-	// Destroy all the pages
+	// Give the pipes back, they may hold frames
+	pipe_exit(process);
+
+	// Destroy all the pages, once the scanners are done with them
+	ksm_untrack(process);
+	wss_untrack(process);
 	int derr = destroy_paging(process);
 	if (derr < 0) return derr;
+	quota_leave(process);
 
-	sfree(process->memregions, PAGE_SIZE);
+	shm_drop_regions(&process->regions);
+	destroy_regions(&process->regions);
 	thrlist_destroy(process->waiting);
-	free(process);
+	slab_free(&thrlist_cache, process->waiting);
+	mutex_destroy(process->cow_lock);
+	slab_free(&mutex_cache, process->cow_lock);
+	mutex_destroy(process->region_lock);
+	slab_free(&mutex_cache, process->region_lock);
+	slab_free(&process_cache, process);
 	return 0;
 }
 
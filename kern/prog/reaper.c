@@ -0,0 +1,191 @@
+/**
+ * @file reaper.c
+ * @brief Teardown of the collected processes, off the path of wait
+ *
+ * Destroying a process frees every frame and page table of its address
+ * space, which takes long for a large one. wait() only takes the child out
+ * of the family of its parent (@see bury_process) and hands the corpse to
+ * the reaper, a kernel thread which destroys the corpses one after the
+ * other, in the order they were collected.
+ *
+ * The queue of corpses is protected by the scheduler lock, like the queues
+ * of exited children: the reaper blocks itself in the same dont_switch_me_out
+ * area in which it finds the queue empty, and the first corpse queued makes
+ * it runnable again. It doesn't get the CPU right away, the thread which
+ * called wait keeps it.
+ *
+ * A thread which vanishes without being the last of its process leaves the
+ * family of its process and is queued too, in the dont_switch_me_out area in
+ * which it leaves the CPU for good. It holds the scheduler lock until the
+ * next thread runs on its CPU, off its kernel stack: once the reaper takes
+ * it off the queue, nothing runs on the stack anymore, and both the stack
+ * and the control block go back to their caches. The dead threads are freed
+ * before the corpses, a process queued after its threads doesn't have them
+ * in its family anymore.
+ *
+ * Until the reaper runs, the corpses are destroyed right away, and the dead
+ * threads stay in their family until their process is destroyed.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <thread.h>
+#include <process.h>
+#include <context.h>
+#include <drivers.h>
+#include <kthread.h>
+#include <reaper.h>
+
+/* The reaper, NULL until it runs */
+static thread_t *reaper = NULL;
+static boolean_t reaper_asleep = FALSE;
+
+/* The corpses, linked through next_exited which they no longer use */
+static process_t *first_corpse = NULL;
+static process_t *last_corpse = NULL;
+
+/* The dead threads, linked through wait_next which they no longer use */
+static thread_t *first_dead = NULL;
+static thread_t *last_dead = NULL;
+
+/* Counters, protected by the scheduler lock too */
+static unsigned int pending = 0;	// Corpses queued or being destroyed
+static unsigned int peak = 0;		// Highest backlog since the last reset
+static unsigned int reaped = 0;		// Corpses destroyed since the last reset
+static unsigned int freed = 0;		// Threads freed since the last reset
+
+/**
+ * @brief The reaper thread
+ */
+static void reaper_main(void *arg) {
+	thread_t *self = get_self();
+
+	for (;;) {
+		dont_switch_me_out();
+		while (first_corpse == NULL && first_dead == NULL) {
+			reaper_asleep = TRUE;
+			set_blocked(self);
+
+			thread_t *other = get_running();
+			if (other == NULL) other = idle();
+			context_switch(self, other);
+			dont_switch_me_out();
+		}
+
+		// The thread is off its stack, we hold the scheduler lock
+		thread_t *dead = first_dead;
+		if (dead != NULL) {
+			first_dead = dead->wait_next;
+			if (first_dead == NULL) last_dead = NULL;
+			dead->wait_next = NULL;
+			freed++;
+			you_can_switch_me_out_now();
+
+			free_thread(dead);
+			continue;
+		}
+
+		process_t *corpse = first_corpse;
+		first_corpse = corpse->next_exited;
+		if (first_corpse == NULL) last_corpse = NULL;
+		corpse->next_exited = NULL;
+		you_can_switch_me_out_now();
+
+		destroy_process(corpse);
+
+		dont_switch_me_out();
+		pending--;
+		reaped++;
+		you_can_switch_me_out_now();
+	}
+}
+
+/**
+ * @brief Creates the reaper and makes it runnable
+ *
+ * If the reaper can't be created, the corpses keep being destroyed by
+ * wait itself.
+ */
+void reaper_start(void) {
+	thread_t *thread = kthread_create(reaper_main, NULL, -1);
+	if (thread == NULL) return;
+
+	dont_switch_me_out();
+	reaper = thread;
+	you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Hands a buried process to the reaper
+ *
+ * @param process the process, out of its family already
+ */
+void reap_process(process_t *process) {
+	if (reaper == NULL) {
+		destroy_process(process);
+		return;
+	}
+
+	dont_switch_me_out();
+	process->next_exited = NULL;
+	if (last_corpse != NULL) last_corpse->next_exited = process;
+	else first_corpse = process;
+	last_corpse = process;
+
+	if (++pending > peak) peak = pending;
+
+	if (reaper_asleep) {
+		reaper_asleep = FALSE;
+		set_runnable(reaper);
+	}
+	you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Hands a vanished thread, which isn't the last of its process, to
+ * the reaper
+ *
+ * We must be in the dont_switch_me_out area in which the thread leaves the
+ * CPU for good.
+ *
+ * @param thread the thread
+ * @return TRUE if the reaper frees it, FALSE if it stays in its family
+ */
+boolean_t reap_thread(thread_t *thread) {
+	if (reaper == NULL) return FALSE;
+
+	leave_family(thread);
+
+	thread->wait_next = NULL;
+	if (last_dead != NULL) last_dead->wait_next = thread;
+	else first_dead = thread;
+	last_dead = thread;
+
+	if (reaper_asleep) {
+		reaper_asleep = FALSE;
+		set_runnable(reaper);
+	}
+	return TRUE;
+}
+
+/**
+ * @brief Copies the counters of the reaper
+ *
+ * @param stats where to copy them
+ * @param reset whether to clear the peak backlog and the reaped counts
+ */
+void reaper_stats(kstat_reaper_t *stats, boolean_t reset) {
+	dont_switch_me_out();
+	stats->pending = pending;
+	stats->peak = peak;
+	stats->reaped = reaped;
+	stats->threads = freed;
+	if (reset) {
+		peak = pending;
+		reaped = 0;
+		freed = 0;
+	}
+	you_can_switch_me_out_now();
+}
@@ -0,0 +1,167 @@
+/**
+ * @file recring.c
+ * @brief Per-CPU rings of records, for the profiler and the scheduler trace
+ *
+ * The ring of a CPU is filled by that CPU, with interrupts off, and drained
+ * by the system calls:
+ * - The CPU is the only one moving head, and only moves it once the record
+ *   is written. It never waits: a record which doesn't fit is dropped.
+ * - The drain is the only one moving tail, and only moves it once the
+ *   records are copied out of the ring. The drains are serialized by a
+ *   mutex, since they copy to user memory.
+ * Stores aren't reordered on x86, so a compiler barrier between the record
+ * and head is enough for the other CPUs to see them in order.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <types.h>
+#include <lock.h>
+#include <seqlock.h>
+#include <usercopy.h>
+#include <errors.h>
+#include <recring.h>
+
+/* Bytes of records copied out of a ring at a time */
+#define RECRING_DRAIN_CHUNK 1024
+
+/**
+ * @brief Gets a record of the ring of a CPU
+ */
+static inline void *record_at(recring_t *ring, int cpu, unsigned int i) {
+	unsigned int index = cpu * ring->size + (i & (ring->size - 1));
+	return ring->records + index * ring->record_size;
+}
+
+/**
+ * @brief Initializes the rings, off
+ *
+ * @param ring the rings
+ * @param records room for size records of record_size bytes for each CPU
+ * @param record_size the size of a record, at most RECRING_DRAIN_CHUNK
+ * @param size the number of records of each CPU, a power of two
+ */
+void recring_init(recring_t *ring, void *records, size_t record_size,
+		unsigned int size) {
+	memset(ring, 0, sizeof(recring_t));
+	ring->record_size = record_size;
+	ring->size = size;
+	ring->records = records;
+	mutex_init(&ring->drain_lock);
+}
+
+/**
+ * @brief Gets the slot of the next record of a CPU, if the rings are on
+ *
+ * The record is only seen by the drains once committed (@see
+ * recring_commit). Called by the CPU itself with interrupts off.
+ *
+ * @param ring the rings
+ * @param cpu the calling CPU
+ * @return the slot, NULL if the rings are off or the one of the CPU is full
+ */
+void *recring_reserve(recring_t *ring, int cpu) {
+	if (!ring->on) return NULL;
+
+	recring_cpu_t *rc = &ring->cpus[cpu];
+	unsigned int head = rc->head;
+	if (head - rc->tail >= ring->size) {
+		rc->dropped++;
+		return NULL;
+	}
+
+	return record_at(ring, cpu, head);
+}
+
+/**
+ * @brief Hands the record written in the slot reserved to the drains
+ *
+ * @param ring the rings
+ * @param cpu the calling CPU
+ */
+void recring_commit(recring_t *ring, int cpu) {
+	recring_cpu_t *rc = &ring->cpus[cpu];
+	SEQ_BARRIER();
+	rc->head = rc->head + 1;
+}
+
+/**
+ * @brief Forgets the records added so far and turns the rings on
+ */
+void recring_start(recring_t *ring) {
+	mutex_lock(&ring->drain_lock);
+
+	int i;
+	for (i = 0; i < CPU_MAX; ++i) {
+		ring->cpus[i].tail = ring->cpus[i].head;
+		ring->cpus[i].dropped = 0;
+	}
+	ring->on = TRUE;
+
+	mutex_unlock(&ring->drain_lock);
+}
+
+/**
+ * @brief Turns the rings off, the records stay until drained
+ * @return the number of records dropped since they started
+ */
+int recring_stop(recring_t *ring) {
+	ring->on = FALSE;
+
+	int i, dropped = 0;
+	for (i = 0; i < CPU_MAX; ++i) dropped += ring->cpus[i].dropped;
+	return dropped;
+}
+
+/**
+ * @brief Copies records out to user memory, the oldest of each CPU first
+ *
+ * @param ring the rings
+ * @param buf the user buffer
+ * @param max the number of records it can hold
+ * @return the number of records copied, a negative error code if buf is
+ * invalid
+ */
+int recring_drain(recring_t *ring, void *buf, int max) {
+	char chunk[RECRING_DRAIN_CHUNK];
+	unsigned int per_chunk = RECRING_DRAIN_CHUNK / ring->record_size;
+	size_t rsize = ring->record_size;
+	char *dst = buf;
+	int copied = 0;
+	int ret = 0;
+
+	mutex_lock(&ring->drain_lock);
+
+	int i;
+	for (i = 0; i < CPU_MAX && copied < max && ret == 0; ++i) {
+		recring_cpu_t *rc = &ring->cpus[i];
+
+		while (copied < max) {
+			unsigned int tail = rc->tail;
+			unsigned int avail = rc->head - tail;
+			if (avail == 0) break;
+			SEQ_BARRIER();
+
+			unsigned int n = 0;
+			while (n < per_chunk && n < avail && copied + n < max) {
+				memcpy(chunk + n * rsize, record_at(ring, i, tail + n), rsize);
+				n++;
+			}
+
+			SEQ_BARRIER();
+			rc->tail = tail + n;
+
+			if (copy_to_user(dst + copied * rsize, chunk, n * rsize)) {
+				ret = ERR_INVALID_ARG;
+				break;
+			}
+			copied += n;
+		}
+	}
+
+	mutex_unlock(&ring->drain_lock);
+	return (ret < 0) ? ret : copied;
+}
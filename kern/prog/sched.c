@@ -0,0 +1,538 @@
+/**
+ * @file sched.c
+ * @brief Multi-level feedback queue scheduler
+ *
+ * Each CPU has its own run queue, made of SCHED_LEVELS lists of runnable
+ * threads, level 0 being the most urgent. A bitmap of the non-empty lists
+ * makes picking the next thread O(1). The policy goes as follows:
+ * - A thread running through the whole quantum of its level is a CPU hog
+ *   and goes one level down, where quanta are longer.
+ * - A thread waking up from a sleep, a deschedule or a wait goes back to its
+ *   base level, so that interactive threads stay ahead of CPU-bound ones.
+ * - A running thread is preempted as soon as a thread of a higher level is
+ *   runnable. Waking a thread up doesn't give it the CPU otherwise, the
+ *   waker goes on (@see sched_preempts).
+ * - Every SCHED_AGING_PERIOD ticks, every runnable thread goes back to its
+ *   base level, so that nobody starves.
+ * - Within a level, a thread of the process running on the CPU goes ahead
+ *   of the head of its queue, since its address space is hot in the TLB and
+ *   caches (@see sched_pick). The head is only passed over
+ *   SCHED_AFFINITY_WINDOW times in a row, so that the other processes of
+ *   the level still get their turn.
+ *
+ * The base level of a thread is its nice value, which it can raise or lower
+ * with the set_nice system call.
+ *
+ * The threads of the earliest-deadline-first class (@see edf.c) sit above
+ * all the levels: a ready one always goes first, and preempts any other on
+ * the next tick at the latest. Their own queues keep them, and their
+ * process, pinned to its CPU, are left out of the levels and the balancing.
+ *
+ * A thread holding a mutex other threads wait for inherits the most urgent
+ * of their levels (@see mutex.c), its boost. It is queued and scheduled at
+ * the more urgent of its own level and its boost (@see sched_level), so
+ * that a waiter is never held up by threads less urgent than itself. Its
+ * own level goes on as usual meanwhile, and is back in charge once it
+ * loses the boost.
+ *
+ * A thread waits in the run queue of the CPU its process is assigned to.
+ * All the threads of a process run on the same CPU, so that a page
+ * directory is never loaded on two CPUs at once and changing a mapping
+ * never requires flushing the TLB of another CPU. Processes are spread over
+ * the CPUs when they are created (@see sched_place), then moved around to
+ * keep the CPUs busy:
+ * - An idle CPU steals a process from the busiest of its peers.
+ * - Every SCHED_BALANCE_PERIOD ticks, the timer moves a process from the
+ *   busiest CPU to the least busy one, if their loads are far apart.
+ * In both cases we take the thread closest to the tail of the least urgent
+ * queue, the one which would wait the longest, and only consider threads
+ * whose process is not running: its page directory is not hot in the TLB
+ * of its CPU, which loses nothing as it goes. The whole process moves,
+ * unless it is pinned, as the same-page merging and working-set scanners do
+ * with the process they work on (@see ksm.c, wss.c).
+ *
+ * As for the other thread lists, the callers must not be switched out
+ * while using these functions, which also keeps the other CPUs away
+ * (@see dont_switch_me_out).
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <string.h>
+
+#include <errors.h>
+#include <thrlist.h>
+#include <sched.h>
+#include <cpu.h>
+#include <drivers.h>
+#include <edf.h>
+
+/* The run queue of a CPU */
+typedef struct runqueue {
+	thrlist_t		queues[SCHED_LEVELS];	// One per level
+	uint32_t		nonempty;	// Bit i is set when queues[i] is not empty
+	unsigned int	queued;		// Number of threads in all the queues
+
+	/* Migration counters, @see kstat.h */
+	unsigned int	steals;
+	unsigned int	balanced;
+	unsigned int	migrations_in;
+	unsigned int	migrations_out;
+	unsigned int	bounces;
+
+	/* Picks which passed over the head of a queue, @see sched_pick */
+	unsigned int	streak;		// In a row, up to SCHED_AFFINITY_WINDOW
+	unsigned int	affine;		// Since the last reset
+} runqueue_t;
+
+/* The run queues, indexed by CPU */
+static runqueue_t runqueues[CPU_MAX];
+
+/**
+ * @brief Returns the run queue of the calling CPU
+ */
+static runqueue_t *local_queue(void) {
+	return &runqueues[cpu_id()];
+}
+
+/**
+ * @brief Returns the level of the queue holding a thread, -1 if none does
+ */
+static int queue_level(thread_t *thread) {
+	thrlist_t *queues = runqueues[thread->cpu].queues;
+	if (thread->list < queues || thread->list >= queues + SCHED_LEVELS)
+		return -1;
+	return thread->list - queues;
+}
+
+/**
+ * @brief Initializes the run queues
+ */
+void sched_init(void) {
+	memset(runqueues, 0, sizeof(runqueues));
+
+	int cpu, i;
+	for (cpu = 0; cpu < CPU_MAX; ++cpu) {
+		for (i = 0; i < SCHED_LEVELS; ++i)
+			thrlist_init(&runqueues[cpu].queues[i]);
+	}
+
+	edf_init();
+}
+
+/**
+ * @brief Tells whether a thread is in a run queue
+ */
+boolean_t sched_queued(thread_t *thread) {
+	if (thread->edf_queued) return TRUE;
+	return thread->list != NULL && queue_level(thread) >= 0;
+}
+
+/**
+ * @brief Adds a thread at the tail of the queue of its level, on the CPU
+ * of its process
+ * @return 0 on success, a negative error code otherwise
+ */
+int sched_enqueue(thread_t *thread) {
+	thread->cpu = thread->process->cpu;
+	if (edf_member(thread)) return edf_enqueue(thread);
+
+	runqueue_t *rq = &runqueues[thread->cpu];
+
+	int level = sched_level(thread);
+	int err = thrlist_add_tail(thread, &rq->queues[level]);
+	if (err < 0) return err;
+
+	rq->nonempty |= (1 << level);
+	rq->queued++;
+	return 0;
+}
+
+/**
+ * @brief Removes a thread from its run queue
+ * @return 0 on success, a negative error code otherwise
+ */
+int sched_dequeue(thread_t *thread) {
+	if (thread->edf_queued) {
+		edf_dequeue(thread);
+		return 0;
+	}
+
+	int level = queue_level(thread);
+	if (level < 0) return ERR_INVALID_ARG;
+
+	int err = thrlist_remove(thread);
+	if (err < 0) return err;
+
+	runqueue_t *rq = &runqueues[thread->cpu];
+	if (rq->queues[level].size == 0) rq->nonempty &= ~(1 << level);
+	rq->queued--;
+	return 0;
+}
+
+/**
+ * @brief Returns the next thread to run on the calling CPU, NULL if none is
+ * runnable
+ *
+ * A ready thread of the earliest-deadline-first class goes first. Otherwise
+ * this is the head of the most urgent queue, unless one of the first
+ * SCHED_AFFINITY_SCAN threads of that queue belongs to the process the CPU
+ * runs, in which case switching to it keeps the page directory loaded. The
+ * running thread itself, which goes back to the tail of its queue when its
+ * quantum is over, is not taken ahead of the others.
+ */
+thread_t *sched_pick(void) {
+	thread_t *rt = edf_pick();
+	if (rt != NULL) return rt;
+
+	runqueue_t *rq = local_queue();
+	if (rq->nonempty == 0) return NULL;
+
+	thread_t *head = thrlist_head(&rq->queues[__builtin_ctz(rq->nonempty)]);
+	thread_t *self = cpu_current();
+	if (self == NULL || self->process == NULL || self->process->threads < 2
+			|| head->process == self->process
+			|| rq->streak >= SCHED_AFFINITY_WINDOW) {
+		rq->streak = 0;
+		return head;
+	}
+
+	int i;
+	thread_t *thread = thrlist_next(head);
+	for (i = 1; thread != NULL && i < SCHED_AFFINITY_SCAN; ++i) {
+		if (thread->process == self->process && thread != self) {
+			rq->streak++;
+			rq->affine++;
+			return thread;
+		}
+		thread = thrlist_next(thread);
+	}
+
+	rq->streak = 0;
+	return head;
+}
+
+/**
+ * @brief Returns the number of threads runnable on the calling CPU
+ */
+unsigned int sched_count(void) {
+	return local_queue()->queued + edf_count(cpu_id());
+}
+
+/**
+ * @brief Returns the number of threads a CPU has to run, counting the one
+ * it runs unless it is idle
+ */
+static unsigned int load(int id) {
+	cpu_t *cpu = get_cpu(id);
+	unsigned int n = runqueues[id].queued + edf_count(id);
+	if (cpu->current != NULL && !is_idle(cpu->current)) n++;
+	return n;
+}
+
+/**
+ * @brief Chooses the CPU of a new process
+ *
+ * This is the online CPU with the fewest threads to run.
+ *
+ * @return the id of the CPU
+ */
+int sched_place(void) {
+	int best = 0;
+	unsigned int best_load = ~0;
+
+	int id;
+	for (id = 0; id < num_cpus(); ++id) {
+		if (!get_cpu(id)->online) continue;
+
+		unsigned int n = load(id);
+		if (n < best_load) {
+			best = id;
+			best_load = n;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * @brief Finds a thread which may leave a CPU
+ *
+ * We search from the tail of the least urgent queue up, and skip the
+ * threads of the process the CPU runs and of the pinned processes.
+ *
+ * @param id the CPU
+ * @return the thread, NULL if there is none
+ */
+static thread_t *migration_candidate(int id) {
+	runqueue_t *rq = &runqueues[id];
+	thread_t *running = get_cpu(id)->current;
+
+	int level;
+	for (level = SCHED_LEVELS - 1; level >= 0; --level) {
+		if (!(rq->nonempty & (1 << level))) continue;
+
+		thread_t *thread;
+		for (thread = thrlist_tail(&rq->queues[level]); thread != NULL;
+				thread = thrlist_prev(thread)) {
+			if (thread->process->pinned) continue;
+			if (running == NULL || thread->process != running->process)
+				return thread;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Moves a process, and its runnable threads, to another CPU
+ *
+ * Its other threads join the new CPU when they are runnable again.
+ */
+static void migrate(process_t *process, int to) {
+	int from = process->cpu;
+	unsigned int now = get_time();
+
+	runqueues[from].migrations_out++;
+	runqueues[to].migrations_in++;
+	if (process->migrated_at != 0
+			&& now - process->migrated_at < SCHED_BOUNCE_WINDOW)
+		runqueues[from].bounces++;
+	process->migrated_at = now;
+
+	process->cpu = to;
+	thread_t *thread;
+	for (thread = process->youngest_thread; thread != NULL;
+			thread = thread->older_sibling) {
+		if (!sched_queued(thread)) continue;
+		sched_dequeue(thread);
+		sched_enqueue(thread);
+	}
+}
+
+/**
+ * @brief Tells whether a peer has threads waiting, which an idle CPU could
+ * steal
+ *
+ * This only peeks at the queues, without the scheduler lock, to spare it
+ * while idle.
+ */
+boolean_t sched_can_steal(void) {
+	int self = cpu_id();
+
+	int id;
+	for (id = 0; id < num_cpus(); ++id)
+		if (id != self && runqueues[id].queued > 0) return TRUE;
+	return FALSE;
+}
+
+/**
+ * @brief Takes a process from the busiest peer of the calling CPU
+ *
+ * Called by an idle CPU, whose run queue is empty.
+ *
+ * @return TRUE if the calling CPU has threads to run now
+ */
+boolean_t sched_steal(void) {
+	int self = cpu_id();
+	int victim = -1;
+	unsigned int most = 0;
+
+	int id;
+	for (id = 0; id < num_cpus(); ++id) {
+		if (id == self || runqueues[id].queued <= most) continue;
+		victim = id;
+		most = runqueues[id].queued;
+	}
+	if (victim < 0) return FALSE;
+
+	thread_t *thread = migration_candidate(victim);
+	if (thread == NULL) return FALSE;
+
+	migrate(thread->process, self);
+	runqueues[self].steals++;
+	return TRUE;
+}
+
+/**
+ * @brief Moves a process from the busiest CPU to the least busy one
+ *
+ * This is only worth it when their loads differ by two threads at least,
+ * otherwise the process would simply swap the roles of the two CPUs.
+ */
+void sched_balance(void) {
+	int busiest = -1, idlest = -1;
+	unsigned int most = 0, least = ~0;
+
+	int id;
+	for (id = 0; id < num_cpus(); ++id) {
+		if (!get_cpu(id)->online) continue;
+
+		unsigned int n = load(id);
+		if (n > most || busiest < 0) {
+			busiest = id;
+			most = n;
+		}
+		if (n < least) {
+			idlest = id;
+			least = n;
+		}
+	}
+	if (busiest < 0 || most < least + 2) return;
+
+	thread_t *thread = migration_candidate(busiest);
+	if (thread == NULL) return;
+
+	migrate(thread->process, idlest);
+	runqueues[idlest].balanced++;
+}
+
+/**
+ * @brief Copies the scheduling counters of the CPUs
+ *
+ * @param stats where to copy them, one entry per CPU
+ * @param n the number of entries available
+ * @param reset whether to clear the counters afterwards
+ * @return the number of entries copied
+ */
+int sched_stats(kstat_sched_t *stats, int n, boolean_t reset) {
+	int id;
+	for (id = 0; id < num_cpus() && id < n; ++id) {
+		runqueue_t *rq = &runqueues[id];
+		stats[id].cpu = id;
+		stats[id].online = get_cpu(id)->online;
+		stats[id].queued = rq->queued;
+		stats[id].steals = rq->steals;
+		stats[id].balanced = rq->balanced;
+		stats[id].migrations_in = rq->migrations_in;
+		stats[id].migrations_out = rq->migrations_out;
+		stats[id].bounces = rq->bounces;
+		stats[id].affine = rq->affine;
+		stats[id].cr3_loads = get_cpu(id)->cr3_loads;
+		stats[id].cr3_skips = get_cpu(id)->cr3_skips;
+
+		if (reset) {
+			rq->steals = 0;
+			rq->balanced = 0;
+			rq->migrations_in = 0;
+			rq->migrations_out = 0;
+			rq->bounces = 0;
+			rq->affine = 0;
+			get_cpu(id)->cr3_loads = 0;
+			get_cpu(id)->cr3_skips = 0;
+		}
+	}
+
+	return id;
+}
+
+/**
+ * @brief Boosts a thread which gave up the CPU and is runnable again
+ *
+ * The thread must not be queued yet.
+ */
+void sched_wakeup(thread_t *thread) {
+	thread->level = thread->nice;
+	thread->slice = 0;
+	if (edf_member(thread)) edf_wakeup(thread);
+}
+
+/**
+ * @brief Tells whether a thread just made runnable takes the CPU from the
+ * one which woke it up
+ *
+ * It does if it is of a higher level, as the next tick would find anyway,
+ * or if the earliest-deadline-first class says so when either is in it.
+ * Both must be on the calling CPU.
+ */
+boolean_t sched_preempts(thread_t *self, thread_t *woken) {
+	if (edf_member(self) || edf_member(woken))
+		return edf_preempts(self, woken);
+	return sched_level(woken) < sched_level(self);
+}
+
+/**
+ * @brief Accounts a timer tick to the running thread
+ *
+ * @return TRUE if the thread must give up the CPU, either since it ran its
+ * whole quantum, in which case it is demoted, or since a thread of a higher
+ * level or of the earliest-deadline-first class is runnable. The class
+ * decides for its own threads (@see edf_tick).
+ */
+boolean_t sched_tick(thread_t *self) {
+	if (edf_member(self)) return edf_tick(self);
+	if (edf_count(cpu_id()) > 0) return TRUE;
+
+	if (++self->slice >= SCHED_QUANTUM(self->level)) {
+		if (self->level < SCHED_LEVELS - 1) self->level++;
+		self->slice = 0;
+		return TRUE;
+	}
+
+	int level = sched_level(self);
+	return (local_queue()->nonempty & ((1 << level) - 1)) != 0;
+}
+
+/**
+ * @brief Brings every thread runnable on the calling CPU, and the running
+ * one, back to its base level
+ *
+ * This is O(number of runnable threads), once every SCHED_AGING_PERIOD.
+ */
+void sched_age(thread_t *self) {
+	self->level = self->nice;
+	self->slice = 0;
+
+	runqueue_t *rq = local_queue();
+	int level;
+	for (level = 1; level < SCHED_LEVELS; ++level) {
+		thread_t *thread = thrlist_head(&rq->queues[level]);
+		while (thread != NULL) {
+			thread_t *next = thrlist_next(thread);
+			if (sched_base(thread) < level) {
+				sched_dequeue(thread);
+				sched_wakeup(thread);
+				sched_enqueue(thread);
+			}
+			thread = next;
+		}
+	}
+}
+
+/**
+ * @brief Sets the base level of a thread
+ *
+ * A thread above its new base level goes down to it right away.
+ *
+ * @return the previous nice value, ERR_INVALID_ARG if nice is not a level
+ */
+int sched_set_nice(thread_t *thread, int nice) {
+	if (nice < 0 || nice >= SCHED_LEVELS) return ERR_INVALID_ARG;
+
+	int old = thread->nice;
+	thread->nice = nice;
+	if (thread->level < nice) {
+		boolean_t requeue = sched_queued(thread);
+		if (requeue) sched_dequeue(thread);
+		thread->level = nice;
+		if (requeue) sched_enqueue(thread);
+	}
+	return old;
+}
+
+/**
+ * @brief Sets the level a thread inherited through mutexes
+ *
+ * A queued thread moves to the queue of its new level right away.
+ *
+ * @param boost the level, SCHED_LEVELS for none
+ */
+void sched_boost(thread_t *thread, int boost) {
+	if (thread->boost == boost) return;
+
+	boolean_t requeue = sched_queued(thread);
+	if (requeue) sched_dequeue(thread);
+	thread->boost = boost;
+	if (requeue) sched_enqueue(thread);
+}
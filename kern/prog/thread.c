@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <x86/cr.h>	
 #include <x86/asm.h>	
@@ -20,37 +21,44 @@
 #include <thrlist.h>
 #include <thrhash.h>
 #include <thread.h>
+#include <sched.h>
+#include <edf.h>
+#include <cpu.h>
+#include <objcache.h>
+#include <fpu.h>
+#include <vdso.h>
+#include <clock.h>
+#include <trace.h>
+#include <cputime.h>
+#include <inc/syscall.h>
 
 /**
- * These double linked lists are used to categorize different threads 
- * given their states. Each of them has unique properties :
- * 
- * 'running' represents the list of all runnable threads, which could get 
- * the CPU.
- * A very important property is that the head of the running list is
- * ALWAYS the thread currently running.*/ 
-static thrlist_t running;
-
-/* 'sleeping' represents all the threads which made a call to 'sleep()'.
- * It is maintained ordered increasingly according to thread->wake to make
- * the awakening of threads during the timer handler as fast as possible.
+ * The runnable threads wait in the run queues of the scheduler (@see
+ * sched.c), which decides who gets each CPU next. The thread currently
+ * running on a CPU is recorded apart in the block of the CPU (@see cpu.c),
+ * it is only queued between the moment it makes itself runnable and the
+ * next context switch.
  */
-static thrlist_t sleeping;
 
-/* A read/write lock for the hash table, which contains all threads */
-static rwlock_t hash_lock;
+/* The threads which made a call to 'sleep()' are in no list, each of them
+ * has its sleep_timeout armed in the timer wheel instead (@see timeout.c).
+ */
 
-/* A simple mutex to make the next_tid() function atomic */
-static mutex_t tid_lock;
-static unsigned int tid = THREAD_INITIAL_TID;
+/* The table of all threads, which also hands out the thread ids, is in
+ * thrhash.c. Its lookups take no lock. */
 
-/* Pointers to the idle and init thread */
+/* Pointer to the init thread, the idle threads are per CPU */
 static thread_t *init_thread = NULL;
-static thread_t *idle_thread = NULL;
 
 /* Lock used to make the malloc functions thread safe */
 mutex_t mem_lock;
 
+/* The free control blocks and kernel stacks, @see objcache.c */
+static objcache_t thread_cache;
+static objcache_t kstack_cache;
+
+static void thread_ctor(void *obj);
+
 
 /**
  * @brief Initializes the thread management library
@@ -60,11 +68,29 @@ mutex_t mem_lock;
  */
 void thread_init() {
 
-	thrlist_init(&running);
-	thrlist_init(&sleeping);	
-	rwlock_init(&hash_lock);
-	mutex_init(&tid_lock);
+	sched_init();
+	init_timeouts();
+	thrhash_init();
 	mutex_init(&mem_lock);
+
+	objcache_init(&thread_cache, "thread", sizeof(thread_t),
+			THREAD_CACHE_LINE, THREAD_CACHE_SIZE, thread_ctor);
+	objcache_init(&kstack_cache, "kstack", THREAD_KERNEL_SIZE*PAGE_SIZE,
+			PAGE_SIZE, KSTACK_CACHE_SIZE, NULL);
+}
+
+/**
+ * @brief Sets up a control block fresh from the heap
+ *
+ * Its lock is only initialized here: the control blocks go back to their
+ * cache with the lock free, ready for the next thread.
+ *
+ * @param obj the control block
+ */
+static void thread_ctor(void *obj) {
+	thread_t *thread = obj;
+	memset(thread, 0, sizeof(thread_t));
+	mutex_init(&thread->thread_lock);
 }
 
 
@@ -85,8 +111,12 @@ int unset_state(thread_t *thread) {
 	// Verify that the thread is not null
 	if (thread == NULL) return ERR_ARG_NULL;
 
+	// A sleeping thread leaves the timer wheel
+	if (thread->state == THR_SLEEPING) cancel_timeout(&thread->sleep_timeout);
+
 	// Remove the thread from its list
-	int err = thrlist_remove(thread);
+	int err = sched_queued(thread) ? sched_dequeue(thread)
+		: thrlist_remove(thread);
 	
 	if (err >= 0) thread->state = THR_ZOMBIE;	
 	return err;
@@ -95,10 +125,14 @@ int unset_state(thread_t *thread) {
 /**
  * @brief Sets the given thread to be running
  * 
- * This simply adds the thread at the beginning of the running list.
+ * This takes the thread out of the run queues and records it as the
+ * current thread of the calling CPU.
  * 
- * This function also makes the important set_esp0 call, so that our mode
- * switch operates correctly in this new thread. 
+ * This function also makes the important cpu_set_esp0 call, so that our
+ * mode switch operates correctly in this new thread. 
+ *
+ * The page directory is only loaded if the thread runs in another address
+ * space than the previous one, since loading it flushes the TLB.
  *
  * This function is called from the context_switch procedure during the
  * transition period.
@@ -115,13 +149,21 @@ int set_running(thread_t *thread) {
 	int err = unset_state(thread);
 	if (err < 0) return err;
 
-	err = thrlist_add_head(thread, &running);
-	if (err < 0) return err;
-
+	cpu_t *cpu = this_cpu();
+	cputime_switch(cpu->current, thread);
+	cpu->current = thread;
+	thread->cpu = cpu->id;
 	thread->state = THR_RUNNING;
-
-	set_esp0(thread->esp0);
-	set_cr3((uint32_t)(thread->process->cr3));
+	vdso_set_running(thread);
+
+	cpu_set_esp0(thread->esp0);
+	uint32_t cr3 = (uint32_t) thread->process->cr3;
+	if (get_cr3() != cr3) {
+		set_cr3(cr3);
+		cpu->cr3_loads++;
+	} else {
+		cpu->cr3_skips++;
+	}
 
 	return 0;
 }
@@ -129,8 +171,10 @@ int set_running(thread_t *thread) {
 /**
  * @brief Sets the given thread to be runnable
  *
- * We add the given thread to the end of the running list, not to the 
- * beginning as does the set_running function.
+ * We add the given thread to the end of the run queue of its level. A
+ * thread coming back from a sleep, a deschedule or a wait is boosted to its
+ * base level first (@see sched_wakeup). The idle thread is never queued,
+ * it only runs when nobody else can.
  *
  * @param thread the thread we should make runnable
  * @return 0 on success, a negative error code otherwise
@@ -139,19 +183,24 @@ int set_runnable(thread_t *thread) {
 
 	if (thread == NULL) return ERR_ARG_NULL;
 
+	thrstate_t previous = thread->state;
 	int err = unset_state(thread);
 	if (err < 0) return err;
 
+	if (previous == THR_BLOCKED || previous == THR_SLEEPING
+			|| previous == THR_WAITING) sched_wakeup(thread);
+
 	thread->state = THR_RUNNING;
+	trace_wakeup(thread, previous);
+	if (is_idle(thread)) return 0;
 
-	err = thrlist_add_tail(thread, &running);
-	return err;
+	return sched_enqueue(thread);
 }
 
 /**
  * @brief Sets the given thread to be blocked
  *
- * A blocked thread only belongs to the hash table containing all threads,
+ * A blocked thread only belongs to the table containing all threads,
  * but to no list like running, sleeping or waiting.
  *
  * @param thread the thread to be blocked
@@ -169,15 +218,40 @@ int set_blocked(thread_t *thread) {
 }
 
 /**
- * @brief Adds a thread to the list of sleeping threads in a sorted way
+ * @brief Makes the runnable again a thread whose sleep is over
+ *
+ * This is the function of the sleep timeout, called from the timer handler.
+ */
+static void wake_sleeper(void *arg) {
+	set_runnable((thread_t *) arg);
+}
+
+/**
+ * @brief Puts a thread to sleep for the given number of ticks
  *
- * The 'sleeping' list is sorted increasingly in the "vake" value which 
- * specifies the time in number of ticks of their awakening.
+ * The "wake" value specifies the time in number of ticks of the awakening,
+ * when the sleep timeout of the thread fires. Arming it is O(1) whatever the
+ * number of sleeping threads. The caller must not be switched out.
  *
  * @param thread the thread to put to sleep
  * @return 0 on sucess, a negative error code otherwise
  */
 int set_sleeping(thread_t *thread, unsigned int sleep) {
+	return set_sleeping_ns(thread, sleep, 0);
+}
+
+/**
+ * @brief Puts a thread to sleep until the given nanosecond (@see clock_ns)
+ *
+ * The sleep timeout of the thread waits for its tick in the wheel, then for
+ * its deadline within the tick. The caller must not be switched out.
+ *
+ * @param thread the thread to put to sleep
+ * @param sleep the ticks before the one in which the deadline falls, at most
+ * @param deadline the nanosecond of the awakening, 0 to wake up at the tick
+ * @return 0 on sucess, a negative error code otherwise
+ */
+int set_sleeping_ns(thread_t *thread, unsigned int sleep, uint64_t deadline) {
 
 	if (thread == NULL) return ERR_ARG_NULL;
 
@@ -189,10 +263,9 @@ int set_sleeping(thread_t *thread, unsigned int sleep) {
 	thread->wake = time + sleep;
 
 	thread->state = THR_SLEEPING;
+	add_timeout_ns(&thread->sleep_timeout, thread->wake, deadline);
 
-	err = thrlist_add_sorted(thread, &sleeping);
-
-	return err;
+	return 0;
 }
 
 /**
@@ -220,25 +293,26 @@ int set_waiting(thread_t *thread) {
 
 
 /**
- * @breif Returns the head of the running list.
- * @return the tcb of the thread at the head of running.
+ * @brief Returns the next thread to run, as chosen by the scheduler
+ * @return the next thread to run, NULL if no thread is runnable
  */
 thread_t *get_running() {
-	return running.head;
+	return sched_pick();
 }
 
 /**
  * @brief Returns the thread currently running.
  *
- * The 'running' list is defined to containg the currently running thread 
- * as its head. Since we want to obtain our own thread control block 
- * though this function we call a kernel panic is the head is NULL.
+ * Since we want to obtain our own thread control block though this
+ * function we call a kernel panic if there is none.
+ *
+ * This is a single load from the block of our CPU (@see cpu_current).
  *
  * @return our thread control block
  */
 thread_t *get_self() {
 	
-	thread_t *self = get_running();
+	thread_t *self = cpu_current();
 	if (self == NULL) kernel_panic("Running list incoherance");
 	return self;
 }
@@ -246,32 +320,52 @@ thread_t *get_self() {
 /**
  * @brief Finds a thread given his tid
  *
- * We look for the thread of given tid in the hash table of all threads. 
+ * We look for the thread of given tid in the table of all threads. 
  * This will give us O(1) access, very useful for yield.
  *
- * We protect the hash table with read/write locks.
+ * The lookup takes no lock, @see thrhash.c. The thread found is only
+ * sure to stay alive until the end of the dont_switch_me_out area the
+ * lookup is made in.
  *
  * @param tid the ID of the thread to find
  * @return the thread we are looking for
  */
 thread_t *get_thread(unsigned int tid) {
 
-	rwlock_lock(&hash_lock, RWLOCK_READ);
-	thread_t *thread = thrhash_find(tid);
-	rwlock_unlock(&hash_lock);
+	return thrhash_find(tid);
+}
 
+/**
+ * @brief Finds a live thread given its tid, and keeps its control block
+ * from being freed until release_thread
+ *
+ * The thread may still vanish meanwhile, the holder only uses what stays
+ * valid in a dead thread, such as its thread lock.
+ *
+ * @param tid the ID of the thread to find
+ * @return the thread, NULL if there is no such live thread
+ */
+thread_t *hold_thread(unsigned int tid) {
+	dont_switch_me_out();
+	thread_t *thread = get_thread(tid);
+	if (thread != NULL && (thread->tid != tid
+			|| thread->state == THR_ZOMBIE))
+		thread = NULL;
+	if (thread != NULL) thread->holds++;
+	you_can_switch_me_out_now();
 	return thread;
 }
 
-
 /**
- * @brief Returns the head of the sleeping list
- * @return the thread with closest waking time
+ * @brief Lets a thread found by hold_thread be freed again
  */
-thread_t *get_sleeping(void) {	
-	return sleeping.head;
+void release_thread(thread_t *thread) {
+	dont_switch_me_out();
+	thread->holds--;
+	you_can_switch_me_out_now();
 }
 
+
 /**
  * @brief returns the head of the waiting list
  *
@@ -282,7 +376,7 @@ thread_t *get_sleeping(void) {
 thread_t *get_waiting(process_t *parent) {
 
 	if (parent == NULL) return NULL;
-	else return parent->waiting->head;
+	else return thrlist_head(parent->waiting);
 }
 
 
@@ -291,14 +385,14 @@ thread_t *get_waiting(process_t *parent) {
  * @return the number of threads ready to resume execution
  */
 unsigned int num_runnable() {
-	return running.size;
+	return sched_count();
 }
 
 /**
  * @brief Create a new thread
  *
  * This is the birth place of any thread. We create a thread control block
- * and add it the hash table.
+ * and add it the table of all threads.
  *
  * On error we propagate the error to the caller by returning NULL.
  *
@@ -307,19 +401,25 @@ unsigned int num_runnable() {
  */
 thread_t *create_thread(process_t *parent) {
 
-	thread_t *thread = calloc(1, sizeof(thread_t));
+	thread_t *thread = objcache_alloc(&thread_cache);
 	if (thread == NULL) return NULL;
 
-	thread->tid = next_tid();
+	int tid = thrhash_reserve();
+	if (tid < 0) {
+		objcache_free(&thread_cache, thread);
+		return NULL;
+	}
+
+	thread->tid = tid;
 	thread->state = THR_ZOMBIE;
 	thread->esp = -1;
 
 	// Create a new kernel stack
-	uint32_t kstack = (uint32_t)smemalign(PAGE_SIZE,
-			THREAD_KERNEL_SIZE*PAGE_SIZE);
+	uint32_t kstack = (uint32_t)objcache_alloc(&kstack_cache);
 
 	if (kstack == 0x0) {
-		free(thread);
+		thrhash_remove(thread);
+		objcache_free(&thread_cache, thread);
 		return NULL;
 	}
 
@@ -329,44 +429,59 @@ thread_t *create_thread(process_t *parent) {
 
 	thread->esp3 = 0xfffffffc;
 	thread->process = parent;
+
+	thread->younger_sibling = NULL;
+	thread->older_sibling = NULL;
+
+	// A sibling may vanish and leave the family meanwhile
+	dont_switch_me_out();
 	parent->threads += 1;
-	
+
 	// Is this the original thread of the process?
 	if (parent->original_tid == -1)
 		parent->original_tid = thread->tid;
 
-	thread->younger_sibling = NULL;
-	thread->older_sibling = NULL;
-
 	// Now update the thread family relations
 	if (parent->youngest_thread) {
 		thread->older_sibling = parent->youngest_thread;
 		parent->youngest_thread->younger_sibling = thread;
 	}
 	parent->youngest_thread = thread; 
+	you_can_switch_me_out_now();
 
 	// Intialize list and swexn values
 	thread->list = NULL;
-	thread->next = NULL;
-	thread->prev = NULL;
+	Q_INIT_ELEM(thread, link);
 	thread->swexn_eip = 0x0;
 	thread->swexn_esp = 0x0;
 	thread->swexn_arg = NULL;
-
-	// Create thread locks
-	thread->thread_lock = calloc(1, sizeof(mutex_t));
-	if (thread->thread_lock == NULL) {
-		sfree((void *)kstack, PAGE_SIZE);		
-		free(thread);
-		return NULL;
-	}
-	mutex_init(thread->thread_lock);
+	thread->swexn_persistent = FALSE;
+	thread->fpu_state = NULL;
+	thread->sys_start = 0;
+	thread->user_cycles = 0;
+	thread->kernel_cycles = 0;
+	thread->cycles_since = 0;
+	thread->ipc_state = IPC_IDLE;
+	thread->ipc_callers = NULL;
+	thread->ipc_next = NULL;
+	init_timeout(&thread->sleep_timeout, wake_sleeper, thread);
+	thread->nice = 0;
+	thread->level = 0;
+	thread->boost = SCHED_LEVELS;
+	thread->blocked_on = NULL;
+	edf_init_thread(thread);
+	thread->slice = 0;
+	thread->cpu = parent->cpu;
+	thread->wake = 0;
+
+	// The thread lock comes initialized and free from the cache
 	thread->acquired_lock = NULL;
+	thread->holds = 0;
+	thread->wait_next = NULL;
+	thread->cond_mutex = NULL;
 
-	// Add thread to hash table
-	rwlock_lock(&hash_lock, RWLOCK_WRITE);
+	// Add thread to the table, lookups can find it from now on
 	thrhash_add(thread);
-	rwlock_unlock(&hash_lock);
 
 	return thread;
 
@@ -390,13 +505,25 @@ thread_t *copy_thread(process_t *process, thread_t *target, boolean_t handler) {
 	thread->esp3 = target->esp3;
 	thread->process = process;
 
+	// The child starts at the base level of its parent
+	thread->nice = target->nice;
+	thread->level = target->nice;
+
 	// Copy software exception handler
 	if (handler) {
 		thread->swexn_eip = target->swexn_eip;
 		thread->swexn_esp = target->swexn_esp;
 		thread->swexn_arg = target->swexn_arg;
+		thread->swexn_persistent = target->swexn_persistent;
 	}	
 
+	// The child starts with the FPU registers of its parent
+	if (fpu_copy(thread, target) < 0) {
+		process->threads -= 1;
+		destroy_thread(thread);
+		return NULL;
+	}
+
 	return thread;
 } 
 
@@ -405,8 +532,9 @@ thread_t *copy_thread(process_t *process, thread_t *target, boolean_t handler) {
  *
  *
  * We can't free the kernel stack since that's where we currently are. 
- * Thus we need to keep the family relations in the tcb. Another task 
- * calling wait() will then clean up.
+ * Thus we need to keep the family relations in the tcb. The reaper frees
+ * the thread once it is off its stack, unless it is the last one of its
+ * process, which another task calling wait() will then clean up.
  *
  * Since we are not supposed to run anymore we are removed from all the 
  * lists, remaining only in the tasks internal thread family.
@@ -433,16 +561,45 @@ int vanish_thread(void) {
 	process_t *task = self->process;
 	if (task == NULL) return ERR_NO_PROCESS;
 	task->threads -= 1;
+	cputime_vanish(self);
+
+	// Lookups don't find us anymore, @see thrhash.c
+	thrhash_unlink(self);
+
+	// Give our bandwidth back, and unpin the process
+	if (edf_member(self)) edf_set(self, 0, 0, 0);
 
 	return 0;
 }
 
+/**
+ * @brief Takes a thread out of the family of its process, if it is still
+ * in it. We must be in a dont_switch_me_out area.
+ *
+ * @param thread the thread
+ */
+void leave_family(thread_t *thread) {
+
+	// Get the process of the thread
+	process_t *task = thread->process;
+
+	// Update the family relations
+	thread_t *older = thread->older_sibling;
+	thread_t *younger = thread->younger_sibling;
+	if (older) older->younger_sibling = younger;
+	if (younger) younger->older_sibling = older;
+	else if (task && task->youngest_thread == thread)
+		task->youngest_thread = older;
+
+	thread->older_sibling = NULL;
+	thread->younger_sibling = NULL;
+}
+
 /**
  * @brief Destroyes a thread completely
  *
  * This function takes care of cleaning up after a vanished thread.
- * We free the kernel stack of the given thread, remove him from the list 
- * of threads of the process and remove him from the hash table.
+ * We remove him from the list of threads of the process, then free him.
  *
  * This functions is thus called by another thread.
  * 
@@ -454,47 +611,48 @@ int destroy_thread(thread_t *thread) {
 	// Verify the thread pointer
 	if (thread == NULL) return ERR_ARG_NULL;
 
-	// Get the process of the thread
-	process_t *task = thread->process;
+	dont_switch_me_out();
+	leave_family(thread);
+	you_can_switch_me_out_now();
 
-	// Update the family relations
-	thread_t *older = thread->older_sibling;
-	thread_t *younger = thread->younger_sibling;
-	if (older) older->younger_sibling = thread->younger_sibling;
-	if (younger) younger->older_sibling = thread->older_sibling;
-	else if (task) task->youngest_thread = thread->older_sibling;
+	free_thread(thread);
+	return 0;
+}
 
-	thread->older_sibling = NULL;
-	thread->younger_sibling = NULL;
+/**
+ * @brief Frees a thread out of the family of its process
+ *
+ * We free the kernel stack of the given thread and remove him from the
+ * table of all threads. The thread must not run on its stack anymore. The
+ * control block is only freed once nobody holds it anymore.
+ *
+ * @param thread the thread to free
+ */
+void free_thread(thread_t *thread) {
+
+	// Holders found the thread before it left the table
+	dont_switch_me_out();
+	while (thread->holds > 0) {
+		you_can_switch_me_out_now();
+		_sleep(1);
+		dont_switch_me_out();
+	}
+	you_can_switch_me_out_now();
+
+	// The FPU registers of a dead thread are lost
+	fpu_drop(thread);
 
 	// remove the kernel stack here	
 	void *stack = (void*)(thread->esp0
 			- THREAD_KERNEL_SIZE*PAGE_SIZE + sizeof(uint32_t));
-	sfree(stack, THREAD_KERNEL_SIZE*PAGE_SIZE);
+	objcache_free(&kstack_cache, stack);
 
-	// remove the thread frm the hash table and free remaining resources
-	rwlock_lock(&hash_lock, RWLOCK_WRITE);
+	// remove the thread frm the thread table and free remaining resources
 	thrhash_remove(thread);
-	rwlock_unlock(&hash_lock);
-	free(thread);
-
-	return 0;
+	objcache_free(&thread_cache, thread);
 }
 
 
-/**
- * @breif returns the next thread ID atomically
- * @return next available thread ID
- */
-unsigned int next_tid(void) {
-
-	mutex_lock(&tid_lock);
-	unsigned int new_tid = tid++;
-	mutex_unlock(&tid_lock);
-
-	return new_tid;
-}
-
 /**
  * @brief Sets up the idle thread
  *
@@ -510,7 +668,10 @@ unsigned int next_tid(void) {
 int set_idle(thread_t *idle) {
 	
 	if (idle == NULL) return ERR_ARG_NULL;
-	idle_thread = idle;
+	// Idle runs on the bootstrap processor
+	get_cpu(0)->idle = idle;
+	idle->cpu = 0;
+	idle->process->cpu = 0;
 
 	// Remove all family relations
 	process_t *process = idle->process;
@@ -541,10 +702,10 @@ int set_init(thread_t *init) {
 }
 
 /**
- * @return returns the idle thread
+ * @return returns the idle thread of the calling CPU
  */
 thread_t *idle(void) {
-	return idle_thread;
+	return this_cpu()->idle;
 }
 
 /**
@@ -557,10 +718,26 @@ thread_t *init(void) {
 /**
  * @breif Verifies if the given thread is the idle thread.
  *
+ * An idle thread never leaves its CPU, so we only look at that one.
+ *
  * @param thread a thread suspicious of being idle
- * @return Returns wether the given thread is the idle thread
+ * @return Returns wether the given thread is the idle thread of a CPU
  */
 int is_idle(thread_t *thread) {
-	return (thread == idle_thread);
+	cpu_t *cpu = get_cpu(thread->cpu);
+	return (cpu != NULL && thread == cpu->idle);
+}
+
+/**
+ * @brief Tells whether the calling CPU may run a thread
+ *
+ * A thread only runs on the CPU of its process (@see sched.c). The caller
+ * must not be switched out.
+ *
+ * @param thread the thread we would like to switch to
+ * @return TRUE if the thread belongs to a process of the calling CPU
+ */
+boolean_t is_local(thread_t *thread) {
+	return thread->process->cpu == cpu_id();
 }
 
@@ -3,72 +3,177 @@
  * @author Daniel Balle (dballe)
  * @author Loic Ottet (lottet)
  *
- * @brief Hash table containing all living threads
+ * @brief Table of all living threads, indexed by thread id
+ *
+ * The table has two levels: a static root of leaf pointers, and leaves of
+ * thread pointers each filling a page. The slot of a thread is found
+ * directly from its id, with no hashing and no chains.
+ *
+ * The table also hands out the thread ids. They increase as long as the
+ * leaves allocated are at least half in use; once they run out of ids past
+ * the last one handed out, a new leaf is added. When less than half are in
+ * use, the ids start over from the lowest one and skip the slots still
+ * taken. The table thus grows with the number of threads alive, and not
+ * with the number of threads ever created.
+ *
+ * Lookups take no lock. The leaves are zeroed before they are linked in
+ * the root and are never freed, and the slots are written in a single
+ * store, so a lookup always finds either NULL or a thread whose control
+ * block was set up before it was added. The writers, which create and
+ * destroy threads, serialize on table_lock.
+ *
+ * Only the leaves are never freed, the control blocks are once their
+ * threads are dead (@see reaper.c). A vanishing thread leaves the table in
+ * the dont_switch_me_out area in which it leaves the CPU for good (@see
+ * thrhash_unlink), and its id is only handed out again once its control
+ * block is freed. A lookup made in a dont_switch_me_out area thus finds live
+ * threads only, which stay alive until the area ends. A control block used
+ * past the area must be held (@see hold_thread).
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errors.h>
 #include <thrhash.h>
 #include <thread.h>
 
-/* A table of threads */
-static thread_t *table[HASH_ENTRIES] = { NULL };
+/* Marks the slot of a thread id handed out but whose thread isn't added */
+#define TID_RESERVED ((thread_t *) 1)
+
+/* Keeps the compiler from moving memory accesses across it */
+#define BARRIER() asm volatile ("" : : : "memory")
+
+/* The leaves of the table, allocated in order */
+static thread_t ** volatile root[TIDTAB_LEAVES] = { NULL };
+static unsigned int num_leaves = 0;
+
+/* The next id to try and the number of slots taken */
+static unsigned int next = THREAD_INITIAL_TID;
+static unsigned int taken = 0;
+
+/* Serializes the writers */
+static mutex_t table_lock;
 
 /**
- * @brief Add a thread to the hash table
- * @param thr the thread to add
+ * @brief Initializes the table, empty
  */
-void thrhash_add(thread_t *thr) {
-	unsigned int entry = thrhash_entry(thr->tid);
+void thrhash_init(void) {
+	mutex_init(&table_lock);
+}
 
-	thr->hash_prev = NULL;
-	thr->hash_next = table[entry];
+/**
+ * @brief Adds a leaf to the table. table_lock must be held.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int grow_table(void) {
+	if (num_leaves == TIDTAB_LEAVES) return ERR_MALLOC_FAIL;
 
-	if (table[entry] != NULL) {
-		table[entry]->hash_prev = thr;
-	}
-	table[entry] = thr;	
+	thread_t **leaf = smemalign(PAGE_SIZE, PAGE_SIZE);
+	if (leaf == NULL) return ERR_MALLOC_FAIL;
+	memset(leaf, 0, PAGE_SIZE);
+
+	// Readers must see the leaf zeroed once they can see it
+	BARRIER();
+	root[num_leaves++] = leaf;
+	return 0;
 }
 
 /**
- * @brief Removes a thread from the hash table
- * @param thr the thread to remove
+ * @brief Hands out a thread id, whose slot is reserved until the thread is
+ * added
+ *
+ * @return the thread id, a negative error code if memory ran out
  */
-void thrhash_remove(thread_t *thr) {
-	unsigned int entry = thrhash_entry(thr->tid);
+int thrhash_reserve(void) {
+	mutex_lock(&table_lock);
 
-	// If we have a predecessor
-	if (thr->hash_prev != NULL)
-		thr->hash_prev->hash_next = thr->hash_next;
-	else table[entry] = thr->hash_next;
+	unsigned int capacity = num_leaves * TIDTAB_LEAF_ENTRIES;
+	for (;;) {
+		if (next >= capacity) {
+			unsigned int usable = (capacity > THREAD_INITIAL_TID) ?
+				capacity - THREAD_INITIAL_TID : 0;
 
-	// If we have a successor
-	if (thr->hash_next != NULL)
-		thr->hash_next->hash_prev = thr->hash_prev;
+			if (taken >= usable / 2 && grow_table() == 0) {
+				capacity += TIDTAB_LEAF_ENTRIES;
+			} else if (taken < usable) {
+				// Start over, there must be a free slot on the way
+				next = THREAD_INITIAL_TID;
+			} else {
+				mutex_unlock(&table_lock);
+				return ERR_MALLOC_FAIL;
+			}
+			continue;
+		}
+
+		thread_t **slot = &root[next / TIDTAB_LEAF_ENTRIES]
+			[next % TIDTAB_LEAF_ENTRIES];
+		if (*slot == NULL) {
+			*slot = TID_RESERVED;
+			taken++;
+			break;
+		}
+		next++;
+	}
 
-	thr->hash_next = NULL;
-	thr->hash_prev = NULL;
+	int tid = next++;
+	mutex_unlock(&table_lock);
+	return tid;
 }
 
 /**
- * @brief Search for a thread given his tid
- * @param the thread on sucess, NULL otherwise
+ * @brief Add a thread to the table, at the slot reserved for its id
+ *
+ * @param thr the thread to add, completely set up
  */
-thread_t *thrhash_find(unsigned int tid) {
-	unsigned int entry = thrhash_entry(tid);
+void thrhash_add(thread_t *thr) {
+	thread_t **leaf = root[thr->tid / TIDTAB_LEAF_ENTRIES];
 
-	thread_t *current = table[entry];
+	// Readers must see the thread set up once they can see it
+	BARRIER();
+	leaf[thr->tid % TIDTAB_LEAF_ENTRIES] = thr;
+}
 
-	while (current != NULL && current->tid != tid) {
-		current = current->hash_next;
-	}
+/**
+ * @brief Removes a thread from the table, its id can be handed out again
+ *
+ * This also releases the id of a thread which was never added.
+ *
+ * @param thr the thread to remove
+ */
+void thrhash_remove(thread_t *thr) {
+	mutex_lock(&table_lock);
+	root[thr->tid / TIDTAB_LEAF_ENTRIES][thr->tid % TIDTAB_LEAF_ENTRIES] =
+		NULL;
+	taken--;
+	mutex_unlock(&table_lock);
+}
 
-	return current;
+/**
+ * @brief Takes a vanishing thread out of the lookups, its id staying taken
+ * until thrhash_remove
+ *
+ * A single store, which takes no lock: we are in the dont_switch_me_out
+ * area in which the thread leaves the CPU for good.
+ *
+ * @param thr the thread to take out
+ */
+void thrhash_unlink(thread_t *thr) {
+	root[thr->tid / TIDTAB_LEAF_ENTRIES][thr->tid % TIDTAB_LEAF_ENTRIES] =
+		TID_RESERVED;
 }
 
 /**
- * @brief The hash function
- * @return the hash for the given tid
+ * @brief Search for a thread given his tid, without locking
+ * @return the thread on sucess, NULL otherwise
  */
-unsigned int thrhash_entry(unsigned int tid) {
-	return tid % HASH_ENTRIES;
+thread_t *thrhash_find(unsigned int tid) {
+	if (tid >= TIDTAB_MAX_TID) return NULL;
+
+	thread_t **leaf = root[tid / TIDTAB_LEAF_ENTRIES];
+	if (leaf == NULL) return NULL;
+
+	thread_t *thr = ((thread_t * volatile *) leaf)[tid % TIDTAB_LEAF_ENTRIES];
+	return (thr == TID_RESERVED) ? NULL : thr;
 }
@@ -0,0 +1,195 @@
+/**
+ * @file trace.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief The trace of the scheduler
+ *
+ * While tracing is on, stack_switch records every context switch and
+ * set_runnable every wakeup, in a ring of the CPU they happen on. The reason
+ * of a switch is told by the state the thread switched out is left in:
+ * sleeping, waiting, blocked or dead. A runnable thread is switched out by
+ * the timer, by a yield or to hand its CPU over, which the callers tell
+ * beforehand (@see trace_hint_switch). Likewise the state of a thread woken
+ * up tells who did it, except for make_runnable (@see trace_hint_wake).
+ *
+ * The rings are shared with the profiler (@see recring.c): the CPU is the
+ * only one adding to its ring, with interrupts off, and the drains are
+ * serialized by a mutex.
+ */
+
+#include <types.h>
+#include <interrupts.h>
+#include <cpu.h>
+#include <clock.h>
+#include <sched.h>
+#include <recring.h>
+#include <trace.h>
+
+/* No hint given */
+#define TRACE_NO_HINT -1
+
+/**
+ * The hints of a CPU
+ */
+typedef struct trace_hints {
+	int switch_hint;
+	int wake_hint;
+} trace_hints_t;
+
+static sched_event_t events[CPU_MAX * SCHED_TRACE_SIZE];
+static recring_t rings;
+static trace_hints_t hints[CPU_MAX];
+
+/**
+ * @brief Initializes the trace, off
+ */
+void trace_init(void) {
+	recring_init(&rings, events, sizeof(sched_event_t), SCHED_TRACE_SIZE);
+
+	int i;
+	for (i = 0; i < CPU_MAX; ++i) {
+		hints[i].switch_hint = TRACE_NO_HINT;
+		hints[i].wake_hint = TRACE_NO_HINT;
+	}
+}
+
+/**
+ * @brief Records an event on the calling CPU, if tracing is on
+ */
+static void record(int type, int reason, int tid, int other) {
+	if (!rings.on) return;
+
+	uint32_t eflags = save_disable_interrupts();
+	cpu_t *cpu = this_cpu();
+
+	sched_event_t *ev = recring_reserve(&rings, cpu->id);
+	if (ev != NULL) {
+		ev->tsc = rdtsc();
+		ev->type = type;
+		ev->reason = reason;
+		ev->cpu = cpu->id;
+		ev->tid = tid;
+		ev->other = other;
+
+		recring_commit(&rings, cpu->id);
+	}
+
+	restore_interrupts(eflags);
+}
+
+/**
+ * @brief Tells why the calling thread, runnable, is about to be switched
+ * out. The caller must not be switched out.
+ *
+ * @param reason SCHED_SWITCH_TICK, SCHED_SWITCH_YIELD or
+ * SCHED_SWITCH_HANDOFF
+ */
+void trace_hint_switch(int reason) {
+	if (rings.on) hints[this_cpu()->id].switch_hint = reason;
+}
+
+/**
+ * @brief Tells who is about to wake a thread up, when its state doesn't.
+ * The caller must not be switched out.
+ *
+ * @param source SCHED_WAKE_MAKE_RUNNABLE
+ */
+void trace_hint_wake(int source) {
+	if (rings.on) hints[this_cpu()->id].wake_hint = source;
+}
+
+/**
+ * @brief Records a context switch, called by stack_switch with interrupts
+ * off
+ */
+void trace_switch(thread_t *self, thread_t *other) {
+	trace_hints_t *hint_of = &hints[this_cpu()->id];
+	int hint = hint_of->switch_hint;
+	hint_of->switch_hint = TRACE_NO_HINT;
+	if (!rings.on) return;
+
+	int reason;
+	if (is_idle(self)) {
+		reason = SCHED_SWITCH_IDLE;
+	} else {
+		switch (self->state) {
+		case THR_RUNNING:
+			reason = (hint != TRACE_NO_HINT) ? hint : SCHED_SWITCH_HANDOFF;
+			break;
+		case THR_BLOCKED:
+			reason = SCHED_SWITCH_BLOCK;
+			break;
+		case THR_SLEEPING:
+			reason = SCHED_SWITCH_SLEEP;
+			break;
+		case THR_WAITING:
+			reason = SCHED_SWITCH_WAIT;
+			break;
+		default:
+			reason = SCHED_SWITCH_VANISH;
+			break;
+		}
+	}
+
+	record(SCHED_EV_SWITCH, reason, self->tid, other->tid);
+}
+
+/**
+ * @brief Records a thread made runnable, called by set_runnable
+ *
+ * @param thread the thread
+ * @param previous its state before, nothing is recorded unless it waited
+ */
+void trace_wakeup(thread_t *thread, thrstate_t previous) {
+	trace_hints_t *hint_of = &hints[this_cpu()->id];
+	int hint = hint_of->wake_hint;
+	hint_of->wake_hint = TRACE_NO_HINT;
+	if (!rings.on) return;
+
+	int source;
+	int waker = get_self()->tid;
+	switch (previous) {
+	case THR_SLEEPING:
+		source = SCHED_WAKE_TIMER;
+		waker = -1;
+		break;
+	case THR_WAITING:
+		source = SCHED_WAKE_CHILD;
+		break;
+	case THR_BLOCKED:
+		source = (hint != TRACE_NO_HINT) ? hint : SCHED_WAKE_OTHER;
+		break;
+	default:
+		return;
+	}
+
+	record(SCHED_EV_WAKEUP, source, thread->tid, waker);
+}
+
+/**
+ * @brief Forgets the events recorded so far and turns tracing on
+ */
+void trace_start(void) {
+	recring_start(&rings);
+}
+
+/**
+ * @brief Turns tracing off, the events stay until drained
+ * @return the number of events dropped since it started
+ */
+int trace_stop(void) {
+	return recring_stop(&rings);
+}
+
+/**
+ * @brief Copies events out to user memory, the oldest of each CPU first
+ *
+ * @param buf the user buffer
+ * @param max the number of events it can hold
+ * @return the number of events copied, a negative error code if buf is
+ * invalid
+ */
+int trace_drain(sched_event_t *buf, int max) {
+	return recring_drain(&rings, buf, max);
+}
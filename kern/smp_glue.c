@@ -1,58 +1,184 @@
-/*
- *
- *    #####          #######         #######         ######            ###
- *   #     #            #            #     #         #     #           ###
- *   #                  #            #     #         #     #           ###
- *    #####             #            #     #         ######             #
- *         #            #            #     #         #
- *   #     #            #            #     #         #                 ###
- *    #####             #            #######         #                 ###
- *
- *   This file is included for completeness (having a tss_desc_create()
- *   function is necessary to link against libsmp) but YOU ARE NOT EXPECTED
- *   TO ACTUALLY USE IT unless it is the Spring semester of 2012.  JUST 
- *   PRETEND YOU NEVER SAW IT HERE.  If you have any questions about why
- *   it is here, DELETE IT BEFORE ASKING, at which point you will be asking
- *   a question about a file that does not exist, which is unlikely to be
- *   productive.  Fnord.
- *
- */
-
-
-
-
-
-
-/*
- *
- *    #####          #######         #######         ######            ###
- *   #     #            #            #     #         #     #           ###
- *   #                  #            #     #         #     #           ###
- *    #####             #            #     #         ######             #
- *         #            #            #     #         #
- *   #     #            #            #     #         #                 ###
- *    #####             #            #######         #                 ###
+/**
+ * @file smp_glue.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
  *
+ * @brief Bring-up of the application processors
  *
- *   This file NEEDS WORK or SHOULD BE DELETED (your choice).
+ * Once the idle program runs on the bootstrap processor, smp_start() gives
+ * each application processor (AP) an idle thread of its own and lets
+ * libsmp wake them up. Each AP then enters ap_main(), turns paging on with
+ * the page directory of its idle process, loads the IDT, its GDT and its
+ * TSS (@see cpu.c), and switches to its idle thread.
  *
- *   You are responsible for making tss_desc_create() work in accordance
- *   with the specification provided in the handout.  Your implementation
- *   can live in this smp_glue.c file or elsewhere, as you choose.
+ * The idle thread of an AP never leaves the kernel, it polls the run queue
+ * of the CPU (@see sched.c) and switches to whoever shows up there, or
+ * steals a process from a busier CPU. Its
+ * process only maps the kernel, so that the page directories of user
+ * processes are never loaded on two CPUs at once.
  *
- *   If you wish, you can add an AP entry-point function to this file, also
- *   in accordance with the documentation found in the handout.
+ * Each AP ticks on the timer of its local APIC, at the rate of the
+ * bootstrap processor (@see timer.c), so that the threads it runs are
+ * preempted when their quantum is over.
  *
+ * @bugs Without a local APIC timer, the threads of the APs run until they
+ * block, yield or vanish.
  */
 
 #include <smp.h>
 #include <stdlib.h>
+#include <x86/cr.h>
+#include <x86/asm.h>
+
+#include <cpu.h>
+#include <sched.h>
+#include <thread.h>
+#include <process.h>
+#include <context.h>
+#include <drivers.h>
+#include <errors.h>
+#include <inc/syscall.h>
+#include <page.h>
+
+/* Number of gates in the IDT */
+#define IDT_ENTRIES 256
+/* Rounds an idle AP waits after a failed steal before trying again */
+#define AP_STEAL_BACKOFF 1000
 
+/* The operand of lidt */
+typedef struct {
+	uint16_t	limit;
+	uint32_t	base;
+} __attribute__((packed)) idtr_t;
+
+/**
+ * @brief Creates a TSS descriptor
+ *
+ * The descriptor is that of an available 32-bit TSS, present and of
+ * privilege level 0.
+ *
+ * @param tss the task state segment
+ * @param tss_size its size in bytes
+ * @return the GDT descriptor of the segment
+ */
 uint64_t
 tss_desc_create(void *tss, size_t tss_size)
 {
+	uint64_t base = (uint32_t) tss;
+	uint64_t limit = tss_size - 1;
 	uint64_t seg = 0LL;
-	(void) tss_size;
-	panic(__FILE__);
+
+	seg |= limit & 0xFFFF;
+	seg |= (base & 0xFFFFFF) << 16;
+	seg |= 0x89LL << 40;				// Present, DPL 0, 32-bit TSS
+	seg |= ((limit >> 16) & 0xF) << 48;	// Byte granularity
+	seg |= ((base >> 24) & 0xFF) << 56;
+
 	return seg;
 }
+
+/**
+ * @brief The idle thread of an application processor
+ *
+ * We run whatever the scheduler has for us, or steal from a busier CPU,
+ * and come back here whenever nobody else can run.
+ */
+static void ap_idle(void *arg) {
+	thread_t *self = get_self();
+	cpu_set_online();
+
+	int backoff = 0;
+	for (;;) {
+		// Peek first, so that we keep off the scheduler lock while idle
+		if (backoff > 0) backoff--;
+		if (num_runnable() == 0 && (backoff > 0 || !sched_can_steal())) {
+			asm volatile ("pause");
+			continue;
+		}
+
+		dont_switch_me_out();
+		if (num_runnable() == 0 && !sched_steal()) {
+			// Nothing we may take, don't ask again right away, and zero
+			// frames in advance meanwhile
+			you_can_switch_me_out_now();
+			backoff = AP_STEAL_BACKOFF;
+			queue_refill();
+			continue;
+		}
+
+		thread_t *other = get_running();
+		if (other != NULL) {
+			unset_state(self);
+			context_switch(self, other);
+		} else you_can_switch_me_out_now();
+	}
+}
+
+/**
+ * @brief Creates the idle thread of an application processor
+ * @return the idle thread, NULL on failure
+ */
+static thread_t *create_ap_idle(int id) {
+	process_t *process = create_process();
+	if (process == NULL) return NULL;
+	process->cpu = id;
+
+	thread_t *thread = create_thread(process);
+	if (thread == NULL) {
+		destroy_process(process);
+		return NULL;
+	}
+
+	thread->cpu = id;
+	entry_stack(thread, ap_idle, NULL);
+	return thread;
+}
+
+/**
+ * @brief Starts the application processors
+ *
+ * A CPU whose idle thread we cannot create is simply left asleep.
+ */
+void smp_start(void) {
+	int n = smp_num_cpus();
+	if (n > CPU_MAX) n = CPU_MAX;
+	if (n <= 1) return;
+
+	// The APs stay offline, out of the scheduler, until they are idle
+	cpu_enable_smp(n);
+
+	int id;
+	for (id = 1; id < n; ++id) get_cpu(id)->idle = create_ap_idle(id);
+
+	smp_boot(ap_main);
+}
+
+/**
+ * @brief Entry point of the application processors
+ * @param id the id of the CPU
+ */
+void ap_main(int id) {
+	cpu_t *cpu = get_cpu(id);
+	if (cpu == NULL || cpu->idle == NULL) {
+		for (;;) asm volatile ("cli; hlt");
+	}
+
+	// The kernel is mapped with global 4MB pages @see create_god_process
+	set_cr3((uint32_t) cpu->idle->process->cr3);
+	set_cr4(get_cr4() | CR4_PSE | CR4_PGE);
+	set_cr0(get_cr0() | CR0_PG | CR0_WP);
+
+	idtr_t idtr;
+	idtr.limit = IDT_ENTRIES * sizeof(uint64_t) - 1;
+	idtr.base = (uint32_t) idt_base();
+	asm volatile ("lidt %0" : : "m" (idtr));
+
+	cpu_init(id);
+	install_sysenter();
+	timer_start_ap();
+
+	// Our boot context is never resumed
+	dont_switch_me_out();
+	context_switch(&cpu->boot, cpu->idle);
+	kernel_panic("CPU %d left its idle thread", id);
+}
@@ -4,11 +4,12 @@
  * @author Daniel Balle (dballe)
  * 
  * This file contains the syscalls related to input and output to and from the
- * console. Both are protected by a mutex, preventing multiple threads from
- * writing to the console at the same time, and from reading characters from
- * the input stream at the same time.
- * 
- * @bugs getchar() not implemented
+ * console. Each process uses one of the virtual terminals, that of its
+ * parent unless it attaches to another. Reading is protected by a mutex per
+ * terminal, preventing multiple threads from reading characters from the
+ * input stream of a terminal at the same time. print queues the string for
+ * the console drain (@see conring.c), and the others wait for what is
+ * queued to be on the terminal and take it.
  */
 
 #include <simics.h>
@@ -17,110 +18,114 @@
 #include <drivers.h>
 #include <types.h>
 #include <malloc.h>
+#include <slab.h>
 #include <lock.h>
 #include <errors.h>
 #include <syshelper.h>
+#include <usercopy.h>
+#include <vterm.h>
+#include <thread.h>
+#include <process.h>
 
-// Ensures that the prompt belongs to only one thread
-static mutex_t input_mutex;
-// Ensures that prints are not interleaved
-static mutex_t output_mutex;
+// Ensures that the prompt of a terminal belongs to only one thread
+static mutex_t input_mutex[NUM_TERMINALS];
 
 /**
  * @brief Initializes the driver mutexes
  */
 void init_syscall_mutexes() {
-	mutex_init(&input_mutex);
-	mutex_init(&output_mutex);
+	int i;
+	for (i = 0; i < NUM_TERMINALS; i++) mutex_init(&input_mutex[i]);
+	conring_init();
 }
 
 /**
- * @brief Not implemented
+ * @brief Returns the terminal of the calling process
  */
-char _getchar() {
-	lprintf("Getchar: feature not implemented");
-	return -1;
+static int own_terminal(void) {
+	return get_self()->process->terminal;
+}
+
+/**
+ * @brief Returns the next character of a completed line, without blocking
+ *
+ * @return the character, -1 if there is none or a thread waits in readline
+ */
+int _getchar() {
+	return keyboard_getchar(own_terminal());
 }
 
 /**
  * @brief Tries to read a line from the keyboard
  * 
  * If no '\n' terminated line of text is available at the moment, the thread
- * blocks (in readchar) and waits for a new character to be entered by the
- * user.
+ * blocks until the line discipline has one, or has as many characters as
+ * the buffer holds (@see keyboard.c). The characters were echoed as they
+ * were typed, on the terminal they were typed on.
  */
 int _readline(void** args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;
-	int size = (int) args[0];
-	char *buf = (char*) args[1];
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	int size = (int) kargs[0];
+	char *buf = (char*) kargs[1];
 
-	if (!check_buffer(buf, size, TRUE)) return ERR_INVALID_ARG;
 	if (size < 0 || size > MAX_LINE_LENGTH) return ERR_INVALID_ARG;
+	if (!user_range(buf, size)) return ERR_INVALID_ARG;
 
-	char *line_buf = smalloc(size * sizeof(char));
+	char *line_buf = kmalloc(size * sizeof(char));
 	if (line_buf == NULL) return ERR_MALLOC_FAIL;
 
 	// We get in queue
-	mutex_lock(&input_mutex);
-
-	int i;
-	boolean_t done = FALSE;
-	int cursor = 0;
-	for(i = 0; i < size && !done; ++i) {
-		char c = readchar();
-		
-		if (c != '\b' || cursor != 0) {
-			putbyte(c);
-		}
-
-		switch(c) {
-			case '\n':
-				// Copy and return the buffer
-				line_buf[cursor++] = c;
-				strncpy(buf, line_buf, i + 1);
-				done = TRUE;
-			case '\b':
-				if (cursor > 0) {
-					line_buf[cursor--] = 0;
-				}
-			case -1:
-				break;
-			default:
-				line_buf[cursor++] = c;
-		}
-	}
+	int term = own_terminal();
+	mutex_lock(&input_mutex[term]);
+	int read = keyboard_readline(term, line_buf, size);
+	mutex_unlock(&input_mutex[term]);
 
-	mutex_unlock(&input_mutex);
+	int err = copy_to_user(buf, line_buf, read);
+	kfree(line_buf, size * sizeof(char));
 
-	sfree(line_buf, size * sizeof(char));
-
-	return i;
+	return err ? ERR_INVALID_ARG : read;
 }
 
 /**
- * @brief Prints the given string into the console
+ * @brief Queues the given string for the terminal of the process
+ *
+ * It returns once the string is queued, which only blocks while the ring is
+ * full. An empty string is a flush: it returns once everything printed
+ * before is on the terminal.
  */
 int _print(void **args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;
-	int size = (int) args[0];
-	char *buf = (char*) args[1];
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	int size = (int) kargs[0];
+	char *buf = (char*) kargs[1];
 
-	if (!check_buffer(buf, size, FALSE)) return ERR_INVALID_ARG;
+	if (size < 0 || !user_range(buf, size)) return ERR_INVALID_ARG;
 
-	mutex_lock(&output_mutex);
-	putbytes(buf, size);
-	mutex_unlock(&output_mutex);
+	if (size == 0) {
+		conring_flush(own_terminal());
+		return 0;
+	}
 
-	return 0;
+	return conring_write(own_terminal(), buf, size);
 }
 
 /**
- * @brief Sets the terminal font and background color
+ * @brief Sets the terminal font and background color, or the terminal of
+ * the process with TERM_ATTACH
  */
 int _set_term_color(int color) {
-	mutex_lock(&output_mutex);
-	int err = set_term_color(color);
-	mutex_unlock(&output_mutex);
+	if (color & TERM_ATTACH) {
+		int term = color & ~TERM_ATTACH;
+		if (term < 0 || term >= NUM_TERMINALS) return ERR_INVALID_ARG;
+		get_self()->process->terminal = term;
+		return 0;
+	}
+
+	int term = own_terminal();
+	console_lock(term);
+	int err = term_set_color(term, color);
+	console_unlock(term);
 	return err;
 }
 
@@ -128,16 +133,17 @@ int _set_term_color(int color) {
  * @brief Puts the current cursor position in the given pointers
  */
 int _get_cursor_pos(int **args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;	
-	int *row = args[0];
-	int *col = args[1];
-
-	if (!check_page((uint32_t)row, TRUE)) return ERR_INVALID_ARG;
-	if (!check_page((uint32_t)col, TRUE)) return ERR_INVALID_ARG;
-	
-	mutex_lock(&output_mutex);
-	get_cursor(row, col);
-	mutex_unlock(&output_mutex);
+	int *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	int row, col;
+	int term = own_terminal();
+	console_lock(term);
+	term_get_cursor(term, &row, &col);
+	console_unlock(term);
+
+	if (copy_to_user(kargs[0], &row, sizeof(int))) return ERR_INVALID_ARG;
+	if (copy_to_user(kargs[1], &col, sizeof(int))) return ERR_INVALID_ARG;
 	return 0;
 }
 
@@ -145,13 +151,15 @@ int _get_cursor_pos(int **args) {
  * @brief Sets the console cursor position to the given values
  */
 int _set_cursor_pos(int *args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;
-	int row = args[0];
-	int col = args[1];
-
-	mutex_lock(&output_mutex);
-	int err = set_cursor(row, col);
-	mutex_unlock(&output_mutex);
+	int kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	int row = kargs[0];
+	int col = kargs[1];
+
+	int term = own_terminal();
+	console_lock(term);
+	int err = term_set_cursor(term, row, col);
+	console_unlock(term);
 
 	return err;
 }
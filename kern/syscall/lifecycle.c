@@ -27,111 +27,207 @@
 #include <errors.h>
 #include <syshelper.h>
 #include <context.h>
+#include <kthread.h>
+#include <image.h>
+#include <usercopy.h>
+#include <shm.h>
+#include <cpu.h>
+#include <slab.h>
+#include <reaper.h>
+#include <ksm.h>
+#include <reclaim.h>
+#include <wss.h>
+#include <fpu.h>
+#include <sysstat.h>
+#include <cputime.h>
+#include <growstack.h>
+#include <message.h>
+#include <boottime.h>
 
 /**
- * @brief Loads a user program
- *
- * We read the program data from the "RAM disk" image included in the 
- * kernel executable binary and load the data into the tasks address 
- * space.
- *
- * We use the provided execname to determine if the idle or init thread is 
- * being loaded and update the corresponding pointers required by our 
- * kernel in the future at the end of the function.
- *
- * To read the program data we use the exec2obj utility which will also be 
- * in charge of validating the header and providing a simple ELF header 
- * with information about each section.
- *
- * We first initialize the stack area of the new program with the provided 
- * arguments and reset the previous paging which we inherited during the 
- * fork call.
+ * @brief Frees arguments saved by save_args
+ */
+static void free_args(char **karg, int num_args) {
+	int i;
+	for (i = 0; i < num_args; ++i) kfree(karg[i], strlen(karg[i]) + 1);
+	kfree(karg, (num_args + 1) * sizeof(char*));
+}
+
+/**
+ * @brief Saves the argument strings of a program in kernel memory
  *
- * Then we iteratate over the simple ELF header and create pages for each 
- * section and copy the data from the exec2obj file into that page.
+ * The arguments have to survive the paging reset of exec, or the switch to
+ * the address space of a spawned child. They are stored in reverse order.
+ * The vector and the strings are read with the user copy routines, a bad
+ * pointer anywhere makes the whole call fail.
  *
- * @param args the program arguments and the filename of the program
- * @return does not return on sucess, a negative error code otherwise
+ * @param argvec the null-terminated argument vector, in user space
+ * @param num_args placeholder for the number of arguments in argvec
+ * @param total_arg_length placeholder for the room the strings need
+ * @return the saved arguments, NULL on error
  */
-int _exec(void **args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;
+static char **save_args(char **argvec, int *num_args, int *total_arg_length) {
+	// Count the arguments first, to store them in reverse order
+	char *arg = NULL;
+	int n = 0;
+	if (argvec != NULL) {
+		do {
+			if (copy_from_user(&arg, argvec + n, sizeof(char*)))
+				return NULL;
+		} while (arg != NULL && ++n <= MAX_ARGS);
+		if (n > MAX_ARGS) return NULL;
+	}
 
-	// Argument 1
-	char *execname = (char*) args[0];
-	if (!check_string(execname)) return ERR_INVALID_ARG;
-	boolean_t is_idle = (strcmp("idle", execname) == 0);
-	boolean_t is_init = (strcmp("init", execname) == 0);
+	char **karg = kzalloc((n + 1) * sizeof(char*));
+	char *scratch = malloc(STR_MAX_LEN);
+	if (karg == NULL || scratch == NULL) {
+		kfree(karg, (n + 1) * sizeof(char*));
+		free(scratch);
+		return NULL;
+	}
 
-	// Argument 2
-	char **argvec = (char**) args[1];
-	if (!check_string_array(argvec)) return ERR_INVALID_ARG;
+	*total_arg_length = 0;
+	int i;
+	for (i = 0; i < n; ++i) {
+		int arglen = -1;
+		if (!copy_from_user(&arg, argvec + n - i - 1, sizeof(char*)))
+			arglen = strncpy_from_user(scratch, arg, STR_MAX_LEN);
+		if (arglen >= 0) karg[i] = kmalloc(arglen + 1);
+		if (arglen < 0 || karg[i] == NULL) {
+
+			// Abort everyhting, the vector has room for n arguments
+			int j;
+			for (j = 0; j < i; ++j) kfree(karg[j], strlen(karg[j]) + 1);
+			kfree(karg, (n + 1) * sizeof(char*));
+			free(scratch);
+			return NULL;
+		}
 
-	// Verify that the ELF header is valid
-	if (elf_check_header(execname) != ELF_SUCCESS)
-		return ERR_ELF_INVALID;	
+		memcpy(karg[i], scratch, arglen + 1);
+		*total_arg_length += arglen + 2;
+	}
 
-	// Create the Simple ELF header
-	simple_elf_t *hdr = calloc(1, sizeof(simple_elf_t));
-	if (hdr == NULL) return ERR_CALLOC_FAIL;
+	free(scratch);
+	*num_args = n;
+	return karg;
+}
 
-	// Load the ELF header
-	if (elf_load_helper(hdr, execname) != ELF_SUCCESS) {
-		free(hdr);
-		return ERR_ELF_LOAD_FAIL;
+/**
+ * @brief Copies the name of a program into kernel memory
+ * @param execname the name in user space
+ * @return the name in a STR_MAX_LEN buffer, NULL on error
+ */
+static char *save_execname(char *execname) {
+	char *kname = malloc(STR_MAX_LEN);
+	if (kname == NULL) return NULL;
+	if (strncpy_from_user(kname, execname, STR_MAX_LEN) < 0) {
+		free(kname);
+		return NULL;
 	}
+	return kname;
+}
 
-	// Get the entry of the file in the exec2obj TOC
-	const exec2obj_userapp_TOC_entry *target = exec2obj_entry(execname);;
+/**
+ * @brief Loads the data and bss segments of a program in the current address
+ * space, from the exec2obj file
+ *
+ * @param image the image of the program
+ * @return 0 on success, a negative error code otherwise
+ */
+static int load_segments(image_t *image) {
+	simple_elf_t *hdr = &image->hdr;
+	int err;
+
+	// The source of the file content
+	unsigned int fs = (unsigned int) image->entry->execbytes;
+
+	// The data segment gets private frames, filled from the file
+	vaddr_t data_first = PAGE_ADDR(hdr->e_datstart);
+	vaddr_t data_end = data_first;
+	if (hdr->e_datlen > 0) {
+		data_end = PAGE_ADDR(hdr->e_datstart + hdr->e_datlen - 1) + PAGE_SIZE;
+		err = map_range(data_first, (data_end - data_first) / PAGE_SIZE,
+			MEM_TYPE_DATA);
+		if (err) return ERR_SEGMENT_PAGE_FAIL;
+		memcpy((void *) hdr->e_datstart, (void *) (fs + hdr->e_datoff),
+			hdr->e_datlen);
+	}
 
-	// fsource is the source of the file content
-	unsigned int fs = (unsigned int)target->execbytes;
+	// The bss is filled on demand, except where it shares a data page
+	if (hdr->e_bsslen > 0) {
+		vaddr_t bss_start = hdr->e_bssstart;
+		vaddr_t bss_end = hdr->e_bssstart + hdr->e_bsslen;
+		vaddr_t first = PAGE_ADDR(bss_start);
+		if (first >= data_first && first < data_end) {
+			// The frame is there already, zero the bss part of it
+			vaddr_t end = (bss_end < data_end) ? bss_end : data_end;
+			memset((void *) bss_start, 0, end - bss_start);
+			first = data_end;
+		}
+		vaddr_t last = PAGE_ADDR(bss_end - 1) + PAGE_SIZE;
+		if (first < last) {
+			err = map_range(first, (last - first) / PAGE_SIZE, MEM_TYPE_BSS);
+			if (err) return ERR_SEGMENT_PAGE_FAIL;
+		}
+	}
 
-	// We store the arguments to survive the paging reset
-	int num_args = string_array_length(argvec);
+	return 0;
+}
 
-	// Save the execname and the arguments in the kernel
-	char **karg = calloc(num_args, sizeof(char*));
-	int total_arg_length = 0;
+/**
+ * @brief Builds the user image of a program in the current address space
+ *
+ * The data and bss segments come from the template of the program, shared
+ * copy on write, when it has one, and are loaded from the exec2obj file
+ * otherwise (@see image_clone). The argument strings are then put above a
+ * fresh user stack on which the arguments of main are pushed, the top page of
+ * a stack region of STACK_MAIN_PAGES pages (@see growstack.c). The text and
+ * rodata are not loaded here: the process gets the shared image of the
+ * program and they are paged in from it on first touch (@see image.c). The
+ * address space is expected to hold no user pages. The saved arguments are
+ * freed, and the user stack pointer of the calling thread is updated.
+ *
+ * @param image the image of the program @see find_image
+ * @param karg the arguments saved by save_args
+ * @param num_args the number of arguments
+ * @param total_arg_length the room the argument strings need
+ * @return 0 on success, a negative error code otherwise
+ */
+static int load_image(image_t *image, char **karg, int num_args,
+		int total_arg_length) {
 	int i;
-	for (i = 0; i < num_args; ++i) {
-		char *arg = argvec[num_args - i - 1];
-		int arglen = strlen(arg) + 1;
-
-		karg[i] = calloc(arglen, sizeof(char));
-		if (karg[i] == NULL) {
-
-			// Abort everyhting
-			for(; i > 0; --i) free(karg[i]);
-			free(karg);
-			free(hdr);
-			return ERR_CREATE_USERSTACK_FAIL;
-		}
 
-		strncpy(karg[i], arg, arglen);
-		total_arg_length += arglen + 1;
-	}
+	get_self()->process->image = image;
 
-	// Reset the paging, only kernel pages are mapped now
-	reset_paging();
+	// The segments, before anything else so that a template holds them only
+	if (!image_clone(image)) {
+		int err = load_segments(image);
+		if (err) {
+			free_args(karg, num_args);
+			return err;
+		}
+		image_snapshot(image);
+	}
 
 	// Put the argument strings above the stack
 	int num_arg_pages = total_arg_length / PAGE_SIZE 
-		+ (total_arg_length % PAGE_SIZE == 0) ? 0:1;
+		+ ((total_arg_length % PAGE_SIZE == 0) ? 0 : 1);
 	vaddr_t va = PAGE_ADDR(-1);
-	for (i = 0; i < num_arg_pages; ++i) {
-		if (i > 0) va -= PAGE_SIZE;
-		int err = create_page(va, MEM_TYPE_RODATA, NULL);
-		if (err) return ERR_SAVE_ARGS_FAIL;
+	if (num_arg_pages > 0) va -= (num_arg_pages - 1) * PAGE_SIZE;
+	// Writable, as the C standard wants, and so the kernel can fill them
+	if (map_range(va, num_arg_pages, MEM_TYPE_DATA)) {
+		free_args(karg, num_args);
+		return ERR_SAVE_ARGS_FAIL;
 	}
 	vaddr_t bottom_argzone = va;
 
-	// Create user stack
+	// Create user stack, which grows down from under the arguments
 	uint32_t *esp3 = ((uint32_t *) va) - 1;
-	int err = create_page(PAGE_ADDR((uint32_t) esp3), MEM_TYPE_STACK, NULL);
+	int err = stack_create(get_self()->process,
+		va - STACK_MAIN_PAGES * PAGE_SIZE, STACK_MAIN_PAGES);
+	if (err == 0) err = prepare_write(PAGE_ADDR((uint32_t) esp3));
 	if (err) {	
-		for (i = 0; i < num_args; ++i) free(karg[i]);
-		free(karg);
-		free(hdr);
+		free_args(karg, num_args);
 		return ERR_CREATE_USERSTACK_FAIL;
 	}
 
@@ -142,9 +238,9 @@ int _exec(void **args) {
 		len = strlen(karg[i]) + 1;
 		strncpy((char*)va, karg[i], len);
 		*(esp3 - i) = va;
-		free(karg[i]);
+		kfree(karg[i], len);
 	}
-	free(karg);
+	kfree(karg, (num_args + 1) * sizeof(char*));
 
 	// Push the arguments
 	uint32_t *argbase = esp3 - num_args - 4;
@@ -152,84 +248,73 @@ int _exec(void **args) {
 	*(argbase + 3) = (uint32_t) esp3;
 	*(argbase + 2) = (uint32_t) (argbase + 5);
 	*(argbase + 1) = num_args;
-	get_running()->esp3 = (uint32_t) (argbase);
+	get_self()->esp3 = (uint32_t) (argbase);
 
-	/**
-	 * To avoid repeated code we iterate over a smaller structure which 
-	 * contains the length, offset and start, in the same order as the 
-	 * original structure of the simple elf header.
-	 *
-	 * Now we iterate over txt, data, rodata and bss segments
-	 */
-	simple_elf_seg_t *segs = (simple_elf_seg_t *)&(hdr->e_txtoff);	
-	mem_type_t type[4] = {MEM_TYPE_TEXT,
-			      MEM_TYPE_DATA,
-			      MEM_TYPE_RODATA,
-			      MEM_TYPE_BSS};
-
-
-
-	for (i = 0; i < 4; i++) {
-		// Create pages for the segment and load it
-		unsigned int copied = 0;
-		unsigned int length = 0;
-		if (type[i] == MEM_TYPE_BSS) length = hdr->e_bsslen;
-		else length = segs[i].len;
-		
-		while (copied < length) {
-
-			// Compute the next virtual address
-			vaddr_t va;
-			if (type[i] == MEM_TYPE_BSS)
-				va = hdr->e_bssstart + copied;
-			else va = segs[i].start + copied;
-	
-			/**
-			 * Find how much space we will have in the page,
-			 * since va might point inside a page.
-			 */
-			unsigned int space = PAGE_ADDR(va) + PAGE_SIZE-va;
-
-			boolean_t bss_page_created = FALSE;
-			
-			// Create the page for that virtual address
-			if (type[i] == MEM_TYPE_TEXT || type[i] == MEM_TYPE_DATA
-					|| (type[i] == MEM_TYPE_RODATA
-						&& (PAGE_ADDR(va) < PAGE_ADDR(hdr->e_txtstart)
-						|| PAGE_ADDR(va) > PAGE_ADDR(hdr->e_txtstart + hdr->e_txtlen)))
-					|| (type[i] == MEM_TYPE_BSS
-						&& (PAGE_ADDR(va) < PAGE_ADDR(hdr->e_datstart)
-						|| PAGE_ADDR(va) > PAGE_ADDR(hdr->e_datstart + hdr->e_datlen)))) {
-				// Create the page if it has not been created yet
-				int err = create_page(PAGE_ADDR(va), type[i], NULL);
-				if (err) return ERR_SEGMENT_PAGE_FAIL;
-				
-				if (type[i] == MEM_TYPE_BSS) {
-					bss_page_created = TRUE;
-				}
-			}
-
-			// Special case if are handeling bss
-			if (type[i] == MEM_TYPE_BSS) {
-				if (!bss_page_created) {
-					memset((void *) va, 0, (space > hdr->e_bsslen) ? hdr->e_bsslen : space);
-				}
-				copied += space;
-				continue;
-			}
-
-			// We are handeling data, txt, or rodata
-			// Determine from where in the file we need to read
-			unsigned int rs = fs + segs[i].off + copied;
-	
-			// Now copy the bytes from the file into that page
-			(void)memcpy((void *)va, (void *)rs, space);
+	return 0;
+}
 
-			// We copied "space" additional bytes
-			copied += space;
+/**
+ * @brief Loads a user program
+ *
+ * We read the program data from the "RAM disk" image included in the 
+ * kernel executable binary and load the data into the tasks address 
+ * space.
+ *
+ * We use the provided execname to determine if the idle or init thread is 
+ * being loaded and update the corresponding pointers required by our 
+ * kernel in the future at the end of the function.
+ *
+ * To read the program data we use the exec2obj utility which will also be 
+ * in charge of validating the header and providing a simple ELF header 
+ * with information about each section. This is only done on the first exec
+ * of a program, its image keeps the header for the next ones (@see
+ * find_image).
+ *
+ * We first initialize the stack area of the new program with the provided 
+ * arguments and reset the previous paging which we inherited during the 
+ * fork call.
+ *
+ * Then we iteratate over the simple ELF header and create pages for each 
+ * section and copy the data from the exec2obj file into that page.
+ *
+ * @param args the program arguments and the filename of the program
+ * @return does not return on sucess, a negative error code otherwise
+ */
+int _exec(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
 
-		}
-	}
+	// Argument 1
+	char *execname = save_execname((char*) kargs[0]);
+	if (execname == NULL) return ERR_INVALID_ARG;
+	boolean_t is_idle = (strcmp("idle", execname) == 0);
+	boolean_t is_init = (strcmp("init", execname) == 0);
+	boolean_t is_god = (strcmp("god", execname) == 0);
+
+	// The program, with its validated ELF header
+	image_t *image;
+	int err = find_image(execname, &image);
+	free(execname);
+	if (err) return err;
+
+	// Argument 2, stored to survive the paging reset
+	int num_args;
+	int total_arg_length;
+	char **karg = save_args((char**) kargs[1], &num_args, &total_arg_length);
+	if (karg == NULL) return ERR_INVALID_ARG;
+
+	// Reset the paging, only kernel pages are mapped now. The region lock
+	// keeps the merging scanner away until the new image is built
+	process_t *process = get_self()->process;
+	mutex_lock(process->region_lock);
+	reset_paging();
+	fpu_drop(get_self());
+	shm_drop_regions(&process->regions);
+	clear_regions(&process->regions);
+
+	err = load_image(image, karg, num_args, total_arg_length);
+	mutex_unlock(process->region_lock);
+	if (err) return err;
 
 	/**
 	 * Finally we check if the program we are now running is idle. In 
@@ -238,7 +323,42 @@ int _exec(void **args) {
 	 */
 	if(is_idle && set_idle(get_self()) < 0) kernel_panic("No idle thread");	
 	if(is_init && set_init(get_self()) < 0) kernel_panic("No init thread");
-	launch(hdr->e_entry, get_self()->esp3);
+
+	// The processes init collects from now on are destroyed by the reaper,
+	// the new ones scanned for identical pages and for their working set,
+	// the caches reclaimed when memory runs low, and prints rendered by the
+	// console drain. The CPUs get their workers, the others once they start
+	if (is_init) {
+		workqueue_start();
+		reaper_start();
+		ksm_start();
+		wss_start();
+		reclaim_start();
+		conring_start();
+	}
+
+	// Now that the bootstrap processor has its idle, the others can start
+	if (is_idle) {
+		smp_start();
+		workqueue_start();
+	}
+
+	// We never get back to our wrapper, and the kernel's exec of god
+	// doesn't count
+#if SYSCALL_PROFILE
+	if (get_self()->sys_start != 0) sysstat_exit(EXEC_INT, 0);
+#endif
+	cputime_leave(0);
+
+	// Their first user instruction ends the boot, @see boottime.c
+	if (is_god) boot_mark(KSTAT_BOOT_USER_GOD);
+	else if (is_idle) boot_mark(KSTAT_BOOT_USER_IDLE);
+	else if (is_init) boot_mark(KSTAT_BOOT_USER_INIT);
+
+	// Idle has nothing to run in user mode, it stays in the kernel
+	if (is_idle) bsp_idle();
+
+	launch(image->hdr.e_entry, get_self()->esp3);
 
 	return 0;
 }
@@ -273,16 +393,18 @@ int _fork() {
 		return ERR_COPY_THR_FAIL;
 	}
 
-	// Make the thread runnable
+	// Handcraft the stack for the child at esp0
+	child_stack(new->esp0, new, &(new->esp), current->esp0);
+
+	// Make the thread runnable, another CPU may run it right away
+	dont_switch_me_out();
 	int err = set_runnable(new);
+	you_can_switch_me_out_now();
 	if (err < 0) {
 		destroy_process(child);
 		destroy_thread(new);	
 		return err;
 	}
-
-	// Handcraft the stack for the child at esp0
-	child_stack(new->esp0, new, &(new->esp), current->esp0);
 	
 	// Note that the child never returns to that point. We make him
 	// go directly to the fork_int function.
@@ -292,6 +414,110 @@ int _fork() {
 }
 
 
+/**
+ * @brief What a spawned child needs to build its user image
+ */
+typedef struct {
+	image_t *program;
+	char **karg;
+	int num_args;
+	int total_arg_length;
+} spawn_image_t;
+
+/**
+ * @brief First kernel function run by a spawned child
+ *
+ * The child runs in its own, empty, address space. It loads the program
+ * image there and leaves for user space. If the image can't be built, the
+ * child vanishes with the error as exit status.
+ *
+ * @param arg the spawn_image_t prepared by the parent
+ */
+static void spawn_entry(void *arg) {
+	spawn_image_t *image = (spawn_image_t *) arg;
+	process_t *process = get_self()->process;
+
+	mutex_lock(process->region_lock);
+	int err = load_image(image->program, image->karg, image->num_args,
+		image->total_arg_length);
+	mutex_unlock(process->region_lock);
+	unsigned long entry = image->program->hdr.e_entry;
+	kfree(image, sizeof(spawn_image_t));
+
+	if (err) {
+		_set_status(err);
+		_vanish();
+	}
+
+	launch(entry, get_self()->esp3);
+}
+
+/**
+ * @brief Creates a new task running the given program
+ *
+ * This has the effect of a fork immediately followed by an exec in the
+ * child, without ever duplicating the address space of the caller. The
+ * program and its arguments are checked and saved in the kernel, then the
+ * child process is created with an empty user space and a single thread
+ * whose kernel stack is built to start in spawn_entry. The child loads the
+ * program itself, once in its own address space.
+ *
+ * Unlike fork, spawn can be called by a multi-threaded task.
+ *
+ * @param args the filename of the program and its arguments
+ * @return the thread id of the child on success, a negative error code
+ * 		otherwise
+ */
+int _spawn(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	// Argument 1
+	char *execname = save_execname((char*) kargs[0]);
+	if (execname == NULL) return ERR_INVALID_ARG;
+
+	// The program, with its validated ELF header
+	image_t *program;
+	int err = find_image(execname, &program);
+	free(execname);
+	if (err) return err;
+
+	spawn_image_t *image = kzalloc(sizeof(spawn_image_t));
+	if (image == NULL) return ERR_CALLOC_FAIL;
+	image->program = program;
+
+	// Argument 2, saved since the child can't read our address space
+	image->karg = save_args((char**) kargs[1], &image->num_args,
+		&image->total_arg_length);
+	if (image->karg == NULL) {
+		kfree(image, sizeof(spawn_image_t));
+		return ERR_INVALID_ARG;
+	}
+
+	// Create the child task, with nothing in user space
+	process_t *child = create_child_process(get_self()->process);
+	thread_t *new = (child == NULL) ? NULL : create_thread(child);
+	if (new == NULL) {
+		free_args(image->karg, image->num_args);
+		kfree(image, sizeof(spawn_image_t));
+		if (child != NULL) {
+			child->state = EXITED;
+			destroy_process(child);
+		}
+		return ERR_COPY_PRO_FAIL;
+	}
+
+	// The child starts in spawn_entry
+	entry_stack(new, spawn_entry, image);
+
+	dont_switch_me_out();
+	err = set_runnable(new);
+	you_can_switch_me_out_now();
+	if (err < 0) kernel_panic("Unable to run spawned thread");
+
+	return new->tid;
+}
+
 /**
  * @brief Sets the exit status of the current task
  * @param status the exit status for the calling thread
@@ -305,59 +531,104 @@ void _set_status(int status) {
 	process->exit_status = status;
 }
 
+/**
+ * @brief Makes one thread waiting for an exited child of process runnable
+ *
+ * @param process the process, NULL does nothing
+ * @return the thread, NULL if none waits
+ */
+static thread_t *wake_waiter(process_t *process) {
+	thread_t *waiting = get_waiting(process);
+	if (waiting != NULL) set_runnable(waiting);
+	return waiting;
+}
+
 /**
  * @brief Collects the exit status of a task
  *
- * We look for a child which has exited and collect that exit status. If 
- * we have no child which exited yet we deschedule ourselves. When a child
- * does exit it checks whether its parent has waiting threads.
+ * We take the child which exited first out of our queue of exited
+ * children and collect its exit status. If we have no child which exited
+ * yet we deschedule ourselves. When a child does exit it joins the queue
+ * and wakes one of the waiting threads of its parent.
+ *
+ * The queue and the count of children are only looked at in a
+ * dont_switch_me_out area, so that a child can't exit between our look and
+ * our sleep. A child we took and put back wakes another waiter, and the
+ * last one we bury wakes all of them, which have no child left to wait for.
+ *
+ * The child is taken out of our family right away, but the teardown of
+ * its address space and control blocks is left to the reaper (@see
+ * reaper.c), we return the status without waiting for it.
  *
  * @param status_ptr the placeholder for the exit status
  * @return the original thread of the exiting task
  */
 int _wait(int *status_ptr) {
-	if (status_ptr != NULL && !check_page((uint32_t)status_ptr, TRUE)) return ERR_INVALID_ARG;
+	if (status_ptr != NULL && !user_range(status_ptr, sizeof(int)))
+		return ERR_INVALID_ARG;
 
 	thread_t *self = get_self();
 	process_t *task = self->process;
 
+	// Find an exited child	
+	process_t *child;
+	dont_switch_me_out();
+
 	// CHECK1 : Do we even have (alive) children ?
-	if (task->children == 0) return ERR_NO_CHILDREN;
+	if (task->children == 0) {
+		you_can_switch_me_out_now();
+		return ERR_NO_CHILDREN;
+	}
 
 	// CHECK2 : Do we have more waiting threads than children ?
-	if (task->children <= task->waiting->size) return ERR_WAIT_FULL;
-
-	// Find an exited child	
-	process_t *child;
+	if (task->children <= task->waiting->size) {
+		you_can_switch_me_out_now();
+		return ERR_WAIT_FULL;
+	}
 
 	// If no child has exited yet
 	while ((child = exited_child(task)) == NULL && task->children > 0) {
-		dont_switch_me_out();
-
 		int err = set_waiting(self);
-		if (err < 0) return err;
+		if (err < 0) {
+			you_can_switch_me_out_now();
+			return err;
+		}
 	
 		// Context Switch somewhere else
 		thread_t *other = get_running();
 		if (other == NULL) other = idle();
 		context_switch(self, other);
+		dont_switch_me_out();
 	}
+	you_can_switch_me_out_now();
 
 	// Are all children gone?
-	if (task->children == 0) return ERR_CHILDREN_GONE;
+	if (child == NULL) return ERR_CHILDREN_GONE;
 	
 	// Set the exit status of the child
-	if (status_ptr != NULL)
-		*status_ptr = child->exit_status;	
+	// A fault here leaves the child to be collected by another wait
+	if (status_ptr != NULL && copy_to_user(status_ptr,
+			&child->exit_status, sizeof(int))) {
+		dont_switch_me_out();
+		unwait_child(task, child);
+		wake_waiter(task);
+		you_can_switch_me_out_now();
+		return ERR_INVALID_ARG;
+	}
 
 	// Return thread ID of original thread
 	int original_tid = child->original_tid;
 	if (original_tid == -1) return ERR_NO_ORIGINAL_THREAD;
 
-	// Here we need to remove all resources of the process	
-	int derr = destroy_process(child);
+	// The child leaves our family now, its resources go later
+	dont_switch_me_out();
+	int derr = bury_process(child);
+	if (task->children == 0)
+		while (wake_waiter(task) != NULL) continue;
+	you_can_switch_me_out_now();
 	if (derr) return derr;
 
+	reap_process(child);
 	return original_tid;
 }
 
@@ -370,8 +641,10 @@ int _wait(int *status_ptr) {
  * thread from the parent process via wait().
  *
  * When we vanish we cannot destroy and free all our resources since we 
- * are still running. Thus when a thread does call wait() it will take care
- * of destroying the process and all its threads entirely.
+ * are still running. Unless we are the last thread, the reaper frees our
+ * kernel stack and control block once we are off them (@see reaper.c).
+ * Otherwise when a thread does call wait() it will take care of destroying
+ * the process and all its threads entirely.
  *
  * Vanish thus simply changes the state of the thread so it cannot regain
  * execution in the future.
@@ -382,6 +655,9 @@ void _vanish(void) {
 
 	dont_switch_me_out();
 
+	// Nobody waits for our reply anymore
+	ipc_vanish(self);
+
 	// Now vanish !
 	vanish_thread();
 
@@ -392,18 +668,14 @@ void _vanish(void) {
 	process_t *process = self->process;
 	if (process->threads == 0) {
 
-		vanish_process(process);
+		// Our exited children, if any, are init's now
+		int orphans = vanish_process(process);
+		for (; orphans > 0; --orphans) wake_waiter(init()->process);
 
 		// Is a thread from the parent waiting for us ?
-		if (process->parent) {
-			thread_t *waiting = NULL;
-			waiting = get_waiting(process->parent);
-			if (waiting != NULL) {
-				set_runnable(waiting);
-				other = waiting;
-			}
-		}
-	}
+		thread_t *waiting = wake_waiter(process->parent);
+		if (waiting != NULL && is_local(waiting)) other = waiting;
+	} else reap_thread(self);
 
 	// Goodbye cruel world
 	context_switch(self, other);
@@ -435,13 +707,15 @@ int _thread_fork(void) {
 	thread_t *new = copy_thread(process, current, FALSE);
 	if (new == NULL) return ERR_COPY_THR_FAIL;
 	
+	// Handcraft the stack for the child at esp0
+	child_stack(new->esp0, new, &(new->esp), current->esp0);
+
 	// Make the thread runnable
+	dont_switch_me_out();
 	int err = set_runnable(new);
+	you_can_switch_me_out_now();
 	if (err < 0) return err;
 
-	// Handcraft the stack for the child at esp0
-	child_stack(new->esp0, new, &(new->esp), current->esp0);
-
 	// Note that the child never returns to that point. We make him
 	// go directly to the fork_int function.
 
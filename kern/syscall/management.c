@@ -17,6 +17,14 @@
 #include <common_kern.h>
 #include <seg.h>
 #include <syshelper.h>
+#include <usercopy.h>
+#include <sched.h>
+#include <edf.h>
+#include <cputime.h>
+#include <futex.h>
+#include <clock.h>
+#include <trace.h>
+#include <message.h>
 
 #ifndef _SYSCALL_H
 typedef void (*swexn_handler_t)(void *arg, ureg_t *ureg);
@@ -40,25 +48,28 @@ typedef void (*swexn_handler_t)(void *arg, ureg_t *ureg);
  * @return 0 on success, a negative error code otherwise.
  */
 int _deschedule(int *flag) {
-	if (!check_page((uint32_t)flag, FALSE)) return ERR_INVALID_ARG;
-
 	thread_t *self = get_self();
 
 	// Atomically with respect to make_runnable
-	mutex_lock(self->thread_lock);		
-	if (*flag != 0) {
-		mutex_unlock(self->thread_lock);	
+	int kflag;
+	mutex_lock(&self->thread_lock);		
+	if (copy_from_user(&kflag, flag, sizeof(int))) {
+		mutex_unlock(&self->thread_lock);
+		return ERR_INVALID_ARG;
+	}
+	if (kflag != 0) {
+		mutex_unlock(&self->thread_lock);	
 		return 0;
 	}
 
 	dont_switch_me_out();
 
-	mutex_unlock(self->thread_lock);
+	mutex_unlock(&self->thread_lock);
 
 	// Block ourselves
 	int err = set_blocked(self);
 	if (err < 0) {
-		mutex_unlock(self->thread_lock);		
+		mutex_unlock(&self->thread_lock);		
 		return err;	
 	}
 
@@ -97,19 +108,33 @@ int _yield(int tid) {
 
 	thread_t *self = get_self();
 
-	// try to find the thread to which we should transfer execution
+	dont_switch_me_out();
+
+	// try to find the thread to which we should transfer execution, it
+	// stays alive in our area only
 	thread_t *other = NULL;
 	if (tid >= 0) {
 		other = get_thread(tid);
-		if (other == NULL || other->state != THR_RUNNING)
+		if (other == NULL || other->tid != tid
+				|| other->state != THR_RUNNING) {
+			you_can_switch_me_out_now();
 			return ERR_YIELD_NOT_RUNNABLE;
+		}
 	}
 
-	dont_switch_me_out();
+	trace_hint_switch(SCHED_SWITCH_YIELD);
 
 	// In a yield we are still runnable
 	set_runnable(self);
 
+	/**
+	 * The target may have been switched to meanwhile, and a CPU only runs
+	 * the threads of its processes (@see sched.c). In both cases we give
+	 * our CPU to the next in line instead.
+	 */
+	if (other != NULL && (!sched_queued(other) || !is_local(other)))
+		other = NULL;
+
 	// If yield was called with -1, we just run the next in line
 	if (other == NULL) other = get_running();
 
@@ -120,39 +145,81 @@ int _yield(int tid) {
 }
 
 /**
- * @brief Makes a deschedules thread runnable again
+ * @brief Makes descheduled threads runnable again, all in one
+ * dont_switch_me_out area
  *
- * We first look up the thread with given id in the hash table and verify 
- * it is indeed blocked. If so we atomically (with respect to 
- * deschedule on the same thread) append him to the runnable list and 
- * context switch to him if no error occured.
+ * Taking and releasing the thread lock of a target first makes it atomic
+ * with respect to a deschedule of the target: one which read its flag
+ * holds the lock until it is in its area, and our own area only starts
+ * once it blocked. The targets are held meanwhile, so that their control
+ * blocks aren't freed under us (@see hold_thread), and looked up again in
+ * our area, they may have been woken up and gone meanwhile.
  *
- * @param tid the thread id of the thread to make runnable
- * @reurn 0 on success, a negative error code otherwise
+ * The woken threads wait for their turn, unless the scheduler lets one of
+ * them preempt us (@see sched_preempts).
+ *
+ * @param tids the thread ids, at most MAKE_RUNNABLE_BATCH
+ * @param n the number of ids
+ * @param results where to store 0 for each thread made runnable, a
+ * negative error code otherwise
  */
-int _make_runnable(int tid) {
-
-	// Make sure tid is valid
-	if (tid < 0) return ERR_INVALID_TID;
+void make_runnable_batch(const int *tids, int n, int *results) {
+	int i;
+	for (i = 0; i < n; ++i) {
+		thread_t *target = (tids[i] < 0) ? NULL : hold_thread(tids[i]);
+		if (target == NULL) continue;
+
+		// Wait for a deschedule in progress to be done with it
+		mutex_lock(&target->thread_lock);
+		mutex_unlock(&target->thread_lock);
+		release_thread(target);
+	}
 
-	// Check if the thread is actually blocked
-	thread_t *target = get_thread(tid);
-	if (target == NULL || target->state != THR_BLOCKED)
-		return ERR_NOT_BLOCKED;
-	
-	// Atomically with respect to deschedule
 	thread_t *self = get_self();
-	mutex_lock(target->thread_lock);
+	thread_t *best = NULL;
 
 	dont_switch_me_out();
+	for (i = 0; i < n; ++i) {
+		if (tids[i] < 0) {
+			results[i] = ERR_INVALID_TID;
+			continue;
+		}
 
-	// Otherwise make him runnabel again, but don't transfer yet
-	int err = set_runnable(target);
+		thread_t *target = get_thread(tids[i]);
+		if (target == NULL || target->tid != tids[i]
+				|| target->state != THR_BLOCKED) {
+			results[i] = ERR_NOT_BLOCKED;
+			continue;
+		}
 
-	mutex_unlock(target->thread_lock);
-	if (err == 0) context_switch(self, target);
-	else you_can_switch_me_out_now();
+		trace_hint_wake(SCHED_WAKE_MAKE_RUNNABLE);
+		results[i] = set_runnable(target);
 
+		// The targets of other CPUs wait there
+		if (results[i] == 0 && is_local(target)
+				&& (best == NULL || sched_preempts(best, target)))
+			best = target;
+	}
+
+	if (best != NULL && sched_preempts(self, best)) {
+		set_runnable(self);
+		context_switch(self, best);
+	} else you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Makes a deschedules thread runnable again
+ *
+ * The thread is appended to the runnable list, atomically with respect to
+ * deschedule on the same thread, but we keep the CPU unless the scheduler
+ * says otherwise (@see make_runnable_batch).
+ *
+ * @param tid the thread id of the thread to make runnable
+ * @reurn 0 on success, a negative error code otherwise
+ */
+int _make_runnable(int tid) {
+	int err;
+	make_runnable_batch(&tid, 1, &err);
 	return err;	
 }
 
@@ -193,6 +260,119 @@ int _sleep(int ticks) {
 	return 0;
 }
 
+/**
+ * @brief Puts the calling thread to sleep for the given number of
+ * microseconds
+ *
+ * Unlike sleep, the delay need not be a number of ticks: the thread wakes up
+ * within the tick, once the clock reaches its deadline (@see split_tick).
+ *
+ * @param usecs the number of microseconds to sleep
+ * @return 0 on sucess, a negative error code otherwise
+ */
+int _usleep(unsigned int usecs) {
+	if (usecs == 0) return 0;
+
+	thread_t *self = get_self();
+	if (self == NULL) return ERR_SELF_NULL;
+
+	uint64_t deadline = clock_ns() + (uint64_t) usecs * NS_PER_USEC;
+
+	dont_switch_me_out();
+
+	int err = set_sleeping_ns(self, usecs / TIMER_USECS_PER_TICK, deadline);
+	if (err < 0) {
+		you_can_switch_me_out_now();
+		return err;
+	}
+
+	thread_t *other = get_running();
+	if (other == NULL) other = idle();
+
+	context_switch(self, other);
+	return 0;
+}
+
+/**
+ * @brief Stores the nanoseconds elapsed since boot, as told by the clock
+ *
+ * @param ns where to store them in user memory
+ * @return 0 on success, a negative error code otherwise
+ */
+int _get_time_ns(uint64_t *ns) {
+	uint64_t now = clock_ns();
+	if (copy_to_user(ns, &now, sizeof(uint64_t))) return ERR_INVALID_ARG;
+	return 0;
+}
+
+/**
+ * @brief Sets the nice value of the calling thread
+ *
+ * The nice value is the base priority level of the thread (@see sched.c),
+ * from 0, the most urgent, to SCHED_LEVELS - 1. The scheduler never puts
+ * the thread above it.
+ *
+ * @param nice the new nice value
+ * @return the previous nice value, a negative error code otherwise
+ */
+int _set_nice(int nice) {
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	int old = sched_set_nice(self, nice);
+	you_can_switch_me_out_now();
+
+	return old;
+}
+
+/**
+ * @brief Makes the calling thread join the earliest-deadline-first class,
+ * change its parameters or leave it
+ *
+ * The thread is promised budget ticks of its CPU every period ticks, within
+ * deadline ticks of the start of the period, provided the CPU has the
+ * bandwidth left (@see edf.c). A budget of 0 takes it back to the levels.
+ *
+ * @param args the budget, the deadline and the period
+ * @return 0 on success, a negative error code otherwise
+ */
+int _set_deadline(void **args) {
+	void *kargs[3];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	int err = edf_set(self, (unsigned int) kargs[0],
+		(unsigned int) kargs[1], (unsigned int) kargs[2]);
+	you_can_switch_me_out_now();
+
+	return err;
+}
+
+/**
+ * @brief Gets the CPU time, in user and in kernel mode, of the calling
+ * thread, of its process or of the children its process waited for
+ *
+ * @param args RUSAGE_THREAD, RUSAGE_SELF or RUSAGE_CHILDREN, and where to
+ * copy the times
+ * @return 0 on success, a negative error code otherwise
+ */
+int _getrusage(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	rusage_t usage;
+	dont_switch_me_out();
+	int err = cputime_usage((int) kargs[0], &usage);
+	you_can_switch_me_out_now();
+
+	if (err < 0) return err;
+	if (copy_to_user(kargs[1], &usage, sizeof(rusage_t)))
+		return ERR_INVALID_ARG;
+	return 0;
+}
+
 /**
  * @brief Returns the number of timer ticks occured since the system boot
  * @return the number of timer ticks
@@ -216,11 +396,18 @@ int _gettid() {
  * exception is triggered by an instruction of this process, except exceptions
  * caused by kernel mechanichs such as copy on write or zero fill on demand.
  * 
+ * With SWEXN_PERSISTENT in esp3, the handler stays registered when it is
+ * called, so that a program taking a fault after the other, like a garbage
+ * collector or a user-level pager, doesn't register it again each time. Its
+ * handler then returns with swexn(SWEXN_RESUME, NULL, NULL, ureg), which
+ * keeps the registration as it is. A fault in the handler itself calls it
+ * again, on the same stack.
+ *
  * If newureg is not null, the user gets the specified values in its registers
- * when it gets back to user space. The system call of course checks that the
- * sensible registers (most notably the segment registers and the EFLAGS
- * register) have suitable values. The user can slaughter itself, but it must
- * not, in any case, cause trouble in the kernel.
+ * when it gets back to user space, eax included. The system call of course
+ * checks that the sensible registers (most notably the segment registers and
+ * the EFLAGS register) have suitable values. The user can slaughter itself,
+ * but it must not, in any case, cause trouble in the kernel.
  * 
  * If one of the two operations can't be carried out when it should have, the
  * other one will not be served either.
@@ -232,25 +419,31 @@ int _gettid() {
  * user space
  */
 int _swexn(void **args) {
-	if (!check_array(args, 4)) return ERR_INVALID_ARG;
+	void *kargs[4];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
 
-	void *esp3 = args[0];
-	if (esp3 != NULL && !check_page((uint32_t)esp3, TRUE))
+	// The handler frame is written with copy_to_user when an exception hits
+	boolean_t persistent = ((uint32_t) kargs[0] & SWEXN_PERSISTENT) != 0;
+	void *esp3 = (void *) ((uint32_t) kargs[0] & ~SWEXN_PERSISTENT);
+	if (esp3 != NULL && !user_range((char *) esp3 - 1, 1))
 		return ERR_INVALID_ARG;
 	
-	swexn_handler_t eip = args[1];
-	if (eip != NULL && !check_page((uint32_t)eip, FALSE))
-		return ERR_INVALID_ARG;
-	if (eip != NULL && (uint32_t) eip < USER_MEM_START)
+	swexn_handler_t eip = kargs[1];
+	if (eip != NULL && !user_range(eip, 1))
 		return ERR_INVALID_ARG;
+	boolean_t resume = (esp3 == NULL && persistent);
 
-	void *arg = args[2];
+	void *arg = kargs[2];
 
-	ureg_t *newureg = args[3];
-	if (newureg != NULL &&
-			!check_array(newureg, sizeof(ureg_t) / sizeof(void*)))
-		return ERR_INVALID_ARG;
-	thread_t *thread = get_running();
+	// Work on a kernel copy, the user could change it under our feet
+	ureg_t kureg;
+	ureg_t *newureg = kargs[3];
+	if (newureg != NULL) {
+		if (copy_from_user(&kureg, newureg, sizeof(ureg_t)))
+			return ERR_INVALID_ARG;
+		newureg = &kureg;
+	}
+	thread_t *thread = get_self();
 	uint32_t *esp0 = (void *) thread->esp0;
 	if (newureg != NULL) {
 		if ((newureg->ds != SEGSEL_USER_DS 
@@ -267,16 +460,20 @@ int _swexn(void **args) {
 		}
 	}
 
-	if (esp3 == NULL || eip == NULL) {
+	if (resume) {
+		// SWEXN_RESUME, the registered handler stays as it is
+	} else if (esp3 == NULL || eip == NULL) {
 		// Deregister the currently registered exception handler
 		thread->swexn_eip = 0x0;
 		thread->swexn_esp = 0x0;
 		thread->swexn_arg = NULL;
+		thread->swexn_persistent = FALSE;
 	} else {
 		// Register a new exception handler
 		thread->swexn_eip = (uint32_t) eip;
 		thread->swexn_esp = (uint32_t) esp3;
 		thread->swexn_arg = arg;
+		thread->swexn_persistent = persistent;
 	}
 
 	if (newureg != NULL) {
@@ -309,6 +506,108 @@ int _swexn(void **args) {
 		//*(esp0 - 4) = newureg->cs;
 		*(esp0 - 5) = newureg->eip; // Wrong values will be handled by paging
 
+		// The return value of the call is what eax resumes with
+		return (int) newureg->eax;
 	}
 	return 0;
 }
+
+/**
+ * @brief Blocks the calling thread while a word of its memory holds a value
+ *
+ * @param args the address of the word and the value it is expected to hold
+ * @return 0 once woken up by futex_wake, a negative error code if the word
+ * didn't hold the value or can't be waited on
+ */
+int _futex_wait(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	return futex_wait((int *) kargs[0], (int) kargs[1]);
+}
+
+/**
+ * @brief Wakes up threads waiting on a word of the memory of the caller
+ *
+ * @param args the address of the word and the number of threads to wake up
+ * @return the number of threads woken up, a negative error code otherwise
+ */
+int _futex_wake(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	return futex_wake((int *) kargs[0], (int) kargs[1]);
+}
+
+/**
+ * @brief Calls a thread with a message and waits for its reply
+ *
+ * @param args the id of the thread and the message, which the reply
+ * replaces
+ * @return 0 on success, a negative error code otherwise
+ */
+int _ipc_call(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	ipc_msg_t msg;
+	if (copy_from_user(&msg, kargs[1], sizeof(msg))) return ERR_INVALID_ARG;
+
+	int err = ipc_call((int) kargs[0], &msg);
+	if (err == 0 && copy_to_user(kargs[1], &msg, sizeof(msg)))
+		return ERR_INVALID_ARG;
+	return err;
+}
+
+/**
+ * @brief Receives the next call made to the calling thread
+ *
+ * @param msg where to store the message of the call
+ * @return the id of the caller, a negative error code otherwise
+ */
+int _ipc_receive(ipc_msg_t *msg) {
+	if (!user_range(msg, sizeof(ipc_msg_t))) return ERR_INVALID_ARG;
+
+	ipc_msg_t call;
+	int tid = ipc_receive(&call);
+	if (copy_to_user(msg, &call, sizeof(call))) return ERR_INVALID_ARG;
+	return tid;
+}
+
+/**
+ * @brief Replies to a call, and receives the next one if asked to
+ */
+static int reply(void **args, boolean_t wait) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	ipc_msg_t msg;
+	if (copy_from_user(&msg, kargs[1], sizeof(msg))) return ERR_INVALID_ARG;
+	if (wait && !user_range(kargs[1], sizeof(msg))) return ERR_INVALID_ARG;
+
+	int tid = ipc_reply((int) kargs[0], &msg, wait ? &msg : NULL);
+	if (wait && tid >= 0 && copy_to_user(kargs[1], &msg, sizeof(msg)))
+		return ERR_INVALID_ARG;
+	return tid;
+}
+
+/**
+ * @brief Replies to the call of a thread
+ *
+ * @param args the id of the caller and the reply
+ * @return 0 on success, a negative error code otherwise
+ */
+int _ipc_reply(void **args) {
+	return reply(args, FALSE);
+}
+
+/**
+ * @brief Replies to the call of a thread and receives the next call
+ *
+ * @param args the id of the caller and the reply, which the next call
+ * replaces
+ * @return the id of the next caller, a negative error code otherwise
+ */
+int _ipc_reply_wait(void **args) {
+	return reply(args, TRUE);
+}
@@ -8,8 +8,30 @@
 
 #include <simics.h>
 #include <asm.h>
+#include <stdlib.h>
 #include <syshelper.h>
+#include <usercopy.h>
 #include <errors.h>
+#include <drivers.h>
+#include <sched.h>
+#include <edf.h>
+#include <cpu.h>
+#include <kstat.h>
+#include <slab.h>
+#include <reaper.h>
+#include <ksm.h>
+#include <reclaim.h>
+#include <ptpool.h>
+#include <lock.h>
+#include <profiler.h>
+#include <sysstat.h>
+#include <trace.h>
+#include <clock.h>
+#include <serial.h>
+#include <boottime.h>
+
+// Bytes readfile copies out to user space at a time
+#define READFILE_CHUNK 256
 
 /**
  * @brief Ceases execution of the operating system
@@ -37,16 +59,267 @@ void _halt(void) {
  * @return the number of copied bytes on sucess, -1 otherwise  
  */
 int _readfile(void **args) {
-	if (!check_array(args, 4)) return ERR_INVALID_ARG;
-
-	char *filename = (char *)args[0];
-	if (!check_string(filename)) return ERR_INVALID_ARG;
-	char *buf = (char *)args[1];
-	int count = (int)args[2];
-	if (count < 0) return ERR_INVALID_ARG;
-	if (!check_buffer(buf, count, TRUE));
-	int offset = (int)args[3];
+	void *kargs[4];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	char *buf = (char *)kargs[1];
+	int count = (int)kargs[2];
+	if (count < 0 || !user_range(buf, count)) return ERR_INVALID_ARG;
+	int offset = (int)kargs[3];
 	if (offset < 0) return ERR_INVALID_ARG;
 
-	return getbytes(filename, offset, count, buf);
+	char *filename = malloc(STR_MAX_LEN);
+	if (filename == NULL) return ERR_MALLOC_FAIL;
+	if (strncpy_from_user(filename, kargs[0], STR_MAX_LEN) < 0) {
+		free(filename);
+		return ERR_INVALID_ARG;
+	}
+
+	// The file lives in kernel memory, copy it out a chunk at a time
+	char chunk[READFILE_CHUNK];
+	int copied = 0;
+	while (copied < count) {
+		int len = count - copied;
+		if (len > READFILE_CHUNK) len = READFILE_CHUNK;
+		int got = getbytes(filename, offset + copied, len, chunk);
+		if (got == ERR_INVALID_OFFSET && copied > 0) break;
+		if (got < 0) {
+			copied = got;
+			break;
+		}
+		if (copy_to_user(buf + copied, chunk, got)) {
+			copied = ERR_INVALID_ARG;
+			break;
+		}
+		copied += got;
+		if (got < len) break;
+	}
+
+	free(filename);
+	return copied;
+}
+
+/**
+ * @brief Copies a set of kernel statistics out to user space
+ *
+ * The counters are gathered in a kernel buffer under the lock protecting
+ * them, then copied out. The sets are described in kstat.h.
+ *
+ * @param args the set, the buffer and its length in bytes
+ * @return the number of entries copied, a negative error code otherwise
+ */
+int _kstat(void **args) {
+	void *kargs[3];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	int what = (int) kargs[0];
+	void *buf = kargs[1];
+	int len = (int) kargs[2];
+	if (len < 0 || !user_range(buf, len)) return ERR_INVALID_ARG;
+	boolean_t reset = (what & KSTAT_RESET) != 0;
+
+	switch (what & ~KSTAT_RESET) {
+	case KSTAT_SCHED: {
+		kstat_sched_t stats[CPU_MAX];
+		int n = len / sizeof(kstat_sched_t);
+		if (n > CPU_MAX) n = CPU_MAX;
+
+		dont_switch_me_out();
+		n = sched_stats(stats, n, reset);
+		you_can_switch_me_out_now();
+
+		if (copy_to_user(buf, stats, n * sizeof(kstat_sched_t)))
+			return ERR_INVALID_ARG;
+		return n;
+	}
+	case KSTAT_SLAB: {
+		kstat_slab_t stats[SLAB_MAX_CACHES];
+		int n = len / sizeof(kstat_slab_t);
+		if (n > SLAB_MAX_CACHES) n = SLAB_MAX_CACHES;
+
+		n = slab_stats(stats, n, reset);
+
+		if (copy_to_user(buf, stats, n * sizeof(kstat_slab_t)))
+			return ERR_INVALID_ARG;
+		return n;
+	}
+	case KSTAT_REAPER: {
+		kstat_reaper_t stats;
+		if (len < sizeof(kstat_reaper_t)) return 0;
+
+		reaper_stats(&stats, reset);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_reaper_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_LOCKS: {
+		int n = len / sizeof(kstat_lock_t);
+		if (n > LOCKSTAT_CLASSES) n = LOCKSTAT_CLASSES;
+		if (n == 0 && !reset) return 0;
+
+		// Too large for our stack
+		size_t size = LOCKSTAT_CLASSES * sizeof(kstat_lock_t);
+		kstat_lock_t *stats = kmalloc(size);
+		if (stats == NULL) return ERR_MALLOC_FAIL;
+
+		n = lockstat_report(stats, n, reset);
+
+		int ret = n;
+		if (copy_to_user(buf, stats, n * sizeof(kstat_lock_t)))
+			ret = ERR_INVALID_ARG;
+		kfree(stats, size);
+		return ret;
+	}
+	case KSTAT_SYSCALLS: {
+		// Far too many for our stack, they go out one by one
+		int max = len / sizeof(kstat_syscall_t);
+		kstat_syscall_t *out = buf;
+		int n = 0;
+		int cpu;
+		unsigned int num;
+		for (cpu = 0; cpu < num_cpus(); ++cpu) {
+			for (num = SYSCALL_INT; num <= SYSCALL_RESERVED_END; ++num) {
+				kstat_syscall_t stats;
+				if (n >= max && !reset) return n;
+				if (!sysstat_get(cpu, num, &stats, reset) || n >= max)
+					continue;
+
+				if (copy_to_user(&out[n], &stats, sizeof(kstat_syscall_t)))
+					return ERR_INVALID_ARG;
+				n++;
+			}
+		}
+		return n;
+	}
+	case KSTAT_KSM: {
+		kstat_ksm_t stats;
+		if (len < sizeof(kstat_ksm_t)) return 0;
+
+		ksm_stats(&stats, reset);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_ksm_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_SERIAL: {
+		kstat_serial_t stats;
+		if (len < sizeof(kstat_serial_t)) return 0;
+
+		serial_stats(&stats, reset);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_serial_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_BOOT: {
+		kstat_boot_t stats;
+		if (len < sizeof(kstat_boot_t)) return 0;
+
+		boot_stats(&stats);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_boot_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_RECLAIM: {
+		kstat_reclaim_t stats;
+		if (len < sizeof(kstat_reclaim_t)) return 0;
+
+		reclaim_stats(&stats, reset);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_reclaim_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_EDF: {
+		kstat_edf_t stats[CPU_MAX];
+		int n = len / sizeof(kstat_edf_t);
+		if (n > CPU_MAX) n = CPU_MAX;
+
+		dont_switch_me_out();
+		n = edf_stats(stats, n, reset);
+		you_can_switch_me_out_now();
+
+		if (copy_to_user(buf, stats, n * sizeof(kstat_edf_t)))
+			return ERR_INVALID_ARG;
+		return n;
+	}
+	case KSTAT_PTPOOL: {
+		kstat_ptpool_t stats;
+		if (len < sizeof(kstat_ptpool_t)) return 0;
+
+		pt_pool_stats(&stats, reset);
+
+		if (copy_to_user(buf, &stats, sizeof(kstat_ptpool_t)))
+			return ERR_INVALID_ARG;
+		return 1;
+	}
+	case KSTAT_LOG: {
+		char record[KSTAT_LOG_MAX];
+		if (len > KSTAT_LOG_MAX) return ERR_INVALID_ARG;
+		if (copy_from_user(record, buf, len)) return ERR_INVALID_ARG;
+		return serial_log(record, len) ? 1 : 0;
+	}
+	default:
+		return ERR_INVALID_ARG;
+	}
+}
+
+/**
+ * @brief Drives the sampling profiler (@see prof.h)
+ *
+ * @param args the operation, a buffer and its length in bytes
+ * @return what the operation returns, a negative error code otherwise
+ */
+int _profile(void **args) {
+	void *kargs[3];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	int op = (int) kargs[0];
+	void *buf = kargs[1];
+	int len = (int) kargs[2];
+
+	switch (op) {
+	case PROF_START:
+		prof_start();
+		return 0;
+	case PROF_STOP:
+		return prof_stop();
+	case PROF_DRAIN:
+		if (len < 0 || !user_range(buf, len)) return ERR_INVALID_ARG;
+		return prof_drain(buf, len / sizeof(prof_sample_t));
+	default:
+		return ERR_INVALID_ARG;
+	}
+}
+
+/**
+ * @brief Drives the trace of the scheduler (@see schedtrace.h)
+ *
+ * @param args the operation, a buffer and its length in bytes
+ * @return what the operation returns, a negative error code otherwise
+ */
+int _sched_trace(void **args) {
+	void *kargs[3];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+
+	int op = (int) kargs[0];
+	void *buf = kargs[1];
+	int len = (int) kargs[2];
+
+	switch (op) {
+	case SCHED_TRACE_START:
+		trace_start();
+		return 0;
+	case SCHED_TRACE_STOP:
+		return trace_stop();
+	case SCHED_TRACE_DRAIN:
+		if (len < 0 || !user_range(buf, len)) return ERR_INVALID_ARG;
+		return trace_drain(buf, len / sizeof(sched_event_t));
+	case SCHED_TRACE_RATE:
+		return clock_tsc_khz();
+	default:
+		return ERR_INVALID_ARG;
+	}
 }
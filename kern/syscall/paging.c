@@ -3,12 +3,20 @@
  * @brief User space memory management
  * 
  * This file contains the new_pages and remove_pages system calls, essential
- * for memory allocation in user space. These system calls operate using the
- * memregions table in the process descriptor table. This table is a map from
- * virtual addresses to the number of frames that were allocated by new_pages
- * for that address, and allow remove_pages to effectively remove the actual
- * number of allocated pages without having to get a size argument when given
- * an address.
+ * for memory allocation in user space, and the shm_create, shm_attach and
+ * shm_detach system calls sharing memory between processes (@see vm/shm.c),
+ * the map_file system call mapping a RAM disk file (@see vm/filemap.c),
+ * the memstat system call reporting the memory of the process, the
+ * set_frame_limit system call limiting it (@see vm/quota.c), and the pipe
+ * system calls, which move whole pages between processes (@see vm/pipe.c).
+ * These system calls operate using the
+ * regions of the process (@see vm/region.c), which record the address and
+ * the number of pages of every allocation made by new_pages. This allows
+ * remove_pages to remove the actual number of allocated pages without having
+ * to get a size argument when given an address, and new_pages to refuse
+ * overlapping allocations without probing the page tables. An attached
+ * shared memory segment is a region as well, which remove_pages refuses,
+ * and so is a grow-down stack (@see vm/growstack.c).
  */
 
 #include <stdlib.h>
@@ -19,6 +27,34 @@
 #include <x86/page.h>
 #include <syshelper.h>
 #include <errors.h>
+#include <image.h>
+#include <region.h>
+#include <usercopy.h>
+#include <shm.h>
+#include <filemap.h>
+#include <quota.h>
+#include <growstack.h>
+#include <lazy.h>
+#include <pipe.h>
+
+/* The flags new_pages accepts in its length */
+#define NEW_PAGES_FLAGS \
+	(NEW_PAGES_GROWSDOWN | NEW_PAGES_LAZY | NEW_PAGES_TEMPLATE)
+
+/**
+ * @brief Checks whether num_pages pages from base can't be allocated
+ *
+ * The caller holds the region lock of the process.
+ */
+static boolean_t range_taken(process_t *process, vaddr_t base,
+		int num_pages) {
+	// The text and rodata may not be paged in yet, check them explicitly
+	image_t *image = process->image;
+	return region_overlaps(&process->regions, base, num_pages)
+		|| (image != NULL && base < image->start
+			+ image->num_pages * PAGE_SIZE
+			&& image->start < base + num_pages * PAGE_SIZE);
+}
 
 /**
  * @brief Allocates len bytes (page-aligned) from base (page-aligned)
@@ -27,103 +63,406 @@
  * in the memregions table for later deallocation. It strives to ensure that
  * whenever the system call fails, everything that was done up to that point
  * is reverted to its state at the time of the call.
+ * No frame is allocated here: the pages are mapped on the zero frame and each
+ * one gets a frame on its first write, so large regions the program barely
+ * touches are cheap. A frame is still reserved for every page, so that the
+ * call fails right away if memory runs short.
+ * With NEW_PAGES_GROWSDOWN in len, the region is a stack of which only the
+ * top page is mapped, extended on the faults under it (@see growstack.c).
+ * With NEW_PAGES_LAZY, and NEW_PAGES_TEMPLATE, its pages are mapped when
+ * first touched, and nothing is reserved (@see lazy.c).
  */
 int _new_pages(int* args) {
-	if (!check_array(args, 2)) return ERR_INVALID_ARG;
-	vaddr_t base = args[0];
-	int len = args[1];
+	int kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	vaddr_t base = kargs[0];
+	int flags = kargs[1] & NEW_PAGES_FLAGS;
+	int len = kargs[1] & ~NEW_PAGES_FLAGS;
+	if ((flags & NEW_PAGES_TEMPLATE) != 0) flags |= NEW_PAGES_LAZY;
+	if (flags == (NEW_PAGES_GROWSDOWN | NEW_PAGES_LAZY))
+		return ERR_INVALID_ARG;
 
 	if (base % PAGE_SIZE != 0) return ERR_INVALID_ARG;
-	if (len < 0 || len % PAGE_SIZE != 0 || len > 0xfff * PAGE_SIZE)
-		return ERR_INVALID_ARG;
+	if (len <= 0 || len % PAGE_SIZE != 0) return ERR_INVALID_ARG;
 
 	process_t *process = get_self()->process;
 	if (process == NULL) kernel_panic("Unregistered thread");
-	if (process->next_memregion_idx == -1) return ERR_WORN_OUT_NEW_PAGES;
 
 	// Number of pages to allocate
 	int num_pages = len / PAGE_SIZE;
 
-	int i;
-	for (i = 0; i < num_pages; ++i) {
-		int err = create_page(base + i * PAGE_SIZE, MEM_TYPE_USER, NULL);
-		if (err) {
-			// Roll back
-			int j;
-			for (j = 0; j < i; ++j) {
-				int err = destroy_page(base + j * PAGE_SIZE);
-				if (err) kernel_panic(
-					"Unable to destroy previously allocated page!");
-			}
-			return err;
-		}
-	}
+	mutex_lock(process->region_lock);
 
-	// Zero out the page
-	memset((void *)base, 0, len);
+	if (range_taken(process, base, num_pages)) {
+		mutex_unlock(process->region_lock);
+		return ERR_REGION_OVERLAP;
+	}
 
-	// Memory region tracking
-	uint32_t entry = base | num_pages;
-	process->memregions[process->next_memregion_idx] = entry;
+	if (flags != 0) {
+		int err;
+		if (flags & NEW_PAGES_GROWSDOWN)
+			err = stack_create(process, base, num_pages);
+		else
+			err = lazy_create(process, base, num_pages,
+				(flags & NEW_PAGES_TEMPLATE) ?
+				REGION_LAZY_TEMPLATE : REGION_LAZY_ZERO, 0);
+		mutex_unlock(process->region_lock);
+		return err;
+	}
 
-	// Find and set the next available spot
-	int nextid = (process->next_memregion_idx + 1) % PAGE_TABLE_ENTRIES;
-	for(;nextid != process->next_memregion_idx;
-			nextid = (nextid + 1) % PAGE_TABLE_ENTRIES) {
-		if (process->memregions[nextid] == 0) {
-			break;
-		}
+	/*
+	 * The frames are only reserved here, so that running out of memory is
+	 * still reported now rather than at the first write
+	 */
+	int err = map_range(base, num_pages, MEM_TYPE_BSS);
+	if (err) {
+		mutex_unlock(process->region_lock);
+		return err;
 	}
-	if (nextid == process->next_memregion_idx) {
-		// All fields in the table are full
-		process->next_memregion_idx = -1;
-	} else {
-		process->next_memregion_idx = nextid;
+
+	// Memory region tracking
+	err = insert_region(&process->regions, base, num_pages);
+	if (err) {
+		if (unmap_range(base, num_pages))
+			kernel_panic("Unable to destroy previously allocated page!");
 	}
 
-	return 0;
+	mutex_unlock(process->region_lock);
+	return err;
 }
 
 /**
  * @brief Removes previously allocated pages from the process' memory space
  * 
- * The function uses the memregions table to map from the address to the
- * number of pages to free. It also frees the table entry when done and
- * updates the process data structure accordingly.
+ * The function uses the regions of the process to map from the address to
+ * the number of pages to free, and forgets the region once done. Files
+ * mapped by map_file are removed the same way.
  */
 int _remove_pages(void* argbase) {
 	vaddr_t base = (vaddr_t) argbase;
 
-	if (base % PAGE_SIZE != 0) return -1;
+	if (base % PAGE_SIZE != 0) return ERR_INVALID_ARG;
 
 	process_t *process = get_self()->process;
 	if (process == NULL) kernel_panic("Unregistered thread");
 
-	// Get number of pages in region
-	int i, reg_idx;
-	int num_pages = 0;
-	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
-		if ((process->memregions[i] & 0xfffff000) == base) {
-			reg_idx = i;
-			num_pages = process->memregions[i] & 0xfff;
-			break;
-		}
+	mutex_lock(process->region_lock);
+
+	// Shared memory segments go away with shm_detach
+	region_t *region = find_region(&process->regions, base);
+	if (region != NULL && region->start == base
+			&& region->kind == REGION_SHM) {
+		mutex_unlock(process->region_lock);
+		return ERR_INVALID_ARG;
+	}
+
+	// A lazy region only has the pages that were touched
+	if (region != NULL && region->start == base && region_is_lazy(region)) {
+		lazy_unmap(region);
+		remove_region(&process->regions, base);
+		mutex_unlock(process->region_lock);
+		return 0;
 	}
 
-	// There was no memory region at this address
-	if (num_pages == 0) return -2;
+	// Only the top of a stack is mapped
+	vaddr_t mapped = base;
+	if (region != NULL && region->start == base
+			&& region->kind == REGION_STACK)
+		mapped = stack_mapped(region);
+
+	// Get number of pages in region
+	int num_pages = remove_region(&process->regions, base);
+	if (num_pages < 0) {
+		// There was no memory region at this address
+		mutex_unlock(process->region_lock);
+		return num_pages;
+	}
+	num_pages -= (mapped - base) / PAGE_SIZE;
 
 	// Remove the pages
-	for (i = 0; i < num_pages; ++i) {
-		int err = destroy_page(base + i * PAGE_SIZE);
-		if (err) kernel_panic("Memory regions unsafely unallocated");		
+	if (unmap_range(mapped, num_pages))
+		kernel_panic("Memory regions unsafely unallocated");
+
+	mutex_unlock(process->region_lock);
+	return 0;
+}
+
+/**
+ * @brief Maps a segment at base and records it in the regions
+ *
+ * The caller gives the attachment it holds on the segment to the region, or
+ * back to the segment on error.
+ */
+static int attach_segment(int id, paddr_t *frames, int num_pages,
+		vaddr_t base) {
+	if (base % PAGE_SIZE != 0) {
+		shm_put(id);
+		return ERR_INVALID_ARG;
+	}
+
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
+	mutex_lock(process->region_lock);
+
+	if (range_taken(process, base, num_pages)) {
+		mutex_unlock(process->region_lock);
+		shm_put(id);
+		return ERR_REGION_OVERLAP;
 	}
 
-	// Clear the region entry
-	process->memregions[reg_idx] = 0;
-	if (process->next_memregion_idx == -1) {
-		process->next_memregion_idx = reg_idx;
+	int err = map_shared(base, frames, num_pages);
+	if (err == 0) {
+		err = insert_region(&process->regions, base, num_pages);
+		if (err && unmap_range(base, num_pages))
+			kernel_panic("Unable to unmap a shared memory segment");
+	}
+	if (err == 0) {
+		region_t *region = find_region(&process->regions, base);
+		region->kind = REGION_SHM;
+		region->object = id;
+	}
+
+	mutex_unlock(process->region_lock);
+	if (err) shm_put(id);
+	return err;
+}
+
+/**
+ * @brief Creates a shared memory segment of len bytes (page-aligned) and
+ * attaches it at base (page-aligned)
+ *
+ * The segment is filled with zeros. Its frames are allocated right away,
+ * since they are meant to be written by several processes.
+ *
+ * @return the id of the segment, a negative error code otherwise
+ */
+int _shm_create(int *args) {
+	int kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	vaddr_t base = kargs[0];
+	int len = kargs[1];
+
+	if (len <= 0 || len % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+
+	int num_pages = len / PAGE_SIZE;
+	paddr_t *frames;
+	int id = shm_create_segment(num_pages, &frames);
+	if (id < 0) return id;
+
+	// The region takes over the attachment of the creation
+	int err = attach_segment(id, frames, num_pages, base);
+	return err ? err : id;
+}
+
+/**
+ * @brief Attaches the shared memory segment id at base (page-aligned)
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int _shm_attach(int *args) {
+	int kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	int id = kargs[0];
+	vaddr_t base = kargs[1];
+
+	int num_pages;
+	paddr_t *frames = shm_get(id, &num_pages);
+	if (frames == NULL) return ERR_NO_SEGMENT;
+
+	return attach_segment(id, frames, num_pages, base);
+}
+
+/**
+ * @brief Detaches the shared memory segment attached at base
+ *
+ * The segment is destroyed once no process has it attached anymore.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int _shm_detach(void *argbase) {
+	vaddr_t base = (vaddr_t) argbase;
+
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
+	mutex_lock(process->region_lock);
+
+	region_t *region = find_region(&process->regions, base);
+	if (region == NULL || region->start != base
+			|| region->kind != REGION_SHM) {
+		mutex_unlock(process->region_lock);
+		return ERR_NO_SEGMENT;
 	}
+	int id = region->object;
+	int num_pages = remove_region(&process->regions, base);
+
+	if (unmap_range(base, num_pages))
+		kernel_panic("Shared memory segment unsafely detached");
 
+	mutex_unlock(process->region_lock);
+	shm_put(id);
 	return 0;
 }
+
+/**
+ * @brief Maps the file filename at base (page-aligned), read-only
+ *
+ * The pages come from the cache of the file and cost no copy. Writing to
+ * them gives the process a private copy of the page. The mapping is removed
+ * with remove_pages. With MAP_FILE_LAZY in base, each page is only mapped
+ * when first touched (@see lazy.c).
+ *
+ * @return the length of the file in bytes, a negative error code otherwise
+ */
+int _map_file(void **args) {
+	void *kargs[2];
+	if (copy_from_user(kargs, args, sizeof(kargs))) return ERR_INVALID_ARG;
+	boolean_t lazy = ((vaddr_t) kargs[1] & MAP_FILE_LAZY) != 0;
+	vaddr_t base = (vaddr_t) kargs[1] & ~MAP_FILE_LAZY;
+	if (base % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+
+	char *filename = malloc(STR_MAX_LEN);
+	if (filename == NULL) return ERR_MALLOC_FAIL;
+	if (strncpy_from_user(filename, kargs[0], STR_MAX_LEN) < 0) {
+		free(filename);
+		return ERR_INVALID_ARG;
+	}
+	int file = file_index(exec2obj_entry(filename));
+	free(filename);
+	if (file < 0) return file;
+
+	int num_pages = file_pages(file);
+	if (num_pages == 0) return ERR_INVALID_ARG;
+
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
+	mutex_lock(process->region_lock);
+
+	if (range_taken(process, base, num_pages)) {
+		mutex_unlock(process->region_lock);
+		return ERR_REGION_OVERLAP;
+	}
+
+	int err;
+	if (lazy) {
+		err = lazy_create(process, base, num_pages, REGION_LAZY_FILE, file);
+		mutex_unlock(process->region_lock);
+		return err ? err : exec2obj_userapp_TOC[file].execlen;
+	}
+
+	err = filemap_map(file, base);
+	if (err == 0) {
+		err = insert_region(&process->regions, base, num_pages);
+		if (err && unmap_range(base, num_pages))
+			kernel_panic("Unable to unmap a mapped file");
+	}
+	if (err == 0) {
+		region_t *region = find_region(&process->regions, base);
+		region->kind = REGION_FILE;
+		region->object = file;
+	}
+
+	mutex_unlock(process->region_lock);
+	return err ? err : exec2obj_userapp_TOC[file].execlen;
+}
+
+/**
+ * @brief Reports the memory used by the calling process
+ *
+ * The regions lock keeps new_pages, remove_pages and the shared memory
+ * calls of the other threads out while the page tables are walked.
+ *
+ * @param stat where to put the statistics @see memstat.h
+ * @return 0 on success, a negative error code otherwise
+ */
+int _memstat(memstat_t *stat) {
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
+	memstat_t snapshot;
+	mutex_lock(process->region_lock);
+	paging_stats(&snapshot);
+	mutex_unlock(process->region_lock);
+
+	if (copy_to_user(stat, &snapshot, sizeof(memstat_t)))
+		return ERR_INVALID_ARG;
+	return 0;
+}
+
+/**
+ * @brief Limits the frames the calling process and its future children may
+ * hold, in a group of their own
+ *
+ * @param frames the limit, in frames
+ * @return 0 on success, a negative error code otherwise
+ */
+int _set_frame_limit(int frames) {
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
+	// The frames of the process must not move while they change group
+	if (process->threads > 1) return ERR_MULTIPLE_THREADS;
+
+	return quota_set(process, frames);
+}
+
+/**
+ * @brief Creates a pipe
+ *
+ * @return the id of the pipe, a negative error code otherwise
+ */
+int _pipe_create(void) {
+	return pipe_create();
+}
+
+/**
+ * @brief Checks the id, buffer and length a pipe system call is given
+ *
+ * @param args the user arguments, copied in kargs
+ * @return 0 if they are valid, ERR_INVALID_ARG otherwise
+ */
+static int pipe_args(void **args, void *kargs[3]) {
+	if (copy_from_user(kargs, args, 3 * sizeof(void *)))
+		return ERR_INVALID_ARG;
+	int len = (int) kargs[2];
+	if (len < 0 || !user_range(kargs[1], len)) return ERR_INVALID_ARG;
+	return 0;
+}
+
+/**
+ * @brief Writes len bytes of buf to a pipe
+ *
+ * @param args the id of the pipe, buf and len
+ * @return the number of bytes written, a negative error code otherwise
+ */
+int _pipe_write(void **args) {
+	void *kargs[3];
+	if (pipe_args(args, kargs)) return ERR_INVALID_ARG;
+
+	return pipe_write((int) kargs[0], (const char *) kargs[1], (int) kargs[2]);
+}
+
+/**
+ * @brief Reads at most len bytes of a pipe into buf
+ *
+ * @param args the id of the pipe, buf and len
+ * @return the number of bytes read, 0 at the end of the stream, a negative
+ * error code otherwise
+ */
+int _pipe_read(void **args) {
+	void *kargs[3];
+	if (pipe_args(args, kargs)) return ERR_INVALID_ARG;
+
+	return pipe_read((int) kargs[0], (char *) kargs[1], (int) kargs[2]);
+}
+
+/**
+ * @brief Closes a pipe, @see pipe_close
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int _pipe_close(int id) {
+	return pipe_close(id);
+}
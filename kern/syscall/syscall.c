@@ -1,26 +1,288 @@
 /*
  * @file syscall.c
  * @brief Syscall functions
+ *
+ * Every system call has its trap gate, whose wrapper saves the user context
+ * and calls the handler. Most of them can also be made with sysenter, which
+ * spares the processor the lookup of the gate and the privilege checks of
+ * int. Its single entry point (@see sysenter_wrappers.S) builds the same
+ * frame as a gate, then _sysenter calls the handler of the system call by
+ * its number. fork, thread_fork and swexn only have their gate: fork and
+ * thread_fork copy the frame of their wrapper to the child, and swexn may
+ * replace the whole user context. The extensions made once the reserved
+ * gates ran out have no gate of their own, only a number for sysenter.
+ *
+ * On the CPUs without sysenter, the stubs make the same calls by number
+ * through the gate of SYSCALL_INT, whose wrapper also calls _sysenter. The
+ * kernel data page tells the stubs which to use (@see kdata.h).
+ *
+ * A few system calls can also be submitted in batches, through a ring in
+ * user memory which a single system call empties (@see _sysring_enter).
  * 
  * @author Daniel Balle (dballe)
  * @author Loic Ottet (lottet)
  */
 
+#include <stdlib.h>
 #include <seg.h>
 #include <idt.h>
 #include <syscall_int.h>
+#include <errors.h>
 #include <interrupts.h>
 #include <syshelper.h>
 #include <inc/syscall.h>
+#include <cpu.h>
+#include <usercopy.h>
+#include <sysring.h>
+#include <sysstat.h>
+#include <cputime.h>
+#include <vdso.h>
+
+/* The MSRs of sysenter */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* The cpuid feature bit of sysenter, in edx */
+#define CPUID_SEP (1 << 11)
+
+/* A handler, called with the argument in %esi whether it takes it or not */
+typedef int (*syscall_fn_t)(void *arg);
+
+#define FAST(num, fn) [(num) - SYSCALL_INT] = (syscall_fn_t) (fn)
+
+/* The handlers reachable through sysenter, indexed by the gate number */
+static const syscall_fn_t fast_syscalls[SYSCALL_RESERVED_END - SYSCALL_INT
+		+ 1] = {
+	FAST(GETTID_INT, _gettid),
+	FAST(EXEC_INT, _exec),
+	FAST(SPAWN_INT, _spawn),
+	FAST(YIELD_INT, _yield),
+	FAST(DESCHEDULE_INT, _deschedule),
+	FAST(MAKE_RUNNABLE_INT, _make_runnable),
+	FAST(SLEEP_INT, _sleep),
+	FAST(USLEEP_INT, _usleep),
+	FAST(GET_TICKS_INT, _get_ticks),
+	FAST(GET_TIME_NS_INT, _get_time_ns),
+	FAST(SET_STATUS_INT, _set_status),
+	FAST(WAIT_INT, _wait),
+	FAST(VANISH_INT, _vanish),
+	FAST(NEW_PAGES_INT, _new_pages),
+	FAST(REMOVE_PAGES_INT, _remove_pages),
+	FAST(SHM_CREATE_INT, _shm_create),
+	FAST(SHM_ATTACH_INT, _shm_attach),
+	FAST(SHM_DETACH_INT, _shm_detach),
+	FAST(MAP_FILE_INT, _map_file),
+	FAST(MEMSTAT_INT, _memstat),
+	FAST(SET_FRAME_LIMIT_INT, _set_frame_limit),
+	FAST(SET_NICE_INT, _set_nice),
+	FAST(GETCHAR_INT, _getchar),
+	FAST(READLINE_INT, _readline),
+	FAST(PRINT_INT, _print),
+	FAST(SET_TERM_COLOR_INT, _set_term_color),
+	FAST(GET_CURSOR_POS_INT, _get_cursor_pos),
+	FAST(SET_CURSOR_POS_INT, _set_cursor_pos),
+	FAST(HALT_INT, _halt),
+	FAST(READFILE_INT, _readfile),
+	FAST(KSTAT_INT, _kstat),
+	FAST(FUTEX_WAIT_INT, _futex_wait),
+	FAST(FUTEX_WAKE_INT, _futex_wake),
+	FAST(SYSRING_INT, _sysring_enter),
+	FAST(PROFILE_INT, _profile),
+	FAST(SCHED_TRACE_INT, _sched_trace),
+	FAST(PIPE_CREATE_INT, _pipe_create),
+	FAST(PIPE_WRITE_INT, _pipe_write),
+	FAST(PIPE_READ_INT, _pipe_read),
+	FAST(PIPE_CLOSE_INT, _pipe_close),
+	FAST(IPC_CALL_INT, _ipc_call),
+	FAST(IPC_RECEIVE_INT, _ipc_receive),
+	FAST(IPC_REPLY_INT, _ipc_reply),
+	FAST(IPC_REPLY_WAIT_INT, _ipc_reply_wait),
+	FAST(SET_DEADLINE_INT, _set_deadline),
+	FAST(GETRUSAGE_INT, _getrusage),
+};
+
+#define BATCH(num, fn) FAST(num, fn)
+
+/* The handlers a ring may call, @see sysring.h */
+static const syscall_fn_t batch_syscalls[SYSCALL_RESERVED_END - SYSCALL_INT
+		+ 1] = {
+	BATCH(YIELD_INT, _yield),
+	BATCH(MAKE_RUNNABLE_INT, _make_runnable),
+	BATCH(NEW_PAGES_INT, _new_pages),
+	BATCH(REMOVE_PAGES_INT, _remove_pages),
+	BATCH(PRINT_INT, _print),
+	BATCH(SET_TERM_COLOR_INT, _set_term_color),
+	BATCH(SET_CURSOR_POS_INT, _set_cursor_pos),
+	BATCH(FUTEX_WAKE_INT, _futex_wake),
+};
+
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+	asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/**
+ * @brief Calls the handler of a system call made with sysenter
+ *
+ * @param num the number of the system call, that of its gate
+ * @param arg the argument of the system call
+ * @return what the handler returns, ERR_INVALID_ARG if there is no such
+ * system call or if it can't be made with sysenter
+ */
+int _sysenter(unsigned int num, void *arg) {
+	if (num < SYSCALL_INT || num > SYSCALL_RESERVED_END)
+		return ERR_INVALID_ARG;
+
+	syscall_fn_t fn = fast_syscalls[num - SYSCALL_INT];
+	if (fn == NULL) return ERR_INVALID_ARG;
+
+	cputime_enter();
+#if SYSCALL_PROFILE
+	sysstat_enter();
+	return cputime_leave(sysstat_exit(num, fn(arg)));
+#else
+	return cputime_leave(fn(arg));
+#endif
+}
+
+/**
+ * @brief Makes the make_runnable requests of a ring from head on, up to
+ * MAKE_RUNNABLE_BATCH of them, and stores their results
+ *
+ * @param ring the ring, in user memory and checked
+ * @param size its size, as checked
+ * @param head the first request, a make_runnable
+ * @param tail the end of the requests
+ * @return the number of requests made
+ */
+static int wake_batch(sysring_t *ring, unsigned int size, unsigned int head,
+		unsigned int tail) {
+	unsigned int mask = size - 1;
+	int tids[MAKE_RUNNABLE_BATCH];
+	int results[MAKE_RUNNABLE_BATCH];
+
+	int n = 0;
+	while (n < MAKE_RUNNABLE_BATCH && head + n != tail) {
+		sysreq_t req;
+		if (copy_from_user(&req, &ring->reqs[(head + n) & mask],
+				sizeof(sysreq_t))) break;
+		if (req.num != MAKE_RUNNABLE_INT) break;
+		tids[n++] = (int) req.arg;
+	}
+
+	make_runnable_batch(tids, n, results);
+
+	int i;
+	for (i = 0; i < n; ++i) {
+		sysreq_t *slot = &ring->reqs[(head + i) & mask];
+		if (copy_to_user(&slot->result, &results[i], sizeof(int))) break;
+
+		unsigned int next = head + i + 1;
+		if (copy_to_user((void *) &ring->head, &next, sizeof(int))) break;
+	}
+	return i;
+}
+
+/**
+ * @brief Makes the system calls submitted in a ring, in order
+ *
+ * The requests from head up to the tail read on entry are made one after
+ * the other, head is moved past each one once its result is stored. A
+ * request the ring can't make, or whose result can't be stored, stops the
+ * batch there, the program finds it at head.
+ *
+ * Consecutive make_runnable requests are made together, in a single
+ * dont_switch_me_out area (@see make_runnable_batch).
+ *
+ * @param ring the ring, in user memory
+ * @return the number of requests made, ERR_INVALID_ARG if the ring itself
+ * is invalid
+ */
+int _sysring_enter(sysring_t *ring) {
+	sysring_t header;
+	if (copy_from_user(&header, ring, sizeof(sysring_t)))
+		return ERR_INVALID_ARG;
+
+	unsigned int size = header.size;
+	if (size == 0 || size > SYSRING_MAX_SIZE || (size & (size - 1)) != 0)
+		return ERR_INVALID_ARG;
+	if (!user_range(ring, sizeof(sysring_t) + size * sizeof(sysreq_t)))
+		return ERR_INVALID_ARG;
+	if (header.tail - header.head > size) return ERR_INVALID_ARG;
+
+	unsigned int head;
+	int done = 0;
+	for (head = header.head; head != header.tail; ++head) {
+		sysreq_t *slot = &ring->reqs[head & (size - 1)];
+		sysreq_t req;
+		if (copy_from_user(&req, slot, sizeof(sysreq_t))) break;
+		if (req.num < SYSCALL_INT || req.num > SYSCALL_RESERVED_END) break;
+
+		if (req.num == MAKE_RUNNABLE_INT) {
+			int made = wake_batch(ring, size, head, header.tail);
+			if (made <= 0) break;
+			head += made - 1;
+			done += made;
+			continue;
+		}
+
+		syscall_fn_t fn = batch_syscalls[req.num - SYSCALL_INT];
+		if (fn == NULL) break;
+
+		int result = fn(req.arg);
+		if (copy_to_user(&slot->result, &result, sizeof(int))) break;
+
+		unsigned int next = head + 1;
+		if (copy_to_user((void *) &ring->head, &next, sizeof(int))) break;
+		done++;
+	}
+
+	return done;
+}
+
+/**
+ * @brief Sets up the sysenter entry point on the calling CPU, if it has one
+ *
+ * The kernel stack is the one the TSS of the CPU points to, the entry point
+ * loads it from there. Every CPU calls this once it has its TSS. If one of
+ * them lacks sysenter, the programs are told to use the gate of SYSCALL_INT
+ * instead.
+ */
+void install_sysenter(void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+	// The first Pentium Pro models report sysenter without having it
+	uint32_t family = (eax >> 8) & 0xF;
+	uint32_t model = (eax >> 4) & 0xF;
+	uint32_t stepping = eax & 0xF;
+	if (!(edx & CPUID_SEP) || (family == 6 && model < 3 && stepping < 3)) {
+		vdso_set_sysenter(FALSE);
+		return;
+	}
+
+	wrmsr(MSR_SYSENTER_CS, SEGSEL_KERNEL_CS);
+	wrmsr(MSR_SYSENTER_ESP, (uint32_t) &this_cpu()->tss.esp0);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_int);
+}
 
 int install_syscalls() {
 	init_syscall_mutexes();
+	vdso_set_sysenter(TRUE);
+	install_sysenter();
+
+	// exec, spawn and readfile find the programs through an index
+	int err = init_exec2obj_index();
+	if (err) return err;
 
 	trap_gate_t trap_gate;
 
 	trap_gate.segment = SEGSEL_KERNEL_CS;
 	trap_gate.privilege_level = 0x3;
 
+	trap_gate.offset = (uint32_t) syscall_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SYSCALL_INT);
+
 	trap_gate.offset = (uint32_t) gettid_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), GETTID_INT);
 
@@ -30,6 +292,9 @@ int install_syscalls() {
 	trap_gate.offset = (uint32_t) fork_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), FORK_INT);
 
+	trap_gate.offset = (uint32_t) spawn_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SPAWN_INT);
+
 	trap_gate.offset = (uint32_t) yield_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), YIELD_INT);
 	
@@ -42,8 +307,14 @@ int install_syscalls() {
 	trap_gate.offset = (uint32_t) sleep_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), SLEEP_INT);
 
+	trap_gate.offset = (uint32_t) usleep_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), USLEEP_INT);
+
 	trap_gate.offset = (uint32_t) get_ticks_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), GET_TICKS_INT);
+
+	trap_gate.offset = (uint32_t) get_time_ns_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), GET_TIME_NS_INT);
 	
 	trap_gate.offset = (uint32_t) set_status_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), SET_STATUS_INT);
@@ -60,6 +331,27 @@ int install_syscalls() {
 	trap_gate.offset = (uint32_t) remove_pages_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), REMOVE_PAGES_INT);
 
+	trap_gate.offset = (uint32_t) shm_create_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SHM_CREATE_INT);
+
+	trap_gate.offset = (uint32_t) shm_attach_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SHM_ATTACH_INT);
+
+	trap_gate.offset = (uint32_t) shm_detach_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SHM_DETACH_INT);
+
+	trap_gate.offset = (uint32_t) map_file_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), MAP_FILE_INT);
+
+	trap_gate.offset = (uint32_t) memstat_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), MEMSTAT_INT);
+
+	trap_gate.offset = (uint32_t) set_frame_limit_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SET_FRAME_LIMIT_INT);
+
+	trap_gate.offset = (uint32_t) set_nice_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SET_NICE_INT);
+
 	trap_gate.offset = (uint32_t) getchar_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), GETCHAR_INT);
 	
@@ -90,5 +382,23 @@ int install_syscalls() {
 	trap_gate.offset = (uint32_t) readfile_int;
 	insert_to_idt(create_trap_idt_entry(&trap_gate), READFILE_INT);
 
+	trap_gate.offset = (uint32_t) kstat_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), KSTAT_INT);
+
+	trap_gate.offset = (uint32_t) futex_wait_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), FUTEX_WAIT_INT);
+
+	trap_gate.offset = (uint32_t) futex_wake_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), FUTEX_WAKE_INT);
+
+	trap_gate.offset = (uint32_t) sysring_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SYSRING_INT);
+
+	trap_gate.offset = (uint32_t) profile_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), PROFILE_INT);
+
+	trap_gate.offset = (uint32_t) sched_trace_int;
+	insert_to_idt(create_trap_idt_entry(&trap_gate), SCHED_TRACE_INT);
+
 	return 0;
 }
@@ -17,6 +17,59 @@
 #include <simics.h>
 
 #include <syshelper.h>
+#include <image.h>
+
+/**
+ * An index of the exec2obj table by file name, built at boot: an open
+ * addressing hash table of the positions of the entries in the table, -1 in
+ * the free slots. It has at least twice as many slots as there are entries,
+ * so the probes are short.
+ */
+static int *toc_index = NULL;
+static unsigned int toc_slots = 0;
+
+/**
+ * @brief Hashes a file name, FNV-1a
+ */
+static unsigned int name_hash(const char *name) {
+	unsigned int hash = 2166136261u;
+	for (; *name != '\0'; ++name) {
+		hash ^= (unsigned char) *name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * @brief Builds the index of the exec2obj table
+ * @return 0 on success, a negative error code otherwise
+ */
+int init_exec2obj_index(void) {
+	unsigned int slots = 1;
+	while (slots < 2 * exec2obj_userapp_count) slots <<= 1;
+
+	toc_index = malloc(slots * sizeof(int));
+	if (toc_index == NULL) return ERR_MALLOC_FAIL;
+	toc_slots = slots;
+
+	unsigned int i;
+	for (i = 0; i < slots; ++i) toc_index[i] = -1;
+
+	int file;
+	for (file = 0; file < exec2obj_userapp_count; ++file) {
+		const char *name = exec2obj_userapp_TOC[file].execname;
+		unsigned int slot = name_hash(name) & (slots - 1);
+		while (toc_index[slot] != -1) {
+			// The first of two files with the same name wins, as before
+			if (strcmp(exec2obj_userapp_TOC[toc_index[slot]].execname,
+					name) == 0) break;
+			slot = (slot + 1) & (slots - 1);
+		}
+		if (toc_index[slot] == -1) toc_index[slot] = file;
+	}
+
+	return 0;
+}
 
 /**
  * @brief Returns the userapp entry for a given filename
@@ -29,24 +82,17 @@ const exec2obj_userapp_TOC_entry *exec2obj_entry(const char *filename) {
 	// Verify that filename is not NULL
 	if (filename == NULL) return NULL;
 
-	// Find the corresponding entry in the exec2obj	
-	const exec2obj_userapp_TOC_entry *cursor = exec2obj_userapp_TOC;
-	const exec2obj_userapp_TOC_entry *target = NULL;
-
-	int i;
-	for (i = 0; i < exec2obj_userapp_count; i++, cursor++) {
-		
-		// Compare the execname to filename
-		if (strcmp(filename,cursor->execname) == 0) {
-			
-			// We found the correct entry
-			target = cursor;
-			break;
-		}
+	// Probe the index until the name or a free slot
+	unsigned int slot = name_hash(filename) & (toc_slots - 1);
+	while (toc_slots > 0 && toc_index[slot] != -1) {
+		const exec2obj_userapp_TOC_entry *cursor =
+			&exec2obj_userapp_TOC[toc_index[slot]];
+		if (strcmp(filename, cursor->execname) == 0) return cursor;
+		slot = (slot + 1) & (toc_slots - 1);
 	}
-	
-	// If target is NULL we didn't find the entry
-	return target;
+
+	// We didn't find the entry
+	return NULL;
 }
 
 
@@ -93,122 +139,3 @@ int getbytes(const char *filename, int offset, int size, char *buf) {
 	// The number of copied bytes is i
 	return i;
 }
-
-/**
- * @brief Gives the length of the given null-terminated string array
- */
-int string_array_length(char **array) {
-	if (array == NULL) return 0;
-	int i;
-	for (i = 0; i <= MAX_ARGS; ++i) {
-		if (array[i] == NULL) {
-			return i;
-		}
-	}
-	return ERR_ARRAY_LENGTH;
-}
-
-/**
- * @brief Checks whether the given address won't cause a fault
- * 
- * @param write checks if we can write to the address as well
- */
-boolean_t check_page(vaddr_t addr, boolean_t write) {
-	pte_t *pte = get_pte(PAGE_ADDR(addr), (void*) get_cr3());
-
-	if (pte != NULL) {
-		boolean_t check = TRUE;
-		check &= PE_GETFLAG(*pte, PTE_PRESENT);
-		if (write) {
-			check &= PE_GETFLAG(*pte, PTE_USER);
-			check &= PE_GETFLAG(*pte, PTE_READWRITE);
-		}
-		return check;
-	}
-
-	return FALSE;
-}
-
-/**
- * @brief Checks whether the given buffer can be safely read/written to
- */
-boolean_t check_buffer(char* buf, size_t len, boolean_t write) {
-	uint32_t cursor;
-	int checked;
-	for (cursor = (uint32_t) buf, checked = 0;
-			checked < len;
-			checked += PAGE_SIZE - (cursor - PAGE_ADDR(cursor)),
-				cursor = PAGE_ADDR(cursor) + PAGE_SIZE) {
-		if (!check_page(cursor, write)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
-}
-
-/**
- * @brief Checks if the given string terminates and can be read safely
- */
-boolean_t check_string(char* str) {
-	uint32_t cursor;
-	int checked;
-	for (cursor = (uint32_t) str, checked = 0;
-			checked < STR_MAX_LEN;
-			cursor = PAGE_ADDR(cursor) + PAGE_SIZE) {
-		if (!check_page(cursor, FALSE)) {
-			return FALSE;
-		}
-
-		int i;
-		for (i = cursor;
-				(i < PAGE_ADDR(cursor) + PAGE_SIZE) & (checked < STR_MAX_LEN);
-				++i, ++checked) {
-			if (*((char*)i) == 0) return TRUE;
-		}
-	}
-	return FALSE;
-}
-
-/**
- * @brief Checks if the null-terminated array of strings is valid and safe
- */
-boolean_t check_string_array(char **arr) {
-	uint32_t cursor;
-	int checked;
-	for (cursor = (uint32_t) arr, checked = 0;
-			checked < STRARR_MAX_SIZE;
-			cursor = PAGE_ADDR(cursor) + PAGE_SIZE) {
-		if (!check_page(cursor, FALSE)) {
-			return FALSE;
-		}
-
-		uint32_t i;
-		for (i = cursor;
-				i < PAGE_ADDR(cursor) + PAGE_SIZE;
-				i += sizeof(char *), ++checked) {
-			if (*((char*)i) == 0) return TRUE;
-			if (!check_string((char*)i)) {
-				return FALSE;
-			}
-		}
-	}
-	return FALSE;
-}
-
-/**
- * @brief Checks if the memory region starting at array of size len words is
- * safe.
- */
-boolean_t check_array(void* array, size_t len) {
-	uint32_t cursor;
-	int checked;
-	for (cursor = (uint32_t) array, checked = 0;
-			checked < len;
-			checked += PAGE_SIZE - (cursor - PAGE_ADDR(cursor)),
-				cursor = PAGE_ADDR(cursor) + PAGE_SIZE) {
-		if (!check_page(cursor, FALSE)) {
-			return FALSE;
-		}
-	}
-	return TRUE;
-}
@@ -0,0 +1,121 @@
+/**
+ * @file sysstat.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief The statistics of the system calls
+ *
+ * Every wrapper calls the handler of its system call through SYSCALL_CALL
+ * (@see sysstat.h), and _sysenter does the same in C. Entering, the TSC is
+ * kept in the thread; leaving, the cycles elapsed go in the log2 histogram
+ * of the system call on the CPU it returns from, with its calls and errors.
+ * The time a call spends blocked or switched out is part of its latency.
+ *
+ * The counters of a CPU are only touched by the CPU itself, with interrupts
+ * off, so that no thread switched in halfway updates them at the same time.
+ * They are read through the KSTAT_SYSCALLS set of kstat.
+ *
+ * The system calls which don't return, such as vanish, aren't accounted.
+ * exec accounts itself before launching the new program.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <interrupts.h>
+#include <thread.h>
+#include <cpu.h>
+#include <clock.h>
+#include <sysstat.h>
+
+/**
+ * The counters of a system call on a CPU
+ */
+typedef struct sysstat {
+	unsigned int	calls;
+	unsigned int	errors;
+	unsigned int	latency[KSTAT_LATENCY_BUCKETS];
+} sysstat_t;
+
+static sysstat_t stats[CPU_MAX][SYSSTAT_GATES];
+
+/**
+ * @brief Returns the bucket of a latency: its log2, rounded down
+ */
+static int latency_bucket(uint64_t cycles) {
+	uint32_t high = cycles >> 32;
+	uint32_t low = cycles;
+	int bit;
+
+	if (high != 0) {
+		asm ("bsrl %1, %0" : "=r" (bit) : "rm" (high));
+		bit += 32;
+	} else if (low != 0) {
+		asm ("bsrl %1, %0" : "=r" (bit) : "rm" (low));
+	} else {
+		bit = 0;
+	}
+
+	return (bit < KSTAT_LATENCY_BUCKETS) ? bit : KSTAT_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * @brief Notes the time a system call starts at, called by the wrapper
+ * before the handler
+ */
+void sysstat_enter(void) {
+	get_self()->sys_start = rdtsc();
+}
+
+/**
+ * @brief Accounts a system call, called by the wrapper once the handler
+ * returns
+ *
+ * @param num the number of its gate
+ * @param ret what the handler returned, 0 if it returns nothing
+ * @return ret, for the wrapper to hand back to the user
+ */
+int sysstat_exit(unsigned int num, int ret) {
+	uint64_t cycles = rdtsc() - get_self()->sys_start;
+	if (num < SYSCALL_INT || num > SYSCALL_RESERVED_END) return ret;
+
+	uint32_t eflags = save_disable_interrupts();
+	sysstat_t *stat = &stats[this_cpu()->id][num - SYSCALL_INT];
+	stat->calls++;
+	if (ret < 0) stat->errors++;
+	stat->latency[latency_bucket(cycles)]++;
+	restore_interrupts(eflags);
+
+	return ret;
+}
+
+/**
+ * @brief Copies the counters of a system call on a CPU
+ *
+ * The counters of another CPU may change while they are copied, they are
+ * only statistics.
+ *
+ * @param cpu the CPU
+ * @param num the number of the gate of the system call
+ * @param out where to copy them
+ * @param reset whether to clear them once copied
+ * @return FALSE if the system call was never made there, TRUE otherwise
+ */
+boolean_t sysstat_get(int cpu, unsigned int num, kstat_syscall_t *out,
+		boolean_t reset) {
+	if (cpu < 0 || cpu >= CPU_MAX) return FALSE;
+	if (num < SYSCALL_INT || num > SYSCALL_RESERVED_END) return FALSE;
+
+	uint32_t eflags = save_disable_interrupts();
+	sysstat_t *stat = &stats[cpu][num - SYSCALL_INT];
+	boolean_t made = stat->calls > 0;
+
+	out->cpu = cpu;
+	out->num = num;
+	out->calls = stat->calls;
+	out->errors = stat->errors;
+	memcpy(out->latency, stat->latency, sizeof(out->latency));
+	if (reset) memset(stat, 0, sizeof(sysstat_t));
+	restore_interrupts(eflags);
+
+	return made;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file usercopy.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief Copies between kernel and user memory
+ *
+ * Rather than walking the page tables to validate every user buffer before
+ * touching it, the system calls copy their arguments in and out with the
+ * functions below, which just access the memory. Only the address range is
+ * checked beforehand, to keep the user out of the kernel. A page fault on
+ * one of the copy instructions goes through the page fault handler as usual,
+ * which resolves zero-fill, copy-on-write and image pages. If it can't, the
+ * handler looks the faulting instruction up in the fixup table, and resumes
+ * the copy at its fixup code, which reports the failure to the caller.
+ *
+ * For the kernel writes to fault on read-only pages in the first place,
+ * paging is enabled with CR0.WP set.
+ */
+
+#include <x86/page.h>
+#include <common_kern.h>
+#include <errors.h>
+#include <usercopy.h>
+
+/* The labels of usercopy_asm.S */
+extern char _copy_user_fault[], _copy_user_fixup[];
+extern char _strncpy_user_fault[], _strncpy_user_fixup[];
+
+/**
+ * An instruction of the copies that may fault on user memory, and where to
+ * resume if the fault can't be resolved.
+ */
+typedef struct {
+	char	*fault;		// The faulting instruction
+	char	*fixup;		// The recovery code
+} fixup_t;
+
+static const fixup_t fixups[] = {
+	{_copy_user_fault, _copy_user_fixup},
+	{_strncpy_user_fault, _strncpy_user_fixup},
+};
+
+/**
+ * @brief Checks that the len bytes from addr are all in user space
+ */
+boolean_t user_range(const void *addr, size_t len) {
+	uint32_t start = (uint32_t) addr;
+	if (start < USER_MEM_START) return FALSE;
+	// The range may end at the very top of the address space
+	return len <= (uint32_t) 0 - start;
+}
+
+/**
+ * @brief Copies len bytes from the user address src to the kernel
+ *
+ * @return 0 on success, ERR_INVALID_ARG if src isn't readable user memory
+ */
+int copy_from_user(void *dst, const void *src, size_t len) {
+	if (!user_range(src, len)) return ERR_INVALID_ARG;
+	if (_copy_user(dst, src, len)) return ERR_INVALID_ARG;
+	return 0;
+}
+
+/**
+ * @brief Copies len bytes from the kernel to the user address dst
+ *
+ * The bytes before a faulting page are copied nonetheless.
+ * @return 0 on success, ERR_INVALID_ARG if dst isn't writable user memory
+ */
+int copy_to_user(void *dst, const void *src, size_t len) {
+	if (!user_range(dst, len)) return ERR_INVALID_ARG;
+	if (_copy_user(dst, src, len)) return ERR_INVALID_ARG;
+	return 0;
+}
+
+/**
+ * @brief Copies the null-terminated user string src in the kernel buffer
+ * dst of len bytes
+ *
+ * @return the length of the string on success, ERR_INVALID_ARG if src isn't
+ * readable user memory or doesn't fit in dst
+ */
+int strncpy_from_user(char *dst, const char *src, size_t len) {
+	if ((uint32_t) src < USER_MEM_START) return ERR_INVALID_ARG;
+
+	// Don't wrap around the address space
+	if (len > (uint32_t) 0 - (uint32_t) src)
+		len = (uint32_t) 0 - (uint32_t) src;
+
+	int copied = _strncpy_user(dst, src, len);
+	return copied < 0 ? ERR_INVALID_ARG : copied;
+}
+
+/**
+ * @brief Returns where to resume after an unresolved page fault at eip
+ *
+ * @return the fixup address, 0 if eip isn't one of the copy instructions
+ */
+uint32_t usercopy_fixup(uint32_t eip) {
+	int i;
+	for (i = 0; i < sizeof(fixups) / sizeof(fixup_t); ++i) {
+		if ((uint32_t) fixups[i].fault == eip)
+			return (uint32_t) fixups[i].fixup;
+	}
+	return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file filemap.c
+ * @brief Mapping of RAM disk files in user space
+ *
+ * The files of the exec2obj table already sit in kernel memory, but not on
+ * page boundaries, so they can't be mapped where they are. Instead each file
+ * gets a cache of frames holding its pages, loaded the first time any
+ * process maps them and kept afterwards, like the program images (@see
+ * image.c). Mapping a file then costs a page table entry per page, and later
+ * reads cost nothing. Under memory pressure, the pages no process maps are
+ * given back and loaded again on their next mapping (@see reclaim.c).
+ *
+ * The pages are mapped read-only and copy on write: a process writing to
+ * its mapping gets a private copy of the page, and the cache is never
+ * modified.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <x86/page.h>
+#include <filemap.h>
+#include <page.h>
+#include <pcrwlock.h>
+#include <errors.h>
+#include <quota.h>
+
+/**
+ * The caches of the files, indexed like the exec2obj table. Entries are
+ * created on the first mapping of a file and never freed.
+ */
+static file_cache_t **caches = NULL;
+/**
+ * Protects the creation of caches. Every exec or mapping looks its entry up,
+ * the creations are rare.
+ */
+static pcrwlock_t caches_lock;
+
+/**
+ * @brief Initializes the file caches
+ * @return 0 on success, a negative error code otherwise
+ */
+int init_filemap(void) {
+	caches = calloc(exec2obj_userapp_count, sizeof(file_cache_t *));
+	if (caches == NULL) return ERR_MALLOC_FAIL;
+	pcrwlock_init(&caches_lock);
+	return 0;
+}
+
+/**
+ * @brief Returns the index of a file in the exec2obj table, or a negative
+ * error code if entry is not in the table
+ */
+int file_index(const exec2obj_userapp_TOC_entry *entry) {
+	if (entry == NULL) return ERR_NO_OBJ_ENTRY;
+	int idx = entry - exec2obj_userapp_TOC;
+	if (idx < 0 || idx >= exec2obj_userapp_count) return ERR_NO_OBJ_ENTRY;
+	return idx;
+}
+
+/**
+ * @brief Returns the number of pages of a file
+ */
+int file_pages(int file) {
+	int len = exec2obj_userapp_TOC[file].execlen;
+	return (len + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/**
+ * @brief Returns the cache of a file, creating it if necessary
+ * @return the cache, NULL on error
+ */
+static file_cache_t *get_cache(int file) {
+	pcrw_read_lock(&caches_lock);
+	file_cache_t *found = caches[file];
+	pcrw_read_unlock(&caches_lock);
+	if (found != NULL) return found;
+
+	pcrw_write_lock(&caches_lock);
+
+	// Someone may have created it in the meantime
+	if (caches[file] != NULL) {
+		pcrw_write_unlock(&caches_lock);
+		return caches[file];
+	}
+
+	file_cache_t *cache = calloc(1, sizeof(file_cache_t));
+	if (cache == NULL) {
+		pcrw_write_unlock(&caches_lock);
+		return NULL;
+	}
+
+	cache->num_pages = file_pages(file);
+	cache->frames = calloc(cache->num_pages, sizeof(paddr_t));
+	if (cache->frames == NULL) {
+		free(cache);
+		pcrw_write_unlock(&caches_lock);
+		return NULL;
+	}
+	mutex_init_named(&cache->lock, "file cache");
+
+	caches[file] = cache;
+	pcrw_write_unlock(&caches_lock);
+
+	return cache;
+}
+
+/**
+ * @brief Returns the frame of a page of a file, loading it if necessary
+ *
+ * The caller gets a hold on the frame. The cache lock is held.
+ *
+ * @return the frame, NULL on error
+ */
+static paddr_t file_frame(file_cache_t *cache, int file, int idx) {
+	paddr_t frame = cache->frames[idx];
+	if (frame == NULL) {
+		// First mapping of the page, the cache holds it from now on
+		frame = allocate_zeroed_frame();
+		if (frame == NULL) return NULL;
+
+		const exec2obj_userapp_TOC_entry *entry = &exec2obj_userapp_TOC[file];
+		int len = entry->execlen - idx * PAGE_SIZE;
+		if (len > PAGE_SIZE) len = PAGE_SIZE;
+		write_frame(frame, 0, entry->execbytes + idx * PAGE_SIZE, len);
+
+		cache->frames[idx] = frame;
+	}
+
+	if (get_frame(frame)) return NULL;
+	return frame;
+}
+
+/**
+ * @brief Returns the frame of a page of a file, loading it if necessary
+ *
+ * The caller gets a hold on the frame.
+ *
+ * @return the frame, NULL on error
+ */
+paddr_t filemap_frame(int file, int idx) {
+	file_cache_t *cache = get_cache(file);
+	if (cache == NULL || idx >= cache->num_pages) return NULL;
+
+	mutex_lock(&cache->lock);
+	paddr_t frame = file_frame(cache, file, idx);
+	mutex_unlock(&cache->lock);
+	return frame;
+}
+
+/**
+ * @brief Gives back the loaded frames of every file that no process maps
+ *
+ * This is called under memory pressure (@see reclaim.c). The pages are
+ * loaded again on their next mapping.
+ *
+ * @return the number of frames given back
+ */
+int filemap_reclaim(void) {
+	int file, idx, n = 0;
+
+	pcrw_read_lock(&caches_lock);
+	for (file = 0; file < exec2obj_userapp_count; ++file) {
+		file_cache_t *cache = caches[file];
+		if (cache == NULL) continue;
+
+		mutex_lock(&cache->lock);
+		for (idx = 0; idx < cache->num_pages; ++idx) {
+			paddr_t frame = cache->frames[idx];
+			if (frame == NULL || frame_refs(frame) > 1) continue;
+
+			cache->frames[idx] = NULL;
+			if (free_frame(frame)) kernel_panic("File frame incoherence");
+			n++;
+		}
+		mutex_unlock(&cache->lock);
+	}
+	pcrw_read_unlock(&caches_lock);
+
+	return n;
+}
+
+/**
+ * @brief Maps all the pages of a file from base in the calling process
+ *
+ * The range must be free. On error nothing stays mapped.
+ *
+ * @param file the index of the file in the exec2obj table
+ * @param base the page where the file begins
+ * @return 0 on success, a negative error code otherwise
+ */
+int filemap_map(int file, vaddr_t base) {
+	file_cache_t *cache = get_cache(file);
+	if (cache == NULL) return ERR_MALLOC_FAIL;
+
+	int err = quota_check(get_self()->process, cache->num_pages);
+	if (err) return err;
+
+	int mapped;
+	mutex_lock(&cache->lock);
+	for (mapped = 0; mapped < cache->num_pages; ++mapped) {
+		paddr_t frame = file_frame(cache, file, mapped);
+		if (frame == NULL) {
+			err = ERR_NO_FRAMES;
+			break;
+		}
+
+		err = create_page(base + mapped * PAGE_SIZE, MEM_TYPE_DATA, frame);
+		if (err) {
+			if (free_frame(frame)) kernel_panic("File frame incoherence");
+			break;
+		}
+	}
+	mutex_unlock(&cache->lock);
+
+	if (err && unmap_range(base, mapped))
+		kernel_panic("Couldn't unmap previously mapped file pages");
+
+	return err;
+}
@@ -15,40 +15,141 @@
 #include <simics.h>
 #include <errors.h>
 #include <lock.h>
+#include <thread.h>
+#include <process.h>
+#include <tlb.h>
+#include <quota.h>
+#include <pageops.h>
+#include <reclaim.h>
+#include <kthread.h>
+#include <cpu.h>
 
 /*
- * A table holding counters for the frames in user space.
- * 
- * Each counter represents the number of processes currently having a page
- * table entry pointing to the frame. This is used to implement copy on write.
- * For data consistency, it is expected that whenever a frame has a counter
- * value of more than one, no process can have writing rights to it and has to
- * copy the frame before being able to write to it.
+ * The descriptor of a frame in user space.
+ *
+ * The reference counter is the number of page table entries currently
+ * pointing to the frame. This is used to implement copy on write. For data
+ * consistency, it is expected that whenever a frame has a counter value of
+ * more than one, no process can have writing rights to it and has to copy the
+ * frame before being able to write to it.
  */
-static uint8_t *frames = NULL;
+typedef struct {
+	uint32_t	refcount;	// Number of page table entries on the frame
+	uint16_t	flags;		// FRAME_* state flags @see page_types.h
+	int16_t		order;		// Order of the free block it heads, if any
+	int			next;		// Next frame in the free list, -1 if none
+	int			prev;		// Previous frame in the free list, -1 if none
+	vaddr_t		rmap;		// Virtual address of one of its mappings, or 0
+} frame_desc_t;
+
+/*
+ * A table holding the descriptors of all the frames in user space
+ */
+static frame_desc_t *frames = NULL;
 /*
  * Total number of frames available for the users
  */
 static size_t nb_frames = 0;
 /*
- * Identifier of a frame pointed to by nobody. -1 if all frames are taken.
+ * The free frames are managed by a buddy allocator. Free memory is split in
+ * blocks of 2^order frames, each block being aligned on its own size. A free
+ * block of a given order is kept in the doubly-linked free list of that order,
+ * threaded through the next and prev fields of the descriptors (-1 terminates
+ * a list). The order field holds, for the first frame of every free block, the
+ * order of that block, and NOT_FREE_HEAD for all other frames.
+ * This makes allocating and freeing a block cost O(FRAME_MAX_ORDER).
+ */
+#define NOT_FREE_HEAD -1
+static int free_lists[FRAME_MAX_ORDER + 1];
+/*
+ * Number of frames currently in the free lists
+ */
+static size_t nb_free_frames = 0;
+/*
+ * A pool of frames known to hold only zeros, refilled in the background by
+ * the workers of the idle CPUs (@see queue_refill). The frames in the pool
+ * are held once by the pool itself and carry the FRAME_ZEROED flag.
+ * refilling, protected by the frame lock, keeps a single worker at a time
+ * refilling the pool.
+ */
+static paddr_t zero_pool[ZERO_POOL_SIZE];
+static int zero_pool_count = 0;
+static boolean_t refilling = FALSE;
+/*
+ * Number of frames promised to zero-fill-on-demand pages that have not been
+ * touched yet (@see reserve_frames). The free frames and the zeroed pool
+ * always hold at least that many frames, and only the holders of a
+ * reservation may dip into them.
  */
-static int next_available_frame = 0;
+static size_t nb_reserved_frames = 0;
 /*
- * A frame-sized buffer to transfer data between frames, via the kernel
+ * A page of kernel virtual memory for each CPU, reserved as a window on user
+ * frames. They are part of the kernel image, so that they lie in the only
+ * kernel page table mapped with 4KB pages (@see build_kernel_map). That
+ * table is shared by every process, but each CPU only ever maps and flushes
+ * its own window, with interrupts off while it is in use (@see window_map):
+ * only the copies on the same CPU serialize.
  */
-static uint32_t *cow_buffer = NULL;
+static uint32_t copy_windows[CPU_MAX][PAGE_SIZE / sizeof(uint32_t)]
+	__attribute__((aligned(PAGE_SIZE)));
 /*
  * Protects the data structures, only one thread at a time can act on the
  * frame data structures.
  */
 static mutex_t fa_mutex;
 
+/**
+ * @brief Puts the free block starting at frame id in the list of its order
+ */
+static void free_list_insert(int id, int order) {
+	frames[id].order = order;
+	frames[id].prev = -1;
+	frames[id].next = free_lists[order];
+	if (free_lists[order] != -1) frames[free_lists[order]].prev = id;
+	free_lists[order] = id;
+}
+
+/**
+ * @brief Takes the free block starting at frame id out of its free list
+ */
+static void free_list_remove(int id) {
+	int order = frames[id].order;
+
+	if (frames[id].prev != -1) frames[frames[id].prev].next = frames[id].next;
+	else free_lists[order] = frames[id].next;
+	if (frames[id].next != -1) frames[frames[id].next].prev = frames[id].prev;
+
+	frames[id].order = NOT_FREE_HEAD;
+	frames[id].next = -1;
+	frames[id].prev = -1;
+}
+
+/**
+ * @brief Gives the single frame id back to the buddy allocator
+ *
+ * The frame is merged with its buddy as long as the buddy is entirely free,
+ * and the resulting block is put in the free list of its order.
+ */
+static void release_frame(int id) {
+	int order = 0;
+	while (order < FRAME_MAX_ORDER) {
+		int buddy = id ^ (1 << order);
+		if (buddy >= nb_frames || frames[buddy].order != order) break;
+		free_list_remove(buddy);
+		if (buddy < id) id = buddy;
+		order++;
+	}
+	free_list_insert(id, order);
+	nb_free_frames++;
+}
+
 /**
  * @brief Initializes the frame allocator
  * 
  * This function creates the frames table to be able to allocate frames in the
- * program.
+ * program. The table is the largest structure made at boot, so each
+ * descriptor is written once, from a template, rather than zeroed by calloc
+ * and written again.
  * 
  * @param upper_mem the size of the allocatable memory, in kilobytes
  * @return 0 on success, negative number on error
@@ -57,17 +158,83 @@ int init_frame_allocator(vm_size_t upper_mem) {
 	nb_frames = (LOWER_MEM_SIZE + upper_mem * 1024 - USER_MEM_START)
 		/ PAGE_SIZE;
 
-	frames = calloc(nb_frames, sizeof(uint8_t));
+	frames = malloc(nb_frames * sizeof(frame_desc_t));
 	if (frames == NULL) return ERR_MALLOC_FAIL;
 
-	cow_buffer = smemalign(PAGE_SIZE, PAGE_SIZE);
-	if (cow_buffer == NULL) return ERR_MALLOC_FAIL;
+	int i, order;
+	for (order = 0; order <= FRAME_MAX_ORDER; ++order) {
+		free_lists[order] = -1;
+	}
+
+	frame_desc_t blank = { 0, 0, NOT_FREE_HEAD, -1, -1, 0 };
+	for (i = 0; i < nb_frames; ++i) frames[i] = blank;
+
+	// Cut the memory in the largest aligned blocks that fit
+	for (i = 0; i < nb_frames; i += 1 << order) {
+		order = FRAME_MAX_ORDER;
+		while (i % (1 << order) != 0 || i + (1 << order) > nb_frames) {
+			order--;
+		}
+		free_list_insert(i, order);
+		nb_free_frames += 1 << order;
+	}
+
+	// The windows must be remappable page by page
+	if ((vaddr_t) copy_windows[CPU_MAX - 1] >= KERNEL_SMALL_PAGES_END)
+		kernel_panic("Copy window out of the kernel page table");
 
 	mutex_init(&fa_mutex);
 
 	return 0;
 }
 
+/**
+ * @brief Returns the number of frames that can be handed out without
+ * breaking a reservation
+ */
+static size_t available_frames(void) {
+	size_t total = nb_free_frames + zero_pool_count;
+	return total > nb_reserved_frames ? total - nb_reserved_frames : 0;
+}
+
+/**
+ * @brief Takes 2^order frames out of the buddy allocator
+ *
+ * This ignores the reservations, which is up to the callers.
+ */
+static paddr_t take_frames(int order) {
+	if (order < 0 || order > FRAME_MAX_ORDER) return NULL;
+
+	// Find the smallest free block that is large enough
+	int o = order;
+	while (o <= FRAME_MAX_ORDER && free_lists[o] == -1) o++;
+	if (o > FRAME_MAX_ORDER) {
+		// No available block to give
+		return NULL;
+	}
+
+	int id = free_lists[o];
+	free_list_remove(id);
+
+	// Split it, giving the upper halves back to the lower orders
+	while (o > order) {
+		o--;
+		free_list_insert(id + (1 << o), o);
+	}
+
+	int i;
+	for (i = id; i < id + (1 << order); ++i) {
+		if (frames[i].refcount != 0)
+			kernel_panic("Allocated frame %d is not free", i);
+		frames[i].refcount = 1;
+		frames[i].flags = 0;
+		frames[i].rmap = 0;
+	}
+	nb_free_frames -= 1 << order;
+
+	return (paddr_t) FRAME_ADDR(id);
+}
+
 /**
  * @brief Returns the address of an available frame
  * 
@@ -79,22 +246,49 @@ int init_frame_allocator(vm_size_t upper_mem) {
  * allocate_frame, which locks the mutex and calls the _ version
  */
 paddr_t _allocate_frame() {
-	if (next_available_frame == -1) {
-		// No available frames to give
-		return NULL;
-	}
-
-	paddr_t frame = (paddr_t) FRAME_ADDR(next_available_frame);
-	
-	int err = _get_frame(frame);
-	if (err) kernel_panic("Allocate frame couldn't get frame");
+	if (available_frames() < 1) return NULL;
 
+	paddr_t frame = take_frames(0);
+	if (frame == NULL && zero_pool_count > 0) {
+		// Fall back on the zeroed pool before giving up
+		frame = zero_pool[--zero_pool_count];
+		frames[FRAME_ID(frame)].flags = 0;
+	}
 	return frame;
 }
 paddr_t allocate_frame() {
 	mutex_lock(&fa_mutex);
 	paddr_t frame = _allocate_frame();
+	boolean_t low = available_frames() < RECLAIM_LOW;
 	mutex_unlock(&fa_mutex);
+
+	if (low) reclaim_kick();
+	return frame;
+}
+
+/**
+ * @brief Returns the address of 2^order physically contiguous frames
+ *
+ * The returned block is aligned on its own size. Each frame of the block is
+ * held once by the caller, exactly as if it came from allocate_frame, so the
+ * frames can be given back one by one with free_frame or all at once with
+ * free_frames. If no block is large enough, a NULL pointer is returned.
+ * This function comes in two versions:
+ * _allocate_frames, which does the job without caring about locking
+ * allocate_frames, which locks the mutex and calls the _ version
+ */
+paddr_t _allocate_frames(int order) {
+	if (order < 0 || order > FRAME_MAX_ORDER) return NULL;
+	if (available_frames() < 1 << order) return NULL;
+	return take_frames(order);
+}
+paddr_t allocate_frames(int order) {
+	mutex_lock(&fa_mutex);
+	paddr_t frame = _allocate_frames(order);
+	boolean_t low = available_frames() < RECLAIM_LOW;
+	mutex_unlock(&fa_mutex);
+
+	if (low) reclaim_kick();
 	return frame;
 }
 
@@ -103,44 +297,133 @@ paddr_t allocate_frame() {
  * 
  * If the process was the last one holding the frame, the frame is put back in
  * the free frame pool.
+ * As for allocate frame, this function has a locking and a non-locking
+ * flavor.
  */
-int free_frame(paddr_t frame) {
+int _free_frame(paddr_t frame) {
 	if (((uint32_t) frame) % PAGE_SIZE != 0) return -1;
 
-	mutex_lock(&fa_mutex);
-
 	if (FRAME_ID(frame) == -1) {
 		// Cannot free a kernel frame (no user can own it)
-		mutex_unlock(&fa_mutex);
 		return ERR_KERNEL_FRAME;
 	}
 
-	if (frames[FRAME_ID(frame)] == 0) {
+	if (frames[FRAME_ID(frame)].refcount == 0) {
 		// Trying to free a frame held by nobody
-		mutex_unlock(&fa_mutex);
 		return ERR_FREE_OWNERLESS_FRAME;
 	}
 
-	frames[FRAME_ID(frame)]--;
+	frames[FRAME_ID(frame)].refcount--;
+	if (frames[FRAME_ID(frame)].refcount <= 1) {
+		frames[FRAME_ID(frame)].flags &= ~FRAME_SHARED;
+	}
+
+	if (frames[FRAME_ID(frame)].refcount == 0) {
+		// Nobody holds the frame anymore, give it back to the allocator
+		release_frame(FRAME_ID(frame));
+	}
+
+	return 0;
+}
+int free_frame(paddr_t frame) {
+	mutex_lock(&fa_mutex);
+	int err = _free_frame(frame);
+	mutex_unlock(&fa_mutex);
+
+	reclaim_notify();
+	return err;
+}
+
+/**
+ * @brief Allocates n frames at once, for the pages from va on
+ *
+ * The frame lock is taken once for the whole batch. Each frame is held once
+ * by the caller, as if it came from allocate_frame, and the first *zeroed of
+ * them come from the zeroed pool. Either all the frames are allocated or
+ * none is.
+ *
+ * @return 0 on success, ERR_NO_FRAMES if there aren't enough frames left
+ */
+int allocate_frame_batch(paddr_t *out, int n, vaddr_t va, int *zeroed) {
+	mutex_lock(&fa_mutex);
+	if (n < 0 || available_frames() < n) {
+		mutex_unlock(&fa_mutex);
+		reclaim_kick();
+		return ERR_NO_FRAMES;
+	}
+
+	int i = 0;
+	for (; i < n && zero_pool_count > 0; ++i) {
+		out[i] = zero_pool[--zero_pool_count];
+		frames[FRAME_ID(out[i])].flags &= ~FRAME_ZEROED;
+	}
+	*zeroed = i;
 
-	if (frames[FRAME_ID(frame)] == 0 && next_available_frame == -1) {
-		// The frame we freed is the only one available
-		next_available_frame = FRAME_ID(frame);
+	for (; i < n; ++i) {
+		out[i] = take_frames(0);
+		if (out[i] == NULL) kernel_panic("Available frame missing");
 	}
 
+	for (i = 0; i < n; ++i) {
+		frames[FRAME_ID(out[i])].rmap = va + i * PAGE_SIZE;
+	}
+	boolean_t low = available_frames() < RECLAIM_LOW;
 	mutex_unlock(&fa_mutex);
 
+	if (low) reclaim_kick();
 	return 0;
 }
 
+/**
+ * @brief Releases n frames at once, taking the frame lock once
+ *
+ * @return 0 on success, the error of the first frame that couldn't be
+ * released otherwise (the others are still released)
+ */
+int free_frame_batch(paddr_t *batch, int n) {
+	int i, err = 0;
+	mutex_lock(&fa_mutex);
+	for (i = 0; i < n; ++i) {
+		int ferr = _free_frame(batch[i]);
+		if (ferr && !err) err = ferr;
+	}
+	mutex_unlock(&fa_mutex);
+
+	reclaim_notify();
+	return err;
+}
+
+/**
+ * @brief Releases every frame of a block obtained with allocate_frames
+ *
+ * Each frame loses one owner, frames nobody holds anymore are merged back
+ * into the buddy allocator. The frame lock is taken once for the block.
+ * @return 0 on success, a negative number on error
+ */
+int free_frames(paddr_t base, int order) {
+	if (order < 0 || order > FRAME_MAX_ORDER) return ERR_INVALID_ARG;
+	if (((uint32_t) base) % (PAGE_SIZE << order) != 0) return ERR_INVALID_ARG;
+
+	int i, err = 0;
+	mutex_lock(&fa_mutex);
+	for (i = 0; i < 1 << order && !err; ++i) {
+		err = _free_frame((paddr_t) ((uint32_t) base + i * PAGE_SIZE));
+	}
+	mutex_unlock(&fa_mutex);
+
+	reclaim_notify();
+	return err;
+}
+
 /**
  * @brief Increases the number of processes having "possession" of the frame
  * 
  * Possession means to have a page table entry pointing to the frame, via copy
- * on write.
- * To prevent the counter from overflowing, every frame can have a maximum of
- * 255 threads pointing to it. When this occurs the calling thread has to
- * allocate a new frame for the page by itself.
+ * on write. The frame must already be held by someone, free frames can only
+ * be obtained through allocate_frame.
+ * The counter is 32 bits wide, which is more than the number of page table
+ * entries that can exist at once, so sharing a frame never fails in practice.
+ * The overflow check is kept as a safety net.
  * As for allocate frame, this function has a locking and a non-locking
  * flavor, which are called from the outside or from frame functions,
  * respectively.
@@ -155,27 +438,18 @@ int _get_frame(paddr_t frame) {
 		return ERR_KERNEL_FRAME;
 	}
 
-	if (frames[FRAME_ID(frame)] == (uint8_t) -1) {
+	if (frames[FRAME_ID(frame)].refcount == 0) {
+		// Free frames are handed out by allocate_frame only
+		return ERR_FREE_OWNERLESS_FRAME;
+	}
+
+	if (frames[FRAME_ID(frame)].refcount == (uint32_t) -1) {
 		// To prevent the counter from overflowing
 		return ERR_TOO_MANY_FRAME_OWNERS; 
 	}
 
-	frames[FRAME_ID(frame)]++;
-
-	if (FRAME_ID(frame) == next_available_frame) {
-		// We have to find the new next available frame
-		int i, f;
-		boolean_t found = FALSE;
-		for (i = 0, f = next_available_frame; i < nb_frames;
-				++i, f = (f+1) % nb_frames) {
-			if (frames[f] == 0) {
-				next_available_frame = f;
-				found = TRUE;
-				break;
-			}
-		}
-		if (!found) next_available_frame = -1;		
-	}
+	frames[FRAME_ID(frame)].refcount++;
+	frames[FRAME_ID(frame)].flags |= FRAME_SHARED;
 
 	return 0;	
 }
@@ -186,6 +460,157 @@ int get_frame(paddr_t frame) {
 	return err;
 }
 
+/**
+ * @brief Returns the FRAME_* flags of a frame, or a negative error code
+ */
+int frame_flags(paddr_t frame) {
+	if (((uint32_t) frame) % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+	if (FRAME_ID(frame) == -1) return ERR_KERNEL_FRAME;
+
+	mutex_lock(&fa_mutex);
+	int flags = frames[FRAME_ID(frame)].flags;
+	mutex_unlock(&fa_mutex);
+	return flags;
+}
+
+/**
+ * @brief Sets and clears FRAME_* flags of a frame held by the caller
+ *
+ * FRAME_SHARED is maintained by the allocator itself and cannot be changed.
+ * @param set the flags to set
+ * @param unset the flags to clear
+ * @return 0 on success, a negative error code otherwise
+ */
+int frame_update_flags(paddr_t frame, uint16_t set, uint16_t unset) {
+	if (((uint32_t) frame) % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+	if (FRAME_ID(frame) == -1) return ERR_KERNEL_FRAME;
+	if ((set | unset) & FRAME_SHARED) return ERR_INVALID_ARG;
+
+	mutex_lock(&fa_mutex);
+	frame_desc_t *desc = &frames[FRAME_ID(frame)];
+	if (desc->refcount == 0) {
+		mutex_unlock(&fa_mutex);
+		return ERR_FREE_OWNERLESS_FRAME;
+	}
+	desc->flags = (desc->flags | set) & ~unset;
+	mutex_unlock(&fa_mutex);
+	return 0;
+}
+
+/**
+ * @brief Records va as a virtual address the frame is mapped at
+ *
+ * This is only a hint for reverse mapping: a shared frame remembers one of its
+ * mappings, the most recent one.
+ */
+void frame_set_rmap(paddr_t frame, vaddr_t va) {
+	if (FRAME_ID(frame) == -1) return;
+	mutex_lock(&fa_mutex);
+	frames[FRAME_ID(frame)].rmap = va;
+	mutex_unlock(&fa_mutex);
+}
+
+/**
+ * @brief Returns the number of page table entries, and other holders, on a
+ * frame, 0 for kernel frames
+ *
+ * The value is only a snapshot, as for num_free_frames.
+ */
+int frame_refs(paddr_t frame) {
+	if (FRAME_ID(frame) == -1) return 0;
+	mutex_lock(&fa_mutex);
+	int refs = frames[FRAME_ID(frame)].refcount;
+	mutex_unlock(&fa_mutex);
+	return refs;
+}
+
+/**
+ * @brief Returns the reverse mapping hint of a frame, 0 if there is none
+ */
+vaddr_t frame_rmap(paddr_t frame) {
+	if (FRAME_ID(frame) == -1) return 0;
+	mutex_lock(&fa_mutex);
+	vaddr_t va = frames[FRAME_ID(frame)].rmap;
+	mutex_unlock(&fa_mutex);
+	return va;
+}
+
+/**
+ * @brief Returns the number of frames nobody holds at the moment
+ *
+ * The value is only a snapshot, it can change as soon as the frame lock is
+ * released.
+ */
+size_t num_free_frames(void) {
+	mutex_lock(&fa_mutex);
+	size_t free = nb_free_frames;
+	mutex_unlock(&fa_mutex);
+	return free;
+}
+
+/**
+ * @brief Returns the number of frames that can be handed out without
+ * breaking a reservation, the zeroed pool included
+ *
+ * The value is only a snapshot, as for num_free_frames.
+ */
+size_t num_available_frames(void) {
+	mutex_lock(&fa_mutex);
+	size_t available = available_frames();
+	mutex_unlock(&fa_mutex);
+	return available;
+}
+
+/**
+ * A copy window in use, @see window_map
+ */
+typedef struct window {
+	void		*page;		// Where the frame is mapped
+	pte_t		saved;		// The entry of the window before
+	uint32_t	eflags;		// Of the thread before it took the window
+} window_t;
+
+/**
+ * @brief Points the copy window of the calling CPU to frame
+ *
+ * Interrupts stay off until the matching window_unmap, so that the thread
+ * neither moves to another CPU nor lets another thread of this one take the
+ * window meanwhile. What is copied through it must not fault.
+ */
+static void window_map(pde_t *cr3, paddr_t frame, window_t *w) {
+	w->eflags = save_disable_interrupts();
+	w->page = copy_windows[cpu_id()];
+	pte_t *window = get_pte((vaddr_t) w->page, cr3);
+	w->saved = *window;
+	*window = PE_UNSETFLAG(*window, PTE_GLOBAL);
+	*window = PE_SETADDR(*window, frame);
+	tlb_flush_page((vaddr_t) w->page);
+}
+
+/**
+ * @brief Restores the copy window of the calling CPU and releases it
+ */
+static void window_unmap(pde_t *cr3, window_t *w) {
+	*get_pte((vaddr_t) w->page, cr3) = w->saved;
+	tlb_flush_page((vaddr_t) w->page);
+	restore_interrupts(w->eflags);
+}
+
+/**
+ * @brief Fills a frame the caller holds with zeros, through the copy window
+ *
+ * @param ahead whether the frame is zeroed ahead of its use, in which case
+ * the zeros don't go through the cache
+ */
+static void clear_frame(paddr_t frame, boolean_t ahead) {
+	pde_t *cr3 = (pde_t *) get_cr3();
+	window_t w;
+	window_map(cr3, frame, &w);
+	if (ahead) zero_page_nt(w.page);
+	else zero_page(w.page);
+	window_unmap(cr3, &w);
+}
+
 /**
  * @brief Copies the contents of a page to a new frame exclusive to the
  * calling thread
@@ -194,51 +619,353 @@ int get_frame(paddr_t frame) {
  * contents of the frame pointed to by the virtual address addr. The caller
  * then has an exclusive, writable copy of the frame, on which he can do
  * whatever he wants.
+ * The new frame is mapped in the copy window of the CPU, so the page is
+ * copied only once, and only the two affected TLB entries are invalidated.
+ * The frame lock is not held during the copy, so allocations are not delayed
+ * by it. Copies within a process are serialized by the process' cow_lock,
+ * which also lets threads faulting on the same page find out that the page
+ * was already copied.
  * @return 0 on success, a negative number on error
  */
 int copy_on_write(vaddr_t page_addr) {
 	if (page_addr % PAGE_SIZE != 0) return -1;
 
+	process_t *process = get_self()->process;
+	if (process == NULL) kernel_panic("Unregistered thread");
+
 	pde_t *cr3 = (pde_t *) get_cr3();
 	pte_t *pte = get_pte(page_addr, cr3);
 	if (pte == NULL) {
 		panic("Trying to copy on write on a non-existing page");
 	}
+
+	mutex_lock(process->cow_lock);
+
+	if (!PE_GETFLAG(*pte, PTE_COPYONWRITE)) {
+		// Another thread of the process already did the copy
+		mutex_unlock(process->cow_lock);
+		return 0;
+	}
+
 	paddr_t old_frame = (paddr_t) PE_GETADDR(*pte);
 	int old_frame_id = FRAME_ID(old_frame);
 
 	mutex_lock(&fa_mutex);
 
-	if (frames[old_frame_id] == 1) {
-		// We are the last process holding to the frame, we're good to go
-		mutex_unlock(&fa_mutex);
-		return 0;
-	} else if (frames[old_frame_id] == 0) {
+	if (frames[old_frame_id].refcount == 0) {
 		mutex_unlock(&fa_mutex);
+		mutex_unlock(process->cow_lock);
 		return ERR_FREE_OWNERLESS_FRAME;
 	}
 
-	// Create a new frame to copy to
-	paddr_t new_frame = _allocate_frame();
-	if (new_frame == NULL) {
-		// Impossible to copy on write
+	paddr_t new_frame = NULL;
+	if (frames[old_frame_id].refcount > 1) {
+		// Create a new frame to copy to
+		new_frame = _allocate_frame();
+		if (new_frame == NULL) {
+			// Impossible to copy on write
+			mutex_unlock(&fa_mutex);
+			mutex_unlock(process->cow_lock);
+			return ERR_NO_FRAMES;
+		}
+	}
+
+	mutex_unlock(&fa_mutex);
+
+	if (new_frame != NULL) {
+		// Point the copy window to the new frame and fill it
+		window_t w;
+		window_map(cr3, new_frame, &w);
+		copy_page(w.page, (void *) page_addr);
+		window_unmap(cr3, &w);
+
+		// Set the page table entry to the new frame
+		*pte = PE_SETADDR(*pte, new_frame);
+		frame_set_rmap(new_frame, page_addr);
+	}
+
+	*pte = PE_UNSETFLAG(*pte, PTE_COPYONWRITE);
+	*pte = PE_SETFLAG(*pte, PTE_READWRITE);
+	tlb_flush_page(page_addr);
+
+	mutex_unlock(process->cow_lock);
+
+	// Drop our hold on the shared frame, if we copied it
+	if (new_frame != NULL && free_frame(old_frame)) {
+		panic("Couldn't release the copied frame");
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Copies len bytes from buf at offset in a frame the caller holds
+ *
+ * The frame doesn't have to be mapped anywhere, the copy goes through the
+ * copy window.
+ */
+void write_frame(paddr_t frame, size_t offset, const void *buf, size_t len) {
+	if (offset >= PAGE_SIZE) return;
+	if (len > PAGE_SIZE - offset) len = PAGE_SIZE - offset;
+
+	pde_t *cr3 = (pde_t *) get_cr3();
+	window_t w;
+	window_map(cr3, frame, &w);
+	memcpy((char *) w.page + offset, buf, len);
+	window_unmap(cr3, &w);
+}
+
+/**
+ * @brief Copies the page held in a frame the caller holds to buf
+ *
+ * As for write_frame, the frame doesn't have to be mapped anywhere.
+ */
+void read_frame(paddr_t frame, void *buf) {
+	pde_t *cr3 = (pde_t *) get_cr3();
+	window_t w;
+	window_map(cr3, frame, &w);
+	copy_page(buf, w.page);
+	window_unmap(cr3, &w);
+}
+
+/**
+ * @brief Returns a frame from the pool of zeroed frames
+ *
+ * The frame is held once by the caller, as if it came from allocate_frame,
+ * and is guaranteed to hold only zeros. If the pool is empty, a NULL pointer
+ * is returned and nothing is allocated.
+ */
+paddr_t take_zeroed_frame(void) {
+	paddr_t frame = NULL;
+	mutex_lock(&fa_mutex);
+	if (zero_pool_count > 0 && available_frames() > 0) {
+		frame = zero_pool[--zero_pool_count];
+		frames[FRAME_ID(frame)].flags &= ~FRAME_ZEROED;
+	}
+	boolean_t low = available_frames() < RECLAIM_LOW;
+	mutex_unlock(&fa_mutex);
+
+	if (low) reclaim_kick();
+	return frame;
+}
+
+/**
+ * @brief Returns an available frame filled with zeros
+ *
+ * The frame comes from the pool of zeroed frames when possible, so that the
+ * zeroing is done ahead of time by the idle thread. Otherwise a regular frame
+ * is allocated and zeroed on the spot. If no frame is available, the function
+ * returns a NULL pointer.
+ */
+paddr_t allocate_zeroed_frame(void) {
+	paddr_t frame = take_zeroed_frame();
+	if (frame != NULL) return frame;
+
+	frame = allocate_frame();
+	if (frame == NULL) return NULL;
+
+	clear_frame(frame, FALSE);
+	return frame;
+}
+
+/**
+ * @brief Sets n frames aside for the zero-fill-on-demand pages of a process
+ *
+ * A page mapped on the zero frame doesn't hold a frame until it is first
+ * written to, but the write fault can't fail. So the frame is reserved when
+ * the page is mapped, and the reservation is either consumed by the fault
+ * (@see allocate_reserved_frame) or given back when the page is unmapped
+ * (@see unreserve_frames). Reserved frames are not handed out to anyone else.
+ * The reservations of a process are counted in its reserved_frames, which is
+ * protected by the frame lock.
+ *
+ * @return 0 on success, ERR_NO_FRAMES if there aren't enough frames left
+ */
+int reserve_frames(process_t *process, int n) {
+	if (process == NULL) return ERR_ARG_NULL;
+	if (n < 0) return ERR_INVALID_ARG;
+
+	mutex_lock(&fa_mutex);
+	if (available_frames() < n) {
 		mutex_unlock(&fa_mutex);
 		return ERR_NO_FRAMES;
 	}
+	nb_reserved_frames += n;
+	process->reserved_frames += n;
+	mutex_unlock(&fa_mutex);
+	quota_charge(process, n);
+
+	return 0;
+}
+
+/**
+ * @brief Gives back up to n frames reserved by the process
+ */
+void unreserve_frames(process_t *process, int n) {
+	if (process == NULL || n <= 0) return;
+
+	mutex_lock(&fa_mutex);
+	if (n > process->reserved_frames) n = process->reserved_frames;
+	nb_reserved_frames -= n;
+	process->reserved_frames -= n;
+	mutex_unlock(&fa_mutex);
+	quota_charge(process, -n);
+}
+
+/**
+ * @brief Returns a zeroed frame out of the reservations of the process
+ *
+ * If the process has nothing reserved, this behaves like
+ * allocate_zeroed_frame and may thus return a NULL pointer.
+ *
+ * @param reserved set to whether the frame used up a reservation
+ */
+paddr_t allocate_reserved_frame(process_t *process, boolean_t *reserved) {
+	mutex_lock(&fa_mutex);
+	*reserved = (process->reserved_frames > 0);
+	if (!*reserved) {
+		mutex_unlock(&fa_mutex);
+		return allocate_zeroed_frame();
+	}
+	nb_reserved_frames--;
+	process->reserved_frames--;
+	// The frame is charged again once mapped (@see prepare_write)
+	quota_charge(process, -1);
+
+	paddr_t frame = NULL;
+	boolean_t zeroed = (zero_pool_count > 0);
+	if (zeroed) {
+		frame = zero_pool[--zero_pool_count];
+		frames[FRAME_ID(frame)].flags &= ~FRAME_ZEROED;
+	} else {
+		frame = take_frames(0);
+	}
+	mutex_unlock(&fa_mutex);
+
+	if (frame == NULL) kernel_panic("Reserved frame missing");
+	if (!zeroed) clear_frame(frame, FALSE);
+	return frame;
+}
+
+/**
+ * @brief Returns 2^order contiguous frames out of the reservations of the
+ * process, with the contents they had, aligned on their physical size
+ *
+ * The block is taken from the buddy allocator only, so it may be missing
+ * even though the frames are reserved; the reservations then stay.
+ *
+ * @return the block, or a NULL pointer
+ */
+paddr_t allocate_reserved_block(process_t *process, int order) {
+	int n = 1 << order;
+
+	mutex_lock(&fa_mutex);
+	if (process->reserved_frames < n) {
+		mutex_unlock(&fa_mutex);
+		return NULL;
+	}
+	paddr_t block = take_frames(order);
+	if (block != NULL && (uint32_t) block % (PAGE_SIZE << order) != 0) {
+		// User memory doesn't start on a boundary of that size
+		int i;
+		for (i = 0; i < n; ++i)
+			_free_frame((paddr_t) ((uint32_t) block + i * PAGE_SIZE));
+		block = NULL;
+	}
+	if (block != NULL) {
+		nb_reserved_frames -= n;
+		process->reserved_frames -= n;
+	}
+	mutex_unlock(&fa_mutex);
 
-	// Save old frame contents on kernel buffer
-	memcpy(cow_buffer, (void*) page_addr, PAGE_SIZE);
+	// The frames are charged again once mapped
+	if (block != NULL) quota_charge(process, -n);
+	return block;
+}
 
-	// Set the page table entry to the new frame
-	*pte = PE_SETADDR(*pte, new_frame);
-	set_cr3(get_cr3());
+/**
+ * @brief Fills the pool of zeroed frames up
+ *
+ * This is run by the worker of a CPU whose idle thread has nothing better
+ * to do (@see queue_refill). The frames are zeroed without holding the frame
+ * lock, so that allocations are not delayed by the refill. The pool is only
+ * refilled from the free frames; a refill stops as soon as they run low, so
+ * that the larger blocks aren't broken up under memory pressure (@see
+ * reclaim.c).
+ */
+void refill_zeroed_frames(void) {
+	mutex_lock(&fa_mutex);
+	boolean_t busy = refilling;
+	refilling = TRUE;
+	mutex_unlock(&fa_mutex);
+	if (busy) return;
 
-	// Copy the page pack to the new frame
-	memcpy((void*) page_addr, cow_buffer, PAGE_SIZE);
+	while (1) {
+		mutex_lock(&fa_mutex);
+		boolean_t full = (zero_pool_count >= ZERO_POOL_SIZE
+			|| nb_free_frames < RECLAIM_HIGH);
+		paddr_t frame = full ? NULL : take_frames(0);
+		mutex_unlock(&fa_mutex);
+		if (frame == NULL) break;
 
-	frames[old_frame_id]--;
+		clear_frame(frame, TRUE);
 
+		mutex_lock(&fa_mutex);
+		if (zero_pool_count < ZERO_POOL_SIZE) {
+			frames[FRAME_ID(frame)].flags |= FRAME_ZEROED;
+			zero_pool[zero_pool_count++] = frame;
+			frame = NULL;
+		}
+		mutex_unlock(&fa_mutex);
+
+		// The pool got filled behind our back
+		if (frame != NULL) free_frame(frame);
+	}
+
+	mutex_lock(&fa_mutex);
+	refilling = FALSE;
 	mutex_unlock(&fa_mutex);
+}
 
-	return 0;
+/**
+ * @brief The work refilling the pool of zeroed frames
+ */
+static void refill_work(void *arg) {
+	refill_zeroed_frames();
+}
+
+/**
+ * @brief Hands the refill of the pool of zeroed frames to the worker of the
+ * calling CPU, if the pool needs it and no refill is under way
+ *
+ * It is called by the idle threads, outside of any dont_switch_me_out area.
+ * The pool is peeked at without the frame lock, the refill looks at it
+ * again. The caller refills the pool itself if the worker can't.
+ */
+void queue_refill(void) {
+	if (refilling || zero_pool_count >= ZERO_POOL_SIZE
+			|| nb_free_frames < RECLAIM_HIGH)
+		return;
+
+	if (queue_work(refill_work, NULL) < 0) refill_zeroed_frames();
+}
+
+/**
+ * @brief Gives the frames of the zeroed pool back to the free lists
+ *
+ * They were available already, but merged back with their buddies they can
+ * make up the larger blocks again.
+ *
+ * @return the number of frames given back
+ */
+int drain_zeroed_frames(void) {
+	mutex_lock(&fa_mutex);
+	int n = zero_pool_count;
+	while (zero_pool_count > 0) {
+		paddr_t frame = zero_pool[--zero_pool_count];
+		frames[FRAME_ID(frame)].flags &= ~FRAME_ZEROED;
+		if (_free_frame(frame)) kernel_panic("Zeroed frame incoherence");
+	}
+	mutex_unlock(&fa_mutex);
+	return n;
 }
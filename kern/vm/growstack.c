@@ -0,0 +1,88 @@
+/**
+ * @file growstack.c
+ * @brief Grow-down stack regions
+ *
+ * The main stack of a program, and every stack a program asks for with
+ * new_pages(base, len | NEW_PAGES_GROWSDOWN), is a region of the process
+ * of kind REGION_STACK. The region spans the most the stack may grow to,
+ * but only its top pages are mapped; the others stay out of the page
+ * tables, and no other allocation may take them. A fault under the mapped
+ * pages extends the stack right from the page fault handler (@see
+ * region_fault), by at least
+ * STACK_GROW_PAGES pages, down to the bottom of the region. Below that the
+ * fault goes to the swexn handler of the thread like any other.
+ *
+ * The new pages are zero-fill pages (@see map_range), so growing a stack
+ * only reserves frames until its pages are written to.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <x86/page.h>
+#include <errors.h>
+#include <page.h>
+#include <region.h>
+#include <growstack.h>
+
+/**
+ * @brief Returns the lowest mapped page of a stack region
+ */
+vaddr_t stack_mapped(region_t *region) {
+	return region->start + (region->num_pages - region->object) * PAGE_SIZE;
+}
+
+/**
+ * @brief Creates a stack region of num_pages pages from base in the current
+ * address space, with its top page mapped
+ *
+ * The caller holds the region lock of the process and has checked that the
+ * range is free.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int stack_create(process_t *process, vaddr_t base, int num_pages) {
+	if (!valid_range(base, num_pages)) return ERR_INVALID_ARG;
+
+	vaddr_t top = base + (num_pages - 1) * PAGE_SIZE;
+	int err = map_range(top, 1, MEM_TYPE_BSS);
+	if (err) return err;
+
+	err = insert_region(&process->regions, base, num_pages);
+	if (err) {
+		if (unmap_range(top, 1))
+			kernel_panic("Unable to unmap the top of a stack");
+		return err;
+	}
+
+	region_t *region = find_region(&process->regions, base);
+	region->kind = REGION_STACK;
+	region->object = 1;
+	return 0;
+}
+
+/**
+ * @brief Extends a stack region down to va, which is under its mapped pages
+ *
+ * This is called on a fault for a page that is not present (@see
+ * region_fault), with the region lock of the process held.
+ *
+ * @return 0 if the stack now maps va, a negative error code otherwise
+ */
+int stack_grow(region_t *region, vaddr_t va) {
+	vaddr_t low = stack_mapped(region);
+	if (va >= low) {
+		// Another thread of the process extended it in the meantime
+		return 0;
+	}
+
+	int pages = (low - PAGE_ADDR(va)) / PAGE_SIZE;
+	int left = region->num_pages - region->object;
+	if (pages < STACK_GROW_PAGES) pages = STACK_GROW_PAGES;
+	if (pages > left) pages = left;
+
+	int err = map_range(low - pages * PAGE_SIZE, pages, MEM_TYPE_BSS);
+	if (err == 0) region->object += pages;
+	return err;
+}
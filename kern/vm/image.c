@@ -0,0 +1,347 @@
+/**
+ * @file image.c
+ * @brief Shared, demand-paged executable images
+ *
+ * Instead of copying the text and rodata of a program into private frames at
+ * every exec, each program of the exec2obj table gets an image holding the
+ * frames of these read-only pages. exec only records the image in the
+ * process. The pages are loaded on the first fault in any process running
+ * the program, and mapped read-only from the image into every process
+ * touching them afterwards.
+ *
+ * The image keeps the ELF header of its program as well, checked and parsed
+ * on the first exec of the program only (@see find_image).
+ *
+ * Once a program was loaded IMAGE_TEMPLATE_LOADS times, the next load takes
+ * a snapshot of its data and bss, in an address space of the image which
+ * never runs: the template. The later loads share the page tables of the
+ * template copy on write, with copy_paging as a fork does, and only build
+ * the arguments and the stack themselves. The template holds its frames and
+ * the reservations of its zero pages for as long as the kernel runs, so
+ * programs with large segments don't get one.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <cr.h>
+#include <image.h>
+#include <page.h>
+#include <pcrwlock.h>
+#include <process.h>
+#include <thread.h>
+#include <errors.h>
+#include <syshelper.h>
+
+/**
+ * The images of the programs, indexed like the exec2obj table. Entries are
+ * created on the first exec of a program and never freed.
+ */
+static image_t **images = NULL;
+/**
+ * Protects the creation of images. Every exec or mapping looks its entry up,
+ * the creations are rare.
+ */
+static pcrwlock_t images_lock;
+
+/**
+ * @brief Initializes the image cache
+ * @return 0 on success, a negative error code otherwise
+ */
+int init_images(void) {
+	images = calloc(exec2obj_userapp_count, sizeof(image_t *));
+	if (images == NULL) return ERR_MALLOC_FAIL;
+	pcrwlock_init(&images_lock);
+	return 0;
+}
+
+/**
+ * @brief Returns the image of a program, creating it if necessary
+ *
+ * @param entry the entry of the program in the exec2obj table
+ * @param hdr the simple ELF header of the program
+ * @return the image, NULL on error
+ */
+static image_t *get_image(const exec2obj_userapp_TOC_entry *entry,
+		simple_elf_t *hdr) {
+	int idx = entry - exec2obj_userapp_TOC;
+	if (idx < 0 || idx >= exec2obj_userapp_count) return NULL;
+
+	pcrw_read_lock(&images_lock);
+	image_t *found = images[idx];
+	pcrw_read_unlock(&images_lock);
+	if (found != NULL) return found;
+
+	pcrw_write_lock(&images_lock);
+
+	// Someone may have created it in the meantime
+	if (images[idx] != NULL) {
+		pcrw_write_unlock(&images_lock);
+		return images[idx];
+	}
+
+	image_t *image = calloc(1, sizeof(image_t));
+	if (image == NULL) {
+		pcrw_write_unlock(&images_lock);
+		return NULL;
+	}
+
+	image->entry = entry;
+	image->hdr = *hdr;
+
+	// The read-only pages span from the first to the last of both segments
+	vaddr_t start = PAGE_ADDR(hdr->e_txtstart);
+	vaddr_t end = hdr->e_txtstart + hdr->e_txtlen;
+	if (hdr->e_rodatlen > 0) {
+		if (PAGE_ADDR(hdr->e_rodatstart) < start)
+			start = PAGE_ADDR(hdr->e_rodatstart);
+		if (hdr->e_rodatstart + hdr->e_rodatlen > end)
+			end = hdr->e_rodatstart + hdr->e_rodatlen;
+	}
+	image->start = start;
+	image->num_pages = (end - start + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	image->frames = calloc(image->num_pages, sizeof(paddr_t));
+	if (image->frames == NULL) {
+		free(image);
+		pcrw_write_unlock(&images_lock);
+		return NULL;
+	}
+	mutex_init(&image->lock);
+
+	images[idx] = image;
+	pcrw_write_unlock(&images_lock);
+
+	return image;
+}
+
+/**
+ * @brief Returns the image of a program, given its name
+ *
+ * The ELF header of the program is only checked and parsed when the image
+ * is created, by its first exec: the later ones find it in the image.
+ *
+ * @param execname the name of the program, in kernel memory
+ * @param out placeholder for the image
+ * @return 0 on success, a negative error code otherwise
+ */
+int find_image(const char *execname, image_t **out) {
+	const exec2obj_userapp_TOC_entry *entry = exec2obj_entry(execname);
+	if (entry == NULL) return ERR_ELF_INVALID;
+	int idx = entry - exec2obj_userapp_TOC;
+
+	pcrw_read_lock(&images_lock);
+	*out = images[idx];
+	pcrw_read_unlock(&images_lock);
+	if (*out != NULL) return 0;
+
+	// First exec of the program
+	if (elf_check_header(execname) != ELF_SUCCESS) return ERR_ELF_INVALID;
+	simple_elf_t hdr;
+	if (elf_load_helper(&hdr, execname) != ELF_SUCCESS)
+		return ERR_ELF_LOAD_FAIL;
+
+	*out = get_image(entry, &hdr);
+	return (*out == NULL) ? ERR_ELF_LOAD_FAIL : 0;
+}
+
+/**
+ * @brief Copies the part of a segment falling in a page to its frame
+ *
+ * @param frame the frame of the page at va
+ * @param va the page
+ * @param start the start address of the segment
+ * @param len the length of the segment
+ * @param src the content of the segment in the kernel
+ */
+static void load_segment(paddr_t frame, vaddr_t va, unsigned long start,
+		unsigned long len, const char *src) {
+	unsigned long from = (start > va) ? start : va;
+	unsigned long to = start + len;
+	if (to > va + PAGE_SIZE) to = va + PAGE_SIZE;
+	if (from >= to) return;
+
+	write_frame(frame, from - va, src + (from - start), to - from);
+}
+
+/**
+ * @brief Tells whether the page at va holds text or rodata of the image
+ */
+static boolean_t image_contains(image_t *image, vaddr_t va) {
+	simple_elf_t *hdr = &image->hdr;
+	if (va + PAGE_SIZE > hdr->e_txtstart
+			&& va < hdr->e_txtstart + hdr->e_txtlen) return TRUE;
+	if (va + PAGE_SIZE > hdr->e_rodatstart
+			&& va < hdr->e_rodatstart + hdr->e_rodatlen) return TRUE;
+	return FALSE;
+}
+
+/**
+ * @brief Maps a text or rodata page of the program of the calling process
+ *
+ * This is called on page faults. If the page at va belongs to the read-only
+ * part of the program, its frame is loaded in the image if this is the first
+ * time anyone touches it, and mapped read-only in the calling process.
+ *
+ * @param va the page which faulted
+ * @return 0 if the page is now mapped, a negative error code otherwise
+ */
+int image_fault(vaddr_t va) {
+	va = PAGE_ADDR(va);
+
+	process_t *process = get_self()->process;
+	if (process == NULL || process->image == NULL)
+		return ERR_PAGE_NOT_PRESENT;
+
+	image_t *image = process->image;
+	if (va < image->start) return ERR_PAGE_NOT_PRESENT;
+	int idx = (va - image->start) / PAGE_SIZE;
+	if (idx >= image->num_pages) return ERR_PAGE_NOT_PRESENT;
+	if (!image_contains(image, va)) return ERR_PAGE_NOT_PRESENT;
+
+	mutex_lock(&image->lock);
+
+	paddr_t frame = image->frames[idx];
+	if (frame == NULL) {
+		// First touch, load the page. The image holds it from now on
+		frame = allocate_zeroed_frame();
+		if (frame == NULL) {
+			mutex_unlock(&image->lock);
+			return ERR_NO_FRAMES;
+		}
+
+		const char *bytes = image->entry->execbytes;
+		simple_elf_t *hdr = &image->hdr;
+		load_segment(frame, va, hdr->e_txtstart, hdr->e_txtlen,
+			bytes + hdr->e_txtoff);
+		load_segment(frame, va, hdr->e_rodatstart, hdr->e_rodatlen,
+			bytes + hdr->e_rodatoff);
+
+		image->frames[idx] = frame;
+	}
+
+	// The mapping holds the frame as well
+	int err = get_frame(frame);
+	mutex_unlock(&image->lock);
+	if (err) return err;
+
+	err = map_frame(va, MEM_TYPE_TEXT, frame);
+	if (err) {
+		if (free_frame(frame)) kernel_panic("Image frame incoherence");
+		// Another thread of the process mapped it first
+		if (err == ERR_PAGE_ALREADY_PRESENT) return 0;
+		return err;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Gives back the loaded frames of every image that no process maps
+ *
+ * This is called under memory pressure (@see reclaim.c). The pages are
+ * loaded again on their next fault.
+ *
+ * @return the number of frames given back
+ */
+int image_reclaim(void) {
+	int i, idx, n = 0;
+
+	pcrw_read_lock(&images_lock);
+	for (i = 0; i < exec2obj_userapp_count; ++i) {
+		image_t *image = images[i];
+		if (image == NULL) continue;
+
+		// A fault takes its hold on the frame with the lock held
+		mutex_lock(&image->lock);
+		for (idx = 0; idx < image->num_pages; ++idx) {
+			paddr_t frame = image->frames[idx];
+			if (frame == NULL || frame_refs(frame) > 1) continue;
+
+			image->frames[idx] = NULL;
+			if (free_frame(frame)) kernel_panic("Image frame incoherence");
+			n++;
+		}
+		mutex_unlock(&image->lock);
+	}
+	pcrw_read_unlock(&images_lock);
+
+	return n;
+}
+
+/**
+ * @brief Gives the calling process the data and bss of its program from the
+ * template of the image, if there is one
+ *
+ * The address space of the process must hold no user pages yet.
+ *
+ * @param image the image of the program
+ * @return TRUE if the segments are now mapped, FALSE if the caller must load
+ * them itself
+ */
+int image_clone(image_t *image) {
+	process_t *process = get_self()->process;
+
+	mutex_lock(&image->lock);
+	image->loads++;
+	if (image->template == NULL) {
+		mutex_unlock(&image->lock);
+		return FALSE;
+	}
+
+	int err = copy_paging(image->template, process);
+	mutex_unlock(&image->lock);
+	if (err) {
+		// Out of quota or of table references, load the usual way
+		reset_paging();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * @brief Makes a template of the data and bss the calling process just
+ * loaded, if its program deserves one
+ *
+ * The process must not have touched them, nor mapped anything else, yet.
+ * It keeps running on the same, now shared, page tables.
+ *
+ * @param image the image of the program
+ */
+void image_snapshot(image_t *image) {
+	process_t *process = get_self()->process;
+
+	mutex_lock(&image->lock);
+	if (image->template != NULL || image->loads < IMAGE_TEMPLATE_LOADS
+			|| process->rss_frames + process->reserved_frames
+				> IMAGE_TEMPLATE_MAX_PAGES) {
+		mutex_unlock(&image->lock);
+		return;
+	}
+
+	process_t *template = calloc(1, sizeof(process_t));
+	if (template == NULL) {
+		mutex_unlock(&image->lock);
+		return;
+	}
+	template->cr3 = init_paging();
+	if (template->cr3 == NULL) {
+		free(template);
+		mutex_unlock(&image->lock);
+		return;
+	}
+
+	if (copy_paging(process, template)) {
+		// Only drops the tables it got, which the process still holds
+		destroy_paging(template);
+		free(template);
+		mutex_unlock(&image->lock);
+		return;
+	}
+
+	image->template = template;
+	mutex_unlock(&image->lock);
+}
@@ -0,0 +1,376 @@
+/**
+ * @file ksm.c
+ * @brief Same-page merging of identical user frames
+ *
+ * Processes running the same program, or forked from the same parent, end
+ * up with many private frames holding the same bytes: data pages nobody
+ * wrote to since a copy on write, buffers filled the same way. The scanner,
+ * a kernel thread which only runs when the kernel is built with KSM_SCAN,
+ * looks at the private frames of every process, KSM_PAGES_PER_PASS pages
+ * at a time with a sleep of KSM_SLEEP_TICKS in between, and maps the pages
+ * holding the same bytes to a single frame, copy on write. The duplicates
+ * go back to the allocator.
+ *
+ * Pages written to since the previous round are left alone, they are
+ * likely to change again. The others are hashed, and looked up in two
+ * tables:
+ * - The stable table holds the frames pages are merged into, each held by
+ *   the scanner once. A page whose bytes are found there, checked byte for
+ *   byte, is made copy on write, checked again, and mapped to it.
+ * - The unstable table holds the hashes seen during the round, with their
+ *   frame. A page matching a different frame there becomes stable itself,
+ *   and the other page is merged into it when the scanner comes back to it.
+ *   The table is cleared after every round, and the stable frames no page
+ *   maps anymore are released.
+ *
+ * The entries of a process are changed behind its back, which is only safe
+ * when none of its threads runs meanwhile, and with its region and copy on
+ * write locks held. The scanner moves to the CPU of the process, where all
+ * of its threads run, and pins the process there (@see sched.c). Switching
+ * to the scanner flushes the entries of the process from the TLB, and the
+ * process gets them back from its page tables once the scanner is out of
+ * the way. Page tables shared since a fork are left for the processes to
+ * split first.
+ *
+ * Only the processes created after the scanner starts, with init, are
+ * scanned.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <page.h>
+#include <process.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <lock.h>
+#include <inc/syscall.h>
+#include <sched.h>
+#include <kthread.h>
+#include <scanset.h>
+#include <ksm.h>
+
+/* A frame seen by the scanner, and the hash of its bytes */
+typedef struct {
+	uint32_t	hash;
+	paddr_t		frame;		// NULL for an empty slot
+} ksm_slot_t;
+
+/*
+ * The frames pages are merged into, and the frames seen this round. Both
+ * are open-addressed on the hash, and protected by table_lock.
+ */
+static ksm_slot_t stable[KSM_SLOTS];
+static int stable_count = 0;
+static ksm_slot_t unstable[KSM_SLOTS];
+static mutex_t table_lock;
+
+/* Counters, protected by table_lock too */
+static unsigned int scanned = 0;
+static unsigned int merged = 0;
+static unsigned int collisions = 0;
+static unsigned int rounds = 0;
+
+/* The copies of the frames compared, only the scanner uses them */
+static uint32_t page_buf[PAGE_SIZE / sizeof(uint32_t)];
+static uint32_t other_buf[PAGE_SIZE / sizeof(uint32_t)];
+
+/* The processes to scan, @see scanset.c */
+static scanset_t processes;
+
+/* Whether the scanner runs, and tracks the new processes */
+static boolean_t running = FALSE;
+
+/**
+ * @brief Hashes the bytes of a page
+ */
+static uint32_t page_hash(const uint32_t *words) {
+	uint32_t hash = 2166136261u;
+	int i;
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); ++i) {
+		hash ^= words[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * @brief Adds a frame to a table, if there is room left
+ * @return TRUE if the frame was added
+ */
+static boolean_t table_insert(ksm_slot_t *table, uint32_t hash,
+		paddr_t frame) {
+	int i, slot = hash & (KSM_SLOTS - 1);
+	for (i = 0; i < KSM_SLOTS; ++i, slot = (slot + 1) & (KSM_SLOTS - 1)) {
+		if (table[slot].frame != NULL) continue;
+		table[slot].hash = hash;
+		table[slot].frame = frame;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * @brief Returns a frame of a table, other than frame, holding the bytes in
+ * page_buf, NULL if there is none
+ *
+ * The bytes of the frame found are left in other_buf.
+ */
+static paddr_t table_find(ksm_slot_t *table, uint32_t hash, paddr_t frame) {
+	int i, slot = hash & (KSM_SLOTS - 1);
+	for (i = 0; i < KSM_SLOTS; ++i, slot = (slot + 1) & (KSM_SLOTS - 1)) {
+		if (table[slot].frame == NULL) return NULL;
+		if (table[slot].hash != hash || table[slot].frame == frame)
+			continue;
+
+		read_frame(table[slot].frame, other_buf);
+		if (memcmp(page_buf, other_buf, PAGE_SIZE) == 0)
+			return table[slot].frame;
+		collisions++;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Releases the stable frames no page maps anymore
+ *
+ * The others are inserted again, so that no lookup stops at a released
+ * slot. The table lock must be held.
+ *
+ * @return the number of frames released
+ */
+static int release_stable(void) {
+	static ksm_slot_t kept[KSM_SLOTS];
+	int i, n = 0, released = 0;
+
+	for (i = 0; i < KSM_SLOTS; ++i) {
+		if (stable[i].frame == NULL) continue;
+		if (frame_refs(stable[i].frame) > 1) kept[n++] = stable[i];
+		else if (free_frame(stable[i].frame))
+			panic("Couldn't release a stable frame");
+		else released++;
+	}
+
+	memset(stable, 0, sizeof(stable));
+	for (i = 0; i < n; ++i) table_insert(stable, kept[i].hash, kept[i].frame);
+	stable_count = n;
+	return released;
+}
+
+/**
+ * @brief Ends a round: forgets the frames seen and releases the stable
+ * frames no page maps anymore
+ */
+static void end_round(void) {
+	mutex_lock(&table_lock);
+	release_stable();
+	memset(unstable, 0, sizeof(unstable));
+	rounds++;
+	mutex_unlock(&table_lock);
+}
+
+/**
+ * @brief Tries to merge a page of a process
+ *
+ * @param process the process, pinned and locked
+ * @param va the page
+ * @param pte its entry
+ */
+static void merge_page(process_t *process, vaddr_t va, pte_t *pte) {
+	pte_t entry = *pte;
+	if (!PE_GETFLAG(entry, PTE_PRESENT) || !PE_GETFLAG(entry, PTE_USER))
+		return;
+	if (PE_GETFLAG(entry, PTE_GLOBAL) || PE_GETFLAG(entry, PTE_ZEROPAGE)
+			|| PE_GETFLAG(entry, PTE_SHARED)) return;
+
+	// Shared frames, the stable ones included, have nothing to gain
+	paddr_t frame = (paddr_t) PE_GETADDR(entry);
+	if (frame_refs(frame) != 1) return;
+	if (frame_flags(frame) & FRAME_PINNED) return;
+
+	// Pages written to lately are likely to change again
+	if (clean_page(process, va, frame) != 0) return;
+
+	read_frame(frame, page_buf);
+	uint32_t hash = page_hash(page_buf);
+
+	mutex_lock(&table_lock);
+	scanned++;
+
+	paddr_t match = table_find(stable, hash, frame);
+	if (match != NULL) {
+		// Nobody writes to the page once it is copy on write
+		if (protect_page(process, va, frame) == 0) {
+			read_frame(frame, page_buf);
+			if (memcmp(page_buf, other_buf, PAGE_SIZE) == 0
+					&& remap_page(process, va, frame, match) == 0)
+				merged++;
+		}
+		mutex_unlock(&table_lock);
+		return;
+	}
+
+	if (table_find(unstable, hash, frame) == NULL) {
+		table_insert(unstable, hash, frame);
+		mutex_unlock(&table_lock);
+		return;
+	}
+
+	// Another page holds the same bytes, merge it into this one later
+	if (stable_count < KSM_SLOTS && protect_page(process, va, frame) == 0) {
+		read_frame(frame, page_buf);
+		if (page_hash(page_buf) == hash && get_frame(frame) == 0) {
+			table_insert(stable, hash, frame);
+			stable_count++;
+		}
+	}
+	mutex_unlock(&table_lock);
+}
+
+/**
+ * @brief Scans the next pages of a process
+ *
+ * @param process the process, pinned and locked
+ * @return TRUE if the scan reached the end of its address space
+ */
+static boolean_t scan_process(process_t *process) {
+	vaddr_t va = process->ksm_cursor;
+	if (va < USER_MEM_START) va = USER_MEM_START;
+
+	int budget = KSM_PAGES_PER_PASS;
+	while (budget > 0) {
+		pde_t pde = *get_pde(va, process->cr3);
+		if (!PE_GETFLAG(pde, PDE_PRESENT) || !PE_GETFLAG(pde, PDE_USER)
+				|| PE_GETFLAG(pde, PDE_KERNEL)
+				|| PE_GETFLAG(pde, PDE_PAGESIZE)
+				|| PE_GETFLAG(pde, PDE_COPYONWRITE)) {
+			// Nothing we may touch in the whole table, or a large page
+			va = (va & DIR_MASK) + PAGE_SIZE * PAGE_TABLE_ENTRIES;
+			if (va == 0) return TRUE;
+			continue;
+		}
+
+		pte_t *pte = get_pte(va, process->cr3);
+		if (pte != NULL && PE_GETFLAG(*pte, PTE_PRESENT)) {
+			merge_page(process, va, pte);
+			budget--;
+		}
+
+		va += PAGE_SIZE;
+		if (va == 0) return TRUE;
+	}
+
+	process->ksm_cursor = va;
+	return FALSE;
+}
+
+/**
+ * @brief The scanner thread
+ */
+static void ksm_main(void *arg) {
+	for (;;) {
+		boolean_t round_over;
+		process_t *process = scanset_next(&processes, &round_over);
+		if (round_over) end_round();
+
+		if (process != NULL) {
+			scanset_join(process);
+
+			mutex_lock(process->region_lock);
+			mutex_lock(process->cow_lock);
+			boolean_t done = scan_process(process);
+			mutex_unlock(process->cow_lock);
+			mutex_unlock(process->region_lock);
+
+			if (done) process->ksm_cursor = 0;
+			scanset_leave(&processes, process, done);
+		}
+
+		_sleep(KSM_SLEEP_TICKS);
+	}
+}
+
+/**
+ * @brief Creates the scanner and makes it runnable, if the kernel is built
+ * with KSM_SCAN
+ */
+void ksm_start(void) {
+	if (!KSM_SCAN) return;
+
+	mutex_init(&table_lock);
+	scanset_init(&processes, SCAN_KSM);
+
+	// Pinned, it moves itself to the processes it scans
+	if (kthread_create(ksm_main, NULL, sched_place()) != NULL)
+		running = TRUE;
+}
+
+/**
+ * @brief Adds a new process to the processes to scan
+ */
+void ksm_track(process_t *process) {
+	if (running) scanset_track(&processes, process);
+}
+
+/**
+ * @brief Takes a process being destroyed out of the processes to scan,
+ * once the scanner is done with it
+ */
+void ksm_untrack(process_t *process) {
+	if (running) scanset_untrack(&processes, process);
+}
+
+/**
+ * @brief Releases the stable frames no page maps anymore, without waiting
+ * for the end of the round
+ *
+ * This is called under memory pressure (@see reclaim.c).
+ *
+ * @return the number of frames released
+ */
+int ksm_reclaim(void) {
+	if (!running) return 0;
+
+	mutex_lock(&table_lock);
+	int released = release_stable();
+	mutex_unlock(&table_lock);
+	return released;
+}
+
+/**
+ * @brief Copies the counters of the scanner
+ *
+ * @param stats where to copy them
+ * @param reset whether to clear the counters of pages and rounds
+ */
+void ksm_stats(kstat_ksm_t *stats, boolean_t reset) {
+	memset(stats, 0, sizeof(kstat_ksm_t));
+	if (!running) return;
+
+	mutex_lock(&table_lock);
+	stats->scanned = scanned;
+	stats->merged = merged;
+	stats->collisions = collisions;
+	stats->rounds = rounds;
+	stats->stable = stable_count;
+
+	// The scanner holds each stable frame once
+	int i;
+	for (i = 0; i < KSM_SLOTS; ++i) {
+		if (stable[i].frame != NULL)
+			stats->sharing += frame_refs(stable[i].frame) - 1;
+	}
+
+	if (reset) {
+		scanned = 0;
+		merged = 0;
+		collisions = 0;
+		rounds = 0;
+	}
+	mutex_unlock(&table_lock);
+}
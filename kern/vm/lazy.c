@@ -0,0 +1,214 @@
+/**
+ * @file lazy.c
+ * @brief Regions filled on demand, and the faults in regions
+ *
+ * new_pages(base, len | NEW_PAGES_LAZY) and map_file with MAP_FILE_LAZY
+ * make regions of which no page is mapped. The page fault handler maps each
+ * page the first time it is touched, as the kind of the region says:
+ * - REGION_LAZY_ZERO pages get a zeroed frame of their own.
+ * - REGION_LAZY_TEMPLATE pages are copies of the first page of the region,
+ *   as it is when they are touched. The first page is mapped when the
+ *   region is made, for the program to fill in, and the others share its
+ *   frame copy on write, like after a fork.
+ * - REGION_LAZY_FILE pages share the page of the file from its cache, copy
+ *   on write (@see filemap.c).
+ *
+ * Unlike new_pages, nothing is reserved, so a region can be far larger than
+ * memory as long as the program only touches part of it. A fault finding no
+ * frame, or going over the limit of the group of the process (@see
+ * quota.c), is left to the swexn handler of the thread.
+ *
+ * region_fault is also where the grow-down stacks grow (@see growstack.c).
+ * It runs with the region lock of the process, so that the regions don't
+ * change under it.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <x86/page.h>
+#include <x86/cr.h>
+#include <errors.h>
+#include <page.h>
+#include <tlb.h>
+#include <filemap.h>
+#include <quota.h>
+#include <growstack.h>
+#include <lazy.h>
+
+/**
+ * @brief Tells whether the pages of a region are mapped on demand
+ */
+boolean_t region_is_lazy(region_t *region) {
+	return region->kind == REGION_LAZY_ZERO
+		|| region->kind == REGION_LAZY_TEMPLATE
+		|| region->kind == REGION_LAZY_FILE;
+}
+
+/**
+ * @brief Creates a lazy region of num_pages pages from base in the current
+ * address space
+ *
+ * Only the first page of a template region is mapped. The caller holds the
+ * region lock of the process and has checked that the range is free.
+ *
+ * @param kind the kind of the region
+ * @param file the index of the file of a REGION_LAZY_FILE region
+ * @return 0 on success, a negative error code otherwise
+ */
+int lazy_create(process_t *process, vaddr_t base, int num_pages,
+		region_kind_t kind, int file) {
+	if (!valid_range(base, num_pages)) return ERR_INVALID_ARG;
+
+	int err;
+	if (kind == REGION_LAZY_TEMPLATE) {
+		err = quota_check(process, 1);
+		if (err) return err;
+
+		paddr_t frame = allocate_zeroed_frame();
+		if (frame == NULL) return ERR_NO_FRAMES;
+		err = map_frame(base, MEM_TYPE_DATA, frame);
+		if (err) {
+			if (free_frame(frame)) kernel_panic("Template frame incoherence");
+			return err;
+		}
+	}
+
+	err = insert_region(&process->regions, base, num_pages);
+	if (err) {
+		if (kind == REGION_LAZY_TEMPLATE && unmap_range(base, 1))
+			kernel_panic("Unable to unmap a template page");
+		return err;
+	}
+
+	region_t *region = find_region(&process->regions, base);
+	region->kind = kind;
+	region->object = file;
+	return 0;
+}
+
+/**
+ * @brief Unmaps the pages of a lazy region which are mapped
+ *
+ * The caller holds the region lock of the process.
+ */
+void lazy_unmap(region_t *region) {
+	pde_t *cr3 = (pde_t *) get_cr3();
+
+	int i = 0;
+	while (i < region->num_pages) {
+		vaddr_t page = region->start + i * PAGE_SIZE;
+
+		// Skip the page tables that were never made
+		if (!PE_GETFLAG(*get_pde(page, cr3), PDE_PRESENT)) {
+			i += PAGE_TABLE_ENTRIES - PTE_OFFSET(page);
+			continue;
+		}
+
+		// Unmap the run of mapped pages from there
+		int run = 0;
+		while (i + run < region->num_pages) {
+			pte_t *pte = get_pte(page + run * PAGE_SIZE, cr3);
+			if (pte == NULL || !PE_GETFLAG(*pte, PTE_PRESENT)) break;
+			run++;
+		}
+		if (run > 0 && unmap_range(page, run))
+			kernel_panic("Lazy region unsafely unmapped");
+		i += run > 0 ? run : 1;
+	}
+}
+
+/**
+ * @brief Maps a page of a template region as a copy of its first page
+ *
+ * The first page becomes copy on write as well, so that writing to it
+ * makes a copy and leaves the pages made from it alone.
+ */
+static int template_fill(process_t *process, region_t *region, vaddr_t va) {
+	int err = own_page_table(region->start);
+	if (err) return err;
+
+	pte_t *first = get_pte(region->start, (pde_t *) get_cr3());
+	if (first == NULL || !PE_GETFLAG(*first, PTE_PRESENT))
+		return ERR_PAGE_NOT_PRESENT;
+
+	mutex_lock(process->cow_lock);
+	paddr_t frame = (paddr_t) PE_GETADDR(*first);
+	err = get_frame(frame);
+	if (err == 0 && !PE_GETFLAG(*first, PTE_COPYONWRITE)) {
+		*first = PE_SETFLAG(*first, PTE_COPYONWRITE);
+		*first = PE_UNSETFLAG(*first, PTE_READWRITE);
+		tlb_flush_page(region->start);
+	}
+	mutex_unlock(process->cow_lock);
+	if (err) return err;
+
+	err = create_page(va, MEM_TYPE_DATA, frame);
+	if (err && free_frame(frame)) kernel_panic("Template frame incoherence");
+	return err;
+}
+
+/**
+ * @brief Maps the page at va of a lazy region
+ *
+ * The caller holds the region lock of the process.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int lazy_fill(process_t *process, region_t *region, vaddr_t va) {
+	// Another thread of the process may have filled it in the meantime
+	pte_t *pte = get_pte(va, (pde_t *) get_cr3());
+	if (pte != NULL && PE_GETFLAG(*pte, PTE_PRESENT)) return 0;
+
+	int err = quota_check(process, 1);
+	if (err) return err;
+
+	paddr_t frame;
+	switch (region->kind) {
+		case REGION_LAZY_ZERO:
+			frame = allocate_zeroed_frame();
+			if (frame == NULL) return ERR_NO_FRAMES;
+			err = map_frame(va, MEM_TYPE_DATA, frame);
+			break;
+		case REGION_LAZY_FILE:
+			frame = filemap_frame(region->object,
+				(va - region->start) / PAGE_SIZE);
+			if (frame == NULL) return ERR_NO_FRAMES;
+			err = create_page(va, MEM_TYPE_DATA, frame);
+			break;
+		default:
+			return template_fill(process, region, va);
+	}
+
+	if (err && free_frame(frame)) kernel_panic("Lazy frame incoherence");
+	return err;
+}
+
+/**
+ * @brief Resolves a fault on a page that is not present, if a region of the
+ * process says how
+ *
+ * A fault taken in the kernel while the thread holds the region lock of its
+ * process can't be resolved, and is left to the caller.
+ *
+ * @return 0 if va is now mapped, a negative error code otherwise
+ */
+int region_fault(vaddr_t va) {
+	thread_t *self = get_self();
+	process_t *process = self->process;
+	if (process == NULL) return ERR_NO_REGION;
+	if (process->region_lock->owner == self) return ERR_NO_REGION;
+
+	mutex_lock(process->region_lock);
+
+	int err = ERR_NO_REGION;
+	region_t *region = find_region(&process->regions, va);
+	if (region != NULL && region->kind == REGION_STACK)
+		err = stack_grow(region, va);
+	else if (region != NULL && region_is_lazy(region))
+		err = lazy_fill(process, region, PAGE_ADDR(va));
+
+	mutex_unlock(process->region_lock);
+	return err;
+}
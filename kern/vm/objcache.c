@@ -0,0 +1,91 @@
+/**
+ * @file objcache.c
+ * @brief Caches of free objects of a single type
+ *
+ * Some kernel objects, such as the thread control blocks and the kernel
+ * stacks, are created and destroyed at a high rate. Rather than going
+ * through the kernel heap and its global lock each time, a freed object is
+ * kept in the cache of its type, up to a bound, and handed out first by the
+ * next allocation. Only when the cache is empty, or full on a free, is the
+ * heap used.
+ *
+ * The objects come out of the cache in the state they were put back in. An
+ * optional constructor sets up the parts which stay the same across uses,
+ * such as locks, when an object comes from the heap; the users reset the
+ * rest and give the objects back in their constructed state.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <assert.h>
+#include <lock.h>
+#include <objcache.h>
+
+/**
+ * @brief Initializes an empty cache
+ *
+ * @param cache the cache
+ * @param name its name, for debugging
+ * @param size the size of the objects
+ * @param align the alignment of the objects, 0 if they need none
+ * @param limit the number of free objects kept at most
+ * @param ctor the constructor run on the objects from the heap, or NULL
+ */
+void objcache_init(objcache_t *cache, const char *name, size_t size,
+		size_t align, int limit, void (*ctor)(void *)) {
+	assert(limit >= 0 && limit <= OBJCACHE_MAX_FREE);
+
+	cache->name = name;
+	cache->size = size;
+	cache->align = align;
+	cache->ctor = ctor;
+	cache->limit = limit;
+	cache->count = 0;
+	mutex_init_named(&cache->lock, "object cache");
+}
+
+/**
+ * @brief Returns a constructed object
+ *
+ * @param cache the cache of the object type
+ * @return the object, or NULL if memory ran out
+ */
+void *objcache_alloc(objcache_t *cache) {
+	mutex_lock(&cache->lock);
+	if (cache->count > 0) {
+		void *obj = cache->free[--cache->count];
+		mutex_unlock(&cache->lock);
+		return obj;
+	}
+	mutex_unlock(&cache->lock);
+
+	void *obj;
+	if (cache->align > 0) obj = smemalign(cache->align, cache->size);
+	else obj = smalloc(cache->size);
+
+	if (obj != NULL && cache->ctor != NULL) cache->ctor(obj);
+	return obj;
+}
+
+/**
+ * @brief Gives an object obtained from objcache_alloc back
+ *
+ * @param cache the cache of the object type
+ * @param obj the object, in its constructed state
+ */
+void objcache_free(objcache_t *cache, void *obj) {
+	if (obj == NULL) return;
+
+	mutex_lock(&cache->lock);
+	if (cache->count < cache->limit) {
+		cache->free[cache->count++] = obj;
+		mutex_unlock(&cache->lock);
+		return;
+	}
+	mutex_unlock(&cache->lock);
+
+	sfree(obj, cache->size);
+}
@@ -27,19 +27,129 @@
 #include <syshelper.h>
 #include <ureg.h>
 #include <lock.h>
+#include <image.h>
+#include <tlb.h>
+#include <ptpool.h>
+#include <usercopy.h>
+#include <shm.h>
+#include <pipe.h>
+#include <filemap.h>
+#include <vdso.h>
+#include <cpu.h>
+#include <quota.h>
+#include <lazy.h>
+#include <pageops.h>
+#include <boottime.h>
+#include <reclaim.h>
+#include <wss.h>
+#include <cputime.h>
 
 /**
- * A blank frame, read-only, to implement ZFOD
+ * A blank frame, read-only, to implement ZFOD. It is part of the kernel image
+ * so that it lies in the kernel page table, where it can be made read-only.
  */
-static paddr_t zero_frame = NULL;
+static char zeros[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static paddr_t zero_frame = zeros;
 /**
- * A buffer to copy frames in case copy on write can't be setup
+ * The page directory entries of the kernel direct map, copied in every page
+ * directory. The first 4MB are mapped by a single page table with 4KB pages,
+ * shared by all processes, and the rest with global 4MB pages.
  */
-static uint32_t *frame_buffer = NULL;
+static pde_t kernel_pdes[KERNEL_PDES];
 /**
- * Mutex protecting the frame buffer
+ * Number of page directories pointing to each shared page table, indexed by
+ * the kernel page the table lives in. Page tables are shared read-only
+ * between a parent and its child at fork, flagged with PDE_COPYONWRITE, and
+ * only split when one of them modifies the 4MB region. The counter is only
+ * meaningful for tables some directory flags PDE_COPYONWRITE.
  */
-static mutex_t frame_buffer_lock;
+static uint16_t *pt_refs = NULL;
+/**
+ * Mutex protecting the shared page tables and their counters
+ */
+static mutex_t pt_refs_lock;
+
+/**
+ * @brief Atomically adds to a memory counter of a process
+ *
+ * The threads of a process map pages under different locks, the regions
+ * lock for new_pages and the copy on write lock for faults.
+ */
+static void atomic_add(volatile int *counter, int value) {
+	asm volatile ("lock; addl %1, %0"
+		: "+m" (*counter) : "r" (value) : "memory");
+}
+
+/**
+ * @brief Returns the process whose page directory is loaded, NULL while
+ * the kernel boots
+ */
+static process_t *current_process(void) {
+	thread_t *self = cpu_current();
+	return (self != NULL) ? self->process : NULL;
+}
+
+/**
+ * @brief Accounts for n more user pages mapped to a frame, fewer if n is
+ * negative, in the calling process
+ *
+ * The peak is only raised, without a lock: two threads racing may both fall
+ * short of the other's value, by a few pages at most.
+ */
+static void account_frames(int n) {
+	process_t *process = current_process();
+	if (process == NULL) return;
+
+	atomic_add(&process->rss_frames, n);
+	if (process->rss_frames > process->peak_frames)
+		process->peak_frames = process->rss_frames;
+	quota_charge(process, n);
+}
+
+/**
+ * @brief Builds the kernel direct map shared by all page directories
+ *
+ * The kernel memory is mapped with 4MB pages, which cost no page table and a
+ * single TLB entry each, except for the first 4MB. These contain the kernel
+ * image, whose zero frame and copy windows need their own page table entries,
+ * and are mapped with 4KB pages. All the kernel entries are global, so they
+ * survive the cr3 reloads of context switches.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int build_kernel_map(void) {
+	if ((vaddr_t) zero_frame >= KERNEL_SMALL_PAGES_END)
+		kernel_panic("Zero frame out of the kernel page table");
+
+	pte_t *pt = smemalign(PAGE_SIZE, PAGE_SIZE);
+	if (pt == NULL) return ERR_MALLOC_FAIL;
+
+	// The entries only differ by their frame
+	pte_t pte = 0;
+	pte = PE_SETFLAG(pte, PTE_PRESENT);
+	pte = PE_SETFLAG(pte, PTE_READWRITE);
+	pte = PE_SETFLAG(pte, PTE_GLOBAL);
+
+	int i;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) pt[i] = pte + i * PAGE_SIZE;
+
+	// Make the zero frame unwritable
+	pte_t *zero_pte = &pt[PTE_OFFSET((vaddr_t) zero_frame)];
+	*zero_pte = PE_UNSETFLAG(*zero_pte, PTE_READWRITE);
+
+	pde_t pde = 0;
+	pde = PE_SETFLAG(pde, PDE_PRESENT);
+	pde = PE_SETFLAG(pde, PDE_READWRITE);
+	pde = PE_SETFLAG(pde, PDE_KERNEL);
+	kernel_pdes[0] = PE_SETADDR(pde, pt);
+
+	pde = PE_SETFLAG(pde, PDE_PAGESIZE);
+	pde = PE_SETFLAG(pde, PDE_GLOBAL);
+	for (i = 1; i < KERNEL_PDES; ++i)
+		kernel_pdes[i] = pde + i * KERNEL_SMALL_PAGES_END;
+
+	return 0;
+}
 
 /**
  * @brief Installs paging for the system
@@ -61,19 +171,44 @@ int install_paging(vm_size_t upper_mem) {
 	insert_to_idt(create_trap_idt_entry(&trap_gate), IDT_PF);
 
 	// Create the zero frame
-	zero_frame = smemalign(PAGE_SIZE, PAGE_SIZE);
-	if (zero_frame == NULL) return ERR_MALLOC_FAIL;
-	memset(zero_frame, 0, PAGE_SIZE);
+	zero_page(zero_frame);
+
+	// The page tables and directories are recycled through a pool
+	init_pt_pool();
+
+	// Map the kernel, once for everybody
+	int err = build_kernel_map();
+	if (err) return err;
+	boot_mark(KSTAT_BOOT_KERNEL_MAP);
 
-	// Create the frame buffer
-	frame_buffer = smemalign(PAGE_SIZE, PAGE_SIZE);
-	if (frame_buffer == NULL) return ERR_MALLOC_FAIL;
-	mutex_init(&frame_buffer_lock);
+	// Create the shared page tables counters
+	pt_refs = calloc(USER_MEM_START / PAGE_SIZE, sizeof(uint16_t));
+	if (pt_refs == NULL) return ERR_MALLOC_FAIL;
+	mutex_init(&pt_refs_lock);
 
 	// Initialize the frame allocator
-	int err = init_frame_allocator(upper_mem);
+	err = init_frame_allocator(upper_mem);
+	if (err) return err;
+	boot_mark(KSTAT_BOOT_FRAMES);
+
+	// Initialize the shared program images
+	err = init_images();
+	if (err) return err;
+
+	// Initialize the shared memory segments and the pipes
+	init_shm();
+	init_pipes();
+
+	// The kernel data page shared by every process
+	vdso_init();
+
+	// Initialize the caches of the mapped files
+	err = init_filemap();
 	if (err) return err;
 
+	// And their reclaim when memory runs low
+	init_reclaim();
+
 	return 0;
 }
 
@@ -81,8 +216,9 @@ int install_paging(vm_size_t upper_mem) {
  * @brief Initializes the page directory for the current process
  * 
  * This function has to be called after install_paging. It sets up a page
- * directory and page tables for the calling process. The kernel space is
- * direct-mapped, and the process begins with no user space pages allocated.
+ * directory for the calling process. The kernel space is direct-mapped by the
+ * entries shared with every other process (@see build_kernel_map), and the
+ * process begins with no user space pages allocated.
  * In fact, this function is called only once, to setup the god process paging.
  * Once this is done, new processes are created with the fork system call,
  * which creates the page tables with copy_paging()
@@ -91,79 +227,262 @@ int install_paging(vm_size_t upper_mem) {
 pde_t *init_paging() {
 	/* Page directory */
 
-	// Allocate
-	pde_t* cr3 = smemalign(PAGE_SIZE, PAGE_SIZE);
+	// Allocate, empty
+	pde_t* cr3 = alloc_page_table();
 	if (cr3 == NULL) return NULL;
-	
-	// Initialize
-	int i;
-	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
-		boolean_t has_user;
-		pde_t pde = 0;
-		if (i*PAGE_TABLE_ENTRIES*PAGE_SIZE < USER_MEM_START) {
-			// If the page directory has pages in kernel space
-			pde = PE_SETFLAG(pde, PDE_PRESENT);
-			pde = PE_SETFLAG(pde, PDE_KERNEL);
-
-			// Allocate page table
-			pte_t *pt = smemalign(PAGE_SIZE, PAGE_SIZE);
-			if (pt == NULL) return NULL;
-
-			// Create all page entries
-			int j;
-			for (j = 0; j < PAGE_TABLE_ENTRIES; ++j) {
-				if ((i*PAGE_TABLE_ENTRIES + j)*PAGE_SIZE >= USER_MEM_START) {
-					// We've reached the end of kernel 
-					// space
-					has_user = TRUE;
-					pde = PE_SETFLAG(pde, PDE_USER);
-					// Fill all remaining PTEs with 0
-					memset(pt + j, 0, PAGE_TABLE_ENTRIES - j);
-					break;
-				}
-
-				// Create page table entry
-				pte_t pte = 0;
-				pte = PE_SETFLAG(pte, PTE_PRESENT);
-				pte = PE_SETFLAG(pte, PTE_READWRITE);
-				pte = PE_SETFLAG(pte, PTE_GLOBAL);
-				pte = PE_SETADDR(pte, (i*PAGE_TABLE_ENTRIES + j)*PAGE_SIZE);
-				pt[j] = pte;
-			}
 
-			// Link the page table to the page directory entry
-			pde = PE_SETADDR(pde, pt);
+	// The kernel space is the same for everybody
+	memcpy(cr3, kernel_pdes, sizeof(kernel_pdes));
+
+	// Return the page directory
+	return cr3;
+}
+
+/**
+ * @brief Gives the calling process a private copy of a shared page table
+ *
+ * The page table behind pde was shared with other processes at fork. If the
+ * process is the last one holding it, the table simply becomes its own again.
+ * Otherwise the table is copied, and every present user page in it gets one
+ * more owner and is set up for copy on write in both tables, exactly as
+ * copy_paging used to do eagerly at fork. Shared memory pages are the
+ * exception: they stay writable on the same frame in both tables.
+ * The caller must flush the TLB.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int split_page_table(pde_t *pde) {
+	mutex_lock(&pt_refs_lock);
+
+	if (!PE_GETFLAG(*pde, PDE_COPYONWRITE)) {
+		// Someone split it in the meantime
+		mutex_unlock(&pt_refs_lock);
+		return 0;
+	}
+
+	pte_t *pt = (pte_t *) PE_GETADDR(*pde);
+	uint16_t *refs = &pt_refs[(uint32_t) pt / PAGE_SIZE];
+
+	if (*refs > 1) {
+		pte_t *ptc = alloc_page_table();
+		if (ptc == NULL) {
+			mutex_unlock(&pt_refs_lock);
+			return ERR_MALLOC_FAIL;
+		}
+
+		int i;
+		for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+			ptc[i] = pt[i];
+			if (!PE_GETFLAG(pt[i], PTE_PRESENT)) continue;
+			if (!PE_GETFLAG(pt[i], PTE_USER)) continue;
+
+			int err = get_frame((paddr_t) PE_GETADDR(pt[i]));
+			if (err == ERR_KERNEL_FRAME) continue;
+			if (err) kernel_panic("Frame allocator coherence error %d", err);
+
+			if (PE_GETFLAG(pt[i], PTE_READWRITE)
+					&& !PE_GETFLAG(pt[i], PTE_SHARED)) {
+				// Only if the page is private and not read-only
+				ptc[i] = PE_SETFLAG(ptc[i], PTE_COPYONWRITE);
+				ptc[i] = PE_UNSETFLAG(ptc[i], PTE_READWRITE);
+				pt[i] = PE_SETFLAG(pt[i], PTE_COPYONWRITE);
+				pt[i] = PE_UNSETFLAG(pt[i], PTE_READWRITE);
+			}
 		}
 
-		// Write the entry to the page directory
-		cr3[i] = pde;
+		(*refs)--;
+		*pde = PE_SETADDR(*pde, ptc);
+	} else {
+		// We are the last process holding the table, it's ours
+		*refs = 0;
 	}
 
-	// Map the zero page
-	pte_t *zero_pte = get_pte((vaddr_t) zero_frame, cr3);
-	if (zero_pte == NULL) {
-		/*
-		 * Either smemalign returned an address out of the kernel, or we
-		 * fucked up the page table, or something even crazier happened, which
-		 * can't be good...
-		 */
-		 kernel_panic("Incoherent zero frame");
+	*pde = PE_UNSETFLAG(*pde, PDE_COPYONWRITE);
+	*pde = PE_SETFLAG(*pde, PDE_READWRITE);
+
+	mutex_unlock(&pt_refs_lock);
+	return 0;
+}
+
+/**
+ * @brief Makes sure the page table mapping va is private to the calling
+ * process, so that its entries can be modified
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int own_page_table(vaddr_t va) {
+	pde_t *pde = get_pde(va, (pde_t *) get_cr3());
+	if (!PE_GETFLAG(*pde, PDE_PRESENT)) return 0;
+	if (!PE_GETFLAG(*pde, PDE_COPYONWRITE)) return 0;
+
+	int err = split_page_table(pde);
+	if (err) return err;
+
+	tlb_flush_range(va & DIR_MASK, PAGE_TABLE_ENTRIES);
+	return 0;
+}
+
+/**
+ * @brief Tells whether a directory entry maps a large user page
+ */
+static boolean_t is_large(pde_t pde) {
+	return PE_GETFLAG(pde, PDE_PRESENT) && PE_GETFLAG(pde, PDE_PAGESIZE)
+		&& PE_GETFLAG(pde, PDE_USER);
+}
+
+/**
+ * @brief Replaces a large page of the calling process by a page table
+ * mapping the same frames
+ *
+ * Each frame of the block is held once already, as a page of its own. This
+ * is done before anything needs a single 4KB page of the region: a new
+ * mapping in it, a partial unmap, or a fork, which shares page tables.
+ *
+ * @param pde the directory entry of the large page, in the current
+ * directory
+ * @param va an address in the large page
+ * @return 0 on success, a negative error code otherwise
+ */
+static int split_large_page(pde_t *pde, vaddr_t va) {
+	pte_t *pt = alloc_page_table();
+	if (pt == NULL) return ERR_MALLOC_FAIL;
+
+	uint32_t base = PE_GETADDR(*pde);
+	int i;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+		pte_t pte = PE_SETADDR(0, base + i * PAGE_SIZE);
+		pte = PE_SETFLAG(pte, PTE_PRESENT);
+		pte = PE_SETFLAG(pte, PTE_USER);
+		pt[i] = PE_SETFLAG(pte, PTE_READWRITE);
 	}
-	
-	/*
-	 * Make it unwritable
-	 */
-	*zero_pte = PE_UNSETFLAG(*zero_pte, PTE_READWRITE);
 
-	// Return the page directory
-	return cr3;
+	pde_t entry = PE_SETADDR(0, pt);
+	entry = PE_SETFLAG(entry, PDE_PRESENT);
+	entry = PE_SETFLAG(entry, PDE_USER);
+	*pde = PE_SETFLAG(entry, PDE_READWRITE);
+
+	process_t *process = current_process();
+	if (process != NULL) atomic_add(&process->page_tables, 1);
+
+	tlb_flush_range(va & DIR_MASK, PAGE_TABLE_ENTRIES);
+	return 0;
+}
+
+/**
+ * @brief Maps a zeroed large page at va, for zero-fill pages the calling
+ * process reserved frames for
+ *
+ * The page takes a 4MB-aligned block of frames out of the reservations, so
+ * that the whole region costs a single TLB entry and no page table. It is
+ * zeroed right away, which uses the frames the reservations stood for
+ * anyway.
+ *
+ * @param va the address, 4MB-aligned, of a region with no page table
+ * @return 0 on success, a negative error code if the caller must map the
+ * region with 4KB pages instead
+ */
+static int map_large(vaddr_t va) {
+	pde_t *pde = get_pde(va, (pde_t *) get_cr3());
+	if (PE_GETFLAG(*pde, PDE_PRESENT)) return ERR_PAGE_ALREADY_PRESENT;
+
+	process_t *process = current_process();
+	paddr_t block = allocate_reserved_block(process, LARGE_PAGE_ORDER);
+	if (block == NULL) return ERR_NO_FRAMES;
+
+	pde_t entry = PE_SETADDR(0, block);
+	entry = PE_SETFLAG(entry, PDE_PRESENT);
+	entry = PE_SETFLAG(entry, PDE_USER);
+	entry = PE_SETFLAG(entry, PDE_READWRITE);
+	*pde = PE_SETFLAG(entry, PDE_PAGESIZE);
+	int i;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; i++)
+		zero_page_nt((void *) (va + i * PAGE_SIZE));
+	account_frames(PAGE_TABLE_ENTRIES);
+	return 0;
+}
+
+/**
+ * @brief Gives the frames of a large page back
+ */
+static void free_large(pde_t pde) {
+	if (free_frames((paddr_t) PE_GETADDR(pde), LARGE_PAGE_ORDER))
+		panic("Couldn't free a large page");
+}
+
+/**
+ * @brief Drops a page directory's hold on a shared page table
+ *
+ * @return TRUE if other directories still use the table, in which case the
+ * caller must leave its contents alone, FALSE if the caller now owns it
+ */
+static boolean_t release_page_table(pde_t pde) {
+	if (!PE_GETFLAG(pde, PDE_COPYONWRITE)) return FALSE;
+
+	mutex_lock(&pt_refs_lock);
+	uint16_t *refs = &pt_refs[PE_GETADDR(pde) / PAGE_SIZE];
+	boolean_t shared = (*refs > 1);
+	if (shared) (*refs)--;
+	else *refs = 0;
+	mutex_unlock(&pt_refs_lock);
+
+	return shared;
+}
+
+/**
+ * The frames and page tables released by a walk of the page tables, given
+ * back MAP_BATCH at a time under a single acquisition of the lock of the
+ * frame allocator, or of the page table pool.
+ */
+typedef struct {
+	paddr_t		frames[MAP_BATCH];
+	int			num_frames;
+	void		*tables[MAP_BATCH];
+	int			num_tables;
+} free_batch_t;
+
+/**
+ * @brief Gives the frames gathered so far back to the allocator
+ */
+static void flush_frames(free_batch_t *batch) {
+	if (batch->num_frames == 0) return;
+
+	int err = free_frame_batch(batch->frames, batch->num_frames);
+	if (err < 0 && err != ERR_KERNEL_FRAME) {
+		panic("Frame allocator coherence error %d", err);
+	}
+	batch->num_frames = 0;
+}
+
+/**
+ * @brief Gives the page tables gathered so far back to the pool
+ */
+static void flush_tables(free_batch_t *batch) {
+	free_page_table_batch(batch->tables, batch->num_tables);
+	batch->num_tables = 0;
+}
+
+/**
+ * @brief Adds a frame to release to the batch
+ */
+static void batch_frame(free_batch_t *batch, paddr_t frame) {
+	batch->frames[batch->num_frames++] = frame;
+	if (batch->num_frames == MAP_BATCH) flush_frames(batch);
+}
+
+/**
+ * @brief Adds a page table to release to the batch
+ */
+static void batch_table(free_batch_t *batch, void *table) {
+	batch->tables[batch->num_tables++] = table;
+	if (batch->num_tables == MAP_BATCH) flush_tables(batch);
 }
 
 /**
  * @brief Resets the page directory to its initial state
  * 
  * Deletes all user-related page table entries in the paging system of the
- * current process. All kernel pages remain mapped in the page tables.
+ * current process. All kernel pages remain mapped in the page tables. The
+ * frames and page tables are given back MAP_BATCH at a time.
  */
 void reset_paging() {
 	// Get the page directory
@@ -174,15 +493,32 @@ void reset_paging() {
 
 	// Read across all page tables
 	int i, j;
+	free_batch_t batch;
+	batch.num_frames = 0;
+	batch.num_tables = 0;
 	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
 		// If there is no page table attached, our work is done
 		if (!PE_GETFLAG(cr3[i], PDE_PRESENT)) continue;
 
+		// The kernel data pages stay
+		if (PE_GETFLAG(cr3[i], PDE_KERNEL)) continue;
+
+		if (is_large(cr3[i])) {
+			free_large(cr3[i]);
+			cr3[i] = 0;
+			continue;
+		}
+
 		// Get the page table
 		pte_t *pt = (pte_t *) PE_GETADDR(cr3[i]);
 		
 		if (PE_GETFLAG(cr3[i], PDE_USER)) {
 
+			if (release_page_table(cr3[i])) {
+				// Other processes still use the table
+				cr3[i] = 0;
+				continue;
+			}
 
 			for (j = 0; j < PAGE_TABLE_ENTRIES; ++j) {
 				pte_t pte = pt[j];
@@ -191,24 +527,120 @@ void reset_paging() {
 				if (!PE_GETFLAG(pte, PTE_USER)) continue;
 				if (PE_GETFLAG(pte, PTE_ZEROPAGE)) continue;
 
-
-				int err = free_frame((paddr_t) PE_GETADDR(pte));
-				if (err) {
-					lprintf("free frame %lx failed", PE_GETADDR(pte));
-					MAGIC_BREAK;
-				}
+				batch_frame(&batch, (paddr_t) PE_GETADDR(pte));
 				pt[j] = 0;
 			}
-			if (!PE_GETFLAG(cr3[i], PDE_KERNEL)) {
-				cr3[i] = 0;
-				//sfree(pt, PAGE_SIZE);
-			}
+			cr3[i] = 0;
+			batch_table(&batch, pt);
 
 		}
 	}
+	flush_frames(&batch);
+	flush_tables(&batch);
+
+	// The zero pages are gone with the rest
+	process_t *process = get_self()->process;
+	unreserve_frames(process, process->reserved_frames);
+	quota_charge(process, -process->rss_frames);
+	process->rss_frames = 0;
+	process->page_tables = 0;
+
+	// Nearly everything changed, flush the whole TLB
+	tlb_flush_all();
+}
+
+/**
+ * @brief Returns the page table entry for va, creating its page table if
+ * necessary
+ *
+ * A page table shared since a fork is split first, so that the entry can be
+ * modified without affecting other processes, and a large page is replaced
+ * by a page table.
+ * @return the page table entry, or NULL if the page table couldn't be
+ * allocated
+ */
+static pte_t *make_pte(vaddr_t va, pde_t *cr3) {
+	if (own_page_table(va)) return NULL;
+
+	// A large page gets a page table first
+	pde_t *pde = get_pde(va, cr3);
+	if (is_large(*pde) && split_large_page(pde, va)) return NULL;
 
-	// We flush the TLB by setting cr3 to itself
-	set_cr3((uint32_t)cr3);
+	pte_t *pte = get_pte(va, cr3);
+	if (pte != NULL) return pte;
+
+	// The page table has not been created
+	pte_t *pt = alloc_page_table();
+	if (pt == NULL) return NULL;
+
+	// Set flags
+	*pde = PE_SETFLAG(*pde, PDE_PRESENT);
+	*pde = PE_SETFLAG(*pde, PDE_READWRITE);
+	*pde = PE_SETFLAG(*pde, PDE_USER);
+	*pde = PE_SETADDR(*pde, pt);
+
+	process_t *process = current_process();
+	if (process != NULL) atomic_add(&process->page_tables, 1);
+
+	return &pt[PTE_OFFSET(va)];
+}
+
+/**
+ * @brief Sets the access rights of a page table entry according to the type
+ * of memory it maps
+ */
+static void set_type_flags(pte_t *pte, mem_type_t type) {
+	switch (type) {
+		case MEM_TYPE_TEXT:
+		case MEM_TYPE_RODATA:
+			// Read-only types
+			break;
+		case MEM_TYPE_DATA:
+		case MEM_TYPE_HEAP:
+		case MEM_TYPE_STACK:
+		case MEM_TYPE_BSS:
+		case MEM_TYPE_USER:
+			// Read-write types
+			*pte = PE_SETFLAG(*pte, PTE_READWRITE);
+			break;
+		default:
+			assert(FALSE);
+	}
+}
+
+/**
+ * @brief Maps a virtual address to a frame the caller already holds
+ *
+ * The frame is expected to be exclusive to the calling process, typically
+ * fresh out of allocate_frame or allocate_frames. On error the frame is left
+ * untouched and still belongs to the caller.
+ *
+ * @param va the virtual address to map
+ * @param type the type of memory one wants to map
+ * @param frame the frame to map va to
+ * @return 0 if success, and a negative error code othwewise
+ */
+int map_frame(vaddr_t va, mem_type_t type, paddr_t frame) {
+	// Argument check
+	if (va % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+	if (va < USER_MEM_START) return ERR_INVALID_ARG;
+	if (vdso_overlaps(va, 1)) return ERR_INVALID_ARG;
+	if ((uint32_t) frame % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+	if ((uint32_t) frame < USER_MEM_START) return ERR_INVALID_ARG;
+
+	pte_t *pte = make_pte(va, (pde_t *) get_cr3());
+	if (pte == NULL) return ERR_MALLOC_FAIL;
+	if (PE_GETFLAG(*pte, PTE_PRESENT)) return ERR_PAGE_ALREADY_PRESENT;
+
+	// Create the page table entry
+	*pte = PE_SETFLAG(*pte, PTE_PRESENT);
+	*pte = PE_SETFLAG(*pte, PTE_USER);
+	*pte = PE_SETADDR(*pte, frame);
+	set_type_flags(pte, type);
+	frame_set_rmap(frame, va);
+	account_frames(1);
+
+	return 0;
 }
 
 /**
@@ -221,11 +653,13 @@ void reset_paging() {
  * address is directly mapped to the reference frame.
  * - If type is read-write, and a reference frame is specified, the 
  *   virtual
- * address is mapped to the reference frame via copy-on-write
+ * address is mapped to the reference frame via copy-on-write. The mapping
+ * takes over a hold the caller has on the frame (@see get_frame)
  * - If type is BSS, the reference frame is ignored and the virtual 
  *   address is
- * mapped to the zero frame with copy on write (implied by the zero frame 
- * bit)
+ * mapped read-only to the zero frame, and gets its own frame on the first
+ * write (@see prepare_write). The caller must have reserved that frame
+ * beforehand with reserve_frames.
  * - If no reference frame is specified, the virtual address is mapped to 
  *   a
  * newly allocated frame, initialized to zero.
@@ -239,58 +673,30 @@ int create_page(vaddr_t va, mem_type_t type, paddr_t ref_frame) {
 	// Argument check
 	if (va % PAGE_SIZE != 0) return ERR_INVALID_ARG;
 	if (va < USER_MEM_START) return ERR_INVALID_ARG;
+	if (vdso_overlaps(va, 1)) return ERR_INVALID_ARG;
 	if (ref_frame != NULL) {
 		if ((uint32_t) ref_frame % PAGE_SIZE != 0) return ERR_INVALID_ARG;
 		if ((uint32_t) ref_frame < USER_MEM_START) return ERR_INVALID_ARG;
 	}
 
-	// Try to allocate new frame if necessary, to revert errors easily
-	paddr_t new_frame = NULL;
 	if (type != MEM_TYPE_BSS && !ref_frame) {
-		new_frame = allocate_frame();
+		// Setup new frame
+		paddr_t new_frame = allocate_frame();
 		if (new_frame == NULL) {
 			return ERR_NO_FRAMES;
 		}
-	}
 
-	pde_t *cr3 = (pde_t *) get_cr3();
-	pte_t* pte = get_pte(va, cr3);
-	if (pte == NULL) {
-		// The page table has not been created
-
-		pde_t *pde = get_pde(va, cr3);
-		// Create page table
-		pte_t *pt = smemalign(PAGE_SIZE, PAGE_SIZE);
-		if (pt == NULL) {
-			int err = free_frame(new_frame);
-			if (err) {
-				panic("Couldn't free previously allocated copy frame");
-			}
-			return ERR_MALLOC_FAIL;
-		}
-		memset(pt, 0, PAGE_SIZE);
-
-		// Set flags
-		*pde = PE_SETFLAG(*pde, PDE_PRESENT);
-		*pde = PE_SETFLAG(*pde, PDE_READWRITE);
-		*pde = PE_SETFLAG(*pde, PDE_USER);
-		*pde = PE_SETADDR(*pde, pt);
-
-		// Set all entries to 0
-		memset(pt, 0, PAGE_TABLE_ENTRIES);
-		pte = &pt[PTE_OFFSET(va)];
-	} else {
-		// We only need this check if the page table was already 
-		// there
-		if (PE_GETFLAG(*pte, PTE_PRESENT)) {
-			int err = free_frame(new_frame);
-			if (err) {
-				panic("Couldn't free previously allocated copy frame");
-			}
-			return ERR_PAGE_ALREADY_PRESENT;
+		int err = map_frame(va, type, new_frame);
+		if (err && free_frame(new_frame)) {
+			panic("Couldn't free previously allocated copy frame");
 		}
+		return err;
 	}
 
+	pte_t *pte = make_pte(va, (pde_t *) get_cr3());
+	if (pte == NULL) return ERR_MALLOC_FAIL;
+	if (PE_GETFLAG(*pte, PTE_PRESENT)) return ERR_PAGE_ALREADY_PRESENT;
+
 	// Create the page table entry
 	*pte = PE_SETFLAG(*pte, PTE_PRESENT);
 	*pte = PE_SETFLAG(*pte, PTE_USER);
@@ -298,32 +704,15 @@ int create_page(vaddr_t va, mem_type_t type, paddr_t ref_frame) {
 		// Setup zero-fill on demand
 		*pte = PE_SETFLAG(*pte, PTE_ZEROPAGE);
 		*pte = PE_SETADDR(*pte, zero_frame);
-	} else if (ref_frame) {
+	} else {
 		// Setup copy on write
 		*pte = PE_SETFLAG(*pte, PTE_COPYONWRITE);
 		*pte = PE_SETADDR(*pte, ref_frame);
-	} else {
-		// Setup new frame
-		*pte = PE_SETADDR(*pte, new_frame);
-	}
-
-	// Type-specific adjustments
-	switch (type) {
-		case MEM_TYPE_TEXT:
-		case MEM_TYPE_RODATA:
-			// Read-only types
-			break;
-		case MEM_TYPE_DATA:
-		case MEM_TYPE_HEAP:
-		case MEM_TYPE_STACK:
-		case MEM_TYPE_BSS:
-		case MEM_TYPE_USER:
-			// Read-write types
-			*pte = PE_SETFLAG(*pte, PTE_READWRITE);
-			break;
-		default:
-			assert(FALSE);
+		account_frames(1);
 	}
+	set_type_flags(pte, type);
+	// Writes must fault, they would land in the zero or reference frame
+	*pte = PE_UNSETFLAG(*pte, PTE_READWRITE);
 
 	// Page successfuly allocated, we're good
 	return 0;
@@ -332,69 +721,432 @@ int create_page(vaddr_t va, mem_type_t type, paddr_t ref_frame) {
 /**
  * @brief Removes the given page from the process' page table
  * 
- * This functions updates the corresponding page table entry and flushes the
- * TLB to avoid inconsistencies.
+ * This functions updates the corresponding page table entry and invalidates
+ * its TLB entry to avoid inconsistencies.
  * @return 0 on success, negative number on error
  */
 int destroy_page(vaddr_t va) {
-	if (va % PAGE_SIZE != 0) return ERR_INVALID_ARG;
+	return unmap_range(va, 1);
+}
+
+/**
+ * @brief Checks that num_pages pages from va are all in user space
+ */
+boolean_t valid_range(vaddr_t va, int num_pages) {
+	if (va % PAGE_SIZE != 0) return FALSE;
+	if (va < USER_MEM_START) return FALSE;
+	if (num_pages < 0) return FALSE;
+	// The range may end at the very top of the address space
+	if (num_pages > (0 - va) / PAGE_SIZE) return FALSE;
+	return !vdso_overlaps(va, num_pages);
+}
+
+/**
+ * @brief Maps num_pages fresh pages of the given type from va
+ *
+ * The page directory is walked once per page table rather than once per
+ * page, and frames are allocated MAP_BATCH at a time, under a single frame
+ * lock. BSS pages are mapped on the zero frame, with their frames reserved
+ * all at once (@see reserve_frames), except for the 4MB-aligned parts of
+ * the range which get large pages when a block of frames is free (@see
+ * map_large); the other types get zeroed frames of their own. No TLB entry
+ * needs to be invalidated, since the pages weren't present. On error,
+ * nothing stays mapped.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int map_range(vaddr_t va, int num_pages, mem_type_t type) {
+	if (!valid_range(va, num_pages)) return ERR_INVALID_ARG;
+
+	process_t *process = get_self()->process;
+	boolean_t zero = (type == MEM_TYPE_BSS);
+	int err = quota_check(process, num_pages);
+	if (err) return err;
+	if (zero) {
+		err = reserve_frames(process, num_pages);
+		if (err) return err;
+	}
+
+	pde_t *cr3 = (pde_t *) get_cr3();
+	paddr_t batch[MAP_BATCH];
+	int batched = 0, used = 0, zeroed = 0;
+
+	pte_t *pt = NULL;
+	int mapped;
+	for (mapped = 0; mapped < num_pages; ++mapped) {
+		vaddr_t page = va + mapped * PAGE_SIZE;
+
+		// A whole 4MB region may take a single large page
+		if (zero && page % LARGE_PAGE_SIZE == 0
+				&& num_pages - mapped >= PAGE_TABLE_ENTRIES
+				&& map_large(page) == 0) {
+			mapped += PAGE_TABLE_ENTRIES - 1;
+			pt = NULL;
+			continue;
+		}
+
+		// Walk the directory only when entering a new page table
+		if (pt == NULL || PTE_OFFSET(page) == 0) {
+			pte_t *pte = make_pte(page, cr3);
+			if (pte == NULL) {
+				err = ERR_MALLOC_FAIL;
+				break;
+			}
+			pt = pte - PTE_OFFSET(page);
+		}
+
+		pte_t *pte = &pt[PTE_OFFSET(page)];
+		if (PE_GETFLAG(*pte, PTE_PRESENT)) {
+			err = ERR_PAGE_ALREADY_PRESENT;
+			break;
+		}
+
+		pte_t entry = 0;
+		entry = PE_SETFLAG(entry, PTE_PRESENT);
+		entry = PE_SETFLAG(entry, PTE_USER);
+
+		if (zero) {
+			// Read-only on the zero frame until the first write
+			entry = PE_SETFLAG(entry, PTE_ZEROPAGE);
+			*pte = PE_SETADDR(entry, zero_frame);
+			continue;
+		}
+
+		if (used == batched) {
+			// Refill the batch of frames
+			used = 0;
+			batched = num_pages - mapped;
+			if (batched > MAP_BATCH) batched = MAP_BATCH;
+			err = allocate_frame_batch(batch, batched, page, &zeroed);
+			if (err) {
+				batched = 0;
+				break;
+			}
+		}
+
+		// Writable until zeroed, the kernel faults on read-only pages
+		entry = PE_SETADDR(entry, batch[used]);
+		if (used >= zeroed) {
+			*pte = PE_SETFLAG(entry, PTE_READWRITE);
+			zero_page_nt((void *) page);
+			tlb_flush_page(page);
+		}
+		set_type_flags(&entry, type);
+		*pte = entry;
+		used++;
+	}
+	if (!zero) account_frames(mapped);
+
+	if (err) {
+		// Roll back
+		if (free_frame_batch(batch + used, batched - used))
+			panic("Couldn't free unmapped frames");
+		if (unmap_range(va, mapped))
+			panic("Couldn't unmap previously mapped pages");
+		if (zero) unreserve_frames(process, num_pages - mapped);
+	}
+
+	return err;
+}
+
+/**
+ * @brief Maps the frames of a shared memory segment from va
+ *
+ * Every page is writable and marked PTE_SHARED, so that it goes on pointing
+ * to the same frame in all the processes sharing it, even across forks. The
+ * mapping holds each frame once more. On error nothing stays mapped.
+ *
+ * @param va the first page to map
+ * @param frames the frames of the segment
+ * @param num_pages the number of frames
+ * @return 0 on success, a negative error code otherwise
+ */
+int map_shared(vaddr_t va, paddr_t *frames, int num_pages) {
+	if (!valid_range(va, num_pages)) return ERR_INVALID_ARG;
+
+	pde_t *cr3 = (pde_t *) get_cr3();
+	int err = quota_check(get_self()->process, num_pages);
+	if (err) return err;
+
+	int mapped;
+	for (mapped = 0; mapped < num_pages; ++mapped) {
+		vaddr_t page = va + mapped * PAGE_SIZE;
+		pte_t *pte = make_pte(page, cr3);
+		if (pte == NULL) {
+			err = ERR_MALLOC_FAIL;
+			break;
+		}
+		if (PE_GETFLAG(*pte, PTE_PRESENT)) {
+			err = ERR_PAGE_ALREADY_PRESENT;
+			break;
+		}
+		err = get_frame(frames[mapped]);
+		if (err) break;
+
+		pte_t entry = PE_SETADDR(0, frames[mapped]);
+		entry = PE_SETFLAG(entry, PTE_PRESENT);
+		entry = PE_SETFLAG(entry, PTE_USER);
+		entry = PE_SETFLAG(entry, PTE_READWRITE);
+		*pte = PE_SETFLAG(entry, PTE_SHARED);
+	}
+	account_frames(mapped);
+
+	if (err && unmap_range(va, mapped))
+		panic("Couldn't unmap previously mapped shared pages");
+
+	return err;
+}
+
+/**
+ * @brief Removes num_pages pages from va from the process' page table
+ *
+ * The page directory is walked once per page table, the frames are released
+ * MAP_BATCH at a time under a single frame lock, and the TLB is flushed once
+ * for all the pages (@see tlb_batch_t). The function stops at the first page
+ * that can't be removed, the pages before it being removed already.
+ *
+ * @return 0 on success, negative number on error
+ */
+int unmap_range(vaddr_t va, int num_pages) {
+	if (!valid_range(va, num_pages)) return ERR_INVALID_ARG;
 
 	pde_t *cr3 = (pde_t *)get_cr3();
 	if (cr3 == NULL) {
 		panic("No page directory registered for thread %d", get_self()->tid);
 	}
-	pte_t *pte = get_pte(va, cr3);
-	if (pte == NULL) return ERR_DIRECTORY_NOT_PRESENT;
 
-	if (!PE_GETFLAG(*pte, PTE_PRESENT)) return ERR_PAGE_NOT_PRESENT;
-	if (PE_GETFLAG(*pte, PTE_GLOBAL)) return ERR_KERNEL_PAGE;
-	if (!PE_GETFLAG(*pte, PTE_USER)) return ERR_KERNEL_PAGE;
+	tlb_batch_t tlb;
+	tlb_batch_init(&tlb);
+	paddr_t batch[MAP_BATCH];
+	int batched = 0, zero_pages = 0, err = 0;
+
+	pte_t *pt = NULL;
+	int i;
+	for (i = 0; i < num_pages; ++i) {
+		vaddr_t page = va + i * PAGE_SIZE;
+
+		// Walk the directory only when entering a new page table
+		if (pt == NULL || PTE_OFFSET(page) == 0) {
+			pde_t *pde = get_pde(page, cr3);
+			if (is_large(*pde) && PTE_OFFSET(page) == 0
+					&& num_pages - i >= PAGE_TABLE_ENTRIES) {
+				// The whole large page goes
+				pde_t large = *pde;
+				*pde = 0;
+				tlb_flush_page(page);
+				free_large(large);
+				i += PAGE_TABLE_ENTRIES - 1;
+				pt = NULL;
+				continue;
+			}
+			if (is_large(*pde)) {
+				// Part of it goes, the rest stays in 4KB pages
+				err = split_large_page(pde, page);
+				if (err) break;
+			}
+
+			err = own_page_table(page);
+			if (err) break;
+			pte_t *pte = get_pte(page, cr3);
+			if (pte == NULL) {
+				err = ERR_DIRECTORY_NOT_PRESENT;
+				break;
+			}
+			pt = pte - PTE_OFFSET(page);
+		}
+
+		pte_t *pte = &pt[PTE_OFFSET(page)];
+		if (!PE_GETFLAG(*pte, PTE_PRESENT)) {
+			err = ERR_PAGE_NOT_PRESENT;
+			break;
+		}
+		if (PE_GETFLAG(*pte, PTE_GLOBAL) || !PE_GETFLAG(*pte, PTE_USER)) {
+			err = ERR_KERNEL_PAGE;
+			break;
+		}
+
+		if (PE_GETFLAG(*pte, PTE_ZEROPAGE)) {
+			// The page never got a frame, only its reservation goes
+			zero_pages++;
+		} else {
+			if (batched == MAP_BATCH) {
+				// The frames can only be reused once they are out of the TLB
+				tlb_batch_flush(&tlb);
+				if (free_frame_batch(batch, batched))
+					panic("Frame allocator coherence error");
+				batched = 0;
+			}
+			batch[batched++] = (paddr_t) PE_GETADDR(*pte);
+		}
+
+		*pte = 0;
+		tlb_batch_add(&tlb, page);
+	}
+
+	tlb_batch_flush(&tlb);
+	if (free_frame_batch(batch, batched))
+		panic("Frame allocator coherence error");
+	unreserve_frames(get_self()->process, zero_pages);
+	// The pages removed which had a frame
+	account_frames(zero_pages - i);
 
-	paddr_t frame = (paddr_t) PE_GETADDR(*pte);
-	*pte = 0;
-	set_cr3(get_cr3());
+	return err;
+}
 
-	int err = free_frame(frame);
-	if (err) panic("Frame allocator coherence error");
+/**
+ * @brief Makes the given user page privately writable
+ *
+ * A page on the zero frame gets a zeroed frame of its own, out of the
+ * reservations of the process, and a copy-on-write page is copied. Other
+ * pages are left alone. This is what the page fault handler does on a write,
+ * and what the kernel must do before writing to user memory itself. The
+ * caller must own the page table of va (@see own_page_table).
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int prepare_write(vaddr_t va) {
+	pde_t *cr3 = (pde_t *) get_cr3();
+	if (is_large(*get_pde(va, cr3))) return 0;
 
+	pte_t *pte = get_pte(va, cr3);
+	if (pte == NULL || !PE_GETFLAG(*pte, PTE_PRESENT))
+		return ERR_PAGE_NOT_PRESENT;
+
+	if (PE_GETFLAG(*pte, PTE_COPYONWRITE))
+		return copy_on_write(PAGE_ADDR(va));
+	if (!PE_GETFLAG(*pte, PTE_ZEROPAGE)) return 0;
+
+	process_t *process = get_self()->process;
+	boolean_t reserved;
+	paddr_t frame = allocate_reserved_frame(process, &reserved);
+	if (frame == NULL) return ERR_NO_FRAMES;
+
+	mutex_lock(process->cow_lock);
+	if (!PE_GETFLAG(*pte, PTE_ZEROPAGE)) {
+		// Another thread of the process filled the page in the meantime
+		mutex_unlock(process->cow_lock);
+		if (free_frame(frame)) panic("Couldn't free unused zero frame");
+		// Take back the reservation the frame came out of, if any. The page
+		// is writable whether we get it back or not.
+		if (reserved) reserve_frames(process, 1);
+		return 0;
+	}
+	*pte = PE_UNSETFLAG(*pte, PTE_ZEROPAGE);
+	*pte = PE_SETFLAG(*pte, PTE_READWRITE);
+	*pte = PE_SETADDR(*pte, frame);
+	frame_set_rmap(frame, PAGE_ADDR(va));
+	mutex_unlock(process->cow_lock);
+	account_frames(1);
+
+	tlb_flush_page(PAGE_ADDR(va));
 	return 0;
 }
 
+/**
+ * @brief Keeps the error of a fault resolution if it is worth a retry
+ */
+static int fault_error(int kept, int err) {
+	if (err == ERR_NO_FRAMES || err == ERR_MALLOC_FAIL) return err;
+	return kept;
+}
+
+/**
+ * @brief Resolves a page fault at addr, if the kernel knows how
+ *
+ * A page another thread mapped or made writable meanwhile counts as
+ * resolved, the access is then retried.
+ *
+ * @param addr the faulting address
+ * @param code the error code of the fault
+ * @return 0 if the page is now mapped, ERR_NO_FRAMES or ERR_MALLOC_FAIL if
+ * memory ran out on the way, another negative error code otherwise
+ */
+static int resolve_fault(vaddr_t addr, uint32_t code) {
+	pde_t *cr3 = (pde_t *)get_cr3();
+	if (cr3 == NULL) {
+		panic("No page directory registered for thread %d", get_self()->tid);
+	}
+	pte_t *pte = get_pte(addr, cr3);
+	int err, kept = ERR_PAGE_NOT_PRESENT;
+
+	pde_t *pde = get_pde(addr, cr3);
+	if (PE_GETFLAG(*pde, PDE_PRESENT) && PE_GETFLAG(*pde, PDE_COPYONWRITE)) {
+		// The page table is shared since a fork, take a private copy of it
+		err = own_page_table(addr);
+		if (err == 0) return 0;
+		kept = fault_error(kept, err);
+		// The entries of a shared table must not be touched
+		pte = NULL;
+	}
+	
+	if (pte != NULL && (PE_GETFLAG(*pte, PTE_ZEROPAGE)
+			|| PE_GETFLAG(*pte, PTE_COPYONWRITE))) {
+		// A write to the zero page or to a copy-on-write page
+		err = prepare_write(PAGE_ADDR(addr));
+		if (err == 0) return 0;
+		kept = fault_error(kept, err);
+	}
+
+	if (pte != NULL && PE_GETFLAG(*pte, PTE_PRESENT)) {
+		pte_t entry = *pte;
+		boolean_t allowed = !(code & PF_ERR_USER)
+			|| PE_GETFLAG(entry, PTE_USER);
+		if ((code & PF_ERR_WRITE) && !PE_GETFLAG(entry, PTE_READWRITE))
+			allowed = FALSE;
+		return allowed ? 0 : kept;
+	}
+
+	// It might be the text or rodata of the program, not loaded yet
+	err = image_fault(addr);
+	if (err == 0) return 0;
+	kept = fault_error(kept, err);
+
+	// Or under a stack, or in a region filled on demand
+	err = region_fault(addr);
+	if (err == 0) return 0;
+	return fault_error(kept, err);
+}
+
 /**
  * @brief Handles page faults in the program
  * 
  * When the program encounters a page fault, multiple outcomes are possible:
  * 1. We tried to write to the zero page -> Zero fill
  * 2. We tried to write to a copy-on-write page -> Copy
- * 3. It is a normal page fault, call the user swexn handler or, if there is
+ * 3. We touched the program image for the first time -> Page it in
+ * 4. We went under the mapped pages of a stack region -> Grow it, or
+ * touched a lazy region -> Fill the page in (@see lazy.c)
+ * 5. The kernel faulted while copying from or to user memory -> Resume at
+ * the fixup of the copy, which reports the error (@see usercopy.c)
+ * 6. It is a normal page fault, call the user swexn handler or, if there is
  * none, panic.
+ *
+ * When one of the first four ran out of memory, the thread waits for the
+ * caches to be reclaimed and tries again (@see reclaim.c), before going on
+ * with the others.
+ *
+ * @param trap the error code of the fault, followed by the saved eip
  */
-void _page_fault_handler() {
+void _page_fault_handler(uint32_t *trap) {
 	// The faulting address
 	vaddr_t addr = get_cr2();
 
-	pde_t *cr3 = (pde_t *)get_cr3();
-	if (cr3 == NULL) {
-		panic("No page directory registered for thread %d", get_self()->tid);
-	}
-	pte_t *pte = get_pte(addr, cr3);
-	
-	if (pte != NULL) {
-		// The page table exists, we might be able to do something
-		if (PE_GETFLAG(*pte, PTE_ZEROPAGE)) { // It's the zero page
-			paddr_t frame = allocate_frame();
-			if (frame != NULL) {
-				*pte = PE_UNSETFLAG(*pte, PTE_ZEROPAGE);
-				*pte = PE_SETFLAG(*pte, PTE_READWRITE);
-				*pte = PE_SETADDR(*pte, frame);
-				set_cr3(get_cr3());
-				memset((void*) PAGE_ADDR(addr), 0, PAGE_SIZE);
-				return;
-			}
-		} else if (PE_GETFLAG(*pte, PTE_COPYONWRITE)) {
-			*pte = PE_UNSETFLAG(*pte, PTE_COPYONWRITE);
-			*pte = PE_SETFLAG(*pte, PTE_READWRITE);
-			copy_on_write(PAGE_ADDR(addr));
+	// Resolving the fault of a program is kernel time, @see cputime.c
+	boolean_t user = (trap[0] & PF_ERR_USER) != 0;
+	if (user) cputime_enter();
+
+	int tries = 0;
+	int err = resolve_fault(addr, trap[0]);
+	while (err != 0 && reclaim_stall(err, tries++))
+		err = resolve_fault(addr, trap[0]);
+	if (user) cputime_leave(0);
+	if (err == 0) return;
+
+	if (!(trap[0] & PF_ERR_USER)) {
+		// The kernel touched bad user memory on behalf of a system call
+		uint32_t fixup = usercopy_fixup(trap[1]);
+		if (fixup != 0) {
+			trap[1] = fixup;
 			return;
 		}
 	}
@@ -405,56 +1157,64 @@ void _page_fault_handler() {
 		vaddr_t esp3 = thread->swexn_esp;
 		void *arg = thread->swexn_arg;
 
-		// Setup the stack for the handler
-		if (check_array((void*) esp3,
-				(sizeof(ureg_t) + 3 * sizeof(uint32_t)) / sizeof(void*))) {
-			// Unregister the exception handler
+		// Unregister the exception handler, unless it is persistent
+		if (!thread->swexn_persistent) {
 			thread->swexn_eip = 0x0;
 			thread->swexn_esp = 0x0;
 			thread->swexn_arg = NULL;
-
-			ureg_t *ureg = (ureg_t *) (esp3 - sizeof(ureg_t));
-
-			uint32_t *esp0 = (uint32_t *) thread->esp0;
-
-			// Cause and cr2
-			ureg->cause = SWEXN_CAUSE_PAGEFAULT;
-			ureg->cr2 = addr;
-
-			// Code segments
-			ureg->ds = *(esp0 - 7);
-			ureg->es = *(esp0 - 8);
-			ureg->fs = *(esp0 - 9);
-			ureg->gs = *(esp0 - 10);
-
-			// General purpose registers
-			ureg->eax = *(esp0 - 11);
-			ureg->ecx = *(esp0 - 12);
-			ureg->edx = *(esp0 - 13);
-			ureg->ebx = *(esp0 - 14);
-			ureg->zero = 0;
-			ureg->ebp = *(esp0 - 16);
-			ureg->esi = *(esp0 - 17);
-			ureg->edi = *(esp0 - 18);
-
-			// Special registers
-			ureg->error_code = *(esp0 - 6);
-			ureg->eip = *(esp0 - 5);
-			ureg->cs = *(esp0 - 4);
-			ureg->eflags = *(esp0 - 3);
-			ureg->esp = *(esp0 - 2);
-			ureg->ss = *(esp0 - 1);
-
-			// Setup arguments
-			void **argbase = (void *) 
-				(esp3 - sizeof(ureg_t) - 2 * sizeof(uint32_t));
-			*(argbase - 1) = 0x0;
-			*(argbase) = arg;
-			*(argbase + 1) = ureg;
-
-			// Transfer execution to the handler, coming back to user space
-			launch(eip, (uint32_t) (argbase - 1));
 		}
+
+		/*
+		 * The frame of the handler, as laid out on its stack: a return
+		 * address, the two arguments, and the registers they point to
+		 */
+		struct {
+			uint32_t	ret;
+			void		*arg;
+			ureg_t		*ureg;
+			ureg_t		regs;
+		} frame;
+		vaddr_t base = esp3 - sizeof(frame);
+		ureg_t *ureg = &frame.regs;
+
+		uint32_t *esp0 = (uint32_t *) thread->esp0;
+
+		// Cause and cr2
+		ureg->cause = SWEXN_CAUSE_PAGEFAULT;
+		ureg->cr2 = addr;
+
+		// Code segments
+		ureg->ds = *(esp0 - 7);
+		ureg->es = *(esp0 - 8);
+		ureg->fs = *(esp0 - 9);
+		ureg->gs = *(esp0 - 10);
+
+		// General purpose registers
+		ureg->eax = *(esp0 - 11);
+		ureg->ecx = *(esp0 - 12);
+		ureg->edx = *(esp0 - 13);
+		ureg->ebx = *(esp0 - 14);
+		ureg->zero = 0;
+		ureg->ebp = *(esp0 - 16);
+		ureg->esi = *(esp0 - 17);
+		ureg->edi = *(esp0 - 18);
+
+		// Special registers
+		ureg->error_code = *(esp0 - 6);
+		ureg->eip = *(esp0 - 5);
+		ureg->cs = *(esp0 - 4);
+		ureg->eflags = *(esp0 - 3);
+		ureg->esp = *(esp0 - 2);
+		ureg->ss = *(esp0 - 1);
+
+		// Setup arguments
+		frame.ret = 0x0;
+		frame.arg = arg;
+		frame.ureg = (ureg_t *) (base + 3 * sizeof(uint32_t));
+
+		// Transfer execution to the handler, coming back to user space
+		if (copy_to_user((void *) base, &frame, sizeof(frame)) == 0)
+			launch(eip, base);
 	}
 
 	// Nothing could be done, we lost the thread, :'(
@@ -469,6 +1229,8 @@ void _page_fault_handler() {
  */
 pte_t *get_pte(vaddr_t va, pde_t *cr3) {
 	pde_t *pde = get_pde(va, cr3);
+	// A 4MB page has no page table
+	if (PE_GETFLAG((uint32_t) *pde, PDE_PAGESIZE)) return NULL;
 	if (PE_GETFLAG((uint32_t) *pde, PDE_PRESENT)) {
 		return &((pte_t *)PE_GETADDR(*pde))[PTE_OFFSET(va)];
 	}
@@ -487,18 +1249,12 @@ pde_t *get_pde(vaddr_t va, pde_t *cr3) {
  * @brief Copies the memory regions of a process to another
  *
  * This method is called by the copy_process() function which is used by
- * the fork system call. The idea is pretty simple : we simply fill in
- * the page tables with the same entries as the old page tables, but with
- * the COPYONWRITE flag on both the parent and the child.
- * 
- * Note on errors: when one occurs after some of the child's page tables have
- * been allocated, the function's caller has to destroy the paging system for
- * the child, but not to touch the one of the parent, even though some copy on
- * write flags have been set. This is to avoid a costly manipulation, and this
- * doesn't induce corectness flaws in the kernel. As the frame count will
- * still be consistent, the next access on the parent's page, if any, will
- * simply remove the copy on write flag if the process was the sole holder of
- * the frame.
+ * the fork system call. The child's page directory simply points to the
+ * parent's page tables. Both directory entries are made read-only and flagged
+ * with PDE_COPYONWRITE, so that the first write to a 4MB region, from either
+ * side, splits its page table (see split_page_table). The cost of a fork
+ * therefore only depends on the number of page tables, and the regions the
+ * child never touches before exec are never copied.
  *
  * @param parent the task whose memory regions we copy
  * @param child the task we copy the memory to
@@ -514,9 +1270,19 @@ int copy_paging(process_t *parent, process_t *child) {
 	pde_t *pcr3 = parent->cr3;
 	pde_t *ccr3 = child->cr3; 
 
+	// The child is charged for all the frames of the parent
+	int err = quota_check(child,
+			parent->rss_frames + parent->reserved_frames);
+	if (err) return err;
+
+	// The child inherits the zero pages, and needs frames for them too
+	err = reserve_frames(child, parent->reserved_frames);
+	if (err) return err;
+
+	mutex_lock(&pt_refs_lock);
+
 	// Iterate over the page directory
 	int pd_index = 0;
-	int pt_index = 0;
 	for (pd_index = 0; pd_index < PAGE_TABLE_ENTRIES; pd_index++) {
 
 		// Check if we have a page table for that entry
@@ -525,102 +1291,45 @@ int copy_paging(process_t *parent, process_t *child) {
 		// Check if the page is for the user space
 		if (!PE_GETFLAG(pcr3[pd_index], PDE_USER)) continue;
 
-		// If there is a page table we get it
-		pte_t *pt = (pte_t *) PE_GETADDR(pcr3[pd_index]);
-		
-		// Then we create a page table for the child
-		pte_t *ptc = smemalign(PAGE_SIZE, PAGE_SIZE);
-		if (ptc == NULL) {
-			// The parent will destroy the paging
-			return ERR_MALLOC_FAIL;
-		}
-		memset(ptc, 0, PAGE_SIZE);
-		
-		// Set our page directory entry to present
-		ccr3[pd_index] = PE_SETFLAG(ccr3[pd_index], PDE_PRESENT);
-		ccr3[pd_index] = PE_SETFLAG(ccr3[pd_index], PDE_READWRITE);
-		ccr3[pd_index] = PE_SETFLAG(ccr3[pd_index], PDE_USER);
-
-		// And point the pde to the new page table
-		ccr3[pd_index] = PE_SETADDR(ccr3[pd_index], ptc);
-	
-		// Iterate over all pages in that page table
-		for (pt_index = 0; pt_index < PAGE_TABLE_ENTRIES;
-				pt_index++, pt++, ptc++) {
-
-			if (!PE_GETFLAG(*pt, PTE_PRESENT)) continue;
-			if (!PE_GETFLAG(*pt, PTE_USER)) continue;
+		// The child has kernel data pages of its own
+		if (PE_GETFLAG(pcr3[pd_index], PDE_KERNEL)) continue;
 
-			*ptc = *pt;
-	
-			/**
-			 * Increment the number of pages linked to that 
-			 * given frame. This will then be used by the copy
-			 * on write mecanism to determine if a personal 
-			 * copy of the frame is really necessary or if 
-			 * every other thread has already copied it.
-			 */
-			paddr_t frame = (paddr_t) PE_GETADDR(*ptc);
-			int err = get_frame(frame);
-
-			if (err == ERR_KERNEL_FRAME) continue; 
-			if (err == 0) {
-				/**
-				 * We set the flag of both the parent and 
-				 * child to copy on write so that the 
-				 * first thread to write to that page gets 
-				 * a personal copy of the frame.
-				 */
-				if (PE_GETFLAG(*pt, PTE_READWRITE)) {
-					// Only if the page is not read-only
-					*ptc = PE_SETFLAG(*ptc, PTE_COPYONWRITE);
-					*ptc = PE_UNSETFLAG(*ptc, PTE_READWRITE);
-					*pt = PE_SETFLAG(*pt, PTE_COPYONWRITE);
-					*pt = PE_UNSETFLAG(*pt, PTE_READWRITE);
-				}
-				continue;
-			} else if (err == ERR_TOO_MANY_FRAME_OWNERS) {	
-				/**
-				 * If we couldn't get that frame because it has 
-				 * too many owners already we need to create a 
-				 * seperate frame.
-				 */
-				paddr_t pa = allocate_frame();
-				if (pa) {
-					*ptc = PE_SETADDR(*ptc, pa);
-					*ptc = PE_SETFLAG(*ptc, PTE_PRESENT);
-					*ptc = PE_SETFLAG(*ptc, PTE_READWRITE);
-					*ptc = PE_SETFLAG(*ptc, PTE_USER);
-					*ptc = PE_UNSETFLAG(*ptc, PTE_COPYONWRITE);
-					/**
-					 * Now we need to copy the old frame into 
-					 * the onw we just allocated.
-					 *
-					 * Note that we have the cr3 of the 
-					 * parent.
-					 */
-					vaddr_t va = pd_index << 22;  	
-					va += (pt_index & 0x3FF) << 12;
-
-					mutex_lock(&frame_buffer_lock);
-					memcpy(frame_buffer, (void*)va, PAGE_SIZE);
-					*pt = PE_SETADDR(*pt, pa);
-					memcpy((void*)va, frame_buffer, PAGE_SIZE);
-					mutex_unlock(&frame_buffer_lock);
-
-					// Restore the parents frame
-					*pt = PE_SETADDR(*pt, frame);	
-				}
-			} else {
-				// We are out of luck, everything failed !
-				destroy_paging(child);
+		// Large pages are shared as page tables, at 4KB granularity
+		if (is_large(pcr3[pd_index])) {
+			err = split_large_page(&pcr3[pd_index],
+				pd_index * LARGE_PAGE_SIZE);
+			if (err) {
+				mutex_unlock(&pt_refs_lock);
 				return err;
 			}
 		}
+
+		// Account for one more directory on the page table
+		uint16_t *refs = &pt_refs[PE_GETADDR(pcr3[pd_index]) / PAGE_SIZE];
+		if (!PE_GETFLAG(pcr3[pd_index], PDE_COPYONWRITE)) *refs = 1;
+		if (*refs == (uint16_t) -1) {
+			// The parent will destroy the paging
+			mutex_unlock(&pt_refs_lock);
+			return ERR_TOO_MANY_FRAME_OWNERS;
+		}
+		(*refs)++;
+
+		// Share the page table, read-only
+		pcr3[pd_index] = PE_SETFLAG(pcr3[pd_index], PDE_COPYONWRITE);
+		pcr3[pd_index] = PE_UNSETFLAG(pcr3[pd_index], PDE_READWRITE);
+		ccr3[pd_index] = pcr3[pd_index];
 	}
 
-	// Flush the TLB
-	set_cr3(get_cr3());
+	mutex_unlock(&pt_refs_lock);
+
+	// The child maps all the frames of the parent, through the same tables
+	child->rss_frames = parent->rss_frames;
+	child->peak_frames = parent->rss_frames;
+	child->page_tables = parent->page_tables;
+	quota_charge(child, child->rss_frames);
+
+	// All the user mappings of the parent just became read-only
+	tlb_flush_all();
 
 	return 0;
 }
@@ -628,6 +1337,8 @@ int copy_paging(process_t *parent, process_t *child) {
 /**
  * @brief Destroys all page tables and the page directory of a process
  *
+ * The frames and page tables are given back MAP_BATCH at a time.
+ *
  * @param process the process whose pages to destroy
  * @return 0 on sucess, a negative error code otherwise
  */
@@ -637,11 +1348,29 @@ int destroy_paging(process_t *process) {
 	int pd_index = 0;
 	int pt_index = 0;
 	pde_t *cr3 = process->cr3;
+	free_batch_t batch;
+	batch.num_frames = 0;
+	batch.num_tables = 0;
+	unreserve_frames(process, process->reserved_frames);
+	quota_charge(process, -process->rss_frames);
+	process->rss_frames = 0;
+	vdso_destroy(process);
 	for (pd_index = 0; pd_index < PAGE_TABLE_ENTRIES; pd_index++) {
 	
 		// Check if we have a page table for that entry
 		if (!PE_GETFLAG(cr3[pd_index], PDE_PRESENT)) continue;
+
+		// The kernel map is shared by everybody
+		if (PE_GETFLAG(cr3[pd_index], PDE_KERNEL)) continue;
+
+		if (is_large(cr3[pd_index])) {
+			free_large(cr3[pd_index]);
+			continue;
+		}
 	
+		// Other processes still use the table, leave it to them
+		if (release_page_table(cr3[pd_index])) continue;
+
 		// If there is a page table we get it
 		pte_t *pt = (pte_t *) PE_GETADDR(cr3[pd_index]);
 
@@ -654,20 +1383,343 @@ int destroy_paging(process_t *process) {
 			if (PE_GETFLAG(*pt, PTE_GLOBAL)) continue;
 			if (!PE_GETFLAG(*pt, PTE_USER)) continue;
 
-			// Free the frame
-			paddr_t frame = (paddr_t) PE_GETADDR(*pt);
+			// Free the frame, along with the next ones
+			batch_frame(&batch, (paddr_t) PE_GETADDR(*pt));
 			*pt = 0;
-			int err = free_frame(frame);
-			if (err < 0 && err != ERR_KERNEL_FRAME) {
-				panic("Frame allocator coherence error %d", err);			
-			}
 		}
 
 		// Now free the page table
-		sfree((void *)PE_GETADDR(cr3[pd_index]), PAGE_SIZE);
+		batch_table(&batch, (void *) PE_GETADDR(cr3[pd_index]));
 	}
 
+	flush_frames(&batch);
+	flush_tables(&batch);
+
 	// Finally free the page directory
-	sfree((void *)cr3, PAGE_SIZE);
+	free_page_table(cr3);
+	return 0;
+}
+
+/**
+ * @brief Fills the memory statistics of the calling process
+ *
+ * The pages mapped to a frame and the page tables are counted as they come
+ * and go, but whether a frame is shared changes behind the back of the
+ * process, when the other process holding it copies it away or exits. So
+ * telling the shared frames from the private ones takes a walk of the page
+ * tables. The working set comes from the last samples of the working-set
+ * scanner (@see wss.c).
+ */
+void paging_stats(memstat_t *stat) {
+	process_t *process = get_self()->process;
+	pde_t *cr3 = process->cr3;
+
+	memset(stat, 0, sizeof(memstat_t));
+	stat->rss = process->rss_frames;
+	stat->peak_rss = process->peak_frames;
+	stat->zero = process->reserved_frames;
+	stat->page_tables = process->page_tables;
+	if (process->quota != NULL) {
+		stat->limit = process->quota->limit;
+		stat->charged = process->quota->charged;
+	}
+
+	int i, j;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+		if (!PE_GETFLAG(cr3[i], PDE_PRESENT)) continue;
+		if (!PE_GETFLAG(cr3[i], PDE_USER)) continue;
+		if (PE_GETFLAG(cr3[i], PDE_KERNEL)) continue;
+
+		// The frames of a large page are private, it is split at fork
+		if (is_large(cr3[i])) continue;
+
+		// All the frames of a table shared since a fork are shared too
+		boolean_t shared_table = PE_GETFLAG(cr3[i], PDE_COPYONWRITE);
+		if (shared_table) stat->shared_page_tables++;
+
+		pte_t *pt = (pte_t *) PE_GETADDR(cr3[i]);
+		for (j = 0; j < PAGE_TABLE_ENTRIES; ++j) {
+			pte_t pte = pt[j];
+			if (!PE_GETFLAG(pte, PTE_PRESENT)) continue;
+			if (!PE_GETFLAG(pte, PTE_USER)) continue;
+			if (PE_GETFLAG(pte, PTE_ZEROPAGE)) continue;
+
+			int flags = frame_flags((paddr_t) PE_GETADDR(pte));
+			if (flags < 0) continue;
+			if (shared_table || (flags & FRAME_SHARED)) stat->shared++;
+		}
+	}
+
+	// The walk races with the other threads of the process
+	if (stat->shared > stat->rss) stat->shared = stat->rss;
+	stat->private = stat->rss - stat->shared;
+
+	wss_stats(process, stat);
+}
+
+/**
+ * @brief Returns the entry of va in the page tables of a process, if the
+ * page table is private to it and the entry maps frame
+ *
+ * The caller holds pt_refs_lock, so that the table can't become shared.
+ */
+static pte_t *private_pte(process_t *process, vaddr_t va, paddr_t frame) {
+	pde_t pde = *get_pde(va, process->cr3);
+	if (!PE_GETFLAG(pde, PDE_PRESENT) || !PE_GETFLAG(pde, PDE_USER))
+		return NULL;
+	if (PE_GETFLAG(pde, PDE_KERNEL) || PE_GETFLAG(pde, PDE_COPYONWRITE))
+		return NULL;
+
+	pte_t *pte = get_pte(va, process->cr3);
+	if (pte == NULL || !PE_GETFLAG(*pte, PTE_PRESENT)) return NULL;
+	if (PE_GETADDR(*pte) != (uint32_t) frame) return NULL;
+	return pte;
+}
+
+/**
+ * @brief Tells whether a page of another process was written to since the
+ * last call, and clears its dirty bit
+ *
+ * The same rules as for protect_page apply.
+ *
+ * @param process the process
+ * @param va the page
+ * @param frame the frame the page is expected to map
+ * @return 1 if the page is dirty, 0 if it isn't, ERR_PAGE_NOT_PRESENT if
+ * the page doesn't map frame anymore or its page table is shared
+ */
+int clean_page(process_t *process, vaddr_t va, paddr_t frame) {
+	mutex_lock(&pt_refs_lock);
+	pte_t *pte = private_pte(process, va, frame);
+	if (pte == NULL) {
+		mutex_unlock(&pt_refs_lock);
+		return ERR_PAGE_NOT_PRESENT;
+	}
+	int dirty = PE_GETFLAG(*pte, PTE_DIRTY);
+	*pte = PE_UNSETFLAG(*pte, PTE_DIRTY);
+	mutex_unlock(&pt_refs_lock);
+	return dirty;
+}
+
+/**
+ * @brief Makes a page of another process copy on write
+ *
+ * This is for the same-page merging scanner (@see ksm.c), which must hold
+ * the cow_lock and region_lock of the process and keep it from running
+ * while its entries change: they are not flushed from any TLB here.
+ *
+ * @param process the process
+ * @param va the page
+ * @param frame the frame the page is expected to map
+ * @return 0 on success, ERR_PAGE_NOT_PRESENT if the page doesn't map frame
+ * anymore or its page table is shared
+ */
+int protect_page(process_t *process, vaddr_t va, paddr_t frame) {
+	mutex_lock(&pt_refs_lock);
+	pte_t *pte = private_pte(process, va, frame);
+	if (pte == NULL) {
+		mutex_unlock(&pt_refs_lock);
+		return ERR_PAGE_NOT_PRESENT;
+	}
+	*pte = PE_SETFLAG(*pte, PTE_COPYONWRITE);
+	*pte = PE_UNSETFLAG(*pte, PTE_READWRITE);
+	mutex_unlock(&pt_refs_lock);
+	return 0;
+}
+
+/**
+ * @brief Points a copy-on-write page of another process to a frame holding
+ * the same bytes
+ *
+ * The same rules as for protect_page apply. The page takes a hold on
+ * new_frame and drops its hold on frame.
+ *
+ * @param process the process
+ * @param va the page, made copy on write by protect_page
+ * @param frame the frame the page is expected to map
+ * @param new_frame the frame which replaces it
+ * @return 0 on success, a negative error code otherwise
+ */
+int remap_page(process_t *process, vaddr_t va, paddr_t frame,
+		paddr_t new_frame) {
+	mutex_lock(&pt_refs_lock);
+	pte_t *pte = private_pte(process, va, frame);
+	if (pte == NULL || !PE_GETFLAG(*pte, PTE_COPYONWRITE)) {
+		mutex_unlock(&pt_refs_lock);
+		return ERR_PAGE_NOT_PRESENT;
+	}
+
+	int err = get_frame(new_frame);
+	if (err) {
+		mutex_unlock(&pt_refs_lock);
+		return err;
+	}
+	*pte = PE_SETADDR(*pte, new_frame);
+	mutex_unlock(&pt_refs_lock);
+
+	if (free_frame(frame)) panic("Couldn't release a merged frame");
+	return 0;
+}
+
+/**
+ * @brief Tells which pages of a 4MB region of another process were touched
+ * since the last call, and clears their accessed bits
+ *
+ * This is for the working-set scanner (@see wss.c), which runs on the CPU
+ * of the process and keeps it from running meanwhile, like the same-page
+ * merging scanner: the entries are not flushed from any TLB here, the
+ * process reloads its directory when it runs again. The hardware sets the
+ * bits behind our back, so they are cleared atomically.
+ *
+ * @param process the process
+ * @param base the first page of the region
+ * @param pages the SAMPLE_* flags of each page of the region, 0 if it holds
+ * no frame of its own
+ * @return 0 on success, ERR_PAGE_NOT_PRESENT if the region has no page
+ * table, a large page or a table shared since a fork
+ */
+int sample_region(process_t *process, vaddr_t base, uint8_t *pages) {
+	mutex_lock(&pt_refs_lock);
+	pde_t pde = *get_pde(base, process->cr3);
+	if (!PE_GETFLAG(pde, PDE_PRESENT) || !PE_GETFLAG(pde, PDE_USER)
+			|| PE_GETFLAG(pde, PDE_KERNEL) || PE_GETFLAG(pde, PDE_PAGESIZE)
+			|| PE_GETFLAG(pde, PDE_COPYONWRITE)) {
+		mutex_unlock(&pt_refs_lock);
+		return ERR_PAGE_NOT_PRESENT;
+	}
+
+	pte_t *pt = (pte_t *) PE_GETADDR(pde);
+	int i;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+		pte_t pte = pt[i];
+		if (!PE_GETFLAG(pte, PTE_PRESENT) || !PE_GETFLAG(pte, PTE_USER)
+				|| PE_GETFLAG(pte, PTE_ZEROPAGE)) {
+			pages[i] = 0;
+			continue;
+		}
+
+		uint8_t flags = SAMPLE_PRESENT;
+		if (PE_GETFLAG(pte, PTE_ACCESSED)) {
+			flags |= SAMPLE_ACCESSED;
+			pte = __sync_fetch_and_and(&pt[i], ~PTE_ACCESSED);
+		}
+		if (PE_GETFLAG(pte, PTE_DIRTY)) flags |= SAMPLE_DIRTY;
+		if (PE_GETFLAG(pte, PTE_COPYONWRITE)) flags |= SAMPLE_COW;
+		pages[i] = flags;
+	}
+	mutex_unlock(&pt_refs_lock);
+	return 0;
+}
+
+/**
+ * @brief Returns the entry of a page of the current address space that can
+ * be lent or replaced, NULL if there is none
+ *
+ * Only the private pages a program may write to qualify: a shared memory
+ * page must go on being shared, a zero page has no frame of its own yet, and
+ * a read-only page must not become writable through a copy.
+ */
+static pte_t *flippable_pte(vaddr_t va) {
+	if (va % PAGE_SIZE != 0 || va < USER_MEM_START) return NULL;
+	if (vdso_overlaps(va, 1) || own_page_table(va)) return NULL;
+
+	pde_t *cr3 = (pde_t *) get_cr3();
+	if (is_large(*get_pde(va, cr3))) return NULL;
+
+	pte_t *pte = get_pte(va, cr3);
+	if (pte == NULL || !PE_GETFLAG(*pte, PTE_PRESENT)) return NULL;
+	if (PE_GETFLAG(*pte, PTE_SHARED) || PE_GETFLAG(*pte, PTE_ZEROPAGE))
+		return NULL;
+	if (!PE_GETFLAG(*pte, PTE_READWRITE)
+			&& !PE_GETFLAG(*pte, PTE_COPYONWRITE))
+		return NULL;
+	return pte;
+}
+
+/**
+ * @brief Lends the frame of a page of the current address space, for it to
+ * be mapped in another one (@see pipe.c)
+ *
+ * The page becomes copy on write, like after a fork: the frame keeps the
+ * bytes it holds now, whatever the process writes next. The caller holds the
+ * region lock of the process.
+ *
+ * @param va the page
+ * @param frame placeholder for the frame, of which the caller gets a hold
+ * @return 0 on success, ERR_PAGE_NOT_PRESENT if the page can't be lent
+ */
+int lend_page(vaddr_t va, paddr_t *frame) {
+	pte_t *pte = flippable_pte(va);
+	if (pte == NULL) return ERR_PAGE_NOT_PRESENT;
+
+	process_t *process = current_process();
+	mutex_lock(process->cow_lock);
+	*frame = (paddr_t) PE_GETADDR(*pte);
+	int err = get_frame(*frame);
+	if (err == 0 && !PE_GETFLAG(*pte, PTE_COPYONWRITE)) {
+		*pte = PE_SETFLAG(*pte, PTE_COPYONWRITE);
+		*pte = PE_UNSETFLAG(*pte, PTE_READWRITE);
+		tlb_flush_page(va);
+	}
+	mutex_unlock(process->cow_lock);
+	return err;
+}
+
+/**
+ * @brief Points a page of the current address space to a lent frame, copy
+ * on write
+ *
+ * The page must be one lend_page would lend. It takes over the hold of the
+ * caller on frame and drops its hold on its own frame, so the process maps
+ * as many frames as before. The caller holds the region lock of the process.
+ *
+ * @param va the page
+ * @param frame the frame, holding the bytes the page should read
+ * @return 0 on success, ERR_PAGE_NOT_PRESENT if the page can't be replaced,
+ * in which case the caller keeps its hold on frame
+ */
+int adopt_page(vaddr_t va, paddr_t frame) {
+	pte_t *pte = flippable_pte(va);
+	if (pte == NULL) return ERR_PAGE_NOT_PRESENT;
+
+	process_t *process = current_process();
+	mutex_lock(process->cow_lock);
+	paddr_t old = (paddr_t) PE_GETADDR(*pte);
+	*pte = PE_SETADDR(*pte, frame);
+	*pte = PE_SETFLAG(*pte, PTE_COPYONWRITE);
+	*pte = PE_UNSETFLAG(*pte, PTE_READWRITE);
+	tlb_flush_page(va);
+	mutex_unlock(process->cow_lock);
+
+	if (free_frame(old)) panic("Couldn't release a replaced frame");
+	return 0;
+}
+
+/**
+ * @brief Maps a page of the kernel image to the registers of a device,
+ * uncached
+ *
+ * The page must lie in the first 4MB, whose page table every page directory
+ * shares, so that the mapping holds in all the address spaces at once. The
+ * frame of the page is lost to the kernel.
+ *
+ * @param va the page, in the kernel image
+ * @param pa the physical address of the registers, page-aligned
+ * @return 0 on success, ERR_INVALID_ARG if va isn't such a page
+ */
+int map_device_page(vaddr_t va, paddr_t pa) {
+	if (va % PAGE_SIZE != 0 || va >= KERNEL_SMALL_PAGES_END)
+		return ERR_INVALID_ARG;
+
+	pte_t pte = 0;
+	pte = PE_SETFLAG(pte, PTE_PRESENT);
+	pte = PE_SETFLAG(pte, PTE_READWRITE);
+	pte = PE_SETFLAG(pte, PTE_GLOBAL);
+	pte = PE_SETFLAG(pte, PTE_NOCACHE);
+	pte = PE_SETFLAG(pte, PTE_WRITETHROUGH);
+
+	pte_t *pt = (pte_t *) PE_GETADDR(kernel_pdes[0]);
+	pt[PTE_OFFSET(va)] = PE_SETADDR(pte, pa);
+	tlb_flush_page(va);
 	return 0;
 }
@@ -0,0 +1,84 @@
+/**
+ * @file pageops.c
+ * @brief Copying and zeroing whole pages
+ *
+ * zero_page and copy_page use rep stosl and rep movsl, which the CPU runs
+ * a cache line at a time rather than a word at a time. The page ends up in
+ * the cache, which is what we want when it is about to be used: the page
+ * copied on write, the frame of a page faulted in.
+ *
+ * zero_page_nt is for the pages nobody touches soon, the frames zeroed
+ * ahead of time and the ranges mapped in bulk. It writes with movnti,
+ * whose stores bypass the cache instead of evicting what the CPU works on,
+ * and ends with an sfence so that the page is in memory once it returns.
+ * movnti stores general purpose registers, so the kernel doesn't touch the
+ * FPU or SSE state of the threads (@see fpu.c). Without SSE2, checked once
+ * by pageops_init, it falls back to zero_page. Every page copied is used
+ * right away, so copies always go through the cache.
+ *
+ * All of them expect page-aligned pages of PAGE_SIZE bytes.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdint.h>
+#include <x86/page.h>
+#include <pageops.h>
+
+/* Whether the CPU has movnti, FALSE until checked */
+static boolean_t have_movnti = FALSE;
+
+/**
+ * @brief Checks for the instructions of the non-temporal variant
+ */
+void pageops_init(void) {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	have_movnti = (edx & CPUID_SSE2) != 0;
+}
+
+/**
+ * @brief Fills a page with zeros
+ */
+void zero_page(void *page) {
+	uint32_t count = PAGE_SIZE / sizeof(uint32_t);
+	asm volatile ("cld; rep stosl"
+		: "+D" (page), "+c" (count)
+		: "a" (0)
+		: "memory");
+}
+
+/**
+ * @brief Copies a page to another
+ */
+void copy_page(void *dst, const void *src) {
+	uint32_t count = PAGE_SIZE / sizeof(uint32_t);
+	asm volatile ("cld; rep movsl"
+		: "+D" (dst), "+S" (src), "+c" (count)
+		:
+		: "memory");
+}
+
+/**
+ * @brief Fills a page with zeros, around the cache
+ */
+void zero_page_nt(void *page) {
+	if (!have_movnti) {
+		zero_page(page);
+		return;
+	}
+
+	uint32_t *word = page;
+	uint32_t *end = word + PAGE_SIZE / sizeof(uint32_t);
+	uint32_t zero = 0;
+	for (; word < end; word += 4) {
+		asm volatile (
+			"movnti %1, (%0)\n\t"
+			"movnti %1, 4(%0)\n\t"
+			"movnti %1, 8(%0)\n\t"
+			"movnti %1, 12(%0)"
+			: : "r" (word), "r" (zero) : "memory");
+	}
+	asm volatile ("sfence" : : : "memory");
+}
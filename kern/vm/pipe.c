@@ -0,0 +1,512 @@
+/**
+ * @file pipe.c
+ * @brief Pipes, which move whole pages without copying them
+ *
+ * A pipe is a stream of bytes, from the threads writing to it to the
+ * threads reading from it. What is written goes one of two ways:
+ * - The bytes of a write that don't make up a whole page of the writer go
+ *   through the ring of the pipe, like a print goes through the console
+ *   ring (@see conring.c).
+ * - A whole page of the writer, page-aligned and writable, is not copied.
+ *   Its frame is lent to the pipe and the page becomes copy on write, as
+ *   after a fork (@see lend_page), so that the pipe keeps the bytes written
+ *   whatever the writer does with its page next. A reader reading a whole
+ *   page into a page-aligned page of its own gets the frame mapped there,
+ *   copy on write as well (@see adopt_page), and drops the frame it had.
+ *   Any other read copies from the frame, through a bounce page.
+ *
+ * The ring and the pages are a single stream: each page records the offset
+ * in the stream it was written at, and a reader only takes it once it has
+ * read everything before. Readers block on not_empty until there is
+ * something to read, writers on not_full until there is room. The ring is
+ * filled and emptied outside of the pipe mutex, since copying from or to
+ * user space may fault: the writer mutex, and the reader mutex, let a
+ * single writer and a single reader at a time move head and tail.
+ *
+ * The frames held by a pipe are not charged to any group (@see quota.c),
+ * which is why a pipe holds PIPE_MAX_PAGES of them at most.
+ *
+ * A process holds ends of the pipes, counted in its pipe_ends by slot: the
+ * creator gets both ends, and a forked child the ends of its parent. Only a
+ * process holding an end of a pipe reads, writes or closes it, and each
+ * pipe_close gives one of its ends back, as does the destruction of the
+ * process for all those it still holds. The first close ends the stream:
+ * further writes fail, and reads return 0 once everything written before is
+ * read. Once no process holds an end anymore, the pipe is destroyed, when no
+ * thread is in it anymore.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <page.h>
+#include <pipe.h>
+#include <lock.h>
+#include <thread.h>
+#include <process.h>
+#include <usercopy.h>
+#include <errors.h>
+
+typedef struct {
+	int id;					// Identifier given to user space, 0 if unused
+	int closes;				// Times it was closed
+	int ends;				// Ends the processes hold, 0 once destroyed
+	int users;				// Threads in pipe_read and pipe_write
+
+	/* The bytes written, from tail to head. Both only grow, and wrap around */
+	char *ring;
+	volatile unsigned int head;
+	volatile unsigned int tail;
+
+	/* The pages written, from page_tail to page_head, which only grow too */
+	paddr_t pages[PIPE_MAX_PAGES];
+	unsigned int page_at[PIPE_MAX_PAGES];	// Offset in the stream of each
+	unsigned int page_head;
+	unsigned int page_tail;
+	unsigned int page_off;	// Bytes of the first page already read
+
+	/* Offsets in the stream of the next byte written and read */
+	unsigned int written;
+	unsigned int read;
+
+	/* The first page as copied out for reads of part of it */
+	char *bounce;
+
+	/* Protects everything above but the ring itself */
+	mutex_t lock;
+	cond_t not_empty;		// Readers wait for bytes
+	cond_t not_full;		// Writers wait for room
+
+	/* Let one thread at a time move head, and tail */
+	mutex_t writer_mutex;
+	mutex_t reader_mutex;
+} pipe_t;
+
+/**
+ * The pipes, looked up by id. A slot is free when its id is 0.
+ */
+static pipe_t pipes[PIPE_MAX];
+/**
+ * Protects the pipes table, the close, end and user counts, and the ends
+ * the processes hold
+ */
+static mutex_t pipes_lock;
+/**
+ * Identifier of the next pipe, never reused
+ */
+static int next_id = 1;
+
+/**
+ * @brief Initializes the pipes table
+ */
+void init_pipes(void) {
+	int i;
+	for (i = 0; i < PIPE_MAX; ++i) {
+		pipe_t *p = &pipes[i];
+		p->id = 0;
+		mutex_init(&p->lock);
+		mutex_init(&p->writer_mutex);
+		mutex_init(&p->reader_mutex);
+		cond_init(&p->not_empty);
+		cond_init(&p->not_full);
+	}
+	mutex_init(&pipes_lock);
+}
+
+/**
+ * @brief Returns the pipe with the given id if the calling process holds
+ * one of its ends, NULL otherwise. The caller holds pipes_lock.
+ */
+static pipe_t *find_pipe(int id) {
+	if (id <= 0) return NULL;
+	process_t *process = get_self()->process;
+	int i;
+	for (i = 0; i < PIPE_MAX; ++i) {
+		if (pipes[i].id == id)
+			return process->pipe_ends[i] > 0 ? &pipes[i] : NULL;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Releases what a pipe holds and frees its slot
+ *
+ * The caller holds pipes_lock, and no thread is in the pipe anymore.
+ */
+static void destroy_pipe(pipe_t *p) {
+	for (; p->page_tail != p->page_head; p->page_tail++) {
+		if (free_frame(p->pages[p->page_tail % PIPE_MAX_PAGES]))
+			kernel_panic("Pipe frame has no owner");
+	}
+	free(p->ring);
+	free(p->bounce);
+	p->id = 0;
+}
+
+/**
+ * @brief Creates a pipe
+ *
+ * @return the id of the pipe, a negative error code otherwise
+ */
+int pipe_create(void) {
+	char *ring = malloc(PIPE_RING_SIZE);
+	char *bounce = malloc(PAGE_SIZE);
+	if (ring == NULL || bounce == NULL) {
+		free(ring);
+		free(bounce);
+		return ERR_MALLOC_FAIL;
+	}
+
+	mutex_lock(&pipes_lock);
+	pipe_t *p = NULL;
+	int i;
+	for (i = 0; i < PIPE_MAX && p == NULL; ++i) {
+		if (pipes[i].id == 0) p = &pipes[i];
+	}
+	if (p == NULL) {
+		mutex_unlock(&pipes_lock);
+		free(ring);
+		free(bounce);
+		return ERR_TOO_MANY_PIPES;
+	}
+
+	p->closes = p->users = 0;
+	p->ends = 2;
+	get_self()->process->pipe_ends[p - pipes] = 2;
+	p->ring = ring;
+	p->bounce = bounce;
+	p->head = p->tail = 0;
+	p->page_head = p->page_tail = p->page_off = 0;
+	p->written = p->read = 0;
+	p->id = next_id++;
+	int id = p->id;
+	mutex_unlock(&pipes_lock);
+
+	return id;
+}
+
+/**
+ * @brief Returns the pipe with the given id and counts the caller in it,
+ * NULL if there is none
+ */
+static pipe_t *pipe_get(int id) {
+	mutex_lock(&pipes_lock);
+	pipe_t *p = find_pipe(id);
+	if (p != NULL) p->users++;
+	mutex_unlock(&pipes_lock);
+	return p;
+}
+
+/**
+ * @brief Counts the caller out of a pipe, and destroys it if it was the last
+ * thread in a pipe nobody holds anymore
+ */
+static void pipe_put(pipe_t *p) {
+	mutex_lock(&pipes_lock);
+	if (--p->users == 0 && p->ends == 0) destroy_pipe(p);
+	mutex_unlock(&pipes_lock);
+}
+
+/**
+ * @brief Gives back ends of a pipe held by a process, ending the stream of
+ * the pipe and destroying it once nobody holds it. The caller holds
+ * pipes_lock.
+ *
+ * @param n the number of ends, which the process holds
+ */
+static void drop_ends(process_t *process, pipe_t *p, int n) {
+	process->pipe_ends[p - pipes] -= n;
+	p->ends -= n;
+
+	mutex_lock(&p->lock);
+	p->closes++;
+	cond_broadcast(&p->not_empty);
+	cond_broadcast(&p->not_full);
+	mutex_unlock(&p->lock);
+
+	if (p->ends == 0 && p->users == 0) destroy_pipe(p);
+}
+
+/**
+ * @brief Closes one end of a pipe held by the calling process, ending its
+ * stream the first time
+ *
+ * @return 0 on success, ERR_NO_PIPE if the process holds no end of such a
+ * pipe
+ */
+int pipe_close(int id) {
+	mutex_lock(&pipes_lock);
+	pipe_t *p = find_pipe(id);
+	if (p == NULL) {
+		mutex_unlock(&pipes_lock);
+		return ERR_NO_PIPE;
+	}
+
+	drop_ends(get_self()->process, p, 1);
+	mutex_unlock(&pipes_lock);
+	return 0;
+}
+
+/**
+ * @brief Gives a forked child the ends of the pipes its parent holds
+ */
+void pipe_fork(process_t *parent, process_t *child) {
+	mutex_lock(&pipes_lock);
+	int i;
+	for (i = 0; i < PIPE_MAX; ++i) {
+		child->pipe_ends[i] = parent->pipe_ends[i];
+		pipes[i].ends += parent->pipe_ends[i];
+	}
+	mutex_unlock(&pipes_lock);
+}
+
+/**
+ * @brief Closes the ends of the pipes a process being destroyed still holds
+ */
+void pipe_exit(process_t *process) {
+	mutex_lock(&pipes_lock);
+	int i;
+	for (i = 0; i < PIPE_MAX; ++i) {
+		if (process->pipe_ends[i] > 0)
+			drop_ends(process, &pipes[i], process->pipe_ends[i]);
+	}
+	mutex_unlock(&pipes_lock);
+}
+
+/**
+ * @brief Appends len bytes of user space to the ring of a pipe
+ *
+ * The caller holds the writer mutex.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+static int write_bytes(pipe_t *p, const char *buf, int len) {
+	int done = 0;
+	while (done < len) {
+		mutex_lock(&p->lock);
+		while (p->head - p->tail == PIPE_RING_SIZE && p->closes == 0)
+			cond_wait(&p->not_full, &p->lock);
+		if (p->closes != 0) {
+			mutex_unlock(&p->lock);
+			return ERR_PIPE_CLOSED;
+		}
+		mutex_unlock(&p->lock);
+
+		// As much as fits, up to the end of the ring
+		unsigned int start = p->head % PIPE_RING_SIZE;
+		int n = PIPE_RING_SIZE - (p->head - p->tail);
+		if (n > len - done) n = len - done;
+		if (start + n > PIPE_RING_SIZE) n = PIPE_RING_SIZE - start;
+		if (copy_from_user(p->ring + start, buf + done, n))
+			return ERR_INVALID_ARG;
+
+		mutex_lock(&p->lock);
+		p->head += n;
+		p->written += n;
+		cond_broadcast(&p->not_empty);
+		mutex_unlock(&p->lock);
+		done += n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Appends a page of the writer to a pipe, without copying it
+ *
+ * The caller holds the writer mutex.
+ *
+ * @param va the page, page-aligned
+ * @return 0 on success, ERR_PAGE_NOT_PRESENT if the page can't be lent and
+ * must be copied, another negative error code otherwise
+ */
+static int write_page(pipe_t *p, vaddr_t va) {
+	process_t *process = get_self()->process;
+	paddr_t frame;
+
+	mutex_lock(process->region_lock);
+	int err = lend_page(va, &frame);
+	mutex_unlock(process->region_lock);
+	if (err) return err;
+
+	mutex_lock(&p->lock);
+	while (p->page_head - p->page_tail == PIPE_MAX_PAGES && p->closes == 0)
+		cond_wait(&p->not_full, &p->lock);
+	if (p->closes != 0) {
+		mutex_unlock(&p->lock);
+		if (free_frame(frame)) kernel_panic("Lent frame incoherence");
+		return ERR_PIPE_CLOSED;
+	}
+
+	unsigned int slot = p->page_head % PIPE_MAX_PAGES;
+	p->pages[slot] = frame;
+	p->page_at[slot] = p->written;
+	p->page_head++;
+	p->written += PAGE_SIZE;
+	cond_broadcast(&p->not_empty);
+	mutex_unlock(&p->lock);
+	return 0;
+}
+
+/**
+ * @brief Writes len bytes of user space to a pipe
+ *
+ * The whole pages of buf are lent to the pipe, the rest is copied into its
+ * ring. The writer blocks until everything is in the pipe.
+ *
+ * @param buf the bytes, in user space and checked by the caller
+ * @return the number of bytes written, a negative error code if none could
+ * be
+ */
+int pipe_write(int id, const char *buf, int len) {
+	pipe_t *p = pipe_get(id);
+	if (p == NULL) return ERR_NO_PIPE;
+
+	mutex_lock(&p->writer_mutex);
+	int done = 0, err = 0;
+	while (done < len && !err) {
+		vaddr_t va = (vaddr_t) (buf + done);
+		if (va % PAGE_SIZE == 0 && len - done >= PAGE_SIZE) {
+			err = write_page(p, va);
+			if (err == 0) {
+				done += PAGE_SIZE;
+				continue;
+			}
+			if (err != ERR_PAGE_NOT_PRESENT) break;
+		}
+
+		// Up to the next page, which may then be lent
+		int n = PAGE_SIZE - va % PAGE_SIZE;
+		if (n > len - done) n = len - done;
+		err = write_bytes(p, buf + done, n);
+		if (err == 0) done += n;
+	}
+	mutex_unlock(&p->writer_mutex);
+
+	pipe_put(p);
+	return (done > 0) ? done : err;
+}
+
+/**
+ * @brief Reads from the first page of a pipe
+ *
+ * The page is mapped at buf if the read takes all of it and buf is one of
+ * the reader's pages that can be replaced, otherwise its bytes are copied.
+ * The caller holds the reader mutex and the pipe mutex, which it gets back.
+ *
+ * @param buf where to read to, in user space
+ * @param len the number of bytes wanted
+ * @return the number of bytes read, a negative error code otherwise
+ */
+static int read_page(pipe_t *p, char *buf, int len) {
+	unsigned int slot = p->page_tail % PIPE_MAX_PAGES;
+	paddr_t frame = p->pages[slot];
+	int n = PAGE_SIZE - p->page_off;
+	if (n > len) n = len;
+
+	if (p->page_off == 0 && n == PAGE_SIZE) {
+		// The whole page, the frame is ours
+		p->page_tail++;
+		p->read += PAGE_SIZE;
+		cond_broadcast(&p->not_full);
+		mutex_unlock(&p->lock);
+
+		process_t *process = get_self()->process;
+		mutex_lock(process->region_lock);
+		int err = adopt_page((vaddr_t) buf, frame);
+		mutex_unlock(process->region_lock);
+
+		if (err) {
+			read_frame(frame, p->bounce);
+			err = copy_to_user(buf, p->bounce, PAGE_SIZE);
+			if (free_frame(frame)) kernel_panic("Pipe frame incoherence");
+		}
+		mutex_lock(&p->lock);
+		return err ? ERR_INVALID_ARG : PAGE_SIZE;
+	}
+
+	// The page stays in the pipe, nobody else takes it out
+	mutex_unlock(&p->lock);
+	if (p->page_off == 0) read_frame(frame, p->bounce);
+	int err = copy_to_user(buf, p->bounce + p->page_off, n);
+	mutex_lock(&p->lock);
+	if (err) return ERR_INVALID_ARG;
+
+	p->read += n;
+	p->page_off += n;
+	if (p->page_off == PAGE_SIZE) {
+		p->page_tail++;
+		p->page_off = 0;
+		cond_broadcast(&p->not_full);
+		if (free_frame(frame)) kernel_panic("Pipe frame incoherence");
+	}
+	return n;
+}
+
+/**
+ * @brief Reads bytes from the ring of a pipe, at most up to the first page
+ *
+ * The caller holds the reader mutex and the pipe mutex, which it gets back.
+ *
+ * @return the number of bytes read, a negative error code otherwise
+ */
+static int read_bytes(pipe_t *p, char *buf, int len) {
+	unsigned int start = p->tail % PIPE_RING_SIZE;
+	unsigned int n = p->head - p->tail;
+	if (p->page_tail != p->page_head) {
+		unsigned int before = p->page_at[p->page_tail % PIPE_MAX_PAGES]
+			- p->read;
+		if (n > before) n = before;
+	}
+	if (n > (unsigned int) len) n = len;
+	if (start + n > PIPE_RING_SIZE) n = PIPE_RING_SIZE - start;
+
+	mutex_unlock(&p->lock);
+	int err = copy_to_user(buf, p->ring + start, n);
+	mutex_lock(&p->lock);
+	if (err) return ERR_INVALID_ARG;
+
+	p->tail += n;
+	p->read += n;
+	cond_broadcast(&p->not_full);
+	return n;
+}
+
+/**
+ * @brief Reads at most len bytes from a pipe into user space
+ *
+ * The reader blocks until there is something to read, then reads as much of
+ * it as it can at once.
+ *
+ * @param buf where to read to, in user space and checked by the caller
+ * @return the number of bytes read, 0 at the end of the stream, a negative
+ * error code if none could be read
+ */
+int pipe_read(int id, char *buf, int len) {
+	pipe_t *p = pipe_get(id);
+	if (p == NULL) return ERR_NO_PIPE;
+
+	mutex_lock(&p->reader_mutex);
+	mutex_lock(&p->lock);
+	while (p->read == p->written && p->closes == 0 && len > 0)
+		cond_wait(&p->not_empty, &p->lock);
+
+	int done = 0, err = 0;
+	while (done < len && p->read != p->written) {
+		boolean_t page = p->page_tail != p->page_head
+			&& p->page_at[p->page_tail % PIPE_MAX_PAGES] + p->page_off
+				== p->read;
+		if (page) err = read_page(p, buf + done, len - done);
+		else err = read_bytes(p, buf + done, len - done);
+		if (err < 0) break;
+		done += err;
+		err = 0;
+	}
+	mutex_unlock(&p->lock);
+	mutex_unlock(&p->reader_mutex);
+
+	pipe_put(p);
+	return (done > 0) ? done : err;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file ptpool.c
+ * @brief A pool of zeroed pages for page tables and page directories
+ *
+ * Page tables come and go with every fork, exec and exit. Rather than going
+ * through the kernel heap, and its lock, for each of them, freed tables are
+ * zeroed and kept in a small pool, from which new tables are taken first.
+ * Only when the pool is empty, or full on a free, is the heap used.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <x86/page.h>
+#include <lock.h>
+#include <ptpool.h>
+#include <pageops.h>
+
+/*
+ * The zeroed tables ready to be handed out
+ */
+static void *pool[PT_POOL_SIZE];
+static int pool_count = 0;
+/*
+ * Usage counters, protected by pool_lock like the pool itself
+ */
+static kstat_ptpool_t stats;
+static mutex_t pool_lock;
+
+/**
+ * @brief Initializes the page table pool, empty
+ */
+void init_pt_pool(void) {
+	memset(&stats, 0, sizeof(kstat_ptpool_t));
+	mutex_init(&pool_lock);
+}
+
+/**
+ * @brief Returns a page-aligned page filled with zeros
+ *
+ * @return the new table, or NULL if memory ran out
+ */
+void *alloc_page_table(void) {
+	mutex_lock(&pool_lock);
+	if (pool_count > 0) {
+		void *table = pool[--pool_count];
+		stats.hits++;
+		mutex_unlock(&pool_lock);
+		return table;
+	}
+	stats.misses++;
+	mutex_unlock(&pool_lock);
+
+	void *table = smemalign(PAGE_SIZE, PAGE_SIZE);
+	if (table != NULL) zero_page(table);
+	return table;
+}
+
+/**
+ * @brief Gives a table obtained from alloc_page_table back
+ *
+ * The table is zeroed now, so that allocations don't have to.
+ */
+void free_page_table(void *table) {
+	if (table == NULL) return;
+
+	zero_page(table);
+
+	mutex_lock(&pool_lock);
+	if (pool_count < PT_POOL_SIZE) {
+		pool[pool_count++] = table;
+		stats.recycled++;
+		mutex_unlock(&pool_lock);
+		return;
+	}
+	stats.released++;
+	mutex_unlock(&pool_lock);
+
+	sfree(table, PAGE_SIZE);
+}
+
+/**
+ * @brief Gives n tables obtained from alloc_page_table back at once
+ *
+ * The tables are zeroed first, and the pool lock is taken once for all of
+ * them. Those which don't fit in the pool go back to the heap.
+ */
+void free_page_table_batch(void **tables, int n) {
+	int i;
+	for (i = 0; i < n; ++i) zero_page(tables[i]);
+
+	mutex_lock(&pool_lock);
+	for (i = 0; i < n && pool_count < PT_POOL_SIZE; ++i) {
+		pool[pool_count++] = tables[i];
+	}
+	stats.recycled += i;
+	stats.released += n - i;
+	mutex_unlock(&pool_lock);
+
+	for (; i < n; ++i) sfree(tables[i], PAGE_SIZE);
+}
+
+/**
+ * @brief Gives every table of the pool back to the heap
+ *
+ * This is called under memory pressure (@see reclaim.c), the heap being
+ * where the next page table comes from when the pool is empty.
+ *
+ * @return the number of tables given back
+ */
+int pt_pool_drain(void) {
+	void *tables[PT_POOL_SIZE];
+
+	mutex_lock(&pool_lock);
+	int i, n = pool_count;
+	for (i = 0; i < n; ++i) tables[i] = pool[i];
+	pool_count = 0;
+	stats.released += n;
+	mutex_unlock(&pool_lock);
+
+	for (i = 0; i < n; ++i) sfree(tables[i], PAGE_SIZE);
+	return n;
+}
+
+/**
+ * @brief Copies the usage counters of the pool, for kstat
+ *
+ * @param out where to copy them
+ * @param reset whether to clear them, all but the tables cached
+ */
+void pt_pool_stats(kstat_ptpool_t *out, boolean_t reset) {
+	mutex_lock(&pool_lock);
+	*out = stats;
+	out->cached = pool_count;
+	if (reset) memset(&stats, 0, sizeof(kstat_ptpool_t));
+	mutex_unlock(&pool_lock);
+}
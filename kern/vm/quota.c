@@ -0,0 +1,136 @@
+/**
+ * @file quota.c
+ * @brief Frame quotas of process groups
+ *
+ * A process holds the frames its pages are mapped to and the frames
+ * reserved for its untouched zero pages (@see vm/page.c). By default
+ * nothing limits them but the memory of the machine, so a runaway process,
+ * or a fork bomb, can take all the frames, after which the copy on write
+ * faults of everybody else fail.
+ *
+ * set_frame_limit puts the calling process in a group of its own, limited
+ * to a number of frames. Its children, and theirs, join the group when they
+ * are created, and a process setting a limit again makes a group nested in
+ * the first one: the frames of a group are charged to all the groups it
+ * sits in, and each of their limits holds. A process leaves its group when
+ * it is destroyed, and a group goes away with its last member.
+ *
+ * Every frame a process holds is charged, including the frames it shares
+ * copy on write since a fork: a fork charges the child for the whole memory
+ * of its parent right away. In return the copy on write faults, which only
+ * replace a frame by a copy, and the zero-fill faults, which consume a
+ * reservation, are never refused. The limit is checked when memory is
+ * asked for, by new_pages, fork, exec, shm_attach and map_file, which fail
+ * cleanly with ERR_FRAME_LIMIT; the text pages of a program paged in on a
+ * fault are charged but can't be refused. The checks don't lock the group,
+ * so processes asking at the same time may go over its limit by what they
+ * asked for.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <errors.h>
+#include <process.h>
+#include <quota.h>
+
+/**
+ * @brief Atomically adds to a counter
+ * @return the new value of the counter
+ */
+static int atomic_add(volatile int *counter, int value) {
+	int old = value;
+	asm volatile ("lock; xaddl %0, %1"
+		: "+r" (old), "+m" (*counter) : : "memory");
+	return old + value;
+}
+
+/**
+ * @brief Drops a reference on a group, destroying it with its last one
+ */
+static void quota_put(quota_t *quota) {
+	while (quota != NULL && atomic_add(&quota->refs, -1) == 0) {
+		quota_t *parent = quota->parent;
+		free(quota);
+		quota = parent;
+	}
+}
+
+/**
+ * @brief Puts a new process in a group, before it maps anything
+ *
+ * @param process the process, in no group yet
+ * @param quota the group, NULL for none
+ */
+void quota_join(process_t *process, quota_t *quota) {
+	if (quota != NULL) atomic_add(&quota->refs, 1);
+	process->quota = quota;
+}
+
+/**
+ * @brief Takes a process being destroyed out of its group, once its frames
+ * are released
+ */
+void quota_leave(process_t *process) {
+	quota_put(process->quota);
+	process->quota = NULL;
+}
+
+/**
+ * @brief Puts a process in a new group limited to a number of frames,
+ * nested in its current one
+ *
+ * The process must have a single thread, so that the frames it holds don't
+ * change while they move to the new group. The limit may be below these
+ * frames, memory is then refused until enough is released.
+ *
+ * @param process the process
+ * @param limit the number of frames of the new group
+ * @return 0 on success, a negative error code otherwise
+ */
+int quota_set(process_t *process, int limit) {
+	if (limit <= 0) return ERR_INVALID_ARG;
+
+	quota_t *quota = malloc(sizeof(quota_t));
+	if (quota == NULL) return ERR_MALLOC_FAIL;
+
+	// The frames of the process are already charged to the outer groups
+	quota->charged = process->rss_frames + process->reserved_frames;
+	quota->limit = limit;
+	quota->refs = 1;
+
+	// The process moves its reference on the old group to the new one
+	quota->parent = process->quota;
+	process->quota = quota;
+
+	return 0;
+}
+
+/**
+ * @brief Charges n more frames to the groups of a process, fewer if n is
+ * negative
+ */
+void quota_charge(process_t *process, int n) {
+	if (process == NULL || n == 0) return;
+
+	quota_t *quota;
+	for (quota = process->quota; quota != NULL; quota = quota->parent)
+		atomic_add(&quota->charged, n);
+}
+
+/**
+ * @brief Tells whether the groups of a process let it hold n more frames
+ *
+ * @return 0 if they all do, ERR_FRAME_LIMIT otherwise
+ */
+int quota_check(process_t *process, int n) {
+	if (process == NULL) return 0;
+
+	quota_t *quota;
+	for (quota = process->quota; quota != NULL; quota = quota->parent) {
+		if (quota->charged + n > quota->limit) return ERR_FRAME_LIMIT;
+	}
+	return 0;
+}
@@ -0,0 +1,279 @@
+/**
+ * @file reclaim.c
+ * @brief Reclaim of the frames held by the caches, under memory pressure
+ *
+ * Much of the memory nobody maps sits in caches: the pool of zeroed frames,
+ * the pool of page tables, the pages of the program images and of the
+ * mapped files, and the stable frames of the same-page merging scanner. All
+ * of them can be rebuilt, so none of them needs to hold a frame a fault is
+ * short of.
+ *
+ * Once the frames available fall under RECLAIM_LOW, the allocator wakes the
+ * reclaimer, a kernel thread which empties the caches until RECLAIM_HIGH
+ * frames are available or there is nothing left to take. The caches are
+ * emptied cheapest first: the pools and the stable frames lose nothing, the
+ * pages of the files and of the images have to be loaded again on their
+ * next fault. Only the frames the caches alone hold are given back, those
+ * some process maps stay.
+ *
+ * A fault that still finds no frame, or no kernel memory for a page table,
+ * doesn't fail right away (@see _page_fault_handler). The faulting thread
+ * reclaims itself, and if nothing could be taken, waits for up to
+ * RECLAIM_STALL_TICKS for frames to be freed, then retries the fault. Only
+ * after RECLAIM_STALL_TRIES of these is the fault left to the swexn handler
+ * of the thread. The threads waiting are linked through their wait_next,
+ * which they don't use while in a fault, and like the counters are
+ * protected by the scheduler lock. Any frame freed wakes them up.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <page.h>
+#include <ptpool.h>
+#include <image.h>
+#include <filemap.h>
+#include <ksm.h>
+#include <errors.h>
+#include <lock.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <kthread.h>
+#include <reclaim.h>
+
+/* The reclaimer, NULL until it runs */
+static thread_t *reclaimer = NULL;
+static boolean_t reclaimer_asleep = FALSE;
+
+/* A kick the reclaimer hasn't started a pass for, @see reclaim_kick */
+static volatile boolean_t reclaim_pending = FALSE;
+
+/* The threads waiting for memory in a fault */
+static thread_t * volatile stallers = NULL;
+
+/* One reclaim at a time, the others wait for it to be done */
+static mutex_t reclaim_lock;
+
+/* Counters, protected by the scheduler lock */
+static kstat_reclaim_t counters;
+
+/**
+ * @brief Initializes the reclaim, before the first fault
+ */
+void init_reclaim(void) {
+	memset(&counters, 0, sizeof(kstat_reclaim_t));
+	mutex_init(&reclaim_lock);
+}
+
+/**
+ * @brief Empties the caches until want frames are available
+ *
+ * @return TRUE if anything at all was given back
+ */
+static boolean_t reclaim(size_t want) {
+	mutex_lock(&reclaim_lock);
+
+	// The pools give back memory, but no frame which wasn't available
+	int drained = drain_zeroed_frames();
+	int tables = pt_pool_drain();
+
+	int reclaimed = ksm_reclaim();
+	if (num_available_frames() < want) reclaimed += filemap_reclaim();
+	if (num_available_frames() < want) reclaimed += image_reclaim();
+
+	mutex_unlock(&reclaim_lock);
+
+	dont_switch_me_out();
+	counters.drained += drained;
+	counters.tables += tables;
+	counters.reclaimed += reclaimed;
+	you_can_switch_me_out_now();
+
+	return drained + tables + reclaimed > 0;
+}
+
+/**
+ * @brief The reclaimer thread
+ *
+ * A kick during a pass is kept pending, so that another pass follows
+ * instead of waiting for the next kick.
+ */
+static void reclaimer_main(void *arg) {
+	thread_t *self = get_self();
+
+	for (;;) {
+		dont_switch_me_out();
+		while (!reclaim_pending && num_available_frames() >= RECLAIM_LOW) {
+			reclaimer_asleep = TRUE;
+			set_blocked(self);
+
+			thread_t *other = get_running();
+			if (other == NULL) other = idle();
+			context_switch(self, other);
+			dont_switch_me_out();
+		}
+		reclaim_pending = FALSE;
+		counters.wakeups++;
+		you_can_switch_me_out_now();
+
+		reclaim(RECLAIM_HIGH);
+		reclaim_notify();
+
+		// What is left is mapped, wait for the next kick
+		dont_switch_me_out();
+		if (reclaim_pending) {
+			you_can_switch_me_out_now();
+			continue;
+		}
+		reclaimer_asleep = TRUE;
+		set_blocked(self);
+
+		thread_t *other = get_running();
+		if (other == NULL) other = idle();
+		context_switch(self, other);
+	}
+}
+
+/**
+ * @brief Creates the reclaimer and makes it runnable
+ *
+ * If the reclaimer can't be created, the faults still reclaim themselves.
+ */
+void reclaim_start(void) {
+	thread_t *thread = kthread_create(reclaimer_main, NULL, -1);
+	if (thread == NULL) return;
+
+	dont_switch_me_out();
+	reclaimer = thread;
+	you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Wakes the reclaimer up, the frames available being low
+ *
+ * If the reclaimer is in a pass, the kick stays pending until it is done.
+ * This may be called from a dont_switch_me_out area.
+ */
+void reclaim_kick(void) {
+	if (reclaimer == NULL || reclaim_pending) return;
+
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
+
+	reclaim_pending = TRUE;
+	if (reclaimer_asleep) {
+		reclaimer_asleep = FALSE;
+		set_runnable(reclaimer);
+	}
+
+	if (!in_area) you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Wakes up the threads waiting for memory, if any
+ *
+ * This is called whenever frames are freed, and may be called from a
+ * dont_switch_me_out area.
+ */
+void reclaim_notify(void) {
+	if (stallers == NULL) return;
+
+	boolean_t in_area = this_cpu()->no_switch;
+	if (!in_area) dont_switch_me_out();
+
+	thread_t *thread = stallers;
+	stallers = NULL;
+	while (thread != NULL) {
+		thread_t *next = thread->wait_next;
+		thread->wait_next = NULL;
+		// Those whose wait is over already are on their way
+		if (thread->state == THR_SLEEPING) set_runnable(thread);
+		thread = next;
+	}
+
+	if (!in_area) you_can_switch_me_out_now();
+}
+
+/**
+ * @brief Takes a thread out of the threads waiting for memory, if it is
+ * still there. We must be in a dont_switch_me_out area.
+ */
+static void unlink_staller(thread_t *thread) {
+	thread_t * volatile *link = &stallers;
+	while (*link != NULL && *link != thread) link = &(*link)->wait_next;
+	if (*link == thread) {
+		*link = thread->wait_next;
+		thread->wait_next = NULL;
+	}
+}
+
+/**
+ * @brief Makes room for a fault which ran out of memory
+ *
+ * The faulting thread reclaims the caches itself, and if they had nothing
+ * left, waits a little for frames to be freed.
+ *
+ * @param err the error of the fault
+ * @param tries the times the fault already waited
+ * @return TRUE if the fault should be retried, FALSE if it fails
+ */
+boolean_t reclaim_stall(int err, int tries) {
+	if (err != ERR_NO_FRAMES && err != ERR_MALLOC_FAIL) return FALSE;
+
+	// A fault in a dont_switch_me_out area can't wait
+	thread_t *self = get_self();
+	if (self == NULL || this_cpu()->no_switch) return FALSE;
+
+	if (tries >= RECLAIM_STALL_TRIES) {
+		dont_switch_me_out();
+		counters.failures++;
+		you_can_switch_me_out_now();
+		return FALSE;
+	}
+
+	dont_switch_me_out();
+	counters.direct++;
+	you_can_switch_me_out_now();
+	if (reclaim(RECLAIM_HIGH)) return TRUE;
+
+	dont_switch_me_out();
+	counters.stalls++;
+	self->wait_next = stallers;
+	stallers = self;
+	if (set_sleeping(self, RECLAIM_STALL_TICKS) < 0) {
+		unlink_staller(self);
+		you_can_switch_me_out_now();
+		return TRUE;
+	}
+
+	thread_t *other = get_running();
+	if (other == NULL) other = idle();
+	context_switch(self, other);
+
+	// Woken by a free, or the wait is over
+	dont_switch_me_out();
+	unlink_staller(self);
+	you_can_switch_me_out_now();
+	return TRUE;
+}
+
+/**
+ * @brief Copies the counters of the reclaim
+ *
+ * @param stats where to copy them
+ * @param reset whether to clear them, all but the frames available
+ */
+void reclaim_stats(kstat_reclaim_t *stats, boolean_t reset) {
+	size_t available = num_available_frames();
+
+	dont_switch_me_out();
+	*stats = counters;
+	if (reset) memset(&counters, 0, sizeof(kstat_reclaim_t));
+	you_can_switch_me_out_now();
+
+	stats->available = available;
+}
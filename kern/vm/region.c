@@ -0,0 +1,168 @@
+/**
+ * @file region.c
+ * @brief The memory regions of a process
+ *
+ * The regions created by new_pages, the shared memory segments attached to
+ * the process and the files it mapped are kept in a table sorted by start
+ * address. Since regions never overlap, this is also sorted by end address,
+ * and finding the region holding an address, or checking whether a range is
+ * free, is a binary search. Regions can be of any length.
+ *
+ * The functions don't lock anything: the regions of a process are protected
+ * by its region_lock, which the callers hold around a check and the update
+ * that follows it.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <errors.h>
+#include <region.h>
+
+/**
+ * @brief Returns the page number one past the end of a region
+ */
+static uint32_t region_end(region_t *region) {
+	return region->start / PAGE_SIZE + region->num_pages;
+}
+
+/**
+ * @brief Returns the index of the first region starting after va, which is
+ * the number of regions if there is none
+ */
+static int upper_bound(region_set_t *set, vaddr_t va) {
+	int low = 0, high = set->count;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (set->regions[mid].start <= va) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+/**
+ * @brief Initializes an empty set of regions
+ */
+void init_regions(region_set_t *set) {
+	set->regions = NULL;
+	set->count = 0;
+	set->capacity = 0;
+}
+
+/**
+ * @brief Frees the table of a set of regions, which is not usable anymore
+ */
+void destroy_regions(region_set_t *set) {
+	free(set->regions);
+	set->regions = NULL;
+	set->count = 0;
+	set->capacity = 0;
+}
+
+/**
+ * @brief Forgets all the regions of a set
+ */
+void clear_regions(region_set_t *set) {
+	set->count = 0;
+}
+
+/**
+ * @brief Copies the regions of src into the empty set dst
+ *
+ * @return 0 on success, ERR_MALLOC_FAIL if the table couldn't be allocated
+ */
+int copy_regions(region_set_t *dst, region_set_t *src) {
+	if (src->count > 0) {
+		dst->regions = malloc(src->count * sizeof(region_t));
+		if (dst->regions == NULL) return ERR_MALLOC_FAIL;
+		memcpy(dst->regions, src->regions, src->count * sizeof(region_t));
+		dst->capacity = src->count;
+	}
+	dst->count = src->count;
+	return 0;
+}
+
+/**
+ * @brief Checks whether any page from start to start + num_pages pages is
+ * part of a region
+ */
+boolean_t region_overlaps(region_set_t *set, vaddr_t start, int num_pages) {
+	uint32_t first = start / PAGE_SIZE;
+	uint32_t end = first + num_pages;
+
+	int i = upper_bound(set, start);
+	// The region before start must end before it
+	if (i > 0 && region_end(&set->regions[i - 1]) > first) return TRUE;
+	// The region after start must begin after the range
+	if (i < set->count && set->regions[i].start / PAGE_SIZE < end) return TRUE;
+	return FALSE;
+}
+
+/**
+ * @brief Adds a region of num_pages pages from start
+ *
+ * @return 0 on success, ERR_REGION_OVERLAP if the region would overlap
+ * another one, ERR_MALLOC_FAIL if the table couldn't grow
+ */
+int insert_region(region_set_t *set, vaddr_t start, int num_pages) {
+	if (start % PAGE_SIZE != 0 || num_pages <= 0) return ERR_INVALID_ARG;
+	if (region_overlaps(set, start, num_pages)) return ERR_REGION_OVERLAP;
+
+	if (set->count == set->capacity) {
+		// Double the table
+		int capacity = set->capacity == 0 ?
+			REGIONS_INITIAL_CAPACITY : 2 * set->capacity;
+		region_t *regions = malloc(capacity * sizeof(region_t));
+		if (regions == NULL) return ERR_MALLOC_FAIL;
+		if (set->count > 0)
+			memcpy(regions, set->regions, set->count * sizeof(region_t));
+		free(set->regions);
+		set->regions = regions;
+		set->capacity = capacity;
+	}
+
+	// Make room at the right spot
+	int i = upper_bound(set, start);
+	memmove(&set->regions[i + 1], &set->regions[i],
+		(set->count - i) * sizeof(region_t));
+	set->regions[i].start = start;
+	set->regions[i].num_pages = num_pages;
+	set->regions[i].kind = REGION_ANON;
+	set->regions[i].object = 0;
+	set->count++;
+
+	return 0;
+}
+
+/**
+ * @brief Removes the region beginning at start
+ *
+ * @return the number of pages of the region, or ERR_NO_REGION if no region
+ * begins at start
+ */
+int remove_region(region_set_t *set, vaddr_t start) {
+	int i = upper_bound(set, start) - 1;
+	if (i < 0 || set->regions[i].start != start) return ERR_NO_REGION;
+
+	int num_pages = set->regions[i].num_pages;
+	memmove(&set->regions[i], &set->regions[i + 1],
+		(set->count - i - 1) * sizeof(region_t));
+	set->count--;
+
+	return num_pages;
+}
+
+/**
+ * @brief Returns the region holding va, NULL if there is none
+ *
+ * The returned region is only valid as long as the lock of the set is held.
+ */
+region_t *find_region(region_set_t *set, vaddr_t va) {
+	int i = upper_bound(set, va) - 1;
+	if (i < 0) return NULL;
+	if (region_end(&set->regions[i]) <= va / PAGE_SIZE) return NULL;
+	return &set->regions[i];
+}
@@ -0,0 +1,153 @@
+/**
+ * @file scanset.c
+ * @brief The sets of processes the background scanners walk
+ *
+ * The same-page merging scanner and the working-set scanner (@see ksm.c
+ * and wss.c) both scan the processes created after they start, a little
+ * at a time, from the CPU of the process. A set links its processes
+ * through their scan link for it, newest first, and keeps the process the
+ * scanner works on next. Both are protected by the lock of the set.
+ *
+ * The scanner marks the process it works on busy, the destruction of a
+ * process waits on not_busy until the scanner is done with it. To work on
+ * a process, the scanner moves to its CPU, where all of its threads run,
+ * and pins the process there (@see sched.c): none of them runs meanwhile.
+ * The scanners are pinned themselves, so that nobody but themselves moves
+ * them.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <process.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <scanset.h>
+
+/* The link of a process in a set */
+#define LINK(set, process) (&(process)->scan[(set)->id])
+
+/**
+ * @brief Initializes an empty set
+ *
+ * @param id the link of the processes it uses, SCAN_KSM or SCAN_WSS
+ */
+void scanset_init(scanset_t *set, int id) {
+	set->id = id;
+	set->tracked = NULL;
+	set->cursor = NULL;
+	mutex_init(&set->lock);
+	cond_init(&set->not_busy);
+}
+
+/**
+ * @brief Picks the process to scan next, and marks it busy
+ *
+ * The processes exiting, and the scanner's own, are skipped.
+ *
+ * @param round_over set when the previous round just ended, may be NULL
+ * @return the process, NULL if there is none to scan right now
+ */
+process_t *scanset_next(scanset_t *set, boolean_t *round_over) {
+	process_t *self = get_self()->process;
+
+	mutex_lock(&set->lock);
+	if (round_over != NULL) *round_over = (set->cursor == NULL);
+	if (set->cursor == NULL) set->cursor = set->tracked;
+
+	while (set->cursor != NULL
+			&& (set->cursor == self || set->cursor->state != RUNNING)) {
+		set->cursor = LINK(set, set->cursor)->next;
+	}
+
+	process_t *process = set->cursor;
+	if (process != NULL) LINK(set, process)->busy = TRUE;
+	mutex_unlock(&set->lock);
+
+	return process;
+}
+
+/**
+ * @brief Moves the calling thread to the CPU of a process and pins the
+ * process there
+ */
+void scanset_join(process_t *process) {
+	thread_t *self = get_self();
+
+	dont_switch_me_out();
+	process->pinned++;
+	if (process->cpu == cpu_id()) {
+		you_can_switch_me_out_now();
+		return;
+	}
+
+	// We run again on the other CPU only
+	self->process->cpu = process->cpu;
+	set_runnable(self);
+	thread_t *other = get_running();
+	if (other == NULL || other == self) other = idle();
+	context_switch(self, other);
+}
+
+/**
+ * @brief Unpins a process and marks it done
+ *
+ * @param done whether its scan reached its end, the next process is
+ * scanned then
+ */
+void scanset_leave(scanset_t *set, process_t *process, boolean_t done) {
+	dont_switch_me_out();
+	process->pinned--;
+	you_can_switch_me_out_now();
+
+	mutex_lock(&set->lock);
+	LINK(set, process)->busy = FALSE;
+	if (done && set->cursor == process)
+		set->cursor = LINK(set, process)->next;
+	cond_broadcast(&set->not_busy);
+	mutex_unlock(&set->lock);
+}
+
+/**
+ * @brief Adds a new process to a set
+ */
+void scanset_track(scanset_t *set, process_t *process) {
+	scan_link_t *link = LINK(set, process);
+
+	mutex_lock(&set->lock);
+	link->prev = NULL;
+	link->next = set->tracked;
+	if (set->tracked != NULL) LINK(set, set->tracked)->prev = process;
+	set->tracked = process;
+	mutex_unlock(&set->lock);
+}
+
+/**
+ * @brief Takes a process being destroyed out of a set, once the scanner is
+ * done with it
+ *
+ * @return TRUE if the process was in the set
+ */
+boolean_t scanset_untrack(scanset_t *set, process_t *process) {
+	scan_link_t *link = LINK(set, process);
+
+	mutex_lock(&set->lock);
+	if (link->prev == NULL && set->tracked != process) {
+		mutex_unlock(&set->lock);
+		return FALSE;
+	}
+
+	while (link->busy) cond_wait(&set->not_busy, &set->lock);
+
+	if (set->cursor == process) set->cursor = link->next;
+	if (link->prev != NULL) LINK(set, link->prev)->next = link->next;
+	else set->tracked = link->next;
+	if (link->next != NULL) LINK(set, link->next)->prev = link->prev;
+	link->next = NULL;
+	link->prev = NULL;
+	mutex_unlock(&set->lock);
+	return TRUE;
+}
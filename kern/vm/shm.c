@@ -0,0 +1,187 @@
+/**
+ * @file shm.c
+ * @brief Shared memory segments
+ *
+ * A segment is a set of zeroed frames that several processes map read-write
+ * at once, so that they can exchange data without copying it through the
+ * kernel. The page table entries of a segment are marked PTE_SHARED: they
+ * stay writable and shared when a page table is split after a fork, instead
+ * of becoming copy on write. Since every mapping holds its frames like any
+ * other page, unmapping and destroying the paging need nothing special.
+ *
+ * Each attachment of a segment is a region of the process holding it (@see
+ * region.c). The segment is destroyed, and its frames released, when the last
+ * of these regions goes away.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <page.h>
+#include <shm.h>
+#include <lock.h>
+#include <errors.h>
+
+/**
+ * The segments, looked up by id. A slot is free when its id is 0.
+ */
+static shm_segment_t segments[SHM_MAX_SEGMENTS];
+/**
+ * Protects the segments table and the attachment counts
+ */
+static mutex_t shm_lock;
+/**
+ * Identifier of the next segment, never reused
+ */
+static int next_id = 1;
+
+/**
+ * @brief Initializes the segments table
+ */
+void init_shm(void) {
+	int i;
+	for (i = 0; i < SHM_MAX_SEGMENTS; ++i) segments[i].id = 0;
+	mutex_init(&shm_lock);
+}
+
+/**
+ * @brief Returns the segment with the given id, the caller holds shm_lock
+ */
+static shm_segment_t *find_segment(int id) {
+	if (id <= 0) return NULL;
+	int i;
+	for (i = 0; i < SHM_MAX_SEGMENTS; ++i) {
+		if (segments[i].id == id) return &segments[i];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Frees num_pages frames of a segment and its frame array
+ */
+static void release_frames(paddr_t *frames, int num_pages) {
+	int i;
+	for (i = 0; i < num_pages; ++i) {
+		if (free_frame(frames[i]))
+			kernel_panic("Shared frame %p has no owner", frames[i]);
+	}
+	free(frames);
+}
+
+/**
+ * @brief Creates a segment of num_pages zeroed frames
+ *
+ * The segment starts with one attachment, which the caller must either map
+ * or give back with shm_put.
+ *
+ * @param num_pages the length of the segment
+ * @param out placeholder for the frames of the segment
+ * @return the id of the segment, a negative error code otherwise
+ */
+int shm_create_segment(int num_pages, paddr_t **out) {
+	if (num_pages <= 0) return ERR_INVALID_ARG;
+
+	paddr_t *frames = malloc(num_pages * sizeof(paddr_t));
+	if (frames == NULL) return ERR_MALLOC_FAIL;
+
+	int i;
+	for (i = 0; i < num_pages; ++i) {
+		frames[i] = allocate_zeroed_frame();
+		if (frames[i] == NULL) {
+			release_frames(frames, i);
+			return ERR_NO_FRAMES;
+		}
+	}
+
+	mutex_lock(&shm_lock);
+	shm_segment_t *segment = NULL;
+	for (i = 0; segment == NULL && i < SHM_MAX_SEGMENTS; ++i) {
+		if (segments[i].id == 0) segment = &segments[i];
+	}
+	if (segment == NULL) {
+		mutex_unlock(&shm_lock);
+		release_frames(frames, num_pages);
+		return ERR_TOO_MANY_SEGMENTS;
+	}
+
+	segment->id = next_id++;
+	segment->num_pages = num_pages;
+	segment->attached = 1;
+	segment->frames = frames;
+	int id = segment->id;
+	mutex_unlock(&shm_lock);
+
+	*out = frames;
+	return id;
+}
+
+/**
+ * @brief Takes one more attachment on a segment
+ *
+ * The frame array stays valid until the attachment is given back.
+ *
+ * @param id the id of the segment
+ * @param num_pages placeholder for the length of the segment
+ * @return the frames of the segment, NULL if there is no such segment
+ */
+paddr_t *shm_get(int id, int *num_pages) {
+	mutex_lock(&shm_lock);
+	shm_segment_t *segment = find_segment(id);
+	paddr_t *frames = NULL;
+	if (segment != NULL) {
+		segment->attached++;
+		*num_pages = segment->num_pages;
+		frames = segment->frames;
+	}
+	mutex_unlock(&shm_lock);
+	return frames;
+}
+
+/**
+ * @brief Gives back an attachment, destroying the segment with the last one
+ */
+void shm_put(int id) {
+	mutex_lock(&shm_lock);
+	shm_segment_t *segment = find_segment(id);
+	if (segment == NULL) kernel_panic("Attachment to unknown segment %d", id);
+
+	if (--segment->attached > 0) {
+		mutex_unlock(&shm_lock);
+		return;
+	}
+
+	paddr_t *frames = segment->frames;
+	int num_pages = segment->num_pages;
+	segment->id = 0;
+	segment->frames = NULL;
+	mutex_unlock(&shm_lock);
+
+	release_frames(frames, num_pages);
+}
+
+/**
+ * @brief Takes an attachment for every segment region of a set, which was
+ * just copied from another process at fork
+ */
+void shm_hold_regions(region_set_t *set) {
+	int i, n;
+	for (i = 0; i < set->count; ++i) {
+		if (set->regions[i].kind != REGION_SHM) continue;
+		if (shm_get(set->regions[i].object, &n) == NULL)
+			kernel_panic("Region of unknown segment %d",
+				set->regions[i].object);
+	}
+}
+
+/**
+ * @brief Gives back the attachments of every segment region of a set, whose
+ * regions are about to be forgotten
+ */
+void shm_drop_regions(region_set_t *set) {
+	int i;
+	for (i = 0; i < set->count; ++i) {
+		if (set->regions[i].kind == REGION_SHM)
+			shm_put(set->regions[i].object);
+	}
+}
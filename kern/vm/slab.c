@@ -0,0 +1,340 @@
+/**
+ * @file slab.c
+ * @brief A slab allocator for the small fixed-size kernel objects
+ *
+ * Every call into the kernel heap takes the single mem_lock (@see
+ * malloc_wrappers.c). The small objects which come and go with processes
+ * and system calls are allocated from slab caches instead, each with its
+ * own lock.
+ *
+ * A cache holds objects of a single size, carved out of page-sized slabs.
+ * The header of a slab sits at the start of its page, so an object finds it
+ * by rounding its address down. A slab keeps the list of its free objects,
+ * linked through their first word, and sits in the partial, full or empty
+ * list of its cache. Allocations are served from the partial slabs first, so
+ * that the slabs fill up; a cache only keeps SLAB_MAX_EMPTY empty slabs and
+ * gives the others back to the heap.
+ *
+ * Some caches are created for a given object type, under a name. The others
+ * are the size classes, powers of two up to SLAB_MAX_SIZE, which serve
+ * kmalloc; larger allocations go to the heap. All the caches are registered
+ * for the statistics (@see slab_stats).
+ *
+ * Unlike the object caches (@see objcache.c), a slab doesn't keep its free
+ * objects constructed.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <assert.h>
+#include <x86/page.h>
+#include <lock.h>
+#include <slab.h>
+
+#define ROUND_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+/* Number of size classes, 16 to 1024 bytes */
+#define SLAB_NUM_CLASSES 7
+
+/**
+ * The header of a slab, at the start of its page
+ */
+struct slab {
+	slab_cache_t	*cache;		// The cache the slab belongs to
+	slab_t			*next;		// In the list of the cache
+	slab_t			*prev;
+	void			*free;		// First free object
+	int				in_use;		// Objects allocated
+};
+
+/* Offset of the first object in a slab */
+#define SLAB_HEADER_SIZE ROUND_UP(sizeof(slab_t), SLAB_ALIGN)
+
+/* The size classes served by kmalloc */
+static slab_cache_t classes[SLAB_NUM_CLASSES];
+static const char *class_names[SLAB_NUM_CLASSES] = {
+	"size-16", "size-32", "size-64", "size-128",
+	"size-256", "size-512", "size-1024"
+};
+
+/* Every cache, for the statistics */
+static slab_cache_t *caches[SLAB_MAX_CACHES];
+static int num_caches = 0;
+static mutex_t caches_lock;
+
+/**
+ * @brief Initializes the slab allocator and its size classes
+ */
+void slab_init(void) {
+	mutex_init(&caches_lock);
+
+	int i;
+	size_t size = SLAB_MIN_SIZE;
+	for (i = 0; i < SLAB_NUM_CLASSES; ++i, size <<= 1)
+		slab_cache_init(&classes[i], class_names[i], size);
+}
+
+/**
+ * @brief Initializes an empty cache and registers it
+ *
+ * @param cache the cache
+ * @param name its name, for the statistics
+ * @param size the size of its objects, at most SLAB_MAX_SIZE
+ */
+void slab_cache_init(slab_cache_t *cache, const char *name, size_t size) {
+	assert(size > 0 && size <= SLAB_MAX_SIZE);
+
+	cache->name = name;
+	cache->size = size;
+	cache->stride = ROUND_UP(size, SLAB_ALIGN);
+	if (cache->stride < sizeof(void *)) cache->stride = sizeof(void *);
+	cache->per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->stride;
+
+	cache->partial = NULL;
+	cache->full = NULL;
+	cache->empty = NULL;
+	cache->num_empty = 0;
+	cache->slabs = 0;
+	cache->in_use = 0;
+	cache->allocs = 0;
+	cache->frees = 0;
+	mutex_init_named(&cache->lock, "slab cache");
+
+	mutex_lock(&caches_lock);
+	assert(num_caches < SLAB_MAX_CACHES);
+	caches[num_caches++] = cache;
+	mutex_unlock(&caches_lock);
+}
+
+/**
+ * @brief Adds a slab at the head of a list
+ */
+static void slab_push(slab_t **list, slab_t *slab) {
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL) (*list)->prev = slab;
+	*list = slab;
+}
+
+/**
+ * @brief Removes a slab from a list
+ */
+static void slab_remove(slab_t **list, slab_t *slab) {
+	if (slab->prev != NULL) slab->prev->next = slab->next;
+	else *list = slab->next;
+	if (slab->next != NULL) slab->next->prev = slab->prev;
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+/**
+ * @brief Gets a page from the heap and makes it a slab of free objects
+ *
+ * @return the new slab, NULL if memory ran out
+ */
+static slab_t *slab_create(slab_cache_t *cache) {
+	slab_t *slab = smemalign(PAGE_SIZE, PAGE_SIZE);
+	if (slab == NULL) return NULL;
+
+	slab->cache = cache;
+	slab->next = NULL;
+	slab->prev = NULL;
+	slab->in_use = 0;
+	slab->free = NULL;
+
+	// Thread the free list, the first object at its head
+	int i;
+	char *objs = (char *) slab + SLAB_HEADER_SIZE;
+	for (i = cache->per_slab - 1; i >= 0; --i) {
+		void **obj = (void **) (objs + i * cache->stride);
+		*obj = slab->free;
+		slab->free = obj;
+	}
+
+	return slab;
+}
+
+/**
+ * @brief Returns an object of the cache
+ *
+ * @param cache the cache
+ * @return the object, NULL if memory ran out
+ */
+void *slab_alloc(slab_cache_t *cache) {
+	mutex_lock(&cache->lock);
+
+	slab_t *slab = cache->partial;
+	if (slab == NULL && cache->empty != NULL) {
+		slab = cache->empty;
+		slab_remove(&cache->empty, slab);
+		slab_push(&cache->partial, slab);
+		cache->num_empty--;
+	}
+
+	if (slab == NULL) {
+		// The heap has its own lock, don't hold ours meanwhile
+		mutex_unlock(&cache->lock);
+		slab = slab_create(cache);
+		if (slab == NULL) return NULL;
+
+		mutex_lock(&cache->lock);
+		slab_push(&cache->partial, slab);
+		cache->slabs++;
+	}
+
+	void **obj = slab->free;
+	slab->free = *obj;
+	if (++slab->in_use == cache->per_slab) {
+		slab_remove(&cache->partial, slab);
+		slab_push(&cache->full, slab);
+	}
+
+	cache->in_use++;
+	cache->allocs++;
+	mutex_unlock(&cache->lock);
+	return obj;
+}
+
+/**
+ * @brief Returns an object of the cache filled with zeros
+ */
+void *slab_zalloc(slab_cache_t *cache) {
+	void *obj = slab_alloc(cache);
+	if (obj != NULL) memset(obj, 0, cache->size);
+	return obj;
+}
+
+/**
+ * @brief Gives an object back to its cache
+ *
+ * @param cache the cache the object was allocated from
+ * @param obj the object, NULL does nothing
+ */
+void slab_free(slab_cache_t *cache, void *obj) {
+	if (obj == NULL) return;
+
+	slab_t *slab = (slab_t *) ((uint32_t) obj & ~(PAGE_SIZE - 1));
+	assert(slab->cache == cache);
+	slab_t *release = NULL;
+
+	mutex_lock(&cache->lock);
+
+	// Take the slab out of its list, it may move to another one
+	if (slab->in_use == cache->per_slab) slab_remove(&cache->full, slab);
+	else slab_remove(&cache->partial, slab);
+
+	*(void **) obj = slab->free;
+	slab->free = obj;
+	slab->in_use--;
+
+	if (slab->in_use > 0) {
+		slab_push(&cache->partial, slab);
+	} else if (cache->num_empty < SLAB_MAX_EMPTY) {
+		slab_push(&cache->empty, slab);
+		cache->num_empty++;
+	} else {
+		release = slab;
+		cache->slabs--;
+	}
+
+	cache->in_use--;
+	cache->frees++;
+	mutex_unlock(&cache->lock);
+
+	if (release != NULL) sfree(release, PAGE_SIZE);
+}
+
+/**
+ * @brief Copies the statistics of the caches, in the order they were
+ * created
+ *
+ * The bytes wasted by a cache are those of its slabs which hold no
+ * allocated object: free objects, headers, padding and the ends of the
+ * pages.
+ *
+ * @param stats where to copy them
+ * @param n the number of entries stats has room for
+ * @param reset whether to clear the allocation and free counters
+ * @return the number of entries copied
+ */
+int slab_stats(kstat_slab_t *stats, int n, boolean_t reset) {
+	mutex_lock(&caches_lock);
+	if (n > num_caches) n = num_caches;
+
+	int i;
+	for (i = 0; i < n; ++i) {
+		slab_cache_t *cache = caches[i];
+		kstat_slab_t *out = &stats[i];
+
+		mutex_lock(&cache->lock);
+		strncpy(out->name, cache->name, KSTAT_NAME_LEN - 1);
+		out->name[KSTAT_NAME_LEN - 1] = '\0';
+		out->size = cache->size;
+		out->slabs = cache->slabs;
+		out->in_use = cache->in_use;
+		out->wasted = cache->slabs * PAGE_SIZE - cache->in_use * cache->size;
+		out->allocs = cache->allocs;
+		out->frees = cache->frees;
+		if (reset) {
+			cache->allocs = 0;
+			cache->frees = 0;
+		}
+		mutex_unlock(&cache->lock);
+	}
+
+	mutex_unlock(&caches_lock);
+	return n;
+}
+
+/**
+ * @brief Finds the smallest size class fitting the given size
+ *
+ * @return the class, NULL if the size is too large for the slabs
+ */
+static slab_cache_t *size_class(size_t size) {
+	int i;
+	for (i = 0; i < SLAB_NUM_CLASSES; ++i)
+		if (size <= classes[i].size) return &classes[i];
+	return NULL;
+}
+
+/**
+ * @brief Allocates a buffer of the given size
+ *
+ * Like smalloc, the size has to be given back to kfree.
+ *
+ * @param size the size of the buffer
+ * @return the buffer, NULL if memory ran out
+ */
+void *kmalloc(size_t size) {
+	slab_cache_t *cache = size_class(size);
+	if (cache == NULL) return smalloc(size);
+	return slab_alloc(cache);
+}
+
+/**
+ * @brief Allocates a buffer of the given size filled with zeros
+ */
+void *kzalloc(size_t size) {
+	void *buf = kmalloc(size);
+	if (buf != NULL) memset(buf, 0, size);
+	return buf;
+}
+
+/**
+ * @brief Frees a buffer obtained from kmalloc
+ *
+ * @param buf the buffer, NULL does nothing
+ * @param size the size it was allocated with
+ */
+void kfree(void *buf, size_t size) {
+	if (buf == NULL) return;
+
+	slab_cache_t *cache = size_class(size);
+	if (cache == NULL) sfree(buf, size);
+	else slab_free(cache, buf);
+}
@@ -0,0 +1,87 @@
+/**
+ * @file tlb.c
+ * @brief Invalidation of the translation lookaside buffer
+ *
+ * Whenever a page table entry of the current address space is changed, the
+ * TLB may still hold the previous translation. Reloading cr3 throws away
+ * every translation that isn't global, while invlpg only drops the one of the
+ * given page. These functions pick the cheapest of the two for the number of
+ * pages changed, so that the user translations unrelated to an update survive
+ * it.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <x86/page.h>
+#include <cr.h>
+#include <tlb.h>
+
+/**
+ * @brief Invalidates the TLB entry of a single page
+ */
+void tlb_flush_page(vaddr_t va) {
+	asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
+/**
+ * @brief Invalidates the TLB entries of num_pages pages from base
+ *
+ * Past TLB_FLUSH_THRESHOLD pages the whole TLB is flushed instead.
+ */
+void tlb_flush_range(vaddr_t base, int num_pages) {
+	if (num_pages > TLB_FLUSH_THRESHOLD) {
+		tlb_flush_all();
+		return;
+	}
+
+	int i;
+	for (i = 0; i < num_pages; ++i) {
+		tlb_flush_page(base + i * PAGE_SIZE);
+	}
+}
+
+/**
+ * @brief Flushes all the non-global entries of the TLB
+ */
+void tlb_flush_all(void) {
+	set_cr3(get_cr3());
+}
+
+/**
+ * @brief Starts an empty batch of pages to invalidate
+ */
+void tlb_batch_init(tlb_batch_t *batch) {
+	batch->count = 0;
+	batch->full = FALSE;
+}
+
+/**
+ * @brief Records that the entry of va has to be invalidated
+ *
+ * The batch falls back to a full flush once it holds too many pages.
+ */
+void tlb_batch_add(tlb_batch_t *batch, vaddr_t va) {
+	if (batch->full) return;
+
+	if (batch->count == TLB_FLUSH_THRESHOLD) {
+		batch->full = TRUE;
+		return;
+	}
+	batch->pages[batch->count++] = va;
+}
+
+/**
+ * @brief Invalidates every page recorded in the batch, and empties it
+ */
+void tlb_batch_flush(tlb_batch_t *batch) {
+	if (batch->full) {
+		tlb_flush_all();
+	} else {
+		int i;
+		for (i = 0; i < batch->count; ++i) {
+			tlb_flush_page(batch->pages[i]);
+		}
+	}
+	tlb_batch_init(batch);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file vdso.c
+ * @brief The kernel data pages, mapped read-only in every process
+ *
+ * get_ticks and gettid are called all the time, by the thread library
+ * most notably, and only read a value the kernel knows. The kernel keeps
+ * these values in two pages at KDATA_BASE (@see kdata.h), mapped read-only
+ * in user space, and the system call stubs simply read them:
+ * - The first page, in the kernel image, is shared by all processes and
+ *   holds the tick count, updated by the timer, and whether the system calls
+ *   may be made with sysenter (@see install_sysenter).
+ * - The second page belongs to the process and holds the id of its thread
+ *   which runs, updated on every switch to one of its threads. All the
+ *   threads of a process run on the same CPU, one at a time (@see sched.c),
+ *   so the thread reading it is always the one it names.
+ *
+ * The pages are mapped by a page table of their own, in the 4MB region at
+ * KDATA_BASE. Its directory entry is flagged PDE_KERNEL, so that fork, exec
+ * and the destruction of the process leave it alone, and the memory
+ * functions refuse the region (@see vdso_overlaps). The kernel writes the
+ * pages through its direct map.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <errors.h>
+#include <page.h>
+#include <ptpool.h>
+#include <vdso.h>
+
+/* The page directory entry of the region */
+#define VDSO_PDE PDE_OFFSET(KDATA_BASE)
+
+/* The page shared by everybody, in the kernel page table */
+static char kdata_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static kdata_t *kdata = (kdata_t *) kdata_page;
+
+/**
+ * @brief Returns a present, user, read-only entry for a kernel frame
+ */
+static pte_t vdso_pte(void *frame) {
+	pte_t pte = PE_SETADDR(0, frame);
+	pte = PE_SETFLAG(pte, PTE_PRESENT);
+	return PE_SETFLAG(pte, PTE_USER);
+}
+
+/**
+ * @brief Clears the shared page
+ */
+void vdso_init(void) {
+	memset(kdata_page, 0, PAGE_SIZE);
+}
+
+/**
+ * @brief Maps the kernel data pages in a new process, with a page of its
+ * own
+ *
+ * @param process the process, whose page directory is set up
+ * @return 0 on success, a negative error code otherwise
+ */
+int vdso_create(process_t *process) {
+	pte_t *pt = alloc_page_table();
+	if (pt == NULL) return ERR_MALLOC_FAIL;
+
+	kdata_task_t *task = alloc_page_table();
+	if (task == NULL) {
+		free_page_table(pt);
+		return ERR_MALLOC_FAIL;
+	}
+
+	pt[PTE_OFFSET(KDATA_BASE)] = vdso_pte(kdata_page);
+	pt[PTE_OFFSET(KDATA_TASK_BASE)] = vdso_pte(task);
+
+	pde_t pde = PE_SETADDR(0, pt);
+	pde = PE_SETFLAG(pde, PDE_PRESENT);
+	pde = PE_SETFLAG(pde, PDE_USER);
+	process->cr3[VDSO_PDE] = PE_SETFLAG(pde, PDE_KERNEL);
+	process->kdata = task;
+
+	return 0;
+}
+
+/**
+ * @brief Unmaps the kernel data pages of a process being destroyed
+ */
+void vdso_destroy(process_t *process) {
+	pde_t *pde = &process->cr3[VDSO_PDE];
+	if (!PE_GETFLAG(*pde, PDE_PRESENT)) return;
+
+	free_page_table((void *) PE_GETADDR(*pde));
+	free_page_table(process->kdata);
+	*pde = 0;
+	process->kdata = NULL;
+}
+
+/**
+ * @brief Tells whether num_pages pages from va reach the region of the
+ * kernel data pages
+ */
+boolean_t vdso_overlaps(vaddr_t va, int num_pages) {
+	if (num_pages <= 0) return FALSE;
+	vaddr_t last = va + (num_pages - 1) * PAGE_SIZE;
+	return PDE_OFFSET(va) <= VDSO_PDE && VDSO_PDE <= PDE_OFFSET(last);
+}
+
+/**
+ * @brief Publishes the tick count
+ */
+void vdso_set_ticks(unsigned int ticks) {
+	kdata->ticks = ticks;
+}
+
+/**
+ * @brief Publishes whether the programs may use sysenter
+ */
+void vdso_set_sysenter(boolean_t usable) {
+	kdata->sysenter = usable;
+}
+
+/**
+ * @brief Publishes the thread about to run in the page of its process
+ */
+void vdso_set_running(thread_t *thread) {
+	kdata_task_t *task = thread->process->kdata;
+	if (task != NULL) task->tid = thread->tid;
+}
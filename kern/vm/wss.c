@@ -0,0 +1,291 @@
+/**
+ * @file wss.c
+ * @brief Estimation of the working set of the processes
+ *
+ * The hardware sets the accessed bit of a page table entry whenever the
+ * page is touched, and nothing else in the kernel looks at it. The scanner,
+ * a kernel thread, samples and clears these bits one 4MB region of a
+ * process at a time, with a sleep of WSS_SLEEP_TICKS in between, and counts
+ * for every page the rounds since it was last touched, a round being a scan
+ * of the whole address space of the process. The pages touched during the
+ * last round are the working set of the process, the others are idle, and
+ * memstat reports how many there are of each age (@see memstat.h), along
+ * with the pages written to and those still copy on write.
+ *
+ * A sampled region keeps the age of each of its pages, and its share of
+ * the counts of the process, which the next sample of the region replaces.
+ * A region which lost its page table loses its samples.
+ *
+ * The bits are cleared behind the back of the process, which is only safe
+ * when none of its threads runs meanwhile. Like the same-page merging
+ * scanner (@see ksm.c and scanset.c), the scanner moves to the CPU of the
+ * process and pins the process there, and holds its region and copy on
+ * write locks.
+ * Switching to the scanner loads another directory, which flushes the
+ * entries of the process from the TLB: once it runs again, it sets the
+ * bits of the pages it touches anew, and no page is invalidated one by one.
+ * The page tables shared since a fork are left alone.
+ *
+ * Only the processes created after the scanner starts, with init, are
+ * scanned.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <x86/page.h>
+#include <page.h>
+#include <process.h>
+#include <thread.h>
+#include <context.h>
+#include <drivers.h>
+#include <cpu.h>
+#include <lock.h>
+#include <inc/syscall.h>
+#include <sched.h>
+#include <kthread.h>
+#include <scanset.h>
+#include <wss.h>
+
+/* The samples of a 4MB region */
+typedef struct {
+	uint8_t		age[PAGE_TABLE_ENTRIES];	// Rounds each page was idle for
+	uint16_t	idle[MEMSTAT_IDLE_BUCKETS];	// Its share of the counts
+	uint16_t	dirty;
+	uint16_t	cow;
+} wss_region_t;
+
+/* The samples of a process */
+struct wss {
+	wss_region_t	*regions[PAGE_TABLE_ENTRIES];	// NULL if none
+	vaddr_t			cursor;			// Next region to sample
+	unsigned int	rounds;
+	unsigned int	idle[MEMSTAT_IDLE_BUCKETS];
+	unsigned int	dirty;
+	unsigned int	cow;
+};
+
+/* Protects the counts of the processes, which memstat reads */
+static mutex_t stats_lock;
+
+/* The flags of the region sampled, only the scanner uses them */
+static uint8_t pages[PAGE_TABLE_ENTRIES];
+
+/* The processes to scan, @see scanset.c */
+static scanset_t processes;
+
+/* Whether the scanner runs, and tracks the new processes */
+static boolean_t running = FALSE;
+
+/**
+ * @brief Returns the bucket of the pages idle for age rounds
+ */
+static int idle_bucket(int age) {
+	int bucket = 0;
+	while (age > 0 && bucket < MEMSTAT_IDLE_BUCKETS - 1) {
+		age >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/**
+ * @brief Adds the share of a region to the counts of its process, or takes
+ * it away. The stats lock must be held.
+ *
+ * @param sign 1 to add it, -1 to take it away
+ */
+static void account_region(struct wss *wss, wss_region_t *region, int sign) {
+	int i;
+	for (i = 0; i < MEMSTAT_IDLE_BUCKETS; ++i)
+		wss->idle[i] += sign * region->idle[i];
+	wss->dirty += sign * region->dirty;
+	wss->cow += sign * region->cow;
+}
+
+/**
+ * @brief Forgets the samples of a region
+ */
+static void drop_region(struct wss *wss, int dir) {
+	wss_region_t *region = wss->regions[dir];
+	if (region == NULL) return;
+
+	mutex_lock(&stats_lock);
+	account_region(wss, region, -1);
+	wss->regions[dir] = NULL;
+	mutex_unlock(&stats_lock);
+
+	free(region);
+}
+
+/**
+ * @brief Ages the pages of a region from the flags just sampled, and
+ * replaces its share of the counts
+ */
+static void update_region(struct wss *wss, int dir) {
+	wss_region_t *region = wss->regions[dir];
+	if (region == NULL) {
+		region = calloc(1, sizeof(wss_region_t));
+		if (region == NULL) return;
+
+		mutex_lock(&stats_lock);
+		wss->regions[dir] = region;
+		mutex_unlock(&stats_lock);
+	}
+
+	wss_region_t share;
+	memset(&share, 0, sizeof(wss_region_t));
+
+	int i;
+	for (i = 0; i < PAGE_TABLE_ENTRIES; ++i) {
+		uint8_t flags = pages[i];
+		if (!(flags & SAMPLE_PRESENT)) {
+			region->age[i] = 0;
+			continue;
+		}
+
+		if (flags & SAMPLE_ACCESSED) region->age[i] = 0;
+		else if (region->age[i] < WSS_MAX_AGE) region->age[i]++;
+
+		share.idle[idle_bucket(region->age[i])]++;
+		if (flags & SAMPLE_DIRTY) share.dirty++;
+		if (flags & SAMPLE_COW) share.cow++;
+	}
+
+	mutex_lock(&stats_lock);
+	account_region(wss, region, -1);
+	memcpy(region->idle, share.idle, sizeof(share.idle));
+	region->dirty = share.dirty;
+	region->cow = share.cow;
+	account_region(wss, region, 1);
+	mutex_unlock(&stats_lock);
+}
+
+/**
+ * @brief Samples the next region of a process
+ *
+ * The regions without a page table of their own are skipped on the way.
+ *
+ * @param process the process, pinned and locked
+ * @return TRUE if the round is over
+ */
+static boolean_t scan_process(process_t *process) {
+	struct wss *wss = process->wss;
+	if (wss == NULL) {
+		wss = calloc(1, sizeof(struct wss));
+		if (wss == NULL) return TRUE;
+
+		mutex_lock(&stats_lock);
+		process->wss = wss;
+		mutex_unlock(&stats_lock);
+	}
+
+	vaddr_t va = wss->cursor;
+	if (va < USER_MEM_START) va = USER_MEM_START;
+
+	for (;;) {
+		int dir = PDE_OFFSET(va);
+		vaddr_t next = (va & DIR_MASK) + PAGE_SIZE * PAGE_TABLE_ENTRIES;
+
+		if (sample_region(process, va & DIR_MASK, pages) == 0) {
+			update_region(wss, dir);
+			wss->cursor = next;
+			break;
+		}
+		drop_region(wss, dir);
+
+		va = next;
+		if (va == 0) {
+			wss->cursor = 0;
+			break;
+		}
+	}
+
+	if (wss->cursor != 0) return FALSE;
+
+	mutex_lock(&stats_lock);
+	wss->rounds++;
+	mutex_unlock(&stats_lock);
+	return TRUE;
+}
+
+/**
+ * @brief The scanner thread
+ */
+static void wss_main(void *arg) {
+	for (;;) {
+		process_t *process = scanset_next(&processes, NULL);
+
+		if (process != NULL) {
+			scanset_join(process);
+
+			mutex_lock(process->region_lock);
+			mutex_lock(process->cow_lock);
+			boolean_t done = scan_process(process);
+			mutex_unlock(process->cow_lock);
+			mutex_unlock(process->region_lock);
+
+			scanset_leave(&processes, process, done);
+		}
+
+		_sleep(WSS_SLEEP_TICKS);
+	}
+}
+
+/**
+ * @brief Creates the scanner and makes it runnable, unless the kernel is
+ * built without WSS_SCAN
+ */
+void wss_start(void) {
+	if (!WSS_SCAN) return;
+
+	mutex_init(&stats_lock);
+	scanset_init(&processes, SCAN_WSS);
+
+	// Pinned, it moves itself to the processes it scans
+	if (kthread_create(wss_main, NULL, sched_place()) != NULL)
+		running = TRUE;
+}
+
+/**
+ * @brief Adds a new process to the processes to scan
+ */
+void wss_track(process_t *process) {
+	if (running) scanset_track(&processes, process);
+}
+
+/**
+ * @brief Takes a process being destroyed out of the processes to scan,
+ * once the scanner is done with it, and frees its samples
+ */
+void wss_untrack(process_t *process) {
+	if (!running || !scanset_untrack(&processes, process)) return;
+
+	struct wss *wss = process->wss;
+	if (wss == NULL) return;
+	process->wss = NULL;
+
+	int dir;
+	for (dir = 0; dir < PAGE_TABLE_ENTRIES; ++dir) free(wss->regions[dir]);
+	free(wss);
+}
+
+/**
+ * @brief Copies the working-set counts of a process into its memory
+ * statistics, which stay 0 until its first sample
+ */
+void wss_stats(process_t *process, memstat_t *stat) {
+	if (!running) return;
+
+	mutex_lock(&stats_lock);
+	struct wss *wss = process->wss;
+	if (wss != NULL) {
+		stat->rounds = wss->rounds;
+		memcpy(stat->idle, wss->idle, sizeof(stat->idle));
+		stat->dirty = wss->dirty;
+		stat->cow = wss->cow;
+	}
+	mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,31 @@
+/** @file ipc.h
+ *  @brief Synchronous messages between threads
+ *
+ *  ipc_call(tid, msg) sends a message to the thread tid and blocks until
+ *  that thread replies, the reply overwriting msg. ipc_receive(msg) blocks
+ *  until some thread calls the caller, and returns the id of that thread,
+ *  with its message in msg. ipc_reply(tid, msg) answers the call received
+ *  from tid; ipc_reply_wait(tid, msg) answers it and receives the next call
+ *  in msg, in the same system call, which is what a server loops on.
+ *
+ *  A message is IPC_MSG_WORDS words, which the kernel copies from the
+ *  sending thread to the receiving one directly. A call to a thread blocked
+ *  receiving gives it the CPU of the caller right away, and so does a reply
+ *  made by ipc_reply_wait, to the thread called back: a round trip costs two
+ *  context switches when the processes run on the same CPU.
+ *
+ *  The calls of a thread are received in the order they were made. A call
+ *  fails if the thread called vanishes before replying.
+ */
+
+#ifndef _IPC_H
+#define _IPC_H
+
+/* Words of a message */
+#define IPC_MSG_WORDS 4
+
+typedef struct {
+	int words[IPC_MSG_WORDS];
+} ipc_msg_t;
+
+#endif /* _IPC_H */
@@ -0,0 +1,40 @@
+/** @file kdata.h
+ *  @brief The kernel data pages, mapped read-only in every process
+ *
+ *  The kernel keeps a few values up to date in two pages at KDATA_BASE, so
+ *  that programs can read them without a system call. The first page is the
+ *  same for every process, the second one is the process' own.
+ */
+
+#ifndef _KDATA_H
+#define _KDATA_H
+
+/* Where the pages are, at the start of a 4MB region no program may use */
+#define KDATA_BASE      0xFF000000
+#define KDATA_TASK_BASE (KDATA_BASE + 0x1000)
+#define KDATA_END       (KDATA_BASE + 0x400000)
+
+/* Where the shared page tells whether sysenter may be used, for the stubs */
+#define KDATA_SYSENTER  (KDATA_BASE + 4)
+
+#ifndef ASSEMBLER
+
+/* The data shared by everybody */
+typedef struct {
+	volatile unsigned int ticks;    /* What get_ticks returns */
+	volatile unsigned int sysenter; /* Non-zero if every CPU has sysenter,
+	                                   otherwise use int $SYSCALL_INT */
+} kdata_t;
+
+/* The data of a process */
+typedef struct {
+	volatile int tid;               /* The thread of the process running,
+	                                   hence the one reading it */
+} kdata_task_t;
+
+#define KDATA       ((const kdata_t *) KDATA_BASE)
+#define KDATA_TASK  ((const kdata_task_t *) KDATA_TASK_BASE)
+
+#endif /* ASSEMBLER */
+
+#endif /* _KDATA_H */
@@ -0,0 +1,177 @@
+/** @file kstat.h
+ *  @brief Kernel statistics, as returned by the kstat system call
+ *
+ *  The first argument of kstat selects a set of counters. Or'ing it with
+ *  KSTAT_RESET clears the counters once they are copied out.
+ */
+
+#ifndef _KSTAT_H
+#define _KSTAT_H
+
+/* Counters sets */
+#define KSTAT_SCHED     0   /* One kstat_sched_t per CPU */
+#define KSTAT_SLAB      1   /* One kstat_slab_t per slab cache */
+#define KSTAT_REAPER    2   /* A single kstat_reaper_t */
+#define KSTAT_LOCKS     3   /* One kstat_lock_t per lock name, most
+                               contended first */
+#define KSTAT_SYSCALLS  4   /* One kstat_syscall_t per CPU and system call
+                               made on it */
+#define KSTAT_KSM       5   /* A single kstat_ksm_t */
+#define KSTAT_SERIAL    6   /* A single kstat_serial_t */
+#define KSTAT_BOOT      8   /* A single kstat_boot_t, never reset */
+#define KSTAT_RECLAIM   9   /* A single kstat_reclaim_t */
+#define KSTAT_EDF       10  /* One kstat_edf_t per CPU */
+#define KSTAT_PTPOOL    11  /* A single kstat_ptpool_t */
+
+/* Not a counters set: kstat(KSTAT_LOG, record, len) writes the record, of at
+ * most KSTAT_LOG_MAX bytes, to the log on the serial port. It returns 1 if
+ * the record was queued and 0 if it was dropped, the log being full; it
+ * never waits for the port. */
+#define KSTAT_LOG       7
+#define KSTAT_LOG_MAX   255
+
+#define KSTAT_RESET     0x100
+
+/* Longest name of a counters entry, terminating zero included */
+#define KSTAT_NAME_LEN  24
+
+/* Buckets of the latency histograms of the system calls */
+#define KSTAT_LATENCY_BUCKETS 32
+
+/* The scheduling counters of a CPU */
+typedef struct {
+	unsigned int cpu;
+	unsigned int online;        /* Does the CPU run threads? */
+	unsigned int queued;        /* Threads in its run queue right now */
+	unsigned int steals;        /* Processes it pulled while idle */
+	unsigned int balanced;      /* Processes the periodic rebalance gave it */
+	unsigned int migrations_in; /* Processes which moved here */
+	unsigned int migrations_out;/* Processes which moved away */
+	unsigned int bounces;       /* Moves away soon after a previous move */
+	unsigned int affine;        /* Picks of a thread of the running process
+                                   ahead of its queue */
+	unsigned int cr3_loads;     /* Switches to another address space */
+	unsigned int cr3_skips;     /* Switches within one, the TLB kept */
+} kstat_sched_t;
+
+/* The counters of a slab cache of the kernel */
+typedef struct {
+	char name[KSTAT_NAME_LEN];
+	unsigned int size;          /* Bytes of an object */
+	unsigned int slabs;         /* Pages the cache holds */
+	unsigned int in_use;        /* Objects allocated right now */
+	unsigned int wasted;        /* Bytes of its pages not in allocated objects */
+	unsigned int allocs;        /* Allocations since the last reset */
+	unsigned int frees;         /* Frees since the last reset */
+} kstat_slab_t;
+
+/* The backlog of the reaper, which destroys the processes collected */
+typedef struct {
+	unsigned int pending;       /* Processes waiting to be destroyed */
+	unsigned int peak;          /* Highest backlog since the last reset */
+	unsigned int reaped;        /* Processes destroyed since the last reset */
+	unsigned int threads;       /* Threads freed since the last reset */
+} kstat_reaper_t;
+
+/* The contention on the kernel mutexes of a name, in timer ticks */
+typedef struct {
+	char name[KSTAT_NAME_LEN];
+	unsigned int acquisitions;
+	unsigned int contended;     /* Acquisitions which found it held */
+	unsigned int wait_ticks;    /* Time spent waiting, in all */
+	unsigned int wait_max;
+	unsigned int hold_ticks;    /* Time it was held, in all */
+	unsigned int hold_max;
+} kstat_lock_t;
+
+/* The system calls of a number made on a CPU, since the last reset */
+typedef struct {
+	unsigned int cpu;
+	unsigned int num;           /* The number of its gate */
+	unsigned int calls;
+	unsigned int errors;        /* Calls which returned a negative value */
+	/* Calls which took between 2^i and 2^(i+1) - 1 TSC cycles in bucket i,
+	 * the longer ones in the last bucket */
+	unsigned int latency[KSTAT_LATENCY_BUCKETS];
+} kstat_syscall_t;
+
+/* The same-page merging scanner, when the kernel runs it */
+typedef struct {
+	unsigned int scanned;       /* Pages looked at since the last reset */
+	unsigned int merged;        /* Frames freed since the last reset, their
+                                   pages mapping an identical frame now */
+	unsigned int collisions;    /* Equal hashes of different pages */
+	unsigned int rounds;        /* Scans of every process */
+	unsigned int stable;        /* Frames the pages are merged into */
+	unsigned int sharing;       /* Pages mapping them right now */
+} kstat_ksm_t;
+
+/* The log on the serial port */
+typedef struct {
+	unsigned int records;       /* Records queued since the last reset */
+	unsigned int dropped;       /* Records dropped since the last reset, the
+                                   log being full */
+	unsigned int bytes;         /* Bytes queued since the last reset */
+	unsigned int pending;       /* Bytes not sent yet */
+} kstat_serial_t;
+
+/* The reclaim of the frames held by the caches, under memory pressure */
+typedef struct {
+	unsigned int wakeups;       /* Runs of the reclaimer since the last reset */
+	unsigned int direct;        /* Reclaims done by faulting threads */
+	unsigned int reclaimed;     /* Frames given back by the caches */
+	unsigned int drained;       /* Zeroed frames given back to the free
+                                   lists */
+	unsigned int tables;        /* Cached page tables given back to the
+                                   kernel heap */
+	unsigned int stalls;        /* Faults which waited for memory */
+	unsigned int failures;      /* Faults which failed anyway */
+	unsigned int available;     /* Frames available right now */
+} kstat_reclaim_t;
+
+/* The earliest-deadline-first class on a CPU */
+typedef struct {
+	unsigned int cpu;
+	unsigned int bandwidth;     /* Thousandths of the CPU admitted */
+	unsigned int members;       /* Threads in the class */
+	unsigned int queued;        /* Of them ready to run */
+	unsigned int throttled;     /* Of them runnable but out of budget */
+	unsigned int admitted;      /* Threads which joined since the last reset */
+	unsigned int rejected;      /* Joins refused since the last reset */
+	unsigned int throttles;     /* Budgets run out since the last reset */
+	unsigned int misses;        /* Deadlines run past since the last reset */
+} kstat_edf_t;
+
+/* The pool of zeroed page tables */
+typedef struct {
+	unsigned int hits;          /* Tables handed out from the pool since the
+                                   last reset */
+	unsigned int misses;        /* Tables which had to come from the heap */
+	unsigned int recycled;      /* Freed tables kept in the pool */
+	unsigned int released;      /* Freed tables given back to the heap */
+	unsigned int cached;        /* Tables in the pool right now */
+} kstat_ptpool_t;
+
+/* The phases of the boot, in the order they end */
+#define KSTAT_BOOT_KERNEL_MAP   0   /* The direct map of the kernel */
+#define KSTAT_BOOT_FRAMES       1   /* The table of the frame allocator */
+#define KSTAT_BOOT_PAGING       2   /* The rest of install_paging */
+#define KSTAT_BOOT_THREADS      3   /* The slabs, threads and their helpers */
+#define KSTAT_BOOT_SYSCALLS     4
+#define KSTAT_BOOT_HANDLERS     5   /* The drivers, timer calibration included */
+#define KSTAT_BOOT_GOD          6   /* The god process, up to its exec */
+#define KSTAT_BOOT_USER_GOD     7   /* First user instruction of god */
+#define KSTAT_BOOT_USER_IDLE    8   /* Of idle */
+#define KSTAT_BOOT_USER_INIT    9   /* Of init */
+#define KSTAT_BOOT_PHASES       10
+
+/* The timeline of the boot */
+typedef struct {
+	unsigned int tsc_khz;       /* Cycles of the TSC in a millisecond */
+	unsigned int unused;
+	unsigned long long end[KSTAT_BOOT_PHASES]; /* TSC cycles from the entry
+                                   of the kernel to the end of each phase,
+                                   0 if it didn't end yet */
+} kstat_boot_t;
+
+#endif /* _KSTAT_H */
@@ -0,0 +1,71 @@
+/** @file memstat.h
+ *  @brief The memory used by a process, as returned by memstat
+ *
+ *  All the counts are in pages. A frame is shared when some other process,
+ *  or the cache of a program image, maps it too, and private otherwise. A
+ *  page table is shared with the processes forked from the same parent that
+ *  didn't write to its 4MB region yet.
+ *
+ *  set_frame_limit(frames) puts the calling process, which must have a
+ *  single thread, in a new group limited to that many frames, nested in its
+ *  current group. Its children join the group. Every frame a process holds,
+ *  including those shared copy on write since a fork, is charged to its
+ *  group; new_pages, fork, exec, shm_attach and map_file fail once the
+ *  group would go over its limit.
+ *
+ *  new_pages(base, len | NEW_PAGES_GROWSDOWN) makes a stack of at most len
+ *  bytes below base + len. Only its top page is mapped at first, the kernel
+ *  maps more as the stack grows down, and remove_pages(base) removes it.
+ *  The main stack of a program is such a stack, of 8MB under its arguments.
+ *
+ *  new_pages(base, len | NEW_PAGES_LAZY) makes a region of which each page
+ *  is mapped when first touched, on a zeroed frame. Nothing is reserved, so
+ *  the region may be far larger than memory; a page the kernel can't fill
+ *  faults to the swexn handler. With NEW_PAGES_TEMPLATE as well, only the
+ *  first page is mapped at first, and every other page starts as a copy of
+ *  the first one as it is when the page is touched. map_file(filename,
+ *  base | MAP_FILE_LAZY) maps each page of the file when first touched.
+ *
+ *  The working set comes from a kernel scanner, which samples and clears
+ *  the accessed bits of a 4MB region of a process at a time. A round is a
+ *  scan of the whole address space of the process. The pages sampled are
+ *  counted by the rounds since they were last touched: idle[0] those
+ *  touched during the last round, which is the working set, then idle[i]
+ *  those untouched for 2^(i-1) to 2^i - 1 rounds, the last bucket holding
+ *  all the older ones. Page tables shared since a fork are not sampled.
+ */
+
+#ifndef _MEMSTAT_H
+#define _MEMSTAT_H
+
+/* Flags of the length given to new_pages, which is otherwise page-aligned */
+#define NEW_PAGES_GROWSDOWN 0x1
+#define NEW_PAGES_LAZY      0x2
+#define NEW_PAGES_TEMPLATE  0x4
+/* Flag of the address given to map_file */
+#define MAP_FILE_LAZY       0x1
+
+/* Buckets of the histogram of the idle pages */
+#define MEMSTAT_IDLE_BUCKETS 6
+
+typedef struct {
+	unsigned int rss;           /* Pages mapped to a frame */
+	unsigned int shared;        /* Of which shared frames */
+	unsigned int private;       /* And private ones */
+	unsigned int peak_rss;      /* The most rss ever was */
+	unsigned int zero;          /* Zero pages not written to yet, which
+	                               hold a reserved frame each */
+	unsigned int page_tables;   /* Page tables in use */
+	unsigned int shared_page_tables;
+	unsigned int limit;         /* Frames the group of the process may hold,
+	                               0 if there is no limit */
+	unsigned int charged;       /* Frames the group holds */
+	unsigned int rounds;        /* Rounds of the working-set scanner */
+	unsigned int idle[MEMSTAT_IDLE_BUCKETS]; /* Pages sampled, by the rounds
+	                               since they were last touched */
+	unsigned int dirty;         /* Of which pages written to */
+	unsigned int cow;           /* And pages still copy on write, which
+	                               nobody wrote to since they were shared */
+} memstat_t;
+
+#endif /* _MEMSTAT_H */
@@ -0,0 +1,32 @@
+/** @file prof.h
+ *  @brief The sampling profiler, driven by the profile system call
+ *
+ *  While the profiler runs, every timer tick records where the CPU was
+ *  interrupted, in a ring of PROF_RING_SIZE samples per CPU. PROF_DRAIN
+ *  copies the samples out, the oldest first. The samples taken while a ring
+ *  is full are dropped and counted.
+ */
+
+#ifndef _PROF_H
+#define _PROF_H
+
+/* Operations of profile(op, buf, len) */
+#define PROF_START  0   /* Forgets the samples taken so far and starts */
+#define PROF_STOP   1   /* Stops, returns the samples dropped since starting */
+#define PROF_DRAIN  2   /* Copies at most len bytes of samples to buf, returns
+                           the number of samples copied */
+
+/* Samples kept per CPU, a power of two */
+#define PROF_RING_SIZE  1024
+
+/* Where a CPU was at a tick */
+typedef struct {
+	unsigned int eip;
+	int tid;                /* The thread running */
+	int pid;                /* And its process */
+	unsigned char cpu;
+	unsigned char user;     /* Was it in user mode? */
+	unsigned short unused;
+} prof_sample_t;
+
+#endif /* _PROF_H */
@@ -0,0 +1,30 @@
+/** @file rusage.h
+ *  @brief The CPU time used, as returned by getrusage
+ *
+ *  The kernel counts the cycles of the time stamp counter each thread runs
+ *  in user mode and in kernel mode: the system calls, the timer interrupts
+ *  and the page faults are kernel time, the rest of what a thread runs is
+ *  user time. A thread which vanishes leaves its time to its process, and a
+ *  process collected by wait() leaves its time, along with that of the
+ *  children it collected itself, to its parent.
+ *
+ *  getrusage(who, usage) fills usage with the time of the calling thread,
+ *  of its whole process or of the children the process collected.
+ */
+
+#ifndef _RUSAGE_H
+#define _RUSAGE_H
+
+/* Whose time getrusage reports */
+#define RUSAGE_SELF     0   /* The calling process, all its threads */
+#define RUSAGE_CHILDREN 1   /* Its children collected by wait, and theirs */
+#define RUSAGE_THREAD   2   /* The calling thread */
+
+typedef struct {
+	unsigned long long user_cycles;
+	unsigned long long kernel_cycles;
+	unsigned long long user_ns;
+	unsigned long long kernel_ns;
+} rusage_t;
+
+#endif /* _RUSAGE_H */
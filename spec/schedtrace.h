@@ -0,0 +1,55 @@
+/** @file schedtrace.h
+ *  @brief The trace of the scheduler, driven by the sched_trace system call
+ *
+ *  While tracing is on, the kernel records every context switch and every
+ *  wakeup of a thread, in a ring of SCHED_TRACE_SIZE events per CPU. The
+ *  timestamps are TSC cycles, SCHED_TRACE_RATE tells how many the TSC
+ *  counts in a millisecond. The events of the CPUs are drained one CPU after
+ *  the other: sort them by timestamp to replay them.
+ */
+
+#ifndef _SCHEDTRACE_H
+#define _SCHEDTRACE_H
+
+/* Operations of sched_trace(op, buf, len) */
+#define SCHED_TRACE_START   0   /* Forgets the events so far and starts */
+#define SCHED_TRACE_STOP    1   /* Stops, returns the events dropped */
+#define SCHED_TRACE_DRAIN   2   /* Copies at most len bytes of events to buf,
+                                   returns the number of events copied */
+#define SCHED_TRACE_RATE    3   /* Returns the TSC cycles per millisecond */
+
+/* Events kept per CPU, a power of two */
+#define SCHED_TRACE_SIZE    4096
+
+/* Kinds of events */
+#define SCHED_EV_SWITCH     0   /* tid was switched out for other */
+#define SCHED_EV_WAKEUP     1   /* tid was made runnable by other */
+
+/* Why a thread was switched out */
+#define SCHED_SWITCH_TICK   0   /* Its quantum was over, or more urgent work */
+#define SCHED_SWITCH_YIELD  1
+#define SCHED_SWITCH_BLOCK  2   /* deschedule, or a lock */
+#define SCHED_SWITCH_SLEEP  3
+#define SCHED_SWITCH_WAIT   4   /* For a child */
+#define SCHED_SWITCH_VANISH 5
+#define SCHED_SWITCH_IDLE   6   /* Idle, once someone can run */
+#define SCHED_SWITCH_HANDOFF 7  /* Runnable, giving the CPU to another */
+
+/* Who made a thread runnable */
+#define SCHED_WAKE_TIMER    0   /* Its sleep was over */
+#define SCHED_WAKE_MAKE_RUNNABLE 1
+#define SCHED_WAKE_CHILD    2   /* A child to collect */
+#define SCHED_WAKE_OTHER    3   /* A lock, a futex or a condition */
+
+typedef struct {
+	unsigned long long tsc;
+	unsigned char type;         /* SCHED_EV_* */
+	unsigned char reason;       /* SCHED_SWITCH_* or SCHED_WAKE_* */
+	unsigned char cpu;
+	unsigned char unused;
+	int tid;
+	int other;                  /* The thread switched to, or the one which
+                                   woke tid up, -1 for the timer */
+} sched_event_t;
+
+#endif /* _SCHEDTRACE_H */
@@ -16,6 +16,7 @@
 /* Life cycle */
 int fork(void);
 int exec(char *execname, char *argvec[]);
+int spawn(char *execname, char *argvec[]);
 void set_status(int status);
 void vanish(void) NORETURN;
 int wait(int *status_ptr);
@@ -28,12 +29,45 @@ int deschedule(int *flag);
 int make_runnable(int pid);
 unsigned int get_ticks(void);
 int sleep(int ticks);
+int usleep(unsigned int usecs);
+int get_time_ns(unsigned long long *ns);
+int set_nice(int nice);
 
 /* Memory management */
 int new_pages(void * addr, int len);
 int remove_pages(void * addr);
+int shm_create(void * addr, int len);
+int shm_attach(int id, void * addr);
+int shm_detach(void * addr);
+int map_file(char *filename, void * addr);
+#include <memstat.h>
+int memstat(memstat_t *stat);
+int set_frame_limit(int frames);
 
-/* Console I/O */
+/* Pipes, whole aligned pages of the buffers move without being copied */
+int pipe_create(void);
+int pipe_write(int id, const void *buf, int len);
+int pipe_read(int id, void *buf, int len);
+int pipe_close(int id);
+
+/* Synchronous messages between threads */
+#include <ipc.h>
+int ipc_call(int tid, ipc_msg_t *msg);
+int ipc_receive(ipc_msg_t *msg);
+int ipc_reply(int tid, ipc_msg_t *msg);
+int ipc_reply_wait(int tid, ipc_msg_t *msg);
+
+/* Earliest-deadline-first scheduling, budget ticks every period ticks within
+ * deadline ticks of its start, a budget of 0 to leave it */
+int set_deadline(unsigned int budget, unsigned int deadline,
+	unsigned int period);
+
+/* CPU time of the thread, its process or the children the process waited
+ * for */
+#include <rusage.h>
+int getrusage(int who, rusage_t *usage);
+
+/* Console I/O, print(0, buf) returns once all that was printed is shown */
 char getchar(void);
 int readline(int size, char *buf);
 int print(int size, char *buf);
@@ -67,10 +101,23 @@ int get_cursor_pos(int *row, int *col);
 #define BGND_MAG   0x50
 #define BGND_BRWN  0x60
 #define BGND_LGRAY 0x70 /* Light gray. */
+#include <vterm.h>
 
 /* Miscellaneous */
 void halt();
 int readfile(char *filename, char *buf, int count, int offset);
+#include <kstat.h>
+#include <kdata.h>
+#include <sysring.h>
+#include <prof.h>
+#include <schedtrace.h>
+int kstat(int what, void *buf, int len);
+int futex_wait(int *addr, int expected);
+int futex_wake(int *addr, int n);
+int sysring_enter(sysring_t *ring);
+int make_runnable_many(int *tids, int n);
+int profile(int op, void *buf, int len);
+int sched_trace(int op, void *buf, int len);
 
 /* "Special" */
 void misbehave(int mode);
@@ -66,4 +66,35 @@
 #define SYSCALL_RESERVED_15       0x8F
 #define SYSCALL_RESERVED_END      0x8F
 
+/* Extensions to the spec, using the reserved syscall numbers */
+#define SPAWN_INT           SYSCALL_RESERVED_0
+#define SHM_CREATE_INT      SYSCALL_RESERVED_1
+#define SHM_ATTACH_INT      SYSCALL_RESERVED_2
+#define SHM_DETACH_INT      SYSCALL_RESERVED_3
+#define MAP_FILE_INT        SYSCALL_RESERVED_4
+#define SET_NICE_INT        SYSCALL_RESERVED_5
+#define KSTAT_INT           SYSCALL_RESERVED_6
+#define FUTEX_WAIT_INT      SYSCALL_RESERVED_7
+#define FUTEX_WAKE_INT      SYSCALL_RESERVED_8
+#define SYSRING_INT         SYSCALL_RESERVED_9
+#define USLEEP_INT          SYSCALL_RESERVED_10
+#define GET_TIME_NS_INT     SYSCALL_RESERVED_11
+#define PROFILE_INT         SYSCALL_RESERVED_12
+#define SCHED_TRACE_INT     SYSCALL_RESERVED_13
+#define MEMSTAT_INT         SYSCALL_RESERVED_14
+#define SET_FRAME_LIMIT_INT SYSCALL_RESERVED_15
+
+/* Extensions to the spec with no gate, made with sysenter only, using
+ * numbers the spec leaves unassigned */
+#define PIPE_CREATE_INT     0x63
+#define PIPE_WRITE_INT      0x64
+#define PIPE_READ_INT       0x65
+#define PIPE_CLOSE_INT      0x66
+#define IPC_CALL_INT        0x67
+#define IPC_RECEIVE_INT     0x68
+#define IPC_REPLY_INT       0x69
+#define IPC_REPLY_WAIT_INT  0x6A
+#define SET_DEADLINE_INT    0x6B
+#define GETRUSAGE_INT       0x6C
+
 #endif /* _SYSCALL_INT_H */
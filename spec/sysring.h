@@ -0,0 +1,42 @@
+/** @file sysring.h
+ *  @brief The ring of system calls submitted together
+ *
+ *  A program fills the ring with requests, from tail on, and makes them all
+ *  with a single sysring_enter. The kernel makes them in order from head,
+ *  stores the result of each in its request and moves head past it, until
+ *  it reaches the tail it read on entry. A system call which returns an
+ *  error doesn't stop the next ones.
+ *
+ *  Only the system calls which neither create nor destroy threads, nor
+ *  replace the program, may be batched: yield, make_runnable, new_pages,
+ *  remove_pages, print, set_term_color, set_cursor_pos and futex_wake. The
+ *  batch stops at any other request, which is left at head.
+ *
+ *  Consecutive make_runnable requests wake their threads all at once, and
+ *  make_runnable_many(tids, n) submits such requests. make_runnable doesn't
+ *  give the CPU to the thread it wakes up, unless the scheduler prefers it
+ *  to the caller.
+ */
+
+#ifndef _SYSRING_H
+#define _SYSRING_H
+
+/* The most requests a ring can have */
+#define SYSRING_MAX_SIZE    1024
+
+/* A system call, as it would be made alone */
+typedef struct {
+	int num;                    /* The number of its gate, @see syscall_int.h */
+	void *arg;                  /* What it takes in %esi */
+	int result;                 /* What it returned, filled by the kernel */
+} sysreq_t;
+
+/* The ring, in user memory, followed by its size requests */
+typedef struct {
+	volatile unsigned int head; /* Next request the kernel makes */
+	volatile unsigned int tail; /* Next request the program fills */
+	unsigned int size;          /* A power of two, up to SYSRING_MAX_SIZE */
+	sysreq_t reqs[0];           /* Request i is at reqs[i & (size - 1)] */
+} sysring_t;
+
+#endif /* _SYSRING_H */
@@ -17,6 +17,12 @@
 #define SWEXN_CAUSE_ALIGNFAULT   0x11
 #define SWEXN_CAUSE_SIMDFAULT    0x13  /* SSE/SSE2 FPU is angry */
 
+/* Flag of the esp3 given to swexn: the handler stays registered when it is
+ * called, instead of having to register again */
+#define SWEXN_PERSISTENT         0x1
+/* The esp3 resuming with newureg and keeping the handler registered */
+#define SWEXN_RESUME             ((void *) SWEXN_PERSISTENT)
+
 #ifndef ASSEMBLER
 
 typedef struct ureg_t {
@@ -0,0 +1,18 @@
+/** @file vterm.h
+ *  @brief The virtual terminals
+ *
+ *  The console has several virtual terminals, each with its own screen,
+ *  cursor, color and input. A process prints to and reads from the terminal
+ *  of its parent, the first one for init. set_term_color(TERM_ATTACH | n)
+ *  makes terminal n, from 0, the one of the calling process and of its
+ *  future children, and doesn't change the color. Alt with the digit n + 1
+ *  puts terminal n on screen, and what is typed then goes to it.
+ */
+
+#ifndef _VTERM_H
+#define _VTERM_H
+
+/* Flag of the color given to set_term_color, which is otherwise a byte */
+#define TERM_ATTACH 0x100
+
+#endif /* _VTERM_H */
@@ -6,12 +6,14 @@
 #define _COND_TYPE_H
 
 #include <inc/types.h>
-#include "list.h"
+
+struct cond_waiter;
 
 typedef struct cond {
-	boolean_t initialized;	// Is the condvar initialized
-	mutex_t *mutex;			// Mutex protecting the data structure
-	list_t *waiting_list;	// List of threads waiting to be signaled
+	boolean_t initialized;		// Is the condvar initialized
+	mutex_t *mutex;				// Mutex protecting the data structure
+	struct cond_waiter *first;	// Oldest thread waiting to be signaled
+	struct cond_waiter *last;	// Newest one
 } cond_t;
 
 #endif /* _COND_TYPE_H */
@@ -6,14 +6,15 @@
 #define _MUTEX_TYPE_H
 
 #include <inc/types.h>
-#include "list.h"
+
+/* The states of a mutex */
+#define MUTEX_FREE		0	// Nobody's in
+#define MUTEX_LOCKED	1	// Somebody's in, nobody waits
+#define MUTEX_CONTENDED	2	// Somebody's in, threads may wait in the kernel
 
 typedef struct mutex {
 	boolean_t initialized;	// Is the mutex initialized
-	boolean_t mutex_lock;	// Is someone performing changes on the STRUCTURE
-	int owner;				// Who is in the mutex (=locked). -1 if nobody's in
-	int id;					// Identifier for the mutex, used for debugging
-	list_t *waiting_list;	// List of threads waiting to enter the mutex
+	int state;				// MUTEX_FREE, MUTEX_LOCKED or MUTEX_CONTENDED
 } mutex_t;
 
 
@@ -7,14 +7,10 @@
 
 #include <inc/types.h>
 
-#include <inc/mutex.h>
-#include <inc/cond.h>
-
 typedef struct sem {
 	boolean_t initialized;	// Is the semaphore initialized
-	int n;					// The "free slots" count
-	mutex_t *mutex;			// Mutex protecting the data structure
-	cond_t *free_slots;		// Condition signaling that some slots are free
+	int n;					// The "free slots" count, never negative
+	int waiters;			// Threads waiting for a free slot
 } sem_t;
 
 #endif /* _SEM_TYPE_H */
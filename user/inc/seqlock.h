@@ -0,0 +1,53 @@
+/** @file seqlock.h
+ *  @brief Sequence locks, for small data read often and rarely written
+ *
+ *  The readers note the sequence number before they read and check it is
+ *  unchanged afterwards, or read again; they never write to the lock.
+ *
+ *      int seq;
+ *      do {
+ *          seq = seq_read_begin(&lock);
+ *          ... copy the data ...
+ *      } while (seq_read_retry(&lock, seq));
+ */
+
+#ifndef _SEQLOCK_H
+#define _SEQLOCK_H
+
+#include <syscall.h>
+#include "seqlock_type.h"
+
+int seqlock_init(seqlock_t *sl);
+void seqlock_destroy(seqlock_t *sl);
+void seq_write_lock(seqlock_t *sl);
+void seq_write_unlock(seqlock_t *sl);
+
+/* Keeps the compiler from moving memory accesses across it */
+#define SEQ_BARRIER() asm volatile ("" : : : "memory")
+
+/**
+ * @brief Starts a read, once the writer in left
+ *
+ * The writer may have been switched out, we let it run meanwhile.
+ *
+ * @return the sequence number to give to seq_read_retry
+ */
+static inline int seq_read_begin(seqlock_t *sl) {
+	int seq;
+	while ((seq = sl->seq) & 1) yield(-1);
+	SEQ_BARRIER();
+	return seq;
+}
+
+/**
+ * @brief Ends a read
+ *
+ * @param seq the number seq_read_begin returned
+ * @return TRUE if a writer came in meanwhile and the read has to be redone
+ */
+static inline boolean_t seq_read_retry(seqlock_t *sl, int seq) {
+	SEQ_BARRIER();
+	return sl->seq != seq;
+}
+
+#endif /* _SEQLOCK_H */
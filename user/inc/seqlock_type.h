@@ -0,0 +1,17 @@
+/** @file seqlock_type.h
+ *  @brief This file defines the type for sequence locks.
+ */
+
+#ifndef _SEQLOCK_TYPE_H
+#define _SEQLOCK_TYPE_H
+
+#include <inc/types.h>
+#include "mutex_type.h"
+
+typedef struct seqlock {
+	boolean_t initialized;	// Is the lock initialized
+	volatile int seq;		// Odd while a writer is in
+	mutex_t writer;			// Serializes the writers
+} seqlock_t;
+
+#endif /* _SEQLOCK_TYPE_H */
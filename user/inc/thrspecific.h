@@ -0,0 +1,26 @@
+/** @file thrspecific.h
+ *  @brief Values private to each thread, under keys shared by all of them
+ *
+ *  A key is made once, by any thread, and each thread then has its own
+ *  value under it, NULL until the thread sets it:
+ *
+ *      static int key;
+ *      thr_key_create(&key);
+ *      thr_setspecific(key, state);
+ *      ... state = thr_getspecific(key);
+ *
+ *  Keys are never deleted, and the values are left alone when their thread
+ *  exits.
+ */
+
+#ifndef _THRSPECIFIC_H
+#define _THRSPECIFIC_H
+
+/* Keys a program may make */
+#define THR_KEYS_MAX 32
+
+int thr_key_create(int *key);
+int thr_setspecific(int key, void *value);
+void *thr_getspecific(int key);
+
+#endif /* _THRSPECIFIC_H */
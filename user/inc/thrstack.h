@@ -0,0 +1,18 @@
+/** @file thrstack.h
+ *  @brief The pool of thread stacks
+ *
+ *  The stack of a joined thread is kept mapped for the next thread created,
+ *  up to a number of stacks; past it, it is unmapped and only its place in
+ *  the address space is reused. thr_stack_pool(n) changes that number,
+ *  THR_STACK_POOL by default, and unmaps the stacks over it.
+ */
+
+#ifndef _THRSTACK_H
+#define _THRSTACK_H
+
+/* Stacks kept mapped by default */
+#define THR_STACK_POOL 8
+
+int thr_stack_pool(unsigned int stacks);
+
+#endif /* _THRSTACK_H */
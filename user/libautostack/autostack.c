@@ -3,32 +3,22 @@
  * @author Daniel Balle (dballe)
  * @author Loic Ottet (lottet)
  * 
- * @brief Implements automatic stack growth for legacy single threaded programs
+ * @brief Installs the exception handler of legacy single threaded programs
  * 
- * Registers an exception handler to handle page faults in a single threaded
- * program. If a page fault is catched, the handler sees if it is within a
- * reasonable range under the current stack and if it is the case tries to
- * expand the stack. If, for any reason, this process fails, the handler
- * passes the instruction back to the execution to trigger the actual kernel 
- * exception.
+ * The main stack used to be grown here, by a page fault handler mapping more
+ * pages under it with new_pages. The kernel now grows the main stack itself,
+ * right from its page fault handler (see growstack.c in the kernel), so any
+ * exception reaching the handler is a real one: it reports the exception and
+ * kills the task, or lets the program go on after a trap. The handler is
+ * registered persistent, so that going on doesn't register it again.
  * 
  * @bugs No bugs known
  */
 
 #include <stdlib.h>
 #include <syscall.h>
-#include <assert.h>
 
 #define STACK_SIZE_WORDS (PAGE_SIZE/sizeof(void *)) // # of words in a page
-#define MAX_ENLARGEMENT_POWER 6 // Stack growth will be at most 2^6 = 64 pages
-
-/**
- * The structure represents the limits of a stack space
- */
-typedef struct stack_limits {
-	unsigned int stack_high;	// Highest address in the stack
-	unsigned int stack_low;		// Lowest address in the stack
-} stack_limits_t;
 
 // Pointer to a free allocated memory zone for the handler to have a stack
 static void **exception_stack = NULL;
@@ -36,50 +26,10 @@ static void **exception_stack = NULL;
 /**
  * @brief Handles the exceptions received
  * 
- * If this is a page fault, does stuff according the the file description
- * 
- * @param arg the limits of the current stack region
+ * @param arg the top of the exception stack
  * @param ureg the processor state at the moment of the fault
  */
 void swexn_handler(void *arg, ureg_t *ureg) {
-	stack_limits_t *stack_limits = (stack_limits_t *) arg;
-	if (ureg->cause == SWEXN_CAUSE_PAGEFAULT) {
-		// We have catched a page fault
-
-		/* We have to check that the address is in a valid expansion region
-		 * (twice the actual stack)
-		 */
-		unsigned int illegal_value = (unsigned int) ureg->cr2;
-		unsigned int stack_size = stack_limits->stack_high
-			- stack_limits->stack_low + 4;
-		assert(stack_size % PAGE_SIZE == 0);
-
-		int i, k;
-		for (i = 1, k = 1; i <= MAX_ENLARGEMENT_POWER; ++i, k *= 2) {
-			unsigned int new_stack_pages = k - 1;
-			unsigned int new_stack_low = stack_limits->stack_low
-				- new_stack_pages * PAGE_SIZE;
-
-			if (illegal_value < stack_limits->stack_low
-				&& illegal_value >= new_stack_low) {
-				// We increase the stack
-				if (new_pages((void *) new_stack_low,
-						new_stack_pages * PAGE_SIZE) == 0) {
-					/* We reexecute the instruction as usual, and reexecute
-					 * the incriminated instruction
-					 */
-					stack_limits->stack_low = new_stack_low;
-					swexn(exception_stack[STACK_SIZE_WORDS - 1], swexn_handler,
-						stack_limits, ureg);
-					return;
-				}
-			}
-		}
-		
-	}
-	/* This is a classic exception, we just have to handle the fault and exit
-	 * the program
-	 */
 	switch(ureg->cause) {
 		case SWEXN_CAUSE_DIVIDE:
 			panic("Exception triggered: Division by 0.\n"
@@ -129,8 +79,7 @@ void swexn_handler(void *arg, ureg_t *ureg) {
 		case SWEXN_CAUSE_BREAKPOINT:
 		case SWEXN_CAUSE_OVERFLOW:
 			// Ignore those, they will continue at the next instruction
-			swexn(exception_stack, swexn_handler,
-				stack_limits, ureg);
+			swexn(SWEXN_RESUME, NULL, NULL, ureg);
 			break;
 		default:
 			// If this happens, then this is way worse than any of the above
@@ -142,7 +91,8 @@ void swexn_handler(void *arg, ureg_t *ureg) {
 /**
  * @brief Registers the exception handler at the beginning of the program
  * 
- * Allocates a stack and registers the handler
+ * Allocates a stack and registers the handler. The limits of the original
+ * stack are not needed anymore, the kernel knows them.
  * 
  * @param stack_high the highest address of the original stack
  * @param stack_low the lowest address of the original stack
@@ -150,14 +100,8 @@ void swexn_handler(void *arg, ureg_t *ureg) {
 void install_autostack(void *stack_high, void *stack_low) {
 	// Allocate exception stack (on the heap, yes...)
 	exception_stack = calloc(PAGE_SIZE, sizeof(char));
-	
-	// Create the stack_limits structure
-	stack_limits_t *stack_limits = malloc(sizeof(stack_limits_t));
-	stack_limits->stack_high = (unsigned int) stack_high;
-	stack_limits->stack_low = (unsigned int) stack_low;
 
 	// Register exception handler
-	swexn(&(exception_stack[STACK_SIZE_WORDS - 1]), swexn_handler,
-		stack_limits, NULL);
+	void *top = &(exception_stack[STACK_SIZE_WORDS - 1]);
+	swexn((char *) top + SWEXN_PERSISTENT, swexn_handler, top, NULL);
 }
-
@@ -0,0 +1,17 @@
+/**
+ * @file get_ticks.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief get_ticks, without entering the kernel
+ */
+
+#include <syscall.h>
+
+/**
+ * @return the number of timer ticks since boot, which the kernel keeps in
+ * its shared data page
+ */
+unsigned int get_ticks(void) {
+	return KDATA->ticks;
+}
@@ -0,0 +1,17 @@
+/**
+ * @file gettid.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief gettid, without entering the kernel
+ */
+
+#include <syscall.h>
+
+/**
+ * @return the id of the calling thread, which the kernel keeps in the data
+ * page of the process while the thread runs
+ */
+int gettid(void) {
+	return KDATA_TASK->tid;
+}
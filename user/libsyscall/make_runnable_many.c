@@ -0,0 +1,58 @@
+/**
+ * @file make_runnable_many.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ *
+ * @brief make_runnable_many, a batch of make_runnable in a ring
+ */
+
+#include <syscall.h>
+#include <stddef.h>
+#include <syscall_int.h>
+
+/* Requests in the ring, as many as the kernel wakes together */
+#define MANY_RING_SIZE 32
+
+/**
+ * @brief Makes descheduled threads runnable, MANY_RING_SIZE at a time
+ *
+ * The kernel makes consecutive make_runnable requests of a ring in one go.
+ * The threads woken up wait for their turn, the caller keeps running.
+ *
+ * @param tids the thread ids
+ * @param n the number of ids
+ * @return the number of threads made runnable, a negative error code if
+ * the ids are invalid
+ */
+int make_runnable_many(int *tids, int n) {
+	int buf[(sizeof(sysring_t) + MANY_RING_SIZE * sizeof(sysreq_t))
+		/ sizeof(int)];
+	sysring_t *ring = (sysring_t *) buf;
+
+	if (tids == NULL || n < 0) return -1;
+
+	int woken = 0;
+	int done = 0;
+	while (done < n) {
+		int count = n - done;
+		if (count > MANY_RING_SIZE) count = MANY_RING_SIZE;
+
+		ring->head = 0;
+		ring->tail = count;
+		ring->size = MANY_RING_SIZE;
+
+		int i;
+		for (i = 0; i < count; ++i) {
+			ring->reqs[i].num = MAKE_RUNNABLE_INT;
+			ring->reqs[i].arg = (void *) tids[done + i];
+			ring->reqs[i].result = -1;
+		}
+
+		if (sysring_enter(ring) < 0) return -1;
+		for (i = 0; i < count; ++i)
+			if (ring->reqs[i].result == 0) woken++;
+		done += count;
+	}
+
+	return woken;
+}
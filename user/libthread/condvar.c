@@ -9,6 +9,11 @@
  * thread at a time can act on the condvar's data structures. Threads register
  * themselves in a waiting list and are awaken when signals are emitted,
  * either one at a time or via a broadcast call.
+ *
+ * Each waiter is a node on its own stack and sleeps in the kernel on a word
+ * of that node (@see futex_wait) until a signal sets it. A signal thus wakes
+ * exactly the oldest waiter, and a signal nobody waits for costs neither an
+ * atomic instruction nor a system call.
  * 
  * @bugs No bugs known
  */
@@ -24,8 +29,8 @@
 #include "mutex_type.h"
 #include "cond_type.h"
 
-#include "list.h"
 #include "p2thread.h"
+#include "mutex.h"
 
 #include "condvar.h"
 
@@ -45,8 +50,8 @@ int cond_init(cond_t *cv) {
 	if (mutex_init(cv->mutex) != 0) return -1;
 
 	// Data structure initialization
-	cv->waiting_list = list_init();
-	if (cv->waiting_list == NULL) return -3;
+	cv->first = NULL;
+	cv->last = NULL;
 
 	// We're done, we can use the condition
 	cv->initialized = TRUE;
@@ -67,10 +72,8 @@ void cond_destroy(cond_t *cv) {
 	// We can't use the condvar anymore
 	cv->initialized = FALSE;
 
-	// Destroy the list
-	assert(list_size(cv->waiting_list) == 0);
-	list_destroy(cv->waiting_list);
-	cv->waiting_list = NULL;
+	// Nobody may be waiting
+	assert(cv->first == NULL);
 
 	// Destroy the mutex
 	mutex_destroy(cv->mutex);
@@ -81,10 +84,10 @@ void cond_destroy(cond_t *cv) {
 /**
  * @brief Waits for the given condition to be signaled
  * 
- * The thread adds itself to the waiting list, and deschedules itself until it
- * is awaken by a signal or broadcast call. Ensuring that the unlocking of the
- * mutex and the descheduling are "atomical" is taken care of in
- * awaken_first_thread.
+ * The thread adds itself to the waiting list, and sleeps until it is awaken
+ * by a signal or broadcast call. A signal sent between the release of the
+ * mutex and the sleep isn't lost: the kernel only lets us sleep as long as
+ * our node isn't signaled.
  * 
  * @param mp the mutex to release while we are waiting for the signal, and to
  * reacquire afterwards
@@ -93,45 +96,79 @@ void cond_wait(cond_t *cv, mutex_t *mp) {
 	// Can't wait on an uninitialized mutex
 	assert(cv->initialized);
 
+	cond_waiter_t me;
+	me.signaled = FALSE;
+	me.next = NULL;
+
 	// Enter critical section
 	mutex_lock(cv->mutex);
 
 	// We register ourselves on the list
-	list_addLast(cv->waiting_list, gettid());
+	if (cv->last != NULL) cv->last->next = &me;
+	else cv->first = &me;
+	cv->last = &me;
 
 	// We release the mutex
 	mutex_unlock(mp);
-
-	// We deschedule ourselves
-	int i = 0;
 	mutex_unlock(cv->mutex);
-	deschedule(&i);
+
+	// We sleep until signaled, the kernel may wake us up for nothing
+	while (!*(volatile int *) &me.signaled)
+		futex_wait(&me.signaled, FALSE);
 
 	// We're back, we acquire the mutex and continue execution
 	mutex_lock(mp);
 }
 
+/**
+ * @brief Removes the first thread of the waiting list. The mutex of the
+ * condition must be held.
+ *
+ * @return the waiter, NULL if there is none
+ */
+static cond_waiter_t *remove_first(cond_t *cv) {
+	cond_waiter_t *waiter = cv->first;
+	if (waiter != NULL) {
+		cv->first = waiter->next;
+		if (cv->first == NULL) cv->last = NULL;
+	}
+	return waiter;
+}
+
+/**
+ * @brief Signals a waiter out of the waiting list and wakes it up
+ *
+ * The waiter may return as soon as it sees the signal, before we wake it
+ * up. The wake up then goes to the next wait on that word of its stack, if
+ * any, which survives it since every wait checks its word again.
+ */
+static void awaken(cond_waiter_t *waiter) {
+	atomic_exchange(&waiter->signaled, TRUE);
+	futex_wake(&waiter->signaled, 1);
+}
+
 /**
  * @brief Wakes the first thread in the waiting list
  * 
  * If no threads wait on the condition (at the moment we call it, or more
  * exactly when we acquire the mutex), this function has no effect (the signal
- * is lost).
+ * is lost). The waiters join the list before they release the mutex they
+ * wait with, so a signaler holding that mutex sees them without taking the
+ * mutex of the condition.
  */
 void cond_signal(cond_t *cv) {
 	// Can't signal on an uninitialized condvar
 	assert(cv->initialized);
 
+	if (cv->first == NULL) return;
+
 	// Enter critical section
 	mutex_lock(cv->mutex);
+	cond_waiter_t *waiter = remove_first(cv);
+	mutex_unlock(cv->mutex);
 
 	// We have a thread to wake
-	if (list_size(cv->waiting_list) != 0) {
-		assert(awaken_first_thread(cv->waiting_list) == 0);
-	}
-	
-	// We're done, end critical section
-	mutex_unlock(cv->mutex);
+	if (waiter != NULL) awaken(waiter);
 }
 
 /**
@@ -145,27 +182,19 @@ void cond_broadcast(cond_t *cv) {
 	// Can't broadcart on an uninitialized condvar
 	assert(cv->initialized);
 
-	// Enter critical section
-	mutex_lock(cv->mutex);
-
-	// Remove successively all threads in the list
-	while(list_size(cv->waiting_list) != 0) {
-		assert(awaken_first_thread(cv->waiting_list) == 0);
-	}
+	if (cv->first == NULL) return;
 
-	// We're done. End critical section
+	// Take the whole list at once
+	mutex_lock(cv->mutex);
+	cond_waiter_t *waiter = cv->first;
+	cv->first = NULL;
+	cv->last = NULL;
 	mutex_unlock(cv->mutex);
-}
 
-/**
- * @brief Actually wakes the first thread in the list
- * 
- * This function ensures that the awaken thread was indeed asleep when he was
- * awaken by us by looping and yielding to it so it can achieve its call to
- * deschedule() before we can actually wake it up.
- */
-int awaken_first_thread(list_t *list) {
-	int awaken = list_removeHead(list);
-	while(make_runnable(awaken) != 0) yield(awaken);
-	return 0;
+	// Wake them successively, the node is gone once awaken
+	while (waiter != NULL) {
+		cond_waiter_t *next = waiter->next;
+		awaken(waiter);
+		waiter = next;
+	}
 }
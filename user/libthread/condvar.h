@@ -9,9 +9,12 @@
 #ifndef __P2_CONDVAR_H_
 #define __P2_CONDVAR_H_
 
-#include "list.h"
-
-/* Function prototypes */
-int awaken_first_thread(list_t *list);
+/**
+ * A thread waiting on a condition, on the stack of the thread
+ */
+typedef struct cond_waiter {
+	int signaled;				// The word the thread sleeps on
+	struct cond_waiter *next;	// Next in the waiting list
+} cond_waiter_t;
 
-#endif /* !__P2_CONDVAR_H_ */
\ No newline at end of file
+#endif /* !__P2_CONDVAR_H_ */
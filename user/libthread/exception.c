@@ -6,8 +6,8 @@
  * @brief Exception handler for multithreaded applications
  * 
  * The handler reacts to faults by killing the task, and to traps by doing
- * nothing and resetting the exception handler, as the execution will continue
- * on the next line.
+ * nothing, as the execution will continue on the next line. It is registered
+ * persistent, so resuming doesn't register it again.
  * 
  * @bugs No known bugs
  */
@@ -23,12 +23,10 @@ extern void panic(const char *, ...);
  * 
  * cf. File description
  * 
- * @param arg the address to the exception stack (to register the handler
- * again if necessary)
+ * @param arg the address to the exception stack
  * @param ureg the state of the program at the moment of the exception
  */
 void multi_swexn_handler(void *arg, ureg_t *ureg) {
-	void *exception_stack_top = arg;
 	switch(ureg->cause) {
 		case SWEXN_CAUSE_DIVIDE:
 			panic("Exception triggered: Division by 0.\n"
@@ -78,7 +76,7 @@ void multi_swexn_handler(void *arg, ureg_t *ureg) {
 		case SWEXN_CAUSE_BREAKPOINT:
 		case SWEXN_CAUSE_OVERFLOW:
 			// Ignore those, they will continue at the next instruction
-			swexn(exception_stack_top, multi_swexn_handler, exception_stack_top, ureg);
+			swexn(SWEXN_RESUME, NULL, NULL, ureg);
 			break;
 		default:
 			// If this happens, then this is way worse than any of the above
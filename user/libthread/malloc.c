@@ -1,46 +1,333 @@
-/*
- * these functions should be thread safe.
- * It is up to you to rewrite them
- * to make them thread safe.
+/**
+ * @file malloc.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
  *
+ * @brief The thread-safe malloc family, with a cache per thread
+ *
+ * @section Architecture
+ * The small blocks, of at most MALLOC_MAX_SMALL bytes, are rounded up to a
+ * power of two, their size class. Each thread has a cache of free blocks of
+ * every class, from which it allocates and to which it frees without any
+ * lock. A cache running out of a class takes a batch of blocks from the
+ * central lists, and gives a batch back once it holds too many; the central
+ * lists are carved in batches from the underlying allocator. Only those
+ * trips, and the large blocks, which go to the underlying allocator
+ * directly, take the heap mutex.
+ *
+ * Every block starts with a header giving its size and the cache it was
+ * allocated from. A block freed by another thread goes back to that cache
+ * through its remote list, onto which the other threads push with a
+ * compare-and-swap; the owner takes the whole list at once, with a single
+ * exchange, when it runs out of a class.
+ *
+ * The cache of a thread is in its descriptor. When the thread exits, its
+ * blocks go back to the central lists and its cache to the orphans, which
+ * the next threads adopt, along with the blocks freed to it since. Before
+ * thr_init, there are no caches and every block goes through the central
+ * lists.
+ *
+ * @bugs None
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <types.h>
 #include <stddef.h>
 #include <syscall.h>
+#include <malloc.h>
 
 #include "p2thread.h"
 #include <inc/mutex.h>
 #include "mutex.h"
 
+/* Size classes, of 16 bytes up to MALLOC_MAX_SMALL */
+#define MALLOC_CLASSES 8
+#define MALLOC_MIN_SHIFT 4
+#define MALLOC_MAX_SMALL (1 << (MALLOC_MIN_SHIFT + MALLOC_CLASSES - 1))
+/* Blocks moved between a cache and the central lists at once */
+#define MALLOC_BATCH 16
+/* Blocks of a class a cache holds before it gives a batch back */
+#define MALLOC_CACHE_MAX 32
+
+typedef struct mcache mcache_t;
+
+/* The header of a block. Free blocks link through their first word */
+typedef struct mhdr mhdr_t;
+struct mhdr {
+	mcache_t *owner;		// NULL for the central lists and large blocks
+	size_t size;			// The size of the class, or the size asked
+};
+
+#define BODY(h) ((void *) ((mhdr_t *) (h) + 1))
+#define HDR(p) ((mhdr_t *) (p) - 1)
+#define NEXT(h) (*(mhdr_t **) BODY(h))
+
+/* The cache of a thread */
+struct mcache {
+	mhdr_t *free[MALLOC_CLASSES];
+	unsigned int count[MALLOC_CLASSES];
+	mhdr_t * volatile remote;	// Freed by the other threads
+	mcache_t *next_orphan;
+};
+
+/* The central lists and the orphans, protected by the heap mutex */
+static mutex_t heap_mutex = { TRUE, MUTEX_FREE };
+static mhdr_t *central[MALLOC_CLASSES];
+static mcache_t *orphans = NULL;
+
+
+/**
+ * @return the size class of a small block of size bytes
+ */
+static int class_of(size_t size) {
+	int c = 0;
+	while ((size_t) (1 << (MALLOC_MIN_SHIFT + c)) < size) c++;
+	return c;
+}
+
+/**
+ * @brief Takes up to n blocks of a class from the central lists
+ *
+ * The lists are refilled first if they are empty. The heap mutex must be
+ * held.
+ *
+ * @param list where to chain the blocks
+ * @return the number of blocks taken
+ */
+static unsigned int central_take(int c, unsigned int n, mhdr_t **list) {
+	size_t size = 1 << (MALLOC_MIN_SHIFT + c);
+
+	if (central[c] == NULL) {
+		size_t stride = sizeof(mhdr_t) + size;
+		char *chunk = _malloc(MALLOC_BATCH * stride);
+		if (chunk == NULL) return 0;
+
+		int i;
+		for (i = 0; i < MALLOC_BATCH; i++) {
+			mhdr_t *h = (mhdr_t *) (chunk + i * stride);
+			h->owner = NULL;
+			h->size = size;
+			NEXT(h) = central[c];
+			central[c] = h;
+		}
+	}
+
+	unsigned int taken = 0;
+	while (taken < n && central[c] != NULL) {
+		mhdr_t *h = central[c];
+		central[c] = NEXT(h);
+		NEXT(h) = *list;
+		*list = h;
+		taken++;
+	}
+	return taken;
+}
+
+/**
+ * @brief Gives a chain of blocks of a class to the central lists. The heap
+ * mutex must be held.
+ */
+static void central_give(int c, mhdr_t *list) {
+	while (list != NULL) {
+		mhdr_t *next = NEXT(list);
+		list->owner = NULL;
+		NEXT(list) = central[c];
+		central[c] = list;
+		list = next;
+	}
+}
+
+/**
+ * @brief Moves the blocks other threads freed to a cache into its lists
+ */
+static void collect_remote(mcache_t *cache) {
+	if (cache->remote == NULL) return;
+
+	mhdr_t *h = (mhdr_t *) atomic_exchange((int *) &cache->remote, 0);
+	while (h != NULL) {
+		mhdr_t *next = NEXT(h);
+		int c = class_of(h->size);
+		NEXT(h) = cache->free[c];
+		cache->free[c] = h;
+		cache->count[c]++;
+		h = next;
+	}
+}
+
+/**
+ * @brief Hands a block back to the cache it came from, from another thread
+ */
+static void remote_push(mcache_t *owner, mhdr_t *h) {
+	int old;
+	do {
+		old = (int) owner->remote;
+		NEXT(h) = (mhdr_t *) old;
+	} while (atomic_cmpxchg((int *) &owner->remote, old, (int) h) != old);
+}
+
+/**
+ * @return the cache of the calling thread, NULL before thr_init or if none
+ * could be made
+ */
+static mcache_t *my_cache(void) {
+	thrdesc_t *self = thr_getdesc();
+	if (self == NULL) return NULL;
+	if (self->mcache != NULL) return self->mcache;
+
+	mutex_lock(&heap_mutex);
+	mcache_t *cache = orphans;
+	if (cache != NULL) orphans = cache->next_orphan;
+	else cache = _calloc(1, sizeof(mcache_t));
+	mutex_unlock(&heap_mutex);
+
+	self->mcache = cache;
+	return cache;
+}
+
+/**
+ * @brief Gives the blocks of an exiting thread back, and its cache to the
+ * orphans
+ *
+ * @param self the descriptor of the thread, which mallocs no more
+ */
+void thr_malloc_exit(thrdesc_t *self) {
+	mcache_t *cache = self->mcache;
+	if (cache == NULL) return;
+	self->mcache = NULL;
+
+	collect_remote(cache);
+
+	mutex_lock(&heap_mutex);
+	int c;
+	for (c = 0; c < MALLOC_CLASSES; c++) {
+		central_give(c, cache->free[c]);
+		cache->free[c] = NULL;
+		cache->count[c] = 0;
+	}
+	cache->next_orphan = orphans;
+	orphans = cache;
+	mutex_unlock(&heap_mutex);
+}
+
+/**
+ * @brief Allocates a block larger than the size classes
+ */
+static void *large_alloc(size_t size) {
+	mutex_lock(&heap_mutex);
+	mhdr_t *h = _malloc(sizeof(mhdr_t) + size);
+	mutex_unlock(&heap_mutex);
+	if (h == NULL) return NULL;
+
+	h->owner = NULL;
+	h->size = size;
+	return BODY(h);
+}
+
 void *malloc(size_t __size)
 {
-	//while (testandset(&mem_lock)) yield(-1);
-	void *result = _malloc(__size);
-	//mem_lock = FALSE;
-	return result;
+	if (__size > MALLOC_MAX_SMALL) return large_alloc(__size);
+
+	int c = class_of(__size);
+	mcache_t *cache = my_cache();
+	mhdr_t *h = NULL;
+
+	if (cache == NULL) {
+		mutex_lock(&heap_mutex);
+		central_take(c, 1, &h);
+		mutex_unlock(&heap_mutex);
+		if (h == NULL) return NULL;
+		return BODY(h);
+	}
+
+	if (cache->free[c] == NULL) collect_remote(cache);
+	if (cache->free[c] == NULL) {
+		mutex_lock(&heap_mutex);
+		cache->count[c] += central_take(c, MALLOC_BATCH, &cache->free[c]);
+		mutex_unlock(&heap_mutex);
+		if (cache->free[c] == NULL) return NULL;
+	}
+
+	h = cache->free[c];
+	cache->free[c] = NEXT(h);
+	cache->count[c]--;
+	h->owner = cache;
+	return BODY(h);
 }
 
 void *calloc(size_t __nelt, size_t __eltsize)
 {
-	//while (testandset(&mem_lock)) yield(-1);
-	void *result = _calloc(__nelt, __eltsize);
-	//mem_lock = FALSE;
+	if (__eltsize != 0 && __nelt > (size_t) -1 / __eltsize) return NULL;
+
+	size_t size = __nelt * __eltsize;
+	void *result = malloc(size);
+	if (result != NULL) memset(result, 0, size);
 	return result;
 }
 
 void *realloc(void *__buf, size_t __new_size)
 {
-	//while (testandset(&mem_lock)) yield(-1);
-	void *result = _realloc(__buf, __new_size);
-	//mem_lock = FALSE;
+	if (__buf == NULL) return malloc(__new_size);
+	if (__new_size == 0) {
+		free(__buf);
+		return NULL;
+	}
+
+	// A small block already has room up to the size of its class
+	size_t size = HDR(__buf)->size;
+	if (size <= MALLOC_MAX_SMALL && __new_size <= size) return __buf;
+
+	void *result = malloc(__new_size);
+	if (result == NULL) return NULL;
+	memcpy(result, __buf, size < __new_size ? size : __new_size);
+	free(__buf);
 	return result;
 }
 
 void free(void *__buf)
 {
-	//while (testandset(&mem_lock)) yield(-1);
-	_free(__buf);
-	//mem_lock = FALSE;
+	if (__buf == NULL) return;
+
+	mhdr_t *h = HDR(__buf);
+	if (h->size > MALLOC_MAX_SMALL) {
+		mutex_lock(&heap_mutex);
+		_free(h);
+		mutex_unlock(&heap_mutex);
+		return;
+	}
+
+	int c = class_of(h->size);
+	mcache_t *cache = my_cache();
+	if (h->owner != NULL && h->owner != cache) {
+		remote_push(h->owner, h);
+		return;
+	}
+
+	if (cache == NULL) {
+		h->owner = NULL;
+		mutex_lock(&heap_mutex);
+		NEXT(h) = central[c];
+		central[c] = h;
+		mutex_unlock(&heap_mutex);
+		return;
+	}
+
+	NEXT(h) = cache->free[c];
+	cache->free[c] = h;
+	if (++cache->count[c] <= MALLOC_CACHE_MAX) return;
+
+	// Too many, give a batch back
+	mhdr_t *batch = NULL;
+	int i;
+	for (i = 0; i < MALLOC_BATCH; i++) {
+		mhdr_t *b = cache->free[c];
+		cache->free[c] = NEXT(b);
+		NEXT(b) = batch;
+		batch = b;
+	}
+	cache->count[c] -= MALLOC_BATCH;
+
+	mutex_lock(&heap_mutex);
+	central_give(c, batch);
+	mutex_unlock(&heap_mutex);
 }
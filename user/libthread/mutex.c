@@ -7,20 +7,34 @@
  * 
  * @section Functionality
  * This file is responsible for providing a mutual exclusion mechanism with 
- * bounded waiting and progress.
+ * progress, which costs no system call as long as there is no contention.
  *
  * @section Architecture
- * Each mutex can be accessed (read or written) by only one thread at the time. 
- * To ensure that property we use a boolean lock on which we perform the 
- * testandset operation.
+ * The mutex is a single word, its state, which is only changed with atomic
+ * instructions. A thread finding the mutex free takes it with a single
+ * compare-and-swap, and a thread releasing it nobody waits for frees it with
+ * a single exchange: neither enters the kernel.
  *
- * To indicate whether a thread currently holds the mutex protecting a specific 
- * critial section we use the "owner" field. That field is also used to 
- * guarantee fair bounded waiting. See the mutex_lock and mutex_unlock function 
- * for further details.
+ * A thread finding the mutex taken marks it as contended and waits in the
+ * kernel for the state to change (@see futex_wait). A thread releasing a
+ * contended mutex frees it and wakes one of the waiters up (@see
+ * futex_wake), which marks it contended again when it takes it, since it
+ * can't know whether others still wait. This is the design described by
+ * Drepper in "Futexes are tricky".
  *
- * @section Previous Design Attempt
- * Before using the current design we tried the following design :
+ * The kernel wakes the waiters up in the order they came, but a thread which
+ * has just arrived can take the mutex before the waiter woken up runs.
+ * Waiting is thus only bounded as long as the mutex is not always taken.
+ *
+ * @section Previous Design Attempts
+ * A lock protected the fields of the mutex, its owner and a waiting list of
+ * thread ids. The owner handed the mutex to the head of the list, to which
+ * it yielded, and the waiters yielded to the owner until they were made the
+ * owner. Bounded waiting was strict, but under contention every thread spent
+ * its time in yield system calls and context switches, taking and releasing
+ * the lock of the mutex with the same yields.
+ *
+ * Before that design we tried the following one :
  *
  * The mutexes include a "waiting list". This list is a linked list who at any
  * time has to be in one of the following states (td is for thread descriptor):
@@ -75,13 +89,9 @@
 
 #include "mutex_type.h"
 
-#include "list.h"
 #include "p2thread.h"
 #include "mutex.h"
 
-// For debugging purposes each mutex has an ID.
-int MID = 100;
-
 /**
  * @brief Initializes a mutex
  *
@@ -96,11 +106,8 @@ int mutex_init(mutex_t *mp) {
 	 * it is very lickely that a newly created mutex contains junk and thus 
 	 * is considered as initialized.
 	 */
-	mp->waiting_list = list_init();
-	mp->owner = -1;
-	mp->id = MID++;
+	mp->state = MUTEX_FREE;
 	mp->initialized = TRUE;
-	mp->mutex_lock = FALSE;
 
 	return 0;
 }
@@ -112,114 +119,53 @@ int mutex_init(mutex_t *mp) {
  */
 void mutex_destroy(mutex_t *mp) {
 
-	// First get the lock to interact with the mutex
-	boolean_t *mlock = &(mp->mutex_lock);
-
-	/**
-	 * We use yield(-1) here because we are not allowed to read or write to 
-	 * the mutex, thus reading a potential field indicating who is currently 
-	 * interacting with the mutex is not possible.
-	 */
-	while (testandset(mlock)) yield(-1);
-	
 	// make sure nobody owns the lock
-	assert(mp->owner == -1);
-
-	// Destroy everything
-	list_destroy(mp->waiting_list);
-	mp->waiting_list = NULL;
-	mp->owner = -1;
-	mp->initialized = FALSE;
+	assert(mp->state == MUTEX_FREE);
 
 	/**
-	 * Don't release the mutex.
-	 * Threads waiting will thus wait until it gets reinitialized.
+	 * Leave the mutex taken.
+	 * Threads arriving will thus wait until it gets reinitialized.
 	 */
-	mp->mutex_lock = TRUE;
-
+	mp->initialized = FALSE;
+	mp->state = MUTEX_LOCKED;
 }
 
 /**
  * @brief Aquire the mutex
  *
- * Only one thread is allowed to interact (that is read or alter) any mutex 
- * at a given time. To make sure that property holds we use a lock which is just 
- * a boolean value and use the "testandset" operation to aquire it.
- *
- * To check whether a thread is inside the critical section protected by that 
- * mutex we use the "owner" field. If it is set to anything other than -1, a 
- * thread has aquired the mutex.
- *
- * To ensure bounded waiting in a fair manner each mutex has a waiting list of 
- * kernel ID's. When the thread which currently holds the mutex releases it, it 
- * removes the head of the waiting list and sets the owner field of the mutex to 
- * that kernel ID. This ensures that the next thread which will enter the 
- * critical section is the next on the waiting list.
+ * The mutex is ours if we change its state from MUTEX_FREE. Otherwise we
+ * mark it MUTEX_CONTENDED, which tells the owner to wake a waiter up, and
+ * sleep in the kernel as long as it stays that way. The exchange which marks
+ * it also tells us whether it was free meanwhile, in which case it is ours,
+ * contended since we don't know whether others wait.
  *
  * @param mp the mutex to aquire
  */
 void mutex_lock(mutex_t *mp) {
 
-
 	// Trying to acquire an uninitialized mutex
 	assert(mp->initialized);
 
-	// Get the lock
-	boolean_t *mlock = &(mp->mutex_lock);
-
-	/**
-	 * We get the lock to interact with the mutex. As explained before, we 
-	 * cannot yield to the thread currently interacting with the mutex as 
-	 * this requires a read which we are not allowed.
-	 */
-	while (testandset(mlock)) yield(-1);
-
-	// At this point we can interact with the mutex 
-	if (mp->owner == -1) {
+	// If no one owns the mutex now go right in
+	int state = atomic_cmpxchg(&mp->state, MUTEX_FREE, MUTEX_LOCKED);
+	if (state == MUTEX_FREE) return;
 
-		// If no one owns the mutex now go right in
-		mp->owner = gettid();
-
-	} else {
-
-		int id = gettid();
-		boolean_t waiting = FALSE;
-
-		// Wait until someone makes us the owner
-		while (mp->owner != id && mp->initialized) {
-
-			// Add ourselves to the waitingList
-			// unless we already did that
-			if (!waiting) {
-				list_addLast(mp->waiting_list, id);
-				waiting = TRUE;
-			}
-
-			// Then release the "mlock"
-			*mlock = FALSE;
-
-			// Yield to the owner
-			yield(mp->owner);
-
-			// When we run again make sure we can still interact
-			while (testandset(mlock)) yield(-1);
-		}
+	if (state != MUTEX_CONTENDED)
+		state = atomic_exchange(&mp->state, MUTEX_CONTENDED);
 
+	// Wait until the owner releases the mutex
+	while (state != MUTEX_FREE) {
+		futex_wait(&mp->state, MUTEX_CONTENDED);
+		state = atomic_exchange(&mp->state, MUTEX_CONTENDED);
 	}
-
-	// release the mutex interaction lock but keep the actual mutex
-	*mlock = FALSE;
-
 }
 
 
 /**
  * @brief Releases a mutex
  *
- * Like with mutex_lock we first need to be able to interact with the mutex. 
- * Once that property is satified we check whether the waiting list is empty or 
- * not and in the ladder case make the head of the list the new owner of the 
- * mutex. If the list is empty we simply release the mutex.
+ * The mutex is free after the exchange. If it was contended, one of the
+ * threads waiting in the kernel is woken up to try again.
  *
  * @param mp the mutex to release
  */
@@ -228,29 +174,8 @@ void mutex_unlock(mutex_t *mp) {
 	// Trying to acquire an uninitialized mutex
 	assert(mp->initialized);
 
-	// Get the locks
-	boolean_t *mlock = &(mp->mutex_lock);	
-
-	// First we get the lock to interact with the mutex
-	while (testandset(mlock)) yield(-1);
-
-	// Now we can interact with the mutex
-
 	// It is illegal for an application to unlock a mutex that is not 
 	// locked.
-	if (mp->owner == -1) {
-		*mlock = FALSE;
-		return;
-	}
-
-	// Now check if there are threads in the waiting list
-	int next = list_removeHead(mp->waiting_list);
-
-	if (next != -1) mp->owner = next;
-	else mp->owner = -1;
-
-	// release the mutex and transfer 
-	*mlock = FALSE;
-	yield(mp->owner);
-
+	if (atomic_exchange(&mp->state, MUTEX_FREE) == MUTEX_CONTENDED)
+		futex_wake(&mp->state, 1);
 }
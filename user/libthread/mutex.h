@@ -13,5 +13,8 @@
 
 /* Function prototypes */
 unsigned int testandset(void *var);
+int atomic_exchange(int *var, int value);
+int atomic_cmpxchg(int *var, int old, int new);
+int atomic_add(int *var, int value);
 
 #endif /* !__P2_MUTEX_H_ */
\ No newline at end of file
@@ -20,6 +20,23 @@
  * thread will not run before we have succesfully created the new thread 
  * descriptor.
  *
+ * The stacks of the threads are slots of the same size laid out downwards
+ * from stack_top, and the top of each slot holds a pointer to the
+ * descriptor of its thread. A thread finds its descriptor from its stack
+ * pointer with a division and a load (@see thr_getdesc), rather than
+ * asking the kernel for its ID and looking it up in the list. A thread
+ * running outside of its slot, on the main stack or on its exception stack,
+ * still looks itself up.
+ *
+ * The descriptor also holds the thread-specific values (@see
+ * thrspecific.h).
+ *
+ * The slot of a joined thread is reused. Up to pool_max slots are kept 
+ * mapped, so that a thread created then needs no new_pages, and the others 
+ * are unmapped but kept for their place in the address space (@see 
+ * thrstack.h). A slot is only reused once its thread is off it for good 
+ * (@see thr_vanish).
+ *
  * @bugs None
  */
 
@@ -34,42 +51,29 @@
 #include <mutex.h>
 #include <cond.h>
 #include <thread.h>
-#include <p2thrlist.h>		/* thr_get, thr_insert */
+#include <p2thrhash.h>		/* thrhash_add, thrhash_finduser */
 #include <p2thread.h>
+#include <thrstack.h>
 #include "exception.h"
 
 
 /**
- * threads is a double linked list of thread descriptors.
- * @see p2thrlist.h
+ * threads are the tables of thread descriptors.
+ * @see p2thrhash.h
  *
  * Each thread should have a single thread descriptor at all time, allocated
  * on the heap. The descriptor contains various information such as kernel ID,
  * user thread ID, the thread mutex, state flags and its frame base.*
  *
- * All "alive" threads should be in the following list. When a thread requires 
- * information about itself or another thread it should look in that list. It 
- * can do so using either its kernel ID or its user ID.
+ * All "alive" threads should be in the tables, until they are joined. When a 
+ * thread requires information about another thread it should look in them. 
+ * It can do so using either its kernel ID or its user ID.
  *
- * The list will be initialized during thr_init().
- * Since that thread list is a shared resource we use a mutex "threads_mutex" 
- * for any interaction with the list.
+ * Since the tables are a shared resource we use a mutex "threads_mutex" 
+ * for any interaction with them.
  */
-static thrlist_t *threads = NULL;
 static mutex_t *threads_mutex = NULL;
 
-/**
- * To ensure thread safety for the malloc family function (malloc, calloc, free 
- * and realloc) we use a simply boolean on which we spin before calling one of 
- * these function.
- *
- * Using a mutex would not work for the following reason : mutexes have 
- * waiting_lists and when a new node is added to the list, we need to malloc is 
- * first. So malloc can not be protected by a mechanism which uses malloc 
- * itself.
- */
-boolean_t mem_lock = FALSE;
-
 /**
  * A user thread ID counter. It get's incremented everytime a thread is created.  
  * Very primitive. The initial value is MIN_THREAD_ID defined in the header 
@@ -99,6 +103,32 @@ static unsigned int nextbase;
  */
 static unsigned int stackpages;
 
+/**
+ * The top of the first stack slot, and the descriptor of the main thread,
+ * which runs above it.
+ */
+static unsigned int stack_top;
+static thrdesc_t *main_desc;
+
+/* The number of keys made, @see thr_key_create */
+static int num_keys = 0;
+
+/**
+ * A free stack slot, by the base given to new_pages. The pool holds the
+ * slots still mapped, the holes those which were unmapped. Both lists, and 
+ * nextbase, are protected by stacks_mutex.
+ */
+typedef struct slot slot_t;
+struct slot {
+	unsigned int base;
+	slot_t *next;
+};
+
+static mutex_t *stacks_mutex = NULL;
+static slot_t *pool = NULL;
+static slot_t *holes = NULL;
+static unsigned int pooled = 0;
+static unsigned int pool_max = THR_STACK_POOL;
 
 
 /**
@@ -122,7 +152,8 @@ int thr_init(unsigned int size) {
 	 * handler
 	 */
 	void *exception_stack = calloc(PAGE_SIZE, sizeof(char));
-	swexn(exception_stack, multi_swexn_handler, exception_stack, NULL);
+	swexn((char *) exception_stack + SWEXN_PERSISTENT, multi_swexn_handler,
+		exception_stack, NULL);
 
 	/**
 	 * Compute the amount of pages required for the stack space of threads.  
@@ -133,18 +164,18 @@ int thr_init(unsigned int size) {
 	else stackpages = (size/PAGE_SIZE + 1);
 
 
-	// Initialize the "threads" list.
-	threads = thrlist_init();
-
-	// Initialize the corresponding mutex
+	// Initialize the mutexes of the tables and of the stack slots
 	threads_mutex = malloc(sizeof(mutex_t));
 	mutex_init(threads_mutex);
+	stacks_mutex = malloc(sizeof(mutex_t));
+	mutex_init(stacks_mutex);
 
 	/**
 	 * Create a thread descriptor for the current/main thread.
 	 */
 	thrdesc_t *desc = thr_newdesc(gettid(), 0);
-	thrlist_addFirst(threads, desc);
+	thrhash_add(desc);
+	main_desc = desc;
 
 	/** Now we need to find the first available stack space slot. We 
 	 * start from the very top of the address space WHICH IS PAGE ALIGNED
@@ -175,6 +206,7 @@ int thr_init(unsigned int size) {
 	 * update our nextbase value, and deallocate the page.
 	 */
 	nextbase = top - PAGE_SIZE;
+	stack_top = nextbase;
 	err = remove_pages((void *)top);
 
 	/**
@@ -188,6 +220,141 @@ int thr_init(unsigned int size) {
 
 
 
+/**
+ * @brief Takes a stack slot and maps it
+ *
+ * A slot of the pool is already mapped. Otherwise a hole is reused if there 
+ * is one, or a new slot is made below the lowest one, and mapped. The new
+ * slots skip the region of the kernel data pages, which no program may map
+ * (@see kdata.h).
+ *
+ * @param basep where to store the base of the slot
+ * @return 0 on success, otherwise the error of new_pages
+ */
+static int take_stack(unsigned int *basep) {
+	mutex_lock(stacks_mutex);
+	slot_t *slot = pool;
+	if (slot != NULL) {
+		pool = slot->next;
+		pooled--;
+		mutex_unlock(stacks_mutex);
+
+		*basep = slot->base;
+		free(slot);
+		return 0;
+	}
+
+	unsigned int base;
+	slot = holes;
+	if (slot != NULL) {
+		holes = slot->next;
+		base = slot->base;
+	} else {
+		unsigned int size = stackpages*PAGE_SIZE;
+		nextbase = nextbase - size;
+		if (nextbase < KDATA_END && nextbase + size > KDATA_BASE)
+			nextbase = KDATA_BASE - size;
+		base = nextbase;
+	}
+	mutex_unlock(stacks_mutex);
+
+	/**
+	 * The base needs to be page alligned. The kernel only maps the top
+	 * of it, and the rest as the child's stack grows down.
+	 */
+	int err = new_pages((void *)base,
+		(stackpages*PAGE_SIZE) | NEW_PAGES_GROWSDOWN);
+
+	if (err) {
+		// Keep the place for later, or lose it if we can't
+		if (slot == NULL) slot = malloc(sizeof(slot_t));
+		if (slot != NULL) {
+			slot->base = base;
+			mutex_lock(stacks_mutex);
+			slot->next = holes;
+			holes = slot;
+			mutex_unlock(stacks_mutex);
+		}
+		return err;
+	}
+
+	free(slot);
+	*basep = base;
+	return 0;
+}
+
+/**
+ * @brief Gives a stack slot back, to the pool if it has room
+ *
+ * @param base the base of the slot, whose thread is off it for good
+ */
+static void release_stack(unsigned int base) {
+
+	// The next thread of the slot must not find our descriptor
+	*((thrdesc_t **) (base + stackpages*PAGE_SIZE) - 1) = NULL;
+
+	slot_t *slot = malloc(sizeof(slot_t));
+	if (slot == NULL) {
+		remove_pages((void *)base);
+		return;
+	}
+	slot->base = base;
+
+	mutex_lock(stacks_mutex);
+	if (pooled < pool_max) {
+		slot->next = pool;
+		pool = slot;
+		pooled++;
+		mutex_unlock(stacks_mutex);
+		return;
+	}
+	mutex_unlock(stacks_mutex);
+
+	remove_pages((void *)base);
+
+	mutex_lock(stacks_mutex);
+	slot->next = holes;
+	holes = slot;
+	mutex_unlock(stacks_mutex);
+}
+
+/**
+ * @brief Sets how many free stacks are kept mapped, and unmaps the others
+ *
+ * @param stacks the number of stacks
+ * @return 0 on success, otherwise a negative error code
+ */
+int thr_stack_pool(unsigned int stacks) {
+	if (stacks_mutex == NULL) return -1;
+
+	// Take the stacks over the mark out of the pool
+	mutex_lock(stacks_mutex);
+	pool_max = stacks;
+	slot_t *excess = NULL;
+	while (pooled > pool_max) {
+		slot_t *slot = pool;
+		pool = slot->next;
+		pooled--;
+		slot->next = excess;
+		excess = slot;
+	}
+	mutex_unlock(stacks_mutex);
+
+	// Then unmap them, and keep their place
+	while (excess != NULL) {
+		slot_t *slot = excess;
+		excess = slot->next;
+		remove_pages((void *)slot->base);
+
+		mutex_lock(stacks_mutex);
+		slot->next = holes;
+		holes = slot;
+		mutex_unlock(stacks_mutex);
+	}
+	return 0;
+}
+
+
 /**
  * @brief Creates a thread to run func with the given argument
  *
@@ -216,28 +383,20 @@ int thr_create(void *(*func)(void *), void *arg ) {
 	mutex_lock(self->mutex);
 
 	/**
-	 * Compute the next available stack space slot. This will also be the 
-	 * argument passed to the new_pages() function as it allocates memory 
-	 * growing upwards, while we count 'nextbase' downwards
+	 * Take a stack slot, mapped. Its base, given to new_pages, is what the 
+	 * child will have in his descriptor, while the child stack starts at 
+	 * its top.
 	 *
-	 * We need to remember the current value of nextbase before updating it 
-	 * as the child will have that value as his stack base pointer in his 
-	 * descriptor.
+	 * If the stack couldn't be allocated we simply propagate the error 
+	 * message we received from new_pages().
 	 */
-	void *base = (void *)nextbase;
-	nextbase = nextbase - stackpages*PAGE_SIZE;
-
-	/**
-	 * Now we can allocate the new stack for the child
-	 * The nbase needs to be page alligned.
-	 */	
-	int err = new_pages((void *)nextbase, stackpages*PAGE_SIZE);
-
-	/**
-	 * check if the stack was sucessfully allocated. If not we simply 
-	 * propagate the error message we received from new_pages();
-	 */
-	if (err) return err;
+	unsigned int sbase;
+	int err = take_stack(&sbase);
+	if (err) {
+		mutex_unlock(self->mutex);
+		return err;
+	}
+	void *base = (void *)(sbase + stackpages*PAGE_SIZE);
 
 	/**
 	 * Now we "spawn" the new child thread. We do so in Assembly to ensure 
@@ -259,24 +418,31 @@ int thr_create(void *(*func)(void *), void *arg ) {
 	 * To make sure the descriptor is present in the "threads" list when the 
 	 * child gains the CPU we pass the parent mutex along which the child 
 	 * will need to aquire before continuing its excecution.  
+	 *
+	 * The child starts below the slot of its descriptor, which is zero 
+	 * until we fill it in.
 	 */
-	int childid = thr_spawn(base, func, arg, self->mutex);
+	int childid = thr_spawn((char *) base - THR_SLOT_SIZE, func, arg,
+		self->mutex);
+	if (childid < 0) {
+		release_stack(sbase);
+		mutex_unlock(self->mutex);
+		return childid;
+	}
 
 	/**
 	 * Now we need to create a new thread descriptor.
 	 * Note that the child id returned by spawn_thread is the kernel ID of 
 	 * the child thread. We will generate our own thread ID.
 	 */
-	thrdesc_t* desc = thr_newdesc(childid, nextbase);
+	thrdesc_t* desc = thr_newdesc(childid, sbase);
 	assert(desc != NULL);
 
-	/**
-	 * Save the thread descriptor in the list "threads".
-	 * We add it to the head since the child is likely to look for it's own 
-	 * thread descriptor soon.
-	 */
-	thrlist_addFirst(threads, desc);
+	// Save the thread descriptor in the tables
+	mutex_lock(threads_mutex);
+	thrhash_add(desc);
 	mutex_unlock(threads_mutex);
+	*((thrdesc_t **) base - 1) = desc;
 
 	/**
 	 * Now the parent should be done.
@@ -301,7 +467,7 @@ int thr_create(void *(*func)(void *), void *arg ) {
 thrdesc_t *thr_newdesc(int childid, unsigned int base) {
 
 	// Allocate the descriptor on the heap
-	thrdesc_t *desc = (thrdesc_t *)malloc(sizeof(thrdesc_t));
+	thrdesc_t *desc = (thrdesc_t *)calloc(1, sizeof(thrdesc_t));
 	assert(desc != NULL);
 
 	/**
@@ -313,7 +479,8 @@ thrdesc_t *thr_newdesc(int childid, unsigned int base) {
 	desc->sbase = base;
 	desc->tid = nextID++;
 	desc->zombie = 0;
-	desc->statusp = NULL;
+	desc->status = NULL;
+	desc->gone = 0;
 
 	desc->mutex = calloc(1, sizeof(mutex_t));
 	assert(desc->mutex != NULL);
@@ -355,7 +522,8 @@ void thr_launch(void *(*func)(void *), void *arg, mutex_t *parent_mutex) {
 	 * case another thread faults simultaneously
 	 */
 	void *exception_stack = calloc(PAGE_SIZE, sizeof(char));
-	swexn(exception_stack, multi_swexn_handler, exception_stack, NULL);
+	swexn((char *) exception_stack + SWEXN_PERSISTENT, multi_swexn_handler,
+		exception_stack, NULL);
 
 	/**
 	 * Make sur the function is not NULL. The argument may be NULL.
@@ -382,20 +550,87 @@ int thr_getid(void) {
 }
 
 /**
- * @brief Finds the thread descriptor of the currently running tread
+ * @brief Looks the thread descriptor of the calling thread up in the list
  *
  * @return the thread descriptor of the calling thread
  */
-thrdesc_t *thr_getdesc(void) {
+static thrdesc_t *thr_finddesc(void) {
 
 	// Lock the "threads" mutex before interacting with the list
 	mutex_lock(threads_mutex);
-	thrdesc_t *desc = thrlist_findkern(threads, gettid());
+	thrdesc_t *desc = thrhash_findkern(gettid());
 	assert(desc != NULL);
 	mutex_unlock(threads_mutex);
 	return desc;
 }
 
+/**
+ * @brief Finds the thread descriptor of the currently running tread
+ *
+ * The slot of the stack we run on gives it, unless we run above the slots,
+ * which only the main thread does, or below the slots made so far, on an 
+ * exception stack. nextbase may be stale, but it only ever goes down, so 
+ * that at worst we look ourselves up.
+ *
+ * @return the thread descriptor of the calling thread
+ */
+thrdesc_t *thr_getdesc(void) {
+	char here;
+	unsigned int sp = (unsigned int) &here;
+
+	if (sp >= stack_top) return main_desc;
+	if (sp < nextbase) return thr_finddesc();
+
+	unsigned int slot = stackpages * PAGE_SIZE;
+	unsigned int top = stack_top - ((stack_top - 1 - sp) / slot) * slot;
+	thrdesc_t *desc = *((thrdesc_t **) top - 1);
+
+	// Our parent may not have filled it in yet
+	if (desc == NULL) return thr_finddesc();
+	return desc;
+}
+
+
+/**
+ * @brief Makes a new key for thread-specific values
+ *
+ * @param key where to store the key
+ * @return 0 on success, a negative error code if there are no keys left
+ */
+int thr_key_create(int *key) {
+	if (key == NULL) return -1;
+
+	mutex_lock(threads_mutex);
+	if (num_keys == THR_KEYS_MAX) {
+		mutex_unlock(threads_mutex);
+		return -1;
+	}
+	*key = num_keys++;
+	mutex_unlock(threads_mutex);
+	return 0;
+}
+
+/**
+ * @brief Sets the value of the calling thread under a key
+ *
+ * @return 0 on success, a negative error code if the key wasn't made
+ */
+int thr_setspecific(int key, void *value) {
+	if (key < 0 || key >= num_keys) return -1;
+	thr_getdesc()->specific[key] = value;
+	return 0;
+}
+
+/**
+ * @brief Gets the value of the calling thread under a key
+ *
+ * @return the value, NULL if it was never set or the key wasn't made
+ */
+void *thr_getspecific(int key) {
+	if (key < 0 || key >= num_keys) return NULL;
+	return thr_getdesc()->specific[key];
+}
+
 
 /**
  * @brief Exist the current thread with the given status 
@@ -410,18 +645,22 @@ void thr_exit(void *status) {
 	//  Get our own description	
 	thrdesc_t *self = thr_getdesc();
 
+	// Our free blocks go back to the other threads @see malloc.c
+	thr_malloc_exit(self);
+
 	// We lock the thread so no one can join at the same time
 	mutex_lock(self->mutex);
 
 	// Set out status and state to Zombie
-	self->statusp = &status;
+	self->status = status;
 	self->zombie = 1;
 
 	// Signal our death
 	mutex_unlock(self->mutex);
 	cond_signal(self->death);
 
-	vanish();
+	// Let our joiner know when our stack and descriptor are free
+	thr_vanish(&self->gone);
 
 }
 
@@ -435,9 +674,14 @@ void thr_exit(void *status) {
 int thr_join(int tid, void **statusp) {
 
 
-	// First we check if the thread tid exists
+	/**
+	 * First we check if the thread tid exists, and claim it: a thread can 
+	 * only be joined once, since joining it frees it
+	 */
 	mutex_lock(threads_mutex);
-	thrdesc_t *target = thrlist_finduser(threads, tid);
+	thrdesc_t *target = thrhash_finduser(tid);
+	if (target != NULL && target->joined) target = NULL;
+	if (target != NULL) target->joined = 1;
 	mutex_unlock(threads_mutex);
 
 	// If the entry does not exists return an error code
@@ -450,7 +694,6 @@ int thr_join(int tid, void **statusp) {
 	while (!target->zombie) {
 
 		// Wait for the death
-		target->joined = 1;
 		cond_wait(target->death, target->mutex);
 	 } 
 
@@ -459,9 +702,23 @@ int thr_join(int tid, void **statusp) {
 	 * given an exit status. If statusp is not null, we place that 
 	 * status there.
 	 */
-	if (statusp != NULL) *statusp = *(target->statusp);
+	if (statusp != NULL) *statusp = target->status;
 
 	mutex_unlock(target->mutex);
+
+	// It is about to vanish, once it did we can free what it leaves
+	while (!target->gone) yield(target->kid);
+
+	mutex_lock(threads_mutex);
+	thrhash_remove(target);
+	mutex_unlock(threads_mutex);
+
+	if (target->sbase != 0) release_stack(target->sbase);
+	mutex_destroy(target->mutex);
+	free(target->mutex);
+	cond_destroy(target->death);
+	free(target->death);
+	free(target);
 	return 0;
 
 }
@@ -483,8 +740,10 @@ int thr_yield(int tid) {
 		return 0;
 	} else {
 		mutex_lock(threads_mutex);
-		int kid = (thrlist_finduser(threads, tid))->tid;
+		thrdesc_t *target = thrhash_finduser(tid);
+		int kid = (target != NULL) ? target->kid : -1;
 		mutex_unlock(threads_mutex);
+		if (kid < 0) return -1;
 		return yield(kid);
 	}
 	return -1;
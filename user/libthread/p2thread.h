@@ -16,11 +16,13 @@
 #define MAX_THREAD_STACK 128
 #define MIN_THREAD_ID 32
 #define MAX_THREAD_ID 9999
+/* Bytes kept at the top of each thread stack for its descriptor slot */
+#define THR_SLOT_SIZE 16
 
 void thr_launch(void *(*func)(void *), void *, mutex_t *);
 thrdesc_t *thr_newdesc(int, unsigned int);
 thrdesc_t *thr_getdesc(void);
 
-extern boolean_t mem_lock;
+void thr_malloc_exit(thrdesc_t *);
 
 #endif /* !__P2_P2THREAD_H_ */
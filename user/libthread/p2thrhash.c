@@ -0,0 +1,78 @@
+/**
+ * @file p2thrhash.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ * @brief The tables of the living thread descriptors
+ *
+ * @section Architecture
+ * Each descriptor is in two hash tables, one by kernel ID and one by user
+ * ID, chained through the descriptor itself so that adding one allocates
+ * nothing. The IDs are mostly consecutive, so the low bits spread them
+ * well enough.
+ *
+ * The tables are shared by all the threads, the callers serialize on the
+ * threads mutex (@see p2thread.c).
+ *
+ * @bugs None
+ */
+
+#include <stdlib.h>		/* NULL */
+#include <p2thrhash.h>
+
+#define BUCKET(id) ((unsigned int) (id) & (THRHASH_BUCKETS - 1))
+
+static thrdesc_t *by_kid[THRHASH_BUCKETS];
+static thrdesc_t *by_tid[THRHASH_BUCKETS];
+
+
+/**
+ * @brief Adds a descriptor to both tables
+ *
+ * @param desc the descriptor, whose IDs are set
+ */
+void thrhash_add(thrdesc_t *desc) {
+	unsigned int k = BUCKET(desc->kid);
+	unsigned int t = BUCKET(desc->tid);
+
+	desc->next_kid = by_kid[k];
+	by_kid[k] = desc;
+	desc->next_tid = by_tid[t];
+	by_tid[t] = desc;
+}
+
+/**
+ * @brief Removes a descriptor from both tables
+ *
+ * @param desc the descriptor, which must be in them
+ */
+void thrhash_remove(thrdesc_t *desc) {
+	thrdesc_t **link = &by_kid[BUCKET(desc->kid)];
+	while (*link != desc) link = &(*link)->next_kid;
+	*link = desc->next_kid;
+
+	link = &by_tid[BUCKET(desc->tid)];
+	while (*link != desc) link = &(*link)->next_tid;
+	*link = desc->next_tid;
+}
+
+/**
+ * @brief Finds a descriptor by kernel ID
+ *
+ * @return the descriptor, NULL if there is none with that ID
+ */
+thrdesc_t *thrhash_findkern(int kid) {
+	thrdesc_t *desc = by_kid[BUCKET(kid)];
+	while (desc != NULL && desc->kid != kid) desc = desc->next_kid;
+	return desc;
+}
+
+/**
+ * @brief Finds a descriptor by user ID
+ *
+ * @return the descriptor, NULL if there is none with that ID
+ */
+thrdesc_t *thrhash_finduser(int tid) {
+	thrdesc_t *desc = by_tid[BUCKET(tid)];
+	while (desc != NULL && desc->tid != tid) desc = desc->next_tid;
+	return desc;
+}
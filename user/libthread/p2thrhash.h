@@ -0,0 +1,22 @@
+/**
+ * @file p2thrhash.h
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ * 
+ * @brief Header file for p2thrhash.c
+ */
+
+#ifndef __P2_P2THRHASH_H_
+#define __P2_P2THRHASH_H_
+
+#include <p2thrlist.h>
+
+/* Buckets of each of the two tables, a power of two */
+#define THRHASH_BUCKETS 64
+
+void thrhash_add(thrdesc_t *);
+void thrhash_remove(thrdesc_t *);
+thrdesc_t *thrhash_findkern(int);
+thrdesc_t *thrhash_finduser(int);
+
+#endif /* !__P2_P2THRHASH_H_ */
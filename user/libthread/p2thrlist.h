@@ -11,6 +11,7 @@
 
 #include "mutex_type.h"
 #include "cond_type.h"
+#include "thrspecific.h"
 
 /**
  * Data structure for a thread descriptor. This contains the kernel ID and the 
@@ -21,12 +22,17 @@ struct thrdesc {
 	int kid;
 	int tid;
 	int zombie;
-	void **statusp;
+	void *status;
+	volatile int gone;		// Off its stack for good, @see thr_vanish
 	unsigned int sbase;
 	mutex_t *mutex;
 	cond_t *death;
 	int joined;
 	thrdesc_t *joined_by;
+	void *specific[THR_KEYS_MAX];	// @see thrspecific.h
+	thrdesc_t *next_kid;		// Chains of the tables, @see p2thrhash.c
+	thrdesc_t *next_tid;
+	struct mcache *mcache;		// Its free blocks, @see malloc.c
 };
 
 /**
@@ -5,18 +5,18 @@
  * 
  * @brief Implements semaphores for synchronization
  * 
- * Semaphores are implemented using a combination of a mutex and a condition
- * variable, both used to protect and signal on a counter, which represents
- * the number of "free slots" available in the semaphore. A semaphore with a
- * value of 1 is equivalent to a mutex.
- * The implementation is based on the lecture slides, with adaptations to make
- * them fit in the mutex/condvar model. Details are presented in each
- * function's descriptions.
- * The role of the mutex is to protect the consistency of the semaphore 
- * notably the relationship between the free slots value and the condition
- * variable). The condition variable is signaled when the semaphore passes
- * from a locked to an unlocked state, namely when its value passes from
- * negative to 0
+ * A semaphore is a counter, which represents the number of "free slots"
+ * available in the semaphore, changed with atomic instructions. A semaphore
+ * with a value of 1 is equivalent to a mutex. Taking a free slot is a single
+ * compare-and-swap, and giving one back is a single atomic addition, plus a
+ * system call to wake a waiter up if there is one.
+ *
+ * A thread finding no free slot sleeps in the kernel as long as the counter
+ * stays at 0 (@see futex_wait), and tries again once woken up. The waiters
+ * are counted so that sem_signal only enters the kernel when somebody may be
+ * asleep. A waiter counts itself before it sleeps, and sleeps only if the
+ * counter is still 0: a slot given back meanwhile either sees it counted or
+ * keeps it from sleeping.
  * 
  * @bugs No bugs known
  */
@@ -25,17 +25,18 @@
 #include <malloc.h>
 #include <assert.h>
 
-#include <inc/cond.h>
-#include <inc/mutex.h>
+#include <syscall.h>
+
 #include <inc/sem.h>
 
+#include "mutex.h"
+
 /**
  * @brief Initializes the semaphore
  * 
- * This function allocates and initializes the required data structures for
- * the semaphore. Calling this function in conjunction with other semaphore
- * related functions has an undefined behavior. No interleaving protection is
- * given by the function.
+ * Calling this function in conjunction with other semaphore related
+ * functions has an undefined behavior. No interleaving protection is given
+ * by the function.
  * 
  * @param count the initial value of the semaphore (the "free slots")
  * @return 0 on success, negative number on error
@@ -44,26 +45,12 @@ int sem_init(sem_t *sem, int count){
 	// Trying to initialize an already initialized semaphore
 	assert(!sem->initialized);
 
+	// The counter can't go below 0
+	if (count < 0) return -1;
+
 	// Initial value
 	sem->n = count;
-
-	// Initialize the mutex
-	sem->mutex = calloc(1, sizeof(mutex_t));
-	if (sem->mutex == NULL) {
-		return -1;
-	}
-	if (mutex_init(sem->mutex) != 0) {
-		return -2;
-	}
-
-	// Initialize the condition variable
-	sem->free_slots = calloc(1, sizeof(cond_t));
-	if (sem->free_slots == NULL) {
-		return -3;
-	}
-	if (cond_init(sem->free_slots) != 0) {
-		return -4;
-	}
+	sem->waiters = 0;
 
 	// All is set, we can begin to use the semaphore
 	sem->initialized = TRUE;
@@ -74,56 +61,45 @@ int sem_init(sem_t *sem, int count){
 /**
  * @brief Tries to enter the semaphore
  * 
- * The function decreases the semaphore value, marking its interest in going
- * in, and waits until a slot frees itself if all are occupied.
+ * The function takes a free slot, and waits until one frees itself if all
+ * are occupied.
  */
 void sem_wait(sem_t *sem){
 	// We can't wait on a non-initialized semaphore
 	assert(sem->initialized);
 
-	// Entering critical section
-	mutex_lock(sem->mutex);
+	for (;;) {
+		int n = *(volatile int *) &sem->n;
 
-	// Update semaphore value
-	--sem->n;
+		// There is a slot for us, unless someone takes it first
+		if (n > 0) {
+			if (atomic_cmpxchg(&sem->n, n, n - 1) == n) return;
+			continue;
+		}
 
-	// If there are no slots for us, we wait for one
-	if (sem->n < 0) {
-		cond_wait(sem->free_slots, sem->mutex);
+		// We wait for one
+		atomic_add(&sem->waiters, 1);
+		futex_wait(&sem->n, 0);
+		atomic_add(&sem->waiters, -1);
 	}
-
-	// We're in, end critical section
-	mutex_unlock(sem->mutex);
 }
 
 /**
  * @brief Exits the section protected by the semaphore
  * 
  * The function increases the semaphore value to liberate a slot on the
- * semaphore. If all slots were taken (n < 0), the thread wakes the first
- * waiting thread to take that empty slot.
+ * semaphore. If threads wait, the first one is woken up to take that slot,
+ * although a thread just arriving may take it first.
  */
 void sem_signal(sem_t *sem){
 	// We can't signal on an uninitialized semaphore
 	assert(sem->initialized);
 
-	// Entering critical section
-	mutex_lock(sem->mutex);
-
 	// We free a slot
-	++sem->n;
-
-	// If there was no free slot inside, we signal that there is one now
-	if (sem->n <= 0) {
-		/* The condition is not mandatory, but it avoids that the semaphore
-		 * send a signal to the condition when no one is waiting, for
-		 * performance reasons.
-		 */
-		cond_signal(sem->free_slots);
-	}
+	atomic_add(&sem->n, 1);
 
-	// We're out, end critical section
-	mutex_unlock(sem->mutex);
+	// If someone waits, we tell it that there is one now
+	if (*(volatile int *) &sem->waiters > 0) futex_wake(&sem->n, 1);
 }
 
 /**
@@ -137,20 +113,9 @@ void sem_destroy(sem_t *sem){
 	// We can't destroy an already destroyed thread
 	assert(sem->initialized);
 
+	// Nobody may be waiting
+	assert(sem->waiters == 0);
+
 	// Disables the semaphore
 	sem->initialized = FALSE;
-
-	/* We free the mutex. mutex_destroy takes care of checking if people were
-	 * waiting.
-	 */
-	mutex_destroy(sem->mutex);
-	free(sem->mutex);
-	sem->mutex = NULL;
-
-	/* We free the condition. cond_destroy takes care of checking if people
-	 * were waiting.
-	 */
-	cond_destroy(sem->free_slots);
-	free(sem->free_slots);
-	sem->free_slots = FALSE;
 }
@@ -0,0 +1,76 @@
+/**
+ * @file seqlock.c
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ * 
+ * @brief Implements the writer side of the sequence locks
+ * 
+ * A writer bumps the sequence number of the lock before and after it
+ * writes, so the number is odd while the data changes, and the readers
+ * (@see seqlock.h) retry the reads which overlapped a write. Readers thus
+ * never wait for each other and never write to the lock.
+ *
+ * The data must be safe to read while it changes, a reader may see it half
+ * written before it retries. The writers serialize on a mutex. The loads of
+ * x86 are not reordered with other loads, nor the stores with other stores,
+ * so keeping the compiler from reordering them is enough.
+ * 
+ * @bugs No bugs known
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include <inc/mutex.h>
+#include <inc/seqlock.h>
+
+/**
+ * @brief Initializes the lock, no writer in
+ *
+ * @return 0 on success, negative number on error
+ */
+int seqlock_init(seqlock_t *sl) {
+	sl->seq = 0;
+	if (mutex_init(&sl->writer) != 0) return -1;
+
+	sl->initialized = TRUE;
+	return 0;
+}
+
+/**
+ * @brief Destroys the lock
+ */
+void seqlock_destroy(seqlock_t *sl) {
+	// Can't destroy an uninitialized lock
+	assert(sl->initialized);
+
+	// No writer may be in
+	assert((sl->seq & 1) == 0);
+
+	mutex_destroy(&sl->writer);
+	sl->initialized = FALSE;
+}
+
+/**
+ * @brief Enters as a writer, the readers retry until we leave
+ */
+void seq_write_lock(seqlock_t *sl) {
+	// Can't lock an uninitialized lock
+	assert(sl->initialized);
+
+	mutex_lock(&sl->writer);
+	sl->seq++;
+	SEQ_BARRIER();
+}
+
+/**
+ * @brief Leaves as a writer
+ */
+void seq_write_unlock(seqlock_t *sl) {
+	// Can't unlock an uninitialized lock
+	assert(sl->initialized);
+
+	SEQ_BARRIER();
+	sl->seq++;
+	mutex_unlock(&sl->writer);
+}
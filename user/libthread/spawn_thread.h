@@ -15,5 +15,6 @@
 #include <mutex_type.h>
 
 int thr_spawn(void *, void *(*func)(void *), void *, mutex_t *);
+void thr_vanish(volatile int *) NORETURN;
 
 #endif /* !__P2_SPAWN_THREAD_H_ */
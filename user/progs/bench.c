@@ -0,0 +1,527 @@
+/**
+ * @file bench.c
+ * @brief Microbenchmarks of the kernel
+ *
+ * Usage: bench [name...]
+ *
+ * Runs the benchmarks named, or all of them, and prints a summary. Each
+ * benchmark is run for BENCH_ROUNDS rounds of a fixed number of operations,
+ * after a round to warm the caches up; the summary gives the time of an
+ * operation in the fastest round and in the median one. The times come
+ * from get_time_ns, the clock of the kernel.
+ *
+ * The benchmarks which fork run before any thread is created, since a
+ * process with several threads can't fork.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include <thread.h>
+#include <mutex.h>
+
+/* Rounds of each benchmark, the warm up one aside */
+#define BENCH_ROUNDS 5
+/* Pages of the memory benchmarks */
+#define BENCH_PAGES 64
+/* Where they map them, aligned for a large page */
+#define BENCH_REGION ((char *) 0x40000000)
+/* Bytes of a large page */
+#define LARGE_REGION (4 * 1024 * 1024)
+/* Threads fighting for the mutex */
+#define MUTEX_THREADS 4
+/* Threads allocating at once, and the blocks each keeps live */
+#define MALLOC_THREADS 4
+#define MALLOC_LIVE 16
+/* Bytes of a line printed */
+#define PRINT_LINE 80
+/* The program exec runs, which exits right away */
+#define NOP_PROGRAM "bench_nop"
+
+/**
+ * A benchmark: run performs a round of iters operations, and returns the
+ * nanoseconds it took, 0 if it failed
+ */
+typedef struct {
+	const char *name;
+	const char *op;
+	int iters;
+	unsigned long long (*run)(int iters);
+} bench_t;
+
+/* The outcome of a benchmark */
+typedef struct {
+	const bench_t *bench;
+	int ok;
+	unsigned int min;         /* Nanoseconds per operation */
+	unsigned int median;
+} result_t;
+
+static unsigned long long now(void) {
+	unsigned long long ns;
+	get_time_ns(&ns);
+	return ns;
+}
+
+/**
+ * @brief Divides a 64 bits number by a 32 bits one, without the helpers of
+ * gcc
+ */
+static unsigned int div64(unsigned long long n, unsigned int d) {
+	unsigned int high = n >> 32;
+	unsigned int low = n;
+	high %= d;
+
+	unsigned int q, rem;
+	asm ("divl %4" : "=a" (q), "=d" (rem) : "a" (low), "d" (high), "rm" (d));
+	return q;
+}
+
+/* ------------------------------------------------------------------------
+ * System calls
+ * --------------------------------------------------------------------- */
+
+static unsigned long long bench_syscall(int iters) {
+	unsigned long long start = now();
+	int i;
+	// Fails right away, after a round trip through the kernel
+	for (i = 0; i < iters; ++i) make_runnable(-1);
+	return now() - start;
+}
+
+static unsigned long long bench_gettid(int iters) {
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) gettid();
+	return now() - start;
+}
+
+/* ------------------------------------------------------------------------
+ * Processes
+ * --------------------------------------------------------------------- */
+
+static unsigned long long bench_fork(int iters) {
+	unsigned long long start = now();
+	int i, status;
+	for (i = 0; i < iters; ++i) {
+		int pid = fork();
+		if (pid == 0) {
+			set_status(0);
+			vanish();
+		}
+		if (pid < 0 || wait(&status) != pid) return 0;
+	}
+	return now() - start;
+}
+
+static unsigned long long bench_fork_exec(int iters) {
+	char *args[] = {NOP_PROGRAM, NULL};
+	unsigned long long start = now();
+	int i, status;
+	for (i = 0; i < iters; ++i) {
+		int pid = fork();
+		if (pid == 0) {
+			exec(NOP_PROGRAM, args);
+			set_status(-1);
+			vanish();
+		}
+		if (pid < 0 || wait(&status) != pid || status != 0) return 0;
+	}
+	return now() - start;
+}
+
+static unsigned long long bench_spawn(int iters) {
+	char *args[] = {NOP_PROGRAM, NULL};
+	unsigned long long start = now();
+	int i, status;
+	for (i = 0; i < iters; ++i) {
+		int pid = spawn(NOP_PROGRAM, args);
+		if (pid < 0 || wait(&status) != pid || status != 0) return 0;
+	}
+	return now() - start;
+}
+
+/* ------------------------------------------------------------------------
+ * Memory
+ * --------------------------------------------------------------------- */
+
+/**
+ * @brief Writes to the first word of each page of the region
+ */
+static void touch(int pages) {
+	int i;
+	for (i = 0; i < pages; ++i) BENCH_REGION[i * PAGE_SIZE] = i;
+}
+
+static unsigned long long bench_zero_fill(int iters) {
+	if (new_pages(BENCH_REGION, iters * PAGE_SIZE) < 0) return 0;
+
+	// The pages are only given frames on their first write
+	unsigned long long start = now();
+	touch(iters);
+	unsigned long long elapsed = now() - start;
+
+	remove_pages(BENCH_REGION);
+	return elapsed;
+}
+
+static unsigned long long bench_cow(int iters) {
+	if (new_pages(BENCH_REGION, iters * PAGE_SIZE) < 0) return 0;
+	touch(iters);
+
+	int pid = fork();
+	if (pid == 0) {
+		// Each write copies the page, shared with the parent so far
+		unsigned long long start = now();
+		touch(iters);
+		set_status(div64(now() - start, iters));
+		vanish();
+	}
+
+	int status = -1;
+	if (pid < 0 || wait(&status) != pid || status < 0) status = 0;
+	remove_pages(BENCH_REGION);
+	return (unsigned long long) status * iters;
+}
+
+static unsigned long long bench_lazy_fill(int iters) {
+	if (new_pages(BENCH_REGION, iters * PAGE_SIZE | NEW_PAGES_LAZY) < 0)
+		return 0;
+
+	// Each write maps a frame zeroed on the spot, or ahead by the idle thread
+	unsigned long long start = now();
+	touch(iters);
+	unsigned long long elapsed = now() - start;
+
+	remove_pages(BENCH_REGION);
+	return elapsed;
+}
+
+static unsigned long long bench_large_page(int iters) {
+	// An aligned 4MB region gets a large page, zeroed around the cache
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) {
+		if (new_pages(BENCH_REGION, LARGE_REGION) < 0) return 0;
+		if (remove_pages(BENCH_REGION) < 0) return 0;
+	}
+	return now() - start;
+}
+
+static unsigned long long bench_new_pages(int iters) {
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) {
+		if (new_pages(BENCH_REGION, BENCH_PAGES * PAGE_SIZE) < 0) return 0;
+		if (remove_pages(BENCH_REGION) < 0) return 0;
+	}
+	return now() - start;
+}
+
+static unsigned long long bench_pipe_page(int iters) {
+	if (new_pages(BENCH_REGION, 2 * PAGE_SIZE) < 0) return 0;
+	touch(2);
+	int id = pipe_create();
+	if (id < 0) {
+		remove_pages(BENCH_REGION);
+		return 0;
+	}
+
+	// Each page goes through the pipe by its frame, without being copied
+	char *dst = BENCH_REGION + PAGE_SIZE;
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) {
+		if (pipe_write(id, BENCH_REGION, PAGE_SIZE) != PAGE_SIZE) break;
+		if (pipe_read(id, dst, PAGE_SIZE) != PAGE_SIZE) break;
+	}
+	unsigned long long elapsed = now() - start;
+
+	pipe_close(id);
+	pipe_close(id);
+	remove_pages(BENCH_REGION);
+	return (i == iters) ? elapsed : 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Threads
+ * --------------------------------------------------------------------- */
+
+static volatile int pong_tid;
+static volatile int ping_tid;
+static volatile int pong_rounds;
+
+static void *nothing(void *arg) {
+	return arg;
+}
+
+static void *pong(void *arg) {
+	int i;
+	pong_tid = gettid();
+	for (i = 0; i < pong_rounds; ++i) yield(ping_tid);
+	return NULL;
+}
+
+static unsigned long long bench_ping_pong(int iters) {
+	// yield takes the kernel ids, not those of the thread library
+	ping_tid = gettid();
+	pong_tid = -1;
+	pong_rounds = iters;
+
+	int tid = thr_create(pong, NULL);
+	if (tid < 0) return 0;
+	while (pong_tid < 0) yield(-1);
+
+	// Each of our yields runs pong, which yields back
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) yield(pong_tid);
+	unsigned long long elapsed = now() - start;
+
+	thr_join(tid, NULL);
+	return elapsed;
+}
+
+static volatile int server_tid;
+
+static void *server(void *arg) {
+	ipc_msg_t msg;
+	server_tid = gettid();
+
+	// A call with a negative first word is the last one
+	int caller = ipc_receive(&msg);
+	while (caller >= 0 && msg.words[0] >= 0) {
+		msg.words[0]++;
+		caller = ipc_reply_wait(caller, &msg);
+	}
+	if (caller >= 0) ipc_reply(caller, &msg);
+	return NULL;
+}
+
+static unsigned long long bench_ipc(int iters) {
+	server_tid = -1;
+	int tid = thr_create(server, NULL);
+	if (tid < 0) return 0;
+	while (server_tid < 0) yield(-1);
+
+	// Each call runs the server, whose reply runs us again
+	ipc_msg_t msg = {{0}};
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) {
+		if (ipc_call(server_tid, &msg) < 0) break;
+	}
+	unsigned long long elapsed = now() - start;
+
+	msg.words[0] = -1;
+	ipc_call(server_tid, &msg);
+	thr_join(tid, NULL);
+	return (i == iters) ? elapsed : 0;
+}
+
+static unsigned long long bench_thr_create(int iters) {
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) {
+		int tid = thr_create(nothing, NULL);
+		if (tid < 0 || thr_join(tid, NULL) < 0) return 0;
+	}
+	return now() - start;
+}
+
+static void *get_ids(void *arg) {
+	int i, iters = (int) arg;
+	for (i = 0; i < iters; ++i) thr_getid();
+	return NULL;
+}
+
+static unsigned long long bench_thr_getid(int iters) {
+	unsigned long long start = now();
+	// From a thread of its own, running on a stack slot
+	int tid = thr_create(get_ids, (void *) iters);
+	if (tid < 0 || thr_join(tid, NULL) < 0) return 0;
+	return now() - start;
+}
+
+static mutex_t bench_mutex;
+static volatile int shared_counter;
+static volatile int mutex_rounds;
+
+static void *fight(void *arg) {
+	int i;
+	for (i = 0; i < mutex_rounds; ++i) {
+		mutex_lock(&bench_mutex);
+		shared_counter++;
+		mutex_unlock(&bench_mutex);
+	}
+	return NULL;
+}
+
+static unsigned long long bench_mutex_contended(int iters) {
+	int tids[MUTEX_THREADS];
+	int i;
+
+	mutex_init(&bench_mutex);
+	shared_counter = 0;
+	mutex_rounds = iters / MUTEX_THREADS;
+
+	unsigned long long start = now();
+	for (i = 0; i < MUTEX_THREADS; ++i) tids[i] = thr_create(fight, NULL);
+	for (i = 0; i < MUTEX_THREADS; ++i)
+		if (tids[i] >= 0) thr_join(tids[i], NULL);
+	unsigned long long elapsed = now() - start;
+
+	mutex_destroy(&bench_mutex);
+	if (shared_counter != mutex_rounds * MUTEX_THREADS) return 0;
+	return elapsed;
+}
+
+static volatile int malloc_rounds;
+
+static void *churn(void *arg) {
+	void *live[MALLOC_LIVE] = { NULL };
+	int i;
+	for (i = 0; i < malloc_rounds; ++i) {
+		free(live[i % MALLOC_LIVE]);
+		live[i % MALLOC_LIVE] = malloc(16 + (i % 8) * 32);
+		if (live[i % MALLOC_LIVE] == NULL) return (void *) -1;
+	}
+	for (i = 0; i < MALLOC_LIVE; ++i) free(live[i]);
+	return NULL;
+}
+
+static unsigned long long bench_malloc_threads(int iters) {
+	int tids[MALLOC_THREADS];
+	int i, ok = 1;
+
+	malloc_rounds = iters / MALLOC_THREADS;
+
+	unsigned long long start = now();
+	for (i = 0; i < MALLOC_THREADS; ++i) tids[i] = thr_create(churn, NULL);
+	for (i = 0; i < MALLOC_THREADS; ++i) {
+		void *status = NULL;
+		if (tids[i] < 0 || thr_join(tids[i], &status) < 0 || status != NULL)
+			ok = 0;
+	}
+	unsigned long long elapsed = now() - start;
+
+	return ok ? elapsed : 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Console
+ * --------------------------------------------------------------------- */
+
+static unsigned long long bench_print(int iters) {
+	char line[PRINT_LINE];
+	memset(line, '.', PRINT_LINE);
+
+	unsigned long long start = now();
+	int i;
+	for (i = 0; i < iters; ++i) print(PRINT_LINE, line);
+	return now() - start;
+}
+
+/* ------------------------------------------------------------------------
+ * Harness
+ * --------------------------------------------------------------------- */
+
+static const bench_t benches[] = {
+	{"syscall", "call", 10000, bench_syscall},
+	{"gettid", "call", 100000, bench_gettid},
+	{"fork", "fork+wait", 50, bench_fork},
+	{"fork_exec", "fork+exec+wait", 20, bench_fork_exec},
+	{"spawn", "spawn+wait", 20, bench_spawn},
+	{"zero_fill", "fault", BENCH_PAGES, bench_zero_fill},
+	{"cow", "fault", BENCH_PAGES, bench_cow},
+	{"lazy_fill", "fault", BENCH_PAGES, bench_lazy_fill},
+	{"new_pages", "new+remove", 100, bench_new_pages},
+	{"large_page", "4MB new+remove", 20, bench_large_page},
+	{"pipe_page", "page write+read", 1000, bench_pipe_page},
+	{"ping_pong", "round trip", 1000, bench_ping_pong},
+	{"ipc", "call+reply", 1000, bench_ipc},
+	{"thr_create", "create+join", 100, bench_thr_create},
+	{"thr_getid", "call", 100000, bench_thr_getid},
+	{"mutex", "lock+unlock", 4000, bench_mutex_contended},
+	{"malloc", "malloc+free", 20000, bench_malloc_threads},
+	{"print", "80 bytes", 200, bench_print},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/**
+ * @brief Runs a benchmark for all its rounds
+ */
+static void run(const bench_t *bench, result_t *result) {
+	unsigned int per_op[BENCH_ROUNDS];
+	int i, j;
+
+	result->bench = bench;
+	result->ok = 0;
+	if (bench->run(bench->iters) == 0) return;
+
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		unsigned long long ns = bench->run(bench->iters);
+		if (ns == 0) return;
+
+		// Insert the round in order
+		unsigned int op = div64(ns, bench->iters);
+		for (j = i; j > 0 && per_op[j - 1] > op; --j)
+			per_op[j] = per_op[j - 1];
+		per_op[j] = op;
+	}
+
+	result->ok = 1;
+	result->min = per_op[0];
+	result->median = per_op[BENCH_ROUNDS / 2];
+}
+
+/**
+ * @brief Prints the outcome of the benchmarks
+ */
+static void summary(result_t *results, int n) {
+	printf("\n%-12s %-16s %12s %12s %10s\n", "benchmark", "operation",
+			"min ns/op", "median ns/op", "ops/s");
+
+	int i;
+	for (i = 0; i < n; ++i) {
+		result_t *r = &results[i];
+		if (!r->ok) {
+			printf("%-12s %-16s %12s\n", r->bench->name, r->bench->op,
+					"FAILED");
+			continue;
+		}
+		unsigned int rate = r->median ? 1000000000u / r->median : 0;
+		printf("%-12s %-16s %12u %12u %10u\n", r->bench->name, r->bench->op,
+				r->min, r->median, rate);
+	}
+}
+
+static int selected(const char *name, int argc, char **argv) {
+	if (argc < 2) return 1;
+
+	int i;
+	for (i = 1; i < argc; ++i)
+		if (strcmp(argv[i], name) == 0) return 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	result_t results[NUM_BENCHES];
+	int n = 0;
+
+	thr_init(4096);
+
+	int i;
+	for (i = 0; i < NUM_BENCHES; ++i) {
+		if (!selected(benches[i].name, argc, argv)) continue;
+		run(&benches[i], &results[n++]);
+	}
+
+	summary(results, n);
+	return 0;
+}
@@ -0,0 +1,11 @@
+/**
+ * @file bench_nop.c
+ * @brief Exits right away, for the exec benchmarks of bench
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+int main(int argc, char **argv) {
+	return 0;
+}
@@ -0,0 +1,410 @@
+/**
+ * @file prof.c
+ * @brief Profiles a program with the sampling profiler of the kernel
+ *
+ * Usage: prof program [args...]
+ *
+ * Spawns the program with the profiler on, drains the samples while it runs
+ * and prints the functions it was caught in most often, in user mode and in
+ * the kernel. The user functions are found in the symbol table of the
+ * program, read from the RAM disk. The kernel functions are found in the
+ * file kernel.sym, the output of "nm -n" on the kernel, if it was built into
+ * the RAM disk; otherwise the kernel samples are grouped by address.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <syscall.h>
+#include <thread.h>
+
+/* Samples drained at a time */
+#define DRAIN_SAMPLES 256
+/* Ticks between two drains */
+#define DRAIN_PERIOD 10
+/* Functions printed */
+#define TOP_FUNCTIONS 30
+/* Kernel samples without symbols are grouped by blocks of this many bytes */
+#define KERNEL_BLOCK 256
+/* The file holding the kernel symbols */
+#define KERNEL_SYMBOLS "kernel.sym"
+
+/* What we need of the ELF format */
+#define ELF_MAGIC 0x464C457F
+#define SHT_SYMTAB 2
+#define STT_FUNC 2
+
+typedef struct {
+	unsigned int magic;
+	unsigned char ident[12];
+	unsigned short type, machine;
+	unsigned int version, entry, phoff, shoff, flags;
+	unsigned short ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+} elf_header_t;
+
+typedef struct {
+	unsigned int name, type, flags, addr, offset, size, link, info;
+	unsigned int addralign, entsize;
+} elf_section_t;
+
+typedef struct {
+	unsigned int name, value, size;
+	unsigned char info, other;
+	unsigned short shndx;
+} elf_symbol_t;
+
+/* A function, to which samples are charged */
+typedef struct {
+	unsigned int start;
+	unsigned int end;
+	const char *name;
+	int hits;
+} function_t;
+
+/* A symbol table, sorted by address */
+typedef struct {
+	function_t *functions;
+	int count;
+} symbols_t;
+
+/* The samples of the run, kept until it is over */
+static prof_sample_t *samples = NULL;
+static int num_samples = 0;
+static int max_samples = 0;
+static volatile int done = 0;
+
+/**
+ * @brief Reads a whole file from the RAM disk
+ *
+ * @param name the name of the file
+ * @param len where to put its length
+ * @return the contents, malloc()ed, NULL if the file can't be read
+ */
+static char *read_all(char *name, int *len) {
+	int size = 4096;
+	char *buf = NULL;
+	int got = 0;
+
+	for (;;) {
+		char *bigger = realloc(buf, size + 1);
+		if (bigger == NULL) {
+			free(buf);
+			return NULL;
+		}
+		buf = bigger;
+
+		int n = readfile(name, buf + got, size - got, got);
+		if (n < 0) {
+			free(buf);
+			return NULL;
+		}
+		got += n;
+		if (got < size) break;
+		size *= 2;
+	}
+
+	buf[got] = '\0';
+	*len = got;
+	return buf;
+}
+
+/**
+ * @brief Sorts functions by address, or by hits, the most first
+ *
+ * A shell sort, the tables have a few thousand functions at most.
+ */
+static void sort_functions(function_t *fns, int n, int by_hits) {
+	int gap, i, j;
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < n; ++i) {
+			function_t fn = fns[i];
+			for (j = i; j >= gap; j -= gap) {
+				function_t *prev = &fns[j - gap];
+				if (by_hits ? prev->hits >= fn.hits : prev->start <= fn.start)
+					break;
+				fns[j] = *prev;
+			}
+			fns[j] = fn;
+		}
+	}
+}
+
+/**
+ * @brief Parses an hexadecimal number, up to the first other character
+ */
+static unsigned int parse_hex(const char *s) {
+	unsigned int value = 0;
+	for (;; ++s) {
+		if (*s >= '0' && *s <= '9') value = value * 16 + *s - '0';
+		else if (*s >= 'a' && *s <= 'f') value = value * 16 + *s - 'a' + 10;
+		else if (*s >= 'A' && *s <= 'F') value = value * 16 + *s - 'A' + 10;
+		else return value;
+	}
+}
+
+/**
+ * @brief Sorts a symbol table, and makes each function end at the next one
+ * when its size is unknown
+ */
+static void sort_symbols(symbols_t *syms) {
+	sort_functions(syms->functions, syms->count, 0);
+
+	int i;
+	for (i = 0; i < syms->count; ++i) {
+		function_t *fn = &syms->functions[i];
+		if (fn->end > fn->start) continue;
+		fn->end = (i + 1 < syms->count) ? syms->functions[i + 1].start :
+				fn->start + 1;
+	}
+}
+
+/**
+ * @brief Loads the functions of an ELF program
+ * @return 0 on success, -1 if the program has no symbol table
+ */
+static int load_elf_symbols(char *program, symbols_t *syms) {
+	int len;
+	char *image = read_all(program, &len);
+	if (image == NULL) return -1;
+
+	elf_header_t *ehdr = (elf_header_t *) image;
+	if (len < sizeof(elf_header_t) || ehdr->magic != ELF_MAGIC ||
+			ehdr->shoff + ehdr->shnum * sizeof(elf_section_t) > len)
+		return -1;
+
+	elf_section_t *sections = (elf_section_t *) (image + ehdr->shoff);
+	int i;
+	for (i = 0; i < ehdr->shnum; ++i) {
+		elf_section_t *symtab = &sections[i];
+		if (symtab->type != SHT_SYMTAB || symtab->link >= ehdr->shnum)
+			continue;
+
+		elf_section_t *strtab = &sections[symtab->link];
+		if (symtab->offset + symtab->size > len ||
+				strtab->offset + strtab->size > len)
+			return -1;
+
+		elf_symbol_t *sym = (elf_symbol_t *) (image + symtab->offset);
+		int n = symtab->size / sizeof(elf_symbol_t);
+		syms->functions = calloc(n, sizeof(function_t));
+		if (syms->functions == NULL) return -1;
+
+		int j;
+		for (j = 0; j < n; ++j) {
+			if ((sym[j].info & 0xF) != STT_FUNC) continue;
+			if (sym[j].name >= strtab->size) continue;
+
+			function_t *fn = &syms->functions[syms->count++];
+			fn->start = sym[j].value;
+			fn->end = sym[j].value + sym[j].size;
+			fn->name = image + strtab->offset + sym[j].name;
+		}
+
+		sort_symbols(syms);
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Loads the text symbols of the kernel, listed by nm
+ * @return 0 on success, -1 if there is no such list
+ */
+static int load_kernel_symbols(symbols_t *syms) {
+	int len;
+	char *list = read_all(KERNEL_SYMBOLS, &len);
+	if (list == NULL) return -1;
+
+	int lines = 1;
+	int i;
+	for (i = 0; i < len; ++i) if (list[i] == '\n') lines++;
+
+	syms->functions = calloc(lines, sizeof(function_t));
+	if (syms->functions == NULL) return -1;
+
+	// Each line is "address type name"
+	char *line = list;
+	while (line < list + len) {
+		char *next = strchr(line, '\n');
+		if (next != NULL) *next = '\0';
+
+		char *type = strchr(line, ' ');
+		if (type != NULL && (type[1] == 'T' || type[1] == 't') &&
+				type[2] == ' ') {
+			function_t *fn = &syms->functions[syms->count++];
+			fn->start = parse_hex(line);
+			fn->end = 0;
+			fn->name = type + 3;
+		}
+
+		if (next == NULL) break;
+		line = next + 1;
+	}
+
+	sort_symbols(syms);
+	return 0;
+}
+
+/**
+ * @brief Returns the function holding an address, NULL if none does
+ */
+static function_t *lookup(symbols_t *syms, unsigned int addr) {
+	int low = 0, high = syms->count - 1;
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		function_t *fn = &syms->functions[mid];
+		if (addr < fn->start) high = mid - 1;
+		else if (addr >= fn->end) low = mid + 1;
+		else return fn;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Returns the block of kernel addresses holding an address, added to
+ * the table if it isn't there yet
+ *
+ * The table must have room for one more block, it is kept sorted.
+ */
+static function_t *lookup_block(symbols_t *syms, unsigned int addr) {
+	unsigned int block = addr & ~(KERNEL_BLOCK - 1);
+	function_t *fn = lookup(syms, block);
+	if (fn != NULL) return fn;
+
+	char *name = malloc(12);
+	if (name == NULL) return NULL;
+	sprintf(name, "0x%08x", block);
+
+	int i = syms->count++;
+	while (i > 0 && syms->functions[i - 1].start > block) {
+		syms->functions[i] = syms->functions[i - 1];
+		i--;
+	}
+
+	fn = &syms->functions[i];
+	fn->start = block;
+	fn->end = block + KERNEL_BLOCK;
+	fn->name = name;
+	fn->hits = 0;
+	return fn;
+}
+
+/**
+ * @brief Drains the samples of the kernel into our array
+ */
+static void drain(void) {
+	for (;;) {
+		if (num_samples + DRAIN_SAMPLES > max_samples) {
+			int max = max_samples ? 2 * max_samples : 4 * DRAIN_SAMPLES;
+			prof_sample_t *bigger = realloc(samples,
+					max * sizeof(prof_sample_t));
+			if (bigger == NULL) return;
+			samples = bigger;
+			max_samples = max;
+		}
+
+		int n = profile(PROF_DRAIN, samples + num_samples,
+				DRAIN_SAMPLES * sizeof(prof_sample_t));
+		if (n <= 0) return;
+		num_samples += n;
+	}
+}
+
+/**
+ * @brief Drains the samples until the program is over
+ */
+static void *drainer(void *arg) {
+	while (!done) {
+		drain();
+		sleep(DRAIN_PERIOD);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Prints the functions with the most hits
+ */
+static void report(const char *title, symbols_t *syms, int total) {
+	sort_functions(syms->functions, syms->count, 1);
+
+	printf("\n%s\n", title);
+	int i;
+	for (i = 0; i < syms->count && i < TOP_FUNCTIONS; ++i) {
+		function_t *fn = &syms->functions[i];
+		if (fn->hits == 0) break;
+		printf("%6d %3d%%  %s\n", fn->hits, fn->hits * 100 / total,
+				fn->name);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("usage: prof program [args...]\n");
+		return -1;
+	}
+
+	thr_init(4096);
+	profile(PROF_START, NULL, 0);
+
+	int pid = spawn(argv[1], &argv[1]);
+	if (pid < 0) {
+		profile(PROF_STOP, NULL, 0);
+		printf("prof: cannot run %s\n", argv[1]);
+		return -1;
+	}
+
+	int tid = thr_create(drainer, NULL);
+	int status;
+	while (wait(&status) != pid) continue;
+
+	int dropped = profile(PROF_STOP, NULL, 0);
+	done = 1;
+	if (tid >= 0) thr_join(tid, NULL);
+	drain();
+
+	symbols_t user = {NULL, 0}, kernel = {NULL, 0};
+	if (load_elf_symbols(argv[1], &user) < 0)
+		printf("prof: no symbols in %s\n", argv[1]);
+	int kernel_syms = load_kernel_symbols(&kernel) == 0;
+
+	// Without symbols the kernel samples go by blocks of addresses
+	if (!kernel_syms) kernel.functions = calloc(num_samples + 1,
+			sizeof(function_t));
+
+	int user_hits = 0, kernel_hits = 0, other_hits = 0, unknown = 0;
+	int i;
+	for (i = 0; i < num_samples; ++i) {
+		prof_sample_t *s = &samples[i];
+		function_t *fn = NULL;
+
+		if (!s->user) {
+			kernel_hits++;
+			if (kernel_syms) fn = lookup(&kernel, s->eip);
+			else if (kernel.functions != NULL)
+				fn = lookup_block(&kernel, s->eip);
+		} else if (s->pid == pid) {
+			user_hits++;
+			fn = lookup(&user, s->eip);
+		} else {
+			other_hits++;
+			continue;
+		}
+
+		if (fn != NULL) fn->hits++;
+		else unknown++;
+	}
+
+	printf("%d samples: %d in %s, %d in the kernel, %d elsewhere\n",
+			num_samples, user_hits, argv[1], kernel_hits, other_hits);
+	printf("%d dropped, %d outside any function\n", dropped, unknown);
+
+	if (user_hits > 0) report("In user mode:", &user, user_hits);
+	if (kernel_hits > 0) report("In the kernel:", &kernel, kernel_hits);
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file schedtrace.c
+ * @brief Replays the trace of the scheduler while a program runs
+ *
+ * Usage: schedtrace program [args...]
+ *
+ * Spawns the program with the trace of the scheduler on, drains the events
+ * while it runs, then replays them in the order of their timestamps. For
+ * every thread seen, it prints the time spent running, runnable, blocked,
+ * sleeping and waiting, and its run-queue latency: the time between being
+ * made runnable, or preempted, and running again. A histogram of the
+ * run-queue latencies of all the threads follows.
+ *
+ * @author Daniel Balle (dballe)
+ * @author Loic Ottet (lottet)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <syscall.h>
+#include <thread.h>
+
+/* Events drained at a time */
+#define DRAIN_EVENTS 512
+/* Ticks between two drains */
+#define DRAIN_PERIOD 5
+/* Buckets of the latency histogram, bucket i holds [2^i, 2^(i+1)) us */
+#define LATENCY_BUCKETS 20
+
+/* What a thread is doing, as far as the trace tells */
+enum {UNKNOWN, RUNNING, RUNNABLE, BLOCKED, SLEEPING, WAITING, DEAD, STATES};
+
+static const char *state_names[STATES] = {
+	"?", "run", "ready", "block", "sleep", "wait", "dead"
+};
+
+/* What we learn about a thread */
+typedef struct {
+	int tid;
+	int state;
+	unsigned long long since;               /* When it entered its state */
+	unsigned long long time[STATES];        /* Cycles spent in each state */
+	unsigned long long latency;             /* Run-queue latency, in all */
+	unsigned long long latency_max;
+	int runs;                               /* Times it was switched to */
+} thread_stats_t;
+
+/* The events of the run, kept until it is over */
+static sched_event_t *events = NULL;
+static int num_events = 0;
+static int max_events = 0;
+static volatile int done = 0;
+
+static thread_stats_t *threads = NULL;
+static int num_threads = 0;
+static int max_threads = 0;
+
+static unsigned int histogram[LATENCY_BUCKETS];
+static unsigned int khz;
+
+/**
+ * @brief Divides a 64 bits number by a 32 bits one, without the helpers of
+ * gcc
+ */
+static unsigned long long div64(unsigned long long n, unsigned int d) {
+	unsigned int high = n >> 32;
+	unsigned int low = n;
+	unsigned int qhigh = high / d;
+	high %= d;
+
+	unsigned int qlow, rem;
+	asm ("divl %4" : "=a" (qlow), "=d" (rem) : "a" (low), "d" (high),
+			"rm" (d));
+	return ((unsigned long long) qhigh << 32) | qlow;
+}
+
+/**
+ * @brief Converts TSC cycles to microseconds
+ */
+static unsigned int to_us(unsigned long long cycles) {
+	if (khz == 0) return 0;
+	return div64(cycles * 1000, khz);
+}
+
+/**
+ * @brief Drains the events of the kernel into our array
+ */
+static void drain(void) {
+	for (;;) {
+		if (num_events + DRAIN_EVENTS > max_events) {
+			int max = max_events ? 2 * max_events : 8 * DRAIN_EVENTS;
+			sched_event_t *bigger = realloc(events,
+					max * sizeof(sched_event_t));
+			if (bigger == NULL) return;
+			events = bigger;
+			max_events = max;
+		}
+
+		int n = sched_trace(SCHED_TRACE_DRAIN, events + num_events,
+				DRAIN_EVENTS * sizeof(sched_event_t));
+		if (n <= 0) return;
+		num_events += n;
+	}
+}
+
+/**
+ * @brief Drains the events until the program is over
+ */
+static void *drainer(void *arg) {
+	while (!done) {
+		drain();
+		sleep(DRAIN_PERIOD);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Sorts the events by timestamp
+ *
+ * Each CPU drains in order, so the array is made of a few sorted runs: an
+ * insertion sort does little work.
+ */
+static void sort_events(void) {
+	int i, j;
+	for (i = 1; i < num_events; ++i) {
+		sched_event_t ev = events[i];
+		for (j = i; j > 0 && events[j - 1].tsc > ev.tsc; --j)
+			events[j] = events[j - 1];
+		events[j] = ev;
+	}
+}
+
+/**
+ * @brief Returns the statistics of a thread, new ones if it wasn't seen
+ */
+static thread_stats_t *thread_of(int tid) {
+	int i;
+	for (i = 0; i < num_threads; ++i)
+		if (threads[i].tid == tid) return &threads[i];
+
+	if (num_threads == max_threads) {
+		int max = max_threads ? 2 * max_threads : 32;
+		thread_stats_t *bigger = realloc(threads,
+				max * sizeof(thread_stats_t));
+		if (bigger == NULL) return NULL;
+		threads = bigger;
+		max_threads = max;
+	}
+
+	thread_stats_t *t = &threads[num_threads++];
+	int state;
+	t->tid = tid;
+	t->state = UNKNOWN;
+	t->since = 0;
+	for (state = 0; state < STATES; ++state) t->time[state] = 0;
+	t->latency = 0;
+	t->latency_max = 0;
+	t->runs = 0;
+	return t;
+}
+
+/**
+ * @brief Moves a thread to another state at the given time
+ */
+static void enter(thread_stats_t *t, int state, unsigned long long now) {
+	if (t->state != UNKNOWN) t->time[t->state] += now - t->since;
+	t->state = state;
+	t->since = now;
+}
+
+/**
+ * @brief Replays a context switch
+ */
+static void replay_switch(sched_event_t *ev) {
+	thread_stats_t *out = thread_of(ev->tid);
+	thread_stats_t *in = thread_of(ev->other);
+	if (out == NULL || in == NULL) return;
+
+	int state;
+	switch (ev->reason) {
+	case SCHED_SWITCH_BLOCK: state = BLOCKED; break;
+	case SCHED_SWITCH_SLEEP: state = SLEEPING; break;
+	case SCHED_SWITCH_WAIT: state = WAITING; break;
+	case SCHED_SWITCH_VANISH: state = DEAD; break;
+	default: state = RUNNABLE; break;
+	}
+	enter(out, state, ev->tsc);
+
+	if (in->state == RUNNABLE) {
+		unsigned long long wait = ev->tsc - in->since;
+		in->latency += wait;
+		if (wait > in->latency_max) in->latency_max = wait;
+
+		unsigned int us = to_us(wait);
+		int bucket = 0;
+		while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+			us >>= 1;
+			bucket++;
+		}
+		histogram[bucket]++;
+	}
+	in->runs++;
+	enter(in, RUNNING, ev->tsc);
+}
+
+/**
+ * @brief Replays a wakeup
+ */
+static void replay_wakeup(sched_event_t *ev) {
+	thread_stats_t *t = thread_of(ev->tid);
+	if (t != NULL) enter(t, RUNNABLE, ev->tsc);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printf("usage: schedtrace program [args...]\n");
+		return -1;
+	}
+
+	thr_init(4096);
+	khz = sched_trace(SCHED_TRACE_RATE, NULL, 0);
+	sched_trace(SCHED_TRACE_START, NULL, 0);
+
+	int pid = spawn(argv[1], &argv[1]);
+	if (pid < 0) {
+		sched_trace(SCHED_TRACE_STOP, NULL, 0);
+		printf("schedtrace: cannot run %s\n", argv[1]);
+		return -1;
+	}
+
+	int tid = thr_create(drainer, NULL);
+	int status;
+	while (wait(&status) != pid) continue;
+
+	int dropped = sched_trace(SCHED_TRACE_STOP, NULL, 0);
+	done = 1;
+	if (tid >= 0) thr_join(tid, NULL);
+	drain();
+
+	sort_events();
+	int i;
+	for (i = 0; i < num_events; ++i) {
+		if (events[i].type == SCHED_EV_SWITCH) replay_switch(&events[i]);
+		else replay_wakeup(&events[i]);
+	}
+
+	printf("%d events, %d dropped, times in milliseconds\n", num_events,
+			dropped);
+	printf("  tid   runs    run  ready  block  sleep   wait"
+			"  lat avg us  lat max us\n");
+	for (i = 0; i < num_threads; ++i) {
+		thread_stats_t *t = &threads[i];
+		printf("%5d %6d", t->tid, t->runs);
+
+		int state;
+		for (state = RUNNING; state <= WAITING; ++state)
+			printf(" %6u", to_us(t->time[state]) / 1000);
+
+		unsigned int avg = t->runs ? to_us(t->latency) / t->runs : 0;
+		printf(" %11u %11u  %s\n", avg, to_us(t->latency_max),
+				state_names[t->state]);
+	}
+
+	printf("\nRun-queue latency:\n");
+	for (i = 0; i < LATENCY_BUCKETS; ++i) {
+		if (histogram[i] == 0) continue;
+		printf("  < %7u us: %u\n", 2u << i, histogram[i]);
+	}
+
+	return 0;
+}
@@ -1,24 +1,45 @@
 /** @file vqtest.c
  *  @brief A very simple test suite for variable queues.
  *
+ *  The pairing heaps and the multi-producer single-consumer queues are
+ *  tested as well, and benchmarked: the heaps against the sorted queues
+ *  they replace, the queues against a queue behind a mutex.
+ *
  *  @author Ryan Pearl <rpearl>
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "variable_queue.h"
 
 typedef struct node {
 	Q_NEW_LINK(node) link;
+	PH_NEW_LINK(node) heap;
+	MPSC_NEW_LINK(node) mpsc;
 	int data;
 } node_t;
 
 Q_NEW_HEAD(list_t, node);
+PH_NEW_HEAD(heap_t, node);
+MPSC_NEW_HEAD(mpsc_t, node);
 
 #define LIST_LEN 5
 
+#define NODE_LESS(a, b) ((a)->data < (b)->data)
+
+/* Elements of the heap tests, and of the benchmarks */
+#define HEAP_LEN 1000
+#define BENCH_LEN 100000
+#define BENCH_SORTED_LEN 10000
+
+/* Producers of the concurrent queue test, and what each of them pushes */
+#define PRODUCERS 4
+#define PRODUCED 100000
+
 void test_init() {
 	list_t list;
 
@@ -224,6 +245,217 @@ void test_insert_before() {
 	assert(!cur);
 }
 
+void test_heap_order() {
+	heap_t heap;
+	PH_INIT_HEAD(&heap);
+	assert(PH_EMPTY(&heap));
+
+	static node_t nodes[HEAP_LEN];
+	int i;
+	srand(410);
+	for (i = 0; i < HEAP_LEN; i++) {
+		nodes[i].data = rand() % (HEAP_LEN / 2);
+		PH_INSERT(&heap, &nodes[i], heap, NODE_LESS);
+	}
+
+	int last = -1;
+	for (i = 0; i < HEAP_LEN; i++) {
+		node_t *min;
+		PH_POP(&heap, min, heap, NODE_LESS);
+		assert(min);
+		assert(min->data >= last);
+		last = min->data;
+	}
+	assert(PH_EMPTY(&heap));
+}
+
+void test_heap_remove() {
+	heap_t heap;
+	PH_INIT_HEAD(&heap);
+
+	static node_t nodes[HEAP_LEN];
+	int i;
+	for (i = 0; i < HEAP_LEN; i++) {
+		nodes[i].data = (i * 7919) % HEAP_LEN;
+		PH_INSERT(&heap, &nodes[i], heap, NODE_LESS);
+	}
+
+	// Take a few out of the middle, once the heap has some shape
+	node_t *min;
+	PH_POP(&heap, min, heap, NODE_LESS);
+	assert(min->data == 0);
+	for (i = 0; i < HEAP_LEN; i += 3) {
+		if (&nodes[i] == min) continue;
+		PH_REMOVE(&heap, &nodes[i], heap, NODE_LESS);
+		nodes[i].data = -1;
+	}
+
+	int last = -1, left = 0;
+	while (!PH_EMPTY(&heap)) {
+		PH_POP(&heap, min, heap, NODE_LESS);
+		assert(min->data > last);
+		last = min->data;
+		left++;
+	}
+	// nodes[0] was the least, and popped instead of removed
+	assert(left == HEAP_LEN - (HEAP_LEN + 2) / 3);
+}
+
+void test_mpsc() {
+	mpsc_t q;
+	MPSC_INIT_HEAD(&q);
+	assert(MPSC_EMPTY(&q));
+
+	node_t nodes[LIST_LEN];
+	int i;
+	for (i = 0; i < LIST_LEN; i++) {
+		nodes[i].data = i;
+		MPSC_PUSH(&q, &nodes[i], mpsc);
+	}
+
+	// Pushes in the middle of a batch come after it
+	node_t *cur;
+	MPSC_POP(&q, cur, mpsc);
+	assert(cur == &nodes[0]);
+	MPSC_PUSH(&q, &nodes[0], mpsc);
+	for (i = 1; i < LIST_LEN; i++) {
+		MPSC_POP(&q, cur, mpsc);
+		assert(cur == &nodes[i]);
+	}
+	MPSC_POP(&q, cur, mpsc);
+	assert(cur == &nodes[0]);
+	MPSC_POP(&q, cur, mpsc);
+	assert(!cur);
+	assert(MPSC_EMPTY(&q));
+}
+
+static mpsc_t shared;
+static node_t produced[PRODUCERS][PRODUCED];
+
+static void *producer(void *arg) {
+	int id = (int) (long) arg;
+	int i;
+	for (i = 0; i < PRODUCED; i++) {
+		produced[id][i].data = id * PRODUCED + i;
+		MPSC_PUSH(&shared, &produced[id][i], mpsc);
+	}
+	return NULL;
+}
+
+void test_mpsc_concurrent() {
+	MPSC_INIT_HEAD(&shared);
+
+	pthread_t threads[PRODUCERS];
+	int i;
+	for (i = 0; i < PRODUCERS; i++)
+		assert(!pthread_create(&threads[i], NULL, producer, (void *) (long) i));
+
+	// Each producer's elements come out in the order it pushed them
+	int next[PRODUCERS] = { 0 };
+	int got = 0;
+	while (got < PRODUCERS * PRODUCED) {
+		node_t *cur;
+		MPSC_POP(&shared, cur, mpsc);
+		if (!cur) continue;
+		int id = cur->data / PRODUCED;
+		assert(cur->data % PRODUCED == next[id]);
+		next[id]++;
+		got++;
+	}
+
+	for (i = 0; i < PRODUCERS; i++) assert(!pthread_join(threads[i], NULL));
+	assert(MPSC_EMPTY(&shared));
+}
+
+/**
+ * @brief Returns the nanoseconds of CPU time used since start
+ */
+static double elapsed_ns(clock_t start) {
+	return (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC;
+}
+
+void bench_sorted_list() {
+	static node_t nodes[BENCH_SORTED_LEN];
+	list_t list;
+	Q_INIT_HEAD(&list);
+	srand(15410);
+
+	clock_t start = clock();
+	int i;
+	for (i = 0; i < BENCH_SORTED_LEN; i++) {
+		nodes[i].data = rand();
+		node_t *cur = Q_GET_TAIL(&list);
+		while (cur && cur->data > nodes[i].data) cur = Q_GET_PREV(cur, link);
+		if (cur) Q_INSERT_AFTER(&list, cur, &nodes[i], link);
+		else Q_INSERT_FRONT(&list, &nodes[i], link);
+	}
+	while (Q_GET_FRONT(&list)) Q_REMOVE(&list, Q_GET_FRONT(&list), link);
+
+	printf("%d elements, %.0f ns per insert and pop...",
+		BENCH_SORTED_LEN, elapsed_ns(start) / BENCH_SORTED_LEN);
+}
+
+void bench_heap() {
+	static node_t nodes[BENCH_LEN];
+	heap_t heap;
+	PH_INIT_HEAD(&heap);
+	srand(15410);
+
+	clock_t start = clock();
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) {
+		nodes[i].data = rand();
+		PH_INSERT(&heap, &nodes[i], heap, NODE_LESS);
+	}
+	while (!PH_EMPTY(&heap)) {
+		node_t *min;
+		PH_POP(&heap, min, heap, NODE_LESS);
+	}
+
+	printf("%d elements, %.0f ns per insert and pop...",
+		BENCH_LEN, elapsed_ns(start) / BENCH_LEN);
+}
+
+void bench_locked_queue() {
+	static node_t nodes[BENCH_LEN];
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	list_t list;
+	Q_INIT_HEAD(&list);
+
+	clock_t start = clock();
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) {
+		pthread_mutex_lock(&lock);
+		Q_INSERT_TAIL(&list, &nodes[i], link);
+		pthread_mutex_unlock(&lock);
+	}
+	for (i = 0; i < BENCH_LEN; i++) {
+		pthread_mutex_lock(&lock);
+		Q_REMOVE(&list, Q_GET_FRONT(&list), link);
+		pthread_mutex_unlock(&lock);
+	}
+
+	printf("%d elements, %.0f ns per push and pop...",
+		BENCH_LEN, elapsed_ns(start) / BENCH_LEN);
+}
+
+void bench_mpsc() {
+	static node_t nodes[BENCH_LEN];
+	mpsc_t q;
+	MPSC_INIT_HEAD(&q);
+
+	clock_t start = clock();
+	int i;
+	for (i = 0; i < BENCH_LEN; i++) MPSC_PUSH(&q, &nodes[i], mpsc);
+	for (i = 0; i < BENCH_LEN; i++) {
+		node_t *cur;
+		MPSC_POP(&q, cur, mpsc);
+	}
+
+	printf("%d elements, %.0f ns per push and pop...",
+		BENCH_LEN, elapsed_ns(start) / BENCH_LEN);
+}
+
 #define RUN_TEST(t) do {\
 	printf("Running "#t"()...");\
 	t();\
@@ -238,5 +470,13 @@ int main() {
 	RUN_TEST(test_insert_before);
 	RUN_TEST(test_insert_after);
 	RUN_TEST(test_remove);
+	RUN_TEST(test_heap_order);
+	RUN_TEST(test_heap_remove);
+	RUN_TEST(test_mpsc);
+	RUN_TEST(test_mpsc_concurrent);
+	RUN_TEST(bench_sorted_list);
+	RUN_TEST(bench_heap);
+	RUN_TEST(bench_locked_queue);
+	RUN_TEST(bench_mpsc);
 	return 0;
 }